@@ -0,0 +1,216 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "util.h"
+#include "nffile.h"
+#include "queue.h"
+#include "blockpipe.h"
+
+static void *PipeWorker(void *arg) {
+blockpipe_t		*bpipe = (blockpipe_t *)arg;
+pipe_block_t	*block;
+void			*worker_data;
+
+	worker_data = bpipe->init ? bpipe->init() : NULL;
+
+	while ( (block = queue_pop(bpipe->workQueue)) != QUEUE_CLOSED ) {
+		bpipe->worker(worker_data, block);
+
+		pthread_mutex_lock(&bpipe->mutex);
+		block->done = 1;
+		pthread_cond_broadcast(&bpipe->cond);
+		pthread_mutex_unlock(&bpipe->mutex);
+	}
+
+	if ( bpipe->dispose ) 
+		bpipe->dispose(worker_data);
+
+	return NULL;
+
+} // End of PipeWorker
+
+/*
+ * Start num_workers threads. Each block of the pipe gets a data block of block_size bytes
+ * and a private buffer of buff_size bytes, if buff_size is not 0. init and dispose may be NULL.
+ */
+blockpipe_t *StartBlockPipe(int num_workers, size_t block_size, size_t buff_size, 
+	pipe_init_t init, pipe_dispose_t dispose, pipe_worker_t worker, pipe_writer_t writer) {
+blockpipe_t *bpipe;
+int i, err;
+
+	bpipe = (blockpipe_t *)calloc(1, sizeof(blockpipe_t));
+	if ( !bpipe ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	bpipe->num_workers = num_workers;
+	bpipe->numBlocks	  = 2 * num_workers + 2;
+	bpipe->init		  = init;
+	bpipe->dispose	  = dispose;
+	bpipe->worker	  = worker;
+	bpipe->writer	  = writer;
+	bpipe->workQueue	  = queue_init(bpipe->numBlocks);
+	bpipe->blocks	  = (pipe_block_t *)calloc(bpipe->numBlocks, sizeof(pipe_block_t));
+	bpipe->tid		  = (pthread_t *)calloc(num_workers, sizeof(pthread_t));
+	if ( !bpipe->workQueue || !bpipe->blocks || !bpipe->tid ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	pthread_mutex_init(&bpipe->mutex, NULL);
+	pthread_cond_init(&bpipe->cond, NULL);
+
+	for ( i=0; i < bpipe->numBlocks; i++ ) {
+		bpipe->blocks[i].block_header = (data_block_header_t *)malloc(block_size);
+		bpipe->blocks[i].buff		 = buff_size ? malloc(buff_size) : NULL;
+		if ( !bpipe->blocks[i].block_header || (buff_size && !bpipe->blocks[i].buff) ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+	}
+
+	for ( i=0; i < num_workers; i++ ) {
+		err = pthread_create(&bpipe->tid[i], NULL, PipeWorker, (void *)bpipe);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err) );
+			exit(255);
+		}
+	}
+
+	return bpipe;
+
+} // End of StartBlockPipe
+
+/*
+ * Wait for the oldest block in flight and pass it to the writer
+ */
+static void WritePipeBlock(blockpipe_t *bpipe) {
+pipe_block_t *block = &bpipe->blocks[bpipe->head];
+
+	pthread_mutex_lock(&bpipe->mutex);
+	while ( !block->done ) 
+		pthread_cond_wait(&bpipe->cond, &bpipe->mutex);
+	pthread_mutex_unlock(&bpipe->mutex);
+
+	bpipe->writer(block);
+
+	bpipe->head = (bpipe->head + 1) % bpipe->numBlocks;
+	bpipe->inflight--;
+
+} // End of WritePipeBlock
+
+/*
+ * Get the next free block. If all blocks are in flight, the oldest one is written first
+ */
+pipe_block_t *NextPipeBlock(blockpipe_t *bpipe) {
+pipe_block_t *block;
+
+	if ( bpipe->inflight == bpipe->numBlocks ) 
+		WritePipeBlock(bpipe);
+
+	block = &bpipe->blocks[(bpipe->head + bpipe->inflight) % bpipe->numBlocks];
+	block->input  = NULL;
+	block->output = NULL;
+	block->size	  = 0;
+	block->type	  = 0;
+	block->error  = 0;
+	block->done	  = 0;
+	bpipe->inflight++;
+
+	return block;
+
+} // End of NextPipeBlock
+
+/*
+ * The last block returned by NextPipeBlock() is not used
+ */
+void ReturnPipeBlock(blockpipe_t *bpipe) {
+
+	bpipe->inflight--;
+
+} // End of ReturnPipeBlock
+
+/*
+ * Pass the block to the workers, if it needs processing - otherwise it is written in sequence
+ */
+void DispatchPipeBlock(blockpipe_t *bpipe, pipe_block_t *block, int process) {
+
+	if ( process ) {
+		queue_push(bpipe->workQueue, (void *)block);
+	} else {
+		// only the reader writes the blocks - no lock required
+		block->done = 1;
+	}
+
+} // End of DispatchPipeBlock
+
+/*
+ * Write all blocks in flight
+ */
+void FlushBlockPipe(blockpipe_t *bpipe) {
+
+	while ( bpipe->inflight ) 
+		WritePipeBlock(bpipe);
+
+} // End of FlushBlockPipe
+
+void StopBlockPipe(blockpipe_t *bpipe) {
+int i;
+
+	FlushBlockPipe(bpipe);
+
+	queue_close(bpipe->workQueue);
+	for ( i=0; i < bpipe->num_workers; i++ ) 
+		pthread_join(bpipe->tid[i], NULL);
+
+	for ( i=0; i < bpipe->numBlocks; i++ ) {
+		free(bpipe->blocks[i].block_header);
+		free(bpipe->blocks[i].buff);
+	}
+	queue_free(bpipe->workQueue);
+	pthread_mutex_destroy(&bpipe->mutex);
+	pthread_cond_destroy(&bpipe->cond);
+	free(bpipe->blocks);
+	free(bpipe->tid);
+	free(bpipe);
+
+} // End of StopBlockPipe
@@ -0,0 +1,106 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _BLOCKPIPE_H
+#define _BLOCKPIPE_H 1
+
+#include "config.h"
+
+#include <sys/types.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <pthread.h>
+
+#include "nffile.h"
+#include "queue.h"
+
+/*
+ * Ordered block pipeline
+ * The reader ( calling thread ) passes data blocks to a number of worker threads,
+ * which process the blocks in parallel. The processed blocks are passed to the 
+ * writer callback in the same sequence as they were dispatched, therefore the 
+ * output does not depend on the number of workers. The writer is called in the 
+ * context of the reader, whenever a new block is needed and all blocks are in 
+ * flight or the pipe is flushed. Blocks which need no processing - e.g. blocks 
+ * copied unchanged or markers - are passed to the writer in sequence as well.
+ */
+
+typedef struct pipe_block_s {
+	data_block_header_t	*block_header;	// data block - processed in place
+	void				*buff;			// private buffer of the block, if requested
+	size_t				size;			// used size of buff
+	void				*input;			// user data: e.g. the input file of the block
+	void				*output;		// user data: e.g. the output file of the block
+	int					type;			// user defined type of the block
+	int					error;
+	int					done;
+} pipe_block_t;
+
+// creates and frees the private data of a worker - e.g. a codec
+typedef void *(*pipe_init_t)(void);
+typedef void (*pipe_dispose_t)(void *worker_data);
+
+// processes a block in a worker thread
+typedef void (*pipe_worker_t)(void *worker_data, pipe_block_t *block);
+
+// writes a processed block in the context of the reader
+typedef void (*pipe_writer_t)(pipe_block_t *block);
+
+typedef struct blockpipe_s {
+	queue_t			*workQueue;		// blocks to process
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	pipe_block_t	*blocks;		// ring of blocks in flight
+	uint32_t		numBlocks;
+	uint32_t		head;			// oldest block in flight
+	uint32_t		inflight;		// number of blocks in flight
+	int				num_workers;
+	pthread_t		*tid;
+	pipe_init_t		init;
+	pipe_dispose_t	dispose;
+	pipe_worker_t	worker;
+	pipe_writer_t	writer;
+} blockpipe_t;
+
+blockpipe_t *StartBlockPipe(int num_workers, size_t block_size, size_t buff_size, 
+	pipe_init_t init, pipe_dispose_t dispose, pipe_worker_t worker, pipe_writer_t writer);
+
+pipe_block_t *NextPipeBlock(blockpipe_t *bpipe);
+
+void ReturnPipeBlock(blockpipe_t *bpipe);
+
+void DispatchPipeBlock(blockpipe_t *bpipe, pipe_block_t *block, int process);
+
+void FlushBlockPipe(blockpipe_t *bpipe);
+
+void StopBlockPipe(blockpipe_t *bpipe);
+
+#endif //_BLOCKPIPE_H
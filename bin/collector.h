@@ -167,7 +167,7 @@ int FlushInfoSampler(FlowSource_t *fs, sampler_info_record_t *sampler);
 
 int HasOptionTable(FlowSource_t *fs, uint16_t id );
 
-void launcher (char *commbuff, FlowSource_t *FlowSource, char *process, int expire);
+void launcher (char *commbuff, FlowSource_t *FlowSource, char *process, char *rollup, int expire);
 
 /* Default time window in seconds to rotate files */
 #define TIME_WINDOW	  	300
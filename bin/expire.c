@@ -44,6 +44,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/param.h>
 #include <sys/uio.h>
 #include <unistd.h>
 #include <signal.h>
@@ -276,11 +277,57 @@ static int compare(const FTSENT **f1, const FTSENT **f2) {
 	return strcmp( (*f1)->fts_name, (*f2)->fts_name);
 } // End of compare
 
+static int CatalogCompare(const void *r1, const void *r2) {
+const dircatalog_record_t *c1 = (const dircatalog_record_t *)r1;
+const dircatalog_record_t *c2 = (const dircatalog_record_t *)r2;
+
+	if ( c1->when == c2->when ) 
+		return strcmp(c1->path, c2->path);
+	return c1->when < c2->when ? -1 : 1;
+
+} // End of CatalogCompare
+
+/*
+ * Remove the now empty sub directories of an expired catalog file up to the data dir
+ */
+static void RemoveEmptyDirs(char *dir, char *relpath) {
+char path[MAXPATHLEN], *p;
+size_t len = strlen(dir);
+
+	snprintf(path, MAXPATHLEN-1, "%s/%s", dir, relpath);
+	path[MAXPATHLEN-1] = '\0';
+
+	while ( (p = strrchr(path, '/')) != NULL && (size_t)(p - path) > len ) {
+		*p = '\0';
+		// a directory, which is not empty, stops the loop
+		if ( rmdir(path) != 0 ) {
+			if ( errno != ENOTEMPTY && errno != EEXIST ) 
+				LogError( "rmdir() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			break;
+		}
+	}
+
+} // End of RemoveEmptyDirs
+
 void RescanDir(char *dir, dirstat_t *dirstat) {
 FTS 		*fts;
 FTSENT 		*ftsent;
 char *const path[] = { dir, NULL };
 char		first_timestring[16], last_timestring[16];
+dircatalog_record_t *catalog;
+uint64_t	max_records;
+size_t		dirlen;
+int			catalog_ok;
+
+	// collect all files for the catalog
+	dirlen		= strlen(dir);
+	max_records = 1024;
+	catalog_ok	= 1;
+	catalog = (dircatalog_record_t *)malloc(max_records * sizeof(dircatalog_record_t));
+	if ( !catalog ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		catalog_ok = 0;
+	}
 
 	dirstat->filesize = dirstat->numfiles = 0;
 	dirstat->first = 0;
@@ -291,6 +338,7 @@ char		first_timestring[16], last_timestring[16];
 	fts = fts_open(path, FTS_LOGICAL,  compare);
 	if ( !fts ) {
 		LogError( "fts_open() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		free(catalog);
 		return;
 	}
 	while ( (ftsent = fts_read(fts)) != NULL) {
@@ -319,6 +367,32 @@ char		first_timestring[16], last_timestring[16];
 					strncat(last_timestring, p, 15);
 				}
 
+				if ( catalog_ok ) {
+					char *relpath = ftsent->fts_path + dirlen;
+					while ( *relpath == '/' )
+						relpath++;
+					if ( strlen(relpath) >= CATALOG_PATHLEN ) {
+						LogError( "Path '%s' too long for catalog. Catalog not created.\n", relpath );
+						catalog_ok = 0;
+					} else {
+						if ( dirstat->numfiles == max_records ) {
+							max_records *= 2;
+							catalog = (dircatalog_record_t *)realloc(catalog, max_records * sizeof(dircatalog_record_t));
+							if ( !catalog ) {
+								LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+								catalog_ok = 0;
+							}
+						}
+					}
+					if ( catalog_ok ) {
+						dircatalog_record_t *record = &catalog[dirstat->numfiles];
+						memset((void *)record, 0, sizeof(dircatalog_record_t));
+						record->when = ISO2UNIX(p);
+						record->size = 512 * ftsent->fts_statp->st_blocks;
+						strncpy(record->path, relpath, CATALOG_PATHLEN-1);
+					}
+				}
+
 				dirstat->filesize += 512 * ftsent->fts_statp->st_blocks;
 				dirstat->numfiles++;
 			}
@@ -339,6 +413,13 @@ char		first_timestring[16], last_timestring[16];
 	}
 	fts_close(fts);
 
+	// replace the catalog of this directory
+	if ( catalog_ok ) {
+		qsort((void *)catalog, dirstat->numfiles, sizeof(dircatalog_record_t), CatalogCompare);
+		WriteCatalog(dir, catalog, dirstat->numfiles);
+	}
+	free(catalog);
+
 	// no files means do rebuild next time, otherwise the stat record may not be accurate 
 	if ( dirstat->numfiles == 0 ) {
 		dirstat->first  = dirstat->last = time(NULL);
@@ -351,9 +432,66 @@ char		first_timestring[16], last_timestring[16];
 
 } // End of RescanDir
 
+/*
+ * Expire the files of a directory in time order from its catalog
+ * returns the number of expired files. done is set, if the limits are reached
+ */
+static uint64_t ExpireCatalog(dircatalog_t *catalog, char *dir, dirstat_t *dirstat, int *done, 
+	int size_done, int lifetime_done, uint64_t sizelimit, time_t t_limit) {
+dircatalog_record_t *record;
+char		filename[MAXPATHLEN];
+uint64_t	num_expired;
+int			expire;
+
+	num_expired = 0;
+	while ( !*done && (record = NextCatalogRecord(catalog)) != NULL ) {
+		expire = 0;
+
+		// expire size-wise if needed
+		if ( !size_done ) {
+			if ( dirstat->filesize > sizelimit ) {
+				expire = 1;
+			} else {
+				dirstat->first = record->when;	// time of first file not expired
+				size_done = 1;
+			}
+		}
+
+		// expire time-wise if needed
+		// this part of the code is executed only when size-wise is fullfilled
+		if ( !expire && !lifetime_done ) {
+			if ( record->when < t_limit ) {
+				expire = 1;
+			} else {
+				dirstat->first = record->when;	// time of first file not expired
+				lifetime_done = 1;
+			}
+		}
+
+		if ( expire ) {
+			snprintf(filename, MAXPATHLEN-1, "%s/%s", dir, record->path);
+			filename[MAXPATHLEN-1] = '\0';
+			// a file already removed is expired as well
+			if ( unlink(filename) == 0 || errno == ENOENT ) {
+				dirstat->filesize = dirstat->filesize > record->size ? dirstat->filesize - record->size : 0;
+				num_expired++;
+				ExpireCatalogRecord(catalog);
+				RemoveEmptyDirs(dir, record->path);
+			} else {
+				LogError( "unlink() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			}
+		}
+		*done = (size_done && lifetime_done) || timeout;
+	}
+
+	return num_expired;
+
+} // End of ExpireCatalog
+
 void ExpireDir(char *dir, dirstat_t *dirstat, uint64_t maxsize, uint64_t maxlife, uint32_t runtime ) {
 FTS 		*fts;
 FTSENT 		*ftsent;
+dircatalog_t	*catalog;
 uint64_t	sizelimit, num_expired;
 int			done, size_done, lifetime_done, dir_files;
 char *const path[] = { dir, NULL };
@@ -415,8 +553,17 @@ time_t 		now = time(NULL);
 	lifetime_done = maxlife == 0 || ( now - dirstat->first ) < maxlife;
 	sizelimit = (dirstat->low_water * maxsize)/100;
 	num_expired = 0;
-	fts = fts_open(path, FTS_LOGICAL,  compare);
-	while ( !done && ((ftsent = fts_read(fts)) != NULL) ) {
+
+	// use the catalog if available, otherwise scan the directory
+	fts = NULL;
+	catalog = OpenCatalog(dir);
+	if ( catalog ) {
+		time_t t_limit = expire_timelimit ? ISO2UNIX(expire_timelimit) : 0;
+		num_expired = ExpireCatalog(catalog, dir, dirstat, &done, size_done, lifetime_done, sizelimit, t_limit);
+		CloseCatalog(catalog);
+	} else 
+		fts = fts_open(path, FTS_LOGICAL,  compare);
+	while ( fts && !done && ((ftsent = fts_read(fts)) != NULL) ) {
 		if ( ftsent->fts_info == FTS_F ) {
 			dir_files++;	// count files in directories
 			if ( ftsent->fts_namelen == 19 && strncmp(ftsent->fts_name, "nfcapd.", 7) == 0 ) {
@@ -498,7 +645,8 @@ time_t 		now = time(NULL);
 			}
 		}
 	}
-	fts_close(fts);
+	if ( fts )
+		fts_close(fts);
 	if ( !done ) {
 		// all files expired and limits not reached
 		// this may be possible, when files get time-wise expired and
@@ -595,6 +743,148 @@ channel_t *current_channel = channel;
 
 } // End of PrepareDirLists
 
+/*
+ * Open the catalogs of all channels and get the oldest file of each channel.
+ * returns 0, if any channel has no catalog
+ */
+static int PrepareCatalogs(channel_t *channel) {
+channel_t *current_channel;
+
+	for ( current_channel = channel; current_channel; current_channel = current_channel->next ) {
+		current_channel->catalog = OpenCatalog(current_channel->datadir);
+		if ( !current_channel->catalog ) {
+			// close all catalogs and scan the directories
+			for ( current_channel = channel; current_channel && current_channel->catalog; current_channel = current_channel->next ) {
+				CloseCatalog(current_channel->catalog);
+				current_channel->catalog = NULL;
+			}
+			return 0;
+		}
+		current_channel->record = NextCatalogRecord(current_channel->catalog);
+	}
+
+	return 1;
+
+} // End of PrepareCatalogs
+
+/*
+ * Expire the current catalog file of a channel and get the next one
+ * returns 1, if the file got removed
+ */
+static int ExpireChannelFile(channel_t *channel, dirstat_t *current_stat) {
+dircatalog_record_t *record = channel->record;
+char filename[MAXPATHLEN];
+int removed;
+
+	snprintf(filename, MAXPATHLEN-1, "%s/%s", channel->datadir, record->path);
+	filename[MAXPATHLEN-1] = '\0';
+
+	// a file already removed is expired as well
+	removed = 0;
+	if ( unlink(filename) == 0 || errno == ENOENT ) {
+		// Update profile stat
+		current_stat->filesize = current_stat->filesize > record->size ? current_stat->filesize - record->size : 0;
+		current_stat->numfiles--;
+
+		// Update channel stat
+		channel->dirstat->filesize = channel->dirstat->filesize > record->size ? channel->dirstat->filesize - record->size : 0;
+		channel->dirstat->numfiles--;
+
+		ExpireCatalogRecord(channel->catalog);
+		RemoveEmptyDirs(channel->datadir, record->path);
+		removed = 1;
+	} else {
+		LogError( "unlink() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+	}
+
+	// advance to next file in any case
+	channel->record = NextCatalogRecord(channel->catalog);
+	if ( channel->record ) 
+		// next file is first (oldest) for channel and for profile - update first mark
+		channel->dirstat->first = current_stat->first = channel->record->when;	
+
+	return removed;
+
+} // End of ExpireChannelFile
+
+static void ExpireProfileCatalog(channel_t *channel, dirstat_t *current_stat, int size_done, int lifetime_done,
+	uint64_t sizelimit, time_t t_limit) {
+int  		done;
+channel_t	*current_channel;
+
+	done = 0;
+	while ( !done ) {
+		// search for the channel with oldest file. If all channel have same age, 
+		// get the last in the list
+		channel_t *expire_channel  = channel;
+		channel_t *compare_channel = expire_channel->next;
+		while ( compare_channel ) {
+			if ( expire_channel->record == NULL ) {
+				expire_channel = compare_channel;
+			}
+			if ( compare_channel->record == NULL ) {
+				compare_channel = compare_channel->next;
+				continue;
+			}
+			if ( expire_channel->record->when >= compare_channel->record->when ) {
+				expire_channel = compare_channel;
+			}
+			compare_channel = compare_channel->next;
+		}
+		if ( !expire_channel->record ) {
+			// no more entries in any channel - we are done
+			done = 1;
+			continue;
+		}
+
+		if ( !size_done ) {
+			// expire size-wise if needed
+			if ( current_stat->filesize > sizelimit ) {
+				ExpireChannelFile(expire_channel, current_stat);
+			} else {
+				// we are done size-wise
+				// time of first file not expired = start time of channel/profile
+				expire_channel->dirstat->first = current_stat->first = expire_channel->record->when;	
+				size_done = 1;
+			}
+		} else if ( !lifetime_done ) {
+			// expire time-wise if needed
+			// this part of the code is executed only when size-wise is already fullfilled
+			if ( expire_channel->record->when < t_limit ) {
+				ExpireChannelFile(expire_channel, current_stat);
+			} else {
+				// we are done time-wise
+				// time of first file not expired = start time of channel/profile
+				expire_channel->dirstat->first = current_stat->first = expire_channel->record->when;	
+				lifetime_done = 1;
+			}
+		} else 
+			// all done
+			done = 1;
+		if ( timeout ) 
+			done = 1;
+
+		if ( expire_channel->record == NULL ) {
+			// this channel has no more files now
+			expire_channel->dirstat->first 			= expire_channel->dirstat->last;
+			if ( expire_channel->dirstat->numfiles ) {	
+				// if channel is empty, no files must be reported, but rebuild is done anyway
+				LogError( "Inconsitency detected in channel %s. Will rebuild automatically.\n", expire_channel->datadir);
+				LogError( "No more files found, but %llu expected.\n", expire_channel->dirstat->numfiles);
+			}
+			expire_channel->dirstat->numfiles 	= 0;
+			expire_channel->dirstat->status		= FORCE_REBUILD;
+		}
+	} // while ( !done )
+
+	for ( current_channel = channel; current_channel; current_channel = current_channel->next ) {
+		CloseCatalog(current_channel->catalog);
+		current_channel->catalog = NULL;
+		current_channel->record  = NULL;
+	}
+
+} // End of ExpireProfileCatalog
+
 void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize, uint64_t maxlife, uint32_t runtime ) {
 int  		size_done, lifetime_done, done;
 char 		*expire_timelimit = "";
@@ -625,6 +915,20 @@ uint64_t	sizelimit, num_expired;
 
 	num_expired = 0;
 
+	// use the catalogs if all channels have one
+	if ( PrepareCatalogs(channel) ) {
+		if ( runtime )
+			alarm(runtime);
+		ExpireProfileCatalog(channel, current_stat, size_done, lifetime_done, sizelimit, 
+			maxlife ? ISO2UNIX(expire_timelimit) : 0);
+		if ( runtime )
+			alarm(0);
+		if ( timeout ) {
+			LogError( "Maximum execution time reached! Interrupt expire.\n");
+		}
+		return;
+	}
+
 	PrepareDirLists(channel);
 	if ( runtime )
 		alarm(runtime);
@@ -60,6 +60,8 @@ typedef struct channel_s {
 	int					status;
 	FTS 				*fts;
 	FTSENT 				*ftsent;
+	dircatalog_t			*catalog;
+	dircatalog_record_t	*record;		// oldest not expired file in catalog
 } channel_t;
 
 enum { OK = 0, NOFILES };
@@ -30,6 +30,7 @@
  *  
  */
 
+
 /*
  * TODO:
  * Unfortunately, the Apache Avro format only supports signed integer values,
@@ -54,6 +55,7 @@
 #include <time.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -61,7 +63,9 @@
 
 #include "nffile.h"
 #include "util.h"
+#include "queue.h"
 #include "nf_common.h"
+#include "output_util.h"
 #include "export_avro.h"
 
 #ifdef NSEL
@@ -73,32 +77,122 @@
  * which has the best compression vs. speed performance of the codecs
  * supported by the library. If snappy is not available, we will fall
  * back to the gzip codec, which is about 3 times slower, but compresses
- * about 35% better.
+ * about 35% better. Another codec may be selected by prefixing the
+ * output filename with the codec name, e.g. deflate:flows.avro
  */
 #define DEFAULT_AVRO_CODEC	"snappy"
 #define FALLBACK_AVRO_CODEC	"deflate"
 
+static const char *avro_codecs[] = { "null", "deflate", "snappy", "lzma", NULL };
+
 /*
- * The Avro writer block size; you may need to increase this if
- * the writer fails to write records with the following error
- * message:
+ * The Avro writer block size. Each block is compressed as a whole, so
+ * larger blocks compress better and need less codec calls. You may need 
+ * to increase this if the writer fails to write records with the 
+ * following error message:
  *
  * "Value too large for file block size"
  */
-#define AVRO_BLOCKSIZE		65536
+#define AVRO_BLOCKSIZE		(1024 * 1024)
+
+/*
+ * Records are handed over to the writer thread in batches of AVRO_BATCHSIZE
+ * records. AVRO_NUMBATCHES batches circulate between process_data and the
+ * writer thread.
+ */
+#define AVRO_BATCHSIZE		1024
+#define AVRO_NUMBATCHES		8
 
 /* Include the Avro schema */
 #include "flowdata_avsc.inc"
 
+/*
+ * All fields of the extended schema. The index of each field in the record
+ * is resolved once in init_avro_export(), so a record is filled without any
+ * lookup by name. Fields not in the schema in use get the index -1.
+ */
+enum
+{
+	F_TYPE = 0, F_SAMPLED, F_START_TS, F_END_TS, F_EXPORT_SYSID, F_PROTOCOL,
+	F_SRC_V4_STR, F_SRC_V4_INT, F_SRC_V6_STR, F_SRC_V6_INT_HI, F_SRC_V6_INT_LO,
+	F_DST_V4_STR, F_DST_V4_INT, F_DST_V6_STR, F_DST_V6_INT_HI, F_DST_V6_INT_LO,
+	F_SRC_PORT, F_DST_PORT, F_ICMP_TYPE, F_ICMP_CODE, F_FWD_STATUS, F_TCP_FLAGS,
+	F_SRC_TOS, F_IN_PACKETS, F_IN_BYTES, F_INPUT_SNMP, F_OUTPUT_SNMP, F_SRC_AS,
+	F_DST_AS, F_NEXT_AS, F_PREV_AS, F_SRC_MASK, F_DST_MASK, F_DST_TOS, F_DIRECTION,
+	F_IP4_NEXT_HOP_STR, F_IP6_NEXT_HOP_STR, F_BGP4_NEXT_HOP_STR, F_BGP6_NEXT_HOP_STR,
+	F_SRC_VLAN, F_DST_VLAN, F_OUT_PACKETS, F_OUT_BYTES, F_AGGR_FLOWS,
+	F_IN_SRC_MAC_STR, F_OUT_DST_MAC_STR, F_IN_DST_MAC_STR, F_OUT_SRC_MAC_STR,
+	F_MPLS_LABEL_01, F_MPLS_LABEL_02, F_MPLS_LABEL_03, F_MPLS_LABEL_04, F_MPLS_LABEL_05,
+	F_MPLS_LABEL_06, F_MPLS_LABEL_07, F_MPLS_LABEL_08, F_MPLS_LABEL_09, F_MPLS_LABEL_10,
+	F_IP4_ROUTER_STR, F_IP6_ROUTER_STR, F_CLI_LATENCY, F_SRV_LATENCY, F_APP_LATENCY,
+	F_ENGINE_TYPE, F_ENGINE_ID, F_T_RECEIVED, F_LABEL,
+	F_NUMFIELDS
+};
+
+static const char *field_name[F_NUMFIELDS] =
+{
+	"type", "sampled", "start_ts", "end_ts", "export_sysid", "protocol",
+	"src_v4_str", "src_v4_int", "src_v6_str", "src_v6_int_hi", "src_v6_int_lo",
+	"dst_v4_str", "dst_v4_int", "dst_v6_str", "dst_v6_int_hi", "dst_v6_int_lo",
+	"src_port", "dst_port", "icmp_type", "icmp_code", "fwd_status", "tcp_flags",
+	"src_tos", "in_packets", "in_bytes", "input_snmp", "output_snmp", "src_as",
+	"dst_as", "next_as", "prev_as", "src_mask", "dst_mask", "dst_tos", "direction",
+	"ip4_next_hop_str", "ip6_next_hop_str", "bgp4_next_hop_str", "bgp6_next_hop_str",
+	"src_vlan", "dst_vlan", "out_packets", "out_bytes", "aggr_flows",
+	"in_src_mac_str", "out_dst_mac_str", "in_dst_mac_str", "out_src_mac_str",
+	"mpls_label_01", "mpls_label_02", "mpls_label_03", "mpls_label_04", "mpls_label_05",
+	"mpls_label_06", "mpls_label_07", "mpls_label_08", "mpls_label_09", "mpls_label_10",
+	"ip4_router_str", "ip6_router_str", "cli_latency", "srv_latency", "app_latency",
+	"engine_type", "engine_id", "t_received", "label"
+};
+
+static int			field_index[F_NUMFIELDS];
+
+/* optional fields set in the current record, which need to be reset to null for the next one */
+static int			union_set[F_NUMFIELDS];
+static int			num_union_set;
+
+/* flow record copy handed over to the writer thread */
+#define AVRO_MAXEXT	64
+
+typedef struct avro_flow_s
+{
+	master_record_t	record;
+	uint16_t	ex_id[AVRO_MAXEXT];	// copy of the extension list, 0 terminated
+} avro_flow_t;
+
+typedef struct avro_batch_s
+{
+	uint32_t	num_flows;
+	avro_flow_t	flow[AVRO_BATCHSIZE];
+} avro_batch_t;
+
 static avro_schema_t            flowavro_schema;
 static avro_file_writer_t       flowavro_writer;
 static avro_value_iface_t*      flowavro_class;
 static avro_value_t             flowavro_single_record;
 
-static int open_avro_file(const char *output_filename)
+static queue_t			*free_batches;
+static queue_t			*full_batches;
+static avro_batch_t		*current_batch;
+static pthread_t		writer_thread;
+static int			writer_running	= 0;
+
+static int open_avro_file(const char *output_filename, const char *codec)
 {
 	memset(&flowavro_writer, 0, sizeof(avro_file_writer_t));
 
+	if (codec != NULL)
+	{
+		if (avro_file_writer_create_with_codec(output_filename, flowavro_schema, &flowavro_writer, codec, AVRO_BLOCKSIZE) != 0)
+		{
+			LogError("avro_file_writer_create_with_codec(%s) failed: %s", codec, avro_strerror());
+			return -1;
+		}
+
+		return 0;
+	}
+
 	if ((avro_file_writer_create_with_codec(output_filename, flowavro_schema, &flowavro_writer, DEFAULT_AVRO_CODEC, AVRO_BLOCKSIZE) != 0) && (avro_file_writer_create_with_codec(output_filename, flowavro_schema, &flowavro_writer, FALLBACK_AVRO_CODEC, AVRO_BLOCKSIZE) != 0))
 	{
 		return -1;
@@ -112,47 +206,16 @@ static void finish_avro_file(void)
 	avro_file_writer_close(flowavro_writer);
 }
 
-int init_avro_export(const char *output_filename)
-{
-	/* Load the Avro schema */
-	memset(&flowavro_schema, 0, sizeof(flowavro_schema));
-
-#ifdef HAVE_EXTENDED_AVRO
-	if (avro_schema_from_json_length((const char*) flowdata_extended_avsc, flowdata_extended_avsc_len, &flowavro_schema) != 0)
-#else
-	if (avro_schema_from_json_length((const char*) flowdata_avsc, flowdata_avsc_len, &flowavro_schema) != 0)
-#endif
-	{
-		return -1;
-	}
-
-	/*
-	 * Instantiate a single instance of the schema. We will re-use a
-	 * single record instance for the writer, as suggested in section 4
-	 * of the libavro documentation.
-	 */
-	flowavro_class = avro_generic_class_from_schema(flowavro_schema);
-
-	if (flowavro_class == NULL)
-	{
-		return -1;
-	}
-
-	if (avro_generic_value_new(flowavro_class, &flowavro_single_record) != 0)
-	{
-		return -1;
-	}
-
-	return open_avro_file(output_filename);
-}
-
-/* Wipe the single Avro record instance we re-use */
-static void wipe_avro_record(void)
+/*
+ * Set all optional fields of the single Avro record instance to null. This
+ * is done once; afterwards only the optional fields set by a record are
+ * reset before the next record is filled.
+ */
+static void null_avro_record(void)
 {
 	size_t	field_ct	= 0;
 	size_t	i		= 0;
 
-	assert(avro_value_reset(&flowavro_single_record) == 0);
 	assert(avro_value_get_size(&flowavro_single_record, &field_ct) == 0);
 
 	for (i = 0; i < field_ct; i++)
@@ -180,6 +243,26 @@ static void wipe_avro_record(void)
 
 		assert(avro_value_set_null(&rec_branch) == 0);
 	}
+
+	num_union_set = 0;
+}
+
+/* Reset the optional fields of the previous record to null */
+static void wipe_avro_record(void)
+{
+	int	i;
+
+	for (i = 0; i < num_union_set; i++)
+	{
+		avro_value_t	rec_field;
+		avro_value_t	rec_branch;
+
+		assert(avro_value_get_by_index(&flowavro_single_record, field_index[union_set[i]], &rec_field, NULL) == 0);
+		assert(avro_value_set_branch(&rec_field, 0, &rec_branch) == 0);
+		assert(avro_value_set_null(&rec_branch) == 0);
+	}
+
+	num_union_set = 0;
 }
 
 /*
@@ -192,101 +275,89 @@ static void wipe_avro_record(void)
  *
  * Also: there are two versions of each setter function, one that sets a value
  * in a fixed field, and one that sets a value in an optional field (an Avro
- * union).
+ * union). The union versions remember the field, so it is reset for the next
+ * record.
  */
-static void avro_set_long_field(const char *fieldname, long long value)
+static inline void avro_get_field(int field, avro_value_t *rec_field)
 {
-	avro_value_t	rec_field;
-
-	assert(avro_value_get_by_name(&flowavro_single_record, fieldname, &rec_field, NULL) == 0);
-	assert(avro_value_set_long(&rec_field, value) == 0);
+	assert(field_index[field] >= 0);
+	assert(avro_value_get_by_index(&flowavro_single_record, field_index[field], rec_field, NULL) == 0);
 }
 
-static void avro_set_long_union(const char *fieldname, long long value)
+static inline void avro_get_branch(int field, avro_value_t *rec_branch)
 {
 	avro_value_t	rec_field;
-	avro_value_t	rec_branch;
 
-	assert(avro_value_get_by_name(&flowavro_single_record, fieldname, &rec_field, NULL) == 0);
-	assert(avro_value_set_branch(&rec_field, 1, &rec_branch) == 0);
-	assert(avro_value_set_long(&rec_branch, value) == 0);
+	avro_get_field(field, &rec_field);
+	assert(avro_value_set_branch(&rec_field, 1, rec_branch) == 0);
+	union_set[num_union_set++] = field;
 }
 
-static void avro_set_int_field(const char *fieldname, int value)
+static void avro_set_long_field(int field, long long value)
 {
 	avro_value_t	rec_field;
 
-	assert(avro_value_get_by_name(&flowavro_single_record, fieldname, &rec_field, NULL) == 0);
-	assert(avro_value_set_int(&rec_field, value) == 0);
+	avro_get_field(field, &rec_field);
+	assert(avro_value_set_long(&rec_field, value) == 0);
 }
 
-static void avro_set_int_union(const char *fieldname, int value)
+#ifdef HAVE_EXTENDED_AVRO
+static void avro_set_long_union(int field, long long value)
 {
-	avro_value_t	rec_field;
 	avro_value_t	rec_branch;
 
-	assert(avro_value_get_by_name(&flowavro_single_record, fieldname, &rec_field, NULL) == 0);
-	assert(avro_value_set_branch(&rec_field, 1, &rec_branch) == 0);
-	assert(avro_value_set_int(&rec_branch, value) == 0);
+	avro_get_branch(field, &rec_branch);
+	assert(avro_value_set_long(&rec_branch, value) == 0);
 }
+#endif
 
-static void avro_set_boolean_field(const char *fieldname, int value)
+static void avro_set_int_field(int field, int value)
 {
 	avro_value_t	rec_field;
 
-	assert(avro_value_get_by_name(&flowavro_single_record, fieldname, &rec_field, NULL) == 0);
-	assert(avro_value_set_boolean(&rec_field, value) == 0);
+	avro_get_field(field, &rec_field);
+	assert(avro_value_set_int(&rec_field, value) == 0);
 }
 
-/*
- * CURRENTLY UNUSED, BUT MAY BE NEEDED IN THE FUTURE
-static void avro_set_boolean_union(const char *fieldname, int value)
+static void avro_set_int_union(int field, int value)
 {
-	avro_value_t	rec_field;
 	avro_value_t	rec_branch;
 
-	assert(avro_value_get_by_name(&flowavro_single_record, fieldname, &rec_field, NULL) == 0);
-	assert(avro_value_set_branch(&rec_field, 1, &rec_branch) == 0);
-	assert(avro_value_set_boolean(&rec_branch, value) == 0);
+	avro_get_branch(field, &rec_branch);
+	assert(avro_value_set_int(&rec_branch, value) == 0);
 }
- */
 
-/*
- * CURRENTLY UNUSED, BUT MAY BE NEEDED IN THE FUTURE
-static void avro_set_double_field(const char *fieldname, double value)
+static void avro_set_boolean_field(int field, int value)
 {
 	avro_value_t	rec_field;
 
-	assert(avro_value_get_by_name(&flowavro_single_record, fieldname, &rec_field, NULL) == 0);
-	assert(avro_value_set_double(&rec_field, value) == 0);
+	avro_get_field(field, &rec_field);
+	assert(avro_value_set_boolean(&rec_field, value) == 0);
 }
- */
 
-static void avro_set_double_union(const char *fieldname, double value)
+#ifdef HAVE_EXTENDED_AVRO
+static void avro_set_double_union(int field, double value)
 {
-	avro_value_t	rec_field;
 	avro_value_t	rec_branch;
 
-	assert(avro_value_get_by_name(&flowavro_single_record, fieldname, &rec_field, NULL) == 0);
-	assert(avro_value_set_branch(&rec_field, 1, &rec_branch) == 0);
+	avro_get_branch(field, &rec_branch);
 	assert(avro_value_set_double(&rec_branch, value) == 0);
 }
+#endif
 
-static void avro_set_string_field(const char *fieldname, const char *value)
+static void avro_set_string_field(int field, const char *value)
 {
 	avro_value_t	rec_field;
 
-	assert(avro_value_get_by_name(&flowavro_single_record, fieldname, &rec_field, NULL) == 0);
+	avro_get_field(field, &rec_field);
 	assert(avro_value_set_string(&rec_field, value) == 0);
 }
 
-static void avro_set_string_union(const char *fieldname, const char *value)
+static void avro_set_string_union(int field, const char *value)
 {
-	avro_value_t	rec_field;
 	avro_value_t	rec_branch;
 
-	assert(avro_value_get_by_name(&flowavro_single_record, fieldname, &rec_field, NULL) == 0);
-	assert(avro_value_set_branch(&rec_field, 1, &rec_branch) == 0);
+	avro_get_branch(field, &rec_branch);
 	assert(avro_value_set_string(&rec_branch, value) == 0);
 }
 
@@ -300,270 +371,214 @@ static void tcp_flags_to_str(master_record_t *r, char *string)
 	} 
 	else 
 	{
-		snprintf(string, 7, "%c%c%c%c%c%c",
-			r->tcp_flags & 32 ? 'U' : '.',
-			r->tcp_flags & 16 ? 'A' : '.',
-			r->tcp_flags &  8 ? 'P' : '.',
-			r->tcp_flags &  4 ? 'R' : '.',
-			r->tcp_flags &  2 ? 'S' : '.',
-			r->tcp_flags &  1 ? 'F' : '.');
+		string[0] = r->tcp_flags & 32 ? 'U' : '.';
+		string[1] = r->tcp_flags & 16 ? 'A' : '.';
+		string[2] = r->tcp_flags &  8 ? 'P' : '.';
+		string[3] = r->tcp_flags &  4 ? 'R' : '.';
+		string[4] = r->tcp_flags &  2 ? 'S' : '.';
+		string[5] = r->tcp_flags &  1 ? 'F' : '.';
+		string[6] = '\0';
 	}
 }
 
+#ifdef HAVE_EXTENDED_AVRO
+/* MAC address string, lowest byte first */
+static void mac_to_str(uint64_t mac, char *string)
+{
+	int	j;
+
+	for (j = 0; j < 6; j++)
+	{
+		string = AppendHex2(string, (mac >> (j*8)) & 0xFF);
+		if (j < 5)
+		{
+			*string++ = ':';
+		}
+	}
+	*string = '\0';
+}
+#endif
+
 /* Output a flow record to the Avro file; based on the JSON outputter */
-void flow_record_to_avro(void *record)
+static void write_avro_record(master_record_t *r, uint16_t *ex_id)
 {
-	master_record_t	*r		= (master_record_t *) record;
-	extension_map_t	*extension_map	= r->map_ref;
 	long long	ts		= 0L;
 	char		tcp_flags[16]	= { 0 };
+	char		ipstr[INET6_ADDRSTRLEN]	= { 0 };
 	int		i		= 0;
 	int		id		= 0;
 
-	/* Start with a clean slate */
+	/* Reset the optional fields of the previous record */
 	wipe_avro_record();
 
 	/* Start time of the flow in milliseconds */
 	ts = (r->first * 1000L) + r->msec_first;
-	avro_set_long_field("start_ts", ts);
+	avro_set_long_field(F_START_TS, ts);
 
 	/* End time of the flow in milliseconds */
 	ts = (r->last * 1000L) + r->msec_last;
-	avro_set_long_field("end_ts", ts);
+	avro_set_long_field(F_END_TS, ts);
 
 #ifdef HAVE_EXTENDED_AVRO
 	/* Flow type */
-	avro_set_string_field("type", TestFlag(r->flags, FLAG_EVENT) ? "EVENT" : "FLOW");
+	avro_set_string_field(F_TYPE, TestFlag(r->flags, FLAG_EVENT) ? "EVENT" : "FLOW");
 #endif
 
 	/* Is the flow sampled? */
-	avro_set_boolean_field("sampled", TestFlag(r->flags, FLAG_SAMPLED) ? 1 : 0);
+	avro_set_boolean_field(F_SAMPLED, TestFlag(r->flags, FLAG_SAMPLED) ? 1 : 0);
 
 	/* The system ID of the flow exporter */
-	avro_set_long_field("export_sysid", r->exporter_sysid);
+	avro_set_long_field(F_EXPORT_SYSID, r->exporter_sysid);
 
 	/* The protocol */
-	avro_set_int_field("protocol", r->prot);
+	avro_set_int_field(F_PROTOCOL, r->prot);
 
 	/* Source and destination IP */
 	if (TestFlag(r->flags,FLAG_IPV6_ADDR ) != 0)
 	{
 		/* This is an IPv6 flow */
-		uint64_t	_src[2]			= { 0 };
-		uint64_t	_dst[2]			= { 0 };
-		char		ipstr[INET6_ADDRSTRLEN]	= { 0 };
-
-		_src[0] = htonll(r->V6.srcaddr[0]);
-		_src[1] = htonll(r->V6.srcaddr[1]);
-		_dst[0] = htonll(r->V6.dstaddr[0]);
-		_dst[1] = htonll(r->V6.dstaddr[1]);
-
-		assert(inet_ntop(AF_INET6, _src, ipstr, INET6_ADDRSTRLEN) != NULL);
-
-		avro_set_string_union("src_v6_str", ipstr);
+		AppendIPv6(ipstr, r->V6.srcaddr);
+		avro_set_string_union(F_SRC_V6_STR, ipstr);
 #ifdef HAVE_EXTENDED_AVRO
-		avro_set_long_union("src_v6_int_hi", r->V6.srcaddr[0]);
-		avro_set_long_union("src_v6_int_lo", r->V6.srcaddr[1]);
+		avro_set_long_union(F_SRC_V6_INT_HI, r->V6.srcaddr[0]);
+		avro_set_long_union(F_SRC_V6_INT_LO, r->V6.srcaddr[1]);
 #endif
 
-		assert(inet_ntop(AF_INET6, _dst, ipstr, INET6_ADDRSTRLEN) != NULL);
-
-		avro_set_string_union("dst_v6_str", ipstr);
-
+		AppendIPv6(ipstr, r->V6.dstaddr);
+		avro_set_string_union(F_DST_V6_STR, ipstr);
 #ifdef HAVE_EXTENDED_AVRO
-		avro_set_long_union("dst_v6_int_hi", r->V6.dstaddr[0]);
-		avro_set_long_union("dst_v6_int_lo", r->V6.dstaddr[1]);
+		avro_set_long_union(F_DST_V6_INT_HI, r->V6.dstaddr[0]);
+		avro_set_long_union(F_DST_V6_INT_LO, r->V6.dstaddr[1]);
 #endif
 	} 
 	else 
 	{
 		/* This is an IPv4 flow */
-		uint32_t	_src			= 0;
-		uint32_t	_dst			= 0;
-		char		ipstr[INET_ADDRSTRLEN]	= { 0 };
-
-		_src = htonl(r->V4.srcaddr);
-		_dst = htonl(r->V4.dstaddr);
-
-		assert(inet_ntop(AF_INET, &_src, ipstr, INET_ADDRSTRLEN) != NULL);
-
-		avro_set_string_union("src_v4_str", ipstr);
+		AppendIPv4(ipstr, r->V4.srcaddr);
+		avro_set_string_union(F_SRC_V4_STR, ipstr);
 #ifdef HAVE_EXTENDED_AVRO
-		avro_set_int_union("src_v4_int", r->V4.srcaddr);
+		avro_set_int_union(F_SRC_V4_INT, r->V4.srcaddr);
 #endif
 
-		assert(inet_ntop(AF_INET, &_dst, ipstr, INET_ADDRSTRLEN) != NULL);
-
-		avro_set_string_union("dst_v4_str", ipstr);
+		AppendIPv4(ipstr, r->V4.dstaddr);
+		avro_set_string_union(F_DST_V4_STR, ipstr);
 #ifdef HAVE_EXTENDED_AVRO
-		avro_set_int_union("dst_v4_int", r->V4.dstaddr);
+		avro_set_int_union(F_DST_V4_INT, r->V4.dstaddr);
 #endif
 	}
 	
 	/* ICMP information or source and destination port */
 	if ( r->prot == IPPROTO_ICMP || r->prot == IPPROTO_ICMPV6 ) 
 	{ 
-		avro_set_int_union("icmp_type", r->icmp_type);
-		avro_set_int_union("icmp_code", r->icmp_code);
+		avro_set_int_union(F_ICMP_TYPE, r->icmp_type);
+		avro_set_int_union(F_ICMP_CODE, r->icmp_code);
 	} 
 	else 
 	{
-		avro_set_int_union("src_port", r->srcport);
-		avro_set_int_union("dst_port", r->dstport);
+		avro_set_int_union(F_SRC_PORT, r->srcport);
+		avro_set_int_union(F_DST_PORT, r->dstport);
 	}
 
 	/* Forwarding status */
-	avro_set_int_field("fwd_status", r->fwd_status);
+	avro_set_int_field(F_FWD_STATUS, r->fwd_status);
 	
 	/* TCP flags */
 	tcp_flags_to_str(r, tcp_flags);
-	avro_set_string_field("tcp_flags", tcp_flags);
+	avro_set_string_field(F_TCP_FLAGS, tcp_flags);
 
 	/* Source TOS */
-	avro_set_int_field("src_tos", r->tos);
+	avro_set_int_field(F_SRC_TOS, r->tos);
 
 	/* Number of packets in the flow */
-	avro_set_long_field("in_packets", r->dPkts);
+	avro_set_long_field(F_IN_PACKETS, r->dPkts);
 
 	/* Number of bytes in the flow */
-	avro_set_long_field("in_bytes", r->dOctets);
+	avro_set_long_field(F_IN_BYTES, r->dOctets);
 
 	/* Process extension fields */
 	i = 0;
-	while ((id = extension_map->ex_id[i]) != 0) 
+	while ((id = ex_id[i]) != 0) 
 	{
 		switch(id) 
 		{
 		case EX_IO_SNMP_2:
 		case EX_IO_SNMP_4:
 #ifdef HAVE_EXTENDED_AVRO
-				avro_set_int_union("input_snmp", r->input);
-				avro_set_int_union("output_snmp", r->output);
+				avro_set_int_union(F_INPUT_SNMP, r->input);
+				avro_set_int_union(F_OUTPUT_SNMP, r->output);
 #endif
 				break;
 		case EX_AS_2:
 		case EX_AS_4:
-				avro_set_int_union("src_as", r->srcas);
-				avro_set_int_union("dst_as", r->dstas);
+				avro_set_int_union(F_SRC_AS, r->srcas);
+				avro_set_int_union(F_DST_AS, r->dstas);
 				break;
 		case EX_BGPADJ:
 #ifdef HAVE_EXTENDED_AVRO
-				avro_set_int_union("next_as", r->bgpNextAdjacentAS);
-				avro_set_int_union("prev_as", r->bgpPrevAdjacentAS);
+				avro_set_int_union(F_NEXT_AS, r->bgpNextAdjacentAS);
+				avro_set_int_union(F_PREV_AS, r->bgpPrevAdjacentAS);
 #endif
 				break;
 		case EX_MULIPLE:
-				avro_set_int_union("src_mask", r->src_mask);
-				avro_set_int_union("dst_mask", r->dst_mask);
+				avro_set_int_union(F_SRC_MASK, r->src_mask);
+				avro_set_int_union(F_DST_MASK, r->dst_mask);
 #ifdef HAVE_EXTENDED_AVRO
-				avro_set_int_union("dst_tos", r->dst_tos);
-				avro_set_int_union("direction", r->dir);
+				avro_set_int_union(F_DST_TOS, r->dst_tos);
+				avro_set_int_union(F_DIRECTION, r->dir);
 #endif
 				break;
 #ifdef HAVE_EXTENDED_AVRO
 		/* All remaining extensions are only exported in case the extended Avro schema is used */
 		case EX_NEXT_HOP_v4: 
-			{
-				uint32_t	_ip			= 0;
-				char		ipstr[INET_ADDRSTRLEN]	= { 0 };
-
-				_ip = htonl(r->ip_nexthop.V4);
-
-				assert(inet_ntop(AF_INET, &_ip, ipstr, INET_ADDRSTRLEN) != NULL);
-
-				avro_set_string_union("ip4_next_hop_str", ipstr);
-			} 
+			AppendIPv4(ipstr, r->ip_nexthop.V4);
+			avro_set_string_union(F_IP4_NEXT_HOP_STR, ipstr);
 			break;
 		case EX_NEXT_HOP_v6: 
-			{
-				uint64_t	_ip[2]			= { 0 };
-				char		ipstr[INET6_ADDRSTRLEN]	= { 0 };
-
-				_ip[0] = htonll(r->ip_nexthop.V6[0]);
-				_ip[1] = htonll(r->ip_nexthop.V6[1]);
-
-				assert(inet_ntop(AF_INET6, _ip, ipstr, INET6_ADDRSTRLEN) != NULL);
-
-				avro_set_string_union("ip6_next_hop_str", ipstr);
-			} 
+			AppendIPv6(ipstr, r->ip_nexthop.V6);
+			avro_set_string_union(F_IP6_NEXT_HOP_STR, ipstr);
 			break;
 		case EX_NEXT_HOP_BGP_v4: 
-			{
-				uint32_t	_ip			= 0;
-				char		ipstr[INET_ADDRSTRLEN]	= { 0 };
-
-				_ip = htonl(r->bgp_nexthop.V4);
-
-				assert(inet_ntop(AF_INET, &_ip, ipstr, INET_ADDRSTRLEN) != NULL);
-
-				avro_set_string_union("bgp4_next_hop_str", ipstr);
-			} 
+			AppendIPv4(ipstr, r->bgp_nexthop.V4);
+			avro_set_string_union(F_BGP4_NEXT_HOP_STR, ipstr);
 			break;
 		case EX_NEXT_HOP_BGP_v6: 
-			{
-				uint64_t	_ip[2]			= { 0 };
-				char		ipstr[INET6_ADDRSTRLEN]	= { 0 };
-
-				_ip[0] = htonll(r->bgp_nexthop.V6[0]);
-				_ip[1] = htonll(r->bgp_nexthop.V6[1]);
-
-				assert(inet_ntop(AF_INET6, _ip, ipstr, INET6_ADDRSTRLEN) != NULL);
-
-				avro_set_string_union("bgp6_next_hop_str", ipstr);
-			} 
+			AppendIPv6(ipstr, r->bgp_nexthop.V6);
+			avro_set_string_union(F_BGP6_NEXT_HOP_STR, ipstr);
 			break;
 		case EX_VLAN:
-			avro_set_int_union("src_vlan", r->src_vlan);
-			avro_set_int_union("dst_vlan", r->dst_vlan);
+			avro_set_int_union(F_SRC_VLAN, r->src_vlan);
+			avro_set_int_union(F_DST_VLAN, r->dst_vlan);
 			break;
 		case EX_OUT_PKG_4:
 		case EX_OUT_PKG_8:
-			avro_set_long_union("out_packets", r->out_pkts);
+			avro_set_long_union(F_OUT_PACKETS, r->out_pkts);
 			break;
 		case EX_OUT_BYTES_4:
 		case EX_OUT_BYTES_8:
-			avro_set_long_union("out_bytes", r->out_bytes);
+			avro_set_long_union(F_OUT_BYTES, r->out_bytes);
 			break;
 		case EX_AGGR_FLOWS_4:
 		case EX_AGGR_FLOWS_8:
-			avro_set_long_union("aggr_flows", r->aggr_flows);
+			avro_set_long_union(F_AGGR_FLOWS, r->aggr_flows);
 			break;
 		case EX_MAC_1: 
 			{
-				int	j	= 0;
-				char	mac1_str[(6 * 3) + 2]	= { 0 };
-				char	mac2_str[(6 * 3) + 2]	= { 0 };
-
-				for (j = 0; j < 6; j++)
-				{
-					snprintf(&mac1_str[j*3], 4, "%02x:", (unsigned int) (r->in_src_mac >> (j*8)) & 0xFF);
-					snprintf(&mac2_str[j*3], 4, "%02x:", (unsigned int) (r->out_dst_mac >> (j*8)) & 0xFF);
-				}
+				char	mac_str[(6 * 3) + 2]	= { 0 };
 
-				mac1_str[(6*3)-1] = '\0';
-				mac2_str[(6*3)-1] = '\0';
-
-				avro_set_string_union("in_src_mac", mac1_str);
-				avro_set_string_union("out_dst_mac", mac2_str);
+				mac_to_str(r->in_src_mac, mac_str);
+				avro_set_string_union(F_IN_SRC_MAC_STR, mac_str);
+				mac_to_str(r->out_dst_mac, mac_str);
+				avro_set_string_union(F_OUT_DST_MAC_STR, mac_str);
 			}
 			break;
 		case EX_MAC_2: 
 			{
-				int	j	= 0;
-				char	mac1_str[(6 * 3) + 2]	= { 0 };
-				char	mac2_str[(6 * 3) + 2]	= { 0 };
-
-				for (j = 0; j < 6; j++)
-				{
-					snprintf(&mac1_str[j*3], 4, "%02x:", (unsigned int) (r->in_dst_mac >> (j*8)) & 0xFF);
-					snprintf(&mac2_str[j*3], 4, "%02x:", (unsigned int) (r->out_src_mac >> (j*8)) & 0xFF);
-				}
-
-				mac1_str[(6*3)-1] = '\0';
-				mac2_str[(6*3)-1] = '\0';
+				char	mac_str[(6 * 3) + 2]	= { 0 };
 
-				avro_set_string_union("in_dst_mac", mac1_str);
-				avro_set_string_union("out_src_mac", mac2_str);
+				mac_to_str(r->in_dst_mac, mac_str);
+				avro_set_string_union(F_IN_DST_MAC_STR, mac_str);
+				mac_to_str(r->out_src_mac, mac_str);
+				avro_set_string_union(F_OUT_SRC_MAC_STR, mac_str);
 			}
 			break;
 		case EX_MPLS:
@@ -575,45 +590,29 @@ void flow_record_to_avro(void *record)
 				 * accordingly.
 				 */
 				int	j		= 0;
-				char	label_str[14]	= { 0 };
 				char	label_val[64]	= { 0 };
 
 				for (j = 0; j < 10; j++)
 				{
-					snprintf(label_str, 14, "mpls_label_%02d", j + 1);
-					snprintf(label_val, 64, "%u-%u-%u", 
-						r->mpls_label[j] >> 4,
-						(r->mpls_label[i] & 0xF ) >> 1,
-						r->mpls_label[i] & 1);
+					char *s = label_val;
 
-					avro_set_string_union(label_str, label_val);
+					s = AppendUint(s, r->mpls_label[j] >> 4);
+					*s++ = '-';
+					s = AppendUint(s, (r->mpls_label[j] & 0xF ) >> 1);
+					*s++ = '-';
+					AppendUint(s, r->mpls_label[j] & 1);
+
+					avro_set_string_union(F_MPLS_LABEL_01 + j, label_val);
 				}
 			}
 			break;
 		case EX_ROUTER_IP_v4:
-			{
-				uint32_t	_ip			= 0;
-				char		ipstr[INET_ADDRSTRLEN]	= { 0 };
-
-				_ip = htonl(r->ip_router.V4);
-
-				assert(inet_ntop(AF_INET, &_ip, ipstr, INET_ADDRSTRLEN) != NULL);
-
-				avro_set_string_union("ip4_router_str", ipstr);
-			}
+			AppendIPv4(ipstr, r->ip_router.V4);
+			avro_set_string_union(F_IP4_ROUTER_STR, ipstr);
 			break;
 		case EX_ROUTER_IP_v6:
-			{
-				uint64_t	_ip[2]			= { 0 };
-				char		ipstr[INET6_ADDRSTRLEN]	= { 0 };
-
-				_ip[0] = htonll(r->ip_router.V6[0]);
-				_ip[1] = htonll(r->ip_router.V6[1]);
-
-				assert(inet_ntop(AF_INET6, _ip, ipstr, INET6_ADDRSTRLEN) != NULL);
-
-				avro_set_string_union("ip6_router_str", ipstr);
-			}
+			AppendIPv6(ipstr, r->ip_router.V6);
+			avro_set_string_union(F_IP6_ROUTER_STR, ipstr);
 			break;
 		case EX_LATENCY: 
 			{
@@ -625,17 +624,17 @@ void flow_record_to_avro(void *record)
 				server_latency = (double) r->server_nw_delay_usec / 1000.0f;
 				app_latency = (double) r->appl_latency_usec / 1000.0f;
 
-				avro_set_double_union("cli_latency", client_latency);
-				avro_set_double_union("srv_latency", server_latency);
-				avro_set_double_union("app_latency", app_latency);
+				avro_set_double_union(F_CLI_LATENCY, client_latency);
+				avro_set_double_union(F_SRV_LATENCY, server_latency);
+				avro_set_double_union(F_APP_LATENCY, app_latency);
 			}
 			break;
 		case EX_ROUTER_ID:
-			avro_set_int_union("engine_type", r->engine_type);
-			avro_set_int_union("engine_id", r->engine_id);
+			avro_set_int_union(F_ENGINE_TYPE, r->engine_type);
+			avro_set_int_union(F_ENGINE_ID, r->engine_id);
 			break;
 		case EX_RECEIVED:
-			avro_set_long_union("t_received", r->received);
+			avro_set_long_union(F_T_RECEIVED, r->received);
 			break;
 #endif /* HAVE_EXTENDED_AVRO */
 		}
@@ -648,7 +647,7 @@ void flow_record_to_avro(void *record)
 	/* Finally, add label */
 	if (r->label)
 	{
-		avro_set_string_union("label", r->label);
+		avro_set_string_union(F_LABEL, r->label);
 	}
 #endif
 
@@ -661,8 +660,213 @@ void flow_record_to_avro(void *record)
 	assert(avro_file_writer_append_value(flowavro_writer, &flowavro_single_record) == 0);
 }
 
+/* Writer thread: write all batches queued by flow_record_to_avro() */
+static void *avro_writer(void *arg)
+{
+	avro_batch_t	*batch;
+
+	while ((batch = queue_pop(full_batches)) != QUEUE_CLOSED)
+	{
+		uint32_t	i;
+
+		for (i = 0; i < batch->num_flows; i++)
+		{
+			write_avro_record(&batch->flow[i].record, batch->flow[i].ex_id);
+		}
+
+		batch->num_flows = 0;
+		queue_push(free_batches, batch);
+	}
+
+	pthread_exit(NULL);
+	/* not reached */
+	return NULL;
+}
+
+static int start_avro_writer(void)
+{
+	int	i, err;
+
+	free_batches = queue_init(AVRO_NUMBATCHES);
+	full_batches = queue_init(AVRO_NUMBATCHES);
+	if (!free_batches || !full_batches)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < AVRO_NUMBATCHES; i++)
+	{
+		avro_batch_t *batch = malloc(sizeof(avro_batch_t));
+		if (!batch)
+		{
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+			return -1;
+		}
+		batch->num_flows = 0;
+		queue_push(free_batches, batch);
+	}
+	current_batch = NULL;
+
+	err = pthread_create(&writer_thread, NULL, avro_writer, NULL);
+	if (err)
+	{
+		LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err));
+		return -1;
+	}
+	writer_running = 1;
+
+	return 0;
+}
+
+static void stop_avro_writer(void)
+{
+	avro_batch_t	*batch;
+
+	if (current_batch)
+	{
+		queue_push(full_batches, current_batch);
+		current_batch = NULL;
+	}
+	queue_close(full_batches);
+	pthread_join(writer_thread, NULL);
+	writer_running = 0;
+
+	queue_close(free_batches);
+	while ((batch = queue_pop(free_batches)) != QUEUE_CLOSED)
+	{
+		free(batch);
+	}
+	queue_free(free_batches);
+	queue_free(full_batches);
+}
+
+/*
+ * Initialise the Avro export. The output filename may be prefixed by the
+ * codec name followed by a colon, e.g. deflate:flows.avro
+ */
+int init_avro_export(const char *output_spec)
+{
+	const char	*output_filename	= output_spec;
+	const char	*codec			= NULL;
+	static char	codec_name[16];
+	int		i;
+
+	for (i = 0; avro_codecs[i] != NULL; i++)
+	{
+		size_t len = strlen(avro_codecs[i]);
+
+		if ((strncmp(output_spec, avro_codecs[i], len) == 0) && (output_spec[len] == ':'))
+		{
+			strncpy(codec_name, avro_codecs[i], sizeof(codec_name) - 1);
+			codec		= codec_name;
+			output_filename	= output_spec + len + 1;
+			break;
+		}
+	}
+
+	/* Load the Avro schema */
+	memset(&flowavro_schema, 0, sizeof(flowavro_schema));
+
+#ifdef HAVE_EXTENDED_AVRO
+	if (avro_schema_from_json_length((const char*) flowdata_extended_avsc, flowdata_extended_avsc_len, &flowavro_schema) != 0)
+#else
+	if (avro_schema_from_json_length((const char*) flowdata_avsc, flowdata_avsc_len, &flowavro_schema) != 0)
+#endif
+	{
+		return -1;
+	}
+
+	/* Resolve the field handles */
+	for (i = 0; i < F_NUMFIELDS; i++)
+	{
+		field_index[i] = avro_schema_record_field_get_index(flowavro_schema, field_name[i]);
+	}
+
+	/*
+	 * Instantiate a single instance of the schema. We will re-use a
+	 * single record instance for the writer, as suggested in section 4
+	 * of the libavro documentation.
+	 */
+	flowavro_class = avro_generic_class_from_schema(flowavro_schema);
+
+	if (flowavro_class == NULL)
+	{
+		return -1;
+	}
+
+	if (avro_generic_value_new(flowavro_class, &flowavro_single_record) != 0)
+	{
+		return -1;
+	}
+	null_avro_record();
+
+	if (open_avro_file(output_filename, codec) != 0)
+	{
+		return -1;
+	}
+
+	/* Without the writer thread, records are written directly */
+	if (start_avro_writer() != 0)
+	{
+		LogError("Failed to start Avro writer thread - write records directly");
+	}
+
+	return 0;
+}
+
+/* 
+ * Queue a flow record for the writer thread. The record is copied, as the
+ * master record is re-used by process_data for the next record.
+ */
+void flow_record_to_avro(void *record)
+{
+	master_record_t	*r		= (master_record_t *) record;
+	extension_map_t	*extension_map	= r->map_ref;
+	avro_flow_t	*flow;
+	int		i;
+
+	if (!writer_running)
+	{
+		uint16_t	ex_id[AVRO_MAXEXT];
+
+		for (i = 0; i < (AVRO_MAXEXT - 1) && extension_map->ex_id[i]; i++)
+		{
+			ex_id[i] = extension_map->ex_id[i];
+		}
+		ex_id[i] = 0;
+		write_avro_record(r, ex_id);
+		return;
+	}
+
+	if (current_batch == NULL)
+	{
+		current_batch = queue_pop(free_batches);
+	}
+
+	flow = &current_batch->flow[current_batch->num_flows++];
+	memcpy(&flow->record, r, sizeof(master_record_t));
+	flow->record.map_ref = NULL;
+	for (i = 0; i < (AVRO_MAXEXT - 1) && extension_map->ex_id[i]; i++)
+	{
+		flow->ex_id[i] = extension_map->ex_id[i];
+	}
+	flow->ex_id[i] = 0;
+
+	if (current_batch->num_flows == AVRO_BATCHSIZE)
+	{
+		queue_push(full_batches, current_batch);
+		current_batch = NULL;
+	}
+}
+
 void finish_avro_export(void)
 {
+	/* Write all queued records */
+	if (writer_running)
+	{
+		stop_avro_writer();
+	}
+
 	/* Close the output file */
 	finish_avro_file();
 
@@ -675,4 +879,3 @@ void finish_avro_export(void)
 	/* Free the Avro schema */
 	avro_schema_decref(flowavro_schema);
 }
-
@@ -777,6 +777,11 @@ printf("DGB: short fts: '%s', filer_first: '%s', filter_last: '%s'\n",
 		switch (ftsent->fts_info) {
 			case FTS_D:
 				// dir entry pre descend
+				// skip hidden directories such as .rollup
+				if ( ftsent->fts_name[0] == '.' ) {
+					fts_set(fts, ftsent, FTS_SKIP );
+					break;
+				}
 				if ( file_list_level && file_list_level && (
 					( dir_entry_filter[fts_level].first_entry &&
 						( strcmp(fts_path, dir_entry_filter[fts_level].first_entry ) < 0 ) ) ||
@@ -792,8 +797,9 @@ printf("DGB: short fts: '%s', filer_first: '%s', filter_last: '%s'\n",
 				// file entry
 // printf("==> Check: %s\n", ftsent->fts_name);
 
-				// skip stat file
-				if ( strcmp(ftsent->fts_name, ".nfstat") == 0 ||
+				// skip stat, catalog and live index file
+				if ( strcmp(ftsent->fts_name, ".nfstat") == 0 || strcmp(ftsent->fts_name, ".nfcatalog") == 0 ||
+					 strcmp(ftsent->fts_name, ".nflive") == 0 ||
 					 strncmp(ftsent->fts_name, NF_DUMPFILE , strlen(NF_DUMPFILE)) == 0)
 					continue;
 				if ( strstr(ftsent->fts_name, ".stat") != NULL )
@@ -993,6 +999,10 @@ void SetupInputFileSequence(char *multiple_dirs, char *single_file, char *multip
 
 } // End of SetupInputFileSequence
 
+stringlist_t *GetInputFileList(void) {
+	return &file_list;
+} // End of GetInputFileList
+
 char *GetCurrentFilename(void) {
 	return current_file;
 } // End of GetCurrentFilename
@@ -48,7 +48,6 @@
 #include <pthread.h>
 #include <assert.h>
 
-#include "rbtree.h"
 #include "nffile.h"
 #include "bookkeeper.h"
 #include "collector.h"
@@ -71,27 +70,83 @@ static void spin_unlock(int volatile *p) {
 #define GetTreeLock(a)		spin_lock(&((a)->list_lock))
 #define ReleaseTreeLock(a)	spin_unlock(&((a)->list_lock))
 
+/*
+ * Node allocation:
+ * Nodes are allocated in slabs of nodes, which are added on demand. Each thread
+ * keeps a local list of free nodes. Nodes are moved in batches between the local
+ * lists and the global free list, so the global lock is taken once per batch only.
+ */
+#define FLOWELEMENTNUM 1024 * 1024
+#define NODEBATCH 256
 
-static int FlowNodeCMP(struct FlowNode *e1, struct FlowNode *e2);
-
-// Insert the IP RB tree code here
-RB_GENERATE(FlowTree, FlowNode, entry, FlowNodeCMP);
+typedef struct NodeSlab_s {
+	struct NodeSlab_s	*next;
+	struct FlowNode		*nodes;
+	uint32_t			size;
+} NodeSlab_t;
 
-// Flow Cache to store all nodes
-#define FLOWELEMENTNUM 1024 * 1024
-//#define FLOWELEMENTNUM 128
-static struct FlowNode *FlowElementCache;
+static NodeSlab_t *NodeSlabs;
+static uint32_t	SlabSize;
 
-// free list 
+// global free list 
 static struct FlowNode *FlowNode_FreeList;
+static uint32_t	FreeListLength;
 static pthread_mutex_t m_FreeList = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  c_FreeList = PTHREAD_COND_INITIALIZER;
-static uint32_t	CacheOverflow;
+
+// thread local free list
+static __thread struct FlowNode *LocalFreeList;
+static __thread uint32_t LocalFreeLength;
+
+static uint32_t	CacheOverflow;		// number of failed cache extensions
 static uint32_t	Allocated;
+static uint32_t	CacheNodes;
+static int		CacheExhausted;		// the cache could not grow - cleared, when the flows are flushed
+
+/*
+ * Flow table:
+ * The flow table is split into shards, selected by the top bits of the flow hash.
+ * Each shard is a hash table with chained buckets, which doubles its size independently,
+ * so a resize rehashes only the flows of one shard. The hash is symmetric, therefore
+ * both directions of a flow end up in the same shard.
+ * The flow table is owned by the thread, which calls Init_FlowTable(). Multiple flow
+ * threads may run their own flow table in parallel, sharing the node cache.
+ */
+#define FLOWSHARDBITS	4
+#define FLOWSHARDS		(1 << FLOWSHARDBITS)
+#define MINBUCKETS		1024
+
+typedef struct FlowShard_s {
+	struct FlowNode	**bucket;
+	uint32_t		mask;		// number of buckets - 1
+	uint32_t		NumFlows;
+} FlowShard_t;
 
-// Flow tree
-static FlowTree_t *FlowTree;
-static int NumFlows;
+static __thread FlowShard_t *FlowTable;
+static __thread int NumFlows;
+
+/*
+ * Flow expiry:
+ * A flow expires InactiveTimeout seconds after its last packet, or ActiveTimeout seconds
+ * after its first packet. Each flow table has a two level timing wheel of one second slots,
+ * which holds every flow in the slot of its next expiry check. Packets only update t_last,
+ * so the wheel is not touched per packet. When a slot is due, its flows are either expired
+ * or linked again into the slot of their new expiry time. A level 1 slot spans WHEELSIZE
+ * seconds and is cascaded into level 0, when the wheel reaches it.
+ */
+#define WHEELBITS	8
+#define WHEELSIZE	(1 << WHEELBITS)
+#define WHEELMASK	(WHEELSIZE - 1)
+#define WHEELSPAN	((WHEELSIZE - 1) * WHEELSIZE)
+
+typedef struct FlowWheel_s {
+	struct FlowNode	*slot[2][WHEELSIZE];
+	time_t			now;		// all slots up to now are processed
+} FlowWheel_t;
+
+static uint32_t	ActiveTimeout	= FLOW_ACTIVE_TIMEOUT;
+static uint32_t	InactiveTimeout	= FLOW_INACTIVE_TIMEOUT;
+
+static __thread FlowWheel_t *FlowWheel;
 
 // Simple unprotected list
 typedef struct FlowNode_list_s {
@@ -100,6 +155,57 @@ typedef struct FlowNode_list_s {
 	uint32_t	size;
 } Linked_list_t;
 
+static int AddSlab(uint32_t size);
+
+static inline uint64_t FlowMix(uint64_t k);
+
+static inline uint64_t FlowHash(struct FlowNode *node);
+
+static int GrowShard(FlowShard_t *shard);
+
+static inline time_t FlowExpire(struct FlowNode *node);
+
+static inline void SlotLink(struct FlowNode **slot, struct FlowNode *node);
+
+static inline void WheelLink(struct FlowNode *node, time_t expire);
+
+static inline void WheelUnlink(struct FlowNode *node);
+
+
+static int AddSlab(uint32_t size) {
+NodeSlab_t *slab;
+uint32_t i;
+
+	slab = (NodeSlab_t *)malloc(sizeof(NodeSlab_t));
+	if ( !slab ) {
+		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+	slab->nodes = calloc(size, sizeof(struct FlowNode));
+	if ( !slab->nodes ) {
+		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+		free(slab);
+		return 0;
+	}
+	slab->size = size;
+
+	// link all new nodes into the free list - global lock is held by the caller
+	for (i=0; i < size; i++ ) {
+		slab->nodes[i].memflag = NODE_FREE;
+		slab->nodes[i].left    = NULL;
+		slab->nodes[i].right   = i < (size-1) ? &slab->nodes[i+1] : FlowNode_FreeList;
+	}
+	FlowNode_FreeList = slab->nodes;
+	FreeListLength	 += size;
+	CacheNodes		 += size;
+
+	slab->next = NodeSlabs;
+	NodeSlabs  = slab;
+
+	return 1;
+
+} // End of AddSlab
+
 /* Free list handling functions */
 // Get next free node from free list
 struct FlowNode *New_Node(void) {
@@ -115,30 +221,40 @@ struct FlowNode *node;
 	return node;
 #endif 
 
-	pthread_mutex_lock(&m_FreeList);
-    while ( FlowNode_FreeList == NULL ) {
-		CacheOverflow++;
-		LogError("Free list exhausted: %u, Flows: %u - sleep", Allocated, NumFlows);
-        pthread_cond_wait(&c_FreeList, &m_FreeList);
-	}
-
-	node = FlowNode_FreeList;
-	if ( node == NULL ) {
-		// should never happen , as we were waiting for a free node
-		LogError("*** Software ERROR *** New_Node() unexpected error in %s line %d: %s: %u\n", 
-			__FILE__, __LINE__, "Node list exhausted", NumFlows);
+	if ( LocalFreeList == NULL ) {
+		// get a batch of nodes from the global free list
+		uint32_t i;
+
+		pthread_mutex_lock(&m_FreeList);
+		if ( FreeListLength < NODEBATCH && !AddSlab(SlabSize) ) {
+			CacheOverflow++;
+			CacheExhausted = 1;
+			if ( FlowNode_FreeList == NULL ) {
+				pthread_mutex_unlock(&m_FreeList);
+				LogError("Free list exhausted: %u, Flows: %u", Allocated, NumFlows);
+				return NULL;
+			}
+		}
+		LocalFreeList = node = FlowNode_FreeList;
+		for ( i=1; i < NODEBATCH && node->right; i++ ) 
+			node = node->right;
+		FlowNode_FreeList = node->right;
+		node->right		  = NULL;
+		FreeListLength	 -= i;
+		LocalFreeLength	  = i;
 		pthread_mutex_unlock(&m_FreeList);
-		return NULL;
 	}
+
+	node = LocalFreeList;
 	if ( node->memflag != NODE_FREE ) {
 		LogError("*** Software ERROR *** New_Node() unexpected error in %s line %d: %s\n", 
 			__FILE__, __LINE__, "Tried to allocate a non free Node");
 		abort();
 	}
 
-	FlowNode_FreeList = node->right;
-	Allocated++;
-	pthread_mutex_unlock(&m_FreeList);
+	LocalFreeList = node->right;
+	LocalFreeLength--;
+	__sync_fetch_and_add(&Allocated, 1);
 
 	node->left 	  = NULL;
 	node->right	  = NULL;
@@ -174,116 +290,372 @@ void Free_Node(struct FlowNode *node) {
 
 	memset((void *)node, 0, sizeof(struct FlowNode));
 
-	pthread_mutex_lock(&m_FreeList);
-	node->right = FlowNode_FreeList;
-	node->left  = NULL;
+	node->right   = LocalFreeList;
+	node->left    = NULL;
 	node->memflag = NODE_FREE;
-	FlowNode_FreeList = node;
-	Allocated--;
-	pthread_mutex_unlock(&m_FreeList);
-	if ( CacheOverflow ) {
-		CacheOverflow = 0;
-		pthread_cond_signal(&c_FreeList);
+	LocalFreeList = node;
+	LocalFreeLength++;
+	__sync_fetch_and_sub(&Allocated, 1);
+
+	if ( LocalFreeLength >= (2 * NODEBATCH) ) {
+		// return a batch of nodes to the global free list
+		struct FlowNode *first, *last;
+		uint32_t i;
+
+		first = last = LocalFreeList;
+		for ( i=1; i < NODEBATCH; i++ ) 
+			last = last->right;
+		LocalFreeList	 = last->right;
+		LocalFreeLength -= NODEBATCH;
+
+		pthread_mutex_lock(&m_FreeList);
+		last->right		  = FlowNode_FreeList;
+		FlowNode_FreeList = first;
+		FreeListLength	 += NODEBATCH;
+		pthread_mutex_unlock(&m_FreeList);
 	}
 
 } // End of Free_Node
 
-/* safety check - this must never become 0 - otherwise the cache is too small */
+/* safety check - this must never become 0 - otherwise the cache could not grow */
 uint32_t CacheCheck(void) {
-	return FLOWELEMENTNUM - NumFlows;
+	return CacheExhausted ? 0 : CacheNodes - NumFlows;
 } // End of CacheCheck
 
-/* flow tree functions */
+/* flow table functions */
+// init the node cache shared by all flow tables
 int Init_FlowTree(uint32_t CacheSize) {
-int i;
+int ok;
 
-	FlowTree = malloc(sizeof(FlowTree_t));
-	if ( !FlowTree ) {
+	if ( CacheSize == 0 )
+		CacheSize = FLOWELEMENTNUM;
+
+	pthread_mutex_lock(&m_FreeList);
+	CacheOverflow  = 0;
+	CacheExhausted = 0;
+	Allocated 	   = 0;
+	CacheNodes	   = 0;
+
+	// the cache grows with slabs of the initial size
+	SlabSize = CacheSize;
+	ok = AddSlab(SlabSize);
+	pthread_mutex_unlock(&m_FreeList);
+
+	return ok;
+
+} // End of Init_FlowTree
+
+void Dispose_FlowTree(void) {
+NodeSlab_t *slab;
+
+	pthread_mutex_lock(&m_FreeList);
+	while ( NodeSlabs ) {
+		slab = NodeSlabs;
+		NodeSlabs = slab->next;
+		free(slab->nodes);
+		free(slab);
+	}
+	FlowNode_FreeList = NULL;
+	FreeListLength	  = 0;
+	CacheNodes		  = 0;
+	pthread_mutex_unlock(&m_FreeList);
+
+	LocalFreeList	= NULL;
+	LocalFreeLength = 0;
+
+} // End of Dispose_FlowTree
+
+// init the flow table of the calling thread
+int Init_FlowTable(void) {
+uint32_t i, buckets;
+
+	FlowTable = calloc(FLOWSHARDS, sizeof(FlowShard_t));
+	if ( !FlowTable ) {
 		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
 		return 0;
 	}
-	RB_INIT(FlowTree);
 
-	if ( CacheSize == 0 )
-		CacheSize = FLOWELEMENTNUM;
-	FlowElementCache = calloc(CacheSize, sizeof(struct FlowNode));
-	if ( !FlowElementCache ) {
+	// initial number of buckets per shard - power of 2
+	buckets = MINBUCKETS;
+	while ( (buckets * FLOWSHARDS) < SlabSize ) 
+		buckets <<= 1;
+	for ( i=0; i<FLOWSHARDS; i++ ) {
+		FlowTable[i].bucket = calloc(buckets, sizeof(struct FlowNode *));
+		if ( !FlowTable[i].bucket ) {
+			LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+			Dispose_FlowTable();
+			return 0;
+		}
+		FlowTable[i].mask	  = buckets - 1;
+		FlowTable[i].NumFlows = 0;
+	}
+	NumFlows = 0;
+
+	FlowWheel = calloc(1, sizeof(FlowWheel_t));
+	if ( !FlowWheel ) {
 		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
-		free(FlowTree);
-		FlowTree = NULL;
+		Dispose_FlowTable();
 		return 0;
 	}
 
-	// init free list
-	FlowNode_FreeList 		   = FlowElementCache;
-	FlowNode_FreeList->left    = NULL;
-	FlowNode_FreeList->right   = &FlowElementCache[1];
-	FlowNode_FreeList->memflag = NODE_FREE;
-	for (i=1; i < (CacheSize-1); i++ ) {
-		FlowElementCache[i].memflag = NODE_FREE;
-		FlowElementCache[i].left  = &FlowElementCache[i-1];
-		FlowElementCache[i].right = &FlowElementCache[i+1];
+	return 1;
+
+} // End of Init_FlowTable
+
+void Dispose_FlowTable(void) {
+uint32_t i;
+
+	if ( FlowTable ) {
+		for ( i=0; i<FLOWSHARDS; i++ ) 
+			free(FlowTable[i].bucket);
+		free(FlowTable);
+		FlowTable = NULL;
+	}
+	free(FlowWheel);
+	FlowWheel = NULL;
+
+	// return the free nodes of this thread to the global free list
+	if ( LocalFreeList ) {
+		struct FlowNode *last = LocalFreeList;
+		while ( last->right ) 
+			last = last->right;
+		pthread_mutex_lock(&m_FreeList);
+		last->right		  = FlowNode_FreeList;
+		FlowNode_FreeList = LocalFreeList;
+		FreeListLength	 += LocalFreeLength;
+		pthread_mutex_unlock(&m_FreeList);
+	}
+	LocalFreeList	= NULL;
+	LocalFreeLength = 0;
+
+} // End of Dispose_FlowTable
+
+static inline uint64_t FlowMix(uint64_t k) {
+
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdLL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53LL;
+	k ^= k >> 33;
+
+	return k;
+
+} // End of FlowMix
+
+// symmetric hash: a flow and its reverse flow have the same hash value
+static inline uint64_t FlowHash(struct FlowNode *node) {
+uint64_t src, dst;
+
+	src = FlowMix(node->src_addr.v6[0] ^ FlowMix(node->src_addr.v6[1] ^ node->src_port));
+	dst = FlowMix(node->dst_addr.v6[0] ^ FlowMix(node->dst_addr.v6[1] ^ node->dst_port));
+
+	return FlowMix((src + dst) ^ (((uint64_t)node->proto << 8) | node->version));
+
+} // End of FlowHash
+
+#define CMPLEN (offsetof(struct FlowNode, _ENDKEY_) - offsetof(struct FlowNode, src_addr))
+#define FlowShard(hash) (&FlowTable[(hash) >> (64 - FLOWSHARDBITS)])
+
+static int GrowShard(FlowShard_t *shard) {
+struct FlowNode **bucket, *node, *nxt;
+uint32_t i, mask;
+
+	mask = (shard->mask << 1) | 1;
+	bucket = calloc(mask + 1, sizeof(struct FlowNode *));
+	if ( !bucket ) {
+		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+		return 0;
 	}
-	FlowElementCache[i].left  	= &FlowElementCache[i-1];
-	FlowElementCache[i].right 	= NULL;
-	FlowElementCache[i].memflag = NODE_FREE;
 
-	CacheOverflow = 0;
-	Allocated 	  = 0;
-	NumFlows 	  = 0;
+	for ( i=0; i <= shard->mask; i++ ) {
+		for ( node = shard->bucket[i]; node != NULL; node = nxt ) {
+			nxt = node->hnext;
+			node->hnext = bucket[node->hash & mask];
+			bucket[node->hash & mask] = node;
+		}
+	}
+	free(shard->bucket);
+	shard->bucket = bucket;
+	shard->mask	  = mask;
 
 	return 1;
-} // End of Init_FlowTree
 
-void Dispose_FlowTree(void) {
-struct FlowNode *node, *nxt;
+} // End of GrowShard
 
-	// Dump all incomplete flows to the file
-	for (node = RB_MIN(FlowTree, FlowTree); node != NULL; node = nxt) {
-		nxt = RB_NEXT(FlowTree, FlowTree, node);
-		RB_REMOVE(FlowTree, FlowTree, node);
+// time of the next expiry check of a flow
+static inline time_t FlowExpire(struct FlowNode *node) {
+time_t active, inactive;
+
+	active	 = node->t_first.tv_sec + ActiveTimeout;
+	inactive = node->t_last.tv_sec + InactiveTimeout;
+
+	return active < inactive ? active : inactive;
+
+} // End of FlowExpire
+
+static inline void SlotLink(struct FlowNode **slot, struct FlowNode *node) {
+
+	node->wnext	 = *slot;
+	node->wpprev = slot;
+	if ( *slot )
+		(*slot)->wpprev = &node->wnext;
+	*slot = node;
+
+} // End of SlotLink
+
+static inline void WheelLink(struct FlowNode *node, time_t expire) {
+time_t now = FlowWheel->now;
+
+	// the slot of now is processed already
+	if ( expire <= now )
+		expire = now + 1;
+
+	if ( (expire - now) < WHEELSIZE ) {
+		node->expire = expire;
+		SlotLink(&FlowWheel->slot[0][expire & WHEELMASK], node);
+	} else {
+		// far away expiry times are checked again at the end of the wheel span
+		if ( (expire - now) > WHEELSPAN )
+			expire = now + WHEELSPAN;
+		node->expire = expire;
+		SlotLink(&FlowWheel->slot[1][(expire >> WHEELBITS) & WHEELMASK], node);
 	}
-	free(FlowElementCache);
-	FlowElementCache 	 = NULL;
-	FlowNode_FreeList 	 = NULL;
-	CacheOverflow = 0;
 
-} // End of Dispose_FlowTree
+} // End of WheelLink
 
-static int FlowNodeCMP(struct FlowNode *e1, struct FlowNode *e2) {
-uint64_t    *a = e1->src_addr.v6;
-uint64_t    *b = e2->src_addr.v6;
-int i;
+static inline void WheelUnlink(struct FlowNode *node) {
 
-#define CMPLEN (offsetof(struct FlowNode, _ENDKEY_) - offsetof(struct FlowNode, src_addr))
+	if ( node->wpprev == NULL )
+		return;
+
+	*node->wpprev = node->wnext;
+	if ( node->wnext )
+		node->wnext->wpprev = node->wpprev;
+	node->wnext	 = NULL;
+	node->wpprev = NULL;
+
+} // End of WheelUnlink
+
+void SetFlowTimeout(uint32_t active, uint32_t inactive) {
+
+	ActiveTimeout	= active;
+	InactiveTimeout = inactive;
+
+} // End of SetFlowTimeout
+
+uint32_t FlowTreeSize(void) {
+	return NumFlows;
+} // End of FlowTreeSize
+
+// store and remove all flows, which expire up to when 
+uint32_t Expire_FlowTree(FlowSource_t *fs, time_t when) {
+struct FlowNode *node, *list;
+uint32_t expired = 0;
+
+	if ( when <= FlowWheel->now ) 
+		return 0;
+
+	if ( NumFlows == 0 ) {
+		// nothing to expire - jump ahead
+		FlowWheel->now = when;
+		return 0;
+	}
 
-	i = memcmp((void *)a, (void *)b, CMPLEN );
-	return i; 
- 
-} // End of FlowNodeCMP
+	while ( FlowWheel->now < when ) {
+		time_t now = ++FlowWheel->now;
+
+		if ( (now & WHEELMASK) == 0 ) {
+			// cascade the level 1 slot of this span into level 0
+			list = FlowWheel->slot[1][(now >> WHEELBITS) & WHEELMASK];
+			FlowWheel->slot[1][(now >> WHEELBITS) & WHEELMASK] = NULL;
+			while ( (node = list) != NULL ) {
+				list = node->wnext;
+				SlotLink(&FlowWheel->slot[0][node->expire & WHEELMASK], node);
+			}
+		}
+
+		list = FlowWheel->slot[0][now & WHEELMASK];
+		FlowWheel->slot[0][now & WHEELMASK] = NULL;
+		while ( (node = list) != NULL ) {
+			time_t expire;
+
+			list = node->wnext;
+			node->wnext  = NULL;
+			node->wpprev = NULL;
+
+			expire = FlowExpire(node);
+			if ( expire <= now ) {
+				StorePcapFlow(fs, node);
+				Remove_Node(node);
+				expired++;
+			} else {
+				WheelLink(node, expire);
+			}
+		}
+
+		if ( NumFlows == 0 ) {
+			FlowWheel->now = when;
+			break;
+		}
+	}
+
+	return expired;
+
+} // End of Expire_FlowTree
 
 struct FlowNode *Lookup_Node(struct FlowNode *node) {
-	return RB_FIND(FlowTree, FlowTree, node);
-} // End of Lookup_FlowTree
+FlowShard_t *shard;
+struct FlowNode *n;
+uint64_t hash;
+
+	hash  = FlowHash(node);
+	shard = FlowShard(hash);
+	for ( n = shard->bucket[hash & shard->mask]; n != NULL; n = n->hnext ) {
+		if ( n->hash == hash && memcmp((void *)&n->src_addr, (void *)&node->src_addr, CMPLEN) == 0 ) 
+			return n;
+	}
+
+	return NULL;
+
+} // End of Lookup_Node
 
 struct FlowNode *Insert_Node(struct FlowNode *node) {
+FlowShard_t *shard;
 struct FlowNode *n;
+uint64_t hash;
 
 dbg_assert(node->left == NULL);
 dbg_assert(node->right == NULL);
 
-	// return RB_INSERT(FlowTree, FlowTree, node);
-	n = RB_INSERT(FlowTree, FlowTree, node);
-	if ( n ) { // existing node
-		return n;
-	} else {
-		NumFlows++;
-		return NULL;
+	hash  = FlowHash(node);
+	shard = FlowShard(hash);
+	for ( n = shard->bucket[hash & shard->mask]; n != NULL; n = n->hnext ) {
+		if ( n->hash == hash && memcmp((void *)&n->src_addr, (void *)&node->src_addr, CMPLEN) == 0 ) 
+			// existing node
+			return n;
 	}
+
+	// keep the load factor <= 1
+	if ( shard->NumFlows > shard->mask ) 
+		GrowShard(shard);
+
+	node->hash  = hash;
+	node->hnext = shard->bucket[hash & shard->mask];
+	shard->bucket[hash & shard->mask] = node;
+	shard->NumFlows++;
+	NumFlows++;
+
+	if ( FlowWheel->now == 0 )
+		FlowWheel->now = node->t_first.tv_sec;
+	WheelLink(node, FlowExpire(node));
+
+	return NULL;
+
 } // End of Insert_Node
 
 void Remove_Node(struct FlowNode *node) {
-struct FlowNode *rev_node;
+FlowShard_t *shard;
+struct FlowNode *rev_node, **n;
 
 #ifdef DEVEL
 	assert(node->memflag == NODE_IN_USE);
@@ -299,10 +671,22 @@ struct FlowNode *rev_node;
 		dbg_assert(rev_node->rev_node == node);
 		rev_node->rev_node = NULL;
 		node->rev_node	   = NULL;
+		// the rev node may expire before this node - no latency without the rev node
+		rev_node->latency.flag = 0;
+	}
+
+	shard = FlowShard(node->hash);
+	n = &shard->bucket[node->hash & shard->mask];
+	while ( *n && *n != node ) 
+		n = &(*n)->hnext;
+	if ( *n ) {
+		*n = node->hnext;
+		shard->NumFlows--;
+		NumFlows--;
 	}
-	RB_REMOVE(FlowTree, FlowTree, node);
+	node->hnext = NULL;
+	WheelUnlink(node);
 	Free_Node(node);
-	NumFlows--;
 
 } // End of Remove_Node
 
@@ -344,18 +728,24 @@ struct FlowNode lookup_node, *rev_node;
 uint32_t Flush_FlowTree(FlowSource_t *fs) {
 struct FlowNode *node, *nxt;
 uint32_t n = NumFlows;
+uint32_t i, j;
 
 	// Dump all incomplete flows to the file
-	for (node = RB_MIN(FlowTree, FlowTree); node != NULL; node = nxt) {
-		StorePcapFlow(fs, node);
-		nxt = RB_NEXT(FlowTree, FlowTree, node);
+	for ( i=0; i<FLOWSHARDS; i++ ) {
+		FlowShard_t *shard = &FlowTable[i];
+		for ( j=0; j <= shard->mask && shard->NumFlows; j++ ) {
+			for ( node = shard->bucket[j]; node != NULL; node = nxt ) {
+				StorePcapFlow(fs, node);
+				nxt = node->hnext;
 #ifdef DEVEL
 if ( node->left || node->right ) {
 	assert(node->proto == 17);
 	 node->left = node->right = NULL;
 }
 #endif
-		Remove_Node(node);
+				Remove_Node(node);
+			}
+		}
 	}
 
 #ifdef DEVEL
@@ -363,6 +753,9 @@ if ( node->left || node->right ) {
 		LogError("### Flush_FlowTree() remaining flows: %u\n", NumFlows);
 #endif
 
+	// flushed nodes are available again
+	CacheExhausted = 0;
+
 	return n;
 
 } // End of Flush_FlowTree
@@ -381,6 +774,17 @@ NodeList_t *NodeList;
 		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
 		return NULL;
 	}
+	// the signal node must not depend on the node cache, which may be exhausted
+	NodeList->signal_node = (struct FlowNode *)calloc(1, sizeof(struct FlowNode));
+	if ( !NodeList->signal_node ) {
+		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+		free(NodeList);
+		return NULL;
+	}
+	NodeList->signal_node->memflag = NODE_IN_USE;
+	NodeList->signal_node->fin	   = SIGNAL_NODE;
+	NodeList->signal_queued = 0;
+
 	NodeList->list 		= NULL;
 	NodeList->last 		= NULL;
 	NodeList->length	= 0;
@@ -403,6 +807,7 @@ void DisposeNodeList(NodeList_t *NodeList) {
 		LogError("Try to free non empty NodeList");
 		return;
 	}
+	free(NodeList->signal_node);
  	free(NodeList);
 
 } // End of DisposeNodeList
@@ -525,6 +930,27 @@ struct FlowNode *node;
 	return node;
 } // End of Pop_Node
 
+// wake up the flow thread with the reserved signal node - works also with an exhausted node cache
+void Push_SignalNode(NodeList_t *NodeList, struct timeval *tv) {
+struct FlowNode *node = NodeList->signal_node;
+
+	// the last signal is still queued - the flow thread gets woken up anyway
+	if ( !__sync_bool_compare_and_swap(&NodeList->signal_queued, 0, 1) )
+		return;
+
+	node->t_first = *tv;
+	node->t_last  = *tv;
+	Push_Node(NodeList, node);
+
+} // End of Push_SignalNode
+
+// the flow thread is done with the signal node - it may be pushed again
+void Release_SignalNode(NodeList_t *NodeList) {
+
+	__sync_lock_release(&NodeList->signal_queued);
+
+} // End of Release_SignalNode
+
 #ifdef DEVEL
 void DumpList(NodeList_t *NodeList) {
 struct FlowNode *node;
@@ -543,7 +969,7 @@ struct FlowNode *node;
 #endif
 
 void DumpNodeStat(void) {
-	LogInfo("Nodes in use: %u, Flows: %u CacheOverflow: %u", Allocated, NumFlows, CacheOverflow);
+	LogInfo("Nodes in use: %u, Flows: %u, Cache size: %u, CacheOverflow: %u", Allocated, NumFlows, CacheNodes, CacheOverflow);
 } // End of DumpNodeStat
 
 /*
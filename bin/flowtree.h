@@ -47,14 +47,18 @@
 #include <signal.h>
 
 #include "collector.h"
-#include "rbtree.h"
+
+// default flow expiry timeouts in seconds
+#define FLOW_ACTIVE_TIMEOUT		300
+#define FLOW_INACTIVE_TIMEOUT	60
 
 #define v4 ip_union._v4
 #define v6 ip_union._v6
 
 struct FlowNode {
-	// tree
-	RB_ENTRY(FlowNode) entry;
+	// flow table
+	struct FlowNode *hnext;
+	uint64_t	hash;
 
 	// linked list
 	struct FlowNode *left;
@@ -62,6 +66,11 @@ struct FlowNode {
 
 	struct FlowNode *biflow;
 
+	// expiry wheel
+	struct FlowNode *wnext;
+	struct FlowNode **wpprev;	// NULL, if not linked
+	time_t		expire;			// scheduled expiry check
+
 	// flow key
 	// IP addr
 	ip_addr_t	src_addr;
@@ -107,6 +116,8 @@ struct FlowNode {
 typedef struct NodeList_s {
 	struct FlowNode *list;
 	struct FlowNode *last;
+	struct FlowNode *signal_node;	// reserved SIGNAL_NODE - not taken from the node cache
+	uint32_t	signal_queued;
 	sig_atomic_t	list_lock;
 	pthread_mutex_t m_list;
 	pthread_cond_t  c_list;
@@ -116,18 +127,22 @@ typedef struct NodeList_s {
 } NodeList_t;
 
 
-/* flow tree type */
-typedef RB_HEAD(FlowTree, FlowNode) FlowTree_t;
-
-// Insert the RB prototypes here
-RB_PROTOTYPE(FlowTree, FlowNode, entry, FlowNodeCMP);
-
 int Init_FlowTree(uint32_t CacheSize);
 
 void Dispose_FlowTree(void);
 
+int Init_FlowTable(void);
+
+void Dispose_FlowTable(void);
+
 uint32_t Flush_FlowTree(FlowSource_t *fs);
 
+void SetFlowTimeout(uint32_t active, uint32_t inactive);
+
+uint32_t Expire_FlowTree(FlowSource_t *fs, time_t when);
+
+uint32_t FlowTreeSize(void);
+
 struct FlowNode *Lookup_Node(struct FlowNode *node);
 
 struct FlowNode *New_Node(void);
@@ -153,6 +168,10 @@ void Push_Node(NodeList_t *NodeList, struct FlowNode *node);
 
 struct FlowNode *Pop_Node(NodeList_t *NodeList, int *done);
 
+void Push_SignalNode(NodeList_t *NodeList, struct timeval *tv);
+
+void Release_SignalNode(NodeList_t *NodeList);
+
 void DumpList(NodeList_t *NodeList);
 
 // Stat functions
@@ -32,6 +32,7 @@
  *
  */
 
+
 #include "config.h"
 
 #include <stdio.h>
@@ -41,6 +42,7 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 
 #ifdef HAVE_NETINET_IN_SYSTM_H
 #include <netinet/in_systm.h>
@@ -54,9 +56,9 @@
 #include <netinet/ip.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "util.h"
-#include "rbtree.h"
 #include "ipfrag.h"
 
 #ifndef DEVEL
@@ -65,256 +67,627 @@
 #   define dbg_printf(...) printf(__VA_ARGS__)
 #endif
 
-#define KEYLEN (offsetof(IPFragNode_t,data_size) - offsetof(IPFragNode_t, src_addr))
-static int IPFragNodeCMP(struct IPFragNode *e1, struct IPFragNode *e2);
+/*
+ * Fragment table:
+ * Datagrams in reassembly are kept in a fixed size hash table with chained buckets.
+ * The nodes come from a pool, sized at init time. The reassembly buffers are carved
+ * from an arena of maxBytes, split into slabs of SLABSIZE bytes. A slab holds buffers
+ * of a single size class from MINBUFFER up to SLABSIZE. A datagram starts with the
+ * smallest buffer, which holds its first fragment and moves to a larger class, if a
+ * fragment does not fit. Empty slabs return to the arena for any class.
+ * All datagrams are linked into a time wheel with one slot per second. Expiring
+ * timed out datagrams and evicting the oldest ones, if the arena is exhausted,
+ * therefore never needs to scan the table.
+ */
+#define SLABSHIFT	16
+#define SLABSIZE	(1 << SLABSHIFT)	// 64k - holds any IP datagram
+#define MINSHIFT	11
+#define MINBUFFER	(1 << MINSHIFT)		// 2k - holds a 1500 bytes MTU fragment
+#define NUMCLASSES	(SLABSHIFT - MINSHIFT + 1)
+#define ClassSize(c)	((uint32_t)MINBUFFER << (c))
+
+#define MAXHOLES	32
+#define HOLE_INFINITY	IP_MAXPACKET
+
+// one slot per second - must be larger than IPFRAG_TIMEOUT
+#define WHEELSLOTS	32
+
+typedef struct hole_s {
+	uint32_t	first;
+	uint32_t	last;
+} hole_t;
+
+typedef struct IPFragNode_s {
+	// hash chain
+	struct IPFragNode_s	*hnext;
+	// time wheel list
+	struct IPFragNode_s	*wnext;
+	struct IPFragNode_s	*wprev;
+
+	// datagram key
+	uint32_t	src_addr[4];
+	uint32_t	dst_addr[4];
+	uint32_t	ident;
+	uint32_t	af;
+	// End of datagram key
+
+	uint32_t	hash;
+	uint32_t	data_class;		// size class of the data buffer
+	time_t		t_first;
+
+	// packet data
+	uint8_t		*data;
+	uint32_t	data_size;		// datagram size - known with the last fragment
+	uint32_t	numHoles;
+	hole_t		holes[MAXHOLES];
+} IPFragNode_t;
+
+#define KEYLEN (offsetof(IPFragNode_t, hash) - offsetof(IPFragNode_t, src_addr))
+
+typedef struct slab_s {
+	struct slab_s	*next;
+	struct slab_s	*prev;
+	void			*freelist;	// free buffers of this slab
+	uint32_t		class;
+	uint32_t		nfree;
+} slab_t;
+
+typedef struct wheel_slot_s {
+	IPFragNode_t	*head;
+	IPFragNode_t	*tail;
+} wheel_slot_t;
+
+// node pool and hash table
+static IPFragNode_t *Nodes;
+static IPFragNode_t *FreeNodes;
+static uint32_t		NumNodes;
+static uint32_t		NodesUsed;
+static IPFragNode_t **Bucket;
+static uint32_t		BucketMask;
+static uint32_t		NumFragments;
+
+// slab arena
+static uint8_t		*Arena;
+static slab_t		*Slabs;
+static uint32_t		NumSlabs;
+static uint32_t		SlabsUsed;
+static slab_t		*FreeSlabs;
+static slab_t		*PartialSlabs[NUMCLASSES];
+static uint64_t		SlabBytes;
+
+// time wheel
+static wheel_slot_t	Wheel[WHEELSLOTS];
+static time_t		WheelTime;
+
+static uint64_t	Completed, Expired, Evicted, Dropped;
+
+// the fragment table is shared by all packet threads
+static pthread_mutex_t m_IPFragTable = PTHREAD_MUTEX_INITIALIZER;
 
-static struct IPFragNode *New_frag_node(void);
+static inline uint64_t FragMix(uint64_t k);
 
-static void Free_node(struct IPFragNode *node, int free_data);
+static inline uint32_t FragHash(IPFragNode_t *node);
 
-static void Remove_node(struct IPFragNode *node);
+static void *BufferAlloc(uint32_t class);
 
-// Insert the IP RB tree code here
-RB_GENERATE(IPFragTree, IPFragNode, entry, IPFragNodeCMP);
+static void BufferFree(void *buf);
 
-static IPFragTree_t *IPFragTree;
-static uint32_t NumFragments;
+static void *BufferGet(uint32_t class, IPFragNode_t *keep);
 
-static int IPFragNodeCMP(struct IPFragNode *e1, struct IPFragNode *e2) {
-uint32_t    *a = &e1->src_addr;
-uint32_t    *b = &e2->src_addr;
+static void RemoveNode(IPFragNode_t *node);
+
+static void ExpireNodes(time_t now);
+
+static int EvictOldest(IPFragNode_t *keep);
+
+static void *UpdateFragment(int af, void *src, void *dst, uint32_t ident, uint32_t first, int more_fragments, 
+	uint32_t *length, void *data, time_t when);
+
+static inline uint64_t FragMix(uint64_t k) {
+
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdLL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53LL;
+	k ^= k >> 33;
+
+	return k;
+
+} // End of FragMix
+
+static inline uint32_t FragHash(IPFragNode_t *node) {
+uint64_t k;
 int i;
-   
-	// 2 x sizeof(uint32_t) (8) + frag_offset == 12
-	i = memcmp((void *)a, (void *)b, KEYLEN );
-	return i; 
- 
-} // End of IPFragNodeCMP
-
-static struct IPFragNode *New_frag_node(void) {
-struct IPFragNode *node;
-
-	node = malloc(sizeof(struct IPFragNode));
-	if ( !node ) {
-		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
-		return NULL;
+
+	k = ((uint64_t)node->af << 32) | node->ident;
+	for (i=0; i<4; i++ ) 
+		k = FragMix(k ^ (((uint64_t)node->src_addr[i] << 32) | node->dst_addr[i]));
+
+	return (uint32_t)k;
+
+} // End of FragHash
+
+/* slab handling */
+
+#define SlabBase(slab)	(Arena + ((size_t)((slab) - Slabs) << SLABSHIFT))
+#define BufferSlab(buf)	(&Slabs[((uint8_t *)(buf) - Arena) >> SLABSHIFT])
+
+static inline void SlabLink(slab_t *slab) {
+
+	slab->prev = NULL;
+	slab->next = PartialSlabs[slab->class];
+	if ( slab->next )
+		slab->next->prev = slab;
+	PartialSlabs[slab->class] = slab;
+
+} // End of SlabLink
+
+static inline void SlabUnlink(slab_t *slab) {
+
+	if ( slab->prev )
+		slab->prev->next = slab->next;
+	else
+		PartialSlabs[slab->class] = slab->next;
+	if ( slab->next )
+		slab->next->prev = slab->prev;
+	slab->next = slab->prev = NULL;
+
+} // End of SlabUnlink
+
+static void *BufferAlloc(uint32_t class) {
+slab_t *slab;
+void *buf;
+
+	slab = PartialSlabs[class];
+	if ( !slab ) {
+		uint32_t i, size, num;
+		uint8_t *base;
+
+		// take an empty slab and split it into buffers of this class
+		if ( FreeSlabs ) {
+			slab = FreeSlabs;
+			FreeSlabs = slab->next;
+		} else if ( SlabsUsed < NumSlabs ) {
+			slab = &Slabs[SlabsUsed++];
+		} else {
+			return NULL;
+		}
+
+		size = ClassSize(class);
+		num  = SLABSIZE / size;
+		base = SlabBase(slab);
+		for (i=0; i<num; i++ ) 
+			*(void **)(base + i * size) = i < (num-1) ? base + (i+1) * size : NULL;
+		slab->freelist = base;
+		slab->class	   = class;
+		slab->nfree	   = num;
+		SlabLink(slab);
+		SlabBytes += SLABSIZE;
 	}
-	memset((void *)node, 0, sizeof(struct IPFragNode));
 
-	node->data = malloc(IP_MAXPACKET);
-	if ( !node->data ) {
-		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
-		free(node);
-		return NULL;
+	buf = slab->freelist;
+	slab->freelist = *(void **)buf;
+	slab->nfree--;
+	if ( slab->nfree == 0 ) 
+		SlabUnlink(slab);
+
+	return buf;
+
+} // End of BufferAlloc
+
+static void BufferFree(void *buf) {
+slab_t *slab = BufferSlab(buf);
+uint32_t num = SLABSIZE / ClassSize(slab->class);
+
+	*(void **)buf  = slab->freelist;
+	slab->freelist = buf;
+	slab->nfree++;
+
+	if ( slab->nfree == num ) {
+		// slab is empty - return it to the arena
+		if ( num > 1 )
+			SlabUnlink(slab);
+		slab->next = FreeSlabs;
+		FreeSlabs  = slab;
+		SlabBytes -= SLABSIZE;
+	} else if ( slab->nfree == 1 ) {
+		SlabLink(slab);
 	}
-	memset(node->data, 0, IP_MAXPACKET);
 
-	node->eod = node->data;
-	node->data_size = 0;
+} // End of BufferFree
 
-	node->holes = malloc(sizeof(hole_t));
-	if ( !node->holes ) {
-		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
-		free(node);
+// get a buffer - evict the oldest datagrams other than keep, until the buffer fits into the arena
+static void *BufferGet(uint32_t class, IPFragNode_t *keep) {
+void *buf;
+
+	while ( (buf = BufferAlloc(class)) == NULL ) {
+		if ( !EvictOldest(keep) ) 
+			return NULL;
+	}
+	return buf;
+
+} // End of BufferGet
+
+/* node handling */
+
+static inline void WheelLink(IPFragNode_t *node) {
+wheel_slot_t *slot = &Wheel[node->t_first % WHEELSLOTS];
+
+	node->wnext = NULL;
+	node->wprev = slot->tail;
+	if ( slot->tail )
+		slot->tail->wnext = node;
+	else
+		slot->head = node;
+	slot->tail = node;
+
+} // End of WheelLink
+
+static inline void WheelUnlink(IPFragNode_t *node) {
+wheel_slot_t *slot = &Wheel[node->t_first % WHEELSLOTS];
+
+	if ( node->wprev )
+		node->wprev->wnext = node->wnext;
+	else
+		slot->head = node->wnext;
+	if ( node->wnext )
+		node->wnext->wprev = node->wprev;
+	else
+		slot->tail = node->wprev;
+
+} // End of WheelUnlink
+
+static IPFragNode_t *NewNode(void) {
+IPFragNode_t *node;
+
+	if ( FreeNodes ) {
+		node = FreeNodes;
+		FreeNodes = node->hnext;
+	} else if ( NodesUsed < NumNodes ) {
+		node = &Nodes[NodesUsed++];
+	} else {
 		return NULL;
 	}
-	node->holes->next  = NULL;
-	node->holes->first = 0;
-	node->holes->last = IP_MAXPACKET;
 	NumFragments++;
 
 	return node;
 
-} // End of New_frag_node
+} // End of NewNode
 
-static void Free_node(struct IPFragNode *node, int free_data) {
-hole_t *hole, *h;
+static void RemoveNode(IPFragNode_t *node) {
+IPFragNode_t **n;
 
-	hole = node->holes;
-	while (hole) {
-		h = hole->next;
-		free(hole);
-		hole = h;
+	for ( n = &Bucket[node->hash & BucketMask]; *n != NULL; n = &(*n)->hnext ) {
+		if ( *n == node ) {
+			*n = node->hnext;
+			break;
+		}
 	}
-	if (free_data) 
-		free(node->data);
-	free(node);
+	WheelUnlink(node);
+
+	if ( node->data ) 
+		BufferFree(node->data);
+	node->data  = NULL;
+	node->hnext = FreeNodes;
+	FreeNodes	= node;
 	NumFragments--;
 
-} // End of Free_node
+} // End of RemoveNode
 
-static void Remove_node(struct IPFragNode *node) {
-struct IPFragNode *n;
+static void ExpireNodes(time_t now) {
+int i;
 
-	n = RB_REMOVE(IPFragTree, IPFragTree, node);
-	if ( n ) {
-		Free_node(n, 0);
-	} // else - node not in tree
+	if ( now <= WheelTime )
+		return;
+
+	// the wheel advanced at least one second - check the head of each slot
+	WheelTime = now;
+	for (i=0; i<WHEELSLOTS; i++ ) {
+		IPFragNode_t *node;
+		while ( (node = Wheel[i].head) != NULL && (node->t_first + IPFRAG_TIMEOUT) <= now ) {
+			dbg_printf("Expire datagram - ident: %u\n", node->ident);
+			RemoveNode(node);
+			Expired++;
+		}
+	}
+
+} // End of ExpireNodes
+
+static int EvictOldest(IPFragNode_t *keep) {
+int i;
+
+	// the slot after the current second holds the oldest datagrams
+	for (i=1; i<=WHEELSLOTS; i++ ) {
+		IPFragNode_t *node = Wheel[(WheelTime + i) % WHEELSLOTS].head;
+		if ( node && node == keep )
+			node = node->wnext;
+		if ( node ) {
+			dbg_printf("Evict datagram - ident: %u\n", node->ident);
+			RemoveNode(node);
+			Evicted++;
+			return 1;
+		}
+	}
+
+	return 0;
 
-} // End of Remove_node
+} // End of EvictOldest
 
-int IPFragTree_init(void) {
-	IPFragTree = malloc(sizeof(IPFragTree_t));
-	if ( !IPFragTree ) {
+int IPFrag_init(uint64_t maxBytes) {
+uint32_t numBuckets;
+
+	if ( maxBytes < (NUMCLASSES * SLABSIZE) )
+		maxBytes = NUMCLASSES * SLABSIZE;
+
+	NumSlabs  = maxBytes >> SLABSHIFT;
+	SlabsUsed = 0;
+	// each datagram holds at least one MINBUFFER
+	NumNodes  = NumSlabs * (SLABSIZE / MINBUFFER);
+	NodesUsed = 0;
+	numBuckets = 1;
+	while ( numBuckets < NumNodes ) 
+		numBuckets <<= 1;
+	BucketMask = numBuckets - 1;
+
+	// the arena is touched on demand only
+	Arena  = malloc((size_t)NumSlabs << SLABSHIFT);
+	Slabs  = calloc(NumSlabs, sizeof(slab_t));
+	Nodes  = calloc(NumNodes, sizeof(IPFragNode_t));
+	Bucket = calloc(numBuckets, sizeof(IPFragNode_t *));
+	if ( !Arena || !Slabs || !Nodes || !Bucket ) {
 		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+		IPFrag_free();
 		return 0;
 	}
-	RB_INIT(IPFragTree);
+
+	FreeNodes = NULL;
+	FreeSlabs = NULL;
+	memset((void *)PartialSlabs, 0, sizeof(PartialSlabs));
+	memset((void *)Wheel, 0, sizeof(Wheel));
+	WheelTime = 0;
 	NumFragments = 0;
-	dbg_printf("IPFrag key len: %lu\n", KEYLEN);
+	SlabBytes	 = 0;
+	Completed = Expired = Evicted = Dropped = 0;
+	dbg_printf("IPFrag key len: %lu, slabs: %u, nodes: %u\n", KEYLEN, NumSlabs, NumNodes);
+
 	return 1;
-} // End of IPFragTree_init
 
-void IPFragTree_free(void) {
-struct IPFragNode *node, *nxt;
+} // End of IPFrag_init
 
-    // Dump all incomplete flows to the file
-    for (node = RB_MIN(IPFragTree, IPFragTree); node != NULL; node = nxt) {
-        nxt = RB_NEXT(IPFragTree, IPFragTree, node);
-        RB_REMOVE(IPFragTree, IPFragTree, node);
-		Free_node(node, 1);
-    }
+void IPFrag_free(void) {
 
-	free(IPFragTree);
-	IPFragTree = NULL;
+	free(Arena);
+	free(Slabs);
+	free(Nodes);
+	free(Bucket);
+	Arena  = NULL;
+	Slabs  = NULL;
+	Nodes  = NULL;
+	Bucket = NULL;
 	NumFragments = 0;
 
-} // End of IPFragTree_free
+} // End of IPFrag_free
 
-void *IPFrag_tree_Update(uint32_t src, uint32_t dst, uint32_t ident, uint32_t *length, uint32_t ip_off, void *data) {
-struct IPFragNode FindNode, *n;
-hole_t *hole, *h, *hole_parent;
-uint16_t more_fragments, first, last, max;
-int found_hole;
+/*
+ * Add a fragment to its datagram. offset is the fragment offset in bytes.
+ * Returns the reassembled datagram, once complete and sets length to the datagram size.
+ * The returned buffer must be released with IPFrag_Release().
+ */
+void *IPFrag_Update(int af, void *src, void *dst, uint32_t ident, uint32_t offset, int more_fragments, 
+	uint32_t *length, void *data, time_t when) {
+void *defragmented;
 
-	FindNode.src_addr = src;
-	FindNode.dst_addr = dst;
-	FindNode.ident 	  = ident;
-	n = RB_FIND(IPFragTree, IPFragTree, &FindNode);
-	if ( !n ) {
-		n = New_frag_node();
-		n->src_addr = src;
-		n->dst_addr = dst;
-		n->ident 	= ident;
-		if ( RB_INSERT(IPFragTree, IPFragTree, n) ) {
-			// must never happen
-			LogError("Node insert returned existing node - Software error in %s line %d", __FILE__, __LINE__);
-		}
-	}
-	hole = n->holes;
-	hole_parent = NULL;
+	pthread_mutex_lock(&m_IPFragTable);
+	defragmented = UpdateFragment(af, src, dst, ident, offset, more_fragments, length, data, when);
+	pthread_mutex_unlock(&m_IPFragTable);
+
+	return defragmented;
+
+} // End of IPFrag_Update
+
+void IPFrag_Release(void *data) {
+
+	pthread_mutex_lock(&m_IPFragTable);
+	BufferFree(data);
+	pthread_mutex_unlock(&m_IPFragTable);
+
+} // End of IPFrag_Release
+
+static inline int AddHole(hole_t *holes, uint32_t *numHoles, uint32_t first, uint32_t last) {
+
+	if ( *numHoles == MAXHOLES )
+		return 0;
+	holes[*numHoles].first = first;
+	holes[*numHoles].last  = last;
+	(*numHoles)++;
+	return 1;
+
+} // End of AddHole
+
+static void *UpdateFragment(int af, void *src, void *dst, uint32_t ident, uint32_t first, int more_fragments, 
+	uint32_t *length, void *data, time_t when) {
+IPFragNode_t FindNode, *n;
+hole_t holes[MAXHOLES];
+uint32_t last, hash, i, numHoles;
+int overflow, overlap, filled;
+
+	// packets may be slightly out of order - never go back in time
+	if ( when < WheelTime ) 
+		when = WheelTime;
+	ExpireNodes(when);
+
+	if ( *length == 0 )
+		return NULL;
 
-	first = (ip_off & IP_OFFMASK) << 3;
-	more_fragments = (ip_off & IP_MF) != 0 ? 1 : 0;
 	last = first + *length - 1;
-	
-	if ( last > IP_MAXPACKET ) {
+	if ( last >= HOLE_INFINITY ) {
 		LogError("Fragment assembly error: last > IP_MAXPACKET");
 		LogError("Fragment assembly: first: %u, last: %u, MF: %u\n", first, last, more_fragments);
 		return NULL;
 	}
 
-	// last fragment - sets max offset
-	found_hole = 0;
-	max = more_fragments == 0 ? last : 0;
+	memset((void *)FindNode.src_addr, 0, KEYLEN);
+	if ( af == AF_INET6 ) {
+		memcpy((void *)FindNode.src_addr, src, 16);
+		memcpy((void *)FindNode.dst_addr, dst, 16);
+	} else {
+		memcpy((void *)FindNode.src_addr, src, 4);
+		memcpy((void *)FindNode.dst_addr, dst, 4);
+	}
+	FindNode.ident = ident;
+	FindNode.af	   = af;
+	hash = FragHash(&FindNode);
+
+	for ( n = Bucket[hash & BucketMask]; n != NULL; n = n->hnext ) {
+		if ( n->hash == hash && memcmp((void *)n->src_addr, (void *)FindNode.src_addr, KEYLEN) == 0 ) 
+			break;
+	}
+
+	if ( !n ) {
+		uint32_t class = 0;
+		while ( ClassSize(class) <= last )
+			class++;
+
+		n = NewNode();
+		if ( !n && EvictOldest(NULL) ) 
+			n = NewNode();
+		if ( !n ) {
+			Dropped++;
+			return NULL;
+		}
+		memcpy((void *)n->src_addr, (void *)FindNode.src_addr, KEYLEN);
+		n->hash		  = hash;
+		n->t_first	  = when;
+		n->data_size  = 0;
+		n->numHoles	  = 1;
+		n->holes[0].first = 0;
+		n->holes[0].last  = HOLE_INFINITY;
+		n->hnext = Bucket[hash & BucketMask];
+		Bucket[hash & BucketMask] = n;
+		WheelLink(n);
+
+		n->data_class = class;
+		n->data = BufferGet(class, n);
+		if ( !n->data ) {
+			RemoveNode(n);
+			Dropped++;
+			return NULL;
+		}
+	}
 	dbg_printf("Fragment assembly: first: %u, last: %u, MF: %u\n", first, last, more_fragments);
-	while (hole) {
-		uint16_t hole_last;
-		if ( max ) {
-			dbg_printf("max in last fragment: %u\n", max);
-			// last fragment offset/length
-			if ( hole->last == IP_MAXPACKET ) {
-				// last fragment has max size
-				if ( max > hole->first ) {
-					dbg_printf("set max of last fragment: %u\n", max);
-					hole->last = max;
-				} else {
-					LogError("last fragment offset error - teardrop attack??");
-				}
-			} else {
-				// last fragment must always be max offset
-				if ( max < hole->last ) {
-					LogError("last fragment offset error - teardrop attack??");
-				}
-			}
+
+	// fragment beyond the end of the datagram or conflicting last fragments
+	if ( n->data_size && (last >= n->data_size || (!more_fragments && last != (n->data_size - 1))) ) {
+		LogError("last fragment offset error - teardrop attack??");
+		RemoveNode(n);
+		Dropped++;
+		return NULL;
+	}
+	if ( !more_fragments ) 
+		n->data_size = last + 1;
+
+	// grow the buffer, if the fragment does not fit
+	if ( last >= ClassSize(n->data_class) ) {
+		uint32_t class = n->data_class;
+		void *buf;
+		while ( ClassSize(class) <= last )
+			class++;
+		buf = BufferGet(class, n);
+		if ( !buf ) {
+			RemoveNode(n);
+			Dropped++;
+			return NULL;
 		}
-		dbg_printf("Check Hole: first: %u, last: %u\n", hole->first, hole->last);
+		memcpy(buf, n->data, ClassSize(n->data_class));
+		BufferFree(n->data);
+		n->data = buf;
+		n->data_class = class;
+	}
 
-		if ( first > hole->last ) {
-			hole_parent = hole;
-			hole = hole->next;
-			dbg_printf("Fragment right outside hole\n");
-			continue;
+	// RFC 815 hole algorithm - a fragment must fill a part of exactly one hole
+	numHoles = 0;
+	overflow = 0;
+	overlap	 = 0;
+	filled	 = 0;
+	for (i=0; i<n->numHoles && !overflow && !overlap; i++ ) {
+		uint32_t hole_first = n->holes[i].first;
+		uint32_t hole_last  = n->holes[i].last;
+
+		if ( n->data_size ) {
+			// the datagram size is known - cut holes at the end
+			if ( hole_first >= n->data_size )
+				continue;
+			if ( hole_last >= n->data_size )
+				hole_last = n->data_size - 1;
 		}
-		if ( last < hole->first ) {
-			hole_parent = hole;
-			hole = hole->next;
-			dbg_printf("Fragment left outside hole\n");
+
+		if ( first > hole_last || last < hole_first ) {
+			// fragment outside hole
+			overflow = !AddHole(holes, &numHoles, hole_first, hole_last);
 			continue;
 		}
-
-		// fragment fits into hole
-		found_hole = 1;
-		if ( last > n->data_size ) 
-			n->data_size = last;
-
-		hole_last = hole->last;
-		if ( first == hole->first ) {
-			dbg_printf("Fragment matches first\n");
-			// fragment fits at beginning of hole
-			if ( last == hole->last ) { 
-				dbg_printf("Fragment matches last\n");
-				// fragment fits completly into hole - delete hole
-				if ( hole_parent ) {
-					hole_parent->next = hole->next;
-				} else {
-					n->holes = NULL;
-				}
-				free(hole);
-				hole = NULL;
-			} else { 
-				// fragment smaller than hole
-				dbg_printf("Fragment smaller than hole\n");
-				hole->first = last+1;
-			}
-		} else {
-			// fragment start within hole
-			dbg_printf("Fragment inside hole\n");
-			hole->last = first - 1;
-			if ( last < hole_last ) {
-				// fragment ends within hole - add another hole
-				h = malloc(sizeof(hole_t));
-				if ( !h ) {
-					LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
-					return NULL;
-				}
-				h->first = last + 1;
-				h->last  = hole_last;
-				h->next  = n->holes;
-				n->holes = h;
-			}
+		if ( first < hole_first || last > hole_last ) {
+			// fragment overlaps data already received
+			overlap = 1;
+			break;
 		}
-		memcpy(n->data + first, data, *length);
+		filled = 1;
+		if ( first > hole_first ) 
+			overflow = !AddHole(holes, &numHoles, hole_first, first - 1);
+		if ( last < hole_last && !overflow ) 
+			overflow = !AddHole(holes, &numHoles, last + 1, hole_last);
+	}
 
-		break;
+	if ( overflow ) {
+		LogError("Fragment assembly: too many holes - drop datagram");
+		RemoveNode(n);
+		Dropped++;
+		return NULL;
 	}
-	
-	if ( !found_hole )
-		LogError("No space - Fragment overlap: first: %u, last: %u\n", first, last);
-	
-	if ( n->holes == NULL ) {
-		void *data = n->data;
-		n->data_size++;
-		*length = n->data_size;
-		Remove_node(n);
-		dbg_printf("Datagramm complete - size: %u\n", n->data_size);
-		return data;
-	} else {
+	if ( !filled && !overlap && memcmp(n->data + first, data, *length) == 0 ) {
+		// retransmitted fragment - already in the datagram
+		return NULL;
+	}
+	if ( overlap || !filled ) {
+		LogError("Fragment assembly: overlapping fragments - drop datagram");
+		RemoveNode(n);
+		Dropped++;
 		return NULL;
 	}
+	memcpy((void *)n->holes, (void *)holes, numHoles * sizeof(hole_t));
+	n->numHoles = numHoles;
 
-} // End of IPFrag_tree_Update
+	memcpy(n->data + first, data, *length);
 
-uint32_t IPFragEntries() {
+	if ( numHoles == 0 ) {
+		void *datagram = n->data;
+		*length = n->data_size;
+		dbg_printf("Datagram complete - size: %u\n", n->data_size);
+		// hand over the buffer to the caller
+		n->data = NULL;
+		RemoveNode(n);
+		Completed++;
+		return datagram;
+	} 
+
+	return NULL;
+
+} // End of UpdateFragment
+
+uint32_t IPFragEntries(void) {
 	return NumFragments;
 } // End of IPFragEntries
+
+void IPFragStat(ipfrag_stat_t *stat) {
+
+	pthread_mutex_lock(&m_IPFragTable);
+	stat->entries	= NumFragments;
+	stat->fill		= 0;
+	stat->bytes		= SlabBytes;
+	stat->completed = Completed;
+	stat->expired	= Expired;
+	stat->evicted	= Evicted;
+	stat->dropped	= Dropped;
+	pthread_mutex_unlock(&m_IPFragTable);
+
+} // End of IPFragStat
@@ -35,50 +35,38 @@
 #include "config.h"
 
 #include <sys/types.h>
+#include <time.h>
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
 #endif
 
-#include "rbtree.h"
+// datagrams not completed within IPFRAG_TIMEOUT seconds are expired
+#define IPFRAG_TIMEOUT	30
 
-typedef struct hole_s {
-	struct hole_s *next;
-	uint32_t	first;
-	uint32_t	last;
-} hole_t;
+// default memory bound of all reassembly buffers
+#define IPFRAG_MAXBYTES	(64 * 1024 * 1024)
 
-struct IPFragNode {
-	// tree
-	RB_ENTRY(IPFragNode) entry;
+typedef struct ipfrag_stat_s {
+	uint32_t	entries;	// datagrams in reassembly
+	uint32_t	fill;
+	uint64_t	bytes;		// slab memory in use
+	uint64_t	completed;	// reassembled datagrams
+	uint64_t	expired;	// datagrams timed out
+	uint64_t	evicted;	// datagrams evicted to stay within the memory bound
+	uint64_t	dropped;	// datagrams dropped due to bogus or too many fragments
+} ipfrag_stat_t;
 
-	// flow key
-	// IP addr
-	uint32_t	src_addr;
-	uint32_t	dst_addr;
-	uint32_t	ident;
-	// End of flow key
+int IPFrag_init(uint64_t maxBytes);
 
-	uint32_t	data_size;
-	// packet data
-	void		*data;
-	void		*eod;
-	hole_t *holes;
-};
+void IPFrag_free(void);
 
-typedef struct IPFragNode IPFragNode_t;
+void *IPFrag_Update(int af, void *src, void *dst, uint32_t ident, uint32_t offset, int more_fragments, 
+	uint32_t *length, void *data, time_t when);
 
-/* flow tree type */
-typedef RB_HEAD(IPFragTree, IPFragNode) IPFragTree_t;
-
-// Insert the RB prototypes here
-RB_PROTOTYPE(IPFragTree, IPFragNode, entry, IPFragNodeCMP);
-
-int IPFragTree_init(void);
-
-void IPFragTree_free(void);
-
-void *IPFrag_tree_Update(uint32_t src, uint32_t dst, uint32_t ident, uint32_t *length, uint32_t ip_off, void *data);
+void IPFrag_Release(void *data);
 
 uint32_t IPFragEntries(void);
 
+void IPFragStat(ipfrag_stat_t *stat);
+
 #endif
@@ -253,6 +253,10 @@ int				ret, bookkeeper_stat, do_rescan;
 	ret = ReadStatInfo(datadir, &dirstat, CREATE_AND_LOCK);
 	switch (ret) {
 		case STATFILE_OK:
+			if ( !CatalogExists(datadir) ) {
+				LogInfo("Rebuild stat record to create file catalog");
+				do_rescan = 1;
+			}
 			break;
 		case ERR_NOSTATFILE:
 			dirstat->low_water = 95;
@@ -320,7 +324,7 @@ int				ret, bookkeeper_stat, do_rescan;
 
 } // End of do_expire
 
-void launcher (char *commbuff, FlowSource_t *FlowSource, char *process, int expire) {
+void launcher (char *commbuff, FlowSource_t *FlowSource, char *process, char *rollup, int expire) {
 FlowSource_t	*fs;
 struct sigaction act;
 char 		*args[MAXARGS];
@@ -329,7 +333,7 @@ srecord_t	*InfoRecord;
 
 	InfoRecord = (srecord_t *)commbuff;
 
-	LogInfo("Launcher: Startup. auto-expire %s", expire ? "enabled" : "off" );
+	LogInfo("Launcher: Startup. auto-expire %s, rollups %s", expire ? "enabled" : "off", rollup ? rollup : "off" );
 	done = launch = child_exit = 0;
 
 	// process may be NULL, if we only expire data files
@@ -399,6 +403,23 @@ srecord_t	*InfoRecord;
 				}
 			}
 
+			// merge the new file into the rollups of each flow source
+			if ( rollup && !InfoRecord->failed ) {
+				fs = FlowSource;
+				while ( fs ) {
+					char cmd[MAXCMDLEN];
+					snprintf(cmd, MAXCMDLEN, "nfrollup -A %s -l %s -r %s/%s", 
+						rollup, fs->datadir, fs->datadir, InfoRecord->fname);
+					cmd[MAXCMDLEN-1] = '\0';
+					dbg_printf("Launcher: ident: %s run rollup: '%s'", fs->Ident, cmd);
+
+					cmd_parse(cmd, args);
+					if ( args[0] )
+						cmd_execute(args);
+					fs = fs->next;
+				}
+			}
+
 			fs = FlowSource;
 			while ( fs ) {
 				if ( expire ) 
@@ -76,6 +76,9 @@ static extension_map_t	*pcap_extension_map;
 static uint32_t pcap_output_record_size_v4;
 static uint32_t pcap_output_record_size_v6;
 
+// serialize flow threads storing flows into the same output file
+static pthread_mutex_t m_output = PTHREAD_MUTEX_INITIALIZER;
+
 typedef struct pcap_v4_block_s {
 	uint32_t	srcaddr;
 	uint32_t	dstaddr;
@@ -99,6 +102,8 @@ static uint16_t pcap_full_map[] = { EX_LATENCY, 0 };
 
 #include "nffile_inline.c"
 
+static int StoreFlow(FlowSource_t *fs, struct FlowNode *Node);
+
 int Init_pcap2nf(void) {
 int i, id, map_index;
 int extension_size;
@@ -157,6 +162,17 @@ uint16_t	map_size;
 } // End of Init_pcap2nf
 
 int StorePcapFlow(FlowSource_t *fs, struct FlowNode *Node) {
+int ret;
+
+	pthread_mutex_lock(&m_output);
+	ret = StoreFlow(fs, Node);
+	pthread_mutex_unlock(&m_output);
+
+	return ret;
+
+} // End of StorePcapFlow
+
+static int StoreFlow(FlowSource_t *fs, struct FlowNode *Node) {
 common_record_t		*common_record;
 uint32_t			packets, bytes, pcap_output_record_size;
 uint64_t	start_time, end_time;
@@ -326,7 +342,7 @@ void		*data_ptr;
 
 	return 1;
 
-} /* End of StorePcapFlow */
+} /* End of StoreFlow */
 
 // Server latency = t(SYN Server) - t(SYN CLient)
 void SetServer_latency(struct FlowNode *node) {
@@ -351,6 +367,11 @@ struct FlowNode *Server_node;
 uint64_t	latency;
 
 	Server_node = node->rev_node;
+	if ( !Server_node ) {
+		// server node expired already
+		node->latency.flag = 0;
+		return;
+	}
 	latency = ((uint64_t)t_packet->tv_sec * (uint64_t)1000000 + (uint64_t)t_packet->tv_usec) -
 			  ((uint64_t)Server_node->t_first.tv_sec * (uint64_t)1000000 + (uint64_t)Server_node->t_first.tv_usec);
 	
@@ -371,6 +392,11 @@ struct FlowNode *Client_node;
 uint64_t	latency;
 
 	Client_node = node->rev_node;
+	if ( !Client_node ) {
+		// client node expired already
+		node->latency.flag = 0;
+		return;
+	}
 	latency = ((uint64_t)t_packet->tv_sec * (uint64_t)1000000 + (uint64_t)t_packet->tv_usec) -
 			  ((uint64_t)node->latency.t_request.tv_sec * (uint64_t)1000000 + (uint64_t)node->latency.t_request.tv_usec);
 	
@@ -113,6 +113,7 @@ typedef struct exporter_v5_s {
 static netflow_v5_header_t	*v5_output_header;
 static netflow_v5_record_t	*v5_output_record;
 static exporter_v5_t 		output_engine;
+static int					output_cnt;	// records in current output packet
 
 static inline exporter_v5_t *GetExporter(FlowSource_t *fs, netflow_v5_header_t *header);
 
@@ -668,6 +669,8 @@ void Init_v5_v7_output(send_peer_t *peer) {
 	v5_output_header->unix_secs		= 0;
 	v5_output_header->unix_nsecs	= 0;
 	v5_output_header->count 		= 0;
+	v5_output_header->engine_tag	= 0;
+	v5_output_header->sampling_interval = 0;
 	output_engine.first				= 1;
 
 	output_engine.sequence		   = 0;
@@ -680,7 +683,6 @@ void Init_v5_v7_output(send_peer_t *peer) {
 
 int Add_v5_output_record(master_record_t *master_record, send_peer_t *peer) {
 static uint64_t	boot_time;	// in msec
-static int	cnt;
 extension_map_t *extension_map = master_record->map_ref;
 uint32_t	i, id, t1, t2;
 
@@ -692,10 +694,10 @@ uint32_t	i, id, t1, t2;
 		// boot time is set one day back - assuming that the start time of every flow does not start ealier
 		boot_time  			 		= (uint64_t)(master_record->first - 86400)*1000;
 		v5_output_header->unix_secs = htonl(master_record->first - 86400);
-		cnt   	 = 0;
+		output_cnt		 = 0;
 		output_engine.first 	 = 0;
 	}
-	if ( cnt == 0 ) {
+	if ( output_cnt == 0 ) {
 		peer->buff_ptr  = (void *)((pointer_addr_t)peer->send_buffer + NETFLOW_V5_HEADER_LENGTH);
 		v5_output_record = (netflow_v5_record_t *)((pointer_addr_t)v5_output_header + (pointer_addr_t)sizeof(netflow_v5_header_t));	
 		output_engine.sequence = output_engine.last_sequence + output_engine.last_count;
@@ -753,17 +755,34 @@ uint32_t	i, id, t1, t2;
 		}
 		i++;
 	}
-	cnt++;
+	output_cnt++;
 
-	v5_output_header->count 	= htons(cnt);
+	v5_output_header->count 	= htons(output_cnt);
 	peer->buff_ptr = (void *)((pointer_addr_t)peer->buff_ptr + NETFLOW_V5_RECORD_LENGTH);
 	v5_output_record++;
-	if ( cnt == NETFLOW_V5_MAX_RECORDS ) {
+	if ( output_cnt == NETFLOW_V5_MAX_RECORDS ) {
 		peer->flush = 1;
-		output_engine.last_count 	  = cnt;
-		cnt = 0; 
+		output_engine.last_count 	  = output_cnt;
+		output_cnt = 0; 
 	}
 
 	return 0;
 
 } // End of Add_v5_output_record
+
+/*
+ * Terminate the current packet of the output buffer
+ * returns 1 and sets peer->flush, if the packet contains any records
+ */
+int Flush_v5_output(send_peer_t *peer) {
+
+	if ( output_cnt == 0 ) 
+		return 0;
+
+	peer->flush = 1;
+	output_engine.last_count = output_cnt;
+	output_cnt = 0;
+
+	return 1;
+
+} // End of Flush_v5_output
@@ -133,6 +133,8 @@ void Init_v5_v7_output(send_peer_t *peer);
 
 int Add_v5_output_record(master_record_t *master_record, send_peer_t *peer);
 
+int Flush_v5_output(send_peer_t *peer);
+
 /*
  * Extension map for v5/v7
  *
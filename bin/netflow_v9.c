@@ -389,6 +389,12 @@ typedef struct output_templates_s {
 #define MAX_LIFETIME 60
 
 static output_template_t	*output_templates;
+
+// direct mapped cache of recently used output templates
+#define TEMPLATE_CACHE_SIZE	256
+#define TEMPLATE_CACHE_HASH(flags, map) \
+	((uint32_t)((((pointer_addr_t)(map) >> 3) ^ ((flags) * 0x9E3779B1U))) & (TEMPLATE_CACHE_SIZE - 1))
+static output_template_t	*template_cache[TEMPLATE_CACHE_SIZE];
 static uint64_t	boot_time;	// in msec
 static uint16_t				template_id;
 static uint32_t				Max_num_v9_tags;
@@ -435,6 +441,13 @@ static uint64_t	Get_val64(void *p);
 // for sending netflow v9
 static netflow_v9_header_t	*v9_output_header;
 
+// state of the current output packet
+static data_flowset_t		*output_flowset;
+static output_template_t	*output_template;
+static uint32_t				last_flags = 0;
+static extension_map_t		*last_map = NULL;
+static int	record_count, template_count, flowset_count, packet_count;
+
 /* functions */
 
 #include "nffile_inline.c"
@@ -2234,15 +2247,21 @@ int i;
 } // End of Init_v9_output
 
 static output_template_t *GetOutputTemplate(uint32_t flags, extension_map_t *extension_map) {
-output_template_t **t;
+output_template_t **t, **cache_slot;
 template_record_t	*fields;
 uint32_t	i, count, record_length;
 
+	cache_slot = &template_cache[TEMPLATE_CACHE_HASH(flags, extension_map)];
+	if ( *cache_slot && (*cache_slot)->flags == flags && (*cache_slot)->extension_map == extension_map )
+		return *cache_slot;
+
 	t = &output_templates;
 	// search for the template, which corresponds to our flags and extension map
 	while ( *t ) {
-		if ( (*t)->flags == flags &&  (*t)->extension_map == extension_map ) 
+		if ( (*t)->flags == flags &&  (*t)->extension_map == extension_map ) {
+			*cache_slot = *t;
 			return *t;
+		}
 		t = &((*t)->next);
 	}
 
@@ -2622,6 +2641,7 @@ uint32_t	i, count, record_length;
 	fields->template_id		= htons(template_id++);
 	fields->count			= htons(count);
 
+	*cache_slot = *t;
 	return *t;
 
 } // End of GetOutputTemplate
@@ -2841,11 +2861,6 @@ uint16_t	icmp;
 } // End of Append_Record
 
 int Add_v9_output_record(master_record_t *master_record, send_peer_t *peer) {
-static data_flowset_t		*data_flowset;
-static output_template_t	*template;
-static uint32_t	last_flags = 0;
-static extension_map_t *last_map = NULL;
-static int	record_count, template_count, flowset_count, packet_count;
 uint32_t	required_size;
 void		*endwrite;
 time_t		now = time(NULL);
@@ -2866,7 +2881,7 @@ time_t		now = time(NULL);
 		template_count = 0;
 		flowset_count  = 0;
 		packet_count   = 0;
-		data_flowset   = NULL;
+		output_flowset = NULL;
 
 		// write common blocksize from frst up to including dstas for one write (memcpy)
 //		common_block_size = (pointer_addr_t)&master_record->fill - (pointer_addr_t)&master_record->first;
@@ -2876,23 +2891,23 @@ time_t		now = time(NULL);
 		v9_output_header->sequence = htonl(packet_count);
 	}
 
-	if ( data_flowset ) {
+	if ( output_flowset ) {
 		// output buffer contains already a data flowset
 		if ( last_flags == master_record->flags && last_map == master_record->map_ref ) {
 			// same id as last record
 			// if ( now - template->time_sent > MAX_LIFETIME )
 			if ( (record_count & 0xFFF) == 0 ) {	// every 4096 flow records
-				uint16_t length = (pointer_addr_t)peer->buff_ptr - (pointer_addr_t)data_flowset;
+				uint16_t length = (pointer_addr_t)peer->buff_ptr - (pointer_addr_t)output_flowset;
 				uint8_t	align   = length & 0x3;
 				if ( align != 0 ) {
 					length += ( 4 - align );
-					data_flowset->length = htons(length);
+					output_flowset->length = htons(length);
 					peer->buff_ptr += align;
 				}
 				// template refresh is needed
 				// terminate the current data flowset
-				data_flowset = NULL;
-				if ( (pointer_addr_t)peer->buff_ptr + template->flowset_length > (pointer_addr_t)peer->endp ) {
+				output_flowset = NULL;
+				if ( (pointer_addr_t)peer->buff_ptr + output_template->flowset_length > (pointer_addr_t)peer->endp ) {
 					// not enough space for template flowset => flush buffer first
 					record_count   = 0;
 					flowset_count  = 0;
@@ -2900,37 +2915,37 @@ time_t		now = time(NULL);
 					peer->flush = 1;
 					return 1;	// return to flush buffer
 				}
-				memcpy(peer->buff_ptr, (void *)template->template_flowset, template->flowset_length);
-				peer->buff_ptr = (void *)((pointer_addr_t)peer->buff_ptr + template->flowset_length);
-				template->time_sent = now;
+				memcpy(peer->buff_ptr, (void *)output_template->template_flowset, output_template->flowset_length);
+				peer->buff_ptr = (void *)((pointer_addr_t)peer->buff_ptr + output_template->flowset_length);
+				output_template->time_sent = now;
 				flowset_count++;
 				template_count++;
 
 				// open a new data flow set at this point in the output buffer
-				data_flowset = (data_flowset_t *)peer->buff_ptr;
-				data_flowset->flowset_id = template->template_flowset->fields[0].template_id;
-				peer->buff_ptr = (void *)data_flowset->data;
+				output_flowset = (data_flowset_t *)peer->buff_ptr;
+				output_flowset->flowset_id = output_template->template_flowset->fields[0].template_id;
+				peer->buff_ptr = (void *)output_flowset->data;
 				flowset_count++;
 			} // else Add record
 
 		} else {
 			// record with different template id
 			// terminate the current data flowset
-			uint16_t length = (pointer_addr_t)peer->buff_ptr - (pointer_addr_t)data_flowset;
+			uint16_t length = (pointer_addr_t)peer->buff_ptr - (pointer_addr_t)output_flowset;
 			uint8_t	align   = length & 0x3;
 			if ( align != 0 ) {
 				length += ( 4 - align );
-				data_flowset->length = htons(length);
+				output_flowset->length = htons(length);
 				peer->buff_ptr += align;
 			}
-			data_flowset = NULL;
+			output_flowset = NULL;
 
 			last_flags 	= master_record->flags;
 			last_map	= master_record->map_ref;
-			template 	= GetOutputTemplate(last_flags, master_record->map_ref);
-			if ( now - template->time_sent > MAX_LIFETIME ) {
+			output_template 	= GetOutputTemplate(last_flags, master_record->map_ref);
+			if ( now - output_template->time_sent > MAX_LIFETIME ) {
 				// refresh template is needed
-				endwrite= (void *)((pointer_addr_t)peer->buff_ptr + template->flowset_length + sizeof(data_flowset_t));
+				endwrite= (void *)((pointer_addr_t)peer->buff_ptr + output_template->flowset_length + sizeof(data_flowset_t));
 				if ( endwrite > peer->endp ) {
 					// not enough space for template flowset => flush buffer first
 					record_count   = 0;
@@ -2939,16 +2954,16 @@ time_t		now = time(NULL);
 					peer->flush = 1;
 					return 1;	// return to flush the buffer
 				}
-				memcpy(peer->buff_ptr, (void *)template->template_flowset, template->flowset_length);
-				peer->buff_ptr = (void *)((pointer_addr_t)peer->buff_ptr + template->flowset_length);
-				template->time_sent = now;
+				memcpy(peer->buff_ptr, (void *)output_template->template_flowset, output_template->flowset_length);
+				peer->buff_ptr = (void *)((pointer_addr_t)peer->buff_ptr + output_template->flowset_length);
+				output_template->time_sent = now;
 				flowset_count++;
 				template_count++;
 			}
 			// open a new data flow set at this point in the output buffer
-			data_flowset = (data_flowset_t *)peer->buff_ptr;
-			data_flowset->flowset_id = template->template_flowset->fields[0].template_id;
-			peer->buff_ptr = (void *)data_flowset->data;
+			output_flowset = (data_flowset_t *)peer->buff_ptr;
+			output_flowset->flowset_id = output_template->template_flowset->fields[0].template_id;
+			peer->buff_ptr = (void *)output_flowset->data;
 			flowset_count++;
 		}
 	} else {
@@ -2956,43 +2971,43 @@ time_t		now = time(NULL);
 		peer->buff_ptr = (void *)((pointer_addr_t)v9_output_header + (pointer_addr_t)sizeof(netflow_v9_header_t));	
 		last_flags = master_record->flags;
 		last_map	= master_record->map_ref;
-		template = GetOutputTemplate(last_flags, master_record->map_ref);
-		if ( now - template->time_sent > MAX_LIFETIME ) {
+		output_template = GetOutputTemplate(last_flags, master_record->map_ref);
+		if ( now - output_template->time_sent > MAX_LIFETIME ) {
 			// refresh template
-			endwrite= (void *)((pointer_addr_t)peer->buff_ptr + template->flowset_length + sizeof(data_flowset_t));
+			endwrite= (void *)((pointer_addr_t)peer->buff_ptr + output_template->flowset_length + sizeof(data_flowset_t));
 			if ( endwrite > peer->endp ) {
 				// this must never happen!
 				fprintf(stderr, "Panic: Software error in %s line %d\n", __FILE__, __LINE__);
 				fprintf(stderr, "buffer %p, buff_ptr %p template length %x, endbuff %p\n", 
-					peer->send_buffer, peer->buff_ptr, template->flowset_length + (uint32_t)sizeof(data_flowset_t), peer->endp );
+					peer->send_buffer, peer->buff_ptr, output_template->flowset_length + (uint32_t)sizeof(data_flowset_t), peer->endp );
 				exit(255);
 			}
-			memcpy(peer->buff_ptr, (void *)template->template_flowset, template->flowset_length);
-			peer->buff_ptr = (void *)((pointer_addr_t)peer->buff_ptr + template->flowset_length);
-			template->time_sent = now;
+			memcpy(peer->buff_ptr, (void *)output_template->template_flowset, output_template->flowset_length);
+			peer->buff_ptr = (void *)((pointer_addr_t)peer->buff_ptr + output_template->flowset_length);
+			output_template->time_sent = now;
 			flowset_count++;
 			template_count++;
 		}
 		// open a new data flow set at this point in the output buffer
-		data_flowset = (data_flowset_t *)peer->buff_ptr;
-		data_flowset->flowset_id = template->template_flowset->fields[0].template_id;
-		peer->buff_ptr = (void *)data_flowset->data;
+		output_flowset = (data_flowset_t *)peer->buff_ptr;
+		output_flowset->flowset_id = output_template->template_flowset->fields[0].template_id;
+		peer->buff_ptr = (void *)output_flowset->data;
 		flowset_count++;
 	}
 	// now add the record
 
-	required_size = template->record_length;
+	required_size = output_template->record_length;
 
 	endwrite = (void *)((pointer_addr_t)peer->buff_ptr + required_size);
 	if ( endwrite > peer->endp ) {
-		uint16_t length = (pointer_addr_t)peer->buff_ptr - (pointer_addr_t)data_flowset;
+		uint16_t length = (pointer_addr_t)peer->buff_ptr - (pointer_addr_t)output_flowset;
 
 		// flush the buffer
-		data_flowset->length = htons(length);
+		output_flowset->length = htons(length);
 		if ( length == 4 ) {	// empty flowset
-			peer->buff_ptr = (void *)data_flowset;
+			peer->buff_ptr = (void *)output_flowset;
 		} 
-		data_flowset = NULL;
+		output_flowset = NULL;
 		v9_output_header->count = htons(record_count+template_count);
 		record_count   = 0;
 		template_count = 0;
@@ -3004,7 +3019,7 @@ time_t		now = time(NULL);
 	// this was a long way up to here, now we can add the data
 	Append_Record(peer, master_record);
 
-	data_flowset->length = htons((pointer_addr_t)peer->buff_ptr - (pointer_addr_t)data_flowset);
+	output_flowset->length = htons((pointer_addr_t)peer->buff_ptr - (pointer_addr_t)output_flowset);
 	record_count++;
 	v9_output_header->count = htons(record_count+template_count);
 
@@ -3012,6 +3027,33 @@ time_t		now = time(NULL);
 
 } // End of Add_v9_output_record
 
+/*
+ * Terminate the current packet of the output buffer
+ * returns 1 and sets peer->flush, if the packet contains any records
+ */
+int Flush_v9_output(send_peer_t *peer) {
+
+	if ( flowset_count == 0 ) 
+		return 0;
+
+	if ( output_flowset ) {
+		uint16_t length = (pointer_addr_t)peer->buff_ptr - (pointer_addr_t)output_flowset;
+		output_flowset->length = htons(length);
+		if ( length == 4 ) {	// empty flowset
+			peer->buff_ptr = (void *)output_flowset;
+		} 
+		output_flowset = NULL;
+	}
+	v9_output_header->count = htons(record_count+template_count);
+	record_count   = 0;
+	template_count = 0;
+	flowset_count  = 0;
+	peer->flush    = 1;
+
+	return 1;
+
+} // End of Flush_v9_output
+
 
 static void InsertSampler( FlowSource_t *fs, exporter_v9_domain_t *exporter, int32_t id, uint16_t mode, uint32_t interval) {
 generic_sampler_t *sampler;
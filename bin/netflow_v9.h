@@ -316,4 +316,6 @@ void Init_v9_output(send_peer_t *peer);
 
 int Add_v9_output_record(master_record_t *master_record, send_peer_t *peer);
 
+int Flush_v9_output(send_peer_t *peer);
+
 #endif //_NETFLOW_V9_H 1
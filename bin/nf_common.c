@@ -53,12 +53,15 @@
 #include "nffile.h"
 #include "nf_common.h"
 #include "util.h"
+#include "output_util.h"
 
 typedef void (*string_function_t)(master_record_t *, char *);
 
 static struct token_list_s {
 	string_function_t	string_function;	// function generation output string
 	char				*string_buffer;		// buffer for output string
+	char				*name;				// token name without '%' - JSON key
+	int					numeric;			// JSON: the value is a number
 } *token_list;
 
 static int	max_token_index	= 0;
@@ -103,6 +106,8 @@ static void AddToken(int index);
 
 static void AddString(char *string);
 
+static int IsJSONNumber(char *s);
+
 static void String_FlowFlags(master_record_t *r, char *string);
 
 static void String_FirstSeen(master_record_t *r, char *string);
@@ -403,6 +408,17 @@ static struct format_token_list_s {
 /* each of the tokens above must not generate output strings larger than this */
 #define MAX_STRING_LENGTH	256
 
+/* tokens printed as JSON numbers by format_jsonl - all other tokens are JSON strings */
+static char *json_number_tokens[] = {
+	"%tsr", "%ter", "%trr", "%td", "%exp", "%it", "%ic", "%sas", "%das", "%nas", "%pas", 
+	"%in", "%out", "%pkt", "%ipkt", "%opkt", "%byt", "%ibyt", "%obyt", "%fl", "%tos", 
+	"%stos", "%dtos", "%smk", "%dmk", "%fwd", "%svln", "%dvln", "%bps", "%pps", "%bpp", 
+	"%cl", "%sl", "%al", NULL
+};
+
+/* max size of one "key":value pair of format_jsonl - each char of a string may be escaped into 6 chars */
+#define JSON_TOKEN_SIZE	(6 * MAX_STRING_LENGTH + 32)
+
 #define NumProtos	138
 #define MAX_PROTO_STR 8
 char protolist[NumProtos][MAX_PROTO_STR] = {
@@ -616,7 +632,7 @@ int Getv6Mode(void) {
 void Proto_string(uint8_t protonum, char *protostr) {
 
 	if ( protonum >= NumProtos || !scale ) {
-		snprintf(protostr,16,"%-5i", protonum );
+		AppendUintPadded(protostr, protonum, 5, 1);
 	} else {
 		strncpy(protostr, protolist[protonum], 16);
 	}
@@ -1255,200 +1271,102 @@ master_record_t *r = (master_record_t *)record;
 } // End of flow_record_pipe
 
 void flow_record_to_csv(void *record, char ** s, int tag) {
-char 		*_s, as[IP_STRING_LEN], ds[IP_STRING_LEN]; 
-char		proto_str[MAX_PROTO_STR], datestr1[64], datestr2[64], datestr3[64], flags_str[16];
-char		s_snet[IP_STRING_LEN], s_dnet[IP_STRING_LEN];
-ssize_t		slen, _slen;
-time_t		when;
-struct tm 	*ts;
+char 		*_s, flags_str[16];
 master_record_t *r = (master_record_t *)record;
 
-	as[0] = 0;
-	ds[0] = 0;
-	if ( (r->flags & FLAG_IPV6_ADDR ) != 0 ) { // IPv6
-		uint64_t snet[2];
-		uint64_t dnet[2];
-
-		// remember IPs for network 
-		snet[0] = r->V6.srcaddr[0];
-		snet[1] = r->V6.srcaddr[1];
-		dnet[0] = r->V6.dstaddr[0];
-		dnet[1] = r->V6.dstaddr[1];
-		r->V6.srcaddr[0] = htonll(r->V6.srcaddr[0]);
-		r->V6.srcaddr[1] = htonll(r->V6.srcaddr[1]);
-		r->V6.dstaddr[0] = htonll(r->V6.dstaddr[0]);
-		r->V6.dstaddr[1] = htonll(r->V6.dstaddr[1]);
-		inet_ntop(AF_INET6, r->V6.srcaddr, as, sizeof(as));
-		inet_ntop(AF_INET6, r->V6.dstaddr, ds, sizeof(ds));
-
-		if ( r->src_mask || r->dst_mask) {
-			if ( r->src_mask > 64 )
-				snet[1] &= 0xffffffffffffffffLL << ( 128 - r->src_mask );
-			else {
-				snet[1] &= 0xffffffffffffffffLL << ( 64 - r->src_mask );
-				snet[1] = 0;
-			}
-			snet[0] = htonll(snet[0]);
-			snet[1] = htonll(snet[1]);
-			inet_ntop(AF_INET6, &snet, s_snet, sizeof(s_snet));
+	duration = r->last - r->first;
+	duration += ((double)r->msec_last - (double)r->msec_first) / 1000.0;
 
-			if ( r->dst_mask > 64 )
-				dnet[1] &= 0xffffffffffffffffLL << ( 128 - r->dst_mask );
-			else {
-				dnet[1] &= 0xffffffffffffffffLL << ( 64 - r->dst_mask );
-				dnet[1] = 0;
-			}
-			dnet[0] = htonll(dnet[0]);
-			dnet[1] = htonll(dnet[1]);
-			inet_ntop(AF_INET6, &dnet, s_dnet, sizeof(s_dnet));
+	String_Flags(record, flags_str);
 
-		} else {
-			s_snet[0] = '\0';
-			s_dnet[0] = '\0';
-		}
+	_s = data_string;
+	_s = AppendDateTime(_s, r->first, DATE_TEXT);
+	*_s++ = ',';
+	_s = AppendDateTime(_s, r->last, DATE_TEXT);
+	_s += snprintf(_s, 64, ",%.3f,", duration);
 
+	if ( (r->flags & FLAG_IPV6_ADDR ) != 0 ) { // IPv6
+		_s = AppendIPv6(_s, r->V6.srcaddr);
+		*_s++ = ',';
+		_s = AppendIPv6(_s, r->V6.dstaddr);
 	} else {	// IPv4
-		uint32_t snet, dnet;
-		snet = r->V4.srcaddr;
-		dnet = r->V4.dstaddr;
-		r->V4.srcaddr = htonl(r->V4.srcaddr);
-		r->V4.dstaddr = htonl(r->V4.dstaddr);
-		inet_ntop(AF_INET, &r->V4.srcaddr, as, sizeof(as));
-		inet_ntop(AF_INET, &r->V4.dstaddr, ds, sizeof(ds));
-		if ( r->src_mask || r->dst_mask) {
-			snet &= 0xffffffffL << ( 32 - r->src_mask );
-			snet = htonl(snet);
-			inet_ntop(AF_INET, &snet, s_snet, sizeof(s_snet));
-
-			dnet &= 0xffffffffL << ( 32 - r->dst_mask );
-			dnet = htonl(dnet);
-			inet_ntop(AF_INET, &dnet, s_dnet, sizeof(s_dnet));
-		} else {
-			s_snet[0] = '\0';
-			s_dnet[0] = '\0';
-		}
+		_s = AppendIPv4(_s, r->V4.srcaddr);
+		*_s++ = ',';
+		_s = AppendIPv4(_s, r->V4.dstaddr);
 	}
-	as[IP_STRING_LEN-1] = 0;
-	ds[IP_STRING_LEN-1] = 0;
-
-	when = r->first;
-	ts = localtime(&when);
-	strftime(datestr1, 63, "%Y-%m-%d %H:%M:%S", ts);
-
-	when = r->last;
-	ts = localtime(&when);
-	strftime(datestr2, 63, "%Y-%m-%d %H:%M:%S", ts);
-
-	duration = r->last - r->first;
-	duration += ((double)r->msec_last - (double)r->msec_first) / 1000.0;
-
-	String_Flags(record, flags_str);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->srcport);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->dstport);
+	*_s++ = ',';
 
 	if ( r->prot >= NumProtos ) {
-		snprintf(proto_str,MAX_PROTO_STR-1,"%u", r->prot );
-		proto_str[MAX_PROTO_STR-1] = '\0';
+		_s = AppendUint(_s, r->prot);
 	} else {
-		int i = 0;;
-		strncpy(proto_str, protolist[r->prot], MAX_PROTO_STR);
 		// remove white spaces for csv
-		while ( proto_str[i] ) {
-			if ( proto_str[i] == ' ' )
-				proto_str[i] = '\0';
-			i++;
-		}
+		char *p = protolist[r->prot];
+		while ( *p && *p != ' ' )
+			*_s++ = *p++;
 	}
+	*_s++ = ',';
+	_s = AppendString(_s, flags_str);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->fwd_status);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->tos);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->dPkts);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->dOctets);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->out_pkts);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->out_bytes);
 
-	_s = data_string;
-	slen = STRINGSIZE;
-	snprintf(_s, slen-1, "%s,%s,%.3f,%s,%s,%u,%u,%s,%s,%u,%u,%llu,%llu,%llu,%llu",
-		datestr1, datestr2, duration, as,ds,r->srcport, r->dstport, proto_str, flags_str, 
-		r->fwd_status, r->tos, (unsigned long long)r->dPkts, (unsigned long long)r->dOctets,
-		(long long unsigned)r->out_pkts, (long long unsigned)r->out_bytes
-	);
-
-	_slen = strlen(data_string);
-	_s += _slen;
-	slen -= _slen;
-	
 	// EX_IO_SNMP_2:
 	// EX_IO_SNMP_4:
-	snprintf(_s, slen-1, ",%u,%u" , r->input, r->output);
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
+	*_s++ = ',';
+	_s = AppendUint(_s, r->input);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->output);
 
 	// EX_AS_2:
 	// EX_AS_4:
-	snprintf(_s, slen-1, ",%u,%u", r->srcas, r->dstas);
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
+	*_s++ = ',';
+	_s = AppendUint(_s, r->srcas);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->dstas);
 
 	// EX_MULIPLE:
-	snprintf(_s, slen-1, ",%u,%u,%u,%u" , r->src_mask, r->dst_mask, r->dst_tos, r->dir );
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
-
+	*_s++ = ',';
+	_s = AppendUint(_s, r->src_mask);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->dst_mask);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->dst_tos);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->dir);
+
+	*_s++ = ',';
 	if ( (r->flags & FLAG_IPV6_NH ) != 0 ) { // IPv6
 		// EX_NEXT_HOP_v6:
-		as[0] = 0;
-		r->ip_nexthop.V6[0] = htonll(r->ip_nexthop.V6[0]);
-		r->ip_nexthop.V6[1] = htonll(r->ip_nexthop.V6[1]);
-		inet_ntop(AF_INET6, r->ip_nexthop.V6, as, sizeof(as));
-		as[IP_STRING_LEN-1] = 0;
-	
-		snprintf(_s, slen-1, ",%s", as);
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
-
+		_s = AppendIPv6(_s, r->ip_nexthop.V6);
+		// EX_NEXT_HOP_BGP_v6: - historically prints the next hop IP
+		*_s++ = ',';
+		_s = AppendIPv6(_s, r->ip_nexthop.V6);
 	} else {
 		// EX_NEXT_HOP_v4:
-		as[0] = 0;
-		r->ip_nexthop.V4 = htonl(r->ip_nexthop.V4);
-		inet_ntop(AF_INET, &r->ip_nexthop.V4, as, sizeof(as));
-		as[IP_STRING_LEN-1] = 0;
-
-		snprintf(_s, slen-1, ",%s", as);
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
-	}
-	
-	if ( (r->flags & FLAG_IPV6_NH ) != 0 ) { // IPv6
-		// EX_NEXT_HOP_BGP_v6:
-		as[0] = 0;
-		r->bgp_nexthop.V6[0] = htonll(r->bgp_nexthop.V6[0]);
-		r->bgp_nexthop.V6[1] = htonll(r->bgp_nexthop.V6[1]);
-		inet_ntop(AF_INET6, r->ip_nexthop.V6, as, sizeof(as));
-		as[IP_STRING_LEN-1] = 0;
-	
-		snprintf(_s, slen-1, ",%s", as);
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
-
-	} else {
+		_s = AppendIPv4(_s, r->ip_nexthop.V4);
 		// 	EX_NEXT_HOP_BGP_v4:
-		as[0] = 0;
-		r->bgp_nexthop.V4 = htonl(r->bgp_nexthop.V4);
-		inet_ntop(AF_INET, &r->bgp_nexthop.V4, as, sizeof(as));
-		as[IP_STRING_LEN-1] = 0;
-
-		snprintf(_s, slen-1, ",%s", as);
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
-
+		*_s++ = ',';
+		_s = AppendIPv4(_s, r->bgp_nexthop.V4);
 	}
 
 	// EX_VLAN:
-	snprintf(_s, slen-1, ",%u,%u", r->src_vlan, r->dst_vlan);
-	_slen = strlen(data_string);
-	_s = data_string + _slen;
-	slen = STRINGSIZE - _slen;
-
+	*_s++ = ',';
+	_s = AppendUint(_s, r->src_vlan);
+	*_s++ = ',';
+	_s = AppendUint(_s, r->dst_vlan);
 
 	/* already in default output:
 	EX_OUT_PKG_4:
@@ -1458,54 +1376,27 @@ master_record_t *r = (master_record_t *)record;
 	*/
 
 	// case EX_MAC_1: 
-	{
-		int i;
-		uint8_t mac1[6], mac2[6];
-
-		for ( i=0; i<6; i++ ) {
-			mac1[i] = (r->in_src_mac >> ( i*8 )) & 0xFF;
-		}
-		for ( i=0; i<6; i++ ) {
-			mac2[i] = (r->out_dst_mac >> ( i*8 )) & 0xFF;
-		}
-
-		snprintf(_s, slen-1, ",%.2x:%.2x:%.2x:%.2x:%.2x:%.2x,%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
-			mac1[5], mac1[4], mac1[3], mac1[2], mac1[1], mac1[0], 
-			mac2[5], mac2[4], mac2[3], mac2[2], mac2[1], mac2[0] );
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
-	} 
+	*_s++ = ',';
+	_s = AppendMac(_s, r->in_src_mac);
+	*_s++ = ',';
+	_s = AppendMac(_s, r->out_dst_mac);
 
 	// EX_MAC_2: 
-	{
-		int i;
-		uint8_t mac1[6], mac2[6];
-
-		for ( i=0; i<6; i++ ) {
-			mac1[i] = (r->in_dst_mac >> ( i*8 )) & 0xFF;
-		}
-		for ( i=0; i<6; i++ ) {
-			mac2[i] = (r->out_src_mac >> ( i*8 )) & 0xFF;
-		}
-
-		snprintf(_s, slen-1, ",%.2x:%.2x:%.2x:%.2x:%.2x:%.2x,%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
-			mac1[5], mac1[4], mac1[3], mac1[2], mac1[1], mac1[0], 
-			mac2[5], mac2[4], mac2[3], mac2[2], mac2[1], mac2[0] );
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
-	}
+	*_s++ = ',';
+	_s = AppendMac(_s, r->in_dst_mac);
+	*_s++ = ',';
+	_s = AppendMac(_s, r->out_src_mac);
 
 	// EX_MPLS: 
 	{
 		unsigned int i;
 		for ( i=0; i<10; i++ ) {
-			snprintf(_s, slen-1, ",%u-%1u-%1u", 
-				r->mpls_label[i] >> 4 , (r->mpls_label[i] & 0xF ) >> 1, r->mpls_label[i] & 1 );
-			_slen = strlen(data_string);
-			_s = data_string + _slen;
-			slen = STRINGSIZE - _slen;
+			*_s++ = ',';
+			_s = AppendUint(_s, r->mpls_label[i] >> 4);
+			*_s++ = '-';
+			_s = AppendUint(_s, (r->mpls_label[i] & 0xF ) >> 1);
+			*_s++ = '-';
+			_s = AppendUint(_s, r->mpls_label[i] & 1);
 		}
 	} 
 
@@ -1515,69 +1406,35 @@ master_record_t *r = (master_record_t *)record;
 		f2 = (double)r->server_nw_delay_usec / 1000.0;
 		f3 = (double)r->appl_latency_usec / 1000.0;
 
-				snprintf(_s, slen-1,
-",%9.3f,%9.3f,%9.3f", f1, f2, f3);
-
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
+		_s += snprintf(_s, 256, ",%9.3f,%9.3f,%9.3f", f1, f2, f3);
 	} 
 
-
 	// EX_ROUTER_IP_v4:
+	*_s++ = ',';
 	if ( (r->flags & FLAG_IPV6_EXP ) != 0 ) { // IPv6
-		// EX_NEXT_HOP_v6:
-		as[0] = 0;
-		r->ip_router.V6[0] = htonll(r->ip_router.V6[0]);
-		r->ip_router.V6[1] = htonll(r->ip_router.V6[1]);
-		inet_ntop(AF_INET6, r->ip_router.V6, as, sizeof(as));
-		as[IP_STRING_LEN-1] = 0;
-	
-		snprintf(_s, slen-1, ",%s", as);
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
-
+		_s = AppendIPv6(_s, r->ip_router.V6);
 	} else {
-		// EX_NEXT_HOP_v4:
-		as[0] = 0;
-		r->ip_router.V4 = htonl(r->ip_router.V4);
-		inet_ntop(AF_INET, &r->ip_router.V4, as, sizeof(as));
-		as[IP_STRING_LEN-1] = 0;
-
-		snprintf(_s, slen-1, ",%s", as);
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
+		_s = AppendIPv4(_s, r->ip_router.V4);
 	}
 
 	// EX_ROUTER_ID
-	snprintf(_s, slen-1, ",%u/%u", r->engine_type, r->engine_id);
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
+	*_s++ = ',';
+	_s = AppendUint(_s, r->engine_type);
+	*_s++ = '/';
+	_s = AppendUint(_s, r->engine_id);
 
 	// Exporter SysID
-	snprintf(_s, slen-1, ",%u", r->exporter_sysid);
-		_slen = strlen(data_string);
-		_s = data_string + _slen;
-		slen = STRINGSIZE - _slen;
+	*_s++ = ',';
+	_s = AppendUint(_s, r->exporter_sysid);
 
 	// Date flow received
-	when = r->received / 1000LL;
- 	ts = localtime(&when);
- 	strftime(datestr3, 63, ",%Y-%m-%d %H:%M:%S", ts);
- 
- 	snprintf(_s, slen-1, "%s.%03llu", datestr3, (long long unsigned)r->received % 1000LL);
- 	        _slen = strlen(data_string);
- 	        _s = data_string + _slen;
- 	        slen = STRINGSIZE - _slen;
+	*_s++ = ',';
+	_s = AppendDateTime(_s, r->received / 1000LL, DATE_TEXT);
+	*_s++ = '.';
+	_s = AppendUintZero(_s, r->received % 1000LL, 3);
 
-	// snprintf(_s, slen-1, "\n");
-	data_string[STRINGSIZE-1] = 0;
 	*s = data_string;
 
-
 } // End of flow_record_to_csv
 
 void flow_record_to_null(void *record, char ** s, int tag) {
@@ -1613,6 +1470,102 @@ int	i, index;
 
 } // End of format_special 
 
+/* the unsigned integers and fixed point numbers of the string functions */
+static int IsJSONNumber(char *s) {
+
+	if ( !isdigit((int)*s) ) 
+		return 0;
+	while ( isdigit((int)*s) ) 
+		s++;
+	if ( *s == '.' ) {
+		s++;
+		if ( !isdigit((int)*s) ) 
+			return 0;
+		while ( isdigit((int)*s) ) 
+			s++;
+	}
+
+	return *s == '\0';
+
+} // End of IsJSONNumber
+
+/*
+ * Print the tokens of the format as compact JSON object per line: {"ts":"..","sa":"..",..}
+ * The record is written directly into the output buffer. *s is set to NULL.
+ */
+void format_jsonl(void *record, char ** s, int tag) {
+master_record_t *r = (master_record_t *)record;
+char	*_s;
+int		i, v6_mode;
+
+	duration = r->last - r->first;
+	duration += ((double)r->msec_last - (double)r->msec_first) / 1000.0;
+
+	// full IPv6 addresses in the JSON values only - other output keeps its v6 mode
+	v6_mode = long_v6;
+	long_v6 = 1;
+
+	// the size is checked by ParseJSONFormat()
+	_s = OutputReserve(token_index * JSON_TOKEN_SIZE + 4);
+	*_s++ = '{';
+	for ( i=0; i<token_index; i++ ) {
+		char *value, *end;
+
+		token_list[i].string_function(r, token_list[i].string_buffer);
+
+		// strip the padding for the column layout
+		value = token_list[i].string_buffer;
+		while ( *value == ' ' )
+			value++;
+		end = value + strlen(value);
+		while ( end > value && end[-1] == ' ' )
+			end--;
+		*end = '\0';
+
+		if ( i ) 
+			*_s++ = ',';
+		*_s++ = '"';
+		_s = AppendString(_s, token_list[i].name);
+		*_s++ = '"';
+		*_s++ = ':';
+		// the type of a key is the same in all records
+		if ( !token_list[i].numeric ) 
+			_s = AppendJSONString(_s, value);
+		else if ( IsJSONNumber(value) ) 
+			_s = AppendString(_s, value);
+		else
+			_s = AppendString(_s, "null");
+	}
+	*_s++ = '}';
+	*_s++ = '\n';
+	OutputCommit(_s);
+
+	long_v6 = v6_mode;
+
+	*s = NULL;
+
+} // End of format_jsonl
+
+/*
+ * Parse the format for the JSON lines output. Only tokens are used, static strings are ignored.
+ * Numbers are not scaled and IPv6 addresses are not condensed.
+ */
+int ParseJSONFormat(char *format, printmap_t *printmap) {
+
+	if ( !ParseOutputFormat(format, 1, printmap) ) 
+		return 0;
+
+	// a record must fit into the output buffer
+	if ( (token_index * JSON_TOKEN_SIZE + 4) > OUTPUT_BUFFSIZE ) {
+		fprintf(stderr, "Too many tokens for the JSON output format: %d, max: %d\n", 
+			token_index, (OUTPUT_BUFFSIZE - 4) / JSON_TOKEN_SIZE);
+		return 0;
+	}
+
+	return 1;
+
+} // End of ParseJSONFormat
+
 char *get_record_header(void) {
 	return header_string;
 } // End of get_record_header
@@ -1638,6 +1591,7 @@ static void InitFormatParser(void) {
 } // End of InitFormatParser
 
 static void AddToken(int index) {
+int i;
 
 	if ( token_index >= max_token_index ) { // no slot available - expand table
 		max_token_index += BLOCK_SIZE;
@@ -1648,6 +1602,12 @@ static void AddToken(int index) {
 		}
 	}
 	token_list[token_index].string_function	 = format_token_list[index].string_function;
+	token_list[token_index].name = format_token_list[index].token + 1;
+	token_list[token_index].numeric = 0;
+	for ( i=0; json_number_tokens[i]; i++ ) {
+		if ( strcmp(json_number_tokens[i], format_token_list[index].token) == 0 ) 
+			token_list[token_index].numeric = 1;
+	}
 	token_list[token_index].string_buffer = malloc(MAX_STRING_LENGTH);
 	if ( !token_list[token_index].string_buffer ) {
 		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
@@ -1745,9 +1705,9 @@ int	i, remaining;
 					if ( strncmp(format_token_list[i].token, c, len) == 0 ) {	// token found
 						AddToken(i);
 						if ( long_v6 && format_token_list[i].is_address )
-							snprintf(h, STRINGSIZE-1-strlen(h), "%23s%s", "", format_token_list[i].header);
+							snprintf(h, STRINGSIZE-(h-header_string), "%23s%s", "", format_token_list[i].header);
 						else
-							snprintf(h, STRINGSIZE-1-strlen(h), "%s", format_token_list[i].header);
+							snprintf(h, STRINGSIZE-(h-header_string), "%s", format_token_list[i].header);
 						h += strlen(h);
 						c[len] = p;
 						c += len;
@@ -1773,7 +1733,7 @@ int	i, remaining;
 				AddString(strdup(c));
 				snprintf(format, 15, "%%%zus", strlen(c));
 				format[15] = '\0';
-				snprintf(h, STRINGSIZE-1-strlen(h), format, "");
+				snprintf(h, STRINGSIZE-(h-header_string), format, "");
 				h += strlen(h);
 				*p = '%';
 				c = p;
@@ -1782,7 +1742,7 @@ int	i, remaining;
 				AddString(strdup(c));
 				snprintf(format, 15, "%%%zus", strlen(c));
 				format[15] = '\0';
-				snprintf(h, STRINGSIZE-1-strlen(h), format, "");
+				snprintf(h, STRINGSIZE-(h-header_string), format, "");
 				h += strlen(h);
 				*c = '\0';
 			}
@@ -1814,14 +1774,31 @@ char	*p, *q;
 
 } // End of condense_v6
 
+static char *AppendAddress(char *s, int is_v6, uint64_t *ip6, uint32_t ip4) {
+char tmp_str[IP_STRING_LEN];
+
+	if ( is_v6 ) {
+		AppendIPv6(tmp_str, ip6);
+		if ( ! long_v6 ) {
+			condense_v6(tmp_str);
+		}
+	} else {
+		AppendIPv4(tmp_str, ip4);
+	}
+	s = AppendString(s, tag_string);
+	return AppendPadded(s, tmp_str, long_v6 ? 39 : 16, 0);
+
+} // End of AppendAddress
+
 static inline void ICMP_Port_decode(master_record_t *r, char *string) {
 
 	if ( r->prot == IPPROTO_ICMP || r->prot == IPPROTO_ICMPV6 ) { // ICMP
-		snprintf(string, MAX_STRING_LENGTH-1, "%u.%u",  r->icmp_type, r->icmp_code);
+		string = AppendUint(string, r->icmp_type);
+		*string++ = '.';
+		AppendUint(string, r->icmp_code);
 	} else { 	// dst port
-		snprintf(string, MAX_STRING_LENGTH-1, "%u",  r->dstport);
+		AppendUint(string, r->dstport);
 	}
-	string[MAX_STRING_LENGTH-1] = '\0';
 
 } // End of ICMP_Port_decode
 
@@ -1834,44 +1811,29 @@ static void String_FlowFlags(master_record_t *r, char *string) {
 } // End of String_FlowFlags
  
 static void String_FirstSeen(master_record_t *r, char *string) {
-time_t 	tt;
-struct tm * ts;
 char 	*s;
 
-	tt = r->first;
-	ts = localtime(&tt);
-	strftime(string, MAX_STRING_LENGTH-1, "%Y-%m-%d %H:%M:%S", ts);
-	s = string + strlen(string);
-	snprintf(s, MAX_STRING_LENGTH-strlen(string)-1,".%03u", r->msec_first);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	s = AppendDateTime(string, r->first, DATE_TEXT);
+	*s++ = '.';
+	AppendUintZero(s, r->msec_first, 3);
 
 } // End of String_FirstSeen
 
 static void String_LastSeen(master_record_t *r, char *string) {
-time_t 	tt;
-struct tm * ts;
 char 	*s;
 
-	tt = r->last;
-	ts = localtime(&tt);
-	strftime(string, MAX_STRING_LENGTH-1, "%Y-%m-%d %H:%M:%S", ts);
-	s = string + strlen(string);
-	snprintf(s, MAX_STRING_LENGTH-strlen(string)-1,".%03u", r->msec_last);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	s = AppendDateTime(string, r->last, DATE_TEXT);
+	*s++ = '.';
+	AppendUintZero(s, r->msec_last, 3);
 
 } // End of String_LastSeen
 
 static void String_Received(master_record_t *r, char *string) {
-time_t 	tt;
-struct tm * ts;
 char 	*s;
 
-	tt = r->received / 1000LL;
-	ts = localtime(&tt);
-	strftime(string, MAX_STRING_LENGTH-1, "%Y-%m-%d %H:%M:%S", ts);
-	s = string + strlen(string);
-	snprintf(s, MAX_STRING_LENGTH-strlen(string)-1,".%03llu", r->received % 1000LL);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	s = AppendDateTime(string, r->received / 1000LL, DATE_TEXT);
+	*s++ = '.';
+	AppendUintZero(s, r->received % 1000LL, 3);
 
 } // End of String_Received
 
@@ -1899,16 +1861,11 @@ static void String_LastSeenRaw(master_record_t *r, char *string) {
 
 #ifdef NSEL
 static void String_EventTime(master_record_t *r, char *string) {
-time_t 	tt;
-struct tm * ts;
 char 	*s;
 
-	tt = r->event_time / 1000LL;
-	ts = localtime(&tt);
-	strftime(string, MAX_STRING_LENGTH-1, "%Y-%m-%d %H:%M:%S", ts);
-	s = string + strlen(string);
-	snprintf(s, MAX_STRING_LENGTH-strlen(string)-1,".%03llu", r->event_time % 1000LL);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	s = AppendDateTime(string, r->event_time / 1000LL, DATE_TEXT);
+	*s++ = '.';
+	AppendUintZero(s, r->event_time % 1000LL, 3);
 
 } // End of String_EventTime
 #endif
@@ -1921,291 +1878,89 @@ static void String_Duration(master_record_t *r, char *string) {
 } // End of String_Duration
 
 static void String_Protocol(master_record_t *r, char *string) {
-char s[16];
 
-	Proto_string(r->prot, s);
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%s", s);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	Proto_string(r->prot, string);
 
 } // End of String_Protocol
 
 static void String_SrcAddr(master_record_t *r, char *string) {
-char tmp_str[IP_STRING_LEN];
-
-	tmp_str[0] = 0;
-	if ( (r->flags & FLAG_IPV6_ADDR ) != 0 ) { // IPv6
-		uint64_t	ip[2];
-
-		ip[0] = htonll(r->V6.srcaddr[0]);
-		ip[1] = htonll(r->V6.srcaddr[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->V4.srcaddr);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s", tag_string, tmp_str);
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s", tag_string, tmp_str);
-
-	string[MAX_STRING_LENGTH-1] = 0;
 
+	AppendAddress(string, (r->flags & FLAG_IPV6_ADDR) != 0, r->V6.srcaddr, r->V4.srcaddr);
 
 } // End of String_SrcAddr
 
 static void String_SrcAddrPort(master_record_t *r, char *string) {
-char 	tmp_str[IP_STRING_LEN], portchar;
-
-	tmp_str[0] = 0;
-	if ( (r->flags & FLAG_IPV6_ADDR ) != 0 ) { // IPv6
-		uint64_t	ip[2];
-
-		ip[0] = htonll(r->V6.srcaddr[0]);
-		ip[1] = htonll(r->V6.srcaddr[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-		portchar = '.';
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->V4.srcaddr);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-		portchar = ':';
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
+char 	*s;
+int		is_v6 = (r->flags & FLAG_IPV6_ADDR) != 0;
 
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s%c%-5i", tag_string, tmp_str, portchar, r->srcport);
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s%c%-5i", tag_string, tmp_str, portchar, r->srcport);
-
-	string[MAX_STRING_LENGTH-1] = 0;
+	s = AppendAddress(string, is_v6, r->V6.srcaddr, r->V4.srcaddr);
+	*s++ = is_v6 ? '.' : ':';
+	AppendUintPadded(s, r->srcport, 5, 1);
 
 } // End of String_SrcAddrPort
 
 static void String_DstAddr(master_record_t *r, char *string) {
-char tmp_str[IP_STRING_LEN];
-
-	tmp_str[0] = 0;
-	if ( (r->flags & FLAG_IPV6_ADDR ) != 0 ) { // IPv6
-		uint64_t	ip[2];
-
-		ip[0] = htonll(r->V6.dstaddr[0]);
-		ip[1] = htonll(r->V6.dstaddr[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->V4.dstaddr);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s", tag_string, tmp_str);
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s", tag_string, tmp_str);
-
-	string[MAX_STRING_LENGTH-1] = 0;
 
+	AppendAddress(string, (r->flags & FLAG_IPV6_ADDR) != 0, r->V6.dstaddr, r->V4.dstaddr);
 
 } // End of String_DstAddr
 
 
 static void String_NextHop(master_record_t *r, char *string) {
-char tmp_str[IP_STRING_LEN];
-
-	tmp_str[0] = 0;
-	if ( (r->flags & FLAG_IPV6_NH ) != 0 ) { // IPv6
-		uint64_t	ip[2];
-
-		ip[0] = htonll(r->ip_nexthop.V6[0]);
-		ip[1] = htonll(r->ip_nexthop.V6[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->ip_nexthop.V4);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s", tag_string, tmp_str);
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s", tag_string, tmp_str);
-
-	string[MAX_STRING_LENGTH-1] = 0;
 
+	AppendAddress(string, (r->flags & FLAG_IPV6_NH) != 0, r->ip_nexthop.V6, r->ip_nexthop.V4);
 
 } // End of String_NextHop
 
 static void String_BGPNextHop(master_record_t *r, char *string) {
-char tmp_str[IP_STRING_LEN];
-
-	tmp_str[0] = 0;
-	if ( (r->flags & FLAG_IPV6_NH ) != 0 ) { // IPv6
-		uint64_t	ip[2];
-
-		ip[0] = htonll(r->bgp_nexthop.V6[0]);
-		ip[1] = htonll(r->bgp_nexthop.V6[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->bgp_nexthop.V4);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s", tag_string, tmp_str);
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s", tag_string, tmp_str);
-
-	string[MAX_STRING_LENGTH-1] = 0;
 
+	AppendAddress(string, (r->flags & FLAG_IPV6_NH) != 0, r->bgp_nexthop.V6, r->bgp_nexthop.V4);
 
 } // End of String_NextHop
 
 static void String_RouterIP(master_record_t *r, char *string) {
-char tmp_str[IP_STRING_LEN];
-
-	tmp_str[0] = 0;
-	if ( (r->flags & FLAG_IPV6_EXP ) != 0 ) { // IPv6
-		uint64_t	ip[2];
-
-		ip[0] = htonll(r->ip_router.V6[0]);
-		ip[1] = htonll(r->ip_router.V6[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->ip_router.V4);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s", tag_string, tmp_str);
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s", tag_string, tmp_str);
-
-	string[MAX_STRING_LENGTH-1] = 0;
 
+	AppendAddress(string, (r->flags & FLAG_IPV6_EXP) != 0, r->ip_router.V6, r->ip_router.V4);
 
 } // End of String_RouterIP
 
 
 static void String_DstAddrPort(master_record_t *r, char *string) {
-char 	tmp_str[IP_STRING_LEN], portchar;
-char 	icmp_port[MAX_STRING_LENGTH];
-
-	tmp_str[0] = 0;
-	if ( (r->flags & FLAG_IPV6_ADDR ) != 0 ) { // IPv6
-		uint64_t	ip[2];
+char 	*s, icmp_port[MAX_STRING_LENGTH];
+int		is_v6 = (r->flags & FLAG_IPV6_ADDR) != 0;
 
-		ip[0] = htonll(r->V6.dstaddr[0]);
-		ip[1] = htonll(r->V6.dstaddr[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-		portchar = '.';
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->V4.dstaddr);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-		portchar = ':';
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
+	s = AppendAddress(string, is_v6, r->V6.dstaddr, r->V4.dstaddr);
+	*s++ = is_v6 ? '.' : ':';
 	ICMP_Port_decode(r, icmp_port);
-
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s%c%-5s", tag_string, tmp_str, portchar, icmp_port);
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s%c%-5s", tag_string, tmp_str, portchar, icmp_port);
-
-	string[MAX_STRING_LENGTH-1] = 0;
+	AppendPadded(s, icmp_port, 5, 1);
 
 } // End of String_DstAddrPort
 
 static void String_SrcNet(master_record_t *r, char *string) {
-char tmp_str[IP_STRING_LEN];
+char 	*s;
 
 	ApplyNetMaskBits(r, 1);
 
-	tmp_str[0] = 0;
-	if ( (r->flags & FLAG_IPV6_ADDR ) != 0 ) { // IPv6
-		uint64_t	ip[2];
-
-		ip[0] = htonll(r->V6.srcaddr[0]);
-		ip[1] = htonll(r->V6.srcaddr[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->V4.srcaddr);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s/%-2u", tag_string, tmp_str, r->src_mask );
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s/%-2u", tag_string, tmp_str, r->src_mask );
-
-	string[MAX_STRING_LENGTH-1] = 0;
-
+	s = AppendAddress(string, (r->flags & FLAG_IPV6_ADDR) != 0, r->V6.srcaddr, r->V4.srcaddr);
+	*s++ = '/';
+	AppendUintPadded(s, r->src_mask, 2, 1);
 
 } // End of String_SrcNet
 
 static void String_DstNet(master_record_t *r, char *string) {
-char tmp_str[IP_STRING_LEN];
+char 	*s;
 
 	ApplyNetMaskBits(r, 2);
 
-	tmp_str[0] = 0;
-	if ( (r->flags & FLAG_IPV6_ADDR ) != 0 ) { // IPv6
-		uint64_t	ip[2];
-
-		ip[0] = htonll(r->V6.dstaddr[0]);
-		ip[1] = htonll(r->V6.dstaddr[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->V4.dstaddr);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s/%-2u", tag_string, tmp_str, r->dst_mask );
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s/%-2u", tag_string, tmp_str, r->dst_mask );
-
-	string[MAX_STRING_LENGTH-1] = 0;
-
+	s = AppendAddress(string, (r->flags & FLAG_IPV6_ADDR) != 0, r->V6.dstaddr, r->V4.dstaddr);
+	*s++ = '/';
+	AppendUintPadded(s, r->dst_mask, 2, 1);
 
 } // End of String_DstNet
 
 static void String_SrcPort(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%6u", r->srcport);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->srcport, 6, 0);
 
 } // End of String_SrcPort
 
@@ -2213,8 +1968,7 @@ static void String_DstPort(master_record_t *r, char *string) {
 char tmp[MAX_STRING_LENGTH];
 
 	ICMP_Port_decode(r, tmp);
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%6s", tmp);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendPadded(string, tmp, 6, 0);
 
 } // End of String_DstPort
 
@@ -2238,15 +1992,13 @@ static void String_ICMP_code(master_record_t *r, char *string) {
 
 static void String_SrcAS(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%6u", r->srcas);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->srcas, 6, 0);
 
 } // End of String_SrcAS
 
 static void String_DstAS(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%6u", r->dstas);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->dstas, 6, 0);
 
 } // End of String_DstAS
 
@@ -2266,15 +2018,13 @@ static void String_PrevAS(master_record_t *r, char *string) {
 
 static void String_Input(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%6u", r->input);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->input, 6, 0);
 
 } // End of String_Input
 
 static void String_Output(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%6u", r->output);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->output, 6, 0);
 
 } // End of String_Output
 
@@ -2282,8 +2032,7 @@ static void String_InPackets(master_record_t *r, char *string) {
 char s[NUMBER_STRING_SIZE];
 
 	format_number(r->dPkts, s, scale, FIXED_WIDTH);
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%8s", s);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendPadded(string, s, 8, 0);
 
 } // End of String_InPackets
 
@@ -2291,8 +2040,7 @@ static void String_OutPackets(master_record_t *r, char *string) {
 char s[NUMBER_STRING_SIZE];
 
 	format_number(r->out_pkts, s, scale, FIXED_WIDTH);
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%8s", s);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendPadded(string, s, 8, 0);
 
 } // End of String_OutPackets
 
@@ -2300,8 +2048,7 @@ static void String_InBytes(master_record_t *r, char *string) {
 char s[NUMBER_STRING_SIZE];
 
 	format_number(r->dOctets, s, scale, FIXED_WIDTH);
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%8s", s);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendPadded(string, s, 8, 0);
 
 } // End of String_InBytes
 
@@ -2309,65 +2056,56 @@ static void String_OutBytes(master_record_t *r, char *string) {
 char s[NUMBER_STRING_SIZE];
 
 	format_number(r->out_bytes, s, scale, FIXED_WIDTH);
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%8s", s);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendPadded(string, s, 8, 0);
 
 } // End of String_OutBytes
 
 static void String_Flows(master_record_t *r, char *string) {
 
 	// snprintf(string, MAX_STRING_LENGTH-1 ,"%5llu", r->aggr_flows ? (unsigned long long)r->aggr_flows : 1 );
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%5llu", (unsigned long long)r->aggr_flows );
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->aggr_flows, 5, 0);
 
 } // End of String_Flows
 
 static void String_Tos(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%3u", r->tos);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->tos, 3, 0);
 
 } // End of String_Tos
 
 static void String_SrcTos(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%4u", r->tos);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->tos, 4, 0);
 
 } // End of String_SrcTos
 
 static void String_DstTos(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%4u", r->dst_tos);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->dst_tos, 4, 0);
 
 } // End of String_DstTos
 
 static void String_SrcMask(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%5u", r->src_mask);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->src_mask, 5, 0);
 
 } // End of String_SrcMask
 
 static void String_DstMask(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%5u", r->dst_mask);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->dst_mask, 5, 0);
 
 } // End of String_DstMask
 
 static void String_SrcVlan(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%5u", r->src_vlan);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->src_vlan, 5, 0);
 
 } // End of String_SrcVlan
 
 static void String_DstVlan(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%5u", r->dst_vlan);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->dst_vlan, 5, 0);
 
 } // End of String_DstVlan
 
@@ -2380,8 +2118,7 @@ static void String_Dir(master_record_t *r, char *string) {
 
 static void String_FwdStatus(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%3u", r->fwd_status);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->fwd_status, 3, 0);
 
 } // End of String_FwdStatus
 
@@ -2603,8 +2340,7 @@ char s[NUMBER_STRING_SIZE];
 		bps = 0;
 	}
 	format_number(bps, s, scale, FIXED_WIDTH);
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%8s", s);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendPadded(string, s, 8, 0);
 
 } // End of String_bps
 
@@ -2618,8 +2354,7 @@ char s[NUMBER_STRING_SIZE];
 		pps = 0;
 	}
 	format_number(pps, s, scale, FIXED_WIDTH);
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%8s", s);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendPadded(string, s, 8, 0);
 
 } // End of String_Duration
 
@@ -2632,8 +2367,7 @@ uint32_t 	Bpp;
 		Bpp = r->dOctets / r->dPkts;			// Bytes per Packet
 	else 
 		Bpp = 0;
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%6u", Bpp);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, Bpp, 6, 0);
 
 } // End of String_bpp
 
@@ -2641,8 +2375,7 @@ static void String_ExpSysID(master_record_t *r, char *string) {
 
 	string[MAX_STRING_LENGTH-1] = '\0';
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%6u", r->exporter_sysid);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->exporter_sysid, 6, 0);
 
 } // End of String_ExpSysID
 
@@ -2728,8 +2461,7 @@ static void String_msec(master_record_t *r, char *string) {
 	unsigned long long etime;
 
 	etime = 1000LL * (unsigned long long)r->first + (unsigned long long)r->msec_first;
-	snprintf(string, MAX_STRING_LENGTH-1,"%13llu",  etime);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, etime, 13, 0);
 
 } // End of String_msec 
 
@@ -2751,139 +2483,46 @@ static void String_eacl(master_record_t *r, char *string) {
 } // End of String_eacl
 
 static void String_xlateSrcAddr(master_record_t *r, char *string) {
-char tmp_str[IP_STRING_LEN];
-
-	tmp_str[0] = 0;
-	if ( (r->xlate_flags & 1 ) != 0 ) { // IPv6
-		uint64_t	ip[2];
-
-		ip[0] = htonll(r->xlate_src_ip.V6[0]);
-		ip[1] = htonll(r->xlate_src_ip.V6[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->xlate_src_ip.V4);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s", tag_string, tmp_str);
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s", tag_string, tmp_str);
 
-	string[MAX_STRING_LENGTH-1] = 0;
+	AppendAddress(string, (r->xlate_flags & 1) != 0, r->xlate_src_ip.V6, r->xlate_src_ip.V4);
 
 } // End of String_xlateSrcAddr
 
 static void String_xlateDstAddr(master_record_t *r, char *string) {
-char tmp_str[IP_STRING_LEN];
-
-	tmp_str[0] = 0;
-	if ( (r->xlate_flags & 1 ) != 0 ) { // IPv6
-		uint64_t	ip[2];
 
-		ip[0] = htonll(r->xlate_dst_ip.V6[0]);
-		ip[1] = htonll(r->xlate_dst_ip.V6[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->xlate_dst_ip.V4);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s", tag_string, tmp_str);
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s", tag_string, tmp_str);
-
-	string[MAX_STRING_LENGTH-1] = 0;
+	AppendAddress(string, (r->xlate_flags & 1) != 0, r->xlate_dst_ip.V6, r->xlate_dst_ip.V4);
 
 } // End of String_xlateDstAddr
 
 static void String_xlateSrcPort(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%6u", r->xlate_src_port);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->xlate_src_port, 6, 0);
 
 } // End of String_xlateSrcPort
 
 static void String_xlateDstPort(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%6u", r->xlate_dst_port);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->xlate_dst_port, 6, 0);
 
 } // End of String_xlateDstPort
 
 static void String_xlateSrcAddrPort(master_record_t *r, char *string) {
-char 	tmp_str[IP_STRING_LEN], portchar;
-
-	tmp_str[0] = 0;
-	if ( (r->xlate_flags & 1 ) != 0 ) { // IPv6
-		uint64_t	ip[2];
-
-		ip[0] = htonll(r->xlate_src_ip.V6[0]);
-		ip[1] = htonll(r->xlate_src_ip.V6[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-
-		portchar = '.';
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->xlate_src_ip.V4);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-
-		portchar = ':';
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
-
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s%c%-5i", tag_string, tmp_str, portchar, r->xlate_src_port);
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s%c%-5i", tag_string, tmp_str, portchar, r->xlate_src_port);
+char 	*s;
+int		is_v6 = (r->xlate_flags & 1) != 0;
 
-	string[MAX_STRING_LENGTH-1] = 0;
+	s = AppendAddress(string, is_v6, r->xlate_src_ip.V6, r->xlate_src_ip.V4);
+	*s++ = is_v6 ? '.' : ':';
+	AppendUintPadded(s, r->xlate_src_port, 5, 1);
 
 } // End of String_xlateSrcAddrPort
 
 static void String_xlateDstAddrPort(master_record_t *r, char *string) {
-char 	tmp_str[IP_STRING_LEN], portchar;
-
-	tmp_str[0] = 0;
-	if ( (r->xlate_flags & 1 ) != 0 ) { // IPv6
-		uint64_t	ip[2];
-
-		ip[0] = htonll(r->xlate_dst_ip.V6[0]);
-		ip[1] = htonll(r->xlate_dst_ip.V6[1]);
-		inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
-		if ( ! long_v6 ) {
-			condense_v6(tmp_str);
-		}
-
-		portchar = '.';
-	} else {	// IPv4
-		uint32_t	ip;
-		ip = htonl(r->xlate_dst_ip.V4);
-		inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
-
-		portchar = ':';
-	}
-	tmp_str[IP_STRING_LEN-1] = 0;
-
-	if ( long_v6 ) 
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%39s%c%-5i", tag_string, tmp_str, portchar, r->xlate_dst_port);
-	else
-		snprintf(string, MAX_STRING_LENGTH-1, "%s%16s%c%-5i", tag_string, tmp_str, portchar, r->xlate_dst_port);
-
-	string[MAX_STRING_LENGTH-1] = 0;
+char 	*s;
+int		is_v6 = (r->xlate_flags & 1) != 0;
 
+	s = AppendAddress(string, is_v6, r->xlate_dst_ip.V6, r->xlate_dst_ip.V4);
+	*s++ = is_v6 ? '.' : ':';
+	AppendUintPadded(s, r->xlate_dst_port, 5, 1);
 
 } // End of String_xlateDstAddrPort
 
@@ -2914,29 +2553,25 @@ static void String_evrf(master_record_t *r, char *string) {
 
 static void String_PortBlockStart(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%7u", r->block_start);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->block_start, 7, 0);
 
 } // End of String_PortBlockStart
 
 static void String_PortBlockEnd(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%7u", r->block_end);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->block_end, 7, 0);
 
 } // End of String_PortBlockEnd
 
 static void String_PortBlockStep(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%7u", r->block_step);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->block_step, 7, 0);
 
 } // End of String_PortBlockStep
 
 static void String_PortBlockSize(master_record_t *r, char *string) {
 
-	snprintf(string, MAX_STRING_LENGTH-1 ,"%7u", r->block_size);
-	string[MAX_STRING_LENGTH-1] = '\0';
+	AppendUintPadded(string, r->block_size, 7, 0);
 
 } // End of String_PortBlockSize
 
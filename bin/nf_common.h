@@ -108,6 +108,10 @@ int ParseOutputFormat(char *format, int plain_numbers, printmap_t *printmap);
 
 void format_special(void *record, char ** s, int tag);
 
+int ParseJSONFormat(char *format, printmap_t *printmap);
+
+void format_jsonl(void *record, char ** s, int tag);
+
 
 uint32_t Get_fwd_status_id(char *status);
 
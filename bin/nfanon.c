@@ -48,6 +48,7 @@
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -57,7 +58,9 @@
 #include "nfx.h"
 #include "util.h"
 #include "flist.h"
+#include "nfscan.h"
 #include "panonymizer.h"
+#include "blockpipe.h"
 
 #if ( SIZEOF_VOID_P == 8 )
 typedef uint64_t    pointer_addr_t;
@@ -65,6 +68,31 @@ typedef uint64_t    pointer_addr_t;
 typedef uint32_t    pointer_addr_t;
 #endif
 
+#define MAXWORKERS 64
+
+/*
+ * The files are read by the scan engine. Single threaded, the flows are anonymized
+ * in the flow callback.
+ * Multi-threaded processing:
+ * The block callback passes the data blocks through an ordered block pipe to the 
+ * anon workers. The workers anonymize all records of a block into the private 
+ * buffer of the block. The reader appends the anonymized blocks in sequence to the 
+ * output file, which results in the same output blocks as in single threaded processing.
+ * Blocks with extension maps are passed to the flow callback, after all blocks in 
+ * flight are written.
+ * An extension map is written to the output file, before the first record using it.
+ */
+typedef struct anon_ctx_s {
+	char		*wfile;					// single output file - NULL: replace the input files
+	nffile_t	*nffile_w;
+	blockpipe_t	*bpipe;
+	char		cfile[MAXPATHLEN];		// input file replaced by outfile
+	char		outfile[MAXPATHLEN];
+	char		ident[IDENTLEN];		// ident of the input file
+	int			cnt;					// number of files
+	uint8_t		map_written[MAX_EXTENSION_MAPS];	// maps written to the current output
+} anon_ctx_t;
+
 // module limited globals
 extension_map_list_t *extension_map_list;
 
@@ -73,7 +101,26 @@ static void usage(char *name);
 
 static inline void AnonRecord(master_record_t *master_record);
 
-static void process_data(void *wfile);
+static void AnonBlock(void *worker_data, pipe_block_t *block);
+
+static inline void WriteAnonMap(anon_ctx_t *ctx, uint16_t map_id);
+
+static void WriteAnonBlock(pipe_block_t *block);
+
+static void DispatchAnonBlock(anon_ctx_t *ctx, data_block_header_t *block_header);
+
+static int CloseAnonOutput(anon_ctx_t *ctx);
+
+static int anon_file(void *data, char *filename, file_header_t *file_header, stat_record_t *stat_record);
+
+static int anon_block(void *data, data_block_header_t *block_header);
+
+static int anon_flow(void *data, common_record_t *flow_record, master_record_t *master_record, 
+	extension_info_t *extension_info);
+
+static void anon_map(void *data, extension_map_t *map);
+
+static void process_data(char *wfile, int num_workers);
 
 /* Functions */
 
@@ -89,6 +136,7 @@ static void usage(char *name) {
 					"-M <expr>\tRead input from multiple directories.\n"
 					"-R <expr>\tRead input from sequence of files.\n"
 					"-w <file>\tName of output file. Defaults to input file.\n"
+					"-W <num>\tUse <num> anon threads.\n"
 					, name);
 } /* usage */
 
@@ -173,251 +221,288 @@ int		i;
 
 } // End of AnonRecord
 
+static int HasExtensionMaps(data_block_header_t *block_header) {
+common_record_t *flow_record;
+uint32_t i;
+
+	flow_record = (common_record_t *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+	for ( i=0; i < block_header->NumRecords; i++ ) {
+		if ( flow_record->type == ExtensionMapType ) 
+			return 1;
+		flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);	
+	}
+
+	return 0;
+
+} // End of HasExtensionMaps
 
-static void process_data(void *wfile) {
+static void AnonBlock(void *worker_data, pipe_block_t *block) {
 master_record_t		master_record;
-common_record_t     *flow_record;
-nffile_t			*nffile_r;
-nffile_t			*nffile_w;
-int 		i, done, ret, cnt, verbose;
-char		outfile[MAXPATHLEN], *cfile;
-#ifdef COMPAT15
-int	v1_map_done = 0;
-#endif
+common_record_t		*flow_record;
+data_block_header_t	out_header;
+nffile_t			out;
+uint32_t			i;
+
+	// PackRecord() only needs the block header and the write pointer of the output file
+	memset((void *)&out, 0, sizeof(nffile_t));
+	out.block_header = &out_header;
+	out.buff_ptr	 = block->buff;
+
+	flow_record = (common_record_t *)((pointer_addr_t)block->block_header + sizeof(data_block_header_t));
+	for ( i=0; i < block->block_header->NumRecords; i++ ) {
+		switch ( flow_record->type ) { 
+			case CommonRecordType: {
+				uint32_t map_id = flow_record->ext_map;
+				if ( extension_map_list->slot[map_id] == NULL ) {
+					LogError("Corrupt data file! No such extension map id: %u. Skip record", flow_record->ext_map );
+				} else if ( ((pointer_addr_t)out.buff_ptr - (pointer_addr_t)block->buff + sizeof(master_record_t)) > BUFFSIZE ) {
+					LogError("Anon buffer overflow in %s line %d. Skip record", __FILE__, __LINE__);
+				} else {
+					ExpandRecord_v2( flow_record, extension_map_list->slot[flow_record->ext_map], NULL, &master_record);
 
+					// update number of flows matching a given map
+					__sync_fetch_and_add(&extension_map_list->slot[map_id]->ref_count, 1);
+		
+					AnonRecord(&master_record);
 
-	setbuf(stderr, NULL);
-	cnt 	= 1;
-	verbose = 1;
+					// the private buffer is never flushed - the reader writes the output blocks
+					out_header.size = 0;
+					PackRecord(&master_record, &out);
+				}
+
+				} break;
+			case ExtensionMapType: 		// blocks with maps are processed by the reader
+			case ExporterRecordType:
+			case SamplerRecordype:
+			case ExporterInfoRecordType:
+			case ExporterStatRecordType:
+			case SamplerInfoRecordype:
+					// Silently skip exporter/sampler records
+				break;
+
+			default: {
+				fprintf(stderr, "Skip unknown record type %i\n", flow_record->type);
+			}
+		}
+		// Advance pointer by number of bytes for netflow record
+		flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);	
+
+	} // for all records
+	block->size = (pointer_addr_t)out.buff_ptr - (pointer_addr_t)block->buff;
+
+} // End of AnonBlock
 
-	// Get the first file handle
-	nffile_r = GetNextFile(NULL, 0, 0);
-	if ( !nffile_r ) {
-		LogError("GetNextFile() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+/*
+ * Write the extension map map_id, if the current output does not have it
+ */
+static inline void WriteAnonMap(anon_ctx_t *ctx, uint16_t map_id) {
+extension_map_t *map;
+
+	if ( ctx->map_written[map_id] ) 
 		return;
+
+	map = extension_map_list->slot[map_id]->map;
+	AppendToBuffer(ctx->nffile_w, (void *)map, map->size);
+	ctx->map_written[map_id] = 1;
+
+} // End of WriteAnonMap
+
+/*
+ * Append the records of an anonymized block to its output file
+ */
+static void WriteAnonBlock(pipe_block_t *block) {
+anon_ctx_t		*ctx = (anon_ctx_t *)block->output;
+common_record_t	*flow_record;
+size_t			offset;
+
+	offset = 0;
+	while ( offset < block->size ) {
+		flow_record = (common_record_t *)((pointer_addr_t)block->buff + offset);
+		WriteAnonMap(ctx, flow_record->ext_map);
+		AppendToBuffer(ctx->nffile_w, (void *)flow_record, flow_record->size);
+		offset += flow_record->size;
 	}
-	if ( nffile_r == EMPTY_LIST ) {
-		LogError("Empty file list. No files to process\n");
-		return;
+
+} // End of WriteAnonBlock
+
+static void DispatchAnonBlock(anon_ctx_t *ctx, data_block_header_t *block_header) {
+pipe_block_t *block = NextPipeBlock(ctx->bpipe);
+
+	memcpy((void *)block->block_header, (void *)block_header, sizeof(data_block_header_t) + block_header->size);
+	block->output = (void *)ctx;
+
+	DispatchPipeBlock(ctx->bpipe, block, 1);
+
+} // End of DispatchAnonBlock
+
+/*
+ * All records of the current output are written. A file replaces its input file
+ * returns 0, if the input file could not be replaced
+ */
+static int CloseAnonOutput(anon_ctx_t *ctx) {
+
+	if ( ctx->bpipe ) 
+		FlushBlockPipe(ctx->bpipe);
+
+	if ( ctx->nffile_w->block_header->NumRecords ) {
+		if ( WriteBlock(ctx->nffile_w) <= 0 ) {
+			LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
+		} 
+	}
+	CloseUpdateFile(ctx->nffile_w, ctx->ident);
+
+	if ( ctx->wfile == NULL && ctx->cfile[0] && rename(ctx->outfile, ctx->cfile) < 0 ) {
+		LogError("\nrename() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		LogError("Abort processing.\n");
+		return 0;
+	}
+
+	return 1;
+
+} // End of CloseAnonOutput
+
+static int anon_file(void *data, char *filename, file_header_t *file_header, stat_record_t *stat_record) {
+anon_ctx_t *ctx = (anon_ctx_t *)data;
+nffile_t	input;
+int			compress;
+
+	// FILE_COMPRESSION() only needs the file header
+	input.file_header = file_header;
+	compress = FILE_COMPRESSION(&input);
+
+	if ( ctx->nffile_w && ctx->wfile == NULL && !CloseAnonOutput(ctx) ) {
+		DisposeFile(ctx->nffile_w);
+		ctx->nffile_w = NULL;
+		return SCAN_STOP;
 	}
 
-	cfile = GetCurrentFilename();
-	if ( !cfile ) {
-		if ( nffile_r->fd == 0 ) { // stdin
-			outfile[0] = '-';
-			outfile[1] = '\0';
-			verbose = 0;
+	ctx->cnt++;
+	if ( filename ) 
+		LogError(" %i Processing %s\r", ctx->cnt, filename);
+
+	if ( ctx->wfile ) {
+		if ( ctx->nffile_w ) {
+			SumStatRecords(ctx->nffile_w->stat_record, stat_record);
 		} else {
-			LogError("(NULL) input file name error in %s line %d\n", __FILE__, __LINE__);
-			return;
+			ctx->nffile_w = OpenNewFile(ctx->wfile, NULL, compress, 1, NULL);
+			if ( !ctx->nffile_w ) 
+				return SCAN_STOP;
+			memcpy((void *)ctx->nffile_w->stat_record, (void *)stat_record, sizeof(stat_record_t));
 		}
 	} else {
-		// prepare output file
-		snprintf(outfile,MAXPATHLEN-1, "%s-tmp", cfile);
-		outfile[MAXPATHLEN-1] = '\0';
-		if ( verbose )
-			fprintf(stderr, " %i Processing %s\r", cnt++, cfile);
+		if ( filename ) {
+			// prepare output file
+			strncpy(ctx->cfile, filename, MAXPATHLEN-1);
+			ctx->cfile[MAXPATHLEN-1] = '\0';
+			snprintf(ctx->outfile, MAXPATHLEN-1, "%s-tmp", filename);
+			ctx->outfile[MAXPATHLEN-1] = '\0';
+		} else {
+			// stdin
+			ctx->cfile[0] = '\0';
+			strcpy(ctx->outfile, "-");
+		}
+		ctx->nffile_w = OpenNewFile(ctx->outfile, ctx->nffile_w, compress, 1, NULL);
+		if ( !ctx->nffile_w ) 
+			return SCAN_STOP;
+		memcpy((void *)ctx->nffile_w->stat_record, (void *)stat_record, sizeof(stat_record_t));
+		memset((void *)ctx->map_written, 0, sizeof(ctx->map_written));
 	}
 
-	if ( wfile )
-		nffile_w = OpenNewFile(wfile, NULL, FILE_COMPRESSION(nffile_r), 1, NULL);
-	else
-		nffile_w = OpenNewFile(outfile, NULL, FILE_COMPRESSION(nffile_r), 1, NULL);
+	strncpy(ctx->ident, file_header->ident, IDENTLEN);
+	ctx->ident[IDENTLEN-1] = '\0';
 
-	if ( !nffile_w ) {
-		if ( nffile_r ) {
-			CloseFile(nffile_r);
-			DisposeFile(nffile_r);
-		}
-		return;
-	}
+	return SCAN_CONTINUE;
 
-	memcpy((void *)nffile_w->stat_record, (void *)nffile_r->stat_record, sizeof(stat_record_t));
-
-	done = 0;
-	while ( !done ) {
-		// get next data block from file
-		ret = ReadBlock(nffile_r);
-
-		switch (ret) {
-			case NF_CORRUPT:
-			case NF_ERROR:
-				if ( ret == NF_CORRUPT ) 
-					LogError("Skip corrupt data file '%s'\n",GetCurrentFilename());
-				else 
-					LogError("Read error in file '%s': %s\n",GetCurrentFilename(), strerror(errno) );
-				// fall through - get next file in chain
-			case NF_EOF: {
-				nffile_t *next;
-    			if ( nffile_w->block_header->NumRecords ) {
-        			if ( WriteBlock(nffile_w) <= 0 ) {
-            			LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
-        			} 
-    			}
-				if ( wfile == NULL ) {
-					CloseUpdateFile(nffile_w, nffile_r->file_header->ident);
-					if ( rename(outfile, cfile) < 0 ) {
-						LogError("\nrename() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-						LogError("Abort processing.\n");
-						return;
-					}
-				}
+} // End of anon_file
 
-				next = GetNextFile(nffile_r, 0, 0);
-				if ( next == EMPTY_LIST ) {
-					done = 1;
-					continue;
-				}
-				if ( next == NULL ) {
-					LogError("Unexpected end of file list\n");
-					done = 1;
-					continue;
-				}
+static int anon_block(void *data, data_block_header_t *block_header) {
+anon_ctx_t *ctx = (anon_ctx_t *)data;
 
-				cfile = GetCurrentFilename();
-				if ( !cfile ) {
-					LogError("(NULL) input file name error in %s line %d\n", __FILE__, __LINE__);
-					return;
-				}
-				LogError(" %i Processing %s\r", cnt++, cfile);
-
-				if ( wfile == NULL ) {
-					snprintf(outfile,MAXPATHLEN-1, "%s-tmp", cfile);
-					outfile[MAXPATHLEN-1] = '\0';
-
-					nffile_w = OpenNewFile(outfile, nffile_w, FILE_COMPRESSION(nffile_r), 1, NULL);
-					if ( !nffile_w ) {
-						if ( nffile_r ) {
-							CloseFile(nffile_r);
-							DisposeFile(nffile_r);
-						}
-						return;
-					}
-					memcpy((void *)nffile_w->stat_record, (void *)nffile_r->stat_record, sizeof(stat_record_t));
-				} else {
-					SumStatRecords(nffile_w->stat_record, nffile_r->stat_record);
-				}
+	if ( !ctx->bpipe ) 
+		return SCAN_CONTINUE;
 
-				// continue with next file
-				continue;
-	
-				} break; // not really needed
-		}
+	if ( block_header->id == DATA_BLOCK_TYPE_2 && !HasExtensionMaps(block_header) ) {
+		DispatchAnonBlock(ctx, block_header);
+		return SCAN_SKIP;
+	}
 
-#ifdef COMPAT15
-		if ( nffile_r->block_header->id == DATA_BLOCK_TYPE_1 ) {
-			common_record_v1_t *v1_record = (common_record_v1_t *)nffile_r->buff_ptr;
-			// create an extension map for v1 blocks
-			if ( v1_map_done == 0 ) {
-				extension_map_t *map = malloc(sizeof(extension_map_t) + 2 * sizeof(uint16_t) );
-				if ( ! map ) {
-					LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-					exit(255);
-				}
-				map->type 	= ExtensionMapType;
-				map->size 	= sizeof(extension_map_t) + 2 * sizeof(uint16_t);
-				map->map_id = 0;
-				map->ex_id[0]  = EX_IO_SNMP_2;
-				map->ex_id[1]  = EX_AS_2;
-				map->ex_id[2]  = 0;
+	// extension maps are inserted and written in sequence, 1.5.x blocks converted by the scan
+	FlushBlockPipe(ctx->bpipe);
 
-				Insert_Extension_Map(extension_map_list, map);
-				AppendToBuffer(nffile_w, (void *)map, map->size);
+	return SCAN_CONTINUE;
 
-				v1_map_done = 1;
-			}
+} // End of anon_block
 
-			// convert the records to v2
-			for ( i=0; i < nffile_r->block_header->NumRecords; i++ ) {
-				common_record_t *v2_record = (common_record_t *)v1_record;
-				Convert_v1_to_v2((void *)v1_record);
-				// now we have a v2 record -> use size of v2_record->size
-				v1_record = (common_record_v1_t *)((pointer_addr_t)v1_record + v2_record->size);
-			}
-			nffile_r->block_header->id = DATA_BLOCK_TYPE_2;
-		}
-#endif
+static int anon_flow(void *data, common_record_t *flow_record, master_record_t *master_record, 
+	extension_info_t *extension_info) {
+anon_ctx_t *ctx = (anon_ctx_t *)data;
 
-		if ( nffile_r->block_header->id == Large_BLOCK_Type ) {
-			// skip
-			continue;
-		}
+	AnonRecord(master_record);
+	WriteAnonMap(ctx, extension_info->map->map_id);
+	PackRecord(master_record, ctx->nffile_w);
 
-		if ( nffile_r->block_header->id != DATA_BLOCK_TYPE_2 ) {
-			fprintf(stderr, "Can't process block type %u. Skip block.\n", nffile_r->block_header->id);
-			continue;
-		}
+	return SCAN_CONTINUE;
 
-		flow_record = nffile_r->buff_ptr;
-		for ( i=0; i < nffile_r->block_header->NumRecords; i++ ) {
-			switch ( flow_record->type ) { 
-				case CommonRecordType: {
-					uint32_t map_id = flow_record->ext_map;
-					if ( extension_map_list->slot[map_id] == NULL ) {
-						LogError("Corrupt data file! No such extension map id: %u. Skip record", flow_record->ext_map );
-					} else {
-						ExpandRecord_v2( flow_record, extension_map_list->slot[flow_record->ext_map], NULL, &master_record);
-	
-						// update number of flows matching a given map
-						extension_map_list->slot[map_id]->ref_count++;
-			
-						AnonRecord(&master_record);
-						PackRecord(&master_record, nffile_w);
-					}
-
-					} break;
-				case ExtensionMapType: {
-					extension_map_t *map = (extension_map_t *)flow_record;
-
-					if ( Insert_Extension_Map(extension_map_list, map) ) {
-					 	// flush new map
-					} // else map already known and flushed
-					AppendToBuffer(nffile_w, (void *)map, map->size);
-
-					} break; 
-				case ExporterRecordType:
-				case SamplerRecordype:
-				case ExporterInfoRecordType:
-				case ExporterStatRecordType:
-				case SamplerInfoRecordype:
-						// Silently skip exporter/sampler records
-					break;
-
-				default: {
-					fprintf(stderr, "Skip unknown record type %i\n", flow_record->type);
-				}
-			}
-			// Advance pointer by number of bytes for netflow record
-			flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);	
+} // End of anon_flow
 
-		} // for all records
+static void anon_map(void *data, extension_map_t *map) {
+anon_ctx_t *ctx = (anon_ctx_t *)data;
 
-	} // while
+	// new or changed map - write it with the next record using it
+	ctx->map_written[map->map_id] = 0;
 
-	PackExtensionMapList(extension_map_list);
-	if ( wfile != NULL )
-		CloseUpdateFile(nffile_w, nffile_r->file_header->ident);
+} // End of anon_map
+
+static void process_data(char *wfile, int num_workers) {
+anon_ctx_t	*ctx;
+scan_t		scan;
 
-	if ( nffile_r ) {
-		CloseFile(nffile_r);
-		DisposeFile(nffile_r);
+	setbuf(stderr, NULL);
+
+	ctx = (anon_ctx_t *)calloc(1, sizeof(anon_ctx_t));
+	if ( !ctx ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
 	}
+	ctx->wfile = wfile;
+	ctx->bpipe = num_workers ? 
+		StartBlockPipe(num_workers, BUFFSIZE + sizeof(data_block_header_t), BUFFSIZE, NULL, NULL, AnonBlock, WriteAnonBlock) : NULL;
+
+	memset((void *)&scan, 0, sizeof(scan_t));
+	scan.extension_map_list	= extension_map_list;
+	scan.data				= (void *)ctx;
+	scan.file				= anon_file;
+	scan.block				= anon_block;
+	scan.flow				= anon_flow;
+	scan.map				= anon_map;
 
-	DisposeFile(nffile_w);
+	if ( ScanFiles(&scan) && ctx->nffile_w ) 
+		CloseAnonOutput(ctx);
+
+	if ( ctx->bpipe )
+		StopBlockPipe(ctx->bpipe);
+
+	PackExtensionMapList(extension_map_list);
+
+	if ( ctx->nffile_w ) 
+		DisposeFile(ctx->nffile_w);
 
 	LogError("\n");
-	LogError("Processed %i files.\n", --cnt);
+	LogError("Processed %i files.\n", ctx->cnt);
+
+	free(ctx);
 
 } // End of process_data
 
 
 int main( int argc, char **argv ) {
 char 		*rfile, *Rfile, *wfile, *Mdirs;
-int			c;
+int			c, num_workers;
 char		CryptoPAnKey[32];
 
 	rfile = Rfile = Mdirs = wfile = NULL;
-	while ((c = getopt(argc, argv, "K:L:r:M:R:w:")) != EOF) {
+	num_workers = 0;
+	while ((c = getopt(argc, argv, "K:L:r:M:R:w:W:")) != EOF) {
 		switch (c) {
 			case 'h':
 				usage(argv[0]);
@@ -449,6 +534,13 @@ char		CryptoPAnKey[32];
 			case 'w':
 				wfile = optarg;
 				break;
+			case 'W':
+				num_workers = atoi(optarg);
+				if ( num_workers < 1 || num_workers > MAXWORKERS ) {
+					LogError("Number of anon threads out of range 1..%d\n", MAXWORKERS);
+					exit(255);
+				}
+				break;
 			default:
 				usage(argv[0]);
 				exit(0);
@@ -468,7 +560,7 @@ char		CryptoPAnKey[32];
 
 	SetupInputFileSequence(Mdirs, rfile, Rfile);
 
-	process_data(wfile);
+	process_data(wfile, num_workers);
 
 	FreeExtensionMaps(extension_map_list);
 
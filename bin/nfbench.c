@@ -0,0 +1,906 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+/*
+ * nfbench - micro and macro benchmarks of the nfdump hot paths
+ * Synthetic flows with realistic distributions are written, read, expanded, 
+ * filtered, aggregated, decoded and printed. The results are printed as JSON.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nffile.h"
+#include "nfx.h"
+#include "nfnet.h"
+#include "bookkeeper.h"
+#include "collector.h"
+#include "netflow_v9.h"
+#include "ipfix.h"
+#include "nf_common.h"
+#include "rbtree.h"
+#include "nftree.h"
+#include "nfdump.h"
+#include "output_json.h"
+#include "output_util.h"
+#include "nfstat.h"
+#include "nflowcache.h"
+#include "util.h"
+#include "nfsynth.h"
+
+#include "nffile_inline.c"
+
+/* hash parameters */
+#define NumPrealloc 128000
+
+/* Global Variables */
+int verbose = 0;
+int hash_hit = 0; 
+int hash_miss = 0;
+int hash_skip = 0;
+
+extension_map_list_t *extension_map_list;
+
+/* Local Variables */
+static const char *nfdump_version = VERSION;
+
+static char *workdir = ".";
+
+// in memory copy of the synthetic flows
+static struct bench_data_s {
+	// uncompressed data blocks
+	data_block_header_t	**blocks;
+	uint32_t			num_blocks;
+	uint64_t			block_bytes;
+
+	// flows in the blocks and their expanded master records
+	uint64_t			num_flows;
+	common_record_t		**flow_record;
+	extension_info_t	**extension_info;
+	master_record_t		*master_record;
+
+	// netflow v9 and IPFIX packets - each packet: uint32_t length, data
+	void				*packets[2];
+	size_t				packet_bytes[2];
+	uint32_t			num_packets[2];
+} data;
+
+typedef struct bench_result_s {
+	uint64_t	records;		// records processed
+	uint64_t	bytes;			// bytes processed
+	uint64_t	matched;		// filter matches
+	uint64_t	output_bytes;	// size of written file
+	double		seconds;
+} bench_result_t;
+
+typedef struct bench_s {
+	char	*name;
+	int		(*func)(struct bench_s *bench, bench_result_t *result);
+	char	*arg;				// filter, aggregation, stat or format
+	int		param;				// codec, netflow version
+	int		isolate;			// run in a child process - modifies global state
+} bench_t;
+
+#define PACKET_V9		0
+#define PACKET_IPFIX	1
+
+#define FORMAT_line "%ts %td %pr %sap -> %dap %pkt %byt %fl"
+#define FORMAT_long "%ts %td %pr %sap -> %dap %flg %tos %pkt %byt %fl"
+#define FORMAT_extended "%ts %td %pr %sap -> %dap %flg %tos %pkt %byt %pps %bps %bpp %fl"
+#define FORMAT_jsonl "%ts %te %td %pr %sa %da %sp %dp %flg %tos %ipkt %ibyt %opkt %obyt %fl"
+
+static printmap_t printmap[] = {
+	{ "raw",		format_file_block_record,  	NULL 			},
+	{ "line", 		format_special,      		FORMAT_line 	},
+	{ "long", 		format_special, 			FORMAT_long 	},
+	{ "extended",	format_special, 			FORMAT_extended	},
+	{ "pipe", 		flow_record_to_pipe,      	NULL 			},
+	{ "json", 		flow_record_to_json,      	NULL 			},
+	{ "jsonl", 		format_jsonl,      			FORMAT_jsonl 	},
+	{ "csv", 		flow_record_to_csv,      	NULL 			},
+	{ NULL,			NULL,                       NULL			}
+};
+
+/* Function Prototypes */
+static void usage(char *name);
+
+static double Now(void);
+
+static char *BenchFile(char *name);
+
+static int GenerateData(synth_param_t *param, uint64_t num_flows, bench_result_t *result);
+
+static int LoadData(void);
+
+static int EncodePackets(void);
+
+static int BenchWrite(bench_t *bench, bench_result_t *result);
+
+static int BenchRead(bench_t *bench, bench_result_t *result);
+
+static int BenchExpand(bench_t *bench, bench_result_t *result);
+
+static int BenchFilter(bench_t *bench, bench_result_t *result);
+
+static int BenchAggregate(bench_t *bench, bench_result_t *result);
+
+static int BenchStat(bench_t *bench, bench_result_t *result);
+
+static int BenchDecode(bench_t *bench, bench_result_t *result);
+
+static int BenchFormat(bench_t *bench, bench_result_t *result);
+
+static int RunIsolated(bench_t *bench, bench_result_t *result);
+
+static void PrintResult(char *name, bench_result_t *result, int first);
+
+static bench_t bench_list[] = {
+	{ "write_none",			BenchWrite,		NULL,	NOT_COMPRESSED,	0 },
+	{ "write_lzo",			BenchWrite,		NULL,	LZO_COMPRESSED,	0 },
+	{ "write_bz2",			BenchWrite,		NULL,	BZ2_COMPRESSED,	0 },
+	{ "write_lz4",			BenchWrite,		NULL,	LZ4_COMPRESSED,	0 },
+#ifdef HAVE_ZSTD
+	{ "write_zstd",			BenchWrite,		NULL,	ZSTD_COMPRESSED,	0 },
+#endif
+	{ "read_none",			BenchRead,		NULL,	NOT_COMPRESSED,	0 },
+	{ "read_lzo",			BenchRead,		NULL,	LZO_COMPRESSED,	0 },
+	{ "read_bz2",			BenchRead,		NULL,	BZ2_COMPRESSED,	0 },
+	{ "read_lz4",			BenchRead,		NULL,	LZ4_COMPRESSED,	0 },
+#ifdef HAVE_ZSTD
+	{ "read_zstd",			BenchRead,		NULL,	ZSTD_COMPRESSED,	0 },
+#endif
+	{ "expand",				BenchExpand,	NULL,	0, 0 },
+	{ "filter_any",			BenchFilter,	"any", 0, 0 },
+	{ "filter_proto",		BenchFilter,	"proto tcp", 0, 0 },
+	{ "filter_port",		BenchFilter,	"dst port 443", 0, 0 },
+	{ "filter_host",		BenchFilter,	"host 10.12.34.56 or host 2001:db8::1", 0, 0 },
+	{ "filter_net",			BenchFilter,	"src net 10.0.0.0/12 and dst net 64.0.0.0/2", 0, 0 },
+	{ "filter_ipv6",		BenchFilter,	"ipv6 and dst net 2a00::/12", 0, 0 },
+	{ "filter_list",		BenchFilter,	"dst port in [ 22 25 53 80 123 443 993 3389 8080 ]", 0, 0 },
+	{ "filter_complex",		BenchFilter,	"(proto tcp and dst port 443 and packets > 10) or "
+											"(proto udp and port 53 and not src as 0)", 0, 0 },
+	{ "filter_extended",	BenchFilter,	"bps > 100k and duration > 1000", 0, 0 },
+	{ "aggr_default",		BenchAggregate,	NULL, 0, 1 },
+	{ "aggr_srcip_dstport",	BenchAggregate,	"srcip,dstport", 0, 1 },
+	{ "aggr_srcnet",		BenchAggregate,	"srcip4/24,srcip6/64,proto", 0, 1 },
+	{ "stat_srcip",			BenchStat,		"srcip", 0, 1 },
+	{ "stat_dstport",		BenchStat,		"dstport", 0, 1 },
+	{ "stat_record",		BenchStat,		"record/bytes", 0, 1 },
+	{ "stat_multi",			BenchStat,		"srcip dstip dstport proto srcas", 0, 1 },
+	{ "decode_v9",			BenchDecode,	NULL, PACKET_V9, 1 },
+	{ "decode_ipfix",		BenchDecode,	NULL, PACKET_IPFIX, 1 },
+	{ "format_line",		BenchFormat,	"line", 0, 1 },
+	{ "format_long",		BenchFormat,	"long", 0, 1 },
+	{ "format_extended",	BenchFormat,	"extended", 0, 1 },
+	{ "format_raw",			BenchFormat,	"raw", 0, 1 },
+	{ "format_pipe",		BenchFormat,	"pipe", 0, 1 },
+	{ "format_csv",			BenchFormat,	"csv", 0, 1 },
+	{ "format_json",		BenchFormat,	"json", 0, 1 },
+	{ "format_jsonl",		BenchFormat,	"jsonl", 0, 1 },
+	{ NULL,					NULL,			NULL, 0, 0 }
+};
+
+static void usage(char *name) {
+		printf("usage %s [options] \n"
+					"-h\t\tthis text you see right here\n"
+					"-n <num>\tNumber of synthetic flows. Default 200000\n"
+					"-i <num>\tNumber of distinct host addresses. Default 100000\n"
+					"-z <exp>\tExponent of the Zipf address distribution. Default 1.0\n"
+					"-6 <ratio>\tFraction of IPv6 flows. Default 0.2\n"
+					"-m <num>\tNumber of extension maps 1..%d. Default %d\n"
+					"-e <num>\tNumber of exporters. Default 4\n"
+					"-s <seed>\tRandom seed. Default 1\n"
+					"-r <num>\tRun each benchmark num times and report the fastest run. Default 3\n"
+					"-b <prefix>\tRun only benchmarks starting with prefix, e.g. filter\n"
+					"-d <dir>\tDirectory for temporary files. Default .\n"
+					"-V\t\tPrint version and exit.\n"
+					, name, SYNTH_MAX_MAPS, SYNTH_MAX_MAPS);
+} /* usage */
+
+static double Now(void) {
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+
+} // End of Now
+
+static char *BenchFile(char *name) {
+static char path[MAXPATHLEN];
+
+	snprintf(path, MAXPATHLEN, "%s/nfbench.%s", workdir, name);
+	path[MAXPATHLEN-1] = '\0';
+	return path;
+
+} // End of BenchFile
+
+static int GenerateData(synth_param_t *param, uint64_t num_flows, bench_result_t *result) {
+synth_t *synth;
+nffile_t *nffile;
+double start;
+
+	synth = SynthInit(param);
+	if ( !synth )
+		return 0;
+
+	nffile = OpenNewFile(BenchFile("synth"), NULL, NOT_COMPRESSED, 0, NULL);
+	if ( !nffile ) {
+		SynthDispose(synth);
+		return 0;
+	}
+
+	start = Now();
+	SynthAppendMaps(synth, nffile);
+	SynthWriteRecords(synth, nffile, num_flows);
+	if ( nffile->block_header->NumRecords && WriteBlock(nffile) <= 0 ) {
+		LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
+		DisposeFile(nffile);
+		SynthDispose(synth);
+		return 0;
+	}
+	CloseUpdateFile(nffile, NULL);
+	result->seconds = Now() - start;
+	result->records = num_flows;
+	result->bytes   = 0;
+
+	DisposeFile(nffile);
+	SynthDispose(synth);
+
+	return 1;
+
+} // End of GenerateData
+
+/*
+ * Load all blocks of the synthetic file into memory and expand all flows
+ */
+static int LoadData(void) {
+nffile_t *nffile;
+uint32_t b, i, max_blocks;
+uint64_t max_flows;
+int ret;
+
+	extension_map_list = InitExtensionMaps(NEEDS_EXTENSION_LIST);
+	if ( !extension_map_list )
+		return 0;
+
+	nffile = OpenFile(BenchFile("synth"), NULL);
+	if ( !nffile )
+		return 0;
+
+	max_blocks = nffile->file_header->NumBlocks;
+	data.blocks = (data_block_header_t **)calloc(max_blocks, sizeof(data_block_header_t *));
+	if ( !data.blocks ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	max_flows = 0;
+	while ( (ret = ReadBlock(nffile)) > 0 && data.num_blocks < max_blocks ) {
+		data_block_header_t *block;
+		size_t size = sizeof(data_block_header_t) + nffile->block_header->size;
+
+		block = (data_block_header_t *)malloc(size);
+		if ( !block ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		memcpy((void *)block, (void *)nffile->block_header, size);
+		data.blocks[data.num_blocks++] = block;
+		data.block_bytes += block->size;
+		max_flows += block->NumRecords;
+	}
+	CloseFile(nffile);
+	DisposeFile(nffile);
+
+	if ( ret < 0 ) {
+		LogError("Failed to read synthetic flows");
+		return 0;
+	}
+
+	data.flow_record	= (common_record_t **)malloc(max_flows * sizeof(common_record_t *));
+	data.extension_info = (extension_info_t **)malloc(max_flows * sizeof(extension_info_t *));
+	data.master_record  = (master_record_t *)calloc(max_flows, sizeof(master_record_t));
+	if ( !data.flow_record || !data.extension_info || !data.master_record ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	for ( b=0; b < data.num_blocks; b++ ) {
+		common_record_t *record_ptr = (common_record_t *)((pointer_addr_t)data.blocks[b] + sizeof(data_block_header_t));
+		for ( i=0; i < data.blocks[b]->NumRecords; i++ ) {
+			if ( record_ptr->type == ExtensionMapType ) {
+				Insert_Extension_Map(extension_map_list, (extension_map_t *)record_ptr);
+			} else if ( record_ptr->type == CommonRecordType ) {
+				extension_info_t *extension_info = extension_map_list->slot[record_ptr->ext_map];
+				if ( !extension_info ) {
+					LogError("Missing extension map %u", record_ptr->ext_map);
+					return 0;
+				}
+				data.flow_record[data.num_flows]	= record_ptr;
+				data.extension_info[data.num_flows] = extension_info;
+				ExpandRecord_v2(record_ptr, extension_info, NULL, &data.master_record[data.num_flows]);
+				data.num_flows++;
+			}
+			record_ptr = (common_record_t *)((pointer_addr_t)record_ptr + record_ptr->size);
+		}
+	}
+
+	return 1;
+
+} // End of LoadData
+
+static void AddPacket(int type, void *packet, uint32_t len) {
+static size_t max_size[2];
+uint32_t *p;
+
+	if ( (data.packet_bytes[type] + len + 2 * sizeof(uint32_t)) > max_size[type] ) {
+		max_size[type] += 4 * 1024 * 1024;
+		data.packets[type] = realloc(data.packets[type], max_size[type]);
+		if ( !data.packets[type] ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+	}
+
+	p = (uint32_t *)((pointer_addr_t)data.packets[type] + data.packet_bytes[type]);
+	*p++ = len;
+	memcpy((void *)p, packet, len);
+	// keep packets 32bit aligned
+	data.packet_bytes[type] += sizeof(uint32_t) + ((len + 3) & ~3);
+	data.num_packets[type]++;
+
+} // End of AddPacket
+
+static void AddIPFIXPacket(void *packet, uint32_t len) {
+uint8_t buff[UDP_PACKET_SIZE];
+uint32_t out;
+
+	out = SynthV9toIPFIX(packet, len, buff);
+	if ( out )
+		AddPacket(PACKET_IPFIX, buff, out);
+
+} // End of AddIPFIXPacket
+
+/*
+ * Encode all flows into netflow v9 packets, as an exporter would send them, 
+ * and convert them into IPFIX packets.
+ */
+static int EncodePackets(void) {
+send_peer_t peer;
+master_record_t master_record;
+uint64_t i;
+
+	memset((void *)&peer, 0, sizeof(peer));
+	peer.send_buffer = malloc(UDP_PACKET_SIZE);
+	if ( !peer.send_buffer ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	peer.buff_ptr = peer.send_buffer;
+	peer.endp	  = (void *)((pointer_addr_t)peer.send_buffer + UDP_PACKET_SIZE - 1);
+	Init_v9_output(&peer);
+
+	for ( i=0; i < data.num_flows; i++ ) {
+		int again;
+
+		// the encoder modifies the record
+		memcpy((void *)&master_record, (void *)&data.master_record[i], sizeof(master_record_t));
+		again = Add_v9_output_record(&master_record, &peer);
+		if ( peer.flush ) {
+			uint32_t len = (pointer_addr_t)peer.buff_ptr - (pointer_addr_t)peer.send_buffer;
+			AddPacket(PACKET_V9, peer.send_buffer, len);
+			AddIPFIXPacket(peer.send_buffer, len);
+			peer.flush	  = 0;
+			peer.buff_ptr = peer.send_buffer;
+		}
+		if ( again ) 
+			Add_v9_output_record(&master_record, &peer);
+	}
+	if ( Flush_v9_output(&peer) ) {
+		uint32_t len = (pointer_addr_t)peer.buff_ptr - (pointer_addr_t)peer.send_buffer;
+		AddPacket(PACKET_V9, peer.send_buffer, len);
+		AddIPFIXPacket(peer.send_buffer, len);
+	}
+	free(peer.send_buffer);
+
+	return data.num_packets[PACKET_V9] > 0;
+
+} // End of EncodePackets
+
+static int BenchWrite(bench_t *bench, bench_result_t *result) {
+nffile_t *nffile;
+char *path;
+struct stat stat_buf;
+double start;
+uint32_t b;
+
+	path = BenchFile(bench->name + 6);
+	nffile = OpenNewFile(path, NULL, bench->param, 0, NULL);
+	if ( !nffile )
+		return 0;
+
+	start = Now();
+	for ( b=0; b < data.num_blocks; b++ ) {
+		memcpy((void *)nffile->block_header, (void *)data.blocks[b], 
+			sizeof(data_block_header_t) + data.blocks[b]->size);
+		if ( WriteBlock(nffile) <= 0 ) {
+			LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
+			DisposeFile(nffile);
+			return 0;
+		}
+	}
+	CloseUpdateFile(nffile, NULL);
+	result->seconds = Now() - start;
+	DisposeFile(nffile);
+
+	result->records = data.num_flows;
+	result->bytes	= data.block_bytes;
+	if ( stat(path, &stat_buf) == 0 )
+		result->output_bytes = stat_buf.st_size;
+
+	return 1;
+
+} // End of BenchWrite
+
+static int BenchRead(bench_t *bench, bench_result_t *result) {
+nffile_t *nffile;
+double start;
+int ret;
+
+	nffile = OpenFile(BenchFile(bench->name + 5), NULL);
+	if ( !nffile )
+		return 0;
+
+	start = Now();
+	while ( (ret = ReadBlock(nffile)) > 0 ) {
+		result->bytes += nffile->block_header->size;
+	}
+	result->seconds = Now() - start;
+	CloseFile(nffile);
+	DisposeFile(nffile);
+
+	if ( ret < 0 ) {
+		LogError("Read error in benchmark %s", bench->name);
+		return 0;
+	}
+	result->records = data.num_flows;
+
+	return 1;
+
+} // End of BenchRead
+
+static int BenchExpand(bench_t *bench, bench_result_t *result) {
+master_record_t *master_record;
+double start;
+uint64_t i;
+
+	master_record = (master_record_t *)calloc(1, sizeof(master_record_t));
+	if ( !master_record ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	start = Now();
+	for ( i=0; i < data.num_flows; i++ ) {
+		ExpandRecord_v2(data.flow_record[i], data.extension_info[i], NULL, master_record);
+		result->bytes += data.flow_record[i]->size;
+	}
+	result->seconds = Now() - start;
+	result->records = data.num_flows;
+	free(master_record);
+
+	return 1;
+
+} // End of BenchExpand
+
+static int BenchFilter(bench_t *bench, bench_result_t *result) {
+FilterEngine_data_t	*engine;
+double start;
+uint64_t i, matched;
+
+	engine = CompileFilter(bench->arg);
+	if ( !engine ) 
+		return 0;
+
+	matched = 0;
+	start = Now();
+	for ( i=0; i < data.num_flows; i++ ) {
+		engine->nfrecord = (uint64_t *)&data.master_record[i];
+		matched += (*engine->FilterEngine)(engine) ? 1 : 0;
+	}
+	result->seconds = Now() - start;
+	result->records = data.num_flows;
+	result->matched = matched;
+
+	return 1;
+
+} // End of BenchFilter
+
+static int BenchAggregate(bench_t *bench, bench_result_t *result) {
+char *aggr_fmt;
+double start;
+uint64_t i;
+
+	// the aggregation string is modified by the parser
+	if ( bench->arg && !ParseAggregateMask(strdup(bench->arg), &aggr_fmt) ) 
+		return 0;
+
+	if ( !Init_FlowTable() )
+		return 0;
+
+	start = Now();
+	for ( i=0; i < data.num_flows; i++ ) {
+		AddFlow(data.flow_record[i], &data.master_record[i], data.extension_info[i]);
+	}
+	result->seconds = Now() - start;
+	result->records = data.num_flows;
+
+	return 1;
+
+} // End of BenchAggregate
+
+static int BenchStat(bench_t *bench, bench_result_t *result) {
+int element_stat, flow_stat;
+char *s, *stat;
+double start;
+uint64_t i;
+
+	element_stat = flow_stat = 0;
+	s = strdup(bench->arg);
+	if ( !s ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	for ( stat = strtok(s, " "); stat; stat = strtok(NULL, " ") ) {
+		if ( !SetStat(stat, &element_stat, &flow_stat) ) 
+			return 0;
+	}
+
+	if ( flow_stat && !Init_FlowTable() )
+		return 0;
+	if ( element_stat && !Init_StatTable(HashBits, NumPrealloc) )
+		return 0;
+
+	start = Now();
+	for ( i=0; i < data.num_flows; i++ ) {
+		if ( flow_stat ) 
+			AddFlow(data.flow_record[i], &data.master_record[i], data.extension_info[i]);
+		if ( element_stat ) 
+			AddStat(data.flow_record[i], &data.master_record[i]);
+	}
+	result->seconds = Now() - start;
+	result->records = data.num_flows;
+
+	return 1;
+
+} // End of BenchStat
+
+static int BenchDecode(bench_t *bench, bench_result_t *result) {
+FlowSource_t fs;
+uint8_t *buff, *p, *end;
+double start;
+
+	if ( !Init_v9() || !Init_IPFIX() )
+		return 0;
+	SetupExtensionDescriptors(strdup("all"));
+
+	memset((void *)&fs, 0, sizeof(fs));
+	fs.sa_family = AF_INET;
+	fs.ip.V4	 = 0x7f000001;
+	if ( !InitExtensionMapList(&fs) )
+		return 0;
+
+	fs.nffile = OpenNewFile(BenchFile("decode"), NULL, NOT_COMPRESSED, 0, NULL);
+	if ( !fs.nffile )
+		return 0;
+
+	buff = (uint8_t *)malloc(NETWORK_INPUT_BUFF_SIZE);
+	if ( !buff ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	p	= (uint8_t *)data.packets[bench->param];
+	end = p + data.packet_bytes[bench->param];
+	start = Now();
+	while ( p < end ) {
+		uint32_t len = *((uint32_t *)p);
+		p += sizeof(uint32_t);
+		// the decoders modify the packet
+		memcpy(buff, p, len);
+		gettimeofday(&fs.received, NULL);
+		if ( bench->param == PACKET_V9 )
+			Process_v9(buff, len, &fs);
+		else
+			Process_IPFIX(buff, len, &fs);
+		p += (len + 3) & ~3;
+		result->bytes += len;
+	}
+	if ( fs.nffile->block_header->NumRecords ) 
+		WriteBlock(fs.nffile);
+	result->seconds = Now() - start;
+	result->records = fs.nffile->stat_record->numflows;
+
+	CloseUpdateFile(fs.nffile, NULL);
+	DisposeFile(fs.nffile);
+	free(buff);
+
+	return 1;
+
+} // End of BenchDecode
+
+static int BenchFormat(bench_t *bench, bench_result_t *result) {
+printer_t print_record;
+double start;
+uint64_t i, bytes;
+int fd;
+
+	print_record = NULL;
+	for ( i=0; printmap[i].printmode; i++ ) {
+		if ( strcmp(bench->arg, printmap[i].printmode) == 0 ) {
+			if ( printmap[i].Format ) {
+				if ( printmap[i].func == format_jsonl ) {
+					if ( !ParseJSONFormat(printmap[i].Format, printmap) )
+						return 0;
+				} else if ( !ParseOutputFormat(printmap[i].Format, 0, printmap) )
+					return 0;
+			}
+			print_record = printmap[i].func;
+			break;
+		}
+	}
+	if ( !print_record ) 
+		return 0;
+
+	// the formatted records are discarded
+	fd = open("/dev/null", O_WRONLY);
+	if ( fd < 0 || dup2(fd, STDOUT_FILENO) < 0 ) {
+		LogError("Can't redirect stdout: %s", strerror(errno));
+		return 0;
+	}
+	close(fd);
+
+	// printers such as jsonl write directly into the output buffer and return no string
+	bytes = OutputBytes();
+	start = Now();
+	for ( i=0; i < data.num_flows; i++ ) {
+		char *string = NULL;
+		print_record(&data.master_record[i], &string, 0);
+		if ( string ) 
+			PrintLine(string);
+	}
+	FlushOutput();
+	result->seconds = Now() - start;
+	result->bytes	= OutputBytes() - bytes;
+	result->records = data.num_flows;
+
+	return 1;
+
+} // End of BenchFormat
+
+/*
+ * Run a benchmark in a child process. The flow and stat tables and the 
+ * collectors keep global state, which must start from scratch for each run.
+ */
+static int RunIsolated(bench_t *bench, bench_result_t *result) {
+int fd[2], status;
+ssize_t len;
+pid_t pid;
+
+	if ( pipe(fd) < 0 ) {
+		LogError("pipe() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if ( pid < 0 ) {
+		LogError("fork() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		close(fd[0]);
+		close(fd[1]);
+		return 0;
+	}
+
+	if ( pid == 0 ) {
+		// child
+		close(fd[0]);
+		if ( !bench->func(bench, result) ) 
+			_exit(1);
+		len = write(fd[1], (void *)result, sizeof(bench_result_t));
+		_exit(len == sizeof(bench_result_t) ? 0 : 1);
+	}
+
+	close(fd[1]);
+	len = read(fd[0], (void *)result, sizeof(bench_result_t));
+	close(fd[0]);
+	if ( waitpid(pid, &status, 0) < 0 )
+		return 0;
+
+	if ( WIFSIGNALED(status) ) {
+		LogError("Benchmark %s terminated by signal %d", bench->name, WTERMSIG(status));
+		return 0;
+	}
+
+	return len == sizeof(bench_result_t) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+} // End of RunIsolated
+
+static void PrintResult(char *name, bench_result_t *result, int first) {
+double seconds = result->seconds > 0.0 ? result->seconds : 1e-9;
+
+	printf("%s\t\t{ \"name\": \"%s\", \"records\": %llu, \"bytes\": %llu, \"seconds\": %.6f, "
+		"\"records_per_sec\": %.0f, \"mb_per_sec\": %.2f", 
+		first ? "" : ",\n", name, (unsigned long long)result->records, (unsigned long long)result->bytes, 
+		result->seconds, (double)result->records / seconds, (double)result->bytes / seconds / 1048576.0);
+	printf(", \"matched\": %llu", (unsigned long long)result->matched);
+	printf(", \"output_bytes\": %llu", (unsigned long long)result->output_bytes);
+	printf(" }");
+
+} // End of PrintResult
+
+int main( int argc, char **argv ) {
+synth_param_t param;
+bench_result_t result;
+uint64_t num_flows;
+char *prefix;
+int c, i, rounds, failed;
+
+	SynthDefaults(&param);
+	num_flows = 200000;
+	rounds	  = 3;
+	prefix	  = NULL;
+	while ((c = getopt(argc, argv, "hn:i:z:6:m:e:s:r:b:d:V")) != EOF) {
+		switch (c) {
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+				break;
+			case 'n':
+				num_flows = strtoull(optarg, NULL, 10);
+				break;
+			case 'i':
+				param.num_ips = atoi(optarg);
+				break;
+			case 'z':
+				param.zipf = atof(optarg);
+				break;
+			case '6':
+				param.v6_ratio = atof(optarg);
+				break;
+			case 'm':
+				param.num_maps = atoi(optarg);
+				break;
+			case 'e':
+				param.num_exporters = atoi(optarg);
+				break;
+			case 's':
+				param.seed = atoi(optarg);
+				break;
+			case 'r':
+				rounds = atoi(optarg);
+				break;
+			case 'b':
+				prefix = optarg;
+				break;
+			case 'd':
+				workdir = optarg;
+				break;
+			case 'V':
+				printf("%s: Version: %s\n",argv[0], nfdump_version);
+				exit(0);
+				break;
+			default:
+				usage(argv[0]);
+				exit(255);
+		}
+	}
+
+	if ( num_flows == 0 || rounds <= 0 || param.num_ips == 0 || 
+		 param.num_maps == 0 || param.num_maps > SYNTH_MAX_MAPS || 
+		 param.v6_ratio < 0.0 || param.v6_ratio > 1.0 ) {
+		fprintf(stderr, "Invalid parameters\n");
+		usage(argv[0]);
+		exit(255);
+	}
+
+	memset((void *)&result, 0, sizeof(result));
+	if ( !GenerateData(&param, num_flows, &result) || !LoadData() || !EncodePackets() ) {
+		fprintf(stderr, "Failed to prepare benchmark data\n");
+		exit(255);
+	}
+
+	printf("{\n\t\"version\": \"%s\",\n", nfdump_version);
+	printf("\t\"flows\": %llu, \"ips\": %u, \"zipf\": %.2f, \"v6_ratio\": %.2f, \"maps\": %u, "
+		"\"exporters\": %u, \"seed\": %u, \"rounds\": %d,\n",
+		(unsigned long long)num_flows, param.num_ips, param.zipf, param.v6_ratio, param.num_maps, 
+		param.num_exporters, param.seed, rounds);
+	printf("\t\"packets\": { \"v9\": %u, \"ipfix\": %u },\n", 
+		data.num_packets[PACKET_V9], data.num_packets[PACKET_IPFIX]);
+	printf("\t\"results\": [\n");
+	PrintResult("generate", &result, 1);
+
+	failed = 0;
+	for ( i=0; bench_list[i].name; i++ ) {
+		bench_t *bench = &bench_list[i];
+		bench_result_t best;
+		int r, ok;
+
+		if ( prefix && strncmp(bench->name, prefix, strlen(prefix)) != 0 ) {
+			// the read benchmarks need the files of the write benchmarks
+			if ( strncmp(bench->name, "write_", 6) != 0 || strncmp(prefix, "read", 4) != 0 )
+				continue;
+		}
+
+		ok = 1;
+		memset((void *)&best, 0, sizeof(best));
+		for ( r=0; r < rounds && ok; r++ ) {
+			memset((void *)&result, 0, sizeof(result));
+			ok = bench->isolate ? RunIsolated(bench, &result) : bench->func(bench, &result);
+			if ( ok && (r == 0 || result.seconds < best.seconds) )
+				best = result;
+		}
+		if ( !ok ) {
+			fprintf(stderr, "Benchmark %s failed\n", bench->name);
+			failed++;
+			continue;
+		}
+		PrintResult(bench->name, &best, 0);
+	}
+	printf("\n\t]\n}\n");
+
+	// cleanup
+	for ( i=0; bench_list[i].name; i++ ) {
+		if ( strncmp(bench_list[i].name, "write_", 6) == 0 ) 
+			unlink(BenchFile(bench_list[i].name + 6));
+	}
+	unlink(BenchFile("synth"));
+	unlink(BenchFile("decode"));
+
+	return failed ? 255 : 0;
+
+} // End of main
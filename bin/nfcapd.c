@@ -104,6 +104,7 @@
 #endif
 
 #include "expire.h"
+#include "nflive.h"
 
 #define DEFAULTCISCOPORT "9995"
 #define DEFAULTHOSTNAME "127.0.0.1"
@@ -130,6 +131,9 @@ static FlowSource_t *FlowSource;
 
 static int done, launcher_alive, periodic_trigger, launcher_pid;
 
+// publish the written blocks of the current file in the live index - -L
+static int live_mode;
+
 static const char *nfdump_version = VERSION;
 
 
@@ -138,6 +142,10 @@ static void usage(char *name);
 
 static void kill_launcher(int pid);
 
+static void OpenLive(FlowSource_t *fs);
+
+static void FlushLive(time_t now);
+
 static void IntHandler(int signal);
 
 static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss);
@@ -169,11 +177,14 @@ static void usage(char *name) {
 					"-R IP[/port]\tRepeat incoming packets to IP address/port\n"
 					"-s rate\tset default sampling rate (default 1)\n"
 					"-x process\tlaunch process after a new file becomes available\n"
-					"-z\t\tLZO compress flows in output file.\n"
+					"-z[=method]\tLZO compress flows in output file.\n"
+					"\t\tmethod: lzo, lz4, bz2 or zstd[:level[:dictfile]]\n"
 					"-y\t\tLZ4 compress flows in output file.\n"
 					"-j\t\tBZ2 compress flows in output file.\n"
 					"-B bufflen\tSet socket buffer to bufflen bytes\n"
 					"-e\t\tExpire data at each cycle.\n"
+					"-L\t\tPublish the current file in a live index for nfdump --follow.\n"
+					"-A keys\tMaintain hourly and daily rollups aggregated by keys. Runs nfrollup\n"
 					"-D\t\tFork to background\n"
 					"-E\t\tPrint extended format of netflow data. for debugging purpose only.\n"
 					"-T\t\tInclude extension tags in records.\n"
@@ -184,6 +195,35 @@ static void usage(char *name) {
 					, name);
 } // End of usage
 
+// attach the current file of the flow source to the live index of its data dir
+static void OpenLive(FlowSource_t *fs) {
+
+	if ( !live_mode ) 
+		return;
+
+	fs->nffile->live = OpenLiveIndex(fs->datadir, fs->current);
+	if ( fs->nffile->live ) 
+		LiveIndexUpdate(fs->nffile->live, fs->nffile->fd);
+	else
+		LogError("Ident: %s, live index disabled", fs->Ident);
+
+} // End of OpenLive
+
+// publish partially filled blocks of the current files in time
+static void FlushLive(time_t now) {
+FlowSource_t *fs = FlowSource;
+
+	while ( fs ) {
+		nffile_t *nffile = fs->nffile;
+		if ( nffile && nffile->live && nffile->block_header->NumRecords && LiveFlushDue(nffile->live, now) ) {
+			if ( WriteBlock(nffile) <= 0 )
+				LogError("Ident: %s, failed to write output buffer to disk: '%s'" , fs->Ident, strerror(errno));
+		}
+		fs = fs->next;
+	}
+
+} // End of FlushLive
+
 void kill_launcher(int pid) {
 int stat, i;
 pid_t ret;
@@ -396,6 +436,7 @@ srecord_t	*commbuff;
 		if ( !fs->nffile ) {
 			return;
 		}
+		OpenLive(fs);
 		// init vars
 		fs->bad_packets		= 0;
 		fs->first_seen      = 0xffffffffffffLL;
@@ -414,6 +455,12 @@ srecord_t	*commbuff;
 
 	// wake up at least at next time slot (twin) + some Overdue time
 	alarm(t_start + twin + OVERDUE_TIME - time(NULL));
+
+	if ( live_mode ) {
+		// wake up in time to publish the flows, if no packets arrive
+		struct timeval timeout = { LIVE_FLUSH, 0 };
+		setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (void *)&timeout, sizeof(timeout));
+	}
 	/*
 	 * Main processing loop:
 	 * this loop, continues until done = 1, set by the signal handler
@@ -423,6 +470,9 @@ srecord_t	*commbuff;
 	while ( 1 ) {
 		struct timeval tv;
 
+		if ( live_mode ) 
+			FlushLive(time(NULL));
+
 		/* read next bunch of data into beginn of input buffer */
 		if ( !done) {
 #ifdef PCAP
@@ -439,7 +489,9 @@ srecord_t	*commbuff;
 #endif
 
 			if ( cnt == -1 && errno != EINTR ) {
-				LogError("ERROR: recvfrom: %s", strerror(errno));
+				// a receive timeout in live mode is no error
+				if ( !live_mode || (errno != EAGAIN && errno != EWOULDBLOCK) ) 
+					LogError("ERROR: recvfrom: %s", strerror(errno));
 				continue;
 			}
 
@@ -551,8 +603,13 @@ srecord_t	*commbuff;
 					// Update books
 					stat(nfcapd_filename, &fstat);
 					UpdateBooks(fs->bookkeeper, t_start, 512*fstat.st_blocks);
+					AppendCatalog(fs->datadir, nfcapd_filename, t_start, 512*fstat.st_blocks);
 				}
 
+				// readers of the live index continue with the next file
+				if ( nffile->live ) 
+					LiveIndexRotate(nffile->live, err ? NULL : subfilename);
+
 				// log stats
 				LogInfo("Ident: '%s' Flows: %llu, Packets: %llu, Bytes: %llu, Sequence Errors: %u, Bad Packets: %u", 
 					fs->Ident, (unsigned long long)nffile->stat_record->numflows, (unsigned long long)nffile->stat_record->numpackets, 
@@ -659,6 +716,7 @@ srecord_t	*commbuff;
 				LogError("Failed to open new collector file");
 				return;
 			}
+			OpenLive(fs);
 		}
 
 		/* check for too little data - cnt must be > 0 at this point */
@@ -740,7 +798,7 @@ srecord_t	*commbuff;
 
 int main(int argc, char **argv) {
  
-char	*bindhost, *datadir, pidstr[32], *launch_process;
+char	*bindhost, *datadir, pidstr[32], *launch_process, *rollup;
 char	*userid, *groupid, *checkptr, *listenport, *mcastgroup, *extension_tags;
 char	*Ident, *dynsrcdir, *time_extension, pidfile[MAXPATHLEN];
 struct stat fstat;
@@ -771,6 +829,7 @@ char	*pcap_file;
 	mcastgroup		= NULL;
 	pidfile[0]		= 0;
 	launch_process	= NULL;
+	rollup			= NULL;
 	userid 			= groupid = NULL;
 	twin	 		= TIME_WINDOW;
 	datadir	 		= NULL;
@@ -778,6 +837,7 @@ char	*pcap_file;
 	time_extension	= "%Y%m%d%H%M";
 	spec_time_extension = 0;
 	expire			= 0;
+	live_mode		= 0;
 	sampling_rate	= 1;
 	compress		= NOT_COMPRESSED;
 	memset((void *)&peer, 0, sizeof(send_peer_t));
@@ -787,7 +847,7 @@ char	*pcap_file;
 	extension_tags	= DefaultExtensions;
 	dynsrcdir		= NULL;
 
-	while ((c = getopt(argc, argv, "46ef:whEVI:DB:b:jl:J:M:n:p:P:R:S:s:T:t:x:Xru:g:zZ")) != EOF) {
+	while ((c = getopt(argc, argv, "46A:eLf:whEVI:DB:b:jl:J:M:n:p:P:R:S:s:T:t:x:Xru:g:z::Z")) != EOF) {
 		switch (c) {
 			case 'h':
 				usage(argv[0]);
@@ -799,9 +859,15 @@ char	*pcap_file;
 			case 'g':
 				groupid  = optarg;
 				break;
+			case 'A':
+				rollup = optarg;
+				break;
 			case 'e':
 				expire = 1;
 				break;
+			case 'L':
+				live_mode = 1;
+				break;
 			case 'f': {
 #ifdef PCAP
 				struct stat	fstat;
@@ -967,7 +1033,9 @@ char	*pcap_file;
 					LogError("Use one compression: -z for LZO, -j for BZ2 or -y for LZ4 compression\n");
 					exit(255);
 				}
-				compress = LZO_COMPRESSED;
+				compress = ParseCompression(optarg);
+				if ( compress < 0 )
+					exit(255);
 				break;
 			case 'Z':
 				time_extension	= "%Y%m%d%H%M%z";
@@ -1018,6 +1086,11 @@ char	*pcap_file;
 		exit(255);
 	}
 
+	if ( rollup && spec_time_extension ) {
+		fprintf(stderr, "ERROR, -Z timezone extension breaks rollups -A\n");
+		exit(255);
+	}
+
 	InitExtensionMaps(NO_EXTENSION_LIST);
 	SetupExtensionDescriptors(strdup(extension_tags));
 
@@ -1131,7 +1204,7 @@ char	*pcap_file;
 	}
 
 	done = 0;
-	if ( launch_process || expire ) {
+	if ( launch_process || rollup || expire ) {
 		// for efficiency reason, the process collecting the data
 		// and the process launching processes, when a new file becomes
 		// available are separated. Communication is done using signals
@@ -1149,7 +1222,7 @@ char	*pcap_file;
 			case 0:
 				// child
 				close(sock);
-				launcher((char *)shmem, FlowSource, launch_process, expire);
+				launcher((char *)shmem, FlowSource, launch_process, rollup, expire);
 				_exit(0);
 				break;
 			case -1:
@@ -38,9 +38,12 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <time.h>
+#include <signal.h>
 #include <string.h>
 #include <ctype.h>
+#include <getopt.h>
 #include <sys/types.h>
+#include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -60,6 +63,7 @@
 #include "exporter.h"
 #include "nf_common.h"
 #include "output_json.h"
+#include "output_util.h"
 #include "netflow_v5_v7.h"
 #include "netflow_v9.h"
 #include "rbtree.h"
@@ -67,11 +71,15 @@
 #include "nfprof.h"
 #include "nfdump.h"
 #include "nflowcache.h"
+#include "nfsort.h"
 #include "nfstat.h"
 #include "nfexport.h"
 #include "ipconv.h"
 #include "util.h"
 #include "flist.h"
+#include "nfscan.h"
+#include "rollup.h"
+#include "nflive.h"
 #ifdef HAVE_AVROEXPORT
 #include "export_avro.h"
 #endif
@@ -93,10 +101,6 @@ FilterEngine_data_t	*Engine;
 extern char	*FilterFilename;
 extern uint32_t loopcnt;
 
-#ifdef COMPAT15
-extern extension_descriptor_t extension_descriptor[];
-#endif
-
 /* Local Variables */
 const char *nfdump_version = VERSION;
 
@@ -106,6 +110,8 @@ static uint32_t skipped_blocks;
 static uint32_t	is_anonymized;
 static time_t 	t_first_flow, t_last_flow;
 static char		Ident[IDENTLEN];
+static int		merge_partials;
+static nflive_t	*live;			// --follow: live index of a collector
 
 
 int hash_hit = 0; 
@@ -192,6 +198,8 @@ extern generic_exporter_t **exporter_list;
 
 #define FORMAT_nel "%ts %nevt %pr %sap -> %dap %nsap -> %ndap"
 
+#define FORMAT_jsonl "%ts %te %td %pr %sa %da %sp %dp %flg %tos %ipkt %ibyt %opkt %obyt %fl"
+
 #ifdef NSEL
 #	define DefaultMode "nsel"
 #else 
@@ -229,6 +237,7 @@ printmap_t printmap[] = {
 	{ "bilong", 	format_special,      		FORMAT_bilong 	},
 	{ "pipe", 		flow_record_to_pipe,      	NULL 			},
 	{ "json", 		flow_record_to_json,      	NULL 			},
+	{ "jsonl", 		format_jsonl,      			FORMAT_jsonl 	},
 	{ "csv", 		flow_record_to_csv,      	NULL 			},
 	{ "null", 		flow_record_to_null,      	NULL 			},
 #ifdef NSEL
@@ -249,11 +258,58 @@ printmap_t printmap[] = {
 // compare at most 16 chars
 #define MAXMODELEN	16	
 
+// sort_flows modes of process_data
+#define SORT_TABLE	1
+#define SORT_STREAM	2
+
+// state of process_data while scanning the flow files
+typedef struct dump_ctx_s {
+	stat_record_t	stat_record;	// all matched flows
+	nffile_t		*nffile_w;
+	char			*wfile;
+	int				write_file;
+	int				compress;
+	int				element_stat;
+	int				flow_stat;
+	int				sort_flows;
+	printer_t		print_record;
+	int				tag;
+	uint64_t		limitflows;
+#ifdef HAVE_AVROEXPORT
+	int				export_avro;
+#endif
+	uint32_t		num_files;
+	int				flow_table;			// flow table of the partial: 1 matches, -1 differs
+	char			ident[IDENTLEN];	// ident of last file read
+	char			partial[MAXPATHLEN];	// partial file merged
+} dump_ctx_t;
+
 /* Function Prototypes */
 static void usage(char *name);
 
 static void PrintSummary(stat_record_t *stat_record, int plain_numbers, int csv_output);
 
+static int dump_file(void *data, char *filename, file_header_t *file_header, stat_record_t *stat_record);
+
+static int dump_block(void *data, data_block_header_t *block_header);
+
+static int dump_flow(void *data, common_record_t *flow_record, master_record_t *master_record, 
+	extension_info_t *extension_info);
+
+static void dump_map(void *data, extension_map_t *map);
+
+static void dump_exporter(void *data, record_header_t *record);
+
+static void dump_stat(void *data, record_header_t *record);
+
+static void dump_idle(void *data);
+
+static void FollowHandler(int signal);
+
+static void CheckPartial(dump_ctx_t *ctx);
+
+static int WritePartial(char *partial_file, stat_record_t *sum_stat, int flow_table, int element_stat, int compress);
+
 #ifndef HAVE_AVROEXPORT
 static stat_record_t process_data(char *wfile, int element_stat, int flow_stat, int sort_flows,
 	printer_t print_header, printer_t print_record, time_t twin_start, time_t twin_end, 
@@ -289,8 +345,10 @@ static void usage(char *name) {
 					"\t\tand ordered by <order>: packets, bytes, flows, bps pps and bpp.\n"
 					"-q\t\tQuiet: Do not print the header and bottom stat lines.\n"
 					"-i <ident>\tChange Ident to <ident> in file given by -r.\n"
-					"-J <num>\tModify file compression: 0: uncompressed - 1: LZO - 2: BZ2 - 3: LZ4 compressed.\n"
-					"-z\t\tLZO compress flows in output file. Used in combination with -w.\n"
+					"-J <num>\tModify file compression: 0: uncompressed - 1: LZO - 2: BZ2 - 3: LZ4 - 4: ZSTD compressed.\n"
+					"\t\tzstd[:level[:dictfile|:train]] selects the ZSTD level and dictionary.\n"
+					"-z[=method]\tLZO compress flows in output file. Used in combination with -w.\n"
+					"\t\tmethod: lzo, lz4, bz2 or zstd[:level[:dictfile]]\n"
 					"-y\t\tLZ4 compress flows in output file. Used in combination with -w.\n"
 					"-j\t\tBZ2 compress flows in output file. Used in combination with -w.\n"
 					"-l <expr>\tSet limit on packets for line and packed output format.\n"
@@ -313,10 +371,13 @@ static void usage(char *name) {
 					"\t\t extended Even more information.\n"
 					"\t\t csv      ',' separated, machine parseable output format.\n"
 					"\t\t json     json output format.\n"
+					"\t\t jsonl    compact json output format - one record per line.\n"
+					"\t\t jsonl:<format> json lines with the fields of the fmt: tokens in <format>.\n"
 					"\t\t pipe     '|' separated legacy machine parseable output format.\n"
 					"\t\t\tmode may be extended by '6' for full IPv6 listing. e.g.long6, extended6.\n"
 #ifdef HAVE_AVROEXPORT
-					"-H <file>\tExport flow data in Apache Avro format for use in Hadoop environments.\n"
+					"-H [codec:]<file>\tExport flow data in Apache Avro format for use in Hadoop environments.\n"
+					"\t\tcodec: null, deflate, snappy or lzma. Default: snappy\n"
 #endif
 					"-E <file>\tPrint exporter ans sampling info for collected flows.\n"
 					"-v <file>\tverify netflow data file. Print version and blocks.\n"
@@ -324,7 +385,12 @@ static void usage(char *name) {
 					"-X\t\tDump Filtertable and exit (debug option).\n"
 					"-Z\t\tCheck filter syntax and exit.\n"
 					"-t <time>\ttime window for filtering packets\n"
-					"\t\tyyyy/MM/dd.hh:mm:ss[-yyyy/MM/dd.hh:mm:ss]\n", name);
+					"\t\tyyyy/MM/dd.hh:mm:ss[-yyyy/MM/dd.hh:mm:ss]\n"
+					"--profile\tPrint the time spent in each processing stage. Needs --enable-stageprof.\n"
+					"--partial <file>\tWrite the partial result of the -s or -A query to file.\n"
+					"--merge-partials\tMerge the partial results given by -r, -R or -M and print the -s or -A query.\n"
+					"--no-rollup\tRead the flow files, even if rollup files can answer the query.\n"
+					"--follow <dir>\tFollow the current file of the collector writing to <dir> with -L, until interrupted.\n", name);
 } /* usage */
 
 
@@ -371,362 +437,341 @@ char 		bps_str[NUMBER_STRING_SIZE], pps_str[NUMBER_STRING_SIZE], bpp_str[NUMBER_
 
 } // End of PrintSummary
 
-#ifndef HAVE_AVROEXPORT
-stat_record_t process_data(char *wfile, int element_stat, int flow_stat, int sort_flows,
-	printer_t print_header, printer_t print_record, time_t twin_start, time_t twin_end, 
-	uint64_t limitflows, int tag, int compress) {
-#else
-stat_record_t process_data(char *wfile, int element_stat, int flow_stat, int sort_flows,
-	printer_t print_header, printer_t print_record, time_t twin_start, time_t twin_end, 
-	uint64_t limitflows, int tag, int compress, int export_avro) {
-#endif
-common_record_t 	*flow_record, *record_ptr;
-master_record_t		*master_record;
-nffile_t			*nffile_w, *nffile_r;
-stat_record_t 		stat_record;
-int 				done, write_file;
-
-#ifdef COMPAT15
-int	v1_map_done = 0;
-#endif
-	
-	// time window of all matched flows
-	memset((void *)&stat_record, 0, sizeof(stat_record_t));
-	stat_record.first_seen = 0x7fffffff;
-	stat_record.msec_first = 999;
-
-	// Do the logic first
+static int dump_file(void *data, char *filename, file_header_t *file_header, stat_record_t *stat_record) {
+dump_ctx_t *ctx = (dump_ctx_t *)data;
 
-	// do not print flows when doing any stats are sorting
-	if ( sort_flows || flow_stat || element_stat ) {
-		print_record = NULL;
+	if ( merge_partials ) {
+		// the flows of the partials are aggregated already - use their stat records
+		CheckPartial(ctx);
+		SumStatRecords(&ctx->stat_record, stat_record);
+		strncpy(ctx->partial, filename ? filename : "-", MAXPATHLEN-1);
 	}
 
-	// do not write flows to file, when doing any stats
-	// -w may apply for flow_stats later
-	write_file = !(sort_flows || flow_stat || element_stat) && wfile;
-	nffile_r = NULL;
-	nffile_w = NULL;
-
-	// Get the first file handle
-	nffile_r = GetNextFile(NULL, twin_start, twin_end);
-	if ( !nffile_r ) {
-		LogError("GetNextFile() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-		return stat_record;
-	}
-	if ( nffile_r == EMPTY_LIST ) {
-		LogError("Empty file list. No files to process\n");
-		return stat_record;
+	// ident of the last file read, for the output file
+	strncpy(ctx->ident, file_header->ident, IDENTLEN);
+	ctx->ident[IDENTLEN-1] = '\0';
+
+	if ( live ) {
+		// the stat record of the current file is not yet written - use the matched flows
+		if ( ctx->num_files++ ) 
+			return SCAN_CONTINUE;
+	} else if ( ctx->num_files++ ) {
+		// Update global time span window
+		if ( stat_record->first_seen < t_first_flow )
+			t_first_flow = stat_record->first_seen;
+		if ( stat_record->last_seen > t_last_flow ) 
+			t_last_flow = stat_record->last_seen;
+		return SCAN_CONTINUE;
 	}
 
 	// preset time window of all processed flows to the stat record in first flow file
-	t_first_flow = nffile_r->stat_record->first_seen;
-	t_last_flow  = nffile_r->stat_record->last_seen;
+	if ( !live ) {
+		t_first_flow = stat_record->first_seen;
+		t_last_flow  = stat_record->last_seen;
+	}
 
 	// store infos away for later use
 	// although multiple files may be processed, it is assumed that all 
 	// have the same settings
-	is_anonymized = IP_ANONYMIZED(nffile_r);
-	strncpy(Ident, nffile_r->file_header->ident, IDENTLEN);
+	is_anonymized = file_header->flags & FLAG_ANONYMIZED;
+	strncpy(Ident, file_header->ident, IDENTLEN);
 	Ident[IDENTLEN-1] = '\0';
 
 	// prepare output file if requested
-	if ( write_file ) {
-		nffile_w = OpenNewFile(wfile, NULL, compress, IP_ANONYMIZED(nffile_r), NULL );
-		if ( !nffile_w ) {
-			if ( nffile_r ) {
-				CloseFile(nffile_r);
-				DisposeFile(nffile_r);
-			}
-			return stat_record;
-		}
+	if ( ctx->write_file ) {
+		ctx->nffile_w = OpenNewFile(ctx->wfile, NULL, ctx->compress, is_anonymized, NULL );
+		if ( !ctx->nffile_w ) 
+			return SCAN_STOP;
 	}
 
-	// setup Filter Engine to point to master_record, as any record read from file
-	// is expanded into this record
-	// Engine->nfrecord = (uint64_t *)master_record;
-
-	done = 0;
-	while ( !done ) {
-	int i, ret;
-	char *ConvertBuffer = NULL;
-
-		// get next data block from file
-		ret = ReadBlock(nffile_r);
-
-		switch (ret) {
-			case NF_CORRUPT:
-			case NF_ERROR:
-				if ( ret == NF_CORRUPT ) 
-					LogError("Skip corrupt data file '%s'\n",GetCurrentFilename());
-				else 
-					LogError("Read error in file '%s': %s\n",GetCurrentFilename(), strerror(errno) );
-				// fall through - get next file in chain
-			case NF_EOF: {
-				nffile_t *next = GetNextFile(nffile_r, twin_start, twin_end);
-				if ( next == EMPTY_LIST ) {
-					done = 1;
-				} else if ( next == NULL ) {
-					done = 1;
-					LogError("Unexpected end of file list\n");
-				} else {
-					// Update global time span window
-					if ( next->stat_record->first_seen < t_first_flow )
-						t_first_flow = next->stat_record->first_seen;
-					if ( next->stat_record->last_seen > t_last_flow ) 
-						t_last_flow = next->stat_record->last_seen;
-					// continue with next file
-				}
-				continue;
+	return SCAN_CONTINUE;
 
-				} break; // not really needed
-			default:
-				// successfully read block
-				total_bytes += ret;
-		}
+} // End of dump_file
 
+static int dump_block(void *data, data_block_header_t *block_header) {
 
-#ifdef COMPAT15
-		if ( nffile_r->block_header->id == DATA_BLOCK_TYPE_1 ) {
-			common_record_v1_t *v1_record = (common_record_v1_t *)nffile_r->buff_ptr;
-			// create an extension map for v1 blocks
-			if ( v1_map_done == 0 ) {
-				extension_map_t *map = malloc(sizeof(extension_map_t) + 2 * sizeof(uint16_t) );
-				if ( ! map ) {
-					LogError("malloc() allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-					exit(255);
-				}
-				map->type 	= ExtensionMapType;
-				map->size 	= sizeof(extension_map_t) + 2 * sizeof(uint16_t);
-				if (( map->size & 0x3 ) != 0 ) {
-					map->size += 4 - ( map->size & 0x3 );
-				}
+	if ( block_header->id == Large_BLOCK_Type ) {
+		// skip
+		FlushOutput();
+		printf("Xstat block skipped ...\n");
+		return SCAN_SKIP;
+	}
 
-				map->map_id = INIT_ID;
+	return SCAN_CONTINUE;
 
-				map->ex_id[0]  = EX_IO_SNMP_2;
-				map->ex_id[1]  = EX_AS_2;
-				map->ex_id[2]  = 0;
-				
-				map->extension_size  = 0;
-				map->extension_size += extension_descriptor[EX_IO_SNMP_2].size;
-				map->extension_size += extension_descriptor[EX_AS_2].size;
+} // End of dump_block
 
-				if ( Insert_Extension_Map(extension_map_list,map) && write_file ) {
-					// flush new map
-					AppendToBuffer(nffile_w, (void *)map, map->size);
-				} // else map already known and flushed
+static void dump_idle(void *data) {
 
-				v1_map_done = 1;
-			}
+	// all flows written so far are processed - print them now
+	FlushOutput();
+	fflush(stdout);
 
-			// convert the records to v2
-			for ( i=0; i < nffile_r->block_header->NumRecords; i++ ) {
-				common_record_t *v2_record = (common_record_t *)v1_record;
-				Convert_v1_to_v2((void *)v1_record);
-				// now we have a v2 record -> use size of v2_record->size
-				v1_record = (common_record_v1_t *)((pointer_addr_t)v1_record + v2_record->size);
+} // End of dump_idle
+
+static void FollowHandler(int signal) {
+	StopLiveFollow();
+} // End of FollowHandler
+
+static int dump_flow(void *data, common_record_t *flow_record, master_record_t *master_record, 
+	extension_info_t *extension_info) {
+dump_ctx_t *ctx = (dump_ctx_t *)data;
+
+	// Records passed filter -> continue record processing
+	// Update statistics
+#ifdef DEVEL
+	if ( master_record->label )
+		printf("Flow has label: %s\n", master_record->label);
+#endif
+	if ( merge_partials ) {
+		// stat tables are merged from the stat records of the partial
+		if ( ctx->flow_stat ) 
+			AddFlow(flow_record, master_record, extension_info);
+		return SCAN_CONTINUE;
+	}
+
+	UpdateStat(&ctx->stat_record, master_record);
+
+	if ( ctx->flow_stat ) {
+		PROF_START(PROF_AGGREGATE, PROF_SAMPLED);
+		AddFlow(flow_record, master_record, extension_info);
+		if ( ctx->element_stat ) {
+			AddStat(flow_record, master_record);
+		} 
+		PROF_END(PROF_AGGREGATE);
+	} else if ( ctx->element_stat ) {
+		PROF_START(PROF_AGGREGATE, PROF_SAMPLED);
+		AddStat(flow_record, master_record);
+		PROF_END(PROF_AGGREGATE);
+	} else if ( ctx->sort_flows == SORT_STREAM ) {
+		PROF_START(PROF_INSERT, PROF_SAMPLED);
+		SortFlow(flow_record, extension_info, master_record->exp_ref);
+		PROF_END(PROF_INSERT);
+	} else if ( ctx->sort_flows ) {
+		PROF_START(PROF_INSERT, PROF_SAMPLED);
+		InsertFlow(flow_record, master_record, extension_info);
+		PROF_END(PROF_INSERT);
+	} else {
+		if ( ctx->write_file ) {
+			AppendToBuffer(ctx->nffile_w, (void *)flow_record, flow_record->size);
+		} else if ( ctx->print_record ) {
+			char *string = NULL;
+			// if we need to print out this record
+			if ( ctx->limitflows == 0 || ctx->stat_record.numflows <= ctx->limitflows ) {
+				PROF_START(PROF_PRINT, PROF_SAMPLED);
+				ctx->print_record(master_record, &string, ctx->tag);
+				if ( string ) 
+					PrintLine(string);
+				PROF_END(PROF_PRINT);
 			}
-			nffile_r->block_header->id = DATA_BLOCK_TYPE_2;
+		} else { 
+			// mutually exclusive conditions should prevent executing this code
+			// this is buggy!
+			printf("Bug! - this code should never get executed in file %s line %d\n", __FILE__, __LINE__);
 		}
+#ifdef HAVE_AVROEXPORT
+		if (ctx->export_avro) flow_record_to_avro(master_record);
 #endif
+	} // sort_flows - else
 
-		if ( nffile_r->block_header->id == Large_BLOCK_Type ) {
-			// skip
-			printf("Xstat block skipped ...\n");
-			continue;
-		}
+	// check if we are done, due to -c option 
+	if ( ctx->limitflows && ctx->stat_record.numflows >= ctx->limitflows ) 
+		return SCAN_STOP;
 
-		if ( nffile_r->block_header->id != DATA_BLOCK_TYPE_2 ) {
-			if ( nffile_r->block_header->id == DATA_BLOCK_TYPE_1 ) {
-				LogError("Can't process nfdump 1.5.x block type 1. Add --enable-compat15 to compile compatibility code. Skip block.\n");
-			} else {
-				LogError("Can't process block type %u. Skip block.\n", nffile_r->block_header->id);
-			}
-			skipped_blocks++;
-			continue;
-		}
+	return SCAN_CONTINUE;
 
-		record_ptr = nffile_r->buff_ptr;
-		for ( i=0; i < nffile_r->block_header->NumRecords; i++ ) {
-			flow_record = record_ptr;
-			switch ( record_ptr->type ) {
-				case CommonRecordV0Type: 
-					// convert common record v0
-					if ( !ConvertBuffer ) {
-						ConvertBuffer = malloc(65536);
-						if ( !ConvertBuffer ) {
-							LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-							exit(255);
-						}
-					}
-					ConvertCommonV0((void *)record_ptr, (common_record_t *)ConvertBuffer);
-					flow_record = (common_record_t *)ConvertBuffer;
-					dbg_printf("Converted type %u to %u record\n", CommonRecordV0Type, CommonRecordType);
-				case CommonRecordType: {
-					int match;
-					uint32_t map_id;
-					generic_exporter_t *exp_info;
-
-					// valid flow_record converted if needed
-					map_id = flow_record->ext_map;
-					exp_info = exporter_list[flow_record->exporter_sysid];
-
-					if ( map_id >= MAX_EXTENSION_MAPS ) {
-						LogError("Corrupt data file. Extension map id %u too big.\n", flow_record->ext_map);
-						exit(255);
-					}
-					if ( extension_map_list->slot[map_id] == NULL ) {
-						LogError("Corrupt data file. Missing extension map %u. Skip record.\n", flow_record->ext_map);
-						record_ptr = (common_record_t *)((pointer_addr_t)record_ptr + record_ptr->size);	
-						continue;
-					} 
-
-					total_flows++;
-					master_record = &(extension_map_list->slot[map_id]->master_record);
-					Engine->nfrecord = (uint64_t *)master_record;
-					ExpandRecord_v2( flow_record, extension_map_list->slot[map_id], 
-						exp_info ? &(exp_info->info) : NULL, master_record);
-
-					// Time based filter
-					// if no time filter is given, the result is always true
-					match  = twin_start && (master_record->first < twin_start || master_record->last > twin_end) ? 0 : 1;
-					match &= limitflows ? stat_record.numflows < limitflows : 1;
-
-					// filter netflow record with user supplied filter
-					if ( match ) 
-						match = (*Engine->FilterEngine)(Engine);
-	
-					if ( match == 0 ) { // record failed to pass all filters
-						// increment pointer by number of bytes for netflow record
-						record_ptr = (common_record_t *)((pointer_addr_t)record_ptr + record_ptr->size);	
-						// go to next record
-						continue;
-					}
+} // End of dump_flow
 
-					// Records passed filter -> continue record processing
-					// Update statistics
-					master_record->label = Engine->label;
-#ifdef DEVEL
-					if ( Engine->label )
-						printf("Flow has label: %s\n", Engine->label);
-#endif
-					UpdateStat(&stat_record, master_record);
+static void dump_map(void *data, extension_map_t *map) {
+dump_ctx_t *ctx = (dump_ctx_t *)data;
 
-					// update number of flows matching a given map
-					extension_map_list->slot[map_id]->ref_count++;
-	
-					if ( flow_stat ) {
-						AddFlow(flow_record, master_record, extension_map_list->slot[map_id]);
-						if ( element_stat ) {
-							AddStat(flow_record, master_record);
-						} 
-					} else if ( element_stat ) {
-						AddStat(flow_record, master_record);
-					} else if ( sort_flows ) {
-						InsertFlow(flow_record, master_record, extension_map_list->slot[map_id]);
-					} else {
-						if ( write_file ) {
-							AppendToBuffer(nffile_w, (void *)flow_record, flow_record->size);
-						} else if ( print_record ) {
-							char *string = NULL;
-							// if we need to print out this record
-							print_record(master_record, &string, tag);
-							if ( string ) {
-								if ( limitflows ) {
-									if ( (stat_record.numflows <= limitflows) )
-										printf("%s\n", string);
-								} else 
-									printf("%s\n", string);
-							}
-						} else { 
-							// mutually exclusive conditions should prevent executing this code
-							// this is buggy!
-							printf("Bug! - this code should never get executed in file %s line %d\n", __FILE__, __LINE__);
-						}
-#ifdef HAVE_AVROEXPORT
-						if (export_avro) flow_record_to_avro(master_record);
+	if ( ctx->write_file ) {
+		// flush new map
+		AppendToBuffer(ctx->nffile_w, (void *)map, map->size);
+	}
+
+} // End of dump_map
+
+static void dump_exporter(void *data, record_header_t *record) {
+dump_ctx_t *ctx = (dump_ctx_t *)data;
+
+	if ( ctx->write_file ) 
+		AppendToBuffer(ctx->nffile_w, (void *)record, record->size);
+
+} // End of dump_exporter
+
+static void dump_stat(void *data, record_header_t *record) {
+dump_ctx_t *ctx = (dump_ctx_t *)data;
+
+	if ( record->type == FlowTableRecordType ) {
+		ctx->flow_table = MatchFlowTableRecord(record) ? 1 : -1;
+		return;
+	}
+
+	if ( ctx->element_stat && !MergeStatRecord(record) ) 
+		LogError("Skip corrupt stat record of size %u\n", record->size);
+
+} // End of dump_stat
+
+static void CheckPartial(dump_ctx_t *ctx) {
+
+	// each partial must contain all -s stats of the query
+	if ( ctx->num_files && ctx->element_stat && !MergedStatTables() ) {
+		LogError("Partial '%s' does not contain the requested -s statistics\n", ctx->partial);
+		exit(255);
+	}
+
+	// the flows of each partial must be aggregated by all keys of the query
+	if ( ctx->num_files && ctx->flow_stat && ctx->flow_table != 1 ) {
+		if ( ctx->flow_table ) 
+			LogError("Partial '%s' is not aggregated by the requested keys\n", ctx->partial);
+		else
+			LogError("Partial '%s' does not contain the requested flow table\n", ctx->partial);
+		exit(255);
+	}
+	ctx->flow_table = 0;
+
+} // End of CheckPartial
+
+static int WritePartial(char *partial_file, stat_record_t *sum_stat, int flow_table, int element_stat, int compress) {
+nffile_t *nffile;
+
+	nffile = OpenNewFile(partial_file, NULL, compress, is_anonymized, NULL);
+	if ( !nffile ) 
+		return 0;
+
+	if ( flow_table ) {
+		flow_table_record_t table_record;
+		GetFlowTableRecord(&table_record);
+		AppendToBuffer(nffile, (void *)&table_record, table_record.size);
+	}
+
+	// bidir adds the out counters to all maps, as flows with different maps are aggregated
+	if ( (flow_table && !ExportFlowTable(nffile, 1, 1, 0, extension_map_list)) ||
+		 (element_stat && !ExportStatTables(nffile)) ) {
+		CloseFile(nffile);
+		DisposeFile(nffile);
+		unlink(partial_file);
+		return 0;
+	}
+
+	memcpy((void *)nffile->stat_record, (void *)sum_stat, sizeof(stat_record_t));
+	if ( !CloseUpdateFile(nffile, Ident) ) {
+		DisposeFile(nffile);
+		unlink(partial_file);
+		return 0;
+	}
+	DisposeFile(nffile);
+
+	return 1;
+
+} // End of WritePartial
+
+#ifndef HAVE_AVROEXPORT
+stat_record_t process_data(char *wfile, int element_stat, int flow_stat, int sort_flows,
+	printer_t print_header, printer_t print_record, time_t twin_start, time_t twin_end, 
+	uint64_t limitflows, int tag, int compress) {
+#else
+stat_record_t process_data(char *wfile, int element_stat, int flow_stat, int sort_flows,
+	printer_t print_header, printer_t print_record, time_t twin_start, time_t twin_end, 
+	uint64_t limitflows, int tag, int compress, int export_avro) {
 #endif
-					} // sort_flows - else
-					} break; 
-				case ExtensionMapType: {
-					extension_map_t *map = (extension_map_t *)record_ptr;
-	
-					if ( Insert_Extension_Map(extension_map_list, map) && write_file ) {
-						// flush new map
-						AppendToBuffer(nffile_w, (void *)map, map->size);
-					} // else map already known and flushed
-					} break;
-				case ExporterRecordType:
-				case SamplerRecordype:
-						// Silently skip exporter records
-					break;
-				case ExporterInfoRecordType: {
-					int ret = AddExporterInfo((exporter_info_record_t *)record_ptr);
-					if ( ret != 0 ) {
-						if ( write_file && ret == 1 ) 
-							AppendToBuffer(nffile_w, (void *)record_ptr, record_ptr->size);
-					} else {
-						LogError("Failed to add Exporter Record\n");
-					}
-					} break;
-				case ExporterStatRecordType:
-					AddExporterStat((exporter_stats_record_t *)record_ptr);
-					break;
-				case SamplerInfoRecordype: {
-					int ret = AddSamplerInfo((sampler_info_record_t *)record_ptr);
-					if ( ret != 0 ) {
-						if ( write_file && ret == 1 ) 
-							AppendToBuffer(nffile_w, (void *)flow_record, flow_record->size);
-					} else {
-						LogError("Failed to add Sampler Record\n");
-					}
-					} break;
-				default: {
-					LogError("Skip unknown record type %i\n", record_ptr->type);
-				}
-			}
+dump_ctx_t	ctx;
+scan_t		scan;
 
-		// Advance pointer by number of bytes for netflow record
-		record_ptr = (common_record_t *)((pointer_addr_t)record_ptr + record_ptr->size);	
+	memset((void *)&ctx, 0, sizeof(dump_ctx_t));
 
+	// time window of all matched flows
+	ctx.stat_record.first_seen = 0x7fffffff;
+	ctx.stat_record.msec_first = 999;
 
-		} // for all records
+	// Do the logic first
 
-		// check if we are done, due to -c option 
-		if ( limitflows ) 
-			done = stat_record.numflows >= limitflows;
+	// do not print flows when doing any stats are sorting
+	if ( sort_flows || flow_stat || element_stat ) {
+		print_record = NULL;
+	}
 
-	} // while
+	// do not write flows to file, when doing any stats
+	// -w may apply for flow_stats later
+	ctx.write_file	 = !(sort_flows || flow_stat || element_stat) && wfile;
+	ctx.wfile		 = wfile;
+	ctx.compress	 = compress;
+	ctx.element_stat = element_stat;
+	ctx.flow_stat	 = flow_stat;
+	ctx.sort_flows	 = sort_flows;
+	ctx.print_record = print_record;
+	ctx.tag			 = tag;
+	ctx.limitflows	 = limitflows;
+#ifdef HAVE_AVROEXPORT
+	ctx.export_avro	 = export_avro;
+#endif
 
-	CloseFile(nffile_r);
+	memset((void *)&scan, 0, sizeof(scan_t));
+	scan.twin_start			= twin_start;
+	scan.twin_end			= twin_end;
+	scan.engine				= Engine;
+	scan.extension_map_list	= extension_map_list;
+	scan.data				= (void *)&ctx;
+	scan.file				= dump_file;
+	scan.block				= dump_block;
+	scan.flow				= dump_flow;
+	scan.map				= dump_map;
+	scan.exporter			= dump_exporter;
+	scan.stat				= merge_partials ? dump_stat : NULL;
+	scan.live				= live;
+	scan.idle				= live ? dump_idle : NULL;
+
+	if ( !ScanFiles(&scan) ) 
+		return ctx.stat_record;
+
+	total_bytes		+= scan.total_bytes;
+	total_flows		+= scan.total_flows;
+	skipped_blocks	+= scan.skipped_blocks;
+
+	if ( merge_partials ) 
+		CheckPartial(&ctx);
+
+	// flush printed records
+	FlushOutput();
 
 	// flush output file
-	if ( write_file ) {
+	if ( ctx.nffile_w ) {
 		// flush current buffer to disc
-		if ( nffile_w->block_header->NumRecords ) {
-			if ( WriteBlock(nffile_w) <= 0 ) {
+		if ( ctx.nffile_w->block_header->NumRecords ) {
+			if ( WriteBlock(ctx.nffile_w) <= 0 ) {
 				LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
 			} 
 		}
 
-		/* Stat info */
-		if ( write_file ) {
-			/* Copy stat info and close file */
-			memcpy((void *)nffile_w->stat_record, (void *)&stat_record, sizeof(stat_record_t));
-			CloseUpdateFile(nffile_w, nffile_r->file_header->ident );
-			nffile_w = DisposeFile(nffile_w);
-		} // else stdout
+		/* Copy stat info and close file */
+		memcpy((void *)ctx.nffile_w->stat_record, (void *)&ctx.stat_record, sizeof(stat_record_t));
+		CloseUpdateFile(ctx.nffile_w, ctx.ident );
+		ctx.nffile_w = DisposeFile(ctx.nffile_w);
 	}	 
 
 	PackExtensionMapList(extension_map_list);
 
-	DisposeFile(nffile_r);
-	return stat_record;
+	return ctx.stat_record;
 
 } // End of process_data
 
 
+// long options
+#define OPT_PROFILE	256
+#define OPT_NOROLLUP	257
+#define OPT_PARTIAL		258
+#define OPT_MERGE		259
+#define OPT_FOLLOW		260
+static struct option longopts[] = {
+	{ "profile", no_argument, NULL, OPT_PROFILE },
+	{ "no-rollup", no_argument, NULL, OPT_NOROLLUP },
+	{ "partial", required_argument, NULL, OPT_PARTIAL },
+	{ "merge-partials", no_argument, NULL, OPT_MERGE },
+	{ "follow", required_argument, NULL, OPT_FOLLOW },
+	{ NULL, 0, NULL, 0 }
+};
+
 int main( int argc, char **argv ) {
 struct stat stat_buff;
 stat_record_t	sum_stat;
@@ -737,14 +782,20 @@ char 		*rfile, *Rfile, *Mdirs, *wfile, *ffile, *filter, *tstring, *stat_type;
 char		*avrofile;
 #endif
 char		*byte_limit_string, *packet_limit_string, *print_format, *record_header;
-char		*print_order, *query_file, *nameserver, *aggr_fmt;
+char		*print_order, *query_file, *nameserver, *aggr_fmt, *partial_file, *followdir;
 int 		c, ffd, ret, element_stat, fdump;
 int 		i, user_format, quiet, flow_stat, topN, aggregate, aggregate_mask, bidir;
-int 		print_stat, syntax_only, date_sorted, do_tag, compress;
+int 		print_stat, syntax_only, date_sorted, stream_sort, do_tag, compress;
 int			plain_numbers, GuessDir, pipe_output, csv_output, ModifyCompress;
 time_t 		t_start, t_end;
 uint32_t	limitflows;
 char 		Ident[IDENTLEN];
+stringlist_t rollup_keys;
+uint32_t	rollup_files;
+int			use_rollup;
+#ifdef NFPROF_STAGES
+int			profile_stages = 0;
+#endif
 
 	rfile = Rfile = Mdirs = wfile = ffile = filter = tstring = stat_type = NULL;
 #ifdef HAVE_AVROEXPORT
@@ -762,6 +813,7 @@ char 		Ident[IDENTLEN];
 	element_stat  	= 0;
 	limitflows		= 0;
 	date_sorted		= 0;
+	stream_sort		= 0;
 	total_bytes		= 0;
 	total_flows		= 0;
 	skipped_blocks	= 0;
@@ -775,6 +827,10 @@ char 		Ident[IDENTLEN];
 	is_anonymized	= 0;
 	GuessDir		= 0;
 	nameserver		= NULL;
+	partial_file	= NULL;
+	merge_partials	= 0;
+	followdir		= NULL;
+	live			= NULL;
 
 	print_format    = NULL;
 	print_header 	= NULL;
@@ -787,16 +843,47 @@ char 		Ident[IDENTLEN];
 
 	Ident[0] = '\0';
 
-	while ((c = getopt(argc, argv, "6aA:Bbc:D:E:s:hn:i:jf:qyzr:v:w:J:K:M:NImO:R:XZt:TVv:x:l:L:o:H:")) != EOF) {
+	// keys a rollup needs to answer the query
+	InitStringlist(&rollup_keys, 16);
+	rollup_files	= 0;
+	use_rollup		= 1;
+
+	while ((c = getopt_long(argc, argv, "6aA:Bbc:D:E:s:hn:i:jf:qyz::r:v:w:J:K:M:NImO:R:XZt:TVv:x:l:L:o:H:", longopts, NULL)) != EOF) {
 		switch (c) {
 			case 'h':
 				usage(argv[0]);
 				exit(0);
 				break;
+			case OPT_PROFILE:
+#ifdef NFPROF_STAGES
+				profile_stages = 1;
+#else
+				LogError("Stage profiling is not compiled in. Run configure with --enable-stageprof\n");
+				exit(255);
+#endif
+				break;
+			case OPT_NOROLLUP:
+				use_rollup = 0;
+				break;
+			case OPT_PARTIAL:
+				partial_file = optarg;
+				break;
+			case OPT_MERGE:
+				merge_partials = 1;
+				use_rollup	   = 0;
+				break;
+			case OPT_FOLLOW:
+				followdir  = optarg;
+				use_rollup = 0;
+				break;
 			case 'a':
-				aggregate = 1;
+				aggregate  = 1;
+				use_rollup = 0;
 				break;
 			case 'A':
+				// ParseAggregateMask() tokenizes optarg
+				if ( !RollupAddAggregateKeys(&rollup_keys, optarg) )
+					use_rollup = 0;
 				if ( !ParseAggregateMask(optarg, &aggr_fmt ) ) {
 					exit(255);
 				}
@@ -810,7 +897,8 @@ char 		Ident[IDENTLEN];
 				}
 				bidir	  = 1;
 				// implies
-				aggregate = 1;
+				aggregate  = 1;
+				use_rollup = 0;
 				break;
 			case 'D':
 				nameserver = optarg;
@@ -854,7 +942,9 @@ char 		Ident[IDENTLEN];
 					LogError("Use one compression: -z for LZO, -j for BZ2 or -y for LZ4 compression\n");
 					exit(255);
 				}
-				compress = LZO_COMPRESSED;
+				compress = ParseCompression(optarg);
+				if ( compress < 0 )
+					exit(255);
 				break;
 			case 'c':	
 				limitflows = atoi(optarg);
@@ -865,6 +955,8 @@ char 		Ident[IDENTLEN];
 				break;
 			case 's':
 				stat_type = optarg;
+				if ( !RollupAddStatKeys(&rollup_keys, stat_type) )
+					use_rollup = 0;
                 if ( !SetStat(stat_type, &element_stat, &flow_stat) ) {
                     exit(255);
                 } 
@@ -926,7 +1018,7 @@ char 		Ident[IDENTLEN];
 					LogError("Unknown print order '%s'\n", print_order);
 					exit(255);
 				}
-				date_sorted = ret == 6;		// index into order_mode
+				date_sorted = strcasecmp(print_order, "tstart") == 0;
 				} break;
 			case 'R':
 				Rfile = optarg;
@@ -953,9 +1045,9 @@ char 		Ident[IDENTLEN];
 				}
 				break;
 			case 'J':
-				ModifyCompress = atoi(optarg);
-				if ( (ModifyCompress < 0) || (ModifyCompress > 3) ) {
-					LogError("Expected -J <num>, 0: uncompressed, 1: LZO, 2: BZ2, 3: LZ4 compressed.\n");
+				ModifyCompress = ParseCompression(optarg);
+				if ( ModifyCompress < 0 ) {
+					LogError("Expected -J <num>, 0: uncompressed, 1: LZO, 2: BZ2, 3: LZ4, 4: ZSTD compressed.\n");
 					exit(255);
 				}
 				break;
@@ -1029,13 +1121,37 @@ char 		Ident[IDENTLEN];
 		LogError("-M needs either -r or -R to specify the file or file list. Add '-R .' for all files in the directories.\n");
 		exit(255);
 	}
+	if ( followdir && (rfile || Rfile || Mdirs || merge_partials || print_stat) ) {
+		LogError("--follow reads the files of the collector. -r, -R, -M, -I or --merge-partials can not be applied\n");
+		exit(255);
+	}
 
 	extension_map_list = InitExtensionMaps(NEEDS_EXTENSION_LIST);
 	if ( !InitExporterList() ) {
 		exit(255);
 	}
 
-	SetupInputFileSequence(Mdirs, rfile, Rfile);
+	if ( followdir ) {
+		struct sigaction act;
+
+		live = AttachLiveIndex(followdir);
+		if ( !live ) 
+			exit(255);
+
+		// stop following and print the result on ^C
+		memset((void *)&act,0,sizeof(struct sigaction));
+		act.sa_handler = FollowHandler;
+		sigemptyset(&act.sa_mask);
+		act.sa_flags = 0;
+		sigaction(SIGTERM, &act, NULL);
+		sigaction(SIGINT, &act, NULL);
+	} else
+		SetupInputFileSequence(Mdirs, rfile, Rfile);
+
+	// answer unfiltered -s and -A queries over complete hours or days from rollup files
+	if ( use_rollup && Rfile && !tstring && !ffile && !print_stat && !flow_stat && !limitflows &&
+		 (element_stat || aggregate_mask) && (!filter || strcasecmp(filter, "any") == 0) ) 
+		rollup_files = RollupSelectFiles(GetInputFileList(), &rollup_keys);
 
 	if ( print_stat ) {
 		nffile_t *nffile;
@@ -1079,7 +1195,19 @@ char 		Ident[IDENTLEN];
 			print_format = DefaultMode;
 	}
 
-	if ( strncasecmp(print_format, "fmt:", 4) == 0 ) {
+	if ( strncasecmp(print_format, "jsonl:", 6) == 0 ) {
+		// JSON lines with user selected fields
+		char *format = &print_format[6];
+		if ( strlen(format) ) {
+			if ( !ParseJSONFormat(format, printmap) )
+				exit(255);
+			print_record  = format_jsonl;
+			user_format	  = 1;
+		} else {
+			LogError("Missing format description for JSON lines output format!\n");
+			exit(255);
+		}
+	} else if ( strncasecmp(print_format, "fmt:", 4) == 0 ) {
 		// special user defined output format
 		char *format = &print_format[4];
 		if ( strlen(format) ) {
@@ -1108,7 +1236,13 @@ char 		Ident[IDENTLEN];
 		i = 0;
 		while ( printmap[i].printmode ) {
 			if ( strncasecmp(print_format, printmap[i].printmode, MAXMODELEN) == 0 ) {
-				if ( printmap[i].Format ) {
+				if ( printmap[i].func == format_jsonl ) {
+					// predefined JSON lines format - no header line
+					if ( !ParseJSONFormat(printmap[i].Format, printmap) )
+						exit(255);
+					print_record  = printmap[i].func;
+					user_format	  = 1;
+				} else if ( printmap[i].Format ) {
 					if ( !ParseOutputFormat(printmap[i].Format, plain_numbers, printmap) )
 						exit(255);
 					// predefined custom format
@@ -1199,7 +1333,26 @@ char 		Ident[IDENTLEN];
 		exit(255);
 	}
 
-	if ((aggregate || flow_stat || print_order)  && !Init_FlowTable() )
+	if ( (partial_file || merge_partials) && !(element_stat || flow_stat || aggregate) ) {
+		LogError("Partial results need a -s or -A query\n");
+		exit(255);
+	}
+	if ( partial_file && wfile ) {
+		LogError("--partial and -w are mutually exclusive\n");
+		exit(255);
+	}
+	if ( merge_partials && (tstring || limitflows || strcasecmp(filter, "any") != 0) ) {
+		LogError("The partials are filtered already. -t, -c or a filter can not be applied to --merge-partials\n");
+		exit(255);
+	}
+
+	// time sorted flows without aggregation are merged from sorted runs
+	stream_sort = date_sorted && !aggregate;
+
+	if ((aggregate || flow_stat || (print_order && !stream_sort))  && !Init_FlowTable() )
+			exit(250);
+
+	if ( stream_sort && !Init_FlowSort() )
 			exit(250);
 
 	if (element_stat && !Init_StatTable(HashBits, NumPrealloc) )
@@ -1213,7 +1366,7 @@ char 		Ident[IDENTLEN];
 	}
 
 
-	if ( !(flow_stat || element_stat || wfile || quiet ) && record_header ) {
+	if ( !(flow_stat || element_stat || wfile || partial_file || quiet ) && record_header ) {
 		if ( user_format ) {
 			printf("%s\n", record_header);
 		} else {
@@ -1232,8 +1385,13 @@ char 		Ident[IDENTLEN];
 	}
 #endif
 
+#ifdef NFPROF_STAGES
+	if ( profile_stages ) 
+		nfprof_stages(1);
+#endif
 	nfprof_start(&profile_data);
-	sum_stat = process_data(wfile, element_stat, aggregate || flow_stat, print_order != NULL,
+	sum_stat = process_data(wfile, element_stat, aggregate || flow_stat, 
+						print_order ? (stream_sort ? SORT_STREAM : SORT_TABLE) : 0,
 						print_header, print_record, t_start, t_end, 
 						limitflows, do_tag, compress
 #ifdef HAVE_AVROEXPORT
@@ -1246,40 +1404,58 @@ char 		Ident[IDENTLEN];
 	if (avrofile != NULL) finish_avro_export();
 #endif
 
+	if ( live ) {
+		CloseLiveIndex(live);
+		live = NULL;
+		// time window of the matched flows
+		if ( sum_stat.last_seen ) {
+			t_first_flow = sum_stat.first_seen;
+			t_last_flow  = sum_stat.last_seen;
+		}
+	}
+
 	if ( total_bytes == 0 ) {
 		printf("No matched flows\n");
 		exit(0);
 	}
 
-	if (aggregate || print_order) {
+	if ( partial_file ) {
+		if ( !WritePartial(partial_file, &sum_stat, aggregate || flow_stat, element_stat, compress) ) {
+			LogError("Failed to write partial file '%s'\n", partial_file);
+			exit(255);
+		}
+	} else if (aggregate || print_order) {
 		if ( wfile ) {
 			nffile_t *nffile = OpenNewFile(wfile, NULL, compress, is_anonymized, NULL);
 			if ( !nffile ) 
 				exit(255);
-			if ( ExportFlowTable(nffile, aggregate, bidir, date_sorted, extension_map_list) ) {
+			if ( stream_sort ? ExportSortedFlows(nffile, extension_map_list) : 
+							   ExportFlowTable(nffile, aggregate, bidir, date_sorted, extension_map_list) ) {
 				CloseUpdateFile(nffile, Ident );	
 			} else {
 				CloseFile(nffile);
 				unlink(wfile);
 			}
 			DisposeFile(nffile);
+		} else if ( stream_sort ) {
+			PrintSortedFlows(print_record, topN, do_tag, GuessDir);
 		} else {
 			PrintFlowTable(print_record, topN, do_tag, GuessDir, extension_map_list);
 		}
 	}
 
-	if (flow_stat) {
+	if (flow_stat && !partial_file) {
 		PrintFlowStat(record_header, print_record, topN, do_tag, quiet, csv_output, extension_map_list);
 #ifdef DEVEL
 		printf("Loopcnt: %u\n", loopcnt);
 #endif
 	} 
 
-	if (element_stat) {
+	if (element_stat && !partial_file) {
 		PrintElementStat(&sum_stat, plain_numbers, record_header, print_record, topN, do_tag, quiet, pipe_output, csv_output);
 	} 
 
-	if ( !quiet ) {
+	if ( !quiet && !partial_file ) {
 		if ( csv_output ) {
 			PrintSummary(&sum_stat, plain_numbers, csv_output);
 		} else if ( !wfile ) {
@@ -1294,11 +1470,20 @@ char 		Ident[IDENTLEN];
 			}
 			printf("Total flows processed: %u, Blocks skipped: %u, Bytes read: %llu\n", 
 				total_flows, skipped_blocks, (unsigned long long)total_bytes);
+			if ( rollup_files ) 
+				printf("Rollup files replaced %u flow files\n", rollup_files);
 			nfprof_print(&profile_data, stdout);
 		}
 	}
 
+#ifdef NFPROF_STAGES
+	// the stage breakdown follows the summary - to stderr, if no summary is printed
+	if ( profile_stages ) 
+		nfprof_print_stages(quiet || csv_output || wfile ? stderr : stdout);
+#endif
+
 	Dispose_FlowTable();
+	Dispose_FlowSort();
 	Dispose_StatTable();
 	FreeExtensionMaps(extension_map_list);
 
@@ -179,6 +179,10 @@ int i;
 				(*c)->do_rescan = 1;		// file corrupt - rescan
 				break;
 			case STATFILE_OK:
+				if ( do_rescan == 0 && !CatalogExists((*c)->datadir) ) {
+					printf("Force rebuild to create file catalog in %s\n", (*c)->datadir);
+					(*c)->do_rescan = 1;
+				}
 				break;
 			case ERR_NOSTATFILE:	// first rescan bevore expire, if no file exists
 				if ( do_rescan == 0 ) {
@@ -56,9 +56,11 @@
 #include "nfx.h"
 #include "nfstat.h"
 #include "nflowcache.h"
+#include "nfsort.h"
 #include "exporter.h"
 
 #include "nfexport.h"
+#include "radixsort.h"
 
 #include "nfdump_inline.c"
 
@@ -66,7 +68,6 @@
 #include "nffile_inline.c"
 #undef NEED_PACKRECORD
 
-#include "heapsort_inline.c"
 #include "applybits_inline.c"
 
 /* global vars */
@@ -294,7 +295,7 @@ char				*string;
 		}
 
 		if ( c >= 2 )
- 			heapSort(SortList, c, 0);
+ 			SortElements(SortList, c, 0);
 
 		for ( i = 0; i < c; i++ ) {
 			master_record_t	*flow_record;
@@ -403,4 +404,42 @@ char				*string;
 
 } // End of ExportFlowTable
 
+int ExportSortedFlows(nffile_t *nffile, extension_map_list_t *extension_map_list) {
+SortRecord_t	*r;
+
+	ExportExtensionMaps(0, 0, nffile, extension_map_list);
+	ExportExporterList(nffile);
+
+	if ( !StartSortedFlows() )
+		return 0;
+
+	while ( (r = NextSortedFlow()) != NULL ) {
+		master_record_t	*flow_record;
+		extension_info_t *extension_info = r->map_info_ref;
+
+		flow_record = &(extension_info->master_record);
+		ExpandRecord_v2( &(r->flowrecord), extension_info, r->exp_ref, flow_record);
+		if ( flow_record->aggr_flows == 0 )
+			flow_record->aggr_flows = 1;
+
+		// switch to output extension map
+		flow_record->map_ref = extension_info->map;
+		flow_record->ext_map = extension_info->map->map_id;
+		PackRecord(flow_record, nffile);
+
+		// Update statistics
+		UpdateStat(nffile->stat_record, flow_record);
+	}
+
+    if ( nffile->block_header->NumRecords ) {
+        if ( WriteBlock(nffile) <= 0 ) {
+            LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
+			return 0;
+        } 
+    }
+
+	return 1;
+
+} // End of ExportSortedFlows
+
 
@@ -39,5 +39,7 @@
 
 int ExportFlowTable(nffile_t *nffile, int aggregate, int bidir, int date_sorted, extension_map_list_t *extension_map_list);
 
+int ExportSortedFlows(nffile_t *nffile, extension_map_list_t *extension_map_list);
+
 #endif //_NFEXPORT_H
 
@@ -50,6 +50,11 @@
 #include <stdlib.h>
 #include <bzlib.h>
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
 #endif
@@ -58,8 +63,10 @@
 #include "lz4.h"
 #include "nf_common.h"
 #include "nffile.h"
+#include "nflive.h"
 #include "flist.h"
 #include "util.h"
+#include "nfprof.h"
 
 /* global vars */
 
@@ -74,11 +81,30 @@ char 	*CurrentIdent;
 #define HEAP_ALLOC(var,size) \
     lzo_align_t __LZO_MMODEL var [ ((size) + (sizeof(lzo_align_t) - 1)) / sizeof(lzo_align_t) ]
 
-static HEAP_ALLOC(wrkmem,LZO1X_1_MEM_COMPRESS);
 static int lzo_initialized = 0;
 static int lz4_initialized = 0;
 static int bz2_initialized = 0;
 
+#ifdef HAVE_ZSTD
+// ZSTD params
+#define ZSTD_DICT_SIZE		(64*1024)			// size of trained dictionaries
+#define ZSTD_TRAIN_SAMPLE	4096				// sample size for dictionary training
+#define ZSTD_TRAIN_SIZE		(8*1024*1024)		// max. amount of sample data
+#define ZSTD_JOB_SIZE		(512*1024)			// job size for multi-threaded compression
+
+static int ZSTD_OpenFile(nffile_t *nffile);
+
+static int ZSTD_NewFile(nffile_t *nffile, int level);
+
+static void ZSTD_FreeDict(nffile_t *nffile);
+
+// dictionary for new ZSTD files, given by ParseCompression() or trained by ModifyCompressFile()
+static void		*zstd_dict		= NULL;
+static size_t	zstd_dict_size	= 0;
+static int		zstd_train		= 0;
+static int		zstd_workers	= 0;
+#endif
+
 static int LZO_initialize(void);
 
 static int LZ4_initialize(void);
@@ -182,6 +208,8 @@ unsigned char __LZO_MMODEL *out;
 lzo_uint in_len;
 lzo_uint out_len;
 int r;
+// wrkmem per call - multiple files may be compressed by different threads
+HEAP_ALLOC(wrkmem,LZO1X_1_MEM_COMPRESS);
 
 	in  = (unsigned char __LZO_MMODEL *)(nffile->buff_pool[0] + sizeof(data_block_header_t));	
 	out = (unsigned char __LZO_MMODEL *)(nffile->buff_pool[1] + sizeof(data_block_header_t));	
@@ -384,6 +412,419 @@ bz_stream bs;
 
 } // End of Uncompress_Block_BZ2
 
+#ifdef HAVE_ZSTD
+static void ZSTD_FreeDict(nffile_t *nffile) {
+
+	ZSTD_freeCDict(nffile->zstd_cdict);
+	ZSTD_freeDDict(nffile->zstd_ddict);
+	free(nffile->zstd_dict);
+	nffile->zstd_cdict	   = NULL;
+	nffile->zstd_ddict	   = NULL;
+	nffile->zstd_dict	   = NULL;
+	nffile->zstd_dict_size = 0;
+
+} // End of ZSTD_FreeDict
+
+static int ZSTD_SetDict(nffile_t *nffile, void *dict, size_t dict_size) {
+
+	ZSTD_FreeDict(nffile);
+	if ( dict_size == 0 )
+		return 1;
+
+	nffile->zstd_dict = malloc(dict_size);
+	if ( !nffile->zstd_dict ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+	memcpy(nffile->zstd_dict, dict, dict_size);
+	nffile->zstd_dict_size = dict_size;
+
+	return 1;
+
+} // End of ZSTD_SetDict
+
+// setup the compression context for the file and digest the dictionary, if any
+static int ZSTD_InitCompress(nffile_t *nffile) {
+size_t r;
+
+	if ( !nffile->zstd_cctx ) {
+		nffile->zstd_cctx = ZSTD_createCCtx();
+		if ( !nffile->zstd_cctx ) {
+			LogError("ZSTD_createCCtx() error in %s line %d\n", __FILE__, __LINE__);
+			return 0;
+		}
+	}
+	ZSTD_CCtx_reset(nffile->zstd_cctx, ZSTD_reset_session_and_parameters);
+
+	r = ZSTD_CCtx_setParameter(nffile->zstd_cctx, ZSTD_c_compressionLevel, nffile->compress_level);
+	if ( ZSTD_isError(r) ) {
+		LogError("ZSTD compression level %d: %s\n", nffile->compress_level, ZSTD_getErrorName(r));
+		return 0;
+	}
+
+	if ( zstd_workers > 1 ) {
+		// silently ignored, if libzstd is built without thread support
+		r = ZSTD_CCtx_setParameter(nffile->zstd_cctx, ZSTD_c_nbWorkers, zstd_workers);
+		if ( !ZSTD_isError(r) )
+			ZSTD_CCtx_setParameter(nffile->zstd_cctx, ZSTD_c_jobSize, ZSTD_JOB_SIZE);
+	}
+
+	if ( nffile->zstd_dict ) {
+		nffile->zstd_cdict = ZSTD_createCDict(nffile->zstd_dict, nffile->zstd_dict_size, nffile->compress_level);
+		if ( !nffile->zstd_cdict ) {
+			LogError("ZSTD_createCDict() error in %s line %d\n", __FILE__, __LINE__);
+			return 0;
+		}
+		ZSTD_CCtx_refCDict(nffile->zstd_cctx, nffile->zstd_cdict);
+	}
+
+	return 1;
+
+} // End of ZSTD_InitCompress
+
+// called by OpenNewFile() - the dictionary block is written after the stat record
+static int ZSTD_NewFile(nffile_t *nffile, int level) {
+
+	nffile->compress_level = level ? level : ZSTD_CLEVEL_DEFAULT;
+	if ( !ZSTD_SetDict(nffile, zstd_dict, zstd_dict_size) )
+		return 0;
+
+	if ( nffile->zstd_dict ) 
+		SetFlag(nffile->file_header->flags, FLAG_ZSTD_DICT);
+
+	return ZSTD_InitCompress(nffile);
+
+} // End of ZSTD_NewFile
+
+static int ZSTD_WriteDict(nffile_t *nffile) {
+data_block_header_t dict_header;
+
+	dict_header.NumRecords = 0;
+	dict_header.size	   = nffile->zstd_dict_size;
+	dict_header.id		   = ZSTD_DICT_BLOCK;
+	dict_header.flags	   = 0;
+
+	if ( write(nffile->fd, (void *)&dict_header, sizeof(data_block_header_t)) < sizeof(data_block_header_t) ||
+		 write(nffile->fd, nffile->zstd_dict, nffile->zstd_dict_size) < nffile->zstd_dict_size ) {
+		LogError("write() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	return 1;
+
+} // End of ZSTD_WriteDict
+
+// called by OpenFile() - read the dictionary block, if the file has one
+static int ZSTD_OpenFile(nffile_t *nffile) {
+data_block_header_t dict_header;
+ssize_t ret, done;
+
+	ZSTD_FreeDict(nffile);
+	if ( !nffile->zstd_dctx ) {
+		nffile->zstd_dctx = ZSTD_createDCtx();
+		if ( !nffile->zstd_dctx ) {
+			LogError("ZSTD_createDCtx() error in %s line %d\n", __FILE__, __LINE__);
+			return 0;
+		}
+	}
+
+	if ( (nffile->file_header->flags & FLAG_ZSTD_DICT) == 0 ) 
+		return 1;
+
+	ret = read(nffile->fd, (void *)&dict_header, sizeof(data_block_header_t));
+	if ( ret != sizeof(data_block_header_t) || dict_header.id != ZSTD_DICT_BLOCK || dict_header.size > ZSTD_MAX_DICT ) {
+		LogError("Corrupt data file: Missing ZSTD dictionary block\n");
+		return 0;
+	}
+
+	nffile->zstd_dict = malloc(dict_header.size);
+	if ( !nffile->zstd_dict ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	// loop for short reads from stdin
+	done = 0;
+	while ( done < dict_header.size ) {
+		ret = read(nffile->fd, nffile->zstd_dict + done, dict_header.size - done);
+		if ( ret <= 0 ) {
+			LogError("Corrupt data file: Unexpected EOF while reading ZSTD dictionary\n");
+			ZSTD_FreeDict(nffile);
+			return 0;
+		}
+		done += ret;
+	}
+	nffile->zstd_dict_size = dict_header.size;
+
+	nffile->zstd_ddict = ZSTD_createDDict(nffile->zstd_dict, nffile->zstd_dict_size);
+	if ( !nffile->zstd_ddict ) {
+		LogError("ZSTD_createDDict() error in %s line %d\n", __FILE__, __LINE__);
+		ZSTD_FreeDict(nffile);
+		return 0;
+	}
+
+	return 1;
+
+} // End of ZSTD_OpenFile
+
+static int Compress_Block_ZSTD(nffile_t *nffile) {
+
+	const void *in  = (const void *)(nffile->buff_pool[0] + sizeof(data_block_header_t));
+	void *out 		= (void *)(nffile->buff_pool[1] + sizeof(data_block_header_t));
+	size_t in_len 	= nffile->block_header->size;
+
+	size_t out_len = ZSTD_compress2(nffile->zstd_cctx, out, nffile->buff_size - sizeof(data_block_header_t), in, in_len);
+	if ( ZSTD_isError(out_len) ) {
+		LogError("Compress_Block_ZSTD() error compression failed in %s line %d: ZSTD : %s\n", __FILE__, __LINE__, ZSTD_getErrorName(out_len));
+		return -1;
+	}
+
+	// copy header
+	memcpy(nffile->buff_pool[1], nffile->buff_pool[0], sizeof(data_block_header_t));
+	((data_block_header_t *)nffile->buff_pool[1])->size = out_len;
+
+	// swap buffers
+	void *_tmp = nffile->buff_pool[1];
+	nffile->buff_pool[1] = nffile->buff_pool[0];
+	nffile->buff_pool[0] = _tmp;
+
+	nffile->block_header = nffile->buff_pool[0];
+
+	return 1;
+
+} // End of Compress_Block_ZSTD
+
+static int Uncompress_Block_ZSTD(nffile_t *nffile) {
+size_t out_len;
+
+	const void *in  = (const void *)(nffile->buff_pool[0] + sizeof(data_block_header_t));
+	void *out 		= (void *)(nffile->buff_pool[1] + sizeof(data_block_header_t));
+	size_t in_len 	= nffile->block_header->size;
+	size_t out_size	= nffile->buff_size - sizeof(data_block_header_t);
+
+	if ( nffile->zstd_ddict ) 
+		out_len = ZSTD_decompress_usingDDict(nffile->zstd_dctx, out, out_size, in, in_len, nffile->zstd_ddict);
+	else
+		out_len = ZSTD_decompressDCtx(nffile->zstd_dctx, out, out_size, in, in_len);
+
+	if ( ZSTD_isError(out_len) ) {
+		LogError("Uncompress_Block_ZSTD() error decompression failed in %s line %d: ZSTD : %s\n", __FILE__, __LINE__, ZSTD_getErrorName(out_len));
+		return -1;
+	}
+
+	// copy header
+	memcpy(nffile->buff_pool[1], nffile->buff_pool[0], sizeof(data_block_header_t));
+	((data_block_header_t *)nffile->buff_pool[1])->size = out_len;
+
+	// swap buffers
+	void *_tmp = nffile->buff_pool[1];
+	nffile->buff_pool[1] = nffile->buff_pool[0];
+	nffile->buff_pool[0] = _tmp;
+
+	nffile->block_header = nffile->buff_pool[0];
+	nffile->buff_ptr 	 = nffile->buff_pool[0] + sizeof(data_block_header_t);
+
+	return 1;
+
+} // End of Uncompress_Block_ZSTD
+
+/*
+ * Train a dictionary from the data blocks of nffile. The file position is restored
+ * afterwards, so the blocks can be read again for compression.
+ */
+static int ZSTD_TrainDict(nffile_t *nffile) {
+off_t	start;
+void	*samples;
+size_t	*sample_sizes, dict_size, sample_bytes;
+unsigned num_samples;
+int		i;
+
+	start = lseek(nffile->fd, 0, SEEK_CUR);
+	if ( start < 0 ) {
+		LogError("lseek() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	samples		 = malloc(ZSTD_TRAIN_SIZE);
+	sample_sizes = malloc((ZSTD_TRAIN_SIZE / ZSTD_TRAIN_SAMPLE + 1) * sizeof(size_t));
+	free(zstd_dict);
+	zstd_dict = malloc(ZSTD_DICT_SIZE);
+	zstd_dict_size = 0;
+	if ( !samples || !sample_sizes || !zstd_dict ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	// cut the blocks into samples, until the sample buffer is full
+	num_samples  = 0;
+	sample_bytes = 0;
+	for ( i=0; i < nffile->file_header->NumBlocks && sample_bytes < ZSTD_TRAIN_SIZE; i++ ) {
+		size_t offset, len;
+		if ( ReadBlock(nffile) < 0 ) 
+			break;
+		for ( offset = 0; offset < nffile->block_header->size && sample_bytes < ZSTD_TRAIN_SIZE; offset += len ) {
+			len = nffile->block_header->size - offset;
+			if ( len > ZSTD_TRAIN_SAMPLE )
+				len = ZSTD_TRAIN_SAMPLE;
+			if ( len > (ZSTD_TRAIN_SIZE - sample_bytes) )
+				len = ZSTD_TRAIN_SIZE - sample_bytes;
+			memcpy(samples + sample_bytes, nffile->buff_ptr + offset, len);
+			sample_sizes[num_samples++] = len;
+			sample_bytes += len;
+		}
+	}
+
+	if ( lseek(nffile->fd, start, SEEK_SET) < 0 ) {
+		LogError("lseek() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		free(samples);
+		free(sample_sizes);
+		return 0;
+	}
+
+	dict_size = ZDICT_trainFromBuffer(zstd_dict, ZSTD_DICT_SIZE, samples, sample_sizes, num_samples);
+	free(samples);
+	free(sample_sizes);
+
+	if ( ZDICT_isError(dict_size) ) {
+		// not enough data for training - compress without dictionary
+		LogInfo("ZSTD dictionary training skipped: %s", ZDICT_getErrorName(dict_size));
+		return 1;
+	}
+	zstd_dict_size = dict_size;
+
+	return 1;
+
+} // End of ZSTD_TrainDict
+
+// load a dictionary file - e.g. trained with 'zstd --train' from uncompressed flow files
+static int LoadDictionary(char *filename) {
+struct stat stat_buf;
+int fd;
+
+	if ( stat(filename, &stat_buf) ) {
+		LogError("Can't stat '%s': %s\n", filename, strerror(errno));
+		return 0;
+	}
+
+	if ( stat_buf.st_size == 0 || stat_buf.st_size > ZSTD_MAX_DICT ) {
+		LogError("Dictionary '%s': size must be between 1 and %d bytes\n", filename, ZSTD_MAX_DICT);
+		return 0;
+	}
+
+	zstd_dict = malloc(stat_buf.st_size);
+	if ( !zstd_dict ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	fd = open(filename, O_RDONLY);
+	if ( fd < 0 || read(fd, zstd_dict, stat_buf.st_size) != stat_buf.st_size ) {
+		LogError("Failed to read dictionary '%s': %s\n", filename, strerror(errno));
+		if ( fd >= 0 )
+			close(fd);
+		free(zstd_dict);
+		zstd_dict = NULL;
+		return 0;
+	}
+	close(fd);
+	zstd_dict_size = stat_buf.st_size;
+
+	return 1;
+
+} // End of LoadDictionary
+
+#endif
+
+/*
+ * Parse a compression argument. Accepts the method as number or name, e.g. for -J,
+ * followed by an optional level and a dictionary for ZSTD:
+ * none|lzo|bz2|lz4|zstd[:<level>[:<dictfile>|:train]]
+ * An empty argument selects LZO - the previous default of -z
+ * Returns the compress value for OpenNewFile() or -1 for an invalid argument.
+ */
+int ParseCompression(char *arg) {
+char *s, *level, *dict;
+int compress;
+
+	if ( arg == NULL )
+		return LZO_COMPRESSED;
+
+	// -z=<method>
+	if ( *arg == '=' )
+		arg++;
+
+	if ( *arg == '\0' )
+		return LZO_COMPRESSED;
+
+	s = strdup(arg);
+	if ( !s ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	dict  = NULL;
+	level = strchr(s, ':');
+	if ( level ) {
+		*level++ = '\0';
+		dict = strchr(level, ':');
+		if ( dict )
+			*dict++ = '\0';
+	}
+
+	if ( strcmp(s, "0") == 0 || strcasecmp(s, "none") == 0 ) 
+		compress = NOT_COMPRESSED;
+	else if ( strcmp(s, "1") == 0 || strcasecmp(s, "lzo") == 0 ) 
+		compress = LZO_COMPRESSED;
+	else if ( strcmp(s, "2") == 0 || strcasecmp(s, "bz2") == 0 ) 
+		compress = BZ2_COMPRESSED;
+	else if ( strcmp(s, "3") == 0 || strcasecmp(s, "lz4") == 0 ) 
+		compress = LZ4_COMPRESSED;
+	else if ( strcmp(s, "4") == 0 || strcasecmp(s, "zstd") == 0 ) 
+		compress = ZSTD_COMPRESSED;
+	else {
+		LogError("Unknown compression '%s'. Expected none, lzo, bz2, lz4 or zstd[:level[:dict]]\n", s);
+		free(s);
+		return -1;
+	}
+
+	if ( level && compress != ZSTD_COMPRESSED ) {
+		LogError("Compression level and dictionary are only supported for zstd\n");
+		free(s);
+		return -1;
+	}
+
+#ifndef HAVE_ZSTD
+	if ( compress == ZSTD_COMPRESSED ) {
+		LogError("ZSTD compression not available. Build nfdump with libzstd\n");
+		free(s);
+		return -1;
+	}
+#else
+	if ( level && *level ) {
+		int l = atoi(level);
+		if ( l < 1 || l > ZSTD_maxCLevel() ) {
+			LogError("ZSTD compression level must be between 1 and %d\n", ZSTD_maxCLevel());
+			free(s);
+			return -1;
+		}
+		compress = ZSTD_COMPRESS(l);
+	}
+
+	if ( dict && *dict ) {
+		if ( strcmp(dict, "train") == 0 ) {
+			zstd_train = 1;
+		} else if ( !LoadDictionary(dict) ) {
+			free(s);
+			return -1;
+		}
+	}
+#endif
+
+	free(s);
+	return compress;
+
+} // End of ParseCompression
+
 nffile_t *OpenFile(char *filename, nffile_t *nffile){
 struct stat stat_buf;
 int ret, allocated;
@@ -485,6 +926,19 @@ int ret, allocated;
 				return NULL;
 			}
 			break;
+		case ZSTD_COMPRESSED: 
+#ifdef HAVE_ZSTD
+			if ( ZSTD_OpenFile(nffile) ) 
+				break;
+#else
+			LogError("Open file '%s': ZSTD compression not available\n", filename ? filename : "<stdin>");
+#endif
+			CloseFile(nffile);
+			if ( allocated ) {
+				DisposeFile(nffile);
+				return NULL;
+			}
+			break;
 	}
 
 	return nffile;
@@ -671,6 +1125,15 @@ int i;
 		free(nffile->buff_pool[i]);
 	}
 
+#ifdef HAVE_ZSTD
+	ZSTD_FreeDict(nffile);
+	ZSTD_freeCCtx(nffile->zstd_cctx);
+	ZSTD_freeDCtx(nffile->zstd_dctx);
+#endif
+
+	CloseLiveIndex(nffile->live);
+	nffile->live = NULL;
+
 	return NULL;
 } // End of DisposeFile
 
@@ -678,7 +1141,7 @@ nffile_t *OpenNewFile(char *filename, nffile_t *nffile, int compress, int anonym
 size_t			len;
 int 			fd, flags;
 
-	switch (compress) {
+	switch (COMPRESSION_TYPE(compress)) {
 		case NOT_COMPRESSED:
 			flags = FLAG_NOT_COMPRESSED;
 			break;
@@ -703,6 +1166,11 @@ int 			fd, flags;
 				return NULL;
 			}
 			break;
+#ifdef HAVE_ZSTD
+		case ZSTD_COMPRESSED:
+			flags = FLAG_ZSTD_COMPRESSED;
+			break;
+#endif
 		default:
 			LogError("Unknown compression ID: %i\n", compress);
 			return NULL;
@@ -734,6 +1202,17 @@ int 			fd, flags;
 
 	nffile->file_header->flags 	   = flags;
 
+#ifdef HAVE_ZSTD
+	if ( flags & FLAG_ZSTD_COMPRESSED ) {
+		if ( !ZSTD_NewFile(nffile, COMPRESSION_LEVEL(compress)) ) {
+			LogError("Failed to initialize ZSTD compression");
+			close(nffile->fd);
+			nffile->fd = 0;
+			return NULL;
+		}
+	}
+#endif
+
 /*
 	XXX catalogs not yet implemented
 	if ( nffile->catalog && nffile->catalog->NumRecords ) {
@@ -771,6 +1250,14 @@ int 			fd, flags;
 		return NULL;
 	}
 
+#ifdef HAVE_ZSTD
+	if ( (nffile->file_header->flags & FLAG_ZSTD_DICT) && !ZSTD_WriteDict(nffile) ) {
+		close(nffile->fd);
+		nffile->fd = 0;
+		return NULL;
+	}
+#endif
+
 /* skip writing catalog in this test version
 	XXX catalogs not yet implemented
 	if ( WriteExtraBlock(nffile, (data_block_header_t *)nffile->catalog) < 0 ) {
@@ -780,6 +1267,10 @@ int 			fd, flags;
 	}
 */
 
+	// readers may open the file now
+	if ( nffile->live ) 
+		LiveIndexUpdate(nffile->live, nffile->fd);
+
 	return nffile;
 
 } /* End of OpenNewFile */
@@ -843,6 +1334,18 @@ nffile_t		*nffile;
 				return NULL;
 			}
 			break;
+#ifdef HAVE_ZSTD
+		case ZSTD_COMPRESSED: 
+			// the level is not stored in the file - continue with the default level
+			nffile->compress_level = ZSTD_CLEVEL_DEFAULT;
+			if ( !ZSTD_InitCompress(nffile) ) {
+				LogError("Failed to initialize ZSTD compression");
+				close(nffile->fd);
+				DisposeFile(nffile);
+				return NULL;
+			}
+			break;
+#endif
 	}
 
 	return nffile;
@@ -869,6 +1372,14 @@ void *p;
 		return 0;
 	}
 
+	// blocks compressed with a dictionary can not be moved into another file
+	if ( (compressed_to | compressed_from) & FLAG_ZSTD_DICT ) {
+		LogError("Can not append '%s' to '%s': ZSTD dictionary compressed file\n", from, to);
+		close(fd_from);
+		close(fd_to);
+		return 0;
+	}
+
 	// both files open - append data
 	ret = lseek(fd_to, 0, SEEK_END);
 	if ( ret < 0 ) {
@@ -995,6 +1506,8 @@ int fd, ret;
 		*compressed = FLAG_LZ4_COMPRESSED;
 	else if ( file_header.flags & FLAG_BZ2_COMPRESSED )
 		*compressed = FLAG_BZ2_COMPRESSED;
+	else if ( file_header.flags & FLAG_ZSTD_COMPRESSED )
+		*compressed = file_header.flags & (FLAG_ZSTD_COMPRESSED | FLAG_ZSTD_DICT);
 	else
 		*compressed = 0;
 
@@ -1049,12 +1562,15 @@ int CloseUpdateFile(nffile_t *nffile, char *ident) {
 
 } /* End of CloseUpdateFile */
 
-int ReadBlock(nffile_t *nffile) {
+/*
+ * Read the next data block of nffile into block: the block header followed by the data.
+ * The data is not uncompressed. block must hold BUFFSIZE + sizeof(data_block_header_t) bytes.
+ */
+int ReadRawBlock(nffile_t *nffile, data_block_header_t *block) {
 ssize_t ret, read_bytes, buff_bytes, request_size;
 void 	*read_ptr;
-uint32_t compression;
 
-	ret = read(nffile->fd, nffile->block_header, sizeof(data_block_header_t));
+	ret = read(nffile->fd, block, sizeof(data_block_header_t));
 	if ( ret == 0 )		// EOF
 		return NF_EOF;
 		
@@ -1072,57 +1588,18 @@ uint32_t compression;
 	read_bytes = ret;
 
 	// Check for sane buffer size
-	if ( nffile->block_header->size > BUFFSIZE ) {
+	if ( block->size > BUFFSIZE ) {
 		// this is most likely a corrupt file
-		LogError("Corrupt data file: Requested buffer size %u exceeds max. buffer size.\n", nffile->block_header->size);
-		return NF_CORRUPT;
-	}
-
-	compression = FILE_COMPRESSION(nffile);
-	ret = read(nffile->fd, nffile->buff_ptr, nffile->block_header->size);
-	if ( ret == nffile->block_header->size ) {
-		// we have the whole record and are done for now
-		switch (compression) {
-			case NOT_COMPRESSED:
-				break;
-			case LZO_COMPRESSED: 
-				if ( Uncompress_Block_LZO(nffile) < 0 ) 
-					return NF_CORRUPT;
-				break;
-			case LZ4_COMPRESSED: 
-				if ( Uncompress_Block_LZ4(nffile) < 0 ) 
-					return NF_CORRUPT;
-				break;
-			case BZ2_COMPRESSED: 
-				if ( Uncompress_Block_BZ2(nffile) < 0 )
-					return NF_CORRUPT;
-			break;
-		}
-		nffile->buff_ptr = (void *)((pointer_addr_t)nffile->block_header + sizeof(data_block_header_t));
-		return read_bytes + nffile->block_header->size;
-	} 
-			
-	if ( ret == 0 ) {
-		// EOF not expected here - this should never happen, file may be corrupt
-		LogError("ReadBlock() Corrupt data file: Unexpected EOF while reading data block.\n");
+		LogError("Corrupt data file: Requested buffer size %u exceeds max. buffer size.\n", block->size);
 		return NF_CORRUPT;
 	}
 
-	if ( ret == -1 ) {	// ERROR
-		LogError("read() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-		return NF_ERROR;
-	}
-
-	// Ups! - ret is != block_header->size
-	// this was a short read - most likely reading from the stdin pipe
-	// loop until we have requested size
-
-	buff_bytes 	 = ret;								// already in buffer
-	request_size = nffile->block_header->size - buff_bytes;	// still to go for this amount of data
-
-	read_ptr 	 = (void *)((pointer_addr_t)nffile->buff_ptr + buff_bytes);	
-	do {
-		ret = read(nffile->fd, read_ptr, request_size);
+	// loop until we have the requested size - short reads happen mostly on the stdin pipe
+	buff_bytes 	 = 0;
+	request_size = block->size;
+	read_ptr 	 = (void *)((pointer_addr_t)block + sizeof(data_block_header_t));
+	while ( request_size > 0 ) {
+		ret = read(nffile->fd, (void *)((pointer_addr_t)read_ptr + buff_bytes), request_size);
 		if ( ret < 0 ) {
 			// -1: Error - not expected
 			LogError("read() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
@@ -1130,21 +1607,22 @@ uint32_t compression;
 		}
 
 		if ( ret == 0 ) {
-			//  0: EOF   - not expected
-			LogError("read() corrupt data file: Unexpected EOF in %s line %d: %s\n", __FILE__, __LINE__);
+			// EOF not expected here - this should never happen, file may be corrupt
+			LogError("ReadBlock() Corrupt data file: Unexpected EOF while reading data block.\n");
 			return NF_CORRUPT;
-		} 
-		
+		}
+
 		buff_bytes 	 += ret;
-		request_size = nffile->block_header->size - buff_bytes;
+		request_size = block->size - buff_bytes;
+	}
 
-		if ( request_size > 0 ) {
-			// still a short read - continue in read loop
-			read_ptr = (void *)((pointer_addr_t)nffile->buff_ptr + buff_bytes);
-		}
-	} while ( request_size > 0 );
+	return read_bytes + block->size;
 
-	switch (compression) {
+} // End of ReadRawBlock
+
+static int Uncompress_Block(nffile_t *nffile) {
+
+	switch (FILE_COMPRESSION(nffile)) {
 		case NOT_COMPRESSED:
 			break;
 		case LZO_COMPRESSED: 
@@ -1158,23 +1636,22 @@ uint32_t compression;
 		case BZ2_COMPRESSED: 
 			if ( Uncompress_Block_BZ2(nffile) < 0 )
 				return NF_CORRUPT;
-		break;
+			break;
+#ifdef HAVE_ZSTD
+		case ZSTD_COMPRESSED: 
+			if ( Uncompress_Block_ZSTD(nffile) < 0 )
+				return NF_CORRUPT;
+			break;
+#endif
 	}
 
-	nffile->buff_ptr = (void *)((pointer_addr_t)nffile->block_header + sizeof(data_block_header_t));
-	return read_bytes + nffile->block_header->size;
+	return 1;
 
-} // End of ReadBlock
+} // End of Uncompress_Block
 
-int WriteBlock(nffile_t *nffile) {
-int ret, compression;
-
-	// empty blocks need not to be stored 
-	if ( nffile->block_header->size == 0 )
-		return 1;
+static int Compress_Block(nffile_t *nffile) {
 
-	compression = FILE_COMPRESSION(nffile);
-	switch (compression) {
+	switch (FILE_COMPRESSION(nffile)) {
 		case NOT_COMPRESSED:
 			break;
 		case LZO_COMPRESSED: 
@@ -1185,21 +1662,150 @@ int ret, compression;
 			break;
 		case BZ2_COMPRESSED:
 			if ( Compress_Block_BZ2(nffile) < 0 ) return -1;
-		break;
+			break;
+#ifdef HAVE_ZSTD
+		case ZSTD_COMPRESSED:
+			if ( Compress_Block_ZSTD(nffile) < 0 ) return -1;
+			break;
+#endif
 	}
 
+	return 1;
+
+} // End of Compress_Block
+
+int ReadBlock(nffile_t *nffile) {
+int ret, err;
+
+	PROF_START(PROF_READ, PROF_ALL);
+	ret = ReadRawBlock(nffile, nffile->block_header);
+	PROF_END(PROF_READ);
+	if ( ret <= 0 )
+		return ret;
+
+	// the header is included in the return value
+	ret -= nffile->block_header->size;
+	PROF_START(PROF_UNCOMPRESS, PROF_ALL);
+	err = Uncompress_Block(nffile);
+	PROF_END(PROF_UNCOMPRESS);
+	if ( err < 0 ) 
+		return NF_CORRUPT;
+
+	nffile->buff_ptr = (void *)((pointer_addr_t)nffile->block_header + sizeof(data_block_header_t));
+	return ret + nffile->block_header->size;
+
+} // End of ReadBlock
+
+int WriteBlock(nffile_t *nffile) {
+int ret;
+
+	// empty blocks need not to be stored 
+	if ( nffile->block_header->size == 0 )
+		return 1;
+
+	if ( Compress_Block(nffile) < 0 ) 
+		return -1;
+
 	ret = write(nffile->fd, (void *)nffile->block_header, sizeof(data_block_header_t) + nffile->block_header->size);
 	if (ret > 0) {
 		nffile->block_header->size = 0;
 		nffile->block_header->NumRecords = 0;
 		nffile->buff_ptr = (void *)((pointer_addr_t) nffile->block_header + sizeof (data_block_header_t));
 		nffile->file_header->NumBlocks++;
+		if ( nffile->live ) 
+			LiveIndexUpdate(nffile->live, nffile->fd);
 	}
  	
 	return ret;
 
 } // End of WriteBlock
 
+/*
+ * Append a data block, which is already compressed for nffile.
+ */
+int WriteRawBlock(nffile_t *nffile, data_block_header_t *block) {
+int ret;
+
+	if ( block->size == 0 )
+		return 1;
+
+	ret = write(nffile->fd, (void *)block, sizeof(data_block_header_t) + block->size);
+	if (ret > 0) 
+		nffile->file_header->NumBlocks++;
+ 	
+	return ret;
+
+} // End of WriteRawBlock
+
+/*
+ * A block codec holds the buffers and compression contexts to recode blocks
+ * with RecodeBlock(). Each thread needs its own codec. Dispose with DisposeFile()
+ */
+nffile_t *NewBlockCodec(void) {
+
+	return NewFile();
+
+} // End of NewBlockCodec
+
+/*
+ * Recode a raw data block read from nffile_r for nffile_w: The block is
+ * uncompressed as in nffile_r and compressed as in nffile_w. block must hold
+ * 2 * BUFFSIZE bytes. nffile_r and nffile_w are not modified, so multiple 
+ * threads may recode blocks of the same files with their own codec.
+ */
+int RecodeBlock(nffile_t *codec, nffile_t *nffile_r, nffile_t *nffile_w, data_block_header_t *block) {
+int ret;
+
+	memcpy(codec->buff_pool[0], (void *)block, sizeof(data_block_header_t) + block->size);
+	codec->block_header = codec->buff_pool[0];
+	codec->buff_ptr 	= (void *)((pointer_addr_t)codec->block_header + sizeof(data_block_header_t));
+
+	// uncompress as the input file
+	codec->file_header->flags = nffile_r->file_header->flags;
+#ifdef HAVE_ZSTD
+	if ( FILE_COMPRESSION(codec) == ZSTD_COMPRESSED && !codec->zstd_dctx ) {
+		codec->zstd_dctx = ZSTD_createDCtx();
+		if ( !codec->zstd_dctx ) {
+			LogError("ZSTD_createDCtx() error in %s line %d\n", __FILE__, __LINE__);
+			return NF_ERROR;
+		}
+	}
+	// the digested dictionaries are read only and may be shared
+	codec->zstd_ddict = nffile_r->zstd_ddict;
+#endif
+	ret = Uncompress_Block(codec);
+#ifdef HAVE_ZSTD
+	codec->zstd_ddict = NULL;
+#endif
+	if ( ret < 0 ) 
+		return NF_CORRUPT;
+
+	// compress as the output file
+	codec->file_header->flags = nffile_w->file_header->flags;
+#ifdef HAVE_ZSTD
+	if ( FILE_COMPRESSION(codec) == ZSTD_COMPRESSED ) {
+		if ( !codec->zstd_cctx ) {
+			codec->zstd_cctx = ZSTD_createCCtx();
+			if ( !codec->zstd_cctx ) {
+				LogError("ZSTD_createCCtx() error in %s line %d\n", __FILE__, __LINE__);
+				return NF_ERROR;
+			}
+		}
+		ZSTD_CCtx_reset(codec->zstd_cctx, ZSTD_reset_session_and_parameters);
+		ZSTD_CCtx_setParameter(codec->zstd_cctx, ZSTD_c_compressionLevel, nffile_w->compress_level);
+		if ( nffile_w->zstd_cdict ) 
+			ZSTD_CCtx_refCDict(codec->zstd_cctx, nffile_w->zstd_cdict);
+	}
+#endif
+	if ( Compress_Block(codec) < 0 ) 
+		return NF_ERROR;
+
+	memcpy((void *)block, codec->block_header, sizeof(data_block_header_t) + codec->block_header->size);
+
+	return 1;
+
+} // End of RecodeBlock
+
 inline void ExpandRecord_v1(common_record_t *input_record, master_record_t *output_record ) {
 uint32_t	*u;
 size_t		size;
@@ -1268,6 +1874,12 @@ char 			*filename, outfile[MAXPATHLEN];
 
 	SetupInputFileSequence(NULL, rfile, Rfile);
 
+#ifdef HAVE_ZSTD
+	// offline recompression - use all cores for ZSTD
+	if ( COMPRESSION_TYPE(compress) == ZSTD_COMPRESSED )
+		zstd_workers = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
 	nffile_r = NULL;
 	while (1) {
 		nffile_r = GetNextFile(nffile_r, 0, 0);
@@ -1282,8 +1894,9 @@ char 			*filename, outfile[MAXPATHLEN];
 			break;
 		}
 	
+		// ZSTD files may be recompressed with another level or dictionary
 		compression = FILE_COMPRESSION(nffile_r);
-		if ( compression == compress ) {
+		if ( compression == compress && compression != ZSTD_COMPRESSED ) {
 			printf("File %s is already same compression methode\n", filename);
 			continue;
 		}
@@ -1294,6 +1907,14 @@ char 			*filename, outfile[MAXPATHLEN];
 
 		anonymized = IP_ANONYMIZED(nffile_r);
 
+#ifdef HAVE_ZSTD
+		if ( zstd_train && !ZSTD_TrainDict(nffile_r) ) {
+			CloseFile(nffile_r);
+			DisposeFile(nffile_r);
+			break;
+		}
+#endif
+
 		// allocate output file
 		nffile_w = OpenNewFile(outfile, NULL, compress, anonymized, NULL);
 		if ( !nffile_w ) {
@@ -1381,6 +2002,7 @@ off_t	fsize;
 		FILE_IS_LZO_COMPRESSED (nffile) ? "lzo compressed" :
 		FILE_IS_LZ4_COMPRESSED (nffile) ? "lz4 compressed" :
 		FILE_IS_BZ2_COMPRESSED (nffile) ? "bz2 compressed" :
+		FILE_IS_ZSTD_COMPRESSED (nffile) ? "zstd compressed" :
             "not compressed");
 
 	printf("Blocks  : %u\n", nffile->file_header->NumBlocks);
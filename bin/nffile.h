@@ -89,6 +89,16 @@
 #define LZO_COMPRESSED 1
 #define BZ2_COMPRESSED 2
 #define LZ4_COMPRESSED 3
+#define ZSTD_COMPRESSED 4
+
+/*
+ * The compress argument of OpenNewFile() holds the compression method in the
+ * lower 8 bits and an optional compression level in the next 8 bits, which is
+ * used by ZSTD only. 0 selects the default level.
+ */
+#define COMPRESSION_TYPE(c)		((c) & 0xFF)
+#define COMPRESSION_LEVEL(c)	(((c) >> 8) & 0xFF)
+#define ZSTD_COMPRESS(level)	(ZSTD_COMPRESSED | ((level) << 8))
 
 typedef struct file_header_s {
 	uint16_t	magic;				// magic to recognize nfdump file type and endian type
@@ -105,14 +115,17 @@ typedef struct file_header_s {
 #define FLAG_CATALOG		0x4		// has a file catalog record after stat record
 #define FLAG_BZ2_COMPRESSED 0x8		// records are BZ2 compressed
 #define FLAG_LZ4_COMPRESSED 0x10	// records are LZ4 compressed
-#define COMPRESSION_MASK	0x19	// all compression bits
+#define FLAG_ZSTD_COMPRESSED 0x20	// records are ZSTD compressed
+#define FLAG_ZSTD_DICT		0x40	// ZSTD dictionary block follows the stat record
+#define COMPRESSION_MASK	0x39	// all compression bits
 // shortcuts
 
 #define FILE_IS_NOT_COMPRESSED(n) (((n)->file_header->flags & COMPRESSION_MASK) == 0)
 #define FILE_IS_LZO_COMPRESSED(n) ((n)->file_header->flags & FLAG_LZO_COMPRESSED)
 #define FILE_IS_BZ2_COMPRESSED(n) ((n)->file_header->flags & FLAG_BZ2_COMPRESSED)
 #define FILE_IS_LZ4_COMPRESSED(n) ((n)->file_header->flags & FLAG_LZ4_COMPRESSED)
-#define FILE_COMPRESSION(n) (FILE_IS_LZO_COMPRESSED(n) ? LZO_COMPRESSED : (FILE_IS_BZ2_COMPRESSED(n) ? BZ2_COMPRESSED : (FILE_IS_LZ4_COMPRESSED(n) ? LZ4_COMPRESSED : NOT_COMPRESSED)))
+#define FILE_IS_ZSTD_COMPRESSED(n) ((n)->file_header->flags & FLAG_ZSTD_COMPRESSED)
+#define FILE_COMPRESSION(n) (FILE_IS_LZO_COMPRESSED(n) ? LZO_COMPRESSED : (FILE_IS_BZ2_COMPRESSED(n) ? BZ2_COMPRESSED : (FILE_IS_LZ4_COMPRESSED(n) ? LZ4_COMPRESSED : (FILE_IS_ZSTD_COMPRESSED(n) ? ZSTD_COMPRESSED : NOT_COMPRESSED))))
 
 #define BLOCK_IS_COMPRESSED(n) ((n)->flags == 2 )
 #define IP_ANONYMIZED(n) ((n)->file_header->flags & FLAG_ANONYMIZED)
@@ -220,6 +233,20 @@ typedef struct L_record_header_s {
 
 #define CATALOG_BLOCK	4
 
+/*
+ *
+ * ZSTD dictionary block
+ * =====================
+ * Files flagged FLAG_ZSTD_DICT carry the ZSTD dictionary used to compress all data blocks right after
+ * the stat record. The block has a standard data block header with id ZSTD_DICT_BLOCK, NumRecords = 0
+ * and is followed by size bytes of the dictionary. The block is read by OpenFile() and not counted in
+ * NumBlocks of the file header.
+ *
+ */
+
+#define ZSTD_DICT_BLOCK	5
+#define ZSTD_MAX_DICT	(1024*1024)
+
 typedef struct catalog_s {
 	uint32_t	NumRecords;		// set to the number of catalog entries
 	uint32_t	size;			// sizeof(nffile_catalog_t) without this header (-12)
@@ -252,6 +279,14 @@ typedef struct nffile_s {
 	void				*buff_ptr;		// pointer into buffer for read/write blocks/records
 	stat_record_t 		*stat_record;	// flow stat record
 	int					fd;				// file descriptor
+	int					compress_level;	// ZSTD compression level
+	void				*zstd_cctx;		// ZSTD compression context
+	void				*zstd_dctx;		// ZSTD decompression context
+	void				*zstd_dict;		// ZSTD dictionary of this file
+	size_t				zstd_dict_size;
+	void				*zstd_cdict;	// digested dictionary for compression
+	void				*zstd_ddict;	// digested dictionary for decompression
+	struct nflive_s		*live;			// collector live index - publishes written blocks
 } nffile_t;
 
 /* 
@@ -291,6 +326,12 @@ typedef struct nffile_s {
 // requires moderate changes till 1.7
 #define CommonRecordType	10
 
+// partial results of -s stats - see nfstat.h
+#define StatTableRecordType		11
+#define StatElementRecordType	12
+// keys of the aggregated flows of a partial result - see nflowcache.h
+#define FlowTableRecordType		13
+
  /* 
  * All records are 32bit aligned and layouted in a 64bit array. The numbers placed in () refer to the netflow v9 type id.
  *
@@ -2200,10 +2241,20 @@ int ReadBlock(nffile_t *nffile);
 
 int WriteBlock(nffile_t *nffile);
 
+int ReadRawBlock(nffile_t *nffile, data_block_header_t *block);
+
+int WriteRawBlock(nffile_t *nffile, data_block_header_t *block);
+
+nffile_t *NewBlockCodec(void);
+
+int RecodeBlock(nffile_t *codec, nffile_t *nffile_r, nffile_t *nffile_w, data_block_header_t *block);
+
 int RenameAppend(char *from, char *to);
 
 void ModifyCompressFile(char * rfile, char *Rfile, int compress);
 
+int ParseCompression(char *arg);
+
 void ExpandRecord_v1(common_record_t *input_record,master_record_t *output_record );
 
 #ifdef COMPAT15
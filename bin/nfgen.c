@@ -48,7 +48,10 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/param.h>
+#include <sys/time.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -66,9 +69,51 @@
 #include "collector.h"
 #include "exporter.h"
 #include "netflow_v5_v7.h"
+#include "netflow_v9.h"
+#include "flist.h"
+#include "nfstatfile.h"
+#include "nfsynth.h"
+#include "sflow.h"
 
 extern extension_descriptor_t extension_descriptor[];
 
+#define MAXWORKERS 64
+
+// one output file of the synthetic mode
+typedef struct gen_slot_s {
+	time_t		when;				// time slot of the file
+	time_t		start;				// flows start within start .. start + duration
+	uint32_t	duration;
+	uint64_t	flows;
+	char		subfile[64];		// path relative to the data dir
+	char		filename[MAXPATHLEN];
+	int			error;
+} gen_slot_t;
+
+// flow sample of the crafted sFlow datagram of -F
+typedef struct sflow_sample_s {
+	int			af;
+	char		*src;
+	char		*dst;
+	uint8_t		proto;
+	uint16_t	sport;
+	uint16_t	dport;
+	int			ext;		// IPv6 extension headers
+	int			cut;		// bytes cut off the sampled header
+	int			socket4;	// add a socket4 element
+} sflow_sample_t;
+
+typedef struct gen_ctx_s {
+	synth_param_t	*param;
+	int				compress;
+	gen_slot_t		*slots;
+	uint32_t		num_slots;
+	uint32_t		next_slot;		// next slot to be processed by a worker
+	pthread_mutex_t	mutex;
+} gen_ctx_t;
+
+int verbose = 0;
+
 static time_t	when;
 uint32_t offset  = 10;
 uint32_t msecs   = 10;
@@ -92,6 +137,72 @@ static void SetBGPNextIPaddress(master_record_t *record, int af,  char *next_ip)
 
 static void UpdateRecord(master_record_t *record);
 
+static void usage(char *name);
+
+static int ParseProtoMix(synth_param_t *param, char *arg);
+
+static uint16_t *ParseExtensions(char *arg);
+
+static int WriteSlot(gen_ctx_t *ctx, synth_t *synth, gen_slot_t *slot);
+
+static void *GenWorker(void *arg);
+
+static int GenerateFiles(gen_ctx_t *ctx, int num_workers);
+
+static int GenerateTree(synth_param_t *param, uint64_t num_flows, char *datadir, 
+	uint32_t twin, int subdir_index, int compress, int num_workers);
+
+static int GenerateFile(synth_param_t *param, uint64_t num_flows, char *filename, int compress);
+
+static int SendPacket(int sockfd, struct sockaddr_storage *addr, int addrlen, send_peer_t *peer, 
+	int version, unsigned int delay);
+
+static int SendFlows(synth_param_t *param, uint64_t num_flows, char *host, char *port, 
+	int version, unsigned int delay);
+
+static int WritePcapPacket(FILE *fp, double t, uint32_t src, uint32_t dst, uint16_t sport, uint16_t dport, uint8_t flags);
+
+static int WritePcap(char *filename, uint32_t num_sessions);
+
+static uint8_t *Put32(uint8_t *p, uint32_t val);
+
+static uint8_t *PutSflowSample(uint8_t *p, uint32_t seq, const sflow_sample_t *s);
+
+static int SendSflow(char *host, char *port);
+
+static void usage(char *name) {
+		printf("usage %s [options] \n"
+					"Without options, a fixed set of test records is written to stdout.\n"
+					"-h\t\tthis text you see right here\n"
+					"-1\t\tPrepend an empty nfdump 1.5.x data block type 1 to the test records.\n"
+					"-n <num>\tGenerate <num> synthetic flows.\n"
+					"-i <num>\tNumber of distinct host addresses. Default 100000\n"
+					"-Z <exp>\tZipf exponent of the address distribution. Default 1.0\n"
+					"-6 <ratio>\tFraction of IPv6 flows 0.0 .. 1.0. Default 0.2\n"
+					"-P <mix>\tProtocol mix tcp:udp:icmp:other as relative weights e.g. 70:25:3:2\n"
+					"-m <num>\tNumber of different extension maps 1 .. %d. Default %d\n"
+					"-x <list>\tUse one extension map with the comma separated extension ids.\n"
+					"-e <num>\tNumber of exporters. Default 4\n"
+					"-s <seed>\tRandom seed. Default 1\n"
+					"-T <time>\tStart time of the flows yyyymmddhhmm. Default 201701010000\n"
+					"-D <sec>\tFlows are spread over <sec> seconds. Default 300\n"
+					"-w <file>\tWrite flows to file. '-' for stdout\n"
+					"-l <dir>\tWrite flows into nfcapd files in <dir>, rotated every -t seconds.\n"
+					"-t <sec>\tRotation interval of the files. Default 300\n"
+					"-S <num>\tSub directory layout - see nfcapd(1)\n"
+					"-z[=<method>]\tCompress files: lzo, bz2, lz4 or zstd[:level]\n"
+					"-y\t\tLZ4 compress files.\n"
+					"-j\t\tBZ2 compress files.\n"
+					"-W <num>\tUse <num> threads to write the files of -l. Default 1\n"
+					"-H <host>\tSend flows as netflow packets to <host>\n"
+					"-p <port>\tDestination port. Default 9995\n"
+					"-V <version>\tNetflow version of the packets: 9 or 10 for IPFIX. Default 9\n"
+					"-d <usec>\tDelay in usec between packets. Default 10\n"
+					"-c <file>\tWrite a pcap file of -n TCP sessions for nfpcapd. Default 100 sessions\n"
+					"-F\t\tSend one sFlow v5 datagram of crafted flow samples to <host> for sfcapd\n"
+					, name, SYNTH_MAX_MAPS, SYNTH_MAX_MAPS);
+} /* usage */
+
 static void SetIPaddress(master_record_t *record, int af,  char *src_ip, char *dst_ip) {
 
 	if ( af == PF_INET6 ) {
@@ -176,15 +287,835 @@ static void UpdateRecord(master_record_t *record) {
 
 } // End of UpdateRecord
 
+static int ParseProtoMix(synth_param_t *param, char *arg) {
+char *s, *p, *q;
+int i;
+
+	s = strdup(arg);
+	if ( !s ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	p = s;
+	for ( i=0; i < SYNTH_PROTO_CLASSES; i++ ) {
+		long weight;
+		q = strchr(p, ':');
+		if ( q )
+			*q = '\0';
+		weight = strtol(p, NULL, 10);
+		if ( weight < 0 || weight > 1000000 ) {
+			free(s);
+			return 0;
+		}
+		param->proto_mix[i] = weight;
+		if ( !q ) {
+			i++;
+			break;
+		}
+		p = q + 1;
+	}
+	free(s);
+
+	// missing classes get weight 0
+	for ( ; i < SYNTH_PROTO_CLASSES; i++ ) 
+		param->proto_mix[i] = 0;
+
+	return 1;
+
+} // End of ParseProtoMix
+
+static uint16_t *ParseExtensions(char *arg) {
+uint16_t *extensions;
+char *s, *p;
+int i;
+
+	extensions = (uint16_t *)calloc(SYNTH_MAX_EXTENSIONS + 1, sizeof(uint16_t));
+	s = strdup(arg);
+	if ( !extensions || !s ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	i = 0;
+	p = strtok(s, ",");
+	while ( p ) {
+		int id = atoi(p);
+		if ( i == SYNTH_MAX_EXTENSIONS || id <= 0 || id > 0xffff ) {
+			free(s);
+			free(extensions);
+			return NULL;
+		}
+		extensions[i++] = id;
+		p = strtok(NULL, ",");
+	}
+	free(s);
+
+	return extensions;
+
+} // End of ParseExtensions
+
+/*
+ * Write the flows of a time slot into slot->filename
+ */
+static int WriteSlot(gen_ctx_t *ctx, synth_t *synth, gen_slot_t *slot) {
+nffile_t *nffile;
+
+	nffile = OpenNewFile(slot->filename, NULL, ctx->compress, 0, NULL);
+	if ( !nffile ) 
+		return 0;
+
+	SynthAppendMaps(synth, nffile);
+	SynthWriteRecords(synth, nffile, slot->flows);
+	if ( nffile->block_header->NumRecords && WriteBlock(nffile) <= 0 ) {
+		LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
+		CloseUpdateFile(nffile, NULL);
+		DisposeFile(nffile);
+		return 0;
+	}
+
+	// an empty slot still covers its time window
+	if ( nffile->stat_record->numflows == 0 ) {
+		nffile->stat_record->first_seen = slot->start;
+		nffile->stat_record->last_seen	= slot->start + slot->duration;
+	}
+	CloseUpdateFile(nffile, NULL);
+	DisposeFile(nffile);
+
+	return 1;
+
+} // End of WriteSlot
+
+static void *GenWorker(void *arg) {
+gen_ctx_t *ctx = (gen_ctx_t *)arg;
+synth_t *synth;
+
+	synth = SynthInit(ctx->param);
+	if ( !synth ) 
+		exit(255);
+
+	while ( 1 ) {
+		gen_slot_t *slot;
+		uint32_t i;
+
+		pthread_mutex_lock(&ctx->mutex);
+		i = ctx->next_slot++;
+		pthread_mutex_unlock(&ctx->mutex);
+		if ( i >= ctx->num_slots ) 
+			break;
+
+		// each slot has its own seed - the output does not depend on the number of workers
+		slot = &ctx->slots[i];
+		SynthReset(synth, ctx->param->seed + i, slot->start, slot->duration);
+		slot->error = !WriteSlot(ctx, synth, slot);
+	}
+
+	SynthDispose(synth);
+
+	return NULL;
+
+} // End of GenWorker
+
+static int GenerateFiles(gen_ctx_t *ctx, int num_workers) {
+pthread_t tid[MAXWORKERS];
+int i, err;
+
+	if ( num_workers > (int)ctx->num_slots ) 
+		num_workers = ctx->num_slots;
+
+	pthread_mutex_init(&ctx->mutex, NULL);
+	ctx->next_slot = 0;
+
+	if ( num_workers <= 1 ) {
+		GenWorker((void *)ctx);
+	} else {
+		for ( i=0; i < num_workers; i++ ) {
+			err = pthread_create(&tid[i], NULL, GenWorker, (void *)ctx);
+			if ( err ) {
+				LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err) );
+				exit(255);
+			}
+		}
+		for ( i=0; i < num_workers; i++ ) 
+			pthread_join(tid[i], NULL);
+	}
+	pthread_mutex_destroy(&ctx->mutex);
+
+	for ( i=0; i < (int)ctx->num_slots; i++ ) {
+		if ( ctx->slots[i].error ) 
+			return 0;
+	}
+
+	return 1;
+
+} // End of GenerateFiles
+
+/*
+ * Generate an nfcapd style file tree in datadir: one file per time slot of twin seconds,
+ * named by the start of the slot and optionally stored in sub directories. The books of
+ * the data dir are updated, if it has a stat file.
+ */
+static int GenerateTree(synth_param_t *param, uint64_t num_flows, char *datadir, 
+	uint32_t twin, int subdir_index, int compress, int num_workers) {
+gen_ctx_t	ctx;
+dirstat_t	*dirstat;
+time_t		t_start, t_end, t;
+uint64_t	flows_done, total_size;
+uint32_t	i;
+int			ok;
+
+	if ( subdir_index && !InitHierPath(subdir_index) ) 
+		return 0;
+
+	memset((void *)&ctx, 0, sizeof(ctx));
+	ctx.param	 = param;
+	ctx.compress = compress;
+
+	t_start = param->start - (param->start % twin);
+	t_end	= param->start + param->duration;
+	ctx.num_slots = (t_end - t_start + twin - 1) / twin;
+	ctx.slots	  = (gen_slot_t *)calloc(ctx.num_slots, sizeof(gen_slot_t));
+	if ( !ctx.slots ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	// spread the flows over the slots proportional to the covered time
+	flows_done = 0;
+	for ( i=0, t = t_start; i < ctx.num_slots; i++, t += twin ) {
+		gen_slot_t *slot = &ctx.slots[i];
+		char fmt[16], *subdir, error[255];
+		struct tm *now;
+		int len;
+		uint64_t flows_until;
+		time_t end;
+
+		slot->when	   = t;
+		slot->start	   = t < param->start ? param->start : t;
+		end			   = t + twin > t_end ? t_end : t + twin;
+		slot->duration = end - slot->start;
+		flows_until	   = (uint64_t)((double)num_flows * (double)(end - param->start) / (double)param->duration);
+		if ( i == ctx.num_slots - 1 ) 
+			flows_until = num_flows;
+		slot->flows	= flows_until - flows_done;
+		flows_done	= flows_until;
+
+		now = localtime(&t);
+		strftime(fmt, sizeof fmt, "%Y%m%d%H%M", now);
+		subdir = subdir_index ? GetSubDir(now) : NULL;
+		if ( subdir ) {
+			if ( !SetupSubDir(datadir, subdir, error, 255) ) {
+				LogError("Failed to create sub hier directories: %s", error);
+				return 0;
+			}
+			len = snprintf(slot->subfile, sizeof(slot->subfile), "%s/nfcapd.%s", subdir, fmt);
+		} else {
+			len = snprintf(slot->subfile, sizeof(slot->subfile), "nfcapd.%s", fmt);
+		}
+		if ( len < 0 || len >= (int)sizeof(slot->subfile) ) {
+			LogError("Sub hier file name too long: %s/nfcapd.%s", subdir ? subdir : ".", fmt);
+			return 0;
+		}
+
+		// the files are written with a temporary name, skipped by nfdump, and renamed when complete
+		snprintf(slot->filename, MAXPATHLEN-1, "%s/%s.nfgen.%lu.%u", datadir, NF_DUMPFILE, (unsigned long)getpid(), i);
+		slot->filename[MAXPATHLEN-1] = '\0';
+	}
+
+	ok = GenerateFiles(&ctx, num_workers);
+
+	total_size = 0;
+	for ( i=0; i < ctx.num_slots; i++ ) {
+		gen_slot_t *slot = &ctx.slots[i];
+		char nfcapd_filename[MAXPATHLEN];
+		struct stat fstat;
+
+		if ( slot->error ) {
+			unlink(slot->filename);
+			continue;
+		}
+
+		snprintf(nfcapd_filename, MAXPATHLEN-1, "%s/%s", datadir, slot->subfile);
+		nfcapd_filename[MAXPATHLEN-1] = '\0';
+		if ( rename(slot->filename, nfcapd_filename) < 0 ) {
+			LogError("rename() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			unlink(slot->filename);
+			ok = 0;
+			continue;
+		}
+		stat(nfcapd_filename, &fstat);
+		total_size += 512 * fstat.st_blocks;
+		AppendCatalog(datadir, nfcapd_filename, slot->when, 512 * fstat.st_blocks);
+	}
+
+	// update the books of the data dir, if it has a stat file
+	if ( ReadStatInfo(datadir, &dirstat, LOCK_IF_EXISTS) == STATFILE_OK ) {
+		dirstat->filesize += total_size;
+		dirstat->numfiles += ctx.num_slots;
+		if ( dirstat->first == 0 || dirstat->first > (uint64_t)t_start ) 
+			dirstat->first = t_start;
+		if ( dirstat->last < (uint64_t)ctx.slots[ctx.num_slots-1].when ) 
+			dirstat->last = ctx.slots[ctx.num_slots-1].when;
+		WriteStatInfo(dirstat);
+		ReleaseStatInfo(dirstat);
+	}
+
+	free(ctx.slots);
+
+	return ok;
+
+} // End of GenerateTree
+
+static int GenerateFile(synth_param_t *param, uint64_t num_flows, char *filename, int compress) {
+gen_ctx_t	ctx;
+gen_slot_t	slot;
+
+	memset((void *)&ctx, 0, sizeof(ctx));
+	memset((void *)&slot, 0, sizeof(slot));
+	ctx.param	   = param;
+	ctx.compress   = compress;
+	ctx.slots	   = &slot;
+	ctx.num_slots  = 1;
+	slot.when	   = param->start;
+	slot.start	   = param->start;
+	slot.duration  = param->duration;
+	slot.flows	   = num_flows;
+	strncpy(slot.filename, filename, MAXPATHLEN-1);
+
+	return GenerateFiles(&ctx, 1);
+
+} // End of GenerateFile
+
+static int SendPacket(int sockfd, struct sockaddr_storage *addr, int addrlen, send_peer_t *peer, 
+	int version, unsigned int delay) {
+uint8_t ipfix_buff[UDP_PACKET_SIZE];
+void *packet;
+uint32_t len;
+
+	packet = peer->send_buffer;
+	len	   = (pointer_addr_t)peer->buff_ptr - (pointer_addr_t)peer->send_buffer;
+	if ( version == 10 ) {
+		len	   = SynthV9toIPFIX(peer->send_buffer, len, ipfix_buff);
+		packet = ipfix_buff;
+	}
+	peer->flush	   = 0;
+	peer->buff_ptr = peer->send_buffer;
+
+	if ( sendto(sockfd, packet, len, 0, (struct sockaddr *)addr, addrlen) < 0 ) {
+		LogError("sendto() failed: %s", strerror(errno));
+		return 0;
+	}
+	if ( delay ) 
+		usleep(delay);
+
+	return 1;
+
+} // End of SendPacket
+
+/*
+ * Encode the flows into netflow v9 or IPFIX packets and send them to host:port.
+ * The v9 encoder uses static data, therefore only one thread sends.
+ */
+static int SendFlows(synth_param_t *param, uint64_t num_flows, char *host, char *port, 
+	int version, unsigned int delay) {
+struct sockaddr_storage addr;
+master_record_t record;
+send_peer_t peer;
+synth_t *synth;
+uint64_t i, packets;
+int sockfd, addrlen, ok;
+
+	synth = SynthInit(param);
+	if ( !synth ) 
+		return 0;
+
+	sockfd = Unicast_send_socket(host, port, AF_UNSPEC, 0, &addr, &addrlen);
+	if ( sockfd <= 0 ) {
+		SynthDispose(synth);
+		return 0;
+	}
+
+	memset((void *)&peer, 0, sizeof(peer));
+	peer.send_buffer = malloc(UDP_PACKET_SIZE);
+	if ( !peer.send_buffer ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	peer.buff_ptr = peer.send_buffer;
+	peer.endp	  = (void *)((pointer_addr_t)peer.send_buffer + UDP_PACKET_SIZE - 1);
+	Init_v9_output(&peer);
+
+	ok		= 1;
+	packets = 0;
+	for ( i=0; i < num_flows && ok; i++ ) {
+		int again;
+
+		// the encoder modifies the record
+		memcpy((void *)&record, (void *)SynthNextRecord(synth), sizeof(master_record_t));
+		again = Add_v9_output_record(&record, &peer);
+		if ( peer.flush ) {
+			ok = SendPacket(sockfd, &addr, addrlen, &peer, version, delay);
+			packets++;
+		}
+		// the record did not fit into the sent packet
+		if ( again ) 
+			Add_v9_output_record(&record, &peer);
+	}
+	if ( ok && Flush_v9_output(&peer) ) {
+		ok = SendPacket(sockfd, &addr, addrlen, &peer, version, delay);
+		packets++;
+	}
+
+	close(sockfd);
+	free(peer.send_buffer);
+	SynthDispose(synth);
+
+	if ( ok ) 
+		fprintf(stderr, "Sent %llu flows in %llu packets\n", (unsigned long long)num_flows, (unsigned long long)packets);
+
+	return ok;
+
+} // End of SendFlows
+
+/*
+ * Packets of the pcap file of nfpcapd tests. Each session starts with a handshake. 
+ * The client sends data for 8s, the server answers again after 10.5s. With short 
+ * -e timeouts, e.g. 10,10, the client flow expires while the server flow is still active.
+ * All sessions start within 0.5s, so the packets are written in time order, if the
+ * offsets are at least 0.5s apart.
+ */
+static const struct session_packet_s {
+	double	offset;		// time relative to the start of the session
+	int		server;		// packet sent by the server
+	uint8_t	flags;		// tcp flags
+} session_packets[] = {
+	{  0.0, 0, 0x02 },	// SYN
+	{  1.0, 1, 0x12 },	// SYN ACK
+	{  2.0, 0, 0x10 },	// ACK
+	{  4.0, 0, 0x18 },
+	{  6.0, 0, 0x18 },
+	{  8.0, 0, 0x18 },
+	{ 10.5, 1, 0x18 },
+	{ 12.0, 0, 0x11 },	// FIN
+	{ 13.0, 1, 0x11 },
+	{ -1.0, 0, 0x00 }
+};
+
+static int WritePcapPacket(FILE *fp, double t, uint32_t src, uint32_t dst, uint16_t sport, uint16_t dport, uint8_t flags) {
+struct {
+	uint32_t	ts_sec;
+	uint32_t	ts_usec;
+	uint32_t	caplen;
+	uint32_t	len;
+	uint8_t		data[14 + 20 + 20 + 64];
+} packet;
+uint8_t *ip  = packet.data + 14;
+uint8_t *tcp = ip + 20;
+uint16_t *p16;
+uint32_t *p32;
+
+	memset((void *)&packet, 0, sizeof(packet));
+	packet.ts_sec  = (uint32_t)t;
+	packet.ts_usec = (uint32_t)((t - (double)packet.ts_sec) * 1000000.0);
+	packet.caplen  = sizeof(packet.data);
+	packet.len	   = sizeof(packet.data);
+
+	// ethernet: zero MAC addresses, type IPv4
+	packet.data[12] = 0x08;
+
+	ip[0] = 0x45;
+	p16 = (uint16_t *)(ip + 2);
+	*p16 = htons(sizeof(packet.data) - 14);
+	ip[8] = 64;
+	ip[9] = IPPROTO_TCP;
+	p32 = (uint32_t *)(ip + 12);
+	p32[0] = htonl(src);
+	p32[1] = htonl(dst);
+
+	p16 = (uint16_t *)tcp;
+	p16[0] = htons(sport);
+	p16[1] = htons(dport);
+	tcp[12] = 5 << 4;
+	tcp[13] = flags;
+	p16[7] = htons(65535);
+
+	// the struct may be padded at the end
+	return fwrite((void *)&packet, 4 * sizeof(uint32_t) + sizeof(packet.data), 1, fp) == 1;
+
+} // End of WritePcapPacket
+
+static int WritePcap(char *filename, uint32_t num_sessions) {
+struct {
+	uint32_t	magic;
+	uint16_t	version_major;
+	uint16_t	version_minor;
+	int32_t		thiszone;
+	uint32_t	sigfigs;
+	uint32_t	snaplen;
+	uint32_t	linktype;
+} header = { 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1 };
+FILE *fp;
+double t0;
+uint32_t i;
+int j, ok;
+
+	fp = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "w");
+	if ( !fp ) {
+		LogError("fopen() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	ok = fwrite((void *)&header, sizeof(header), 1, fp) == 1;
+
+	// the sessions start in the middle of a 5min slot
+	t0 = (double)ISO2UNIX(strdup("201901010002"));
+	for ( j=0; ok && session_packets[j].offset >= 0.0; j++ ) {
+		const struct session_packet_s *p = &session_packets[j];
+		for ( i=0; ok && i<num_sessions; i++ ) {
+			double t = t0 + (0.5 * i) / num_sessions + p->offset;
+			uint32_t client = 0x0a000000 + i;
+			uint32_t server = 0xc0a80001 + (i % 16);
+			uint16_t cport  = 1024 + i % 60000;
+			if ( p->server ) 
+				ok = WritePcapPacket(fp, t, server, client, 80, cport, p->flags);
+			else
+				ok = WritePcapPacket(fp, t, client, server, cport, 80, p->flags);
+		}
+	}
+
+	if ( fp != stdout && fclose(fp) != 0 ) 
+		ok = 0;
+	if ( !ok ) 
+		LogError("Failed to write pcap file '%s': %s", filename, strerror(errno));
+
+	return ok;
+
+} // End of WritePcap
+
+/*
+ * Flow samples of the sfcapd tests. The sampled headers are ethernet frames with
+ * the layer 4 header behind <ext> IPv6 extension headers - hop-by-hop first, then
+ * fragment. cut bytes are cut off the end of the header, to truncate the sample.
+ */
+static const sflow_sample_t sflow_samples[] = {
+	{ AF_INET6, "2001:db8::1", "2001:db8::2", IPPROTO_TCP, 1111, 2222, 2,  0, 0 },
+	{ AF_INET,  "10.47.0.1",   "10.47.0.2",   IPPROTO_TCP, 3333, 4444, 0, 12, 0 },	// ports only
+	{ AF_INET6, "2001:db8::3", "2001:db8::4", IPPROTO_TCP, 5555, 6666, 1, 12, 0 },	// ports only
+	{ AF_INET6, "2001:db8::5", "2001:db8::6", IPPROTO_TCP, 7777, 8888, 1, 24, 0 },	// in the hop-by-hop header
+	{ AF_INET6, "2001:db8::7", "2001:db8::8", IPPROTO_UDP,   53,   53, 0,  0, 1 },
+	{ 0, NULL, NULL, 0, 0, 0, 0, 0, 0 }
+};
+
+static uint8_t *Put32(uint8_t *p, uint32_t val) {
+
+	val = htonl(val);
+	memcpy((void *)p, (void *)&val, 4);
+	return p + 4;
+
+} // End of Put32
+
+static uint8_t *PutSflowSample(uint8_t *p, uint32_t seq, const sflow_sample_t *s) {
+uint8_t header[14 + 40 + 16 + 20];
+uint8_t *h, *ip, *sample_len;
+uint32_t len, l4_len, header_len;
+int i;
+
+	memset((void *)header, 0, sizeof(header));
+	l4_len = s->proto == IPPROTO_TCP ? 20 : 8;
+
+	// ethernet: zero MAC addresses
+	h = header + 12;
+	*h++ = s->af == AF_INET6 ? 0x86 : 0x08;
+	*h++ = s->af == AF_INET6 ? 0xdd : 0x00;
+	ip = h;
+	if ( s->af == AF_INET6 ) {
+		len = 8 * s->ext + l4_len;
+		ip[0] = 0x60;
+		ip[4] = len >> 8;
+		ip[5] = len & 0xff;
+		ip[6] = s->ext ? 0 : s->proto;
+		ip[7] = 64;
+		inet_pton(AF_INET6, s->src, ip + 8);
+		inet_pton(AF_INET6, s->dst, ip + 24);
+		h = ip + 40;
+		for ( i=0; i<s->ext; i++ ) {
+			h[0] = i + 1 < s->ext ? 44 : s->proto;
+			h += 8;
+		}
+	} else {
+		len = 20 + l4_len;
+		ip[0] = 0x45;
+		ip[2] = len >> 8;
+		ip[3] = len & 0xff;
+		ip[8] = 64;
+		ip[9] = s->proto;
+		inet_pton(AF_INET, s->src, ip + 12);
+		inet_pton(AF_INET, s->dst, ip + 16);
+		h = ip + 20;
+	}
+	h[0] = s->sport >> 8;
+	h[1] = s->sport & 0xff;
+	h[2] = s->dport >> 8;
+	h[3] = s->dport & 0xff;
+	if ( s->proto == IPPROTO_TCP ) {
+		h[12] = 5 << 4;
+		h[13] = 0x02;	// SYN
+	} else {
+		h[5] = 8;
+	}
+	h += l4_len;
+	header_len = (h - header) - s->cut;
+
+	// flow sample
+	p = Put32(p, SFLFLOW_SAMPLE);
+	sample_len = p;
+	p += 4;
+	p = Put32(p, seq);
+	p = Put32(p, 1);				// source id class 0, index 1
+	p = Put32(p, 1);				// sampling rate
+	p = Put32(p, seq);				// sample pool
+	p = Put32(p, 0);				// drops
+	p = Put32(p, 1);				// input interface
+	p = Put32(p, 2);				// output interface
+	p = Put32(p, s->socket4 ? 2 : 1);
+
+	// sampled header element - padded to 4 bytes
+	p = Put32(p, SFLFLOW_HEADER);
+	p = Put32(p, 16 + ((header_len + 3) & ~3));
+	p = Put32(p, SFLHEADER_ETHERNET_ISO8023);
+	p = Put32(p, (h - header) + 4);	// frame length incl. FCS
+	p = Put32(p, 4);				// stripped FCS
+	p = Put32(p, header_len);
+	memset((void *)p, 0, (header_len + 3) & ~3);
+	memcpy((void *)p, (void *)header, header_len);
+	p += (header_len + 3) & ~3;
+
+	if ( s->socket4 ) {
+		uint32_t addr;
+		p = Put32(p, SFLFLOW_EX_SOCKET4);
+		p = Put32(p, 20);
+		p = Put32(p, s->proto);
+		inet_pton(AF_INET, "10.47.1.1", &addr);
+		memcpy((void *)p, (void *)&addr, 4);
+		inet_pton(AF_INET, "10.47.1.2", &addr);
+		memcpy((void *)(p + 4), (void *)&addr, 4);
+		p += 8;
+		p = Put32(p, s->sport);
+		p = Put32(p, s->dport);
+	}
+	Put32(sample_len, p - sample_len - 4);
+
+	return p;
+
+} // End of PutSflowSample
+
+/*
+ * Send one sFlow v5 datagram with the flow samples of sflow_samples to host:port
+ */
+static int SendSflow(char *host, char *port) {
+struct sockaddr_storage addr;
+uint8_t datagram[1500], *p, *num_samples;
+uint32_t i, agent;
+int sockfd, addrlen, ok;
+
+	p = Put32(datagram, 5);
+	p = Put32(p, SFLADDRESSTYPE_IP_V4);
+	inet_pton(AF_INET, "127.0.0.1", &agent);
+	memcpy((void *)p, (void *)&agent, 4);
+	p += 4;
+	p = Put32(p, 0);				// agent sub id
+	p = Put32(p, 1);				// sequence number
+	p = Put32(p, 1000);				// uptime
+	num_samples = p;
+	p += 4;
+	for ( i=0; sflow_samples[i].af; i++ ) 
+		p = PutSflowSample(p, i + 1, &sflow_samples[i]);
+	Put32(num_samples, i);
+
+	sockfd = Unicast_send_socket(host, port, AF_UNSPEC, 0, &addr, &addrlen);
+	if ( sockfd <= 0 ) 
+		return 0;
+
+	ok = sendto(sockfd, datagram, p - datagram, 0, (struct sockaddr *)&addr, addrlen) >= 0;
+	if ( !ok ) 
+		LogError("sendto() failed: %s", strerror(errno));
+	close(sockfd);
+
+	return ok;
+
+} // End of SendSflow
+
 int main( int argc, char **argv ) {
 int i, c;
 master_record_t		record;
 nffile_t			*nffile;
-
-	when = ISO2UNIX(strdup("200407111030"));
-	while ((c = getopt(argc, argv, "h")) != EOF) {
+synth_param_t		param;
+uint64_t			num_flows;
+char				*wfile, *datadir, *host, *port, *pcapfile;
+int					synthetic, compress, subdir_index, num_workers, version, v1_block, sflow;
+unsigned int		delay;
+uint32_t			twin;
+
+	SynthDefaults(&param);
+	num_flows	 = 100000;
+	wfile		 = NULL;
+	datadir		 = NULL;
+	host		 = NULL;
+	port		 = "9995";
+	synthetic	 = 0;
+	compress	 = NOT_COMPRESSED;
+	subdir_index = 0;
+	num_workers	 = 1;
+	version		 = 9;
+	delay		 = 10;
+	twin		 = 300;
+	v1_block	 = 0;
+	pcapfile	 = NULL;
+	sflow		 = 0;
+	while ((c = getopt(argc, argv, "1hn:i:Z:6:P:m:x:e:s:T:D:w:l:t:S:z::yjW:H:p:V:d:c:F")) != EOF) {
 		switch(c) {
 			case 'h':
+				usage(argv[0]);
+				exit(0);
+				break;
+			case '1':
+				v1_block = 1;
+				break;
+			case 'n':
+				num_flows = strtoull(optarg, NULL, 10);
+				synthetic = 1;
+				break;
+			case 'i':
+				param.num_ips = strtoul(optarg, NULL, 10);
+				synthetic = 1;
+				break;
+			case 'Z':
+				param.zipf = atof(optarg);
+				synthetic = 1;
+				break;
+			case '6':
+				param.v6_ratio = atof(optarg);
+				if ( param.v6_ratio < 0.0 || param.v6_ratio > 1.0 ) {
+					LogError("IPv6 ratio must be 0.0 .. 1.0");
+					exit(255);
+				}
+				synthetic = 1;
+				break;
+			case 'P':
+				if ( !ParseProtoMix(&param, optarg) ) {
+					LogError("Invalid protocol mix: %s", optarg);
+					exit(255);
+				}
+				synthetic = 1;
+				break;
+			case 'm':
+				param.num_maps = atoi(optarg);
+				if ( param.num_maps < 1 || param.num_maps > SYNTH_MAX_MAPS ) {
+					LogError("Number of extension maps must be 1 .. %d", SYNTH_MAX_MAPS);
+					exit(255);
+				}
+				synthetic = 1;
+				break;
+			case 'x':
+				param.extensions = ParseExtensions(optarg);
+				if ( !param.extensions ) {
+					LogError("Invalid extension list: %s", optarg);
+					exit(255);
+				}
+				synthetic = 1;
+				break;
+			case 'e':
+				param.num_exporters = atoi(optarg);
+				synthetic = 1;
+				break;
+			case 's':
+				param.seed = strtoul(optarg, NULL, 10);
+				synthetic = 1;
+				break;
+			case 'T':
+				param.start = ISO2UNIX(optarg);
+				if ( param.start == 0 ) 
+					exit(255);
+				synthetic = 1;
+				break;
+			case 'D':
+				param.duration = atoi(optarg);
+				if ( param.duration == 0 ) {
+					LogError("Duration must be > 0");
+					exit(255);
+				}
+				synthetic = 1;
+				break;
+			case 'w':
+				wfile = optarg;
+				synthetic = 1;
+				break;
+			case 'l':
+				datadir = optarg;
+				synthetic = 1;
+				break;
+			case 't':
+				twin = atoi(optarg);
+				if ( twin < 2 ) {
+					LogError("time interval <= 2s not allowed");
+					exit(255);
+				}
+				break;
+			case 'S':
+				subdir_index = atoi(optarg);
+				break;
+			case 'j':
+				if ( compress ) {
+					LogError("Use one compression: -z for LZO, -j for BZ2 or -y for LZ4 compression\n");
+					exit(255);
+				}
+				compress = BZ2_COMPRESSED;
+				break;
+			case 'y':
+				if ( compress ) {
+					LogError("Use one compression: -z for LZO, -j for BZ2 or -y for LZ4 compression\n");
+					exit(255);
+				}
+				compress = LZ4_COMPRESSED;
+				break;
+			case 'z':
+				if ( compress ) {
+					LogError("Use one compression: -z for LZO, -j for BZ2 or -y for LZ4 compression\n");
+					exit(255);
+				}
+				compress = ParseCompression(optarg);
+				if ( compress < 0 )
+					exit(255);
+				break;
+			case 'W':
+				num_workers = atoi(optarg);
+				if ( num_workers < 1 || num_workers > MAXWORKERS ) {
+					LogError("Number of threads must be 1 .. %d", MAXWORKERS);
+					exit(255);
+				}
+				break;
+			case 'H':
+				host = optarg;
+				synthetic = 1;
+				break;
+			case 'p':
+				port = optarg;
+				break;
+			case 'V':
+				version = atoi(optarg);
+				if ( version != 9 && version != 10 ) {
+					LogError("Netflow version must be 9 or 10");
+					exit(255);
+				}
+				break;
+			case 'd':
+				delay = atoi(optarg);
+				break;
+			case 'c':
+				pcapfile = optarg;
+				break;
+			case 'F':
+				sflow = 1;
 				break;
 			default:
 				fprintf(stderr, "ERROR: Unsupported option: '%c'\n", c);
@@ -192,6 +1123,34 @@ nffile_t			*nffile;
 		}
 	}
 
+	if ( pcapfile ) 
+		exit(WritePcap(pcapfile, synthetic ? num_flows : 100) ? 0 : 255);
+
+	if ( sflow ) {
+		if ( !host ) {
+			LogError("Expect -H <host> for -F");
+			exit(255);
+		}
+		exit(SendSflow(host, port) ? 0 : 255);
+	}
+
+	if ( synthetic ) {
+		int ok;
+		if ( (wfile != NULL) + (datadir != NULL) + (host != NULL) > 1 ) {
+			LogError("Use one output: -w, -l or -H");
+			exit(255);
+		}
+		if ( datadir ) 
+			ok = GenerateTree(&param, num_flows, datadir, twin, subdir_index, compress, num_workers);
+		else if ( host ) 
+			ok = SendFlows(&param, num_flows, host, port, version, delay);
+		else 
+			ok = GenerateFile(&param, num_flows, wfile ? wfile : "-", compress);
+		exit(ok ? 0 : 255);
+	}
+
+	when = ISO2UNIX(strdup("200407111030"));
+
 	extension_info.map = (extension_map_t *)malloc(sizeof(extension_map_t) + 32 * sizeof(uint16_t));
 	if ( !extension_info.map ) {
 		fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror (errno));
@@ -237,6 +1196,21 @@ nffile_t			*nffile;
 		exit(255);
 	}
 
+	if ( v1_block ) {
+		// readers must skip or convert this block and continue with the next one
+		struct {
+			data_block_header_t	header;
+			uint32_t			data;
+		} v1;
+		memset((void *)&v1, 0, sizeof(v1));
+		v1.header.id   = DATA_BLOCK_TYPE_1;
+		v1.header.size = sizeof(uint32_t);
+		if ( WriteRawBlock(nffile, &v1.header) <= 0 ) {
+			LogError("Failed to write output buffer: '%s'" , strerror(errno));
+			exit(255);
+		}
+	}
+
 	AppendToBuffer(nffile, (void *)extension_info.map, extension_info.map->size);
 	
 	record.map_ref = extension_info.map;
@@ -0,0 +1,402 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "util.h"
+#include "nffile.h"
+#include "nflive.h"
+
+// reader poll interval in micro seconds
+#define LIVE_POLL	100000
+
+static volatile sig_atomic_t LiveStop = 0;
+
+/* function prototypes */
+static nflive_t *MapLiveIndex(char *datadir, int writable);
+
+static int LiveHistory(nflive_t *live, uint64_t sequence, char *name);
+
+static int OpenLiveCurrent(nflive_t *live, char *path, nffile_t **nffile);
+
+static nflive_t *MapLiveIndex(char *datadir, int writable) {
+nflive_t *live;
+struct stat stat_buf;
+char path[MAXPATHLEN];
+void *p;
+int fd;
+
+	snprintf(path, MAXPATHLEN-1, "%s/%s", datadir, live_filename);
+	path[MAXPATHLEN-1] = '\0';
+
+	if ( writable ) {
+		fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	} else {
+		fd = open(path, O_RDONLY);
+	}
+	if ( fd < 0 ) {
+		if ( !writable && errno == ENOENT ) 
+			LogError("No live index in '%s'. Run the collector with -L\n", datadir);
+		else
+			LogError("open() error for '%s': %s", path, strerror(errno));
+		return NULL;
+	}
+
+	if ( fstat(fd, &stat_buf) ) {
+		LogError("fstat() error for '%s': %s", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if ( stat_buf.st_size != sizeof(nflive_index_t) ) {
+		if ( !writable || ftruncate(fd, sizeof(nflive_index_t)) ) {
+			LogError("Live index '%s' size error", path);
+			close(fd);
+			return NULL;
+		}
+	}
+
+	p = mmap(NULL, sizeof(nflive_index_t), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if ( p == MAP_FAILED ) {
+		LogError("mmap() error for '%s': %s", path, strerror(errno));
+		return NULL;
+	}
+
+	live = calloc(1, sizeof(nflive_t));
+	if ( !live ) {
+		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+		munmap(p, sizeof(nflive_index_t));
+		return NULL;
+	}
+	live->index	   = (nflive_index_t *)p;
+	live->writable = writable;
+	live->datadir  = strdup(datadir);
+	if ( !live->datadir ) {
+		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+		CloseLiveIndex(live);
+		return NULL;
+	}
+
+	return live;
+
+} // End of MapLiveIndex
+
+/*
+ * Create or take over the live index of datadir for the current file of a collector.
+ * The current file is published with the first LiveIndexUpdate().
+ */
+nflive_t *OpenLiveIndex(char *datadir, char *current) {
+nflive_index_t *index;
+nflive_t *live;
+char *name;
+
+	live = MapLiveIndex(datadir, 1);
+	if ( !live ) 
+		return NULL;
+
+	index = live->index;
+	if ( index->magic != LIVE_MAGIC || index->version != LIVE_VERSION ) {
+		memset((void *)index, 0, sizeof(nflive_index_t));
+		index->magic   = LIVE_MAGIC;
+		index->version = LIVE_VERSION;
+		index->sequence = 1;
+	} else if ( index->offset ) {
+		// the current file of a previous collector was not completed - continue with the next sequence
+		index->offset = 0;
+		__sync_synchronize();
+		index->sequence++;
+	} // else readers wait already for the next file
+
+	name = strrchr(current, '/');
+	name = name ? name + 1 : current;
+	strncpy(index->current, name, LIVE_NAMELEN-1);
+	index->current[LIVE_NAMELEN-1] = '\0';
+	index->pid = getpid();
+	__sync_synchronize();
+
+	return live;
+
+} // End of OpenLiveIndex
+
+// publish the end of the last block written to fd, the current file
+void LiveIndexUpdate(nflive_t *live, int fd) {
+nflive_index_t *index = live->index;
+off_t offset;
+
+	offset = lseek(fd, 0, SEEK_CUR);
+	if ( offset < 0 ) 
+		return;
+
+	if ( index->offset == 0 ) {
+		// first update of a new file
+		struct stat stat_buf;
+		if ( fstat(fd, &stat_buf) ) 
+			return;
+		index->dev = stat_buf.st_dev;
+		index->ino = stat_buf.st_ino;
+	}
+
+	__sync_synchronize();
+	index->offset	= offset;
+	live->published = time(NULL);
+
+} // End of LiveIndexUpdate
+
+// the current file is complete and renamed to filename, relative to the data dir. NULL: rename failed
+void LiveIndexRotate(nflive_t *live, char *filename) {
+nflive_index_t *index = live->index;
+struct live_history_s *history;
+uint64_t sequence = index->sequence;
+
+	history = &index->history[sequence % LIVE_HISTORY];
+	history->sequence = 0;
+	__sync_synchronize();
+	if ( filename ) {
+		strncpy(history->name, filename, LIVE_NAMELEN-1);
+		history->name[LIVE_NAMELEN-1] = '\0';
+	} else 
+		history->name[0] = '\0';
+	__sync_synchronize();
+	history->sequence = sequence;
+
+	// readers finish the completed file and wait for the next one
+	index->offset = 0;
+	__sync_synchronize();
+	index->sequence = sequence + 1;
+
+} // End of LiveIndexRotate
+
+// a partially filled block is flushed once per LIVE_FLUSH seconds
+int LiveFlushDue(nflive_t *live, time_t now) {
+	return (now - live->published) >= LIVE_FLUSH;
+} // End of LiveFlushDue
+
+nflive_t *AttachLiveIndex(char *datadir) {
+nflive_t *live;
+
+	live = MapLiveIndex(datadir, 0);
+	if ( !live ) 
+		return NULL;
+
+	if ( live->index->magic != LIVE_MAGIC || live->index->version != LIVE_VERSION ) {
+		LogError("Live index in '%s': bad magic or version\n", datadir);
+		CloseLiveIndex(live);
+		return NULL;
+	}
+
+	// start with the current file
+	live->sequence = live->index->sequence - 1;
+	LiveStop = 0;
+
+	return live;
+
+} // End of AttachLiveIndex
+
+// get the name of a completed file from the history. returns 0, if no longer available
+static int LiveHistory(nflive_t *live, uint64_t sequence, char *name) {
+struct live_history_s *history = &live->index->history[sequence % LIVE_HISTORY];
+
+	if ( history->sequence != sequence ) 
+		return 0;
+	__sync_synchronize();
+	snprintf(name, MAXPATHLEN-1, "%s/%s", live->datadir, history->name);
+	name[MAXPATHLEN-1] = '\0';
+	__sync_synchronize();
+
+	return history->sequence == sequence && history->name[0] != '\0';
+
+} // End of LiveHistory
+
+/*
+ * Open path and check, that it is still the current file of the index
+ * returns 1 on success, 0 if the file changed meanwhile
+ */
+static int OpenLiveCurrent(nflive_t *live, char *path, nffile_t **nffile) {
+nflive_index_t *index = live->index;
+struct stat stat_buf;
+uint64_t sequence, offset, dev, ino;
+int fd;
+
+	// reverse order of the writer: dev/ino are valid, once the offset is published
+	sequence = index->sequence;
+	offset	 = index->offset;
+	__sync_synchronize();
+	dev = index->dev;
+	ino = index->ino;
+	__sync_synchronize();
+	if ( sequence != live->sequence + 1 || offset == 0 || index->sequence != sequence ) 
+		return 0;
+
+	// check the file, before it is opened as nffile
+	fd = open(path, O_RDONLY);
+	if ( fd < 0 ) 
+		return 0;
+	if ( fstat(fd, &stat_buf) || stat_buf.st_dev != dev || stat_buf.st_ino != ino ) {
+		close(fd);
+		return 0;
+	}
+	close(fd);
+
+	*nffile = OpenFile(path, *nffile);
+	if ( *nffile == NULL ) 
+		return 0;
+
+	// the name may have been reused by a rotation in between
+	if ( (*nffile)->fd <= 0 || fstat((*nffile)->fd, &stat_buf) || 
+		 stat_buf.st_dev != dev || stat_buf.st_ino != ino ) {
+		CloseFile(*nffile);
+		return 0;
+	}
+
+	return 1;
+
+} // End of OpenLiveCurrent
+
+/*
+ * Open the file following the last file read. Completed files are taken from the 
+ * history, if a reader fell behind. Waits for the next file of the collector.
+ * nffile is reused as by OpenFile(). returns NULL, if following was stopped
+ */
+nffile_t *OpenLiveFile(nflive_t *live, nffile_t *nffile) {
+nflive_index_t *index = live->index;
+char path[MAXPATHLEN];
+
+	if ( nffile ) 
+		CloseFile(nffile);
+
+	while ( !LiveStop ) {
+		uint64_t sequence, want;
+		int ok = 0;
+
+		want	 = live->sequence + 1;
+		sequence = index->sequence;
+		__sync_synchronize();
+
+		if ( want < sequence ) {
+			// a completed file
+			if ( LiveHistory(live, want, path) ) {
+				nffile_t *n = OpenFile(path, nffile);
+				ok = n != NULL && n->fd > 0;
+				if ( n ) 
+					nffile = n;
+			}
+			if ( !ok ) {
+				LogError("Live file %llu no longer available - skipped\n", (unsigned long long)want);
+				live->sequence = want;
+				continue;
+			}
+		} else if ( want == sequence && index->offset ) {
+			// the current file
+			snprintf(path, MAXPATHLEN-1, "%s/%s", live->datadir, index->current);
+			path[MAXPATHLEN-1] = '\0';
+			ok = OpenLiveCurrent(live, path, &nffile);
+		} 
+
+		if ( ok ) {
+			live->sequence = want;
+			live->offset   = lseek(nffile->fd, 0, SEEK_CUR);
+			return nffile;
+		}
+
+		// the next file is not yet ready
+		usleep(LIVE_POLL);
+	}
+
+	return NULL;
+
+} // End of OpenLiveFile
+
+/*
+ * Read the next data block of the live file. Waits, until the collector completed the next
+ * block. Returns as ReadBlock(): NF_EOF, if the file was rotated and all blocks are read,
+ * or if following was stopped.
+ */
+int ReadLiveBlock(nflive_t *live, nffile_t *nffile) {
+nflive_index_t *index = live->index;
+int ret;
+
+	while ( !LiveStop ) {
+		uint64_t sequence, offset;
+
+		sequence = index->sequence;
+		__sync_synchronize();
+		offset = index->offset;
+		__sync_synchronize();
+
+		if ( sequence == live->sequence && index->sequence == sequence && live->offset >= offset ) {
+			// no new block
+			usleep(LIVE_POLL);
+			continue;
+		}
+
+		// a new block or the file is complete - read up to EOF
+		ret = ReadBlock(nffile);
+		if ( ret > 0 ) 
+			live->offset = lseek(nffile->fd, 0, SEEK_CUR);
+		return ret;
+	}
+
+	return NF_EOF;
+
+} // End of ReadLiveBlock
+
+// async signal safe
+void StopLiveFollow(void) {
+	LiveStop = 1;
+} // End of StopLiveFollow
+
+void CloseLiveIndex(nflive_t *live) {
+
+	if ( !live ) 
+		return;
+
+	munmap((void *)live->index, sizeof(nflive_index_t));
+	free(live->datadir);
+	free(live);
+
+} // End of CloseLiveIndex
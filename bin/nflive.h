@@ -0,0 +1,110 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _NFLIVE_H
+#define _NFLIVE_H 1
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <time.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nffile.h"
+
+/*
+ * Live index: a small memory mapped file in the data dir of a collector, which
+ * follows the blocks written to the current nfcapd file. Each written block 
+ * publishes the end offset of the last complete block, each file rotation 
+ * increments the sequence of the current file and records the name of the 
+ * completed file. Readers ( nfdump --follow ) map the index read-only and read
+ * the blocks of the current file up to the published offset, while the file is
+ * written. The current file is identified by its inode, as the name does not 
+ * change across rotations.
+ */
+#define live_filename ".nflive"
+
+#define LIVE_MAGIC		0xA50C
+#define LIVE_VERSION	1
+
+// completed files kept in the index for slow readers
+#define LIVE_HISTORY	8
+#define LIVE_NAMELEN	128
+
+typedef struct nflive_index_s {
+	uint16_t	magic;
+	uint16_t	version;
+	uint32_t	pid;				// pid of the collector
+	volatile uint64_t	sequence;	// sequence of the current file - incremented at each rotation
+	volatile uint64_t	offset;		// end of the last complete block - 0: current file not yet ready
+	uint64_t	dev;				// device and inode of the current file
+	uint64_t	ino;
+	char		current[LIVE_NAMELEN];	// name of the current file in the data dir
+	struct live_history_s {
+		volatile uint64_t	sequence;
+		char		name[LIVE_NAMELEN];	// completed file, relative to the data dir
+	} history[LIVE_HISTORY];
+} nflive_index_t;
+
+typedef struct nflive_s {
+	nflive_index_t	*index;		// mapped index
+	char			*datadir;
+	int				writable;	// collector - otherwise reader
+	time_t			published;	// collector: time of the last update
+	uint64_t		sequence;	// reader: sequence of the file read
+	off_t			offset;		// reader: offset of the next block to read
+} nflive_t;
+
+// seconds, after which collectors flush a partially filled block in live mode
+#define LIVE_FLUSH	1
+
+// collector functions
+nflive_t *OpenLiveIndex(char *datadir, char *current);
+
+void LiveIndexUpdate(nflive_t *live, int fd);
+
+void LiveIndexRotate(nflive_t *live, char *filename);
+
+int LiveFlushDue(nflive_t *live, time_t now);
+
+// reader functions
+nflive_t *AttachLiveIndex(char *datadir);
+
+nffile_t *OpenLiveFile(nflive_t *live, nffile_t *nffile);
+
+int ReadLiveBlock(nflive_t *live, nffile_t *nffile);
+
+void StopLiveFollow(void);
+
+void CloseLiveIndex(nflive_t *live);
+
+#endif //_NFLIVE_H
@@ -80,6 +80,8 @@ static inline uint32_t SuperFastHash (const char * data, int len);
 
 static inline void New_Hash_Key(void *keymem, master_record_t *flow_record, int swap_flow);
 
+static void AddFlowTableKey(flow_table_record_t *table_record, uint32_t offset, uint64_t mask);
+
 /* locals */
 static hash_FlowTable FlowTable;
 static int	initialised = 0;
@@ -173,6 +175,9 @@ static aggregate_param_t *aggregate_stack = NULL;
 static uint32_t	aggregate_key_len 		  = sizeof(Default_key_t);
 static uint32_t	bidir_flows				  = 0;
 
+// hash key memory of AddFlow() - taken from the table memory
+static void	*flowkey_mem = NULL, *bidirkey_mem = NULL;
+
 // counter indices
 // The array size of FlowTableRecord_t array counter must match.
 enum CNT_IND { FLOWS = 0, INPACKETS, INBYTES, OUTPACKETS, OUTBYTES };
@@ -321,6 +326,8 @@ void Dispose_FlowTable(void) {
 	FlowTable.NumRecords  	= 0;
 	FlowTable.bucket 		= NULL;
 	FlowTable.bucketcache 	= NULL;
+	flowkey_mem	= NULL;
+	bidirkey_mem	= NULL;
 
 } // End of Dispose_FlowTable
 
@@ -443,24 +450,23 @@ FlowTableRecord_t	*record;
 
 
 void AddFlow(common_record_t *raw_record, master_record_t *flow_record, extension_info_t *extension_info ) {
-static void			*keymem = NULL, *bidirkeymem = NULL;
 FlowTableRecord_t	*FlowTableRecord;
 uint32_t			index_cache; 
 
-	if ( keymem == NULL ) {
-		keymem = MemoryHandle_get(&FlowTable.mem ,FlowTable.keysize );
+	if ( flowkey_mem == NULL ) {
+		flowkey_mem = MemoryHandle_get(&FlowTable.mem ,FlowTable.keysize );
 		// the last aligned word may not be fully used. set it to 0 to guarantee
 		// a proper comarison
 
 		// for 64 bit arch int == 8 bytes otherwise 4
-		((int *)keymem)[FlowTable.keylen-1] = 0;
+		((int *)flowkey_mem)[FlowTable.keylen-1] = 0;
 
 	}
 
-	New_Hash_Key(keymem, flow_record, 0);
+	New_Hash_Key(flowkey_mem, flow_record, 0);
 
 	// Update netflow statistics
-	FlowTableRecord = hash_lookup_FlowTable(&index_cache, keymem, flow_record);
+	FlowTableRecord = hash_lookup_FlowTable(&index_cache, flowkey_mem, flow_record);
 	if ( FlowTableRecord ) {
 		// flow record found - best case! update all fields
 		FlowTableRecord->counter[INBYTES]    += flow_record->dOctets;
@@ -484,7 +490,7 @@ uint32_t			index_cache;
 
 	} else if ( !bidir_flows || ( flow_record->prot != IPPROTO_TCP && flow_record->prot != IPPROTO_UDP) ) {
 		// no flow record found and no TCP/UDP bidir flows. Insert flow record into hash
-		FlowTableRecord = hash_insert_FlowTable(index_cache, keymem, raw_record);
+		FlowTableRecord = hash_insert_FlowTable(index_cache, flowkey_mem, raw_record);
 
 		FlowTableRecord->counter[INBYTES]	 = flow_record->dOctets;
 		FlowTableRecord->counter[INPACKETS]  = flow_record->dPkts;
@@ -496,25 +502,25 @@ uint32_t			index_cache;
 		FlowTableRecord->exp_ref  	 		 = flow_record->exp_ref;
 
 		// keymen got part of the cache
-		keymem = NULL;
+		flowkey_mem = NULL;
 	} else {
 		// for bidir flows do
 		uint32_t	bidir_index_cache; 
 
 		// use tmp memory for bidir hash key to search for bidir flow
 		// we need it only to lookup 
-		if ( bidirkeymem == NULL ) {
-			bidirkeymem = MemoryHandle_get(&FlowTable.mem ,FlowTable.keysize );
+		if ( bidirkey_mem == NULL ) {
+			bidirkey_mem = MemoryHandle_get(&FlowTable.mem ,FlowTable.keysize );
 			// the last aligned word may not be fully used. set it to 0 to guarantee
 			// a proper comarison
 
 			// for 64 bit arch int == 8 bytes otherwise 4
-			((int *)bidirkeymem)[FlowTable.keylen-1] = 0;
+			((int *)bidirkey_mem)[FlowTable.keylen-1] = 0;
 		}
 
 		// generate the hash key for reverse record (bidir)
-		New_Hash_Key(bidirkeymem, flow_record, 1);
-		FlowTableRecord = hash_lookup_FlowTable(&bidir_index_cache, bidirkeymem, flow_record);
+		New_Hash_Key(bidirkey_mem, flow_record, 1);
+		FlowTableRecord = hash_lookup_FlowTable(&bidir_index_cache, bidirkey_mem, flow_record);
 		if ( FlowTableRecord ) {
 			// we found a corresponding flow - so update all fields in reverse direction
 			FlowTableRecord->counter[OUTBYTES]   += flow_record->dOctets;
@@ -538,7 +544,7 @@ uint32_t			index_cache;
 		} else {
 			// no bidir flow found 
 			// insert original flow into the cache
-			FlowTableRecord = hash_insert_FlowTable(index_cache, keymem, raw_record);
+			FlowTableRecord = hash_insert_FlowTable(index_cache, flowkey_mem, raw_record);
 	
 			FlowTableRecord->counter[INBYTES]	 = flow_record->dOctets;
 			FlowTableRecord->counter[INPACKETS]  = flow_record->dPkts;
@@ -548,7 +554,7 @@ uint32_t			index_cache;
 			FlowTableRecord->map_info_ref  	 	 = extension_info;
 			FlowTableRecord->exp_ref  	 		 = flow_record->exp_ref;
 
-			keymem = NULL;
+			flowkey_mem = NULL;
 		}
 
 	} 
@@ -867,6 +873,85 @@ master_record_t *aggr_record_mask;
 
 } // End of GetMasterAggregateMask
 
+static void AddFlowTableKey(flow_table_record_t *table_record, uint32_t offset, uint64_t mask) {
+int i;
+
+	for ( i=0; i<table_record->num_keys; i++ ) {
+		if ( table_record->key[i].offset == offset ) {
+			table_record->key[i].mask |= mask;
+			return;
+		}
+	}
+
+	// the aggregation stack has less entries than MaxFlowTableKeys
+	table_record->key[i].offset = offset;
+	table_record->key[i].mask	= mask;
+	table_record->num_keys++;
+
+} // End of AddFlowTableKey
+
+void GetFlowTableRecord(flow_table_record_t *table_record) {
+
+	memset((void *)table_record, 0, sizeof(flow_table_record_t));
+	table_record->type			= FlowTableRecordType;
+	table_record->bidir			= bidir_flows;
+	table_record->apply_netbits = FlowTable.apply_netbits;
+
+	if ( aggregate_stack ) {
+		aggregate_param_t *aggr_param = aggregate_stack;
+		while ( aggr_param->size ) {
+			AddFlowTableKey(table_record, aggr_param->offset, aggr_param->mask);
+			aggr_param++;
+		}
+	} else {
+		// default 5-tuple aggregation
+		AddFlowTableKey(table_record, OffsetSrcIPv6a, MaskIPv6);
+		AddFlowTableKey(table_record, OffsetSrcIPv6b, MaskIPv6);
+		AddFlowTableKey(table_record, OffsetDstIPv6a, MaskIPv6);
+		AddFlowTableKey(table_record, OffsetDstIPv6b, MaskIPv6);
+		AddFlowTableKey(table_record, OffsetPort, MaskSrcPort | MaskDstPort);
+		AddFlowTableKey(table_record, OffsetProto, MaskProto);
+	}
+
+	table_record->size = offsetof(flow_table_record_t, key) + 
+		table_record->num_keys * sizeof(struct flow_table_key_s);
+
+} // End of GetFlowTableRecord
+
+/*
+ * Check the flow table record of a partial. Its flows can be aggregated by this query,
+ * if all bits of the keys of this query are keys of the partial.
+ */
+int MatchFlowTableRecord(record_header_t *record) {
+flow_table_record_t partial, query;
+int i, j;
+
+	if ( record->size < offsetof(flow_table_record_t, key) || record->size > sizeof(flow_table_record_t) ) 
+		return 0;
+
+	// records in a data block are 32bit aligned only
+	memcpy((void *)&partial, (void *)record, record->size);
+	if ( record->size < (offsetof(flow_table_record_t, key) + partial.num_keys * sizeof(struct flow_table_key_s)) ) 
+		return 0;
+
+	GetFlowTableRecord(&query);
+	if ( query.bidir != partial.bidir || query.apply_netbits != partial.apply_netbits ) 
+		return 0;
+
+	for ( i=0; i<query.num_keys; i++ ) {
+		uint64_t mask = 0;
+		for ( j=0; j<partial.num_keys; j++ ) {
+			if ( partial.key[j].offset == query.key[i].offset )
+				mask = partial.key[j].mask;
+		}
+		if ( (query.key[i].mask & ~mask) != 0 ) 
+			return 0;
+	}
+
+	return 1;
+
+} // End of MatchFlowTableRecord
+
 static inline void New_Hash_Key(void *keymem, master_record_t *flow_record, int swap_flow) {
 uint64_t *record = (uint64_t *)flow_record;
 Default_key_t *keyptr;
@@ -131,6 +131,27 @@ typedef struct hash_FlowTable {
 
 } hash_FlowTable;
 
+/*
+ * Flow table keys of a partial result
+ * nfdump --partial writes the keys of the flow table in front of the aggregated flows. Each 
+ * key is the mask of a 64bit word of the master record, which is part of the hash key.
+ * The flows of a partial can only be merged by a query, which uses a subset of these keys.
+ */
+#define MaxFlowTableKeys 64
+
+typedef struct flow_table_record_s {
+	uint16_t	type;			// FlowTableRecordType
+	uint16_t	size;			// size of the record up to the last key
+	uint8_t		bidir;			// bidirectional flows
+	uint8_t		apply_netbits;	// srcnet/dstnet aggregation
+	uint16_t	num_keys;		// number of keys
+	struct flow_table_key_s {
+		uint32_t	offset;		// offset in master record
+		uint32_t	fill;
+		uint64_t	mask;		// bits of the key
+	} key[MaxFlowTableKeys];
+} flow_table_record_t;
+
 hash_FlowTable *GetFlowTable(void);
 
 int Init_FlowTable(void);
@@ -151,4 +172,8 @@ int ParseAggregateMask( char *arg, char **aggr_fmt  );
 
 master_record_t *GetMasterAggregateMask(void);
 
+void GetFlowTableRecord(flow_table_record_t *table_record);
+
+int MatchFlowTableRecord(record_header_t *record);
+
 #endif //_NFLOWCACHE_H
@@ -113,6 +113,7 @@
 #include "flowtree.h"
 #include "netflow_pcap.h"
 #include "pcaproc.h"
+#include "tpacket.h"
 
 #define TIME_WINDOW     300
 #define SNAPLEN         200
@@ -120,6 +121,7 @@
 #define TIMEOUT         500
 #define FILTER          ""
 #define DEFAULT_DIR     "/var/tmp"
+#define MAXCAPTURETHREADS 64
 
 #ifndef DLT_LINUX_SLL
 #define DLT_LINUX_SLL   113
@@ -189,6 +191,21 @@ typedef struct p_packet_thread_args_s {
 	int		live;
 } p_packet_thread_args_t;
 
+// flow threads of multiple capture threads rotate the common output file together
+typedef struct flow_sync_s {
+	pthread_mutex_t m_sync;
+	pthread_cond_t  c_sync;
+	uint32_t	num_threads;
+	uint32_t	waiting;
+	uint32_t	cycle;
+
+	// shared rotation state
+	time_t		t_start;
+	uint32_t	NumFlows;
+	int			done;
+	int			failed;
+} flow_sync_t;
+
 typedef struct p_flow_thread_args_s {
 	// common thread info struct
 	pthread_t tid;
@@ -204,6 +221,8 @@ typedef struct p_flow_thread_args_s {
 	time_t	t_win;
 	int		subdir_index;
 	int		compress;
+	int		shard;				// number of this flow thread
+	flow_sync_t *sync;			// NULL, if only one flow thread
 } p_flow_thread_args_t;
 
 /*
@@ -223,16 +242,24 @@ static pcap_dev_t *setup_pcap_Ffile(FILE *fp, char *filter, int snaplen);
 
 static pcap_dev_t *setup_pcap_file(char *pcap_file, char *filter, int snaplen);
 
+static pcap_dev_t *setup_tpacket_live(char *device, char *filter, int snaplen, int fanout_group);
+
 static void WaitDone(void);
 
 static void SignalThreadTerminate(thread_info_t *thread_info, pthread_cond_t *thread_cond );
 
 static void *p_pcap_flush_thread(void *thread_data);
 
+static int FlowSyncWait(flow_sync_t *sync);
+
+static int RotateFlowFile(FlowSource_t *fs, time_t t_start, time_t t_win, int subdir_index, int compress, uint32_t NumFlows, int done);
+
 static void *p_flow_thread(void *thread_data);
 
 static void *p_packet_thread(void *thread_data);
 
+static void *p_ring_thread(void *thread_data);
+
 /*
  * Functions
  */
@@ -243,6 +270,7 @@ static void usage(char *name) {
 					"-u userid\tChange user to username\n"
 					"-g groupid\tChange group to groupname\n"
 					"-i device\tspecify a device\n"
+					"-W num\t\tcapture device with num threads. Linux TPACKET_V3 fanout capture\n"
 					"-r pcapfile\tspecify a file to read from\n"
 					"-B cache buckets\tset the number of cache buckets. (default 1048576)\n"
 					"-s snaplen\tset the snapshot length - default 1500\n"
@@ -252,6 +280,7 @@ static void usage(char *name) {
 					"-I Ident\tset the ident string for stat file. (default 'none')\n"
 					"-P pidfile\tset the PID file\n"
 					"-t time frame\tset the time window to rotate pcap/nfcapd file\n"
+					"-e active,inactive\tset the active and inactive flow expire time (s) - default 300,60\n"
 					"-j\t\tBZ2 compress flows in output file.\n"
 					"-z\t\tCompress flows in output file.\n"
 					"-E\t\tPrint extended format of netflow data. for debugging purpose only.\n"
@@ -578,6 +607,62 @@ uint32_t	linkoffset, linktype;
 
 } // End of setup_pcap_file
 
+static pcap_dev_t *setup_tpacket_live(char *device, char *filter, int snaplen, int fanout_group) {
+pcap_t 		*handle;
+pcap_dev_t	*pcap_dev;
+char errbuf[PCAP_ERRBUF_SIZE];
+struct bpf_program filter_code;	
+bpf_u_int32 netmask = 0;
+
+	dbg_printf("Enter function: %s\n", __FUNCTION__);
+
+	if (device == NULL) {
+		device = pcap_lookupdev(errbuf);
+		if (device == NULL) {
+			LogError("Couldn't find default device: %s", errbuf);
+			return NULL;
+		}
+	}
+
+	// dead handle to compile the filter for the kernel
+	handle = pcap_open_dead(DLT_EN10MB, snaplen);
+	if (handle == NULL) {
+		LogError("pcap_open_dead() failed for device %s", device);
+		return NULL;
+	}
+
+	// always compile a filter - an empty filter accepts all packets, cut to snaplen
+	if (pcap_compile(handle, &filter_code, filter ? filter : "", 1, netmask) == -1) {
+		LogError("Couldn't parse filter %s: %s", filter, pcap_geterr(handle));
+		pcap_close(handle);
+		return NULL;
+	}
+
+	pcap_dev = (pcap_dev_t *)calloc(1, sizeof(pcap_dev_t));
+	if ( !pcap_dev ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		pcap_freecode(&filter_code);
+		pcap_close(handle);
+		return NULL;
+	}	
+
+	pcap_dev->ring = OpenTPacketRing(device, &filter_code, fanout_group);
+	pcap_freecode(&filter_code);
+	if ( !pcap_dev->ring ) {
+		pcap_close(handle);
+		free(pcap_dev);
+		return NULL;
+	}
+
+	pcap_dev->handle	 = handle;
+	pcap_dev->snaplen	 = snaplen;
+	pcap_dev->linkoffset = 14;
+	pcap_dev->linktype	 = DLT_EN10MB;
+
+	return pcap_dev;
+
+} // End of setup_tpacket_live
+
 static void SignalThreadTerminate(thread_info_t *thread_info, pthread_cond_t *thread_cond ) {
 
 	if ( !thread_info->done ) {
@@ -604,6 +689,149 @@ static void SignalThreadTerminate(thread_info_t *thread_info, pthread_cond_t *th
 
 } // End of SignalThreadEnd
 
+// wait for all flow threads - returns 1 for the last thread arriving
+static int FlowSyncWait(flow_sync_t *sync) {
+uint32_t cycle;
+
+	pthread_mutex_lock(&sync->m_sync);
+	cycle = sync->cycle;
+	sync->waiting++;
+	if ( sync->waiting == sync->num_threads ) {
+		sync->waiting = 0;
+		sync->cycle++;
+		pthread_cond_broadcast(&sync->c_sync);
+		pthread_mutex_unlock(&sync->m_sync);
+		return 1;
+	}
+	while ( cycle == sync->cycle ) 
+		pthread_cond_wait(&sync->c_sync, &sync->m_sync);
+	pthread_mutex_unlock(&sync->m_sync);
+
+	return 0;
+
+} // End of FlowSyncWait
+
+static int RotateFlowFile(FlowSource_t *fs, time_t t_start, time_t t_win, int subdir_index, int compress, uint32_t NumFlows, int done) {
+struct tm *when;
+nffile_t *nffile;
+char FullName[MAXPATHLEN];
+char netflowFname[128];
+char error[256];
+char *subdir;
+ipfrag_stat_t ipfrag_stat;
+
+	when = localtime(&t_start);
+	nffile = fs->nffile;
+
+	// prepare sub dir hierarchy
+	if ( subdir_index ) {
+		subdir = GetSubDir(when);
+		if ( !subdir ) {
+			// failed to generate subdir path - put flows into base directory
+			LogError("Failed to create subdir path!");
+		
+			// failed to generate subdir path - put flows into base directory
+			subdir = NULL;
+			snprintf(netflowFname, 127, "nfcapd.%i%02i%02i%02i%02i",
+				when->tm_year + 1900, when->tm_mon + 1, when->tm_mday, when->tm_hour, when->tm_min);
+		} else {
+			snprintf(netflowFname, 127, "%s/nfcapd.%i%02i%02i%02i%02i", subdir,
+				when->tm_year + 1900, when->tm_mon + 1, when->tm_mday, when->tm_hour, when->tm_min);
+		}
+
+	} else {
+		subdir = NULL;
+		snprintf(netflowFname, 127, "nfcapd.%i%02i%02i%02i%02i",
+			when->tm_year + 1900, when->tm_mon + 1, when->tm_mday, when->tm_hour, when->tm_min);
+	}
+	netflowFname[127] = '\0';
+
+	if ( subdir && !SetupSubDir(fs->datadir, subdir, error, 255) ) {
+		// in this case the flows get lost! - the rename will fail
+		// but this should not happen anyway, unless i/o problems, inode problems etc.
+		LogError("Ident: %s, Failed to create sub hier directories: %s", fs->Ident, error );
+	}
+
+	if ( nffile->block_header->NumRecords ) {
+		// flush current buffer to disc
+		if ( WriteBlock(nffile) <= 0 )
+			LogError("Ident: %s, failed to write output buffer to disk: '%s'" , fs->Ident, strerror(errno));
+	} // else - no new records in current block
+
+	// prepare full filename
+	snprintf(FullName, MAXPATHLEN-1, "%s/%s", fs->datadir, netflowFname);
+	FullName[MAXPATHLEN-1] = '\0';
+
+	// update stat record
+	// if no flows were collected, fs->last_seen is still 0
+	// set first_seen to start of this time slot, with twin window size.
+	if ( fs->last_seen == 0 ) {
+		fs->first_seen = (uint64_t)1000 * (uint64_t)t_start;
+		fs->last_seen  = (uint64_t)1000 * (uint64_t)(t_start + t_win);
+	}
+	nffile->stat_record->first_seen = fs->first_seen/1000;
+	nffile->stat_record->msec_first	= fs->first_seen - nffile->stat_record->first_seen*1000;
+	nffile->stat_record->last_seen 	= fs->last_seen/1000;
+	nffile->stat_record->msec_last	= fs->last_seen - nffile->stat_record->last_seen*1000;
+
+	// Flush Exporter Stat to file
+	FlushExporterStats(fs);
+	// Close file
+	CloseUpdateFile(nffile, fs->Ident);
+
+	// if rename fails, we are in big trouble, as we need to get rid of the old .current file
+	// otherwise, we will loose flows and can not continue collecting new flows
+	if ( !RenameAppend(fs->current, FullName) ) {
+		LogError("Ident: %s, Can't rename dump file: %s", fs->Ident,  strerror(errno));
+		LogError("Ident: %s, Serious Problem! Fix manually", fs->Ident);
+/* XXX
+		if ( launcher_pid )
+			commbuff->failed = 1;
+*/
+		// we do not update the books here, as the file failed to rename properly
+		// otherwise the books may be wrong
+	} else {
+		struct stat	fstat;
+/* XXX
+		if ( launcher_pid )
+			commbuff->failed = 0;
+*/
+		// Update books
+		stat(FullName, &fstat);
+		UpdateBooks(fs->bookkeeper, t_start, 512*fstat.st_blocks);
+		AppendCatalog(fs->datadir, FullName, t_start, 512*fstat.st_blocks);
+	}
+
+	LogInfo("Ident: '%s' Flows: %llu, Packets: %llu, Bytes: %llu, Max Flows: %u, Fragments: %u", 
+		fs->Ident, (unsigned long long)nffile->stat_record->numflows, (unsigned long long)nffile->stat_record->numpackets, 
+		(unsigned long long)nffile->stat_record->numbytes, NumFlows, IPFragEntries());
+
+	IPFragStat(&ipfrag_stat);
+	LogInfo("IP fragments: datagrams completed: %llu, expired: %llu, evicted: %llu, dropped: %llu, memory: %llu bytes",
+		(unsigned long long)ipfrag_stat.completed, (unsigned long long)ipfrag_stat.expired, 
+		(unsigned long long)ipfrag_stat.evicted, (unsigned long long)ipfrag_stat.dropped, (unsigned long long)ipfrag_stat.bytes);
+
+	// reset stats
+	fs->bad_packets = 0;
+	fs->first_seen  = 0xffffffffffffLL;
+	fs->last_seen 	= 0;
+
+	// Dump all extension maps and exporters to the buffer
+	FlushStdRecords(fs);
+
+	if ( done ) 
+		return 1;
+
+	nffile = OpenNewFile(fs->current, nffile, compress, 0, NULL);
+	if ( !nffile ) {
+		LogError("Fatal: OpenNewFile() failed for ident: %s", fs->Ident);
+		return 0;
+	}
+
+	return 1;
+
+} // End of RotateFlowFile
+
 __attribute__((noreturn)) static void *p_flow_thread(void *thread_data) {
 // argument dispatching
 p_flow_thread_args_t *args = (p_flow_thread_args_t *)thread_data;
@@ -611,10 +839,11 @@ time_t t_win				 = args->t_win;
 int subdir_index			 = args->subdir_index;
 int compress			 	 = args->compress;
 FlowSource_t *fs			 = args->fs;
+flow_sync_t *sync			 = args->sync;
 
 // locals
 time_t t_start, t_clock;
-int err, done;
+int err, done, ok;
 
 	done 	   = 0;
 	args->done = 0;
@@ -624,33 +853,39 @@ int err, done;
 	if ( err ) {
 		LogError("[%lu] pthread_setspecific() error in %s line %d: %s\n", 
 			(long unsigned)args->tid, __FILE__, __LINE__, strerror(errno) );
-		args->done = 1;
-		args->exit = 255;
-   		pthread_kill(args->parent, SIGUSR1);
-		pthread_exit((void *)args);
 	}
 
-	if ( !Init_pcap2nf() ) {
-		args->done = 1;
-		args->exit = 255;
-   		pthread_kill(args->parent, SIGUSR1);
-		pthread_exit((void *)args);
+	ok = err == 0 && Init_FlowTable();
+
+	// the first flow thread prepares the output file for all flow threads
+	if ( ok && args->shard == 0 ) {
+		ok = Init_pcap2nf();
+		if ( ok ) {
+			// prepare file
+			fs->nffile = OpenNewFile(fs->current, NULL, compress, 0, NULL);
+			ok = fs->nffile != NULL;
+		}
+
+		// init vars
+		fs->bad_packets		= 0;
+		fs->first_seen      = 0xffffffffffffLL;
+		fs->last_seen 		= 0;
 	}
 
-	// prepare file
-	fs->nffile = OpenNewFile(fs->current, NULL, compress, 0, NULL);
-	if ( !fs->nffile ) {
+	if ( sync ) {
+		if ( !ok ) 
+			sync->failed = 1;
+		FlowSyncWait(sync);
+		ok = !sync->failed;
+	}
+
+	if ( !ok ) {
 		args->done = 1;
 		args->exit = 255;
    		pthread_kill(args->parent, SIGUSR1);
 		pthread_exit((void *)args);
 	}
 
-	// init vars
-	fs->bad_packets		= 0;
-	fs->first_seen      = 0xffffffffffffLL;
-	fs->last_seen 		= 0;
-
 	t_start = 0;
 	t_clock = 0;
 	while ( 1 ) {
@@ -667,121 +902,50 @@ int err, done;
 
 		if ( t_start == 0 ) {
 			t_start = t_clock - (t_clock % t_win);
+			if ( sync ) {
+				// all flow threads use the time slot of the first flow
+				__sync_bool_compare_and_swap(&sync->t_start, 0, t_start);
+				t_start = sync->t_start;
+			}
 		}
 
+		// store expired flows - flows, which expire up to the end of the time slot, go into this file
+		Expire_FlowTree(fs, (t_clock - t_start) < t_win ? t_clock : t_start + t_win);
+
 		if (((t_clock - t_start) >= t_win) || done) { /* rotate file */
-			struct tm *when;
-			nffile_t *nffile;
-			char FullName[MAXPATHLEN];
-			char netflowFname[128];
-			char error[256];
-			char *subdir;
+			uint32_t NumFlows;
 
-			// flush all flows to disk
+			// active flows stay in the cache across files. Flush all flows at the end only
 			DumpNodeStat();
-			uint32_t NumFlows  = Flush_FlowTree(fs);
-
-			when = localtime(&t_start);
-			nffile = fs->nffile;
-
-			// prepare sub dir hierarchy
-			if ( subdir_index ) {
-				subdir = GetSubDir(when);
-				if ( !subdir ) {
-					// failed to generate subdir path - put flows into base directory
-					LogError("Failed to create subdir path!");
-				
-					// failed to generate subdir path - put flows into base directory
-					subdir = NULL;
-					snprintf(netflowFname, 127, "nfcapd.%i%02i%02i%02i%02i",
-						when->tm_year + 1900, when->tm_mon + 1, when->tm_mday, when->tm_hour, when->tm_min);
-				} else {
-					snprintf(netflowFname, 127, "%s/nfcapd.%i%02i%02i%02i%02i", subdir,
-						when->tm_year + 1900, when->tm_mon + 1, when->tm_mday, when->tm_hour, when->tm_min);
+			if ( sync ) {
+				// all flow threads need to know, if this is the last file
+				if ( done )
+					sync->done = 1;
+				FlowSyncWait(sync);
+				NumFlows = sync->done ? Flush_FlowTree(fs) : FlowTreeSize();
+
+				// wait until all flow threads flushed their flows, before the file is rotated
+				__sync_fetch_and_add(&sync->NumFlows, NumFlows);
+				if ( FlowSyncWait(sync) ) {
+					if ( !RotateFlowFile(fs, sync->t_start, t_win, subdir_index, compress, sync->NumFlows, sync->done) )
+						sync->failed = 1;
+					sync->t_start  = t_clock - (t_clock % t_win);
+					sync->NumFlows = 0;
 				}
-
+				FlowSyncWait(sync);
+				done	= sync->done;
+				ok		= !sync->failed;
+				t_start = sync->t_start;
 			} else {
-				subdir = NULL;
-				snprintf(netflowFname, 127, "nfcapd.%i%02i%02i%02i%02i",
-					when->tm_year + 1900, when->tm_mon + 1, when->tm_mday, when->tm_hour, when->tm_min);
-			}
-			netflowFname[127] = '\0';
-	
-			if ( subdir && !SetupSubDir(fs->datadir, subdir, error, 255) ) {
-				// in this case the flows get lost! - the rename will fail
-				// but this should not happen anyway, unless i/o problems, inode problems etc.
-				LogError("Ident: %s, Failed to create sub hier directories: %s", fs->Ident, error );
+				NumFlows = done ? Flush_FlowTree(fs) : FlowTreeSize();
+				ok = RotateFlowFile(fs, t_start, t_win, subdir_index, compress, NumFlows, done);
+				t_start = t_clock - (t_clock % t_win);
 			}
 
-			if ( nffile->block_header->NumRecords ) {
-				// flush current buffer to disc
-				if ( WriteBlock(nffile) <= 0 )
-					LogError("Ident: %s, failed to write output buffer to disk: '%s'" , fs->Ident, strerror(errno));
-			} // else - no new records in current block
-
-			// prepare full filename
-			snprintf(FullName, MAXPATHLEN-1, "%s/%s", fs->datadir, netflowFname);
-			FullName[MAXPATHLEN-1] = '\0';
-
-			// update stat record
-			// if no flows were collected, fs->last_seen is still 0
-			// set first_seen to start of this time slot, with twin window size.
-			if ( fs->last_seen == 0 ) {
-				fs->first_seen = (uint64_t)1000 * (uint64_t)t_start;
-				fs->last_seen  = (uint64_t)1000 * (uint64_t)(t_start + t_win);
-			}
-			nffile->stat_record->first_seen = fs->first_seen/1000;
-			nffile->stat_record->msec_first	= fs->first_seen - nffile->stat_record->first_seen*1000;
-			nffile->stat_record->last_seen 	= fs->last_seen/1000;
-			nffile->stat_record->msec_last	= fs->last_seen - nffile->stat_record->last_seen*1000;
-	
-			// Flush Exporter Stat to file
-			FlushExporterStats(fs);
-			// Close file
-			CloseUpdateFile(nffile, fs->Ident);
-	
-			// if rename fails, we are in big trouble, as we need to get rid of the old .current file
-			// otherwise, we will loose flows and can not continue collecting new flows
-			if ( !RenameAppend(fs->current, FullName) ) {
-				LogError("Ident: %s, Can't rename dump file: %s", fs->Ident,  strerror(errno));
-				LogError("Ident: %s, Serious Problem! Fix manually", fs->Ident);
-	/* XXX
-				if ( launcher_pid )
-					commbuff->failed = 1;
-	*/
-				// we do not update the books here, as the file failed to rename properly
-				// otherwise the books may be wrong
-			} else {
-				struct stat	fstat;
-	/* XXX
-				if ( launcher_pid )
-					commbuff->failed = 0;
-	*/
-				// Update books
-				stat(FullName, &fstat);
-				UpdateBooks(fs->bookkeeper, t_start, 512*fstat.st_blocks);
-			}
-
-			LogInfo("Ident: '%s' Flows: %llu, Packets: %llu, Bytes: %llu, Max Flows: %u, Fragments: %u", 
-				fs->Ident, (unsigned long long)nffile->stat_record->numflows, (unsigned long long)nffile->stat_record->numpackets, 
-				(unsigned long long)nffile->stat_record->numbytes, NumFlows, IPFragEntries());
-
-			// reset stats
-			fs->bad_packets = 0;
-			fs->first_seen  = 0xffffffffffffLL;
-			fs->last_seen 	= 0;
-	
-			// Dump all extension maps and exporters to the buffer
-			FlushStdRecords(fs);
-
 			if ( done ) 
 				break;
-	
-			t_start = t_clock - (t_clock % t_win);
 
-			nffile = OpenNewFile(fs->current, nffile, compress, 0, NULL);
-			if ( !nffile ) {
-				LogError("Fatal: OpenNewFile() failed for ident: %s", fs->Ident);
+			if ( !ok ) {
 				args->done = 1;
 				args->exit = 255;
    				pthread_kill(args->parent, SIGUSR1);
@@ -792,12 +956,17 @@ int err, done;
 		if ( Node->fin != SIGNAL_NODE )
 			// Process the Node
 			ProcessFlowNode(fs, Node);
+		else
+			Release_SignalNode(args->NodeList);
 
 	}
 
-	while ( fs ) {
-		DisposeFile(fs->nffile);
-		fs = fs->next;
+	Dispose_FlowTable();
+	if ( args->shard == 0 ) {
+		while ( fs ) {
+			DisposeFile(fs->nffile);
+			fs = fs->next;
+		}
 	}
 	LogInfo("Terminating flow processng: exit: %i", args->exit);
 	dbg_printf("End flow thread[%lu]\n", (long unsigned)args->tid);
@@ -1055,11 +1224,7 @@ int err;
 					if ((t_clock - t_start) >= t_win) { /* rotate file */
 						if ( t_start ) {
 							// if not first packet, where t_start = 0
-							struct FlowNode	*Node = New_Node();
-							Node->t_first = tv;
-							Node->t_last  = tv;
-							Node->fin  	  = SIGNAL_NODE;
-							Push_Node(args->NodeList, Node);
+							Push_SignalNode(args->NodeList, &tv);
 							if ( pcap_datadir )
 							// keep the packet
 								RotateFile(pcapfile, t_start, live);
@@ -1131,6 +1296,74 @@ int err;
 
 } /* End of p_packet_thread */
 
+__attribute__((noreturn)) static void *p_ring_thread(void *thread_data) {
+// argument dispatching
+p_packet_thread_args_t *args = (p_packet_thread_args_t *)thread_data;
+pcap_dev_t *pcap_dev = args->pcap_dev;
+time_t t_win		 = args->t_win;
+// locals
+time_t t_start;
+int err;
+
+	dbg_printf("New ring thread[%lu]\n", (long unsigned)args->tid);
+	args->done = 0;
+	args->exit = 0;
+
+	err = pthread_setspecific( buffer_key, (void *)args );
+	if ( err ) {
+		LogError("[%lu] pthread_setspecific() error in %s line %d: %s\n", 
+			(long unsigned)args->tid, __FILE__, __LINE__, strerror(errno) );
+		args->done = 1;
+		args->exit = 255;
+   		pthread_kill(args->parent, SIGUSR1);
+		pthread_exit((void *)args);
+		/* NOTREACHED */
+	}
+
+	err = 0;
+	t_start = 0;
+	while ( !args->done ) {
+		struct timeval tv;
+		time_t t_clock;
+
+		if ( TPacketProcess(pcap_dev, args->NodeList, TIMEOUT) < 0 ) {
+			err = 1;
+			args->done = 1;
+			break;
+		}
+
+		// wake up the flow thread at the end of each time slot on quiet lines
+		gettimeofday(&tv, NULL);
+		t_clock = tv.tv_sec;
+		if ((t_clock - t_start) >= t_win) {
+			if ( t_start ) {
+				uint32_t packets, drops;
+				Push_SignalNode(args->NodeList, &tv);
+				LogInfo("Packet processing stats: Total: %u, Skipped: %u, Unknown: %u, Short snaplen: %u", 
+					pcap_dev->proc_stat.packets, pcap_dev->proc_stat.skipped, 
+					pcap_dev->proc_stat.unknown, pcap_dev->proc_stat.short_snap);
+				if ( TPacketStat(pcap_dev->ring, &packets, &drops) ) 
+					LogInfo("Ring stats: Received: %u, Dropped: %u", packets, drops);
+			}
+			t_start = t_clock - (t_clock % t_win);
+			memset((void *)&(pcap_dev->proc_stat), 0, sizeof(proc_stat_t));
+		}
+	}
+
+	if ( err ) 
+  		pthread_kill(args->parent, SIGUSR1);
+
+	LogInfo("Packet processing stats: Total: %u, Skipped: %u, Unknown: %u, Short snaplen: %u", 
+		pcap_dev->proc_stat.packets, pcap_dev->proc_stat.skipped, 
+		pcap_dev->proc_stat.unknown, pcap_dev->proc_stat.short_snap);
+	LogInfo("Terminating ring processing: exit: %i", args->exit);
+	dbg_printf("End ring thread[%lu]\n", (long unsigned)args->tid);
+
+	pthread_exit((void *)args);
+	/* NOTREACHED */
+
+} /* End of p_ring_thread */
+
 static void WaitDone(void) {
 sigset_t signal_set;
 int done, sig;
@@ -1174,15 +1407,16 @@ int main(int argc, char *argv[]) {
 sigset_t			signal_set;
 struct sigaction	sa;
 int c, snaplen, err, do_daemonize;
-int subdir_index, compress, expire, cache_size;
+int subdir_index, compress, expire, cache_size, num_threads, i;
 FlowSource_t	*fs;
 dirstat_t 		*dirstat;
 time_t 			t_win;
 char 			*device, *pcapfile, *filter, *datadir, *pcap_datadir, *extension_tags, pidfile[MAXPATHLEN], pidstr[32];
 char			*Ident, *userid, *groupid;
-pcap_dev_t 		*pcap_dev;
-p_packet_thread_args_t *p_packet_thread_args;
-p_flow_thread_args_t *p_flow_thread_args;
+pcap_dev_t 		*pcap_dev, *capture_dev[MAXCAPTURETHREADS];
+flow_sync_t		*flow_sync;
+p_packet_thread_args_t *p_packet_thread_args[MAXCAPTURETHREADS];
+p_flow_thread_args_t *p_flow_thread_args[MAXCAPTURETHREADS];
 
 	snaplen			= 1500;
 	do_daemonize	= 0;
@@ -1203,7 +1437,8 @@ p_flow_thread_args_t *p_flow_thread_args;
 	verbose			= 0;
 	expire			= 0;
 	cache_size		= 0;
-	while ((c = getopt(argc, argv, "B:DEI:g:hi:j:r:s:l:p:P:t:u:S:T:e:Vz")) != EOF) {
+	num_threads		= 0;
+	while ((c = getopt(argc, argv, "B:DEI:g:hi:j:r:s:l:p:P:t:u:S:T:e:VW:z")) != EOF) {
 		switch (c) {
 			struct stat fstat;
 			case 'h':
@@ -1232,6 +1467,13 @@ p_flow_thread_args_t *p_flow_thread_args;
 			case 'i':
 				device = optarg;
 				break;
+			case 'W':
+				num_threads = atoi(optarg);
+				if ( num_threads < 1 || num_threads > MAXCAPTURETHREADS ) {
+					LogError("ERROR: Number of capture threads must be between 1 and %d", MAXCAPTURETHREADS);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'l':
 				datadir = optarg;
 				err  = stat(datadir, &fstat);
@@ -1277,6 +1519,14 @@ p_flow_thread_args_t *p_flow_thread_args;
 					exit(EXIT_FAILURE);
 				}
 				break;
+			case 'e': {
+				uint32_t active, inactive;
+				if ( sscanf(optarg, "%u,%u", &active, &inactive) != 2 || active == 0 || inactive == 0 ) {
+					LogError("ERROR: Expire time format: active,inactive - both > 0");
+					exit(EXIT_FAILURE);
+				}
+				SetFlowTimeout(active, inactive);
+				} break;
 			case 'j':
 				if ( compress ) {
 					LogError("Use either -z for LZO or -j for BZ2 compression, but not both\n");
@@ -1354,6 +1604,16 @@ p_flow_thread_args_t *p_flow_thread_args;
 		exit(EXIT_FAILURE);
 	}
 
+	if ( num_threads && pcapfile ) {
+		LogError("Capture threads -W require a device");
+		exit(EXIT_FAILURE);
+	}
+
+	if ( num_threads && pcap_datadir ) {
+		LogError("Packet dumping -p is not supported with capture threads -W");
+		exit(EXIT_FAILURE);
+	}
+
 	
 	if ( !Init_FlowTree(cache_size)) {
 		LogError("Init_FlowTree() failed.");
@@ -1365,12 +1625,24 @@ p_flow_thread_args_t *p_flow_thread_args;
 
 	if ( pcapfile ) {
 		pcap_dev = setup_pcap_file(pcapfile, filter, snaplen);
+	} else if ( num_threads ) {
+		// all rings join the same fanout group
+		for ( i=0; i<num_threads; i++ ) {
+			capture_dev[i] = setup_tpacket_live(device, filter, snaplen, getpid() & 0xFFFF);
+			if ( !capture_dev[i] ) 
+				exit(EXIT_FAILURE);
+		}
+		pcap_dev = capture_dev[0];
 	} else {
 		pcap_dev = setup_pcap_live(device, filter, snaplen);
 	}
 	if (!pcap_dev) {
 		exit(EXIT_FAILURE);
 	}
+	if ( num_threads == 0 ) {
+		num_threads	   = 1;
+		capture_dev[0] = pcap_dev;
+	}
 
 	SetPriv(userid, groupid);
 
@@ -1458,7 +1730,10 @@ p_flow_thread_args_t *p_flow_thread_args;
 		exit(255);
 	}
 
-	IPFragTree_init();
+	if ( !IPFrag_init(IPFRAG_MAXBYTES) ) {
+		pcap_close(pcap_dev->handle);
+		exit(255);
+	}
 
 	LogInfo("Startup.");
 	// prepare signal mask for all threads
@@ -1488,62 +1763,102 @@ p_flow_thread_args_t *p_flow_thread_args;
 		exit(255);
 	}
 
-	// prepare flow thread args
-	p_flow_thread_args = (p_flow_thread_args_t *)malloc(sizeof(p_flow_thread_args_t));
-	if ( !p_flow_thread_args ) {
-		LogError("malloc() error in %s line %d: %s\n", 
-			__FILE__, __LINE__, strerror(errno) );
-		exit(255);
-	}	
-	p_flow_thread_args->fs 	   	   = fs;
-	p_flow_thread_args->t_win 	   = t_win;
-	p_flow_thread_args->compress   = compress;
-	p_flow_thread_args->subdir_index = subdir_index;
-	p_flow_thread_args->parent	   = pthread_self();
-	p_flow_thread_args->NodeList   = NewNodeList();
-
-	err = 0;
-	err = pthread_create(&p_flow_thread_args->tid, NULL, p_flow_thread, (void *)p_flow_thread_args);
-	if ( err ) {
-		LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-		exit(255);
+	// flow threads of multiple capture threads write into the same file
+	flow_sync = NULL;
+	if ( num_threads > 1 ) {
+		flow_sync = (flow_sync_t *)calloc(1, sizeof(flow_sync_t));
+		if ( !flow_sync ) {
+			LogError("malloc() error in %s line %d: %s\n", 
+				__FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		pthread_mutex_init(&flow_sync->m_sync, NULL);
+		pthread_cond_init(&flow_sync->c_sync, NULL);
+		flow_sync->num_threads = num_threads;
 	}
-	dbg_printf("Started flow thread[%lu]\n", (long unsigned)p_flow_thread_args->tid);
 
-	// prepare packet thread args
-	p_packet_thread_args = (p_packet_thread_args_t *)malloc(sizeof(p_packet_thread_args_t));
-	if ( !p_packet_thread_args ) {
-		LogError("malloc() error in %s line %d: %s\n", 
-			__FILE__, __LINE__, strerror(errno) );
-		exit(255);
-	}	
-	p_packet_thread_args->pcap_dev 	   = pcap_dev;
-	p_packet_thread_args->t_win 	   = t_win;
-	p_packet_thread_args->subdir_index = subdir_index;
-	p_packet_thread_args->pcap_datadir = pcap_datadir;
-	p_packet_thread_args->live 	   	   = device != NULL;
-	p_packet_thread_args->parent	   = pthread_self();
-	p_packet_thread_args->NodeList	   = p_flow_thread_args->NodeList;
-
-	err = pthread_create(&p_packet_thread_args->tid, NULL, p_packet_thread, (void *)p_packet_thread_args);
-	if ( err ) {
-		LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-		exit(255);
+	// each capture thread feeds its own flow thread with its own flow table
+	for ( i=0; i<num_threads; i++ ) {
+		// prepare flow thread args
+		p_flow_thread_args[i] = (p_flow_thread_args_t *)malloc(sizeof(p_flow_thread_args_t));
+		if ( !p_flow_thread_args[i] ) {
+			LogError("malloc() error in %s line %d: %s\n", 
+				__FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}	
+		p_flow_thread_args[i]->fs           = fs;
+		p_flow_thread_args[i]->t_win        = t_win;
+		p_flow_thread_args[i]->compress     = compress;
+		p_flow_thread_args[i]->subdir_index = subdir_index;
+		p_flow_thread_args[i]->parent       = pthread_self();
+		p_flow_thread_args[i]->NodeList     = NewNodeList();
+		p_flow_thread_args[i]->shard        = i;
+		p_flow_thread_args[i]->sync         = flow_sync;
+
+		err = 0;
+		err = pthread_create(&p_flow_thread_args[i]->tid, NULL, p_flow_thread, (void *)p_flow_thread_args[i]);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		dbg_printf("Started flow thread[%lu]\n", (long unsigned)p_flow_thread_args[i]->tid);
+
+		// prepare packet thread args
+		p_packet_thread_args[i] = (p_packet_thread_args_t *)malloc(sizeof(p_packet_thread_args_t));
+		if ( !p_packet_thread_args[i] ) {
+			LogError("malloc() error in %s line %d: %s\n", 
+				__FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}	
+		p_packet_thread_args[i]->pcap_dev     = capture_dev[i];
+		p_packet_thread_args[i]->t_win        = t_win;
+		p_packet_thread_args[i]->subdir_index = subdir_index;
+		p_packet_thread_args[i]->pcap_datadir = pcap_datadir;
+		p_packet_thread_args[i]->live         = device != NULL;
+		p_packet_thread_args[i]->parent       = pthread_self();
+		p_packet_thread_args[i]->NodeList     = p_flow_thread_args[i]->NodeList;
+
+		if ( capture_dev[i]->ring ) 
+			err = pthread_create(&p_packet_thread_args[i]->tid, NULL, p_ring_thread, (void *)p_packet_thread_args[i]);
+		else
+			err = pthread_create(&p_packet_thread_args[i]->tid, NULL, p_packet_thread, (void *)p_packet_thread_args[i]);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		dbg_printf("Started packet thread[%lu]\n", (long unsigned)p_packet_thread_args[i]->tid);
 	}
-	dbg_printf("Started packet thread[%lu]\n", (long unsigned)p_packet_thread_args->tid);
 
 	// Wait till done
 	WaitDone();
 
-	dbg_printf("Signal packet thread to terminate\n");
-	SignalThreadTerminate((thread_info_t *)p_packet_thread_args, NULL);
-
-	dbg_printf("Signal flow thread to terminate\n");
-	SignalThreadTerminate((thread_info_t *)p_flow_thread_args, &p_packet_thread_args->NodeList->c_list);
+	dbg_printf("Signal packet threads to terminate\n");
+	for ( i=0; i<num_threads; i++ ) 
+		SignalThreadTerminate((thread_info_t *)p_packet_thread_args[i], NULL);
+
+	// flow threads wait for each other to close the file - signal all, before joining
+	dbg_printf("Signal flow threads to terminate\n");
+	for ( i=0; i<num_threads; i++ ) {
+		if ( !p_flow_thread_args[i]->done ) {
+			p_flow_thread_args[i]->done = 1;
+			pthread_kill(p_flow_thread_args[i]->tid, SIGUSR2);
+			pthread_cond_signal(&p_flow_thread_args[i]->NodeList->c_list);
+		}
+	}
+	for ( i=0; i<num_threads; i++ ) 
+		SignalThreadTerminate((thread_info_t *)p_flow_thread_args[i], &p_flow_thread_args[i]->NodeList->c_list);
 
 	// free arg list
-	free((void *)p_packet_thread_args);
-	free((void *)p_flow_thread_args);
+	for ( i=0; i<num_threads; i++ ) {
+		free((void *)p_packet_thread_args[i]);
+		free((void *)p_flow_thread_args[i]);
+		if ( capture_dev[i]->ring ) {
+			CloseTPacketRing(capture_dev[i]->ring);
+			if ( i ) 
+				pcap_close(capture_dev[i]->handle);
+		}
+	}
+	free((void *)flow_sync);
 
 	LogInfo("Terminating nfpcapd.");
 
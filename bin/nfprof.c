@@ -51,6 +51,20 @@
 #include <sys/resource.h>
 #include "nfprof.h"
 
+#ifdef NFPROF_STAGES
+int nfprof_stages_enabled = 0;
+nfprof_stage_t nfprof_stage[PROF_STAGES];
+
+static uint64_t stages_start;
+
+// time of a back to back clock read - subtracted from each timed call
+static uint64_t clock_overhead;
+
+static const char *stage_name[PROF_STAGES] = {
+	"read", "uncompress", "expand", "filter", "aggregate", "insert", "sort", "print"
+};
+#endif
+
 /*
  * Initialize profiling.
  * 
@@ -132,3 +146,65 @@ double fps, allsecs;
 
 } // End of nfprof_print
 
+
+#ifdef NFPROF_STAGES
+
+void nfprof_stages(int enable) {
+uint64_t t;
+int i;
+
+	bzero (nfprof_stage, sizeof(nfprof_stage));
+	nfprof_stages_enabled = enable;
+
+	// calibrate the cost of the timer itself
+	t = 0;
+	for ( i=0; i < 1024; i++ ) {
+		uint64_t start = nfprof_clock();
+		t += nfprof_clock() - start;
+	}
+	clock_overhead = t / 1024;
+
+	stages_start = nfprof_clock();
+
+} // End of nfprof_stages
+
+/*
+ * Print the time breakdown of the stages as share of the wall time since nfprof_stages().
+ * Stages run by the read ahead thread overlap with the others. If the stage times add up 
+ * to more than the wall time, the shares are relative to the sum of the stage times.
+ */
+void nfprof_print_stages(FILE *std) {
+double wall, total, nsec[PROF_STAGES];
+int i;
+
+	wall = (double)(nfprof_clock() - stages_start);
+
+	// subtract the timer overhead of all represented calls - sampled calls are already weighted
+	total = 0.0;
+	for ( i=0; i < PROF_STAGES; i++ ) {
+		nfprof_stage_t *stage = &nfprof_stage[i];
+		nsec[i] = (double)stage->nsec - (double)stage->weight * (double)clock_overhead;
+		if ( nsec[i] < 0.0 ) 
+			nsec[i] = 0.0;
+		total += nsec[i];
+	}
+	if ( total > wall ) 
+		wall = total;
+
+	fprintf(std, "Stage        Calls          Sampled        Time(s)    ns/call     Share\n");
+	for ( i=0; i < PROF_STAGES; i++ ) {
+		nfprof_stage_t *stage = &nfprof_stage[i];
+		double share;
+
+		if ( stage->calls == 0 ) 
+			continue;
+
+		share = wall > 0.0 ? 100.0 * nsec[i] / wall : 0.0;
+		fprintf(std, "%-12s %-14llu %-14llu %-10.3f %-11.1f %5.1f%%\n", stage_name[i], 
+			(unsigned long long)stage->calls, (unsigned long long)stage->sampled, 
+			nsec[i] / 1000000000.0, nsec[i] / (double)stage->calls, share);
+	}
+
+} // End of nfprof_print_stages
+
+#endif
@@ -44,6 +44,7 @@
 
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <time.h>
 
 typedef struct nfprof_s {
   struct timeval  	tstart;   /* start time */
@@ -58,4 +59,64 @@ int nfprof_end(nfprof_t *profile_data, uint64_t numflows);
 
 void nfprof_print(nfprof_t *profile_data, FILE *std);
 
+/*
+ * Stage timers
+ * The time spent in the stages of the record processing is accumulated per stage.
+ * The timers are compiled in with --enable-stageprof and enabled at runtime with 
+ * nfprof_stages(). Stages called per record are sampled: only every PROF_SAMPLED + 1 
+ * call is timed and each timed call is weighted by the sample rate.
+ * Per record and one-off work use separate stages, e.g. PROF_INSERT and PROF_SORT.
+ * Without NFPROF_STAGES, the PROF_ macros compile to nothing.
+ */
+enum { PROF_READ = 0, PROF_UNCOMPRESS, PROF_EXPAND, PROF_FILTER, PROF_AGGREGATE, 
+	PROF_INSERT, PROF_SORT, PROF_PRINT, PROF_STAGES };
+
+// sample masks - time each call or every 64th call
+#define PROF_ALL		0
+#define PROF_SAMPLED	0x3f
+
+typedef struct nfprof_stage_s {
+	uint64_t	calls;		// number of calls
+	uint64_t	sampled;	// number of timed calls
+	uint64_t	weight;		// number of calls represented by the timed calls
+	uint64_t	nsec;		// weighted time of all timed calls
+} nfprof_stage_t;
+
+#ifdef NFPROF_STAGES
+
+extern int nfprof_stages_enabled;
+extern nfprof_stage_t nfprof_stage[PROF_STAGES];
+
+static inline uint64_t nfprof_clock(void) {
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+} // End of nfprof_clock
+
+#define PROF_START(stage, mask) \
+	uint64_t _prof_##stage = 0; \
+	const uint64_t _prof_weight_##stage = (uint64_t)(mask) + 1; \
+	if ( nfprof_stages_enabled && (nfprof_stage[stage].calls++ & (mask)) == 0 ) \
+		_prof_##stage = nfprof_clock();
+
+#define PROF_END(stage) \
+	if ( _prof_##stage ) { \
+		nfprof_stage[stage].nsec += (nfprof_clock() - _prof_##stage) * _prof_weight_##stage; \
+		nfprof_stage[stage].weight += _prof_weight_##stage; \
+		nfprof_stage[stage].sampled++; \
+	}
+
+void nfprof_stages(int enable);
+
+void nfprof_print_stages(FILE *std);
+
+#else
+
+#define PROF_START(stage, mask)
+#define PROF_END(stage)
+
+#endif
+
 #endif //_NFPROF_H
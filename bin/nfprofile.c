@@ -43,6 +43,7 @@
 #include <sys/param.h>
 #include <netinet/in.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -62,8 +63,14 @@
 #include "ipconv.h"
 #include "flist.h"
 #include "util.h"
+#include "queue.h"
+#include "nfscan.h"
 #include "profile.h"
 
+#ifdef HAVE_INFLUXDB
+#include <curl/curl.h>
+#endif
+
 /* externals */
 extern generic_exporter_t **exporter_list;
 
@@ -74,6 +81,57 @@ extern extension_descriptor_t extension_descriptor[];
 /* Local Variables */
 static const char *nfdump_version = VERSION;
 
+#define MAXWORKERS 64
+
+/*
+ * The files are read by the scan engine. Single threaded, the flows are filtered
+ * in the flow callback.
+ * Multi-threaded processing:
+ * The block callback passes the data blocks to the filter workers.
+ * The workers filter all records of a block and mark the matching records per channel.
+ * Filtered blocks are passed in sequence to the per channel writer threads, which 
+ * append the matching records to the channel file and compress/write the output blocks.
+ */
+typedef struct profile_block_s {
+	uint64_t			seq;			// sequence number of this block
+	data_block_header_t	*block_header;	// copy of input data block
+	uint32_t			words;			// bitmap words per channel
+	uint32_t			maxwords;		// allocated bitmap words
+	uint64_t			*match;			// bitmap of matched records per channel
+	stat_record_t		*stat_record;	// statistics of this block per channel
+	uint32_t			refcnt;			// number of writers still using this block
+} profile_block_t;
+
+typedef struct profile_ctx_s {
+	profile_channel_info_t	*channels;
+	unsigned int			num_channels;
+	uint32_t				num_files;
+	// single threaded
+	FilterSet_t				*filter_set;	// filters of all channels
+	uint8_t					*match;			// matched channels of a record
+	// multi-threaded
+	struct profile_worker_s	*reader;		// filters blocks with meta records
+	uint64_t				seq;			// sequence number of next block read
+	queue_t					*freeQueue;		// free blocks
+	queue_t					*workQueue;		// blocks to filter
+	queue_t					**writerQueue;	// blocks to write per channel
+	pthread_mutex_t			seq_mutex;
+	pthread_cond_t			seq_cond;
+	profile_block_t			**pending;		// filtered blocks not yet in sequence
+	uint32_t				numBlocks;
+	uint64_t				next_seq;		// next block in sequence for the writers
+} profile_ctx_t;
+
+typedef struct profile_worker_s {
+	profile_ctx_t	*ctx;
+	FilterSet_t		*filter_set;
+	pthread_t		tid;
+	unsigned int	channel;
+	extension_info_t *last_info;
+	master_record_t	master_record;
+	uint8_t			*match;
+} profile_worker_t;
+
 
 extension_map_list_t *extension_map_list;
 uint32_t is_anonymized;
@@ -88,8 +146,21 @@ static void usage(char *name);
 
 static profile_param_info_t *ParseParams (char *profile_datadir);
 
+static int profile_file(void *data, char *filename, file_header_t *file_header, stat_record_t *stat_record);
+
+static int profile_flow(void *data, common_record_t *flow_record, master_record_t *master_record, 
+	extension_info_t *extension_info);
+
+static void profile_record(void *data, record_header_t *record);
+
+static void profile_map(void *data, extension_map_t *map);
+
 static void process_data(profile_channel_info_t *channels, unsigned int num_channels, time_t tslot);
 
+static int profile_block(void *data, data_block_header_t *block_header);
+
+static void process_data_mt(profile_channel_info_t *channels, unsigned int num_channels, int num_workers);
+
 /* Functions */
 
 #include "nfdump_inline.c"
@@ -108,7 +179,12 @@ static void usage(char *name) {
 					"-s\t\tprofile subdir.\n"
 					"-Z\t\tCheck filter syntax and exit.\n"
 					"-S subdir\tSub directory format. see nfcapd(1) for format\n"
-					"-z\t\tCompress flows in output file.\n"
+					"-z[=method]\tCompress flows in output file. Default LZO\n"
+					"\t\tmethod: lzo, lz4, bz2 or zstd[:level[:dictfile]]\n"
+					"-y\t\tLZ4 compress flows in output file.\n"
+					"-j\t\tBZ2 compress flows in output file.\n"
+					"-W <num>\tUse <num> filter threads and one writer thread per channel.\n"
+					"\t\tBlocks of nfdump 1.5.x files are skipped.\n"
 #ifdef HAVE_INFLUXDB
 					"-i <influxurl>\tInfluxdb url for stats (example: http://localhost:8086/write?db=mydb&u=pippo&p=paperino)\n"
 #endif
@@ -116,238 +192,498 @@ static void usage(char *name) {
 } /* usage */
 
 
+static int profile_file(void *data, char *filename, file_header_t *file_header, stat_record_t *stat_record) {
+profile_ctx_t *ctx = (profile_ctx_t *)data;
+
+	if ( ctx->num_files++ == 0 ) {
+		// store infos away for later use
+		// although multiple files may be processed, it is assumed that all 
+		// have the same settings
+		is_anonymized = file_header->flags & FLAG_ANONYMIZED;
+		strncpy(Ident, file_header->ident, IDENTLEN);
+		Ident[IDENTLEN-1] = '\0';
+	}
+
+	return SCAN_CONTINUE;
+
+} // End of profile_file
+
+static int profile_flow(void *data, common_record_t *flow_record, master_record_t *master_record, 
+	extension_info_t *extension_info) {
+profile_ctx_t *ctx = (profile_ctx_t *)data;
+profile_channel_info_t *channels = ctx->channels;
+int j;
+
+	// apply all profile filters at once
+	RunFilterSet(ctx->filter_set, (uint64_t *)master_record, ctx->match);
+
+	for ( j=0; j < ctx->num_channels; j++ ) {
+		// if profile filter failed -> next profile
+		if ( !ctx->match[j] )
+			continue;
+
+		// filter was successful -> continue record processing
+
+		// update statistics
+		UpdateStat(&channels[j].stat_record, master_record);
+		if ( channels[j].nffile ) 
+			UpdateStat(channels[j].nffile->stat_record, master_record);
+
+		// do we need to write data to new file - shadow profiles do not have files.
+		if ( channels[j].nffile != NULL ) {
+			// write record to output buffer
+			AppendToBuffer(channels[j].nffile, (void *)flow_record, flow_record->size);
+		} 
+
+	} // End of for all channels
+
+	return SCAN_CONTINUE;
+
+} // End of profile_flow
+
+// new exporter or sampler record
+static void profile_record(void *data, record_header_t *record) {
+profile_ctx_t *ctx = (profile_ctx_t *)data;
+int j;
+
+	for ( j=0; j < ctx->num_channels; j++ ) {
+		if ( ctx->channels[j].nffile != NULL ) 
+			AppendToBuffer(ctx->channels[j].nffile, (void *)record, record->size);
+	}
+
+} // End of profile_record
+
+static void profile_map(void *data, extension_map_t *map) {
+
+	// flush new map
+	profile_record(data, (record_header_t *)map);
+
+} // End of profile_map
+
 static void process_data(profile_channel_info_t *channels, unsigned int num_channels, time_t tslot) {
-common_record_t	*flow_record;
-nffile_t		*nffile;
-FilterEngine_data_t	*engine;
-int 		i, j, done, ret ;
-#ifdef COMPAT15
-int	v1_map_done = 0;
-#endif
+profile_ctx_t	ctx;
+scan_t			scan;
+int				j;
+
+	memset((void *)&ctx, 0, sizeof(profile_ctx_t));
+	ctx.channels	 = channels;
+	ctx.num_channels = num_channels;
+	ctx.filter_set	 = GetChannelFilterSet();
+	ctx.match		 = (uint8_t *)malloc(num_channels * sizeof(uint8_t));
+	if ( !ctx.match ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
 
-	nffile = GetNextFile(NULL, 0, 0);
-	if ( !nffile ) {
-		LogError("GetNextFile() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+	memset((void *)&scan, 0, sizeof(scan_t));
+	scan.extension_map_list	= extension_map_list;
+	scan.data				= (void *)&ctx;
+	scan.file				= profile_file;
+	scan.flow				= profile_flow;
+	scan.map				= profile_map;
+	scan.exporter			= profile_record;
+
+	if ( !ScanFiles(&scan) ) {
+		free(ctx.match);
 		return;
 	}
-	if ( nffile == EMPTY_LIST ) {
-		LogError("Empty file list. No files to process\n");
-		return;
+
+	// do we need to write data to new file - shadow profiles do not have files.
+	for ( j=0; j < num_channels; j++ ) {
+		if ( channels[j].nffile != NULL ) {
+			// flush output buffer
+			if ( channels[j].nffile->block_header->NumRecords ) {
+				if ( WriteBlock(channels[j].nffile) <= 0 ) {
+					LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
+				} 
+			} 
+		}
 	}
+	free(ctx.match);
 
-	// store infos away for later use
-	// although multiple files may be processed, it is assumed that all 
-	// have the same settings
-	is_anonymized = IP_ANONYMIZED(nffile);
-	strncpy(Ident, nffile->file_header->ident, IDENTLEN);
-	Ident[IDENTLEN-1] = '\0';
+} // End of process_data
 
-	done = 0;
-	while ( !done ) {
-
-		// get next data block from file
-		ret = ReadBlock(nffile);
-
-		switch (ret) {
-			case NF_CORRUPT:
-			case NF_ERROR:
-				if ( ret == NF_CORRUPT ) 
-					LogError("Skip corrupt data file '%s'\n",GetCurrentFilename());
-				else 
-					LogError("Read error in file '%s': %s\n",GetCurrentFilename(), strerror(errno) );
-				// fall through - get next file in chain
-			case NF_EOF: {
-				nffile_t *next = GetNextFile(nffile, 0, 0);
-				if ( next == EMPTY_LIST ) {
-					done = 1;
-				}
-				if ( next == NULL ) {
-					done = 1;
-					LogError("Unexpected end of file list\n");
-				}
-				continue;
-	
-				} break; // not really needed
+/*
+ * Filter all records of a block and mark the matching records in the channel bitmaps.
+ * Blocks with extension maps, exporter or sampler records are processed by the reader
+ * only, while no other block is in progress.
+ */
+static void FilterProfileBlock(profile_ctx_t *ctx, profile_block_t *block, profile_worker_t *worker) {
+profile_channel_info_t *channels = ctx->channels;
+common_record_t	*flow_record;
+master_record_t	*master_record;
+uint32_t		i, j, words, num_channels;
+
+	num_channels = ctx->num_channels;
+	words = (block->block_header->NumRecords + 63) >> 6;
+	if ( (words * num_channels) > block->maxwords ) {
+		block->maxwords = words * num_channels;
+		block->match = realloc(block->match, block->maxwords * sizeof(uint64_t));
+		if ( !block->match ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
 		}
+	}
+	block->words = words;
+	memset((void *)block->match, 0, words * num_channels * sizeof(uint64_t));
+	memset((void *)block->stat_record, 0, num_channels * sizeof(stat_record_t));
+	for ( j=0; j < num_channels; j++ ) {
+		block->stat_record[j].first_seen = 0x7fffffff;
+		block->stat_record[j].last_seen  = 0;
+	}
 
-#ifdef COMPAT15
-		if ( nffile->block_header->id == DATA_BLOCK_TYPE_1 ) {
-			common_record_v1_t *v1_record = (common_record_v1_t *)nffile->buff_ptr;
-			// create an extension map for v1 blocks
-			if ( v1_map_done == 0 ) {
-				extension_map_t *map = malloc(sizeof(extension_map_t) + 2 * sizeof(uint16_t) );
-				if ( ! map ) {
-					LogError("malloc() allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-					exit(255);
+	master_record = &worker->master_record;
+	flow_record = (common_record_t *)((pointer_addr_t)block->block_header + sizeof(data_block_header_t));
+	for ( i=0; i < block->block_header->NumRecords; i++ ) {
+		switch ( flow_record->type ) { 
+			case CommonRecordType: {
+				generic_exporter_t *exp_info = exporter_list[flow_record->exporter_sysid];
+				extension_info_t *extension_info = extension_map_list->slot[flow_record->ext_map];
+
+				if ( extension_info == NULL ) {
+					LogError("Corrupt data file. Missing extension map %u. Skip record.\n", flow_record->ext_map);
+					break;
+				} 
+
+				// a different map may leave other fields behind
+				if ( extension_info != worker->last_info ) {
+					memset((void *)master_record, 0, sizeof(master_record_t));
+					worker->last_info = extension_info;
 				}
-				map->type 	= ExtensionMapType;
-				map->size 	= sizeof(extension_map_t) + 2 * sizeof(uint16_t);
-				if (( map->size & 0x3 ) != 0 ) {
-					map->size += 4 - ( map->size & 0x3 );
+				ExpandRecord_v2( flow_record, extension_info, exp_info ? &(exp_info->info) : NULL, master_record);
+
+				// apply all profile filters at once
+				RunFilterSet(worker->filter_set, (uint64_t *)master_record, worker->match);
+
+				for ( j=0; j < num_channels; j++ ) {
+					if ( !worker->match[j] )
+						continue;
+					UpdateStat(&block->stat_record[j], master_record);
+					block->match[j*words + (i >> 6)] |= 1LL << (i & 0x3F);
 				}
-				
-				map->map_id = INIT_ID;
-				map->ex_id[0]  = EX_IO_SNMP_2;
-				map->ex_id[1]  = EX_AS_2;
-				map->ex_id[2]  = 0;
-
-				map->extension_size  = 0;
-				map->extension_size += extension_descriptor[EX_IO_SNMP_2].size;
-				map->extension_size += extension_descriptor[EX_AS_2].size;
-				
+				} break;
+			case ExtensionMapType: {
+				extension_map_t *map = (extension_map_t *)flow_record;
+
 				if ( Insert_Extension_Map(extension_map_list, map) ) {
-					int j;
 					for ( j=0; j < num_channels; j++ ) {
-						if ( channels[j].nffile != NULL) {
-							// flush new map
-							AppendToBuffer(channels[j].nffile, (void *)map, map->size);
-						}
+						// flush new map
+						if ( channels[j].nffile != NULL ) 
+							block->match[j*words + (i >> 6)] |= 1LL << (i & 0x3F);
 					}
 				} // else map already known and flushed
-			
-				v1_map_done = 1;
+				} break; 
+			case ExporterInfoRecordType: {
+				int ret = AddExporterInfo((exporter_info_record_t *)flow_record);
+				if ( ret != 0 ) {
+					for ( j=0; j < num_channels; j++ ) {
+						// flush new exporter
+						if ( channels[j].nffile != NULL && ret == 1) 
+							block->match[j*words + (i >> 6)] |= 1LL << (i & 0x3F);
+					}
+				} else {
+					LogError("Failed to add Exporter Record\n");
+				}
+				} break;
+			case SamplerInfoRecordype: {
+				int ret = AddSamplerInfo((sampler_info_record_t *)flow_record);
+				if ( ret != 0 ) {
+					for ( j=0; j < num_channels; j++ ) {
+						// flush new sampler
+						if ( channels[j].nffile != NULL && ret == 1 ) 
+							block->match[j*words + (i >> 6)] |= 1LL << (i & 0x3F);
+					}
+				} else {
+					LogError("Failed to add Sampler Record\n");
+				}
+				} break;
+			case ExporterRecordType:
+			case SamplerRecordype:
+			case ExporterStatRecordType:
+					// Silently skip exporter records
+				break;
+			default:  {
+				LogError("Skip unknown record type %i\n", flow_record->type);
 			}
+		}
+		// Advance pointer by number of bytes for netflow record
+		flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);
+	}
 
-			// convert the records to v2
-			for ( i=0; i < nffile->block_header->NumRecords; i++ ) {
-				common_record_t *v2_record = (common_record_t *)v1_record;
-				Convert_v1_to_v2((void *)v1_record);
-				// now we have a v2 record -> use size of v2_record->size
-				v1_record = (common_record_v1_t *)((pointer_addr_t)v1_record + v2_record->size);
-			}
-			nffile->block_header->id = DATA_BLOCK_TYPE_2;
+} // End of FilterProfileBlock
+
+/*
+ * Check if a block contains records, which modify extension maps, exporter or sampler lists.
+ */
+static int HasMetaRecords(data_block_header_t *block_header) {
+common_record_t	*flow_record;
+uint32_t	i;
+
+	flow_record = (common_record_t *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+	for ( i=0; i < block_header->NumRecords; i++ ) {
+		switch ( flow_record->type ) {
+			case ExtensionMapType:
+			case ExporterInfoRecordType:
+			case SamplerInfoRecordype:
+				return 1;
 		}
-#endif
+		flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);
+	}
+	return 0;
 
-		if ( nffile->block_header->id == Large_BLOCK_Type ) {
-			// skip
-			continue;
+} // End of HasMetaRecords
+
+/*
+ * A block is filtered. Pass all blocks in sequence to the writers
+ */
+static void ProfileBlockDone(profile_ctx_t *ctx, profile_block_t *block) {
+profile_block_t *next;
+unsigned int j;
+
+	pthread_mutex_lock(&ctx->seq_mutex);
+	ctx->pending[block->seq % ctx->numBlocks] = block;
+	while ( (next = ctx->pending[ctx->next_seq % ctx->numBlocks]) != NULL ) {
+		ctx->pending[ctx->next_seq % ctx->numBlocks] = NULL;
+		next->refcnt = ctx->num_channels;
+		// writer queues hold all blocks - never blocks
+		for ( j=0; j < ctx->num_channels; j++ ) 
+			queue_push(ctx->writerQueue[j], (void *)next);
+		ctx->next_seq++;
+	}
+	pthread_cond_broadcast(&ctx->seq_cond);
+	pthread_mutex_unlock(&ctx->seq_mutex);
+
+} // End of ProfileBlockDone
+
+/*
+ * Wait until all blocks up to seq are filtered
+ */
+static void DrainProfileBlocks(profile_ctx_t *ctx, uint64_t seq) {
+
+	pthread_mutex_lock(&ctx->seq_mutex);
+	while ( ctx->next_seq < seq ) 
+		pthread_cond_wait(&ctx->seq_cond, &ctx->seq_mutex);
+	pthread_mutex_unlock(&ctx->seq_mutex);
+
+} // End of DrainProfileBlocks
+
+static void *FilterWorker(void *arg) {
+profile_worker_t *worker = (profile_worker_t *)arg;
+profile_ctx_t *ctx = worker->ctx;
+profile_block_t *block;
+
+	while ( (block = queue_pop(ctx->workQueue)) != QUEUE_CLOSED ) {
+		FilterProfileBlock(ctx, block, worker);
+		ProfileBlockDone(ctx, block);
+	}
+
+	return NULL;
+
+} // End of FilterWorker
+
+static void *ChannelWriter(void *arg) {
+profile_worker_t *worker = (profile_worker_t *)arg;
+profile_ctx_t *ctx = worker->ctx;
+profile_channel_info_t *channel = &ctx->channels[worker->channel];
+profile_block_t *block;
+common_record_t	*flow_record;
+uint64_t *bitmap;
+uint32_t i;
+
+	while ( (block = queue_pop(ctx->writerQueue[worker->channel])) != QUEUE_CLOSED ) {
+		// shadow profiles do not have files.
+		if ( channel->nffile != NULL ) {
+			bitmap = block->match + worker->channel * block->words;
+			flow_record = (common_record_t *)((pointer_addr_t)block->block_header + sizeof(data_block_header_t));
+			for ( i=0; i < block->block_header->NumRecords; i++ ) {
+				if ( bitmap[i >> 6] & (1LL << (i & 0x3F)) ) 
+					AppendToBuffer(channel->nffile, (void *)flow_record, flow_record->size);
+				flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);
+			}
 		}
 
-		if ( nffile->block_header->id != DATA_BLOCK_TYPE_2 ) {
-			LogError("Can't process block type %u. Skip block.\n", nffile->block_header->id);
-			continue;
+		if ( block->stat_record[worker->channel].numflows ) {
+			SumStatRecords(&channel->stat_record, &block->stat_record[worker->channel]);
+			if ( channel->nffile ) 
+				SumStatRecords(channel->nffile->stat_record, &block->stat_record[worker->channel]);
 		}
 
-		flow_record = nffile->buff_ptr;
-		for ( i=0; i < nffile->block_header->NumRecords; i++ ) {
-			switch ( flow_record->type ) { 
-					case CommonRecordType: {
-					generic_exporter_t *exp_info = exporter_list[flow_record->exporter_sysid];
-					uint32_t map_id = flow_record->ext_map;
-					master_record_t	*master_record;
-
-					if ( extension_map_list->slot[map_id] == NULL ) {
-						LogError("Corrupt data file. Missing extension map %u. Skip record.\n", flow_record->ext_map);
-						flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);	
-						continue;
-					} 
-	
-					master_record = &(extension_map_list->slot[map_id]->master_record);
-					ExpandRecord_v2( flow_record, extension_map_list->slot[flow_record->ext_map], 
-						exp_info ? &(exp_info->info) : NULL, master_record);
+		// last writer returns the block
+		if ( __sync_sub_and_fetch(&block->refcnt, 1) == 0 ) 
+			queue_push(ctx->freeQueue, (void *)block);
+	}
 
-					for ( j=0; j < num_channels; j++ ) {
-						int match;
-	
-						// apply profile filter
-						(channels[j].engine)->nfrecord 	= (uint64_t *)master_record;
-						engine = channels[j].engine;
-						match = (*engine->FilterEngine)(engine);
-	
-						// if profile filter failed -> next profile
-						if ( !match )
-							continue;
-	
-						// filter was successful -> continue record processing
-	
-						// update statistics
-						UpdateStat(&channels[j].stat_record, master_record);
-						if ( channels[j].nffile ) 
-							UpdateStat(channels[j].nffile->stat_record, master_record);
-	
-						// do we need to write data to new file - shadow profiles do not have files.
-						// check if we need to flush the output buffer
-						if ( channels[j].nffile != NULL ) {
-							// write record to output buffer
-							AppendToBuffer(channels[j].nffile, (void *)flow_record, flow_record->size);
-						} 
-	
-					} // End of for all channels
-	
-					} break;
-				case ExtensionMapType: {
-					extension_map_t *map = (extension_map_t *)flow_record;
-	
-					if ( Insert_Extension_Map(extension_map_list, map) ) {
-						int j;
-						for ( j=0; j < num_channels; j++ ) {
-							if ( channels[j].nffile != NULL ) {
-								// flush new map
-								AppendToBuffer(channels[j].nffile, (void *)map, map->size);
-							}
-						}
-					} // else map already known and flushed
-	
-					} break; 
-				case ExporterInfoRecordType: {
-					int ret = AddExporterInfo((exporter_info_record_t *)flow_record);
-					if ( ret != 0 ) {
-						int j;
-						for ( j=0; j < num_channels; j++ ) {
-							if ( channels[j].nffile != NULL && ret == 1) {
-								// flush new exporter
-								AppendToBuffer(channels[j].nffile, (void *)flow_record, flow_record->size);
-							}
-						}
-					} else {
-						LogError("Failed to add Exporter Record\n");
-					}
-					} break;
-				case SamplerInfoRecordype: {
-					int ret = AddSamplerInfo((sampler_info_record_t *)flow_record);
-					if ( ret != 0 ) {
-						int j;
-						for ( j=0; j < num_channels; j++ ) {
-							if ( channels[j].nffile != NULL && ret == 1 ) {
-								// flush new map
-								AppendToBuffer(channels[j].nffile, (void *)flow_record, flow_record->size);
-							}
-						}
-					} else {
-						LogError("Failed to add Sampler Record\n");
-					}
-					} break;
-				case ExporterRecordType:
-				case SamplerRecordype:
-				case ExporterStatRecordType:
-						// Silently skip exporter records
-					break;
-				default:  {
-					LogError("Skip unknown record type %i\n", flow_record->type);
-				}
-			}
-			// Advance pointer by number of bytes for netflow record
-			flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);
+	// flush output buffer
+	if ( channel->nffile != NULL && channel->nffile->block_header->NumRecords ) {
+		if ( WriteBlock(channel->nffile) <= 0 ) {
+			LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
+		} 
+	}
 
-		} // End of for all umRecords
-	} // End of while !done
+	return NULL;
 
-	// do we need to write data to new file - shadow profiles do not have files.
-	for ( j=0; j < num_channels; j++ ) {
-		if ( channels[j].nffile != NULL ) {
-			// flush output buffer
-			if ( channels[j].nffile->block_header->NumRecords ) {
-				if ( WriteBlock(channels[j].nffile) <= 0 ) {
-					LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
-				} 
-			} 
+} // End of ChannelWriter
+
+/*
+ * Pass the next data block to the filter workers
+ */
+static int profile_block(void *data, data_block_header_t *block_header) {
+profile_ctx_t	*ctx = (profile_ctx_t *)data;
+profile_block_t	*block;
+
+	if ( block_header->id == DATA_BLOCK_TYPE_1 ) {
+		// v1 records are converted in place with a shared extension map, which
+		// the filter threads can not do. These blocks are skipped - see nfprofile(1)
+		LogError("Can't process nfdump 1.5.x block type 1 with filter threads. Skip block.\n");
+		return SCAN_SKIP;
+	}
+
+	// other block types are skipped by the scan
+	if ( block_header->id != DATA_BLOCK_TYPE_2 ) 
+		return SCAN_CONTINUE;
+
+	block = queue_pop(ctx->freeQueue);
+	memcpy((void *)block->block_header, (void *)block_header, sizeof(data_block_header_t) + block_header->size);
+	block->seq = ctx->seq++;
+
+	if ( HasMetaRecords(block->block_header) ) {
+		// extension maps, exporter and sampler lists are modified
+		// wait for all workers and process this block ourself
+		DrainProfileBlocks(ctx, block->seq);
+		FilterProfileBlock(ctx, block, ctx->reader);
+		ProfileBlockDone(ctx, block);
+	} else {
+		queue_push(ctx->workQueue, (void *)block);
+	}
+
+	// the records are processed by the workers
+	return SCAN_SKIP;
+
+} // End of profile_block
+
+static void process_data_mt(profile_channel_info_t *channels, unsigned int num_channels, int num_workers) {
+profile_ctx_t		ctx;
+profile_worker_t	*workers, *writers, reader;
+profile_block_t		*block;
+FilterSet_t			*channel_filters;
+scan_t				scan;
+int 		i, err;
+
+	channel_filters = GetChannelFilterSet();
+
+	memset((void *)&ctx, 0, sizeof(profile_ctx_t));
+	ctx.channels	 = channels;
+	ctx.num_channels = num_channels;
+	ctx.numBlocks	 = 2 * num_workers + 2;
+	ctx.next_seq	 = 0;
+	ctx.reader		 = &reader;
+	pthread_mutex_init(&ctx.seq_mutex, NULL);
+	pthread_cond_init(&ctx.seq_cond, NULL);
+
+	ctx.freeQueue	= queue_init(ctx.numBlocks);
+	ctx.workQueue	= queue_init(ctx.numBlocks);
+	ctx.writerQueue = (queue_t **)calloc(num_channels, sizeof(queue_t *));
+	ctx.pending		= (profile_block_t **)calloc(ctx.numBlocks, sizeof(profile_block_t *));
+	workers = (profile_worker_t *)calloc(num_workers, sizeof(profile_worker_t));
+	writers = (profile_worker_t *)calloc(num_channels, sizeof(profile_worker_t));
+	if ( !ctx.freeQueue || !ctx.workQueue || !ctx.writerQueue || !ctx.pending || !workers || !writers ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	for ( i=0; i < ctx.numBlocks; i++ ) {
+		block = (profile_block_t *)calloc(1, sizeof(profile_block_t));
+		if ( !block ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		block->block_header = (data_block_header_t *)malloc(BUFFSIZE + sizeof(data_block_header_t));
+		block->stat_record  = (stat_record_t *)calloc(num_channels, sizeof(stat_record_t));
+		if ( !block->block_header || !block->stat_record ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
 		}
+		queue_push(ctx.freeQueue, (void *)block);
 	}
-	CloseFile(nffile);
-	DisposeFile(nffile);
 
-} // End of process_data
+	// the reader filters blocks with meta records itself
+	memset((void *)&reader, 0, sizeof(profile_worker_t));
+	reader.ctx		  = &ctx;
+	reader.filter_set = channel_filters;
+	reader.match	  = (uint8_t *)malloc(num_channels * sizeof(uint8_t));
+	if ( !reader.match ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	for ( i=0; i < num_channels; i++ ) {
+		ctx.writerQueue[i] = queue_init(ctx.numBlocks);
+		if ( !ctx.writerQueue[i] ) 
+			exit(255);
+		writers[i].ctx	   = &ctx;
+		writers[i].channel = i;
+		err = pthread_create(&writers[i].tid, NULL, ChannelWriter, (void *)&writers[i]);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err) );
+			exit(255);
+		}
+	}
+
+	for ( i=0; i < num_workers; i++ ) {
+		workers[i].ctx		  = &ctx;
+		workers[i].filter_set = CloneFilterSet(channel_filters);
+		workers[i].match	  = (uint8_t *)malloc(num_channels * sizeof(uint8_t));
+		if ( !workers[i].match ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		err = pthread_create(&workers[i].tid, NULL, FilterWorker, (void *)&workers[i]);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err) );
+			exit(255);
+		}
+	}
+
+	memset((void *)&scan, 0, sizeof(scan_t));
+	scan.extension_map_list	= extension_map_list;
+	scan.data				= (void *)&ctx;
+	scan.file				= profile_file;
+	scan.block				= profile_block;
+
+	ScanFiles(&scan);
+
+	queue_close(ctx.workQueue);
+	for ( i=0; i < num_workers; i++ ) {
+		pthread_join(workers[i].tid, NULL);
+		DisposeFilterSet(workers[i].filter_set);
+		free(workers[i].match);
+	}
+
+	// writers flush their output buffers
+	for ( i=0; i < num_channels; i++ ) {
+		queue_close(ctx.writerQueue[i]);
+		pthread_join(writers[i].tid, NULL);
+		queue_free(ctx.writerQueue[i]);
+	}
+
+	for ( i=0; i < ctx.numBlocks; i++ ) {
+		block = queue_pop(ctx.freeQueue);
+		free(block->block_header);
+		free(block->stat_record);
+		free(block->match);
+		free(block);
+	}
+	queue_free(ctx.freeQueue);
+	queue_free(ctx.workQueue);
+	pthread_mutex_destroy(&ctx.seq_mutex);
+	pthread_cond_destroy(&ctx.seq_cond);
+	free(ctx.writerQueue);
+	free(ctx.pending);
+	free(workers);
+	free(writers);
+	free(reader.match);
+
+} // End of process_data_mt
 
 static profile_param_info_t *ParseParams (char *profile_datadir) {
 struct stat stat_buf;
@@ -518,12 +854,13 @@ profile_param_info_t **list = &profile_list;
 } // End of ParseParams
 
 int main( int argc, char **argv ) {
-unsigned int		num_channels, compress;
+unsigned int		num_channels;
+int					compress;
 struct stat stat_buf;
 profile_param_info_t *profile_list;
 char *rfile, *ffile, *filename, *Mdirs;
 char	*profile_datadir, *profile_statdir, *nameserver;
-int c, syntax_only, subdir_index, stdin_profile_params;
+int c, syntax_only, subdir_index, stdin_profile_params, num_workers;
 time_t tslot;
 
 	profile_datadir = NULL;
@@ -537,6 +874,7 @@ time_t tslot;
 	nameserver		= NULL;
 	stdin_profile_params = 0;
 	is_anonymized	= 0;
+	num_workers		= 0;
 
 	strncpy(Ident, "none", IDENTLEN);
 	Ident[IDENTLEN-1] = '\0';
@@ -544,7 +882,7 @@ time_t tslot;
 	// default file names
 	ffile = "filter.txt";
 	rfile = NULL;
-	while ((c = getopt(argc, argv, "D:HIL:p:P:hif:J;r:n:M:S:t:VzZ")) != EOF) {
+	while ((c = getopt(argc, argv, "D:HIL:p:P:hif:jyr:n:M:S:t:VW:z::Z")) != EOF) {
 		switch (c) {
 			case 'h':
 				usage(argv[0]);
@@ -588,6 +926,13 @@ time_t tslot;
 			case 'M':
 				Mdirs = optarg;
 				break;
+			case 'W':
+				num_workers = atoi(optarg);
+				if ( num_workers < 1 || num_workers > MAXWORKERS ) {
+					LogError("Number of filter threads out of range 1..%d\n", MAXWORKERS);
+					exit(255);
+				}
+				break;
 			case 'r':
 				rfile = optarg;
 				break;
@@ -610,7 +955,9 @@ time_t tslot;
 					LogError("Use one compression: -z for LZO, -j for BZ2 or -y for LZ4 compression\n");
 					exit(255);
 				}
-				compress = LZO_COMPRESSED;
+				compress = ParseCompression(optarg);
+				if ( compress < 0 )
+					exit(255);
 				break;
 #ifdef HAVE_INFLUXDB
 			case 'i':
@@ -694,11 +1041,25 @@ time_t tslot;
 		exit(255);
 	}
 
+#ifdef HAVE_INFLUXDB
+	// curl_global_init() is not thread safe - call it before any thread is started
+	if ( strlen(influxdb_url) > 0 )
+		curl_global_init(CURL_GLOBAL_ALL);
+#endif
+
 	SetupInputFileSequence(Mdirs,rfile, NULL);
 
-	process_data(GetChannelInfoList(), num_channels, tslot);
+	if ( num_workers ) 
+		process_data_mt(GetChannelInfoList(), num_channels, num_workers);
+	else
+		process_data(GetChannelInfoList(), num_channels, tslot);
+
+	CloseChannels(tslot, compress, num_workers);
 
-	CloseChannels(tslot, compress);
+#ifdef HAVE_INFLUXDB
+	if ( strlen(influxdb_url) > 0 )
+		curl_global_cleanup();
+#endif
 
 	FreeExtensionMaps(extension_map_list);
 
@@ -0,0 +1,654 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+/*
+ * nfrepack recompresses a sequence of nfdump files in place and optionally
+ * merges consecutive files of a directory into larger files.
+ *
+ * Multi-threaded processing:
+ * The reader ( main thread ) reads the raw data blocks of all files in sequence and
+ * passes them to the workers, which uncompress each block and compress it again with
+ * the new method. The reader appends the recoded blocks in sequence to the output files.
+ * Markers in the ring of blocks in flight close input and output files, as soon as all
+ * blocks before are written, so the workers keep busy across file boundaries.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <string.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nffile.h"
+#include "util.h"
+#include "flist.h"
+#include "nfstatfile.h"
+#include "blockpipe.h"
+
+#define MAXWORKERS 64
+
+// max. number of directory levels searched upwards for the .nfstat file of a data dir
+#define MAXSTATDEPTH 6
+
+typedef struct repack_output_s {
+	nffile_t	*nffile_w;
+	char		filename[MAXPATHLEN];	// final name - the name of the first input file
+	char		tmpfile[MAXPATHLEN];
+	char		ident[IDENTLEN];
+	char		**inputs;				// input files merged into this output
+	int			num_inputs;
+	int			anonymized;
+	int			error;
+} repack_output_t;
+
+/*
+ * The blocks of all input files pass an ordered block pipe. The workers recode the blocks
+ * in place, while the writer appends them in sequence to the outputs. Blocks copied 
+ * unchanged as well as the markers for the end of an input file or an output file pass
+ * the pipe without being processed. pipe_block_t: input is the input file, output the
+ * repack output of the block.
+ */
+enum { BLOCK_RECODE = 0, BLOCK_RAW, END_OF_INPUT, END_OF_OUTPUT };
+
+// changes of the data dirs for the bookkeeping
+typedef struct repack_books_s {
+	struct repack_books_s	*next;
+	char					*datadir;
+	int64_t					size;
+	int64_t					numfiles;
+	dircatalog_record_t		*changes;		// changed and removed files for the catalog
+	uint64_t				numchanges;
+	uint64_t				maxchanges;
+	int						catalog_invalid;
+} repack_books_t;
+
+// module limited globals
+static repack_books_t	*books		= NULL;
+static int				verbose		= 0;
+static uint64_t			files_done	= 0;
+static uint32_t			num_outputs = 0;
+
+/* Function Prototypes */
+static void usage(char *name);
+
+static void *NewRepackWorker(void);
+
+static void DisposeRepackWorker(void *worker_data);
+
+static void RecodeRepackBlock(void *worker_data, pipe_block_t *block);
+
+static repack_books_t *GetBooks(char *filename);
+
+static void BookFile(repack_books_t *b, char *filename, uint64_t size);
+
+static void WriteBooks(void);
+
+static repack_output_t *NewOutput(char *filename, nffile_t *nffile_r, int compress);
+
+static void AddInput(repack_output_t *output, char *filename, nffile_t *nffile_r);
+
+static void CloseOutput(repack_output_t *output);
+
+static void WriteRepackBlock(pipe_block_t *block);
+
+static void DispatchMarker(blockpipe_t *bpipe, int type, nffile_t *nffile_r, repack_output_t *output);
+
+static void process_files(int compress, int merge, int num_workers);
+
+/* Functions */
+
+static void usage(char *name) {
+		printf("usage %s [options] \n"
+					"-h\t\tthis text you see right here\n"
+					"-r\t\tread input from file\n"
+					"-M <expr>\tRead input from multiple directories.\n"
+					"-R <expr>\tRead input from sequence of files.\n"
+					"-J <method>\tNew compression: none, lzo, bz2, lz4 or zstd[:level[:dictfile]]\n"
+					"-m <num>\tMerge up to <num> consecutive files of a directory into one file.\n"
+					"-W <num>\tUse <num> threads. Default: number of CPUs.\n"
+					"-v\t\tverbose: print each output file.\n"
+					, name);
+} /* usage */
+
+static void *NewRepackWorker(void) {
+nffile_t *codec;
+
+	codec = NewBlockCodec();
+	if ( !codec ) {
+		exit(255);
+	}
+
+	return (void *)codec;
+
+} // End of NewRepackWorker
+
+static void DisposeRepackWorker(void *worker_data) {
+nffile_t *codec = (nffile_t *)worker_data;
+
+	DisposeFile(codec);
+	free(codec);
+
+} // End of DisposeRepackWorker
+
+static void RecodeRepackBlock(void *worker_data, pipe_block_t *block) {
+repack_output_t *output = (repack_output_t *)block->output;
+
+	block->error = RecodeBlock((nffile_t *)worker_data, (nffile_t *)block->input, output->nffile_w, block->block_header) < 0;
+
+} // End of RecodeRepackBlock
+
+/*
+ * Get the books of the data dir of filename. The data dir is the first directory upwards,
+ * which has a .nfstat file - nfcapd may store the files in sub directories.
+ * returns NULL, if the file is not in a data dir
+ */
+static repack_books_t *GetBooks(char *filename) {
+repack_books_t	*b;
+char			path[MAXPATHLEN], statfile[MAXPATHLEN], *dir;
+int				i;
+
+	strncpy(path, filename, MAXPATHLEN-1);
+	path[MAXPATHLEN-1] = '\0';
+	dir = dirname(path);
+
+	for ( i=0; i < MAXSTATDEPTH; i++ ) {
+		snprintf(statfile, MAXPATHLEN-1, "%s/%s", dir, stat_filename);
+		statfile[MAXPATHLEN-1] = '\0';
+		if ( access(statfile, F_OK) == 0 ) 
+			break;
+		if ( strcmp(dir, "/") == 0 || strcmp(dir, ".") == 0 )
+			return NULL;
+		dir = dirname(dir);
+	}
+	if ( i == MAXSTATDEPTH ) 
+		return NULL;
+
+	for ( b = books; b != NULL; b = b->next ) {
+		if ( strcmp(b->datadir, dir) == 0 )
+			break;
+	}
+
+	if ( b == NULL ) {
+		b = (repack_books_t *)calloc(1, sizeof(repack_books_t));
+		if ( !b || !(b->datadir = strdup(dir)) ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		b->next = books;
+		books	= b;
+	}
+
+	return b;
+
+} // End of GetBooks
+
+/*
+ * Record the new size of a file for the catalog of the data dir. Size 0 removes the file
+ */
+static void BookFile(repack_books_t *b, char *filename, uint64_t size) {
+dircatalog_record_t *change;
+size_t len;
+char *relpath;
+
+	len = strlen(b->datadir);
+	if ( strcmp(b->datadir, ".") == 0 ) {
+		relpath = filename;
+	} else if ( strncmp(filename, b->datadir, len) == 0 && filename[len] == '/' ) {
+		relpath = filename + len;
+		while ( *relpath == '/' )
+			relpath++;
+	} else {
+		relpath = NULL;
+	}
+
+	if ( !relpath || strlen(relpath) >= CATALOG_PATHLEN ) {
+		// the file can not be found in the catalog
+		b->catalog_invalid = 1;
+		return;
+	}
+
+	if ( b->numchanges == b->maxchanges ) {
+		b->maxchanges = b->maxchanges ? 2 * b->maxchanges : 64;
+		b->changes = realloc(b->changes, b->maxchanges * sizeof(dircatalog_record_t));
+		if ( !b->changes ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+	}
+	change = &b->changes[b->numchanges++];
+	memset((void *)change, 0, sizeof(dircatalog_record_t));
+	change->size = size;
+	strncpy(change->path, relpath, CATALOG_PATHLEN-1);
+
+} // End of BookFile
+
+static void WriteBooks(void) {
+repack_books_t	*b;
+dirstat_t		*dirstat;
+
+	for ( b = books; b != NULL; b = b->next ) {
+		if ( ReadStatInfo(b->datadir, &dirstat, LOCK_IF_EXISTS) != STATFILE_OK ) {
+			LogError("Failed to update stat file in '%s'. Run nfexpire -r to rebuild", b->datadir);
+			continue;
+		}
+
+		if ( b->size < 0 && (uint64_t)(-b->size) > dirstat->filesize )
+			dirstat->filesize = 0;
+		else
+			dirstat->filesize += b->size;
+
+		if ( b->numfiles < 0 && (uint64_t)(-b->numfiles) > dirstat->numfiles )
+			dirstat->numfiles = 0;
+		else
+			dirstat->numfiles += b->numfiles;
+
+		WriteStatInfo(dirstat);
+		ReleaseStatInfo(dirstat);
+
+		// the catalog must not keep the sizes of the old files for nfexpire
+		if ( b->catalog_invalid ) {
+			char path[MAXPATHLEN];
+			snprintf(path, MAXPATHLEN-1, "%s/%s", b->datadir, catalog_filename);
+			path[MAXPATHLEN-1] = '\0';
+			// removing the catalog forces a rescan with the next nfexpire run
+			unlink(path);
+		} else if ( b->numchanges && UpdateCatalog(b->datadir, b->changes, b->numchanges) < 0 ) {
+			LogError("Failed to update catalog in '%s'. Run nfexpire -r to rebuild", b->datadir);
+		}
+
+		if ( verbose )
+			printf("Updated stat file in '%s'\n", b->datadir);
+	}
+
+} // End of WriteBooks
+
+static repack_output_t *NewOutput(char *filename, nffile_t *nffile_r, int compress) {
+repack_output_t *output;
+char dir[MAXPATHLEN];
+
+	output = (repack_output_t *)calloc(1, sizeof(repack_output_t));
+	if ( !output ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	strncpy(output->filename, filename, MAXPATHLEN-1);
+	// name the tmp file like a running collector file, so the file lister skips it
+	strncpy(dir, filename, MAXPATHLEN-1);
+	dir[MAXPATHLEN-1] = '\0';
+	// several outputs are open at the same time - each one needs its own tmp file
+	snprintf(output->tmpfile, MAXPATHLEN-1, "%s/%s.repack.%lu.%u", dirname(dir), NF_DUMPFILE, 
+		(unsigned long)getpid(), num_outputs++);
+	output->tmpfile[MAXPATHLEN-1] = '\0';
+	memcpy(output->ident, nffile_r->file_header->ident, IDENTLEN);
+	output->ident[IDENTLEN-1] = '\0';
+	output->anonymized = IP_ANONYMIZED(nffile_r);
+
+	output->nffile_w = OpenNewFile(output->tmpfile, NULL, compress, output->anonymized, NULL);
+	if ( !output->nffile_w ) {
+		free(output);
+		return NULL;
+	}
+
+	return output;
+
+} // End of NewOutput
+
+static void AddInput(repack_output_t *output, char *filename, nffile_t *nffile_r) {
+
+	output->inputs = realloc(output->inputs, (output->num_inputs + 1) * sizeof(char *));
+	if ( !output->inputs || !(output->inputs[output->num_inputs] = strdup(filename)) ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	output->num_inputs++;
+
+	SumStatRecords(output->nffile_w->stat_record, nffile_r->stat_record);
+
+} // End of AddInput
+
+/*
+ * All blocks of the output are written - replace the input files
+ * The first input is replaced by the output, the other inputs are removed
+ * only, after the output is in place.
+ */
+static void CloseOutput(repack_output_t *output) {
+repack_books_t *b;
+struct stat stat_buf;
+uint64_t old_size, new_size, size;
+int i, removed;
+
+	if ( output->error || !CloseUpdateFile(output->nffile_w, output->ident) ) {
+		LogError("Failed to repack '%s'. Files left unchanged\n", output->filename);
+		unlink(output->tmpfile);
+	} else {
+		old_size = stat(output->filename, &stat_buf) == 0 ? 512 * stat_buf.st_blocks : 0;
+		new_size = stat(output->tmpfile, &stat_buf) == 0 ? 512 * stat_buf.st_blocks : 0;
+
+		if ( rename(output->tmpfile, output->filename) < 0 ) {
+			LogError("rename() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			LogError("Failed to repack '%s'. Files left unchanged\n", output->filename);
+			unlink(output->tmpfile);
+		} else {
+			b = GetBooks(output->filename);
+			if ( b ) 
+				BookFile(b, output->filename, new_size);
+
+			removed = 0;
+			for ( i=1; i < output->num_inputs; i++ ) {
+				size = stat(output->inputs[i], &stat_buf) == 0 ? 512 * stat_buf.st_blocks : 0;
+				if ( unlink(output->inputs[i]) < 0 ) {
+					// the records are in the output as well - nfdump would read them twice
+					LogError("unlink() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+					LogError("Remove '%s' - its records are merged into '%s'\n", output->inputs[i], output->filename);
+					continue;
+				}
+				old_size += size;
+				removed++;
+				if ( b ) 
+					BookFile(b, output->inputs[i], 0);
+			}
+			if ( b ) {
+				b->size		+= (int64_t)new_size - (int64_t)old_size;
+				b->numfiles -= removed;
+			}
+			files_done += output->num_inputs;
+
+			if ( verbose ) {
+				if ( output->num_inputs > 1 )
+					printf("%s: %d files merged. Size %llu -> %llu\n", output->filename, output->num_inputs, 
+						(unsigned long long)old_size, (unsigned long long)new_size);
+				else
+					printf("%s: Size %llu -> %llu\n", output->filename, 
+						(unsigned long long)old_size, (unsigned long long)new_size);
+			}
+		}
+	}
+
+	for ( i=0; i < output->num_inputs; i++ ) 
+		free(output->inputs[i]);
+	free(output->inputs);
+	DisposeFile(output->nffile_w);
+	free(output->nffile_w);
+	free(output);
+
+} // End of CloseOutput
+
+/*
+ * Write the next block in sequence or process the marker
+ */
+static void WriteRepackBlock(pipe_block_t *block) {
+repack_output_t *output = (repack_output_t *)block->output;
+nffile_t		*nffile_r = (nffile_t *)block->input;
+
+	switch (block->type) {
+		case BLOCK_RECODE:
+		case BLOCK_RAW:
+			if ( block->error ) {
+				output->error = 1;
+			} else if ( !output->error && WriteRawBlock(output->nffile_w, block->block_header) <= 0 ) {
+				LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
+				output->error = 1;
+			}
+			break;
+		case END_OF_INPUT:
+			CloseFile(nffile_r);
+			DisposeFile(nffile_r);
+			free(nffile_r);
+			break;
+		case END_OF_OUTPUT:
+			CloseOutput(output);
+			break;
+	}
+
+} // End of WriteRepackBlock
+
+static void DispatchMarker(blockpipe_t *bpipe, int type, nffile_t *nffile_r, repack_output_t *output) {
+pipe_block_t *block = NextPipeBlock(bpipe);
+
+	block->type	  = type;
+	block->input  = (void *)nffile_r;
+	block->output = (void *)output;
+	DispatchPipeBlock(bpipe, block, 0);
+
+} // End of DispatchMarker
+
+static void process_files(int compress, int merge, int num_workers) {
+blockpipe_t		*bpipe;
+repack_output_t	*output;
+nffile_t		*nffile_list, *nffile_r;
+char			*cfile, outdir[MAXPATHLEN], dir[MAXPATHLEN];
+int				merged;
+
+	// the file list handle is only used to walk the file sequence
+	nffile_list = GetNextFile(NULL, 0, 0);
+	if ( !nffile_list ) {
+		LogError("GetNextFile() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return;
+	}
+
+	// a recoded block may grow - reserve the same space as the nffile buffers
+	bpipe	= StartBlockPipe(num_workers, 2 * BUFFSIZE, 0, NewRepackWorker, DisposeRepackWorker, 
+				RecodeRepackBlock, WriteRepackBlock);
+	output	= NULL;
+	merged	= 0;
+	outdir[0] = '\0';
+	while ( nffile_list != EMPTY_LIST && nffile_list != NULL ) {
+		int raw, in_compress, out_compress, ret;
+
+		cfile = GetCurrentFilename();
+		if ( !cfile ) {
+			LogError("nfrepack does not read from stdin\n");
+			break;
+		}
+
+		// skip hidden files such as the .nfstat and .nfcatalog files of the data dir
+		strncpy(dir, cfile, MAXPATHLEN-1);
+		dir[MAXPATHLEN-1] = '\0';
+		if ( basename(dir)[0] == '.' ) {
+			nffile_list = GetNextFile(nffile_list, 0, 0);
+			continue;
+		}
+
+		nffile_r = OpenFile(cfile, NULL);
+		if ( !nffile_r ) {
+			nffile_list = GetNextFile(nffile_list, 0, 0);
+			continue;
+		}
+		in_compress = FILE_COMPRESSION(nffile_r);
+
+		strncpy(dir, cfile, MAXPATHLEN-1);
+		dir[MAXPATHLEN-1] = '\0';
+		strncpy(dir, dirname(dir), MAXPATHLEN-1);
+
+		// only files of the same directory with the same flags are merged
+		if ( output && (merged == merge || strcmp(dir, outdir) != 0 || 
+			 output->anonymized != IP_ANONYMIZED(nffile_r)) ) {
+			DispatchMarker(bpipe, END_OF_OUTPUT, NULL, output);
+			output = NULL;
+		}
+
+		if ( output == NULL ) {
+			if ( merge <= 1 && compress >= 0 && COMPRESSION_TYPE(compress) == in_compress && in_compress != ZSTD_COMPRESSED ) {
+				if ( verbose )
+					printf("File %s is already same compression method\n", cfile);
+				CloseFile(nffile_r);
+				DisposeFile(nffile_r);
+				free(nffile_r);
+				nffile_list = GetNextFile(nffile_list, 0, 0);
+				continue;
+			}
+
+			output = NewOutput(cfile, nffile_r, compress >= 0 ? compress : in_compress);
+			if ( !output ) {
+				CloseFile(nffile_r);
+				DisposeFile(nffile_r);
+				free(nffile_r);
+				break;
+			}
+			strncpy(outdir, dir, MAXPATHLEN-1);
+			outdir[MAXPATHLEN-1] = '\0';
+			merged = 0;
+		}
+		AddInput(output, cfile, nffile_r);
+		merged++;
+
+		// blocks are copied unchanged, if the compression does not change
+		out_compress = FILE_COMPRESSION(output->nffile_w);
+		raw = in_compress == out_compress && 
+			  !(nffile_r->file_header->flags & FLAG_ZSTD_DICT) && 
+			  !(output->nffile_w->file_header->flags & FLAG_ZSTD_DICT) &&
+			  ( in_compress != ZSTD_COMPRESSED || compress < 0 );
+
+		while ( 1 ) {
+			pipe_block_t *block = NextPipeBlock(bpipe);
+			ret = ReadRawBlock(nffile_r, block->block_header);
+			if ( ret <= 0 ) {
+				ReturnPipeBlock(bpipe);
+				if ( ret < 0 ) {
+					LogError("Error while reading data block of '%s'\n", cfile);
+					output->error = 1;
+				}
+				break;
+			}
+
+			block->input  = (void *)nffile_r;
+			block->output = (void *)output;
+			block->type	  = raw ? BLOCK_RAW : BLOCK_RECODE;
+			DispatchPipeBlock(bpipe, block, !raw);
+		}
+		DispatchMarker(bpipe, END_OF_INPUT, nffile_r, output);
+
+		nffile_list = GetNextFile(nffile_list, 0, 0);
+	}
+
+	if ( output ) 
+		DispatchMarker(bpipe, END_OF_OUTPUT, NULL, output);
+
+	StopBlockPipe(bpipe);
+
+	if ( nffile_list && nffile_list != EMPTY_LIST ) {
+		CloseFile(nffile_list);
+		DisposeFile(nffile_list);
+	}
+
+} // End of process_files
+
+int main( int argc, char **argv ) {
+char 		*rfile, *Rfile, *Mdirs;
+int			c, compress, merge, num_workers;
+
+	rfile = Rfile = Mdirs = NULL;
+	compress	= -1;
+	merge		= 1;
+	num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if ( num_workers < 1 )
+		num_workers = 1;
+	if ( num_workers > MAXWORKERS )
+		num_workers = MAXWORKERS;
+
+	while ((c = getopt(argc, argv, "hJ:m:r:M:R:vW:")) != EOF) {
+		switch (c) {
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+				break;
+			case 'J':
+				compress = ParseCompression(optarg);
+				if ( compress < 0 )
+					exit(255);
+				break;
+			case 'm':
+				merge = atoi(optarg);
+				if ( merge < 1 ) {
+					LogError("Number of files to merge must be > 0\n");
+					exit(255);
+				}
+				break;
+			case 'r':
+				rfile = optarg;
+				break;
+			case 'M':
+				Mdirs = optarg;
+				break;
+			case 'R':
+				Rfile = optarg;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			case 'W':
+				num_workers = atoi(optarg);
+				if ( num_workers < 1 || num_workers > MAXWORKERS ) {
+					LogError("Number of threads out of range 1..%d\n", MAXWORKERS);
+					exit(255);
+				}
+				break;
+			default:
+				usage(argv[0]);
+				exit(0);
+		}
+	}
+
+	if ( !rfile && !Rfile ) {
+		LogError("Expected -r <file> or -R <dir>\n");
+		exit(255);
+	}
+
+	if ( compress < 0 && merge <= 1 ) {
+		LogError("Nothing to do: expected -J <method> and/or -m <num>\n");
+		exit(255);
+	}
+
+	SetupInputFileSequence(Mdirs, rfile, Rfile);
+
+	process_files(compress, merge, num_workers);
+
+	WriteBooks();
+
+	if ( verbose )
+		printf("%llu files processed\n", (unsigned long long)files_done);
+
+	return 0;
+
+} // End of main
@@ -33,6 +33,9 @@
 
 #include "config.h"
 
+// for sendmmsg prototype
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -49,6 +52,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/resource.h>
+#include <sys/uio.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -70,10 +74,19 @@
 #include "flist.h"
 #include "util.h"
 #include "grammar.h"
+#include "nfscan.h"
 
 #define DEFAULTCISCOPORT "9995"
 #define DEFAULTHOSTNAME "127.0.0.1"
 
+#define MAXPEERS	16
+
+// number of packets sent with one sendmmsg() call
+#define SENDBATCH	64
+
+// close a partial packet, if the next flow is due later than this in original timing mode
+#define REPLAYFLUSH	10000000LL	// 10ms in nsec
+
 #undef	FPURGE
 #ifdef	HAVE___FPURGE
 #define	FPURGE	__fpurge
@@ -85,10 +98,6 @@
 /* Externals */
 extern int yydebug;
 
-#ifdef COMPAT15
-extern extension_descriptor_t extension_descriptor[];
-#endif
-
 /* Global Variables */
 FilterEngine_data_t	*Engine;
 int 		verbose;
@@ -96,8 +105,61 @@ int 		verbose;
 /* Local Variables */
 static const char *nfdump_version = VERSION;
 
+// output buffer of the netflow v5/v9 encoder
 send_peer_t peer;
 
+// all destinations - each packet is sent to all peers
+static send_peer_t	peers[MAXPEERS];
+static int			num_peers;
+
+/*
+ * Packets are collected in batches and sent to each peer with a single 
+ * sendmmsg() call, if available.
+ */
+static struct send_batch_s {
+	uint32_t		num;			// packets in batch
+	uint32_t		size;			// max packets in batch
+	void			*buff;			// SENDBATCH packets of UDP_PACKET_SIZE
+	size_t			len[SENDBATCH];
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr	msg[SENDBATCH];
+	struct iovec	iov[SENDBATCH];
+#endif
+} batch;
+
+/*
+ * Token bucket rate limiter for packets/s or flows/s
+ */
+typedef struct token_bucket_s {
+	double		rate;		// tokens per second - 0 = unlimited
+	double		burst;		// max number of tokens
+	double		tokens;		// available tokens
+	uint64_t	last;		// time of last refill in nsec
+} token_bucket_t;
+
+static token_bucket_t packet_bucket, flow_bucket;
+
+/*
+ * Replay flows with original timing, speed up by a factor
+ */
+static struct replay_clock_s {
+	double		speed;		// replay speed factor - 0 = off
+	uint64_t	flow_start;	// export time of the first flow in msec
+	uint64_t	wall_start;	// wall time of the first flow in nsec
+} replay_clock;
+
+/*
+ * State of the flows replayed by send_data()
+ */
+typedef struct replay_ctx_s {
+	uint32_t		count;			// max number of flows to send - 0 = all
+	uint32_t		numflows;		// flows sent
+	unsigned int	delay;
+	int				confirm;
+	int				netflow_version;
+	int				error;
+} replay_ctx_t;
+
 extension_map_list_t *extension_map_list;
 
 generic_exporter_t **exporter_list;
@@ -107,28 +169,49 @@ static void usage(char *name);
 
 static void send_blast(unsigned int delay );
 
+static int replay_flow(void *data, common_record_t *flow_record, master_record_t *master_record, 
+	extension_info_t *extension_info);
+
 static void send_data(char *rfile, time_t twin_start, time_t twin_end, uint32_t count, 
 				unsigned int delay,  int confirm, int netflow_version);
 
+static void add_peer(char *hostname, int mcast);
+
+static uint64_t NowNsec(void);
+
+static void SleepNsec(uint64_t nsec);
+
+static void InitTokenBucket(token_bucket_t *tb, double rate);
+
+static uint64_t TakeTokens(token_bucket_t *tb, double tokens);
+
+static uint64_t ReplayWait(master_record_t *master_record);
+
+static int InitSendBatch(uint32_t size);
+
+static int SendBatch(void);
+
 static int FlushBuffer(int confirm);
 
 /* Functions */
 
-#include "nffile_inline.c"
 #include "nfdump_inline.c"
 
 static void usage(char *name) {
 		printf("usage %s [options] [\"filter\"]\n"
 					"-h\t\tthis text you see right here\n"
 					"-V\t\tPrint version and exit.\n"
-					"-H <Host/ip>\tTarget IP address default: 127.0.0.1\n"
-					"-j <mcast>\tSend packets to multicast group\n"
+					"-H <Host/ip>\tTarget IP address default: 127.0.0.1. May be repeated.\n"
+					"-j <mcast>\tSend packets to multicast group. May be repeated.\n"
 					"-4\t\tForce IPv4 protocol.\n"
 					"-6\t\tForce IPv6 protocol.\n"
 					"-L <log>\tLog to syslog facility <log>\n"
 					"-p <port>\tTarget port default 9995\n"
-					"-d <usec>\tDelay in usec between packets. default 10\n"
-					"-c <cnt>\tPacket count. default send all packets\n"
+					"-d <usec>\tDelay in usec between packets. default 1, 0 with -P, -F or -T\n"
+					"-P <pps>\tLimit rate to <pps> packets/s\n"
+					"-F <fps>\tLimit rate to <fps> flows/s\n"
+					"-T <speed>\tReplay flows with original timing at <speed> times original speed\n"
+					"-c <cnt>\tFlow count. default send all flows\n"
 					"-b <bsize>\tSend buffer size.\n"
 					"-r <input>\tread from file. default: stdin\n"
 					"-f <filter>\tfilter syntaxfile\n"
@@ -138,9 +221,161 @@ static void usage(char *name) {
 					, name);
 } /* usage */
 
+static uint64_t NowNsec(void) {
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000LL + (uint64_t)ts.tv_nsec;
+
+} // End of NowNsec
+
+static void SleepNsec(uint64_t nsec) {
+struct timespec ts;
+
+	ts.tv_sec  = nsec / 1000000000LL;
+	ts.tv_nsec = nsec % 1000000000LL;
+	while ( nanosleep(&ts, &ts) < 0 && errno == EINTR )
+		;
+
+} // End of SleepNsec
+
+static void InitTokenBucket(token_bucket_t *tb, double rate) {
+
+	tb->rate   = rate;
+	// allow bursts of 10ms traffic but at least a full send batch
+	tb->burst  = rate / 100.0 > SENDBATCH ? rate / 100.0 : SENDBATCH;
+	tb->tokens = tb->burst;
+	tb->last   = NowNsec();
+
+} // End of InitTokenBucket
+
+/*
+ * Take tokens from the bucket. Returns the time in nsec to wait 
+ * until the tokens are available
+ */
+static uint64_t TakeTokens(token_bucket_t *tb, double tokens) {
+uint64_t now;
+
+	if ( tb->rate == 0 )
+		return 0;
+
+	now = NowNsec();
+	tb->tokens += (double)(now - tb->last) * tb->rate / 1000000000.0;
+	if ( tb->tokens > tb->burst )
+		tb->tokens = tb->burst;
+	tb->last = now;
+
+	tb->tokens -= tokens;
+	if ( tb->tokens >= 0 )
+		return 0;
+
+	return (uint64_t)(-tb->tokens * 1000000000.0 / tb->rate);
+
+} // End of TakeTokens
+
+/*
+ * Returns the time in nsec to wait until this flow is due in original timing.
+ * A flow is due, when it ended - that is when a router exports it.
+ */
+static uint64_t ReplayWait(master_record_t *master_record) {
+uint64_t now, due, t_flow;
+
+	if ( replay_clock.speed == 0 )
+		return 0;
+
+	t_flow = 1000LL * (uint64_t)master_record->last + (uint64_t)master_record->msec_last;
+	now	   = NowNsec();
+	if ( replay_clock.wall_start == 0 ) {
+		replay_clock.flow_start = t_flow;
+		replay_clock.wall_start = now;
+		return 0;
+	}
+
+	// flows are not strictly sorted - send late flows immediately
+	if ( t_flow <= replay_clock.flow_start )
+		return 0;
+
+	due = replay_clock.wall_start + (uint64_t)((double)(t_flow - replay_clock.flow_start) * 1000000.0 / replay_clock.speed);
+	return due > now ? due - now : 0;
+
+} // End of ReplayWait
+
+static int InitSendBatch(uint32_t size) {
+#ifdef HAVE_SENDMMSG
+uint32_t i;
+#endif
+
+	batch.buff = malloc(SENDBATCH * UDP_PACKET_SIZE);
+	if ( !batch.buff ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+	batch.num  = 0;
+	batch.size = size > SENDBATCH ? SENDBATCH : size;
+
+#ifdef HAVE_SENDMMSG
+	memset((void *)batch.msg, 0, sizeof(batch.msg));
+	for ( i=0; i < SENDBATCH; i++ ) {
+		batch.iov[i].iov_base = (void *)((pointer_addr_t)batch.buff + i * UDP_PACKET_SIZE);
+		batch.iov[i].iov_len  = 0;
+		batch.msg[i].msg_hdr.msg_iov	= &batch.iov[i];
+		batch.msg[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+
+	return 1;
+
+} // End of InitSendBatch
+
+/*
+ * Send all packets of the current batch to all peers
+ */
+static int SendBatch(void) {
+int i, ret;
+uint32_t j;
+
+	if ( batch.num == 0 )
+		return 0;
+
+	for ( i=0; i < num_peers; i++ ) {
+#ifdef HAVE_SENDMMSG
+		j = 0;
+		while ( j < batch.num ) {
+			uint32_t k;
+			for ( k=j; k < batch.num; k++ ) {
+				batch.msg[k].msg_hdr.msg_name	 = (void *)&peers[i].addr;
+				batch.msg[k].msg_hdr.msg_namelen = peers[i].addrlen;
+			}
+			ret = sendmmsg(peers[i].sockfd, &batch.msg[j], batch.num - j, 0);
+			if ( ret < 0 ) {
+				if ( errno == EINTR )
+					continue;
+				batch.num = 0;
+				return -1;
+			}
+			j += ret;
+		}
+#else
+		for ( j=0; j < batch.num; j++ ) {
+			ret = sendto(peers[i].sockfd, (void *)((pointer_addr_t)batch.buff + j * UDP_PACKET_SIZE), batch.len[j], 0, 
+				(struct sockaddr *)&(peers[i].addr), peers[i].addrlen);
+			if ( ret < 0 ) {
+				batch.num = 0;
+				return -1;
+			}
+		}
+#endif
+	}
+	batch.num = 0;
+
+	return 0;
+
+} // End of SendBatch
+
 static int FlushBuffer(int confirm) {
 size_t len = (pointer_addr_t)peer.buff_ptr - (pointer_addr_t)peer.send_buffer;
 static unsigned long cnt = 1;
+uint64_t wait;
 
 	peer.flush = 0;
 	peer.buff_ptr = peer.send_buffer;
@@ -150,7 +385,29 @@ static unsigned long cnt = 1;
 		fflush(stdout);
 		fgetc(stdin);
 	}
-	return sendto(peer.sockfd, peer.send_buffer, len, 0, (struct sockaddr *)&(peer.addr), peer.addrlen);
+
+	// do not hold back queued packets, while waiting for the rate limit
+	wait = TakeTokens(&packet_bucket, 1);
+	if ( wait ) {
+		if ( SendBatch() < 0 )
+			return -1;
+		SleepNsec(wait);
+	}
+
+	memcpy((void *)((pointer_addr_t)batch.buff + batch.num * UDP_PACKET_SIZE), peer.send_buffer, len);
+	batch.len[batch.num] = len;
+#ifdef HAVE_SENDMMSG
+	batch.iov[batch.num].iov_len = len;
+#endif
+	batch.num++;
+
+	if ( batch.num == batch.size ) {
+		if ( SendBatch() < 0 )
+			return -1;
+	}
+
+	return len;
+
 } // End of FlushBuffer
 
 
@@ -164,17 +421,19 @@ double 					fps;
 	peer.send_buffer = malloc(1400);
 	if ( !peer.send_buffer ) {
 		perror("Memory allocation error");
-		close(peer.sockfd);
 		return;
 	}
 	header = (common_flow_header_t *)peer.send_buffer;
 	header->version = htons(255);
 	nfprof_start(&profile_data);
 	for ( i = 0; i < 65535; i++ ) {
+		int j;
 		header->count = htons(i);
-		ret = sendto(peer.sockfd, peer.send_buffer, 1400, 0, (struct sockaddr *)&peer.addr, peer.addrlen);
-		if ( ret < 0 || ret != 1400 ) {
-			perror("Error sending data");
+		for ( j=0; j < num_peers; j++ ) {
+			ret = sendto(peers[j].sockfd, peer.send_buffer, 1400, 0, (struct sockaddr *)&peers[j].addr, peers[j].addrlen);
+			if ( ret < 0 || ret != 1400 ) {
+				perror("Error sending data");
+			}
 		}
 
 		if ( delay ) {
@@ -203,243 +462,147 @@ double 					fps;
 
 } // End of send_blast
 
-static void send_data(char *rfile, time_t twin_start, 
-			time_t twin_end, uint32_t count, unsigned int delay, int confirm, int netflow_version) {
-master_record_t	master_record;
-common_record_t	*flow_record;
-nffile_t		*nffile;
-int 			i, done, ret, again;
-uint32_t		numflows, cnt;
-
-#ifdef COMPAT15
-int	v1_map_done = 0;
-#endif
-	
-	// Get the first file handle
-	nffile = GetNextFile(NULL, twin_start, twin_end);
-	if ( !nffile ) {
-		LogError("GetNextFile() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-		return;
+static int replay_flow(void *data, common_record_t *flow_record, master_record_t *master_record, 
+	extension_info_t *extension_info) {
+replay_ctx_t	*ctx = (replay_ctx_t *)data;
+uint64_t		wait, flow_wait;
+int				again;
+
+	// pace flows by original timing and flow rate limit
+	wait = ReplayWait(master_record);
+	if ( wait > REPLAYFLUSH ) {
+		// a router would not hold back the flows of a partial packet that long
+		int flush = ctx->netflow_version == 5 ? Flush_v5_output(&peer) : Flush_v9_output(&peer);
+		if ( flush && FlushBuffer(ctx->confirm) < 0 ) {
+			perror("Error sending data");
+			ctx->error = 1;
+			return SCAN_STOP;
+		}
 	}
-	if ( nffile == EMPTY_LIST ) {
-		LogError("Empty file list. No files to process\n");
-		return;
+	flow_wait = TakeTokens(&flow_bucket, 1);
+	if ( flow_wait > wait )
+		wait = flow_wait;
+	if ( wait ) {
+		if ( SendBatch() < 0 ) {
+			perror("Error sending data");
+			ctx->error = 1;
+			return SCAN_STOP;
+		}
+		SleepNsec(wait);
 	}
 
+	if ( ctx->netflow_version == 5 ) 
+		again = Add_v5_output_record(master_record, &peer);
+	else
+		again = Add_v9_output_record(master_record, &peer);
+
+	ctx->numflows++;
+
+	if ( peer.flush ) {
+		if ( FlushBuffer(ctx->confirm) < 0 ) {
+			perror("Error sending data");
+			ctx->error = 1;
+			return SCAN_STOP;
+		}
+
+		if ( ctx->delay ) {
+			// sleep as specified
+			usleep(ctx->delay);
+		}
+	}
+
+	if ( again ) {
+		if ( ctx->netflow_version == 5 ) 
+			Add_v5_output_record(master_record, &peer);
+		else
+			Add_v9_output_record(master_record, &peer);
+	}
+
+	return ctx->numflows == ctx->count ? SCAN_STOP : SCAN_CONTINUE;
+
+} // End of replay_flow
+
+static void send_data(char *rfile, time_t twin_start, 
+			time_t twin_end, uint32_t count, unsigned int delay, int confirm, int netflow_version) {
+replay_ctx_t	ctx;
+scan_t			scan;
+int 			ret;
+
 	peer.send_buffer   	= malloc(UDP_PACKET_SIZE);
 	peer.flush			= 0;
 	if ( !peer.send_buffer ) {
 		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-		CloseFile(nffile);
-		DisposeFile(nffile);
 		return;
 	}
 	peer.buff_ptr = peer.send_buffer;
 	peer.endp  	  = (void *)((pointer_addr_t)peer.send_buffer + UDP_PACKET_SIZE - 1);
 
+	// send each packet immediately, if confirmed or delayed
+	if ( !InitSendBatch(confirm || delay ? 1 : SENDBATCH) ) {
+		return;
+	}
+
 	if ( netflow_version == 5 ) 
 		Init_v5_v7_output(&peer);
 	else 
 		Init_v9_output(&peer);
 
-	numflows	= 0;
-	done	 	= 0;
-
-	// setup Filter Engine to point to master_record, as any record read from file
-	// is expanded into this record
-	Engine->nfrecord = (uint64_t *)&master_record;
-
-	cnt = 0;
-	while ( !done ) {
-		// get next data block from file
-		ret = ReadBlock(nffile);
-
-		switch (ret) {
-			case NF_CORRUPT:
-			case NF_ERROR:
-				if ( ret == NF_CORRUPT ) 
-					LogError("Skip corrupt data file '%s'\n",GetCurrentFilename());
-				else 
-					LogError("Read error in file '%s': %s\n",GetCurrentFilename(), strerror(errno) );
-				// fall through - get next file in chain
-			case NF_EOF: {
-				nffile_t *next = GetNextFile(nffile, twin_start, twin_end);
-				if ( next == EMPTY_LIST ) {
-					done = 1;
-				}
-				if ( next == NULL ) {
-					done = 1;
-					LogError("Unexpected end of file list\n");
-				}
-				// else continue with next file
-				continue;
-	
-				} break; // not really needed
-		}
-
-#ifdef COMPAT15
-		if ( nffile->block_header->id == DATA_BLOCK_TYPE_1 ) {
-			common_record_v1_t *v1_record = (common_record_v1_t *)nffile->buff_ptr;
-			// create an extension map for v1 blocks
-			if ( v1_map_done == 0 ) {
-				extension_map_t *map = malloc(sizeof(extension_map_t) + 2 * sizeof(uint16_t) );
-				if ( ! map ) {
-					perror("Memory allocation error");
-					exit(255);
-				}
-				map->type 	= ExtensionMapType;
-				map->size 	= sizeof(extension_map_t) + 2 * sizeof(uint16_t);
-				if (( map->size & 0x3 ) != 0 ) {
-					map->size += 4 - ( map->size & 0x3 );
-				}
-				map->map_id = INIT_ID;
-				map->ex_id[0]  = EX_IO_SNMP_2;
-				map->ex_id[1]  = EX_AS_2;
-				map->ex_id[2]  = 0;
-				
-				map->extension_size  = 0;
-				map->extension_size += extension_descriptor[EX_IO_SNMP_2].size;
-				map->extension_size += extension_descriptor[EX_AS_2].size;
-					
-				Insert_Extension_Map(extension_map_list, map);
-				v1_map_done = 1;
-			}
-
-			// convert the records to v2
-			for ( i=0; i < nffile->block_header->NumRecords; i++ ) {
-				common_record_t *v2_record = (common_record_t *)v1_record;
-				Convert_v1_to_v2((void *)v1_record);
-				// now we have a v2 record -> use size of v2_record->size
-				v1_record = (common_record_v1_t *)((pointer_addr_t)v1_record + v2_record->size);
-			}
-			nffile->block_header->id = DATA_BLOCK_TYPE_2;
-		}
-#endif
-
-		if ( nffile->block_header->id != DATA_BLOCK_TYPE_2 ) {
-			LogError("Can't process block type %u. Skip block.\n", nffile->block_header->id);
-			continue;
-		}
-
-		// cnt is the number of blocks, which survived the filter
-		// and added to the output buffer
-		flow_record = nffile->buff_ptr;
-
-		for ( i=0; i < nffile->block_header->NumRecords; i++ ) {
-			int match;
-
-			switch ( flow_record->type ) {
-				case CommonRecordType: {
-					if ( extension_map_list->slot[flow_record->ext_map] == NULL ) {
-						LogError("Corrupt data file. Missing extension map %u. Skip record.\n", flow_record->ext_map);
-						flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);	
-						continue;
-					} 
-
-					// if no filter is given, the result is always true
-					ExpandRecord_v2( flow_record, extension_map_list->slot[flow_record->ext_map], NULL, &master_record);
-
-					match = twin_start && (master_record.first < twin_start || master_record.last > twin_end) ? 0 : 1;
-
-					// filter netflow record with user supplied filter
-					if ( match ) 
-						match = (*Engine->FilterEngine)(Engine);
-	
-					if ( match == 0 ) { // record failed to pass all filters
-						// increment pointer by number of bytes for netflow record
-						flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);	
-						// go to next record
-						continue;
-					}
-					// Records passed filter -> continue record processing
-
-					if ( netflow_version == 5 ) 
-						again = Add_v5_output_record(&master_record, &peer);
-					else
-						again = Add_v9_output_record(&master_record, &peer);
-	
-					cnt++;
-					numflows++;
-
-					if ( peer.flush ) {
-						ret = FlushBuffer(confirm);
-	
-						if ( ret < 0 ) {
-							perror("Error sending data");
-							CloseFile(nffile);
-							DisposeFile(nffile);
-							return;
-						}
-			
-						if ( delay ) {
-							// sleep as specified
-							usleep(delay);
-						}
-						cnt = 0;
-					}
-	
-					if ( again ) {
-						if ( netflow_version == 5 ) 
-							Add_v5_output_record(&master_record, &peer);
-						else
-							Add_v9_output_record(&master_record, &peer);
-						cnt++;
-					}
-
-					} break;
-				case ExtensionMapType: {
-					extension_map_t *map = (extension_map_t *)flow_record;
-	
-					if ( Insert_Extension_Map(extension_map_list, map) ) {
-						// flush new map
-						
-					} // else map already known and flushed
-	
-					} break;
-				case ExporterRecordType:
-				case SamplerRecordype:
-				case ExporterInfoRecordType:
-				case ExporterStatRecordType:
-				case SamplerInfoRecordype:
-						// Silently skip exporter/sampler records
-					break;
-			 	default: {
-					LogError("Skip unknown record type %i\n", flow_record->type);
-				}
-			}
-			// Advance pointer by number of bytes for netflow record
-			flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);	
-
-		}
-	} // while
+	memset((void *)&ctx, 0, sizeof(replay_ctx_t));
+	ctx.count			= count;
+	ctx.delay			= delay;
+	ctx.confirm			= confirm;
+	ctx.netflow_version	= netflow_version;
+
+	memset((void *)&scan, 0, sizeof(scan_t));
+	scan.twin_start			= twin_start;
+	scan.twin_end			= twin_end;
+	scan.engine				= Engine;
+	scan.extension_map_list	= extension_map_list;
+	scan.data				= (void *)&ctx;
+	scan.flow				= replay_flow;
+
+	if ( !ScanFiles(&scan) || ctx.error ) {
+		free(batch.buff);
+		return;
+	}
 
 	// flush still remaining records
-	if ( cnt ) {
+	if ( netflow_version == 5 ) 
+		ret = Flush_v5_output(&peer);
+	else
+		ret = Flush_v9_output(&peer);
+	if ( ret ) 
 		ret = FlushBuffer(confirm);
 
-		if ( ret < 0 ) {
-			perror("Error sending data");
-		}
-
-	} // if cnt 
-
-	if (nffile) {
-		CloseFile(nffile);
-		DisposeFile(nffile);
+	if ( ret < 0 || SendBatch() < 0 ) {
+		perror("Error sending data");
 	}
 
-	close(peer.sockfd);
+	free(batch.buff);
 
 	return;
 
 } // End of send_data
 
 
+static void add_peer(char *hostname, int mcast) {
+
+	if ( num_peers == MAXPEERS ) {
+		LogError("ERROR, Too many destinations. Max %d destinations allowed!\n", MAXPEERS);
+		exit(255);
+	}
+	peers[num_peers].hostname = strdup(hostname);
+	peers[num_peers].mcast	  = mcast;
+	num_peers++;
+
+} // End of add_peer
+
 int main( int argc, char **argv ) {
 struct stat stat_buff;
 char *rfile, *ffile, *filter, *tstring;
-int c, confirm, ffd, ret, blast, netflow_version;
-unsigned int delay, count, sockbuff_size;
+int c, i, confirm, ffd, ret, blast, netflow_version, delay;
+unsigned int count, sockbuff_size;
+double packet_rate, flow_rate;
 time_t t_start, t_end;
 
 	rfile = ffile = filter = tstring = NULL;
@@ -451,14 +614,17 @@ time_t t_start, t_end;
 	peer.family		= AF_UNSPEC;
 	peer.sockfd		= 0;
 
-	delay 	  		= 1;
+	delay 	  		= -1;
+	packet_rate		= 0;
+	flow_rate		= 0;
+	num_peers		= 0;
 	count	  		= 0xFFFFFFFF;
 	sockbuff_size  	= 0;
 	netflow_version	= 5;
 	blast			= 0;
 	verbose			= 0;
 	confirm			= 0;
-	while ((c = getopt(argc, argv, "46BhH:i:K:L:p:d:c:b:j:r:f:t:v:VY")) != EOF) {
+	while ((c = getopt(argc, argv, "46BhH:i:K:L:p:d:c:b:j:r:f:t:v:F:P:T:VY")) != EOF) {
 		switch (c) {
 			case 'h':
 				usage(argv[0]);
@@ -476,17 +642,10 @@ time_t t_start, t_end;
 				break;
 			case 'H':
 			case 'i':	// compatibility with old version
-				peer.hostname = strdup(optarg);
-				peer.mcast	  = 0;
+				add_peer(optarg, 0);
 				break;
 			case 'j':	
-				if ( peer.hostname == NULL ) {
-					peer.hostname = strdup(optarg);
-					peer.mcast	  = 1;
-				} else {
-        			LogError("ERROR, -H(-i) and -j are mutually exclusive!!\n");
-        			exit(255);
-				}
+				add_peer(optarg, 1);
 				break;
 			case 'K':
 				LogError("*** Anonymization moved! Use nfanon to anonymize flows first!\n");
@@ -501,6 +660,31 @@ time_t t_start, t_end;
 				break;
 			case 'd':
 				delay = atoi(optarg);
+				if ( delay < 0 ) {
+					LogError("Invalid delay: %s\n", optarg);
+					exit(255);
+				}
+				break;
+			case 'P':
+				packet_rate = atof(optarg);
+				if ( packet_rate <= 0 ) {
+					LogError("Invalid packet rate: %s\n", optarg);
+					exit(255);
+				}
+				break;
+			case 'F':
+				flow_rate = atof(optarg);
+				if ( flow_rate <= 0 ) {
+					LogError("Invalid flow rate: %s\n", optarg);
+					exit(255);
+				}
+				break;
+			case 'T':
+				replay_clock.speed = atof(optarg);
+				if ( replay_clock.speed <= 0 ) {
+					LogError("Invalid replay speed: %s\n", optarg);
+					exit(255);
+				}
 				break;
 			case 'v':
 				netflow_version = atoi(optarg);
@@ -553,8 +737,12 @@ time_t t_start, t_end;
 		filter = argv[optind];
 	}
 
-	if ( peer.hostname == NULL )
-		peer.hostname 	= DEFAULTHOSTNAME;
+	if ( num_peers == 0 )
+		add_peer(DEFAULTHOSTNAME, 0);
+
+	// rate limits and timing replay replace the fixed delay
+	if ( delay < 0 ) 
+		delay = packet_rate || flow_rate || replay_clock.speed ? 0 : 1;
 
 	if ( !filter && ffile ) {
 		if ( stat(ffile, &stat_buff) ) {
@@ -587,16 +775,21 @@ time_t t_start, t_end;
 	if ( !Engine ) 
 		exit(254);
 	
-	if ( peer.mcast )
-		peer.sockfd = Multicast_send_socket (peer.hostname, peer.port, peer.family, sockbuff_size, 
-											&peer.addr, &peer.addrlen );
-	else 
-		peer.sockfd = Unicast_send_socket (peer.hostname, peer.port, peer.family, sockbuff_size, 
-											&peer.addr, &peer.addrlen );
-	if ( peer.sockfd <= 0 ) {
-		exit(255);
+	for ( i=0; i < num_peers; i++ ) {
+		if ( peers[i].mcast )
+			peers[i].sockfd = Multicast_send_socket (peers[i].hostname, peer.port, peer.family, sockbuff_size, 
+												&peers[i].addr, &peers[i].addrlen );
+		else 
+			peers[i].sockfd = Unicast_send_socket (peers[i].hostname, peer.port, peer.family, sockbuff_size, 
+												&peers[i].addr, &peers[i].addrlen );
+		if ( peers[i].sockfd <= 0 ) {
+			exit(255);
+		}
 	}
 
+	InitTokenBucket(&packet_bucket, packet_rate);
+	InitTokenBucket(&flow_bucket, flow_rate);
+
 	if ( blast ) {
 		send_blast(delay );
 		exit(0);
@@ -613,6 +806,9 @@ time_t t_start, t_end;
 
 	send_data(rfile, t_start, t_end, count, delay, confirm, netflow_version);
 
+	for ( i=0; i < num_peers; i++ ) 
+		close(peers[i].sockfd);
+
 	FreeExtensionMaps(extension_map_list);
 
 	return 0;
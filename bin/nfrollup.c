@@ -0,0 +1,520 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+/*
+ * nfrollup maintains the hourly and daily rollup files of a data directory.
+ * Each flow file is merged into the rollup of its hour. As soon as a file of a later
+ * hour arrives, the completed hour is merged into the rollup of its day. A rollup
+ * holds the flows aggregated by its -A keys - the same records nfdump -A <keys> -w
+ * writes. nfcapd runs nfrollup for each new file, if started with -A <keys>.
+ * Files must be merged in time order. Files merged already are skipped.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nffile.h"
+#include "nfx.h"
+#include "util.h"
+#include "flist.h"
+#include "nfstatfile.h"
+#include "nflowcache.h"
+#include "nfexport.h"
+#include "nfscan.h"
+#include "exporter.h"
+#include "rollup.h"
+
+// state of a merge
+typedef struct merge_ctx_s {
+	stat_record_t	stat_record;
+	int				anonymized;
+} merge_ctx_t;
+
+// module limited globals
+static int	verbose  = 0;
+static int	compress = LZ4_COMPRESSED;
+
+// hash statistics of the flow table - see nflowcache.c
+int hash_hit = 0; 
+int hash_miss = 0;
+int hash_skip = 0;
+
+/* Function Prototypes */
+static void usage(char *name);
+
+static int merge_file(void *data, char *filename, file_header_t *file_header, stat_record_t *stat_record);
+
+static int merge_flow(void *data, common_record_t *flow_record, master_record_t *master_record, 
+	extension_info_t *extension_info);
+
+static int Merge(char **inputs, int num, char *output, rollup_info_t *info);
+
+static void FoldDay(char *rollupdir, char *day, char *slot);
+
+static void UpdateRollup(char *rollupdir, char *filename);
+
+static void PruneRollups(char *datadir, char *rollupdir);
+
+static int MakeDir(char *path);
+
+/* Functions */
+
+static void usage(char *name) {
+		printf("usage %s [options] \n"
+					"-h\t\tThis text\n"
+					"-A <keys>\tAggregation keys of the rollup e.g. srcip,dstport,proto\n"
+					"-l <datadir>\tData directory of the flow files\n"
+					"-r <file>\tMerge flow file into its hourly and daily rollup\n"
+					"-R <expr>\tMerge all files of the -R file list in order\n"
+					"-J <method>\tCompression of the rollup files: lzo, bz2, lz4 or zstd[:level]. Default lz4\n"
+					"-v\t\tVerbose: print each merge\n"
+					"The rollups are maintained in <datadir>/%s/<keys>\n", name, ROLLUP_DIR);
+} /* usage */
+
+static int merge_file(void *data, char *filename, file_header_t *file_header, stat_record_t *stat_record) {
+merge_ctx_t *ctx = (merge_ctx_t *)data;
+
+	SumStatRecords(&ctx->stat_record, stat_record);
+	if ( file_header->flags & FLAG_ANONYMIZED )
+		ctx->anonymized = 1;
+
+	return SCAN_CONTINUE;
+
+} // End of merge_file
+
+static int merge_flow(void *data, common_record_t *flow_record, master_record_t *master_record, 
+	extension_info_t *extension_info) {
+
+	AddFlow(flow_record, master_record, extension_info);
+	return SCAN_CONTINUE;
+
+} // End of merge_flow
+
+/*
+ * aggregate all flows of the input files and write them to output
+ * info is stored in the ident of output
+ */
+static int Merge(char **inputs, int num, char *output, rollup_info_t *info) {
+extension_map_list_t *extension_map_list;
+stringlist_t	*file_list;
+merge_ctx_t		ctx;
+scan_t			scan;
+nffile_t		*nffile;
+char			tmpfile[MAXPATHLEN], ident[IDENTLEN], *p;
+uint32_t		i;
+
+	if ( verbose ) {
+		printf("Merge");
+		for ( i=0; i<num; i++ ) 
+			printf(" %s", inputs[i]);
+		printf(" -> %s\n", output);
+	}
+
+	// release the previous file list
+	file_list = GetInputFileList();
+	for ( i=0; i<file_list->num_strings; i++ ) 
+		free(file_list->list[i]);
+	free(file_list->list);
+	file_list->list = NULL;
+
+	SetupInputFileSequence(NULL, inputs[0], NULL);
+	for ( i=1; i<num; i++ ) 
+		InsertString(file_list, inputs[i]);
+
+	extension_map_list = InitExtensionMaps(NEEDS_EXTENSION_LIST);
+	if ( !Init_FlowTable() ) 
+		exit(255);
+
+	memset((void *)&ctx, 0, sizeof(merge_ctx_t));
+	ctx.stat_record.first_seen = 0xffffffff;
+	ctx.stat_record.msec_first = 999;
+
+	memset((void *)&scan, 0, sizeof(scan_t));
+	scan.extension_map_list	= extension_map_list;
+	scan.data				= (void *)&ctx;
+	scan.file				= merge_file;
+	scan.flow				= merge_flow;
+
+	if ( !ScanFiles(&scan) ) {
+		LogError("Failed to read flow files for '%s'", output);
+		Dispose_FlowTable();
+		FreeExtensionMaps(extension_map_list);
+		return 0;
+	}
+
+	// maps of different input files may share an id - re-index all referenced maps
+	PackExtensionMapList(extension_map_list);
+
+	// write to a temp file in the same directory and rename it, when done
+	p = strrchr(output, '/');
+	snprintf(tmpfile, MAXPATHLEN, "%.*s/.nfrollup.%lu", p ? (int)(p - output) : 1, p ? output : ".", 
+		(unsigned long)getpid());
+	tmpfile[MAXPATHLEN-1] = '\0';
+
+	nffile = OpenNewFile(tmpfile, NULL, compress, ctx.anonymized, NULL);
+	if ( !nffile ) {
+		Dispose_FlowTable();
+		FreeExtensionMaps(extension_map_list);
+		return 0;
+	}
+
+	// bidir adds the out bytes and packets to all maps - flows of a key may come with different maps
+	if ( !ExportFlowTable(nffile, 1, 1, 0, extension_map_list) ) {
+		CloseFile(nffile);
+		DisposeFile(nffile);
+		unlink(tmpfile);
+		Dispose_FlowTable();
+		FreeExtensionMaps(extension_map_list);
+		return 0;
+	}
+
+	memcpy((void *)nffile->stat_record, (void *)&ctx.stat_record, sizeof(stat_record_t));
+	RollupSetIdent(ident, info);
+	CloseUpdateFile(nffile, ident);
+	DisposeFile(nffile);
+
+	Dispose_FlowTable();
+	FreeExtensionMaps(extension_map_list);
+
+	if ( rename(tmpfile, output) < 0 ) {
+		LogError("rename() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		unlink(tmpfile);
+		return 0;
+	}
+
+	return 1;
+
+} // End of Merge
+
+/*
+ * merge all hours of day before the hour of slot, which are not yet merged
+ * into the rollup of the day
+ */
+static void FoldDay(char *rollupdir, char *day, char *slot) {
+char			dayfile[MAXPATHLEN], hourfile[MAXPATHLEN], hour[HOUR_LEN+1];
+rollup_info_t	dayinfo, hourinfo;
+int				h;
+
+	RollupPath(dayfile, MAXPATHLEN, rollupdir, day, DAY_LEN);
+	for ( h=0; h<24; h++ ) {
+		char *inputs[2];
+		int  num, has_day;
+
+		snprintf(hour, HOUR_LEN+1, "%.*s%02i", DAY_LEN, day, h);
+		// the hour of slot is still open
+		if ( strncmp(hour, slot, HOUR_LEN) >= 0 )
+			break;
+
+		RollupPath(hourfile, MAXPATHLEN, rollupdir, hour, HOUR_LEN);
+		if ( !RollupReadInfo(hourfile, &hourinfo) )
+			continue;
+
+		has_day = RollupReadInfo(dayfile, &dayinfo);
+		if ( has_day && strcmp(hourinfo.last, dayinfo.last) <= 0 ) 
+			// merged already
+			continue;
+
+		num = 0;
+		if ( has_day ) {
+			inputs[num++] = dayfile;
+			dayinfo.numfiles += hourinfo.numfiles;
+		} else {
+			dayinfo = hourinfo;
+		}
+		inputs[num++] = hourfile;
+		snprintf(dayinfo.last, SLOT_LEN+1, "%s", hourinfo.last);
+
+		if ( !Merge(inputs, num, dayfile, &dayinfo) ) 
+			LogError("Failed to merge '%s' into '%s'", hourfile, dayfile);
+	}
+
+} // End of FoldDay
+
+/*
+ * merge the flow file into the rollup of its hour and complete the rollups 
+ * of the days of all previous hours
+ */
+static void UpdateRollup(char *rollupdir, char *filename) {
+char			hourfile[MAXPATHLEN], day[DAY_LEN+1], *slot, *inputs[2];
+rollup_info_t	info;
+struct tm		tm;
+int				num;
+
+	slot = RollupSlot(filename);
+	if ( !slot ) {
+		LogError("Skip '%s': not a nfcapd.YYYYMMDDhhmm file", filename);
+		return;
+	}
+
+	// the previous day - its last hour is completed by the first file of a new day
+	memset((void *)&tm, 0, sizeof(struct tm));
+	if ( sscanf(slot, "%4d%2d%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3 ) {
+		LogError("Skip '%s': invalid time slot", filename);
+		return;
+	}
+	tm.tm_year -= 1900;
+	tm.tm_mon  -= 1;
+	tm.tm_mday -= 1;
+	tm.tm_hour  = 12;
+	tm.tm_isdst = -1;
+	mktime(&tm);
+	strftime(day, DAY_LEN+1, "%Y%m%d", &tm);
+	FoldDay(rollupdir, day, slot);
+
+	snprintf(day, DAY_LEN+1, "%.*s", DAY_LEN, slot);
+	FoldDay(rollupdir, day, slot);
+
+	RollupPath(hourfile, MAXPATHLEN, rollupdir, slot, HOUR_LEN);
+	num = 0;
+	if ( RollupReadInfo(hourfile, &info) ) {
+		if ( strcmp(slot, info.last) <= 0 ) {
+			if ( verbose )
+				printf("Skip %s: merged already\n", filename);
+			return;
+		}
+		inputs[num++] = hourfile;
+		info.numfiles++;
+	} else {
+		snprintf(info.first, SLOT_LEN+1, "%s", slot);
+		info.numfiles = 1;
+	}
+	inputs[num++] = filename;
+	snprintf(info.last, SLOT_LEN+1, "%s", slot);
+
+	if ( !Merge(inputs, num, hourfile, &info) ) 
+		LogError("Failed to merge '%s' into '%s'", filename, hourfile);
+
+} // End of UpdateRollup
+
+/*
+ * remove the rollups of all hours and days before the first flow file in datadir
+ */
+static void PruneRollups(char *datadir, char *rollupdir) {
+dirstat_t	*dirstat;
+time_t		first;
+char		oldest[SLOT_LEN+1], path[MAXPATHLEN];
+int			i;
+
+	if ( ReadStatInfo(datadir, &dirstat, LOCK_IF_EXISTS) != STATFILE_OK ) 
+		return;
+	first = dirstat->first;
+	ReleaseStatInfo(dirstat);
+
+	if ( first == 0 ) 
+		return;
+	strftime(oldest, SLOT_LEN+1, "%Y%m%d%H%M", localtime(&first));
+
+	for ( i=0; i<2; i++ ) {
+		char *interval		= i ? ROLLUP_DAY : ROLLUP_HOUR;
+		int  interval_len	= i ? DAY_LEN : HOUR_LEN;
+		size_t prefix_len	= strlen(ROLLUP_PREFIX);
+		DIR *dir;
+		struct dirent *entry;
+
+		if ( snprintf(path, MAXPATHLEN, "%s/%s", rollupdir, interval) >= MAXPATHLEN )
+			continue;
+		dir = opendir(path);
+		if ( !dir ) 
+			continue;
+
+		while ( (entry = readdir(dir)) != NULL ) {
+			if ( strncmp(entry->d_name, ROLLUP_PREFIX, prefix_len) != 0 ||
+				 strlen(entry->d_name) != (prefix_len + interval_len) ) 
+				continue;
+			if ( strncmp(entry->d_name + prefix_len, oldest, interval_len) < 0 ) {
+				if ( snprintf(path, MAXPATHLEN, "%s/%s/%s", rollupdir, interval, entry->d_name) >= MAXPATHLEN )
+					continue;
+				if ( verbose )
+					printf("Remove %s\n", path);
+				unlink(path);
+			}
+		}
+		closedir(dir);
+	}
+
+} // End of PruneRollups
+
+static int MakeDir(char *path) {
+struct stat stat_buf;
+
+	if ( stat(path, &stat_buf) == 0 && S_ISDIR(stat_buf.st_mode) ) 
+		return 1;
+
+	if ( mkdir(path, 0755) < 0 && errno != EEXIST ) {
+		LogError("mkdir() error for '%s': %s", path, strerror(errno));
+		return 0;
+	}
+	return 1;
+
+} // End of MakeDir
+
+int main( int argc, char **argv ) {
+struct stat		stat_buf;
+stringlist_t	keylist, files;
+char 			*rfile, *Rfile, *datadir, *keys, *aggr_keys, *aggr_fmt;
+char			rollupdir[MAXPATHLEN], path[MAXPATHLEN];
+int				c, lockfd;
+uint32_t		i;
+
+	rfile = Rfile = datadir = keys = aggr_fmt = NULL;
+
+	while ((c = getopt(argc, argv, "hA:J:l:r:R:v")) != EOF) {
+		switch (c) {
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+				break;
+			case 'A':
+				keys = optarg;
+				for ( i=0; i<strlen(keys); i++ ) 
+					keys[i] = tolower((int)keys[i]);
+				break;
+			case 'J':
+				compress = ParseCompression(optarg);
+				if ( compress < 0 )
+					exit(255);
+				break;
+			case 'l':
+				datadir = optarg;
+				break;
+			case 'r':
+				rfile = optarg;
+				break;
+			case 'R':
+				Rfile = optarg;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			default:
+				usage(argv[0]);
+				exit(255);
+		}
+	}
+
+	if ( !keys || !datadir ) {
+		LogError("Expected -A <keys> and -l <datadir>\n");
+		exit(255);
+	}
+
+	if ( !rfile && !Rfile ) {
+		LogError("Expected -r <file> or -R <dir>\n");
+		exit(255);
+	}
+
+	InitStringlist(&keylist, 16);
+	if ( !RollupKeyList(keys, &keylist) ) {
+		LogError("Invalid rollup keys '%s' - subnet bits are not supported\n", keys);
+		exit(255);
+	}
+
+	// ParseAggregateMask() tokenizes its argument
+	aggr_keys = strdup(keys);
+	if ( !aggr_keys ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	if ( !ParseAggregateMask(aggr_keys, &aggr_fmt) ) 
+		exit(255);
+
+	// the exporters of the flow files are kept in the rollups
+	if ( !InitExporterList() ) 
+		exit(255);
+
+	if ( stat(datadir, &stat_buf) || !S_ISDIR(stat_buf.st_mode) ) {
+		LogError("No such directory: '%s'\n", datadir);
+		exit(255);
+	}
+
+	// create <datadir>/.rollup/<keys>/1h and 1d
+	if ( (strlen(datadir) + strlen(keys) + 32) >= MAXPATHLEN ) {
+		LogError("Path too long: '%s/%s/%s'\n", datadir, ROLLUP_DIR, keys);
+		exit(255);
+	}
+	snprintf(rollupdir, MAXPATHLEN, "%s/%s", datadir, ROLLUP_DIR);
+	if ( !MakeDir(rollupdir) ) 
+		exit(255);
+	snprintf(rollupdir, MAXPATHLEN, "%s/%s/%s", datadir, ROLLUP_DIR, keys);
+	if ( !MakeDir(rollupdir) ) 
+		exit(255);
+	if ( snprintf(path, MAXPATHLEN, "%s/%s", rollupdir, ROLLUP_HOUR) >= MAXPATHLEN || !MakeDir(path) ) 
+		exit(255);
+	if ( snprintf(path, MAXPATHLEN, "%s/%s", rollupdir, ROLLUP_DAY) >= MAXPATHLEN || !MakeDir(path) ) 
+		exit(255);
+
+	// the collector may start the next update, before this one is done
+	if ( snprintf(path, MAXPATHLEN, "%s/.lock", rollupdir) >= MAXPATHLEN ) 
+		exit(255);
+	lockfd = open(path, O_RDWR | O_CREAT, 0644);
+	if ( lockfd < 0 || flock(lockfd, LOCK_EX) < 0 ) {
+		LogError("Can't lock '%s': %s\n", path, strerror(errno));
+		exit(255);
+	}
+
+	// the merges reuse the file list - take a copy
+	InitStringlist(&files, 64);
+	if ( rfile ) {
+		InsertString(&files, rfile);
+	} else {
+		stringlist_t *file_list;
+		SetupInputFileSequence(NULL, NULL, Rfile);
+		file_list = GetInputFileList();
+		for ( i=0; i<file_list->num_strings; i++ ) 
+			InsertString(&files, file_list->list[i]);
+	}
+
+	for ( i=0; i<files.num_strings; i++ ) 
+		UpdateRollup(rollupdir, files.list[i]);
+
+	PruneRollups(datadir, rollupdir);
+
+	flock(lockfd, LOCK_UN);
+	close(lockfd);
+
+	return 0;
+
+} // End of main
@@ -0,0 +1,518 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nffile.h"
+#include "nfx.h"
+#include "nf_common.h"
+#include "nftree.h"
+#include "nfnet.h"
+#include "bookkeeper.h"
+#include "collector.h"
+#include "exporter.h"
+#include "flist.h"
+#include "util.h"
+#include "queue.h"
+#include "nfprof.h"
+#include "nfscan.h"
+
+#ifndef DEVEL
+#   define dbg_printf(...) /* printf(__VA_ARGS__) */
+#else
+#   define dbg_printf(...) printf(__VA_ARGS__)
+#endif
+
+/* a block or file change passed from the reader to the scanning thread */
+typedef struct scan_block_s {
+#define SCAN_DATA	1
+#define SCAN_FILE	2
+	int					type;
+	file_header_t		file_header;	// SCAN_FILE
+	stat_record_t		stat_record;	// SCAN_FILE
+	char				filename[MAXPATHLEN];	// SCAN_FILE: empty for stdin or live files
+	data_block_header_t	*block_header;	// SCAN_DATA: data block
+	uint32_t			size;			// SCAN_DATA: bytes read from file
+} scan_block_t;
+
+typedef struct scan_ctx_s {
+	scan_t			*scan;
+	nffile_t		*nffile;
+	queue_t			*freeQueue;		// empty blocks
+	queue_t			*workQueue;		// blocks to scan, in file order
+	scan_block_t	blocks[ScanBlocks];
+	common_record_t	*ConvertBuffer;	// converted v0 records
+	int				started;		// first file announced
+	int				readahead;		// blocks are read by ScanReader()
+#ifdef COMPAT15
+	int				v1_map_done;
+#endif
+} scan_ctx_t;
+
+extern generic_exporter_t **exporter_list;
+
+#ifdef COMPAT15
+extern extension_descriptor_t extension_descriptor[];
+#endif
+
+/* function prototypes */
+static void SetBlockFilename(scan_ctx_t *ctx, scan_block_t *block);
+
+static int ReadNextBlock(scan_ctx_t *ctx, scan_block_t *block);
+
+static void *ScanReader(void *arg);
+
+static int ScanNextBlock(scan_ctx_t *ctx, scan_block_t *block);
+
+static int ScanBlock(scan_ctx_t *ctx, data_block_header_t *block_header);
+
+#include "nffile_inline.c"
+
+/*
+ * The reader may be ahead of the scanning thread - the name of the file 
+ * is passed along with the file change
+ */
+static void SetBlockFilename(scan_ctx_t *ctx, scan_block_t *block) {
+char *filename = ctx->scan->live ? NULL : GetCurrentFilename();
+
+	if ( filename ) {
+		strncpy(block->filename, filename, MAXPATHLEN-1);
+		block->filename[MAXPATHLEN-1] = '\0';
+	} else 
+		block->filename[0] = '\0';
+
+} // End of SetBlockFilename
+
+/*
+ * Read the next data block or file change of the file list into block
+ * returns 0 at the end of the file list
+ */
+static int ReadNextBlock(scan_ctx_t *ctx, scan_block_t *block) {
+nffile_t	*nffile	= ctx->nffile;
+void		*_tmp;
+int			ret;
+
+	if ( !ctx->started ) {
+		// announce first file
+		ctx->started = 1;
+		block->type = SCAN_FILE;
+		memcpy((void *)&block->file_header, (void *)nffile->file_header, sizeof(file_header_t));
+		memcpy((void *)&block->stat_record, (void *)nffile->stat_record, sizeof(stat_record_t));
+		SetBlockFilename(ctx, block);
+		return 1;
+	}
+
+	// get next data block from file
+	ret = ctx->scan->live ? ReadLiveBlock(ctx->scan->live, nffile) : ReadBlock(nffile);
+
+	switch (ret) {
+		case NF_CORRUPT:
+		case NF_ERROR:
+			if ( ret == NF_CORRUPT ) 
+				LogError("Skip corrupt data file '%s'\n",GetCurrentFilename());
+			else 
+				LogError("Read error in file '%s': %s\n",GetCurrentFilename(), strerror(errno) );
+			// fall through - get next file in chain
+		case NF_EOF: {
+			nffile_t *next;
+			if ( ctx->scan->live ) {
+				// next file of the collector - NULL: stopped
+				next = OpenLiveFile(ctx->scan->live, nffile);
+				if ( next == NULL ) 
+					return 0;
+				ctx->nffile = next;
+			} else
+				next = GetNextFile(nffile, ctx->scan->twin_start, ctx->scan->twin_end);
+			if ( next == EMPTY_LIST ) 
+				return 0;
+			if ( next == NULL ) {
+				LogError("Unexpected end of file list\n");
+				return 0;
+			}
+			// announce next file
+			block->type = SCAN_FILE;
+			memcpy((void *)&block->file_header, (void *)next->file_header, sizeof(file_header_t));
+			memcpy((void *)&block->stat_record, (void *)next->stat_record, sizeof(stat_record_t));
+			SetBlockFilename(ctx, block);
+			return 1;
+			} break; // not really needed
+	}
+
+	// successfully read block
+	block->type = SCAN_DATA;
+	block->size = ret;
+
+	if ( !ctx->readahead ) {
+		// scan block in file buffer
+		block->block_header = nffile->block_header;
+		return 1;
+	}
+
+	// hand over the block buffer to the scanning thread and continue with an empty one
+	// the uncompressed block is always in buff_pool[0]
+	_tmp = nffile->buff_pool[0];
+	nffile->buff_pool[0] = (void *)block->block_header;
+	block->block_header	 = (data_block_header_t *)_tmp;
+	nffile->block_header = nffile->buff_pool[0];
+	nffile->buff_ptr	 = (void *)((pointer_addr_t)nffile->block_header + sizeof(data_block_header_t));
+
+	return 1;
+
+} // End of ReadNextBlock
+
+static void *ScanReader(void *arg) {
+scan_ctx_t		*ctx = (scan_ctx_t *)arg;
+scan_block_t	*block;
+
+	while ( (block = queue_pop(ctx->freeQueue)) != QUEUE_CLOSED ) {
+		if ( !ReadNextBlock(ctx, block) ) 
+			break;
+		if ( queue_push(ctx->workQueue, (void *)block) == QUEUE_CLOSED ) 
+			break;
+	}
+
+	// all files read or scan stopped
+	queue_close(ctx->workQueue);
+
+	return NULL;
+
+} // End of ScanReader
+
+static int ScanNextBlock(scan_ctx_t *ctx, scan_block_t *block) {
+scan_t *scan = ctx->scan;
+
+	if ( block->type == SCAN_FILE ) {
+		if ( scan->file ) 
+			return scan->file(scan->data, block->filename[0] ? block->filename : NULL, 
+				&block->file_header, &block->stat_record);
+		return SCAN_CONTINUE;
+	}
+
+	scan->total_bytes += block->size;
+	return ScanBlock(ctx, block->block_header);
+
+} // End of ScanNextBlock
+
+static int ScanBlock(scan_ctx_t *ctx, data_block_header_t *block_header) {
+scan_t					*scan = ctx->scan;
+extension_map_list_t	*extension_map_list = scan->extension_map_list;
+FilterEngine_data_t		*engine = scan->engine;
+time_t					twin_start = scan->twin_start;
+time_t					twin_end   = scan->twin_end;
+common_record_t			*flow_record, *record_ptr;
+uint32_t				num_flows;
+int						i;
+
+	if ( scan->block && scan->block(scan->data, block_header) == SCAN_SKIP ) 
+		return SCAN_CONTINUE;
+
+#ifdef COMPAT15
+	if ( block_header->id == DATA_BLOCK_TYPE_1 ) {
+		common_record_v1_t *v1_record = (common_record_v1_t *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+		// create an extension map for v1 blocks
+		if ( ctx->v1_map_done == 0 ) {
+			extension_map_t *map = malloc(sizeof(extension_map_t) + 2 * sizeof(uint16_t) );
+			if ( ! map ) {
+				LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+				exit(255);
+			}
+			map->type 	= ExtensionMapType;
+			map->size 	= sizeof(extension_map_t) + 2 * sizeof(uint16_t);
+			if (( map->size & 0x3 ) != 0 ) {
+				map->size += 4 - ( map->size & 0x3 );
+			}
+
+			map->map_id = INIT_ID;
+
+			map->ex_id[0]  = EX_IO_SNMP_2;
+			map->ex_id[1]  = EX_AS_2;
+			map->ex_id[2]  = 0;
+			
+			map->extension_size  = 0;
+			map->extension_size += extension_descriptor[EX_IO_SNMP_2].size;
+			map->extension_size += extension_descriptor[EX_AS_2].size;
+
+			if ( Insert_Extension_Map(extension_map_list, map) && scan->map ) 
+				scan->map(scan->data, map);
+
+			ctx->v1_map_done = 1;
+		}
+
+		// convert the records to v2
+		for ( i=0; i < block_header->NumRecords; i++ ) {
+			common_record_t *v2_record = (common_record_t *)v1_record;
+			Convert_v1_to_v2((void *)v1_record);
+			// now we have a v2 record -> use size of v2_record->size
+			v1_record = (common_record_v1_t *)((pointer_addr_t)v1_record + v2_record->size);
+		}
+		block_header->id = DATA_BLOCK_TYPE_2;
+	}
+#endif
+
+	if ( block_header->id == Large_BLOCK_Type ) {
+		// skip
+		return SCAN_CONTINUE;
+	}
+
+	if ( block_header->id != DATA_BLOCK_TYPE_2 ) {
+		if ( block_header->id == DATA_BLOCK_TYPE_1 ) {
+			LogError("Can't process nfdump 1.5.x block type 1. Add --enable-compat15 to compile compatibility code. Skip block.\n");
+		} else {
+			LogError("Can't process block type %u. Skip block.\n", block_header->id);
+		}
+		scan->skipped_blocks++;
+		return SCAN_CONTINUE;
+	}
+
+	num_flows  = 0;
+	record_ptr = (common_record_t *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+	for ( i=0; i < block_header->NumRecords; i++ ) {
+		flow_record = record_ptr;
+		switch ( record_ptr->type ) {
+			case CommonRecordV0Type: 
+				// convert common record v0
+				ConvertCommonV0((void *)record_ptr, ctx->ConvertBuffer);
+				flow_record = ctx->ConvertBuffer;
+				dbg_printf("Converted type %u to %u record\n", CommonRecordV0Type, CommonRecordType);
+			case CommonRecordType: {
+				int match;
+				uint32_t map_id;
+				generic_exporter_t *exp_info;
+				master_record_t	*master_record;
+
+				// valid flow_record converted if needed
+				map_id = flow_record->ext_map;
+				exp_info = exporter_list ? exporter_list[flow_record->exporter_sysid] : NULL;
+
+				if ( map_id >= MAX_EXTENSION_MAPS ) {
+					LogError("Corrupt data file. Extension map id %u too big.\n", flow_record->ext_map);
+					exit(255);
+				}
+				if ( extension_map_list->slot[map_id] == NULL ) {
+					LogError("Corrupt data file. Missing extension map %u. Skip record.\n", flow_record->ext_map);
+					break;
+				} 
+
+				num_flows++;
+				master_record = &(extension_map_list->slot[map_id]->master_record);
+				PROF_START(PROF_EXPAND, PROF_SAMPLED);
+				ExpandRecord_v2( flow_record, extension_map_list->slot[map_id], 
+					exp_info ? &(exp_info->info) : NULL, master_record);
+				PROF_END(PROF_EXPAND);
+
+				// Time based filter
+				// if no time filter is given, the result is always true
+				match = twin_start && (master_record->first < twin_start || master_record->last > twin_end) ? 0 : 1;
+
+				// filter netflow record with user supplied filter
+				if ( match && engine ) {
+					PROF_START(PROF_FILTER, PROF_SAMPLED);
+					engine->nfrecord = (uint64_t *)master_record;
+					match = (*engine->FilterEngine)(engine);
+					PROF_END(PROF_FILTER);
+				}
+
+				if ( match == 0 ) // record failed to pass all filters
+					break;
+
+				// update number of flows matching a given map
+				extension_map_list->slot[map_id]->ref_count++;
+				if ( engine ) 
+					master_record->label = engine->label;
+
+				if ( scan->flow && 
+					 scan->flow(scan->data, flow_record, master_record, extension_map_list->slot[map_id]) == SCAN_STOP ) {
+					scan->total_flows += num_flows;
+					return SCAN_STOP;
+				}
+
+				} break; 
+			case ExtensionMapType: {
+				extension_map_t *map = (extension_map_t *)record_ptr;
+
+				if ( Insert_Extension_Map(extension_map_list, map) && scan->map ) {
+					// new map
+					scan->map(scan->data, map);
+				} // else map already known
+				} break;
+			case ExporterRecordType:
+			case SamplerRecordype:
+					// Silently skip exporter records
+				break;
+			case ExporterInfoRecordType: {
+				int ret;
+				if ( !exporter_list ) 
+					break;
+				ret = AddExporterInfo((exporter_info_record_t *)record_ptr);
+				if ( ret != 0 ) {
+					if ( ret == 1 && scan->exporter ) 
+						scan->exporter(scan->data, (record_header_t *)record_ptr);
+				} else {
+					LogError("Failed to add Exporter Record\n");
+				}
+				} break;
+			case ExporterStatRecordType:
+				if ( exporter_list ) 
+					AddExporterStat((exporter_stats_record_t *)record_ptr);
+				break;
+			case SamplerInfoRecordype: {
+				int ret;
+				if ( !exporter_list ) 
+					break;
+				ret = AddSamplerInfo((sampler_info_record_t *)record_ptr);
+				if ( ret != 0 ) {
+					if ( ret == 1 && scan->exporter ) 
+						scan->exporter(scan->data, (record_header_t *)record_ptr);
+				} else {
+					LogError("Failed to add Sampler Record\n");
+				}
+				} break;
+			case StatTableRecordType:
+			case StatElementRecordType:
+			case FlowTableRecordType:
+				if ( scan->stat ) 
+					scan->stat(scan->data, (record_header_t *)record_ptr);
+				break;
+			default: {
+				LogError("Skip unknown record type %i\n", record_ptr->type);
+			}
+		}
+
+		// Advance pointer by number of bytes for netflow record
+		record_ptr = (common_record_t *)((pointer_addr_t)record_ptr + record_ptr->size);	
+
+	} // for all records
+	scan->total_flows += num_flows;
+
+	return SCAN_CONTINUE;
+
+} // End of ScanBlock
+
+int ScanFiles(scan_t *scan) {
+scan_ctx_t		ctx;
+scan_block_t	*block;
+pthread_t		tid;
+int				i, err, done;
+
+	memset((void *)&ctx, 0, sizeof(scan_ctx_t));
+	ctx.scan = scan;
+
+	// Get the first file handle
+	if ( scan->live ) {
+		ctx.nffile = OpenLiveFile(scan->live, NULL);
+		if ( !ctx.nffile ) 
+			return 0;
+	} else
+		ctx.nffile = GetNextFile(NULL, scan->twin_start, scan->twin_end);
+	if ( !ctx.nffile ) {
+		LogError("GetNextFile() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+	if ( ctx.nffile == EMPTY_LIST ) {
+		LogError("Empty file list. No files to process\n");
+		return 0;
+	}
+
+	ctx.freeQueue = queue_init(ScanBlocks);
+	ctx.workQueue = queue_init(ScanBlocks);
+	ctx.ConvertBuffer = (common_record_t *)malloc(65536);
+	if ( !ctx.freeQueue || !ctx.workQueue || !ctx.ConvertBuffer ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	// no reader thread on single CPU systems - it only competes for the CPU and the cache
+	ctx.readahead = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+
+	if ( ctx.readahead ) {
+		for ( i=0; i < ScanBlocks; i++ ) {
+			// block buffers are swapped with the file buffers - same size required
+			ctx.blocks[i].block_header = (data_block_header_t *)malloc(ctx.nffile->buff_size);
+			if ( !ctx.blocks[i].block_header ) {
+				LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+				exit(255);
+			}
+			queue_push(ctx.freeQueue, (void *)&ctx.blocks[i]);
+		}
+
+		err = pthread_create(&tid, NULL, ScanReader, (void *)&ctx);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err) );
+			exit(255);
+		}
+
+		done = 0;
+		while ( !done && (block = queue_pop(ctx.workQueue)) != QUEUE_CLOSED ) {
+			done = ScanNextBlock(&ctx, block) == SCAN_STOP;
+			queue_push(ctx.freeQueue, (void *)block);
+			if ( scan->live && scan->idle && queue_length(ctx.workQueue) == 0 ) 
+				scan->idle(scan->data);
+		}
+
+		// stop reader, if still running
+		if ( scan->live ) 
+			StopLiveFollow();
+		queue_close(ctx.freeQueue);
+		queue_close(ctx.workQueue);
+		pthread_join(tid, NULL);
+
+		for ( i=0; i < ScanBlocks; i++ ) 
+			free(ctx.blocks[i].block_header);
+	} else {
+		block = &ctx.blocks[0];
+		while ( ReadNextBlock(&ctx, block) && ScanNextBlock(&ctx, block) != SCAN_STOP ) {
+			if ( scan->live && scan->idle ) 
+				scan->idle(scan->data);
+		}
+	}
+
+	CloseFile(ctx.nffile);
+	DisposeFile(ctx.nffile);
+
+	free(ctx.ConvertBuffer);
+	queue_free(ctx.freeQueue);
+	queue_free(ctx.workQueue);
+
+	return 1;
+
+} // End of ScanFiles
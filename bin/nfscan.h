@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _NFSCAN_H
+#define _NFSCAN_H 1
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <time.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nffile.h"
+#include "nfx.h"
+#include "nftree.h"
+#include "nflive.h"
+
+/*
+ * Record scan engine
+ * Scans all files of the current file list ( SetupInputFileSequence() ) and
+ * passes the records to the callbacks of a scan. A reader thread reads and 
+ * decompresses the next blocks ahead, while the calling thread evaluates the 
+ * records of the current block. Flow records are converted and expanded, checked
+ * against the time window and the filter. Only matching flows are passed to
+ * the flow callback. Exporter and sampler records are evaluated, if the exporter
+ * list is initialised ( InitExporterList() ), otherwise they are skipped.
+ * All callbacks are called in the context of the thread calling ScanFiles().
+ * If a live index is given, the blocks of the current file of a collector are 
+ * followed instead of the file list, until StopLiveFollow() is called.
+ */
+
+// return values of the file, flow and block callbacks
+#define SCAN_CONTINUE	0
+#define SCAN_STOP		1
+#define SCAN_SKIP		2
+
+// number of blocks read ahead
+#define ScanBlocks	4
+
+typedef struct scan_s {
+	// time window of flows - twin_start == 0: no time window
+	time_t				twin_start;
+	time_t				twin_end;
+	// filter - NULL: all flows match
+	FilterEngine_data_t	*engine;
+	extension_map_list_t *extension_map_list;
+	// user data passed to all callbacks
+	void				*data;
+	// follow the files of this live index - NULL: scan the file list
+	nflive_t			*live;
+
+	// callbacks - any of them may be NULL
+	// next file in file list. filename is NULL for stdin or live files. SCAN_STOP stops the scan
+	int (*file)(void *data, char *filename, file_header_t *file_header, stat_record_t *stat_record);
+	// next data block. SCAN_SKIP skips all records of this block
+	int (*block)(void *data, data_block_header_t *block_header);
+	// flow matched time window and filter. SCAN_STOP stops the scan
+	int (*flow)(void *data, common_record_t *flow_record, master_record_t *master_record, 
+		extension_info_t *extension_info);
+	// new extension map
+	void (*map)(void *data, extension_map_t *map);
+	// new exporter or sampler record
+	void (*exporter)(void *data, record_header_t *record);
+	// stat table or stat element record of a partial result file
+	void (*stat)(void *data, record_header_t *record);
+	// live index only: all blocks written so far are scanned
+	void (*idle)(void *data);
+
+	// scan statistics
+	uint64_t	total_bytes;	// bytes read from files
+	uint32_t	total_flows;	// flows read
+	uint32_t	skipped_blocks;	// blocks of unknown type
+} scan_t;
+
+// returns 0, if no file could be opened, 1 otherwise
+int ScanFiles(scan_t *scan);
+
+#endif //_NFSCAN_H
@@ -0,0 +1,387 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nffile.h"
+#include "nfx.h"
+#include "util.h"
+#include "nfprof.h"
+#include "nfsort.h"
+
+#ifndef DEVEL
+#   define dbg_printf(...) /* printf(__VA_ARGS__) */
+#else
+#   define dbg_printf(...) printf(__VA_ARGS__)
+#endif
+
+// size of a sort record in the run buffer or tmp file - 64bit aligned
+#define SortRecordSize(r) ((offsetof(SortRecord_t, flowrecord) + (r)->flowrecord.size + 7) & ~7)
+
+/* a sorted run in the tmp file */
+typedef struct SortRun_s {
+	off_t		offset;		// start of run in tmp file
+	off_t		end;		// end of run in tmp file
+	uint64_t	last_key;	// key of last record in run
+
+	// merge state
+	char		*buff;		// read buffer
+	uint32_t	fill;		// bytes in read buffer
+	uint32_t	pos;		// current record in read buffer
+} SortRun_t;
+
+/* locals */
+static struct FlowSort_s {
+	// run buffer
+	char			*buff;
+	uint32_t		used;
+	SortRecord_t	**index;
+	uint32_t		NumRecords;
+	uint32_t		MaxRecords;
+
+	// spilled runs
+	FILE			*tmpfile;
+	off_t			tmpsize;
+	SortRun_t		*runs;
+	uint32_t		NumRuns;
+	uint32_t		MaxRuns;
+
+	// merge state
+	uint32_t		*heap;
+	uint32_t		HeapSize;
+	uint32_t		next;		// next index in run buffer, if nothing was spilled
+	SortRun_t		*pending;	// run of the last returned record
+} FlowSort;
+
+static int	initialised = 0;
+
+/* function prototypes */
+static int SortRecordCmp(const void *p1, const void *p2);
+
+static void FlushRun(void);
+
+static int FillRun(SortRun_t *run);
+
+static inline int RunLess(uint32_t r1, uint32_t r2);
+
+static void SiftDown(uint32_t node);
+
+static int SortRecordCmp(const void *p1, const void *p2) {
+SortRecord_t *r1 = *(SortRecord_t **)p1;
+SortRecord_t *r2 = *(SortRecord_t **)p2;
+
+	if ( r1->key != r2->key ) 
+		return r1->key < r2->key ? -1 : 1;
+
+	// keep the records of the same time in the sequence they were read
+	return r1 < r2 ? -1 : (r1 > r2);
+
+} // End of SortRecordCmp
+
+int Init_FlowSort(void) {
+
+	if ( initialised )
+		return 1;
+
+	memset((void *)&FlowSort, 0, sizeof(FlowSort));
+	FlowSort.buff = malloc(SortBuffSize);
+	FlowSort.MaxRecords = 1024 * 1024;
+	FlowSort.index = (SortRecord_t **)malloc(FlowSort.MaxRecords * sizeof(SortRecord_t *));
+	if ( !FlowSort.buff || !FlowSort.index ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	initialised = 1;
+	return 1;
+
+} // End of Init_FlowSort
+
+void Dispose_FlowSort(void) {
+uint32_t i;
+
+	if ( !initialised ) 
+		return;
+
+	for ( i=0; i<FlowSort.NumRuns; i++ ) 
+		free(FlowSort.runs[i].buff);
+	free(FlowSort.runs);
+	free(FlowSort.heap);
+	free(FlowSort.index);
+	free(FlowSort.buff);
+	if ( FlowSort.tmpfile )
+		fclose(FlowSort.tmpfile);
+
+	initialised = 0;
+
+} // End of Dispose_FlowSort
+
+void SortFlow(common_record_t *raw_record, extension_info_t *extension_info, exporter_info_record_t *exp_ref) {
+SortRecord_t *record;
+uint32_t size;
+
+	size = (offsetof(SortRecord_t, flowrecord) + raw_record->size + 7) & ~7;
+	if ( (FlowSort.used + size) > SortBuffSize ) 
+		FlushRun();
+
+	if ( FlowSort.NumRecords == FlowSort.MaxRecords ) {
+		FlowSort.MaxRecords *= 2;
+		FlowSort.index = (SortRecord_t **)realloc(FlowSort.index, FlowSort.MaxRecords * sizeof(SortRecord_t *));
+		if ( !FlowSort.index ) {
+			LogError("realloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+	}
+
+	record = (SortRecord_t *)(FlowSort.buff + FlowSort.used);
+	record->key = 1000LL * raw_record->first + raw_record->msec_first;
+	record->map_info_ref = extension_info;
+	record->exp_ref		 = exp_ref;
+	memcpy((void *)&record->flowrecord, (void *)raw_record, raw_record->size);
+
+	FlowSort.index[FlowSort.NumRecords++] = record;
+	FlowSort.used += size;
+
+} // End of SortFlow
+
+static void FlushRun(void) {
+SortRun_t *run;
+uint32_t i;
+
+	if ( FlowSort.NumRecords == 0 )
+		return;
+
+	if ( !FlowSort.tmpfile ) {
+		FlowSort.tmpfile = tmpfile();
+		if ( !FlowSort.tmpfile ) {
+			LogError("tmpfile() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+	}
+
+	qsort(FlowSort.index, FlowSort.NumRecords, sizeof(SortRecord_t *), SortRecordCmp);
+
+	// flow files are mostly time ordered - if this run starts after the last one 
+	// ends, just extend the last run instead of adding a new one to the merge
+	run = FlowSort.NumRuns ? &FlowSort.runs[FlowSort.NumRuns-1] : NULL;
+	if ( !run || run->last_key > FlowSort.index[0]->key ) {
+		if ( FlowSort.NumRuns == FlowSort.MaxRuns ) {
+			FlowSort.MaxRuns += 64;
+			FlowSort.runs = (SortRun_t *)realloc(FlowSort.runs, FlowSort.MaxRuns * sizeof(SortRun_t));
+			if ( !FlowSort.runs ) {
+				LogError("realloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+				exit(255);
+			}
+		}
+		run = &FlowSort.runs[FlowSort.NumRuns++];
+		memset((void *)run, 0, sizeof(SortRun_t));
+		run->offset = FlowSort.tmpsize;
+	}
+
+	for ( i=0; i<FlowSort.NumRecords; i++ ) {
+		SortRecord_t *record = FlowSort.index[i];
+		uint32_t size = SortRecordSize(record);
+		if ( fwrite((void *)record, size, 1, FlowSort.tmpfile) != 1 ) {
+			LogError("fwrite() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		FlowSort.tmpsize += size;
+	}
+	run->end	  = FlowSort.tmpsize;
+	run->last_key = FlowSort.index[FlowSort.NumRecords-1]->key;
+	dbg_printf("Flush %u records into run %u\n", FlowSort.NumRecords, FlowSort.NumRuns-1);
+
+	FlowSort.NumRecords = 0;
+	FlowSort.used		= 0;
+
+} // End of FlushRun
+
+static int FillRun(SortRun_t *run) {
+SortRecord_t *record;
+uint32_t left;
+ssize_t ret;
+
+	left = run->fill - run->pos;
+	if ( left >= offsetof(SortRecord_t, flowrecord) + sizeof(record_header_t) ) {
+		record = (SortRecord_t *)(run->buff + run->pos);
+		if ( left >= SortRecordSize(record) )
+			return 1;
+	}
+
+	// move the incomplete record to the start of the buffer and read the next chunk
+	if ( left ) 
+		memmove(run->buff, run->buff + run->pos, left);
+	run->fill = left;
+	run->pos  = 0;
+
+	if ( run->offset < run->end ) {
+		size_t want = SortReadSize - left;
+		if ( (off_t)want > (run->end - run->offset) )
+			want = run->end - run->offset;
+		ret = pread(fileno(FlowSort.tmpfile), run->buff + left, want, run->offset);
+		if ( ret <= 0 ) {
+			LogError("pread() error in %s line %d: %s\n", __FILE__, __LINE__, ret == 0 ? "Short read" : strerror(errno) );
+			exit(255);
+		}
+		run->offset += ret;
+		run->fill	+= ret;
+	}
+
+	return run->fill > 0;
+
+} // End of FillRun
+
+static inline int RunLess(uint32_t r1, uint32_t r2) {
+uint64_t k1 = ((SortRecord_t *)(FlowSort.runs[r1].buff + FlowSort.runs[r1].pos))->key;
+uint64_t k2 = ((SortRecord_t *)(FlowSort.runs[r2].buff + FlowSort.runs[r2].pos))->key;
+
+	// equal times: the earlier run wins
+	return k1 < k2 || ( k1 == k2 && r1 < r2 );
+
+} // End of RunLess
+
+static void SiftDown(uint32_t node) {
+uint32_t *heap = FlowSort.heap;
+uint32_t size  = FlowSort.HeapSize;
+
+	while ( 1 ) {
+		uint32_t smallest = node;
+		uint32_t child = 2 * node + 1;
+		if ( child < size && RunLess(heap[child], heap[smallest]) )
+			smallest = child;
+		child++;
+		if ( child < size && RunLess(heap[child], heap[smallest]) )
+			smallest = child;
+		if ( smallest == node )
+			break;
+		uint32_t tmp = heap[node];
+		heap[node] = heap[smallest];
+		heap[smallest] = tmp;
+		node = smallest;
+	}
+
+} // End of SiftDown
+
+int StartSortedFlows(void) {
+uint32_t i;
+
+	FlowSort.next	 = 0;
+	FlowSort.pending = NULL;
+
+	if ( FlowSort.NumRuns == 0 ) {
+		// everything fits into the run buffer - sort and return in memory
+		PROF_START(PROF_SORT, PROF_ALL);
+		if ( FlowSort.NumRecords > 1 )
+			qsort(FlowSort.index, FlowSort.NumRecords, sizeof(SortRecord_t *), SortRecordCmp);
+		PROF_END(PROF_SORT);
+		return 1;
+	}
+
+	PROF_START(PROF_SORT, PROF_ALL);
+	FlushRun();
+	PROF_END(PROF_SORT);
+	if ( fflush(FlowSort.tmpfile) != 0 ) {
+		LogError("fflush() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	// the run buffer is no longer needed
+	free(FlowSort.buff);
+	free(FlowSort.index);
+	FlowSort.buff  = NULL;
+	FlowSort.index = NULL;
+
+	FlowSort.heap = (uint32_t *)malloc(FlowSort.NumRuns * sizeof(uint32_t));
+	if ( !FlowSort.heap ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	FlowSort.HeapSize = 0;
+	for ( i=0; i<FlowSort.NumRuns; i++ ) {
+		SortRun_t *run = &FlowSort.runs[i];
+		run->buff = malloc(SortReadSize);
+		if ( !run->buff ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			return 0;
+		}
+		if ( FillRun(run) ) 
+			FlowSort.heap[FlowSort.HeapSize++] = i;
+	}
+	dbg_printf("Merge %u runs\n", FlowSort.NumRuns);
+
+	for ( i = FlowSort.HeapSize / 2; i > 0; i-- ) 
+		SiftDown(i - 1);
+
+	return 1;
+
+} // End of StartSortedFlows
+
+SortRecord_t *NextSortedFlow(void) {
+SortRun_t *run;
+
+	if ( FlowSort.NumRuns == 0 ) {
+		return FlowSort.next < FlowSort.NumRecords ? FlowSort.index[FlowSort.next++] : NULL;
+	}
+
+	// advance the run of the previously returned record
+	if ( FlowSort.pending ) {
+		run = FlowSort.pending;
+		run->pos += SortRecordSize((SortRecord_t *)(run->buff + run->pos));
+		if ( !FillRun(run) ) {
+			// run exhausted
+			FlowSort.heap[0] = FlowSort.heap[--FlowSort.HeapSize];
+		}
+		FlowSort.pending = NULL;
+		if ( FlowSort.HeapSize )
+			SiftDown(0);
+	}
+
+	if ( FlowSort.HeapSize == 0 )
+		return NULL;
+
+	run = &FlowSort.runs[FlowSort.heap[0]];
+	FlowSort.pending = run;
+
+	return (SortRecord_t *)(run->buff + run->pos);
+
+} // End of NextSortedFlow
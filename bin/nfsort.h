@@ -0,0 +1,77 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _NFSORT_H
+#define _NFSORT_H 1
+
+#include "config.h"
+
+#include <sys/types.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nffile.h"
+#include "nfx.h"
+
+/*
+ * Time sorted flow output without aggregation ( -O tstart, -m )
+ * Flows are collected in a fixed size run buffer. A full buffer is sorted and
+ * spilled as sorted run into a temporary file. The runs are merged by a heap, 
+ * so memory stays bounded, independant of the number of flows to sort.
+ */
+
+/* Element of a sort run */
+typedef struct SortRecord_s {
+	uint64_t			key;			// 1000 * first + msec_first
+	extension_info_t	*map_info_ref;
+	exporter_info_record_t *exp_ref;
+	// flow record follows
+	common_record_t		flowrecord;
+	// no further vars beyond this point! The flow record above has additional data.
+} SortRecord_t;
+
+// size of the run buffer
+#define SortBuffSize	(64*1024*1024)
+
+// read buffer per spilled run, while merging
+#define SortReadSize	(256*1024)
+
+int Init_FlowSort(void);
+
+void Dispose_FlowSort(void);
+
+void SortFlow(common_record_t *raw_record, extension_info_t *extension_info, exporter_info_record_t *exp_ref);
+
+int StartSortedFlows(void);
+
+SortRecord_t *NextSortedFlow(void);
+
+#endif //_NFSORT_H
@@ -59,8 +59,12 @@
 #include "netflow_v5_v7.h"
 #include "nf_common.h"
 #include "util.h"
+#include "output_util.h"
 #include "nflowcache.h"
+#include "nfsort.h"
 #include "nfstat.h"
+#include "radixsort.h"
+#include "nfprof.h"
 
 extern int hash_hit;
 extern int hash_miss;
@@ -451,12 +455,18 @@ enum { NONE = 0, LESS, MORE };
 /* function prototypes */
 static int ParseStatString(char *str, int16_t	*StatType, int *flow_record_stat, uint16_t *order_proto);
 
-static inline StatRecord_t *stat_hash_lookup(uint64_t *value, uint8_t prot, int hash_num);
+static inline uint64_t stat_hash(uint64_t *value, uint8_t prot, int hash_num);
 
-static inline StatRecord_t *stat_hash_insert(uint64_t *value, uint8_t prot, int hash_num);
+static inline StatSlot_t *stat_hash_lookup(uint64_t *value, uint8_t prot, uint64_t hash, int hash_num);
+
+static inline StatRecord_t *stat_hash_insert(StatSlot_t *slot, uint64_t *value, uint8_t prot, uint64_t hash, int hash_num);
 
 static void Expand_StatTable_Blocks(int hash_num);
 
+static void Expand_StatTable_Slots(int hash_num);
+
+static void FlushStatBatch(void);
+
 static inline void PrintSortedFlowcache(SortElement_t *SortList, uint32_t maxindex, int limit_count, int GuessFlowDirection, 
 	printer_t print_record, int tag, int ascending, extension_map_list_t *extension_map_list );
 
@@ -477,11 +487,50 @@ static hash_StatTable *StatTable;
 static SumRecord_t SumRecord;
 static int initialised = 0;
 
+// initial width of the stat hash tables
+#define StatInitBits	16
+
+// number of pending stat updates
+#define StatBatchSize	256
+
+/* flow values of pending stat updates */
+typedef struct StatFlow_s {
+	uint64_t	dOctets;
+	uint64_t	dPkts;
+	uint64_t	out_bytes;
+	uint64_t	out_pkts;
+	uint64_t	flows;
+	uint32_t	first;
+	uint32_t	last;
+	uint16_t	msec_first;
+	uint16_t	msec_last;
+	uint8_t		flags;
+	uint8_t		prot;
+} StatFlow_t;
+
+/* pending stat update of a key */
+typedef struct StatUpdate_s {
+	uint64_t	value[2];
+	uint64_t	hash;
+	uint32_t	hash_num;
+	uint32_t	flow;		// index into StatBatch.flow
+} StatUpdate_t;
+
+static struct StatBatch_s {
+	uint32_t		NumUpdates;
+	uint32_t		NumFlows;
+	StatUpdate_t	update[StatBatchSize];
+	StatFlow_t		flow[StatBatchSize];
+} StatBatch;
+
+/* tables of the partial file currently merged: table id -> hash_num, -1: not requested */
+static int16_t	PartialTable[256];
+static uint32_t	PartialTablesSeen;
+
 
 /* Functions */
 
 #include "nffile_inline.c"
-#include "heapsort_inline.c"
 #include "applybits_inline.c"
 
 static uint64_t	null_record(FlowTableRecord_t *record, int inout) {
@@ -764,6 +813,9 @@ int		 hash_num;
 
 	memset((void *)&SumRecord, 0, sizeof(SumRecord));
 
+	// the tables grow on demand - start small, as many -s stats may be requested
+	if ( NumBits > StatInitBits )
+		NumBits = StatInitBits;
 	maxindex = (1 << NumBits);
 
 	StatTable = (hash_StatTable *)calloc(NumStats, sizeof(hash_StatTable));
@@ -775,10 +827,10 @@ int		 hash_num;
 	for ( hash_num=0; hash_num<NumStats; hash_num++ ) {
 		StatTable[hash_num].IndexMask   = maxindex -1;
 		StatTable[hash_num].NumBits     = NumBits;
+		StatTable[hash_num].NumRecords  = 0;
 		StatTable[hash_num].Prealloc    = Prealloc;
-		StatTable[hash_num].bucket	  	= (StatRecord_t **)calloc(maxindex, sizeof(StatRecord_t *));
-		StatTable[hash_num].bucketcache = (StatRecord_t **)calloc(maxindex, sizeof(StatRecord_t *));
-		if ( !StatTable[hash_num].bucket || !StatTable[hash_num].bucketcache ) {
+		StatTable[hash_num].slots	  	= (StatSlot_t *)calloc(maxindex, sizeof(StatSlot_t));
+		if ( !StatTable[hash_num].slots ) {
 			fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
 			return 0;
 		}
@@ -804,6 +856,9 @@ int		 hash_num;
 		}
 	}
 
+	memset((void *)PartialTable, 0xff, sizeof(PartialTable));
+	PartialTablesSeen = 0;
+
 	initialised = 1;
 	return 1;
 
@@ -816,7 +871,7 @@ unsigned int i, hash_num;
 		return;
 
 	for ( hash_num=0; hash_num<NumStats; hash_num++ ) {
-		free((void *)StatTable[hash_num].bucket);
+		free((void *)StatTable[hash_num].slots);
 		for ( i=0; i<StatTable[hash_num].NumBlocks; i++ ) 
 			free((void *)StatTable[hash_num].memblock[i]);
 		free((void *)StatTable[hash_num].memblock);
@@ -971,29 +1026,70 @@ int Parse_PrintOrder(char *order) {
 
 } // End of Parse_PrintOrder
 
-static inline StatRecord_t *stat_hash_lookup(uint64_t *value, uint8_t prot, int hash_num) {
-uint32_t		index;
-StatRecord_t	*record;
+static inline uint64_t stat_hash(uint64_t *value, uint8_t prot, int hash_num) {
+uint64_t h;
 
-	index = value[1] & StatTable[hash_num].IndexMask;
+	// keys are often IPv4 addresses or ports in value[1] only - mix all bits
+	h = value[1] ^ (value[0] * 0x9E3779B97F4A7C15LL);
+	if ( StatRequest[hash_num].order_proto ) 
+		h ^= (uint64_t)prot << 56;
 
-	if ( StatTable[hash_num].bucket[index] == NULL )
-		return NULL;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdLL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53LL;
+	h ^= h >> 33;
 
-	record = StatTable[hash_num].bucket[index];
-	if ( StatRequest[hash_num].order_proto ) {
-		while ( record && ( record->stat_key[1] != value[1] || record->stat_key[0] != value[0] || prot != record->prot ) ) {
-			record = record->next;
-		}
-	} else {
-		while ( record && ( record->stat_key[1] != value[1] || record->stat_key[0] != value[0] ) ) {
-			record = record->next;
-		}
+	return h;
+
+} // End of stat_hash
+
+static inline StatSlot_t *stat_hash_lookup(uint64_t *value, uint8_t prot, uint64_t hash, int hash_num) {
+StatSlot_t	*slots = StatTable[hash_num].slots;
+uint32_t	mask   = StatTable[hash_num].IndexMask;
+uint32_t	index;
+int			order_proto = StatRequest[hash_num].order_proto;
+
+	// returns the slot of the record or the empty slot to insert it
+	index = hash & mask;
+	while ( slots[index].record ) {
+		StatRecord_t *record = slots[index].record;
+		if ( slots[index].hash == hash && record->stat_key[1] == value[1] && record->stat_key[0] == value[0] &&
+			 ( !order_proto || prot == record->prot ) ) 
+			break;
+		index = (index + 1) & mask;
 	}
-	return record;
+	return &slots[index];
 
 } // End of stat_hash_lookup
 
+static void Expand_StatTable_Slots(int hash_num) {
+StatSlot_t	*old_slots = StatTable[hash_num].slots;
+uint32_t	old_size   = StatTable[hash_num].IndexMask + 1;
+uint32_t	i, mask;
+
+	StatTable[hash_num].NumBits++;
+	StatTable[hash_num].IndexMask = (1U << StatTable[hash_num].NumBits) - 1;
+	mask = StatTable[hash_num].IndexMask;
+	StatTable[hash_num].slots = (StatSlot_t *)calloc(mask + 1, sizeof(StatSlot_t));
+	if ( !StatTable[hash_num].slots ) {
+		fprintf(stderr, "calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror (errno));
+		exit(250);
+	}
+
+	for ( i=0; i<old_size; i++ ) {
+		uint32_t index;
+		if ( old_slots[i].record == NULL )
+			continue;
+		index = old_slots[i].hash & mask;
+		while ( StatTable[hash_num].slots[index].record )
+			index = (index + 1) & mask;
+		StatTable[hash_num].slots[index] = old_slots[i];
+	}
+	free(old_slots);
+
+} // End of Expand_StatTable_Slots
+
 static void Expand_StatTable_Blocks(int hash_num) {
 
 	if ( StatTable[hash_num].NumBlocks >= StatTable[hash_num].MaxBlocks ) {
@@ -1017,8 +1113,7 @@ static void Expand_StatTable_Blocks(int hash_num) {
 
 } // End of Expand_StatTable_Blocks
 
-static inline StatRecord_t *stat_hash_insert(uint64_t *value, uint8_t prot, int hash_num) {
-uint32_t		index;
+static inline StatRecord_t *stat_hash_insert(StatSlot_t *slot, uint64_t *value, uint8_t prot, uint64_t hash, int hash_num) {
 StatRecord_t	*record;
 
 	if ( StatTable[hash_num].NextElem >= StatTable[hash_num].Prealloc )
@@ -1026,25 +1121,74 @@ StatRecord_t	*record;
 
 	record = &(StatTable[hash_num].memblock[StatTable[hash_num].NextBlock][StatTable[hash_num].NextElem]);
 	StatTable[hash_num].NextElem++;
-	record->next     	= NULL;
 	record->stat_key[0] = value[0];
 	record->stat_key[1] = value[1];
 	record->prot		= prot;
 
-	index = value[1] & StatTable[hash_num].IndexMask;
-	if ( StatTable[hash_num].bucket[index] == NULL ) 
-		StatTable[hash_num].bucket[index] = record;
-	else
-		StatTable[hash_num].bucketcache[index]->next = record;
-	StatTable[hash_num].bucketcache[index] = record;
-	
+	slot->hash	 = hash;
+	slot->record = record;
+
+	// keep the load factor below 1/2
+	StatTable[hash_num].NumRecords++;
+	if ( (StatTable[hash_num].NumRecords << 1) > StatTable[hash_num].IndexMask ) 
+		Expand_StatTable_Slots(hash_num);
+
 	return record;
 
 } // End of stat_hash_insert
 
+static void FlushStatBatch(void) {
+uint32_t i;
+
+	for ( i=0; i<StatBatch.NumUpdates; i++ ) {
+		StatUpdate_t *update = &StatBatch.update[i];
+		StatFlow_t	 *flow	 = &StatBatch.flow[update->flow];
+		StatSlot_t	 *slot;
+		StatRecord_t *stat_record;
+
+		slot = stat_hash_lookup(update->value, flow->prot, update->hash, update->hash_num);
+		stat_record = slot->record;
+		if ( stat_record ) {
+			stat_record->counter[INBYTES] 	 += flow->dOctets;
+			stat_record->counter[INPACKETS]  += flow->dPkts;
+			stat_record->counter[OUTBYTES] 	 += flow->out_bytes;
+			stat_record->counter[OUTPACKETS] += flow->out_pkts;
+	
+			if ( TimeMsec_CMP(flow->first, flow->msec_first, stat_record->first, stat_record->msec_first) == 2) {
+				stat_record->first 		= flow->first;
+				stat_record->msec_first = flow->msec_first;
+			}
+			if ( TimeMsec_CMP(flow->last, flow->msec_last, stat_record->last, stat_record->msec_last) == 1) {
+				stat_record->last 		= flow->last;
+				stat_record->msec_last 	= flow->msec_last;
+			}
+			stat_record->counter[FLOWS] += flow->flows;
+
+		} else {
+			stat_record = stat_hash_insert(slot, update->value, flow->prot, update->hash, update->hash_num);
+	
+			stat_record->counter[INBYTES]   = flow->dOctets;
+			stat_record->counter[INPACKETS]	= flow->dPkts;
+			stat_record->counter[OUTBYTES] 	= flow->out_bytes;
+			stat_record->counter[OUTPACKETS]= flow->out_pkts;
+			stat_record->first    			= flow->first;
+			stat_record->msec_first 		= flow->msec_first;
+			stat_record->last				= flow->last;
+			stat_record->msec_last			= flow->msec_last;
+			stat_record->record_flags		= flow->flags & 0x1;
+			stat_record->counter[FLOWS]		= flow->flows;
+		}
+	}
+
+	StatBatch.NumUpdates = 0;
+	StatBatch.NumFlows	 = 0;
+
+} // End of FlushStatBatch
+
 void AddStat(common_record_t *raw_record, master_record_t *flow_record ) {
-StatRecord_t		*stat_record;
+StatFlow_t			*flow;
 uint64_t			value[2][2];
+uint32_t			flow_index;
 int	j, i;
 
 	SumRecord.ibyte += flow_record->dOctets;
@@ -1053,11 +1197,34 @@ int	j, i;
 	SumRecord.opkg  += flow_record->out_pkts;
 	SumRecord.flows += flow_record->aggr_flows ? flow_record->aggr_flows : 1;
 
+	/*
+	 * The stat updates are collected in a batch: the hash of each key is calculated 
+	 * and its slot prefetched now, the tables are updated when the batch is full.
+	 * Each flow adds up to 2 updates for each -s stat
+	 */
+	if ( (StatBatch.NumUpdates + 2 * NumStats) > StatBatchSize ) 
+		FlushStatBatch();
+
+	flow_index = StatBatch.NumFlows++;
+	flow = &StatBatch.flow[flow_index];
+	flow->dOctets	 = flow_record->dOctets;
+	flow->dPkts		 = flow_record->dPkts;
+	flow->out_bytes	 = flow_record->out_bytes;
+	flow->out_pkts	 = flow_record->out_pkts;
+	flow->flows		 = flow_record->aggr_flows ? flow_record->aggr_flows : 1;
+	flow->first		 = flow_record->first;
+	flow->last		 = flow_record->last;
+	flow->msec_first = flow_record->msec_first;
+	flow->msec_last	 = flow_record->msec_last;
+	flow->flags		 = flow_record->flags;
+	flow->prot		 = flow_record->prot;
+
 	// for every requested -s stat do
 	for ( j=0; j<NumStats; j++ ) {
 		int stat   = StatRequest[j].StatType;
 		// for the number of elements in this stat type
 		for ( i=0; i<StatParameters[stat].num_elem; i++ ) {
+			StatUpdate_t *update;
 			uint32_t offset = StatParameters[stat].element[i].offset1;
 			uint64_t mask	= StatParameters[stat].element[i].mask;
 			uint32_t shift	= StatParameters[stat].element[i].shift;
@@ -1073,42 +1240,144 @@ int	j, i;
 			if ( i == 1 && value[0][0] == value[1][0] && value[0][1] == value[1][1] ) {
 				break;
 			}
-			stat_record = stat_hash_lookup(value[i], flow_record->prot, j);
-			if ( stat_record ) {
-				stat_record->counter[INBYTES] 	 += flow_record->dOctets;
-				stat_record->counter[INPACKETS]  += flow_record->dPkts;
-				stat_record->counter[OUTBYTES] 	 += flow_record->out_bytes;
-				stat_record->counter[OUTPACKETS] += flow_record->out_pkts;
-		
-				if ( TimeMsec_CMP(flow_record->first, flow_record->msec_first, stat_record->first, stat_record->msec_first) == 2) {
-					stat_record->first 		= flow_record->first;
-					stat_record->msec_first = flow_record->msec_first;
-				}
-				if ( TimeMsec_CMP(flow_record->last, flow_record->msec_last, stat_record->last, stat_record->msec_last) == 1) {
-					stat_record->last 		= flow_record->last;
-					stat_record->msec_last 	= flow_record->msec_last;
-				}
-				stat_record->counter[FLOWS] += flow_record->aggr_flows ? flow_record->aggr_flows : 1;
 
-			} else {
-				stat_record = stat_hash_insert(value[i], flow_record->prot, j);
-		
-				stat_record->counter[INBYTES]   = flow_record->dOctets;
-				stat_record->counter[INPACKETS]	= flow_record->dPkts;
-				stat_record->counter[OUTBYTES] 	= flow_record->out_bytes;
-				stat_record->counter[OUTPACKETS]= flow_record->out_pkts;
-				stat_record->first    			= flow_record->first;
-				stat_record->msec_first 		= flow_record->msec_first;
-				stat_record->last				= flow_record->last;
-				stat_record->msec_last			= flow_record->msec_last;
-				stat_record->record_flags		= flow_record->flags & 0x1;
-				stat_record->counter[FLOWS]		= flow_record->aggr_flows ? flow_record->aggr_flows : 1;
-			}
+			update = &StatBatch.update[StatBatch.NumUpdates++];
+			update->value[0] = value[i][0];
+			update->value[1] = value[i][1];
+			update->hash	 = stat_hash(value[i], flow_record->prot, j);
+			update->hash_num = j;
+			update->flow	 = flow_index;
+			__builtin_prefetch(&StatTable[j].slots[update->hash & StatTable[j].IndexMask]);
+
 		} // for the number of elements in this stat type
 	} // for every requested -s stat
 
 } // End of AddStat
 
+int ExportStatTables(nffile_t *nffile) {
+stat_table_record_t		table_record;
+stat_element_record_t	element_record;
+uint32_t				i;
+int						hash_num;
+
+	FlushStatBatch();
+
+	for ( hash_num=0; hash_num<NumStats; hash_num++ ) {
+		StatSlot_t *slots = StatTable[hash_num].slots;
+
+		memset((void *)&table_record, 0, sizeof(stat_table_record_t));
+		table_record.type		 = StatTableRecordType;
+		table_record.size		 = sizeof(stat_table_record_t);
+		table_record.table		 = hash_num;
+		table_record.order_proto = StatRequest[hash_num].order_proto;
+		strncpy(table_record.statname, StatParameters[StatRequest[hash_num].StatType].statname, 
+			sizeof(table_record.statname)-1);
+		AppendToBuffer(nffile, (void *)&table_record, sizeof(stat_table_record_t));
+
+		memset((void *)&element_record, 0, sizeof(stat_element_record_t));
+		element_record.type	 = StatElementRecordType;
+		element_record.size	 = sizeof(stat_element_record_t);
+		element_record.table = hash_num;
+		for ( i=0; i<=StatTable[hash_num].IndexMask; i++ ) {
+			StatRecord_t *record = slots[i].record;
+			if ( !record ) 
+				continue;
+
+			element_record.prot			= record->prot;
+			element_record.record_flags	= record->record_flags;
+			element_record.first		= record->first;
+			element_record.last			= record->last;
+			element_record.msec_first	= record->msec_first;
+			element_record.msec_last	= record->msec_last;
+			memcpy((void *)element_record.counter, (void *)record->counter, sizeof(element_record.counter));
+			element_record.stat_key[0]	= record->stat_key[0];
+			element_record.stat_key[1]	= record->stat_key[1];
+			AppendToBuffer(nffile, (void *)&element_record, sizeof(stat_element_record_t));
+		}
+	}
+
+	return 1;
+
+} // End of ExportStatTables
+
+int MergeStatRecord(record_header_t *record) {
+stat_element_record_t	element_record;
+StatSlot_t				*slot;
+StatRecord_t			*stat_record;
+uint64_t				hash;
+int						hash_num, i;
+
+	if ( record->type == StatTableRecordType ) {
+		stat_table_record_t *table_record = (stat_table_record_t *)record;
+
+		if ( record->size < sizeof(stat_table_record_t) ) 
+			return 0;
+
+		// map the table to the same -s stat of this query - other stats are skipped
+		PartialTable[table_record->table] = -1;
+		for ( i=0; i<NumStats; i++ ) {
+			if ( StatRequest[i].order_proto == table_record->order_proto &&
+				 strncmp(StatParameters[StatRequest[i].StatType].statname, table_record->statname, 
+					sizeof(table_record->statname)) == 0 ) {
+				PartialTable[table_record->table] = i;
+				PartialTablesSeen |= 1 << i;
+				break;
+			}
+		}
+		return 1;
+	}
+
+	if ( record->size < sizeof(stat_element_record_t) ) 
+		return 0;
+
+	// records in a data block are 32bit aligned only
+	memcpy((void *)&element_record, (void *)record, sizeof(stat_element_record_t));
+	hash_num = PartialTable[element_record.table];
+	if ( hash_num < 0 ) 
+		return 1;
+
+	hash = stat_hash(element_record.stat_key, element_record.prot, hash_num);
+	slot = stat_hash_lookup(element_record.stat_key, element_record.prot, hash, hash_num);
+	stat_record = slot->record;
+	if ( stat_record ) {
+		for ( i=0; i<5; i++ ) 
+			stat_record->counter[i] += element_record.counter[i];
+	
+		if ( TimeMsec_CMP(element_record.first, element_record.msec_first, stat_record->first, stat_record->msec_first) == 2) {
+			stat_record->first 		= element_record.first;
+			stat_record->msec_first = element_record.msec_first;
+		}
+		if ( TimeMsec_CMP(element_record.last, element_record.msec_last, stat_record->last, stat_record->msec_last) == 1) {
+			stat_record->last 		= element_record.last;
+			stat_record->msec_last 	= element_record.msec_last;
+		}
+	} else {
+		stat_record = stat_hash_insert(slot, element_record.stat_key, element_record.prot, hash, hash_num);
+		memcpy((void *)stat_record->counter, (void *)element_record.counter, sizeof(stat_record->counter));
+		stat_record->first		  = element_record.first;
+		stat_record->msec_first	  = element_record.msec_first;
+		stat_record->last		  = element_record.last;
+		stat_record->msec_last	  = element_record.msec_last;
+		stat_record->record_flags = element_record.record_flags;
+	}
+
+	return 1;
+
+} // End of MergeStatRecord
+
+int MergedStatTables(void) {
+uint32_t all = (1U << NumStats) - 1;
+int		 complete;
+
+	// all requested -s stats found in the last partial file
+	complete = (PartialTablesSeen & all) == all;
+	PartialTablesSeen = 0;
+	memset((void *)PartialTable, 0xff, sizeof(PartialTable));
+
+	return complete;
+
+} // End of MergedStatTables
+
 static void PrintStatLine(stat_record_t	*stat, uint32_t plain_numbers, StatRecord_t *StatData, int type, int order_proto, int tag, int inout) {
 char		proto[16], valstr[40], datestr[64];
 char		flows_str[NUMBER_STRING_SIZE], byte_str[NUMBER_STRING_SIZE], packets_str[NUMBER_STRING_SIZE];
@@ -1494,7 +1763,7 @@ char				*string;
 		maxindex = c;
 
 		if ( c >= 2 )
- 			heapSort(SortList, c, 0);
+ 			SortElements(SortList, c, 0);
 
 		PrintSortedFlowcache(SortList, maxindex, topN, GuessDir, 
 			print_record, tag, order_mode[PrintOrder].direction, extension_map_list);
@@ -1509,8 +1778,10 @@ char				*string;
 				common_record_t *raw_record;
 				int map_id;
 
-				if ( topN && c >= topN )
+				if ( topN && c >= topN ) {
+					FlushOutput();
 					return;
+				}
 
 				// we want to print only those flows which pass the packet or byte limits
 				if ( byte_limit ) {
@@ -1554,17 +1825,54 @@ char				*string;
 				}
 				if ( GuessDir && ( flow_record->srcport < flow_record->dstport ) )
 					SwapFlow(flow_record);
+				PROF_START(PROF_PRINT, PROF_SAMPLED);
 				print_record((void *)flow_record, &string, tag);
-				printf("%s\n", string);
+				if ( string )
+					PrintLine(string);
+				PROF_END(PROF_PRINT);
 
 				c++;
 				r = r->next;
 			}
 		}
+		FlushOutput();
 	}
 
 } // End of PrintFlowTable
 
+void PrintSortedFlows(printer_t print_record, uint32_t topN, int tag, int GuessDir) {
+SortRecord_t	*r;
+uint32_t		c;
+char			*string;
+
+	if ( !StartSortedFlows() )
+		return;
+
+	c = 0;
+	while ( (r = NextSortedFlow()) != NULL ) {
+		master_record_t	*flow_record;
+
+		if ( topN && c >= topN ) 
+			break;
+
+		flow_record = &(r->map_info_ref->master_record);
+		ExpandRecord_v2( &(r->flowrecord), r->map_info_ref, r->exp_ref, flow_record);
+		if ( flow_record->aggr_flows == 0 )
+			flow_record->aggr_flows = 1;
+
+		if ( GuessDir && ( flow_record->srcport < flow_record->dstport ) )
+			SwapFlow(flow_record);
+		PROF_START(PROF_PRINT, PROF_SAMPLED);
+		print_record((void *)flow_record, &string, tag);
+		if ( string )
+			PrintLine(string);
+		PROF_END(PROF_PRINT);
+		c++;
+	}
+	FlushOutput();
+
+} // End of PrintSortedFlows
+
 void PrintFlowStat(char *record_header, printer_t print_record, int topN, int tag, int quiet, int cvs_output, extension_map_list_t *extension_map_list) {
 hash_FlowTable *FlowTable;
 FlowTableRecord_t	*r;
@@ -1633,7 +1941,7 @@ uint32_t			maxindex, c;
 		printf("Aggregated flows %u\n", maxindex);
 
 	if ( c >= 2 )
- 		heapSort(SortList, c, topN);
+ 		SortElements(SortList, c, topN);
 	if ( !quiet ) {
 		if ( !cvs_output ) {
 			if ( topN != 0 )
@@ -1661,7 +1969,7 @@ uint32_t			maxindex, c;
 			}
 
 			if ( maxindex >= 2 )
- 				heapSort(SortList, maxindex, topN);
+ 				SortElements(SortList, maxindex, topN);
 			if ( !quiet ) {
 				if ( !cvs_output ) {
 					if ( topN != 0 ) 
@@ -1738,9 +2046,13 @@ int	i, max;
 		if ( GuessFlowDirection && ( flow_record->srcport < flow_record->dstport ) )
 			SwapFlow(flow_record);
 
+		PROF_START(PROF_PRINT, PROF_SAMPLED);
 		print_record((void *)flow_record, &string, tag);
-		printf("%s\n", string);
+		if ( string )
+			PrintLine(string);
+		PROF_END(PROF_PRINT);
 	}
+	FlushOutput();
 
 } // End of PrintSortedFlowcache
 
@@ -1749,6 +2061,9 @@ SortElement_t	*topN_element_list;
 uint32_t		numflows;
 int32_t 		i, j, hash_num, order_index;
 
+	// apply pending stat updates
+	FlushStatBatch();
+
 	numflows = 0;
 	// for every requested -s stat do
 	for ( hash_num=0; hash_num<NumStats; hash_num++ ) {
@@ -1829,36 +2144,31 @@ uint32_t	   		c, maxindex;
 
 	// preset topN_list table - still unsorted
 	c = 0;
-	// Iterate through all buckets
-	for ( i=0; i <= StatTable[hash_num].IndexMask; i++ ) {
-		r = StatTable[hash_num].bucket[i];
-		// foreach elem in this bucket
-		while ( r ) {
-			// next elem in bucket
-
-			// we want to sort only those flows which pass the packet or byte limits
-			if ( byte_limit ) {
-			        value = bytes_element(r, order_mode[order].inout);
-				if (( byte_mode == LESS && value >= byte_limit ) ||
-					( byte_mode == MORE && value <= byte_limit ) ) {
-					r = r->next;
-					continue;
-				}
+	// Iterate through all stat records in the stat blocks. The records are listed in the
+	// order they were created and no longer in bucket order, so equal values may be
+	// printed in a different order than by nfdump versions with chained buckets.
+	for ( i=0; i < maxindex; i++ ) {
+		r = &(StatTable[hash_num].memblock[i / StatTable[hash_num].Prealloc][i % StatTable[hash_num].Prealloc]);
+
+		// we want to sort only those flows which pass the packet or byte limits
+		if ( byte_limit ) {
+		        value = bytes_element(r, order_mode[order].inout);
+			if (( byte_mode == LESS && value >= byte_limit ) ||
+				( byte_mode == MORE && value <= byte_limit ) ) {
+				continue;
 			}
-			if ( packet_limit ) {
-			        value = packets_element(r, order_mode[order].inout);
-				if (( packet_mode == LESS && value >= packet_limit ) ||
-					( packet_mode == MORE && value <= packet_limit ) ) {
-					r = r->next;
-					continue;
-				}
+		}
+		if ( packet_limit ) {
+		        value = packets_element(r, order_mode[order].inout);
+			if (( packet_mode == LESS && value >= packet_limit ) ||
+				( packet_mode == MORE && value <= packet_limit ) ) {
+				continue;
 			}
+		}
 
-			topN_list[c].count  = order_mode[order].element_function(r, order_mode[order].inout);
-			topN_list[c].record = (void *)r;
-			r = r->next;
-			c++;
-		} // foreach element
+		topN_list[c].count  = order_mode[order].element_function(r, order_mode[order].inout);
+		topN_list[c].record = (void *)r;
+		c++;
 	}
 	*count = c;
 	// printf ("Sort %u flows\n", c);
@@ -1870,7 +2180,7 @@ uint32_t	   		c, maxindex;
 
 	// Sorting makes only sense, when 2 or more flows are left
 	if ( c >= 2 )
- 		heapSort(topN_list, c, topN);
+ 		SortElements(topN_list, c, topN);
 
 	/*
 	for ( i = 0; i < maxindex; i++ ) 
@@ -63,8 +63,6 @@ typedef struct SumRecord_s {
 } SumRecord_t;
 
 typedef struct StatRecord {
-	// record chain
-	struct StatRecord *next;
 	// flow parameters
 	uint64_t	counter[5];	// flows ipkg ibyte opkg obyte
 	uint32_t	first;
@@ -79,12 +77,18 @@ typedef struct StatRecord {
 	uint64_t	stat_key[2];
 } StatRecord_t;
 
+/* slot of the open addressing hash table */
+typedef struct StatSlot_s {
+	uint64_t			hash;			/* full 64bit hash of the key */
+	StatRecord_t		*record;		/* NULL: empty slot */
+} StatSlot_t;
+
 typedef struct hash_StatTable {
-	/* hash table data */
+	/* hash table data - open addressing, linear probing */
 	uint16_t 			NumBits;		/* width of the hash table */
 	uint32_t			IndexMask;		/* Mask which corresponds to NumBits */
-	StatRecord_t 		**bucket;		/* Hash entry point: points to elements in the stat block */
-	StatRecord_t 		**bucketcache;	/* in case of index collisions, this array points to the last element with that index */
+	uint32_t			NumRecords;		/* number of used slots */
+	StatSlot_t 			*slots;			/* Hash entry point: points to elements in the stat block */
 
 	/* memory management */
 	/* memory blocks - containing the stat records */
@@ -97,6 +101,38 @@ typedef struct hash_StatTable {
 	uint32_t			NextElem;		/* This element in the current stat block is the next free slot */
 } hash_StatTable;
 
+/*
+ * Partial results
+ * nfdump --partial writes the stat tables of a -s query into an nfdump file, next to the
+ * aggregated flows of -A or -s record. Each table starts with a table record, followed by
+ * one element record per stat record. nfdump --merge-partials merges the tables of all
+ * partial files into the requested tables of the same -s stats.
+ */
+typedef struct stat_table_record_s {
+	uint16_t	type;			// StatTableRecordType
+	uint16_t	size;			// sizeof(stat_table_record_t)
+	uint8_t		table;			// table id within this file
+	uint8_t		order_proto;	// protocol separated statistics
+	uint16_t	fill;
+	char		statname[16];	// name of the -s stat
+} stat_table_record_t;
+
+typedef struct stat_element_record_s {
+	uint16_t	type;			// StatElementRecordType
+	uint16_t	size;			// sizeof(stat_element_record_t)
+	uint8_t		table;			// table id of the table record
+	uint8_t		prot;
+	uint8_t		record_flags;
+	uint8_t		fill1;
+	uint32_t	first;
+	uint32_t	last;
+	uint16_t	msec_first;
+	uint16_t	msec_last;
+	uint32_t	fill2;
+	uint64_t	counter[5];		// flows ipkg ibyte opkg obyte
+	uint64_t	stat_key[2];
+} stat_element_record_t;
+
 typedef struct SortElement {
 	void 		*record;
     uint64_t	count;
@@ -126,6 +162,12 @@ void PrintElementStat(stat_record_t	*sum_stat, uint32_t limitflows, char *record
 
 int ParseListOrder(char *s, int multiple_orders );
 
-void PrintSortedFlows(printer_t print_record, uint32_t limitflows, int tag);
+void PrintSortedFlows(printer_t print_record, uint32_t topN, int tag, int GuessDir);
+
+int ExportStatTables(nffile_t *nffile);
+
+int MergeStatRecord(record_header_t *record);
+
+int MergedStatTables(void);
 
 #endif //_NFSTAT_H
@@ -80,6 +80,9 @@ static config_def_t config_def[] = {
 
 #define STACK_BLOCK_SIZE 32
 
+// buffer size to compact the catalog
+#define COPY_BUFFSIZE 1048576
+
 static int	stack_max_entries = 0;
 static dirstat_env_t *dirstat_stack = NULL;
 
@@ -520,6 +523,349 @@ int i, index;
 
 } // End of ReleaseStatInfo
 
+int CatalogExists(char *dirname) {
+char path[MAXPATHLEN];
+struct stat fstat;
+
+	snprintf(path, MAXPATHLEN-1, "%s/%s", dirname, catalog_filename);
+	path[MAXPATHLEN-1] = '\0';
+
+	return stat(path, &fstat) == 0;
+
+} // End of CatalogExists
+
+/*
+ * Append a new file to the catalog of dirname. If no catalog exists, nothing is done.
+ * It gets created with the next rescan of the directory.
+ * returns 1 if the file was appended, 0 if no catalog exists and -1 on error
+ */
+int AppendCatalog(char *dirname, char *filename, time_t when, uint64_t size) {
+char path[MAXPATHLEN], *relpath;
+dircatalog_record_t record;
+struct stat fd_stat, path_stat;
+size_t len;
+int fd, i, ret;
+
+	snprintf(path, MAXPATHLEN-1, "%s/%s", dirname, catalog_filename);
+	path[MAXPATHLEN-1] = '\0';
+
+	// path of file relative to dirname
+	len = strlen(dirname);
+	relpath = filename;
+	if ( strncmp(filename, dirname, len) == 0 && filename[len] == '/' ) {
+		relpath = filename + len;
+		while ( *relpath == '/' )
+			relpath++;
+	}
+
+	if ( relpath == filename || strlen(relpath) >= CATALOG_PATHLEN ) {
+		// file can not be tracked - remove the catalog, which forces a rescan
+		LogError( "Can not add file '%s' to catalog in '%s'. Remove catalog.\n", filename, dirname);
+		unlink(path);
+		return -1;
+	}
+
+	memset((void *)&record, 0, sizeof(record));
+	record.when = when;
+	record.size = size;
+	strncpy(record.path, relpath, CATALOG_PATHLEN-1);
+
+	fd = -1;
+	for ( i=0; i<3; i++ ) {
+		fd = open(path, O_WRONLY|O_APPEND);
+		if ( fd < 0 ) {
+			if ( errno == ENOENT ) 
+				return 0;
+			LogError( "open() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			return -1;
+		}
+
+		if ( SetFileLock(fd) != 0 ) {
+			LogError( "ioctl(F_WRLCK) error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			close(fd);
+			return -1;
+		}
+
+		// the catalog may have been replaced by a rescan while waiting for the lock
+		if ( fstat(fd, &fd_stat) == 0 && stat(path, &path_stat) == 0 && fd_stat.st_ino == path_stat.st_ino )
+			break;
+
+		ReleaseFileLock(fd);
+		close(fd);
+		fd = -1;
+	}
+
+	if ( fd < 0 ) 
+		return 0;
+
+	ret = 1;
+	if ( write(fd, (void *)&record, sizeof(record)) != sizeof(record) ) {
+		LogError( "write() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		ret = -1;
+	}
+
+	ReleaseFileLock(fd);
+	close(fd);
+
+	return ret;
+
+} // End of AppendCatalog
+
+/*
+ * Create a new catalog of dirname with numrecords records, ordered by time
+ * An existing catalog is replaced
+ */
+int WriteCatalog(char *dirname, dircatalog_record_t *records, uint64_t numrecords) {
+char path[MAXPATHLEN], tmppath[MAXPATHLEN];
+dircatalog_header_t header;
+size_t	len;
+int fd;
+
+	snprintf(path, MAXPATHLEN-1, "%s/%s", dirname, catalog_filename);
+	path[MAXPATHLEN-1] = '\0';
+	snprintf(tmppath, MAXPATHLEN-1, "%s/%s.%lu", dirname, catalog_filename, (unsigned long)getpid());
+	tmppath[MAXPATHLEN-1] = '\0';
+
+	fd = open(tmppath, O_WRONLY|O_TRUNC|O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if ( fd < 0 ) {
+		LogError( "open() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	memset((void *)&header, 0, sizeof(header));
+	header.magic   = CATALOG_MAGIC;
+	header.version = CATALOG_VERSION;
+	header.head	   = sizeof(dircatalog_header_t);
+
+	len = numrecords * sizeof(dircatalog_record_t);
+	if ( write(fd, (void *)&header, sizeof(header)) != sizeof(header) ||
+		 (len && write(fd, (void *)records, len) != len) ) {
+		LogError( "write() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		close(fd);
+		unlink(tmppath);
+		return 0;
+	}
+	close(fd);
+
+	if ( rename(tmppath, path) < 0 ) {
+		LogError( "rename() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		unlink(tmppath);
+		return 0;
+	}
+
+	return 1;
+
+} // End of WriteCatalog
+
+static int CatalogPathCompare(const void *r1, const void *r2) {
+
+	return strncmp(((dircatalog_record_t *)r1)->path, ((dircatalog_record_t *)r2)->path, CATALOG_PATHLEN);
+
+} // End of CatalogPathCompare
+
+/*
+ * Apply the changes of files, modified outside of a collector, to the catalog of dirname.
+ * The path of each change is relative to dirname. The size of a file is replaced by the
+ * size of its change, a change with size 0 removes the file from the catalog.
+ * changes are sorted by path. Appending writers wait until the catalog is replaced.
+ * returns 1 if the catalog was updated, 0 if no catalog exists and -1 on error
+ */
+int UpdateCatalog(char *dirname, dircatalog_record_t *changes, uint64_t numchanges) {
+dircatalog_t		*catalog;
+dircatalog_record_t	*record, *change, *records;
+uint64_t			numrecords, maxrecords;
+int					ret;
+
+	catalog = OpenCatalog(dirname);
+	if ( !catalog ) 
+		return CatalogExists(dirname) ? -1 : 0;
+
+	if ( SetFileLock(catalog->fd) != 0 ) {
+		LogError( "ioctl(F_WRLCK) error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		close(catalog->fd);
+		free(catalog->dirname);
+		free(catalog);
+		return -1;
+	}
+
+	qsort((void *)changes, numchanges, sizeof(dircatalog_record_t), CatalogPathCompare);
+
+	records	   = NULL;
+	numrecords = 0;
+	maxrecords = 0;
+	ret		   = 1;
+	while ( (record = NextCatalogRecord(catalog)) != NULL ) {
+		change = bsearch((void *)record, (void *)changes, numchanges, sizeof(dircatalog_record_t), CatalogPathCompare);
+		if ( change ) {
+			if ( change->size == 0 ) 
+				continue;
+			record->size = change->size;
+		}
+		if ( numrecords == maxrecords ) {
+			dircatalog_record_t *r;
+			maxrecords = maxrecords ? 2 * maxrecords : 1024;
+			r = realloc(records, maxrecords * sizeof(dircatalog_record_t));
+			if ( !r ) {
+				LogError( "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+				ret = -1;
+				break;
+			}
+			records = r;
+		}
+		records[numrecords++] = *record;
+	}
+
+	// the new catalog replaces the locked one
+	if ( ret == 1 && !WriteCatalog(dirname, records, numrecords) )
+		ret = -1;
+
+	ReleaseFileLock(catalog->fd);
+	close(catalog->fd);
+	free(catalog->dirname);
+	free(catalog);
+	free(records);
+
+	return ret;
+
+} // End of UpdateCatalog
+
+dircatalog_t *OpenCatalog(char *dirname) {
+char path[MAXPATHLEN];
+dircatalog_header_t header;
+dircatalog_t	*catalog;
+struct stat fstat_buf;
+int fd;
+
+	snprintf(path, MAXPATHLEN-1, "%s/%s", dirname, catalog_filename);
+	path[MAXPATHLEN-1] = '\0';
+
+	fd = open(path, O_RDWR);
+	if ( fd < 0 ) {
+		if ( errno != ENOENT ) 
+			LogError( "open() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return NULL;
+	}
+
+	if ( read(fd, (void *)&header, sizeof(header)) != sizeof(header) || 
+		 header.magic != CATALOG_MAGIC || header.version != CATALOG_VERSION || 
+		 fstat(fd, &fstat_buf) < 0 || header.head < sizeof(header) || header.head > fstat_buf.st_size ) {
+		LogError( "Corrupt catalog '%s'\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	catalog = (dircatalog_t *)calloc(1, sizeof(dircatalog_t));
+	if ( !catalog ) {
+		LogError( "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		close(fd);
+		return NULL;
+	}
+
+	catalog->fd		 = fd;
+	catalog->dirname = strdup(dirname);
+	catalog->head	 = header.head;
+	catalog->offset	 = header.head;
+	catalog->size	 = fstat_buf.st_size;
+
+	return catalog;
+
+} // End of OpenCatalog
+
+/*
+ * Get next record of the catalog. Files appended while reading are returned as well.
+ * returns NULL at the end of the catalog
+ */
+dircatalog_record_t *NextCatalogRecord(dircatalog_t *catalog) {
+
+	if ( pread(catalog->fd, (void *)&catalog->record, sizeof(dircatalog_record_t), catalog->offset) != sizeof(dircatalog_record_t) )
+		return NULL;
+
+	catalog->offset += sizeof(dircatalog_record_t);
+	catalog->record.path[CATALOG_PATHLEN-1] = '\0';
+
+	return &catalog->record;
+
+} // End of NextCatalogRecord
+
+/*
+ * The last record returned by NextCatalogRecord() is expired
+ */
+void ExpireCatalogRecord(dircatalog_t *catalog) {
+
+	catalog->head = catalog->offset;
+
+} // End of ExpireCatalogRecord
+
+/*
+ * Store the new head of the catalog. If more than half of the catalog is expired, 
+ * move the remaining records to the beginning of the catalog
+ */
+void CloseCatalog(dircatalog_t *catalog) {
+dircatalog_header_t header;
+struct stat fstat_buf;
+ssize_t	ret;
+off_t	in, out;
+char	*buff;
+
+	if ( !catalog ) 
+		return;
+
+	if ( SetFileLock(catalog->fd) != 0 ) {
+		LogError( "ioctl(F_WRLCK) error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		close(catalog->fd);
+		free(catalog->dirname);
+		free(catalog);
+		return;
+	}
+
+	memset((void *)&header, 0, sizeof(header));
+	header.magic   = CATALOG_MAGIC;
+	header.version = CATALOG_VERSION;
+	header.head	   = catalog->head;
+
+	buff = NULL;
+	if ( fstat(catalog->fd, &fstat_buf) == 0 && 
+		 (catalog->head - sizeof(header)) > (fstat_buf.st_size / 2) ) 
+		buff = malloc(COPY_BUFFSIZE);
+
+	if ( buff ) {
+		// compact catalog - appending writers wait for the lock
+		in  = catalog->head;
+		out = sizeof(header);
+		while ( (ret = pread(catalog->fd, buff, COPY_BUFFSIZE, in)) > 0 ) {
+			if ( pwrite(catalog->fd, buff, ret, out) != ret ) {
+				LogError( "write() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+				break;
+			}
+			in  += ret;
+			out += ret;
+		}
+		if ( ret == 0 ) {
+			if ( ftruncate(catalog->fd, out) < 0 ) {
+				LogError( "ftruncate() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			}
+			header.head = sizeof(header);
+		} else {
+			// catalog is inconsistent - remove it, which forces a rescan
+			char path[MAXPATHLEN];
+			snprintf(path, MAXPATHLEN-1, "%s/%s", catalog->dirname, catalog_filename);
+			path[MAXPATHLEN-1] = '\0';
+			unlink(path);
+		}
+		free(buff);
+	}
+
+	if ( pwrite(catalog->fd, (void *)&header, sizeof(header), 0) != sizeof(header) ) {
+		LogError( "write() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+	}
+
+	ReleaseFileLock(catalog->fd);
+	close(catalog->fd);
+	free(catalog->dirname);
+	free(catalog);
+
+} // End of CloseCatalog
+
 void PrintDirStat(dirstat_t *dirstat) {
 struct tm *ts;
 time_t	t;
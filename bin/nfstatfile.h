@@ -37,6 +37,7 @@
 #include "config.h"
 
 #include <sys/types.h>
+#include <time.h>
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
 #endif
@@ -67,6 +68,40 @@ enum { STATFILE_OK = 0, ERR_FAIL, ERR_NOSTATFILE, FORCE_REBUILD };
 
 #define stat_filename ".nfstat"
 
+/*
+ * File catalog: append-only list of all nfcapd files in a data directory.
+ * Collectors and nfprofile append each new file at rotation time, nfexpire
+ * reads the files in time order from the head of the catalog, without scanning
+ * the directory tree. The catalog is rebuilt with every rescan of the directory.
+ */
+#define catalog_filename ".nfcatalog"
+
+#define CATALOG_MAGIC	0xA50C
+#define CATALOG_VERSION	1
+
+typedef struct dircatalog_header_s {
+	uint16_t	magic;
+	uint16_t	version;
+	uint32_t	reserved;
+	uint64_t	head;		// offset of first not expired record
+} dircatalog_header_t;
+
+#define CATALOG_PATHLEN	48
+typedef struct dircatalog_record_s {
+	uint64_t	when;		// time slot of the file
+	uint64_t	size;		// disk usage of the file
+	char		path[CATALOG_PATHLEN];	// path relative to the data dir
+} dircatalog_record_t;
+
+typedef struct dircatalog_s {
+	int					fd;
+	char				*dirname;
+	off_t				offset;		// offset of next record to read
+	off_t				head;		// offset of first not expired record
+	off_t				size;		// size of catalog when opened
+	dircatalog_record_t	record;
+} dircatalog_t;
+
 char *ScaleValue(uint64_t v);
 
 char *ScaleTime(uint64_t v);
@@ -79,4 +114,20 @@ int WriteStatInfo(dirstat_t *dirstat);
 
 int ReleaseStatInfo(dirstat_t *dirstat);
 
+int CatalogExists(char *dirname);
+
+int AppendCatalog(char *dirname, char *filename, time_t when, uint64_t size);
+
+int WriteCatalog(char *dirname, dircatalog_record_t *records, uint64_t numrecords);
+
+int UpdateCatalog(char *dirname, dircatalog_record_t *changes, uint64_t numchanges);
+
+dircatalog_t *OpenCatalog(char *dirname);
+
+dircatalog_record_t *NextCatalogRecord(dircatalog_t *catalog);
+
+void ExpireCatalogRecord(dircatalog_t *catalog);
+
+void CloseCatalog(dircatalog_t *catalog);
+
 #endif //_NFSTATFILE_H
@@ -0,0 +1,623 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nffile.h"
+#include "nfx.h"
+#include "nfnet.h"
+#include "bookkeeper.h"
+#include "collector.h"
+#include "netflow_v9.h"
+#include "ipfix.h"
+#include "nf_common.h"
+#include "util.h"
+#include "nfsynth.h"
+
+#define NEED_PACKRECORD 1
+#include "nffile_inline.c"
+#undef NEED_PACKRECORD
+
+#include "nfdump_inline.c"
+
+extern extension_descriptor_t extension_descriptor[];
+
+/*
+ * Predefined extension maps. They cover the mix of maps seen from different 
+ * exporter types: netflow v5 like, v9/IPFIX with routing information, L2 and
+ * MPLS information, IPv6 next hops and aggregated records.
+ */
+static const uint16_t synth_maps[SYNTH_MAX_MAPS][12] = {
+	{ EX_IO_SNMP_2, EX_AS_2, 0 },
+	{ EX_IO_SNMP_4, EX_AS_4, EX_MULIPLE, EX_NEXT_HOP_v4, 0 },
+	{ EX_IO_SNMP_2, EX_AS_2, EX_MULIPLE, EX_NEXT_HOP_v4, EX_NEXT_HOP_BGP_v4, EX_ROUTER_IP_v4, EX_ROUTER_ID, 0 },
+	{ EX_IO_SNMP_4, EX_AS_4, EX_MULIPLE, EX_NEXT_HOP_v6, EX_NEXT_HOP_BGP_v6, EX_ROUTER_IP_v6, 0 },
+	{ EX_IO_SNMP_2, EX_AS_4, EX_VLAN, EX_MAC_1, EX_MAC_2, 0 },
+	{ EX_IO_SNMP_4, EX_AS_2, EX_OUT_PKG_4, EX_OUT_BYTES_4, EX_AGGR_FLOWS_4, EX_BGPADJ, 0 },
+	{ EX_IO_SNMP_4, EX_AS_4, EX_MULIPLE, EX_NEXT_HOP_v4, EX_MPLS, EX_ROUTER_IP_v4, EX_RECEIVED, 0 },
+	{ EX_IO_SNMP_2, EX_AS_2, EX_MULIPLE, EX_NEXT_HOP_BGP_v4, EX_VLAN, EX_OUT_PKG_8, EX_OUT_BYTES_8, 
+	  EX_AGGR_FLOWS_8, EX_MAC_1, 0 },
+};
+
+/*
+ * Service mix - the weights add up to 100. Port 0 selects a random high port.
+ * A protocol mix rescales the weights of each protocol class.
+ */
+static const struct service_s {
+	uint16_t	port;
+	uint8_t		proto;
+	uint8_t		weight;		// in percent
+	uint16_t	pkt_size;	// average packet size
+} service_list[] = {
+	{ 443,	IPPROTO_TCP,	38,	 900 },
+	{ 80,	IPPROTO_TCP,	12,	 700 },
+	{ 443,	IPPROTO_UDP,	 8,	1100 },
+	{ 53,	IPPROTO_UDP,	12,	  90 },
+	{ 123,	IPPROTO_UDP,	 2,	  76 },
+	{ 22,	IPPROTO_TCP,	 3,	 200 },
+	{ 25,	IPPROTO_TCP,	 2,	 500 },
+	{ 993,	IPPROTO_TCP,	 2,	 300 },
+	{ 3389,	IPPROTO_TCP,	 1,	 400 },
+	{ 8080,	IPPROTO_TCP,	 2,	 600 },
+	{ 0,	IPPROTO_TCP,	 8,	 500 },
+	{ 0,	IPPROTO_UDP,	 5,	 300 },
+	{ 0,	IPPROTO_ICMP,	 3,	  84 },
+	{ 0,	IPPROTO_GRE,	 2,	 600 },
+	{ 0,	0,				 0,	   0 }
+};
+
+// resolution of the service selection table
+#define SERVICE_SLOTS 1000
+
+struct synth_s {
+	synth_param_t	param;
+	uint64_t		rnd;			// xorshift state
+
+	// cumulative Zipf distribution of num_ips address ranks
+	double			*zipf_cdf;
+
+	// service_list index for each 1/SERVICE_SLOTS
+	uint8_t			service[SERVICE_SLOTS];
+
+	extension_map_t	*maps[SYNTH_MAX_MAPS];
+	// map properties
+	int				v6_nexthop[SYNTH_MAX_MAPS];
+	int				out_counter[SYNTH_MAX_MAPS];
+	int				aggr_flows[SYNTH_MAX_MAPS];
+
+	uint32_t		sequence;
+	master_record_t	record;
+};
+
+static inline uint64_t NextRandom(synth_t *synth) {
+uint64_t x = synth->rnd;
+
+	// xorshift64*
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	synth->rnd = x;
+	return x * 0x2545F4914F6CDD1DULL;
+
+} // End of NextRandom
+
+// uniform double in [0, 1)
+static inline double Uniform(synth_t *synth) {
+
+	return (double)(NextRandom(synth) >> 11) * (1.0 / 9007199254740992.0);
+
+} // End of Uniform
+
+// scatter address ranks over the address space
+static inline uint64_t Mix64(uint64_t x) {
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+
+} // End of Mix64
+
+static uint32_t ZipfRank(synth_t *synth) {
+double u = Uniform(synth);
+uint32_t lo, hi;
+
+	lo = 0;
+	hi = synth->param.num_ips - 1;
+	while ( lo < hi ) {
+		uint32_t mid = (lo + hi) >> 1;
+		if ( synth->zipf_cdf[mid] < u )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+
+} // End of ZipfRank
+
+static int ProtoClass(uint8_t proto) {
+
+	switch (proto) {
+		case IPPROTO_TCP:
+			return SYNTH_TCP;
+		case IPPROTO_UDP:
+			return SYNTH_UDP;
+		case IPPROTO_ICMP:
+			return SYNTH_ICMP;
+		default:
+			return SYNTH_OTHER;
+	}
+
+} // End of ProtoClass
+
+/*
+ * Fill the service selection table. Without a protocol mix, the service_list weights
+ * are used as they are. Otherwise the weights of each protocol class are scaled, such 
+ * that the class gets its share of the protocol mix.
+ */
+static void SetupServices(synth_t *synth) {
+double weight[SYNTH_PROTO_CLASSES], share, sum;
+uint32_t i, n, end, mix_sum;
+
+	mix_sum = 0;
+	for ( i=0; i < SYNTH_PROTO_CLASSES; i++ ) {
+		mix_sum += synth->param.proto_mix[i];
+		weight[i] = 0.0;
+	}
+	for ( i=0; service_list[i].weight; i++ ) 
+		weight[ProtoClass(service_list[i].proto)] += service_list[i].weight;
+
+	n	= 0;
+	sum = 0.0;
+	for ( i=0; service_list[i].weight; i++ ) {
+		int proto_class = ProtoClass(service_list[i].proto);
+		if ( mix_sum ) 
+			share = (double)synth->param.proto_mix[proto_class] / (double)mix_sum * 
+				service_list[i].weight / weight[proto_class];
+		else
+			share = service_list[i].weight / 100.0;
+		sum += share;
+		end = (uint32_t)(sum * SERVICE_SLOTS + 0.5);
+		while ( n < end && n < SERVICE_SLOTS ) 
+			synth->service[n++] = i;
+	}
+	while ( n < SERVICE_SLOTS ) 
+		synth->service[n++] = 0;
+
+} // End of SetupServices
+
+/*
+ * Verify a user defined extension list: optional extensions up to EX_RECEIVED, at most
+ * one extension of each kind e.g. either 2 or 4 byte interfaces
+ */
+static int CheckExtensions(uint16_t *extensions) {
+uint32_t used = 0;
+int i;
+
+	for ( i=0; extensions[i]; i++ ) {
+		uint16_t id = extensions[i];
+		uint32_t bit;
+		if ( i >= SYNTH_MAX_EXTENSIONS ) {
+			LogError("Synthetic traffic: too many extensions - max %d", SYNTH_MAX_EXTENSIONS);
+			return 0;
+		}
+		if ( id < EX_IO_SNMP_2 || id > EX_RECEIVED || extension_descriptor[id].size == 0 ) {
+			LogError("Synthetic traffic: unsupported extension %u", id);
+			return 0;
+		}
+		bit = 1 << extension_descriptor[id].user_index;
+		if ( used & bit ) {
+			LogError("Synthetic traffic: extension %u conflicts with a previous extension", id);
+			return 0;
+		}
+		used |= bit;
+	}
+
+	return 1;
+
+} // End of CheckExtensions
+
+void SynthDefaults(synth_param_t *param) {
+
+	memset((void *)param, 0, sizeof(synth_param_t));
+	param->seed			 = 1;
+	param->num_ips		 = 100000;
+	param->zipf			 = 1.0;
+	param->v6_ratio		 = 0.2;
+	param->num_maps		 = SYNTH_MAX_MAPS;
+	param->num_exporters = 4;
+	param->start		 = 1483228800;	// 2017-01-01 00:00 UTC
+	param->duration		 = 300;
+
+} // End of SynthDefaults
+
+static extension_map_t *NewMap(int id, const uint16_t *ex_id) {
+extension_map_t *map;
+int i;
+
+	map = (extension_map_t *)calloc(1, sizeof(extension_map_t) + (SYNTH_MAX_EXTENSIONS + 1) * sizeof(uint16_t));
+	if ( !map ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return NULL;
+	}
+
+	map->type	= ExtensionMapType;
+	map->map_id = id;
+	map->extension_size = 0;
+	for ( i=0; ex_id[i]; i++ ) {
+		map->ex_id[i] = ex_id[i];
+		map->extension_size += extension_descriptor[ex_id[i]].size;
+	}
+	map->ex_id[i] = 0;
+	map->size = sizeof(extension_map_t) + i * sizeof(uint16_t);
+
+	// align 32bits
+	if (( map->size & 0x3 ) != 0 ) {
+		map->size += 4 - ( map->size & 0x3 );
+	}
+
+	return map;
+
+} // End of NewMap
+
+synth_t *SynthInit(synth_param_t *param) {
+synth_t *synth;
+const uint16_t *ex_id;
+double sum;
+uint32_t i, j;
+
+	if ( param->num_ips == 0 || param->num_maps == 0 || param->num_maps > SYNTH_MAX_MAPS ) {
+		LogError("Synthetic traffic: invalid parameters");
+		return NULL;
+	}
+	if ( param->extensions && !CheckExtensions(param->extensions) ) 
+		return NULL;
+
+	synth = (synth_t *)calloc(1, sizeof(synth_t));
+	if ( !synth ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return NULL;
+	}
+	synth->param = *param;
+	synth->param.extensions = NULL;
+	if ( param->extensions ) 
+		synth->param.num_maps = 1;
+	if ( synth->param.num_exporters == 0 ) 
+		synth->param.num_exporters = 1;
+	SynthReset(synth, param->seed, param->start, param->duration);
+
+	synth->zipf_cdf = (double *)malloc(param->num_ips * sizeof(double));
+	if ( !synth->zipf_cdf ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		free(synth);
+		return NULL;
+	}
+	sum = 0.0;
+	for ( i=0; i < param->num_ips; i++ ) {
+		sum += 1.0 / pow((double)(i+1), param->zipf);
+		synth->zipf_cdf[i] = sum;
+	}
+	for ( i=0; i < param->num_ips; i++ ) 
+		synth->zipf_cdf[i] /= sum;
+
+	SetupServices(synth);
+
+	for ( i=0; i < synth->param.num_maps; i++ ) {
+		ex_id = param->extensions ? param->extensions : synth_maps[i];
+		synth->maps[i] = NewMap(i, ex_id);
+		if ( !synth->maps[i] ) {
+			SynthDispose(synth);
+			return NULL;
+		}
+		for ( j=0; ex_id[j]; j++ ) {
+			switch ( ex_id[j] ) {
+				case EX_NEXT_HOP_v6:
+				case EX_NEXT_HOP_BGP_v6:
+				case EX_ROUTER_IP_v6:
+					synth->v6_nexthop[i] = 1;
+					break;
+				case EX_OUT_PKG_4:
+				case EX_OUT_PKG_8:
+					synth->out_counter[i] = 1;
+					break;
+				case EX_AGGR_FLOWS_4:
+				case EX_AGGR_FLOWS_8:
+					synth->aggr_flows[i] = 1;
+					break;
+			}
+		}
+	}
+
+	synth->record.type = CommonRecordType;
+
+	return synth;
+
+} // End of SynthInit
+
+void SynthDispose(synth_t *synth) {
+int i;
+
+	if ( !synth )
+		return;
+
+	for ( i=0; i < SYNTH_MAX_MAPS; i++ ) 
+		free(synth->maps[i]);
+	free(synth->zipf_cdf);
+	free(synth);
+
+} // End of SynthDispose
+
+void SynthReset(synth_t *synth, uint32_t seed, time_t start, uint32_t duration) {
+
+	synth->param.seed	  = seed;
+	synth->param.start	  = start;
+	synth->param.duration = duration ? duration : 1;
+	synth->rnd			  = Mix64((uint64_t)seed + 1);
+	synth->sequence		  = 0;
+
+} // End of SynthReset
+
+extension_map_t *SynthGetMap(synth_t *synth, int i) {
+
+	return i >= 0 && i < (int)synth->param.num_maps ? synth->maps[i] : NULL;
+
+} // End of SynthGetMap
+
+static void SetAddress(synth_t *synth, master_record_t *record, int v6) {
+uint64_t src = Mix64(ZipfRank(synth));
+uint64_t dst = Mix64(ZipfRank(synth) ^ 0x9e3779b97f4a7c15ULL);
+
+	if ( v6 ) {
+		SetFlag(record->flags, FLAG_IPV6_ADDR);
+		// clients in 2001:db8::/32, servers in 2a00::/12
+		record->V6.srcaddr[0] = 0x20010db800000000ULL | (src >> 32);
+		record->V6.srcaddr[1] = src;
+		record->V6.dstaddr[0] = 0x2a00000000000000ULL | (dst >> 12);
+		record->V6.dstaddr[1] = dst;
+	} else {
+		ClearFlag(record->flags, FLAG_IPV6_ADDR);
+		// clients in 10.0.0.0/8, servers in 1.0.0.0 - 223.255.255.255
+		record->V6.srcaddr[0] = record->V6.srcaddr[1] = 0;
+		record->V6.dstaddr[0] = record->V6.dstaddr[1] = 0;
+		record->V4.srcaddr = 0x0a000000 | (uint32_t)(src & 0x00ffffff);
+		record->V4.dstaddr = 0x01000000 + (uint32_t)(dst % 0xdf000000);
+	}
+
+} // End of SetAddress
+
+static void SetRouting(synth_t *synth, master_record_t *record, int v6) {
+uint32_t r = NextRandom(synth) >> 32;
+
+	if ( v6 ) {
+		record->ip_nexthop.V6[0]  = 0x20010db8ff000000ULL;
+		record->ip_nexthop.V6[1]  = r & 0xff;
+		record->bgp_nexthop.V6[0] = 0x20010db8fe000000ULL;
+		record->bgp_nexthop.V6[1] = (r >> 8) & 0xff;
+		record->ip_router.V6[0]	  = 0x20010db8fd000000ULL;
+		record->ip_router.V6[1]	  = record->exporter_sysid;
+	} else {
+		record->ip_nexthop.V6[0]  = record->bgp_nexthop.V6[0] = record->ip_router.V6[0] = 0;
+		record->ip_nexthop.V6[1]  = record->bgp_nexthop.V6[1] = record->ip_router.V6[1] = 0;
+		record->ip_nexthop.V4	  = 0xac100000 | (r & 0xff);
+		record->bgp_nexthop.V4	  = 0xac110000 | ((r >> 8) & 0xff);
+		record->ip_router.V4	  = 0xac120000 | record->exporter_sysid;
+	}
+
+	record->input	  = 1 + (r & 0x3f);
+	record->output	  = 1 + ((r >> 6) & 0x3f);
+	record->srcas	  = (r >> 12) & 0x3 ? 64512 + ((r >> 12) & 0x3ff) : 0;
+	record->dstas	  = 1 + ((r >> 16) & 0xffff) % 20000;
+	record->src_mask  = record->V6.srcaddr[0] ? 48 : 24;
+	record->dst_mask  = record->V6.dstaddr[0] ? 32 : 16 + (r & 0x7);
+	record->dst_tos	  = record->tos;
+	record->dir		  = (r >> 20) & 0x1;
+	record->src_vlan  = (r >> 21) & 0xfff;
+	record->dst_vlan  = record->src_vlan;
+	record->bgpNextAdjacentAS = record->dstas;
+	record->bgpPrevAdjacentAS = record->srcas;
+
+} // End of SetRouting
+
+master_record_t *SynthNextRecord(synth_t *synth) {
+master_record_t *record = &synth->record;
+const struct service_s *service;
+uint64_t r, duration;
+double size;
+uint32_t map_id, msec;
+int v6;
+
+	r = NextRandom(synth);
+	v6 = Uniform(synth) < synth->param.v6_ratio;
+
+	map_id = r % synth->param.num_maps;
+	record->map_ref = synth->maps[map_id];
+	record->ext_map = map_id;
+	record->exporter_sysid = 1 + (r >> 8) % synth->param.num_exporters;
+	record->engine_type = 0;
+	record->engine_id	= record->exporter_sysid;
+	record->flags = 0;
+
+	SetAddress(synth, record, v6);
+
+	// service and ports
+	service = &service_list[synth->service[(r >> 16) % SERVICE_SLOTS]];
+	record->prot = service->proto;
+	switch ( service->proto ) {
+		case IPPROTO_ICMP:
+			if ( v6 ) {
+				record->prot = IPPROTO_ICMPV6;
+				record->dstport = (r >> 24) & 0x1 ? 128 << 8 : 129 << 8;
+			} else {
+				record->dstport = (r >> 24) & 0x1 ? 8 << 8 : 0;
+			}
+			record->srcport = 0;
+			break;
+		case IPPROTO_GRE:
+			record->srcport = record->dstport = 0;
+			break;
+		default:
+			record->srcport = 1024 + ((r >> 24) % 64512);
+			record->dstport = service->port ? service->port : 1024 + ((r >> 40) % 64512);
+			// half of the known services are seen from the server side
+			if ( service->port && ((r >> 56) & 0x1) ) {
+				uint16_t port = record->srcport;
+				record->srcport = record->dstport;
+				record->dstport = port;
+			}
+	}
+
+	// heavy tailed packets per flow - Pareto alpha 1.2
+	record->dPkts = (uint64_t)(1.0 / pow(1.0 - Uniform(synth), 1.0 / 1.2));
+	if ( record->dPkts > 10000000 )
+		record->dPkts = 10000000;
+	size = service->pkt_size * (0.5 + Uniform(synth));
+	record->dOctets = (uint64_t)(record->dPkts * size);
+	if ( record->dOctets < 28 * record->dPkts )
+		record->dOctets = 28 * record->dPkts;
+
+	if ( record->prot == IPPROTO_TCP ) 
+		record->tcp_flags = record->dPkts == 1 ? ((r >> 57) & 0x1 ? 0x02 : 0x14) : 0x1b;
+	else
+		record->tcp_flags = 0;
+	record->tos		   = (r >> 58) & 0x1 ? 0 : ((r >> 59) & 0x7) << 5;
+	record->fwd_status = 0;
+
+	// time
+	duration = record->dPkts > 1 ? (record->dPkts - 1) * (1 + ((r >> 32) & 0x3f)) : 0;
+	if ( duration > 120000 ) 
+		duration = 120000;
+	msec = (NextRandom(synth) >> 32) % ((uint64_t)synth->param.duration * 1000);
+	record->first	   = synth->param.start + msec / 1000;
+	record->msec_first = msec % 1000;
+	msec += duration;
+	record->last	   = synth->param.start + msec / 1000;
+	record->msec_last  = msec % 1000;
+	record->received   = (uint64_t)record->last * 1000LL + record->msec_last + 10;
+
+	SetRouting(synth, record, synth->v6_nexthop[map_id]);
+
+	// L2, MPLS and aggregated flows
+	record->in_src_mac	= 0x00005e000000LL | (r & 0xffffff);
+	record->out_dst_mac	= 0x00005e000000LL | ((r >> 24) & 0xffffff);
+	record->in_dst_mac	= 0x0000aa000000LL | record->exporter_sysid;
+	record->out_src_mac	= 0x0000bb000000LL | record->exporter_sysid;
+	record->mpls_label[0] = ((16 + (r & 0xfff)) << 4);
+	record->mpls_label[1] = ((16 + ((r >> 12) & 0xfff)) << 4) | 1;
+	// only set counters, which are stored in the record
+	record->out_pkts	= synth->out_counter[map_id] ? record->dPkts : 0;
+	record->out_bytes	= synth->out_counter[map_id] ? record->dOctets : 0;
+	record->aggr_flows	= synth->aggr_flows[map_id] ? 1 + (r & 0x3) : 0;
+
+	synth->sequence++;
+	return record;
+
+} // End of SynthNextRecord
+
+void SynthAppendMaps(synth_t *synth, nffile_t *nffile) {
+uint32_t i;
+
+	for ( i=0; i < synth->param.num_maps; i++ ) 
+		AppendToBuffer(nffile, (void *)synth->maps[i], synth->maps[i]->size);
+
+} // End of SynthAppendMaps
+
+int SynthWriteRecords(synth_t *synth, nffile_t *nffile, uint64_t count) {
+uint64_t i;
+
+	for ( i=0; i < count; i++ ) {
+		master_record_t *record = SynthNextRecord(synth);
+		PackRecord(record, nffile);
+		UpdateStat(nffile->stat_record, record);
+	}
+
+	return 1;
+
+} // End of SynthWriteRecords
+
+/*
+ * Convert a netflow v9 packet into an IPFIX packet. Both use the same template
+ * and data record layout, only the header and the template set ids differ.
+ * out must hold at least len bytes.
+ */
+uint32_t SynthV9toIPFIX(void *packet, uint32_t len, void *out) {
+netflow_v9_header_t *v9_header = (netflow_v9_header_t *)packet;
+ipfix_header_t *ipfix_header;
+uint32_t in, out_len;
+
+	if ( len < NETFLOW_V9_HEADER_LENGTH )
+		return 0;
+
+	ipfix_header = (ipfix_header_t *)out;
+	ipfix_header->Version			= htons(10);
+	ipfix_header->ExportTime		= v9_header->unix_secs;
+	ipfix_header->LastSequence		= v9_header->sequence;
+	ipfix_header->ObservationDomain = v9_header->source_id;
+
+	in		= NETFLOW_V9_HEADER_LENGTH;
+	out_len = IPFIX_HEADER_LENGTH;
+	while ( (in + 4) <= len ) {
+		uint16_t *flowset = (uint16_t *)((pointer_addr_t)packet + in);
+		uint16_t id		= ntohs(flowset[0]);
+		uint16_t length = ntohs(flowset[1]);
+
+		if ( length < 4 || (in + length) > len )
+			break;
+
+		memcpy((void *)((pointer_addr_t)out + out_len), (void *)flowset, length);
+		if ( id < 2 ) {
+			// v9 template 0 / option template 1 -> IPFIX 2 / 3
+			uint16_t *set = (uint16_t *)((pointer_addr_t)out + out_len);
+			set[0] = htons(id + 2);
+		}
+		in		+= length;
+		out_len += length;
+	}
+	ipfix_header->Length = htons(out_len);
+
+	return out_len;
+
+} // End of SynthV9toIPFIX
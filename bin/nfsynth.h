@@ -0,0 +1,101 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _NFSYNTH_H
+#define _NFSYNTH_H 1
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <time.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nffile.h"
+#include "nfx.h"
+
+/*
+ * Synthetic flow generator
+ * Generates flow records with realistic distributions: host addresses are Zipf 
+ * distributed, services follow a weighted port/protocol mix, packets per flow are
+ * heavy tailed. The records use a selectable number of different extension maps.
+ * The same seed always generates the same sequence of records.
+ */
+
+// number of predefined extension maps
+#define SYNTH_MAX_MAPS	8
+
+// max number of extensions of a user defined map
+#define SYNTH_MAX_EXTENSIONS	16
+
+// protocol classes of the protocol mix
+enum { SYNTH_TCP = 0, SYNTH_UDP, SYNTH_ICMP, SYNTH_OTHER, SYNTH_PROTO_CLASSES };
+
+typedef struct synth_param_s {
+	uint32_t	seed;			// random seed
+	uint32_t	num_ips;		// number of distinct host addresses
+	double		zipf;			// exponent of the Zipf address distribution
+	double		v6_ratio;		// fraction of IPv6 flows 0.0 .. 1.0
+	uint32_t	num_maps;		// extension maps in use 1 .. SYNTH_MAX_MAPS
+	uint32_t	num_exporters;	// flows are spread over exporter sysids 1 .. num_exporters
+	time_t		start;			// start of the time window
+	uint32_t	duration;		// flows start within duration seconds
+	uint32_t	proto_mix[SYNTH_PROTO_CLASSES];	// relative weights tcp/udp/icmp/other - all 0: default mix
+	uint16_t	*extensions;	// 0 terminated extension id list of a user defined map - replaces the predefined maps
+} synth_param_t;
+
+typedef struct synth_s synth_t;
+
+void SynthDefaults(synth_param_t *param);
+
+synth_t *SynthInit(synth_param_t *param);
+
+void SynthDispose(synth_t *synth);
+
+// restart the record sequence with a new seed and time window. The address distribution is kept
+void SynthReset(synth_t *synth, uint32_t seed, time_t start, uint32_t duration);
+
+// extension map i of the generator - 0 <= i < num_maps
+extension_map_t *SynthGetMap(synth_t *synth, int i);
+
+// next record - the returned record is overwritten by the next call
+master_record_t *SynthNextRecord(synth_t *synth);
+
+// append all extension maps to the current block of nffile
+void SynthAppendMaps(synth_t *synth, nffile_t *nffile);
+
+// append count records to nffile. Returns 0 on error, 1 otherwise
+int SynthWriteRecords(synth_t *synth, nffile_t *nffile, uint64_t count);
+
+// convert the netflow v9 packet into an IPFIX packet in out. Returns the length of the IPFIX packet
+uint32_t SynthV9toIPFIX(void *packet, uint32_t len, void *out);
+
+#endif //_NFSYNTH_H
@@ -72,6 +72,7 @@
 #include "nf_common.h"
 #include "nfx.h"
 #include "util.h"
+#include "output_util.h"
 
 /* Global Variables */
 extern char 	*CurrentIdent;
@@ -84,8 +85,12 @@ int check_filter_block(char *filter, master_record_t *flow_record, int expect);
 
 void check_offset(char *text, pointer_addr_t offset, pointer_addr_t expect);
 
+void check_filter_set(char **filters, master_record_t *flow_record);
+
 void CheckCompression(char *filename);
 
+void CheckAddressStrings(void);
+
 int check_filter_block(char *filter, master_record_t *flow_record, int expect) {
 int ret, i;
 uint64_t	*block = (uint64_t *)flow_record;
@@ -127,6 +132,60 @@ void check_offset(char *text, pointer_addr_t offset, pointer_addr_t expect) {
 	}
 }
 
+void check_filter_set(char **filters, master_record_t *flow_record) {
+FilterEngine_data_t	**engines;
+FilterSet_t	*set;
+uint8_t		*match;
+int i, num;
+
+	num = 0;
+	while ( filters[num] ) 
+		num++;
+
+	engines = (FilterEngine_data_t **)malloc(num * sizeof(FilterEngine_data_t *));
+	match	= (uint8_t *)malloc(num * sizeof(uint8_t));
+	if ( !engines || !match ) {
+		fprintf(stderr, "malloc() error: %s\n", strerror(errno));
+		exit(255);
+	}
+	for ( i=0; i<num; i++ ) {
+		engines[i] = CompileFilter(filters[i]);
+		if ( !engines[i] ) 
+			exit(254);
+	}
+
+	set = CompileFilterSet(engines, num);
+	// run twice to check cached results
+	RunFilterSet(set, (uint64_t *)flow_record, match);
+	RunFilterSet(set, (uint64_t *)flow_record, match);
+	for ( i=0; i<num; i++ ) {
+		int ret;
+		engines[i]->nfrecord = (uint64_t *)flow_record;
+		ret = (*engines[i]->FilterEngine)(engines[i]);
+		if ( ret != match[i] ) {
+			printf("**** FAILED **** Filter set: %u blocks, %u unique, Filter: '%s'\n", 
+				set->numBlocks, set->numPredicates - 1, filters[i]);
+			printf("Expected: %i, Found: %i\n", ret, match[i]);
+			exit(255);
+		}
+	}
+	printf("Success: Filter set: %i filters, %u blocks, %u unique\n", num, set->numBlocks, set->numPredicates - 1);
+
+	DisposeFilterSet(set);
+	for ( i=0; i<num; i++ ) {
+		char **ident = engines[i]->IdentList;
+		// the ident list of a few idents is NULL terminated
+		while ( ident && *ident )
+			free(*ident++);
+		free(engines[i]->IdentList);
+		free(engines[i]->filter);
+		free(engines[i]);
+	}
+	free(engines);
+	free(match);
+
+} // End of check_filter_set
+
 void CheckCompression(char *filename) {
 nffile_t	*nffile_w, *nffile_r;
 int i, compress, bsize;
@@ -207,6 +266,49 @@ uint32_t recsize[4];
 
 } // End of CheckCompression
 
+void CheckAddressStrings(void) {
+char *addresses[] = { 
+	"0.0.0.0", "10.0.0.1", "172.16.14.18", "255.255.255.255",
+	"::", "::1", "::ffff:10.1.2.3", "::10.1.2.3", "::1:2:3:4:5", "1::", "1:0:0:2::3", 
+	"fe80::2110:abcd:1235:ffff", "2001:db8:0:0:1:0:0:1", "2001:db8::1:0:0:1", 
+	"2001:620:1000:cafe:20e:35ff:fec0:fed5", NULL
+};
+char expect[INET6_ADDRSTRLEN], string[INET6_ADDRSTRLEN];
+int i;
+
+	for ( i=0; addresses[i]; i++ ) {
+		if ( strchr(addresses[i], ':') ) {
+			uint64_t ip[2];
+			inet_pton(PF_INET6, addresses[i], ip);
+			inet_ntop(PF_INET6, ip, expect, sizeof(expect));
+			ip[0] = ntohll(ip[0]);
+			ip[1] = ntohll(ip[1]);
+			AppendIPv6(string, ip);
+		} else {
+			uint32_t ip;
+			inet_pton(PF_INET, addresses[i], &ip);
+			inet_ntop(PF_INET, &ip, expect, sizeof(expect));
+			AppendIPv4(string, ntohl(ip));
+		}
+		if ( strcmp(string, expect) != 0 ) {
+			printf("Address string %s: expected '%s', got '%s'\n", addresses[i], expect, string);
+			exit(255);
+		}
+	}
+
+	AppendUintPadded(string, 1234, 8, 0);
+	if ( strcmp(string, "    1234") != 0 ) {
+		printf("Padded number: got '%s'\n", string);
+		exit(255);
+	}
+	AppendUintPadded(string, 80, 5, 1);
+	if ( strcmp(string, "80   ") != 0 ) {
+		printf("Padded number: got '%s'\n", string);
+		exit(255);
+	}
+
+} // End of CheckAddressStrings
+
 int main(int argc, char **argv) {
 master_record_t flow_record;
 common_record_t c_record;
@@ -837,6 +939,23 @@ void *p;
 	ret = check_filter_block("ident none", &flow_record, 0);
 	ret = check_filter_block("not ident none", &flow_record, 1);
 
+	// filter set checks - shared filter blocks across multiple filters
+	{
+		char *filters[] = {
+			"ident channel1 and proto tcp",
+			"(ident channel1 or ident none) and proto tcp and port in [ 62 63 64 ]",
+			"not ident channel1 and proto tcp",
+			"proto tcp and port in [ 62 63 64 ]",
+			"proto tcp and not port in [ 62 64 254 256 ]",
+			"proto udp or bpp > 19",
+			"src net 172.32/16 and dst net 10.10/16",
+			"src net 172.32/16 and not dst net 10.10/16",
+			"any",
+			NULL
+		};
+		check_filter_set(filters, &flow_record);
+	}
+
 	// vlan labels
 	flow_record.src_vlan = 0;
 	flow_record.dst_vlan = 0;
@@ -1238,5 +1357,7 @@ exit(0);
 
 #endif
 
+	CheckAddressStrings();
+
 	return 0;
 }
@@ -78,6 +78,14 @@ static char		**IdentList;
 
 static void UpdateList(uint32_t a, uint32_t b);
 
+static inline int EvaluateBlock(FilterBlock_t *block, uint64_t *nfrecord, char **IdentList);
+
+static int SameBlockData(FilterBlock_t *b1, FilterBlock_t *b2);
+
+static int SamePredicate(FilterBlock_t *b1, char **IdentList1, FilterBlock_t *b2, char **IdentList2);
+
+static uint32_t PredicateHash(FilterBlock_t *block, char **IdentList);
+
 /* flow processing functions */
 static inline void pps_function(uint64_t *record_data, uint64_t *comp_values);
 static inline void bps_function(uint64_t *record_data, uint64_t *comp_values);
@@ -246,6 +254,7 @@ uint32_t	NewBlock(uint32_t offset, uint64_t mask, uint64_t value, uint16_t comp,
 	FilterTree[n].fname 	= flow_procs_map[function].name;
 	FilterTree[n].label 	= NULL;
 	FilterTree[n].data 		= data;
+	FilterTree[n].predicate	= 0;
 	if ( comp > 0 || function > 0 )
 		Extended = 1;
 
@@ -445,10 +454,61 @@ int	evaluate, invert;
 
 } /* End of RunFilter */
 
+/* evaluate a single filter block against nfrecord */
+static inline int EvaluateBlock(FilterBlock_t *block, uint64_t *nfrecord, char **IdentList) {
+uint32_t	offset; 
+uint64_t	comp_value[2];
+int	evaluate;
+
+	offset = block->offset;
+	comp_value[0] = nfrecord[offset] & block->mask;
+	comp_value[1] = block->value;
+
+	if (block->function != NULL)
+		block->function(nfrecord, comp_value);
+
+	evaluate = 0;
+	switch (block->comp) {
+		case CMP_EQ:
+			evaluate = comp_value[0] == comp_value[1];
+			break;
+		case CMP_GT:
+			evaluate = comp_value[0] > comp_value[1];
+			break;
+		case CMP_LT:
+			evaluate = comp_value[0] < comp_value[1];
+			break;
+		case CMP_IDENT:
+			evaluate = strncmp(CurrentIdent, IdentList[comp_value[1]], IDENTLEN) == 0 ;
+			break;
+		case CMP_FLAGS:
+			if ( block->invert )
+				evaluate = comp_value[0] > 0;
+			else
+				evaluate = comp_value[0] == comp_value[1];
+			break;
+		case CMP_IPLIST: {
+			struct IPListNode find;
+			find.ip[0] = nfrecord[offset];
+			find.ip[1] = nfrecord[offset+1];
+			find.mask[0] = 0xffffffffffffffffLL;
+			find.mask[1] = 0xffffffffffffffffLL;
+			evaluate = RB_FIND(IPtree, block->data, &find) != NULL; }
+			break;
+		case CMP_ULLIST: {
+			struct ULongListNode find;
+			find.value = comp_value[0];
+			evaluate = RB_FIND(ULongtree, block->data, &find ) != NULL; }
+			break;
+	}
+
+	return evaluate;
+
+} /* End of EvaluateBlock */
+
 /* extended filter engine */
 int RunExtendedFilter(FilterEngine_data_t *args) {
-uint32_t	index, offset; 
-uint64_t	comp_value[2];
+uint32_t	index;
 int	evaluate, invert;
 
 	args->label = NULL;
@@ -456,48 +516,8 @@ int	evaluate, invert;
 	evaluate = 0;
 	invert = 0;
 	while ( index ) {
-		offset   = args->filter[index].offset;
 		invert   = args->filter[index].invert;
-
-		comp_value[0] = args->nfrecord[offset] & args->filter[index].mask;
-		comp_value[1] = args->filter[index].value;
-
-		if (args->filter[index].function != NULL)
-			args->filter[index].function(args->nfrecord, comp_value);
-
-		switch (args->filter[index].comp) {
-			case CMP_EQ:
-				evaluate = comp_value[0] == comp_value[1];
-				break;
-			case CMP_GT:
-				evaluate = comp_value[0] > comp_value[1];
-				break;
-			case CMP_LT:
-				evaluate = comp_value[0] < comp_value[1];
-				break;
-			case CMP_IDENT:
-				evaluate = strncmp(CurrentIdent, args->IdentList[comp_value[1]], IDENTLEN) == 0 ;
-				break;
-			case CMP_FLAGS:
-				if ( invert )
-					evaluate = comp_value[0] > 0;
-				else
-					evaluate = comp_value[0] == comp_value[1];
-				break;
-			case CMP_IPLIST: {
-				struct IPListNode find;
-				find.ip[0] = args->nfrecord[offset];
-				find.ip[1] = args->nfrecord[offset+1];
-				find.mask[0] = 0xffffffffffffffffLL;
-				find.mask[1] = 0xffffffffffffffffLL;
-				evaluate = RB_FIND(IPtree, args->filter[index].data, &find) != NULL; }
-				break;
-			case CMP_ULLIST: {
-				struct ULongListNode find;
-				find.value = comp_value[0];
-				evaluate = RB_FIND(ULongtree, args->filter[index].data, &find ) != NULL; }
-				break;
-		}
+		evaluate = EvaluateBlock(&args->filter[index], args->nfrecord, args->IdentList);
 
 		/*
 		 * Label evaluation:
@@ -525,6 +545,272 @@ int	evaluate, invert;
 
 } /* End of RunExtendedFilter */
 
+/*
+ * Compare the list data of two filter blocks
+ */
+static int SameBlockData(FilterBlock_t *b1, FilterBlock_t *b2) {
+
+	if ( b1->data == b2->data ) 
+		return 1;
+
+	if ( b1->data == NULL || b2->data == NULL ) 
+		return 0;
+
+	if ( b1->comp == CMP_IPLIST ) {
+		struct IPListNode *n1, *n2;
+		n1 = RB_MIN(IPtree, b1->data);
+		n2 = RB_MIN(IPtree, b2->data);
+		while ( n1 && n2 ) {
+			if ( n1->ip[0] != n2->ip[0] || n1->ip[1] != n2->ip[1] ||
+				 n1->mask[0] != n2->mask[0] || n1->mask[1] != n2->mask[1] )
+				return 0;
+			n1 = RB_NEXT(IPtree, b1->data, n1);
+			n2 = RB_NEXT(IPtree, b2->data, n2);
+		}
+		return n1 == NULL && n2 == NULL;
+	} 
+
+	if ( b1->comp == CMP_ULLIST ) {
+		struct ULongListNode *n1, *n2;
+		n1 = RB_MIN(ULongtree, b1->data);
+		n2 = RB_MIN(ULongtree, b2->data);
+		while ( n1 && n2 ) {
+			if ( n1->value != n2->value )
+				return 0;
+			n1 = RB_NEXT(ULongtree, b1->data, n1);
+			n2 = RB_NEXT(ULongtree, b2->data, n2);
+		}
+		return n1 == NULL && n2 == NULL;
+	}
+
+	return 0;
+
+} // End of SameBlockData
+
+/*
+ * Two filter blocks are the same predicate, if they evaluate to the same result for any record.
+ * invert is not part of the predicate, as it is applied by the engine - except for CMP_FLAGS
+ */
+static int SamePredicate(FilterBlock_t *b1, char **IdentList1, FilterBlock_t *b2, char **IdentList2) {
+
+	if ( b1->offset != b2->offset || b1->mask != b2->mask || b1->comp != b2->comp || 
+		 b1->function != b2->function )
+		return 0;
+
+	switch (b1->comp) {
+		case CMP_IDENT:
+			// value is an index into the engine specific IdentList
+			return strncmp(IdentList1[b1->value], IdentList2[b2->value], IDENTLEN) == 0;
+			break;
+		case CMP_FLAGS:
+			return b1->value == b2->value && b1->invert == b2->invert;
+			break;
+		case CMP_IPLIST:
+		case CMP_ULLIST:
+			return b1->value == b2->value && SameBlockData(b1, b2);
+			break;
+		default:
+			return b1->value == b2->value && b1->data == b2->data;
+	}
+
+	// not reached
+	return 0;
+
+} // End of SamePredicate
+
+static uint32_t PredicateHash(FilterBlock_t *block, char **IdentList) {
+uint64_t	hash;
+
+	hash  = (uint64_t)block->offset * 0x9E3779B97F4A7C15LL;
+	hash ^= block->mask + 0x9E3779B97F4A7C15LL + (hash << 6) + (hash >> 2);
+	if ( block->comp == CMP_IDENT ) {
+		char *s = IdentList[block->value];
+		while ( *s ) {
+			hash = (hash ^ (uint8_t)*s++) * 0x100000001B3LL;
+		}
+	} else {
+		hash ^= block->value + 0x9E3779B97F4A7C15LL + (hash << 6) + (hash >> 2);
+	}
+	hash ^= (uint64_t)block->comp << 32;
+
+	return (uint32_t)(hash ^ (hash >> 32));
+
+} // End of PredicateHash
+
+/*
+ * Build a filter set: 
+ * walk all blocks reachable from the start node of each engine and map each block
+ * to a unique predicate. Identical blocks of different engines share the same predicate
+ */
+FilterSet_t *CompileFilterSet(FilterEngine_data_t **engines, uint32_t numEngines) {
+FilterSet_t	*set;
+uint32_t	*stack, *hashtable, stacksize, maxPredicates, hashsize, i;
+
+	set = (FilterSet_t *)malloc(sizeof(FilterSet_t));
+	if ( !set ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	set->engines	   = engines;
+	set->numEngines	   = numEngines;
+	set->numBlocks	   = 0;
+	set->numPredicates = 1;	/* index 0 reserved */
+	set->epoch		   = 1;
+
+	maxPredicates = MAXBLOCKS;
+	set->predicates = (FilterPredicate_t *)calloc(maxPredicates, sizeof(FilterPredicate_t));
+	hashsize  = 2 * MAXBLOCKS;
+	hashtable = (uint32_t *)calloc(hashsize, sizeof(uint32_t));
+	stacksize = MAXBLOCKS;
+	stack	  = (uint32_t *)malloc(stacksize * sizeof(uint32_t));
+	if ( !set->predicates || !hashtable || !stack ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	for ( i=0; i<numEngines; i++ ) {
+		FilterBlock_t *filter = engines[i]->filter;
+		char **IdentList = engines[i]->IdentList;
+		uint32_t sp = 0;
+
+		if ( engines[i]->StartNode == 0 ) 
+			continue;
+
+		stack[sp++] = engines[i]->StartNode;
+		while ( sp ) {
+			FilterBlock_t *block = &filter[stack[--sp]];
+			uint32_t hash, p;
+
+			if ( block->predicate ) 
+				// already mapped
+				continue;
+
+			set->numBlocks++;
+			hash = PredicateHash(block, IdentList) & (hashsize - 1);
+			p = hashtable[hash];
+			while ( p && !SamePredicate(set->predicates[p].block, set->predicates[p].IdentList, block, IdentList) ) 
+				p = set->predicates[p].next;
+
+			if ( p == 0 ) {
+				// new predicate
+				if ( set->numPredicates == maxPredicates ) {
+					maxPredicates += MAXBLOCKS;
+					set->predicates = realloc(set->predicates, maxPredicates * sizeof(FilterPredicate_t));
+					if ( !set->predicates ) {
+						fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+						exit(255);
+					}
+				}
+				p = set->numPredicates++;
+				set->predicates[p].block	 = block;
+				set->predicates[p].IdentList = IdentList;
+				set->predicates[p].next		 = hashtable[hash];
+				set->predicates[p].epoch	 = 0;
+				set->predicates[p].result	 = 0;
+				hashtable[hash] = p;
+			}
+			block->predicate = p;
+
+			if ( (sp + 2) > stacksize ) {
+				stacksize += MAXBLOCKS;
+				stack = realloc(stack, stacksize * sizeof(uint32_t));
+				if ( !stack ) {
+					fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+					exit(255);
+				}
+			}
+			if ( block->OnTrue ) 
+				stack[sp++] = block->OnTrue;
+			if ( block->OnFalse ) 
+				stack[sp++] = block->OnFalse;
+		}
+	}
+
+	free(stack);
+	free(hashtable);
+
+	return set;
+
+} // End of CompileFilterSet
+
+/*
+ * Clone a filter set for use in another thread. The compiled filters are shared
+ * read only, the predicate result cache is private to the clone.
+ */
+FilterSet_t *CloneFilterSet(FilterSet_t *set) {
+FilterSet_t *clone;
+uint32_t	i;
+
+	clone = (FilterSet_t *)malloc(sizeof(FilterSet_t));
+	if ( !clone ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	*clone = *set;
+	clone->epoch = 1;
+
+	clone->predicates = (FilterPredicate_t *)malloc(set->numPredicates * sizeof(FilterPredicate_t));
+	if ( !clone->predicates ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	memcpy((void *)clone->predicates, (void *)set->predicates, set->numPredicates * sizeof(FilterPredicate_t));
+	for ( i=0; i<clone->numPredicates; i++ ) 
+		clone->predicates[i].epoch = 0;
+
+	return clone;
+
+} // End of CloneFilterSet
+
+void DisposeFilterSet(FilterSet_t *set) {
+
+	free(set->predicates);
+	free(set);
+
+} // End of DisposeFilterSet
+
+/*
+ * Run all engines of the filter set against nfrecord. The engines walk their own tree,
+ * but each predicate is evaluated only once per record. Labels are not evaluated.
+ */
+uint32_t RunFilterSet(FilterSet_t *set, uint64_t *nfrecord, uint8_t *match) {
+FilterPredicate_t	*predicates = set->predicates;
+uint32_t	i, index, epoch, matches;
+int	evaluate, invert;
+
+	// a new epoch invalidates all cached results of the previous record
+	epoch = ++set->epoch;
+	if ( epoch == 0 ) {
+		for ( i=0; i<set->numPredicates; i++ ) 
+			predicates[i].epoch = 0;
+		epoch = set->epoch = 1;
+	}
+
+	matches = 0;
+	for ( i=0; i<set->numEngines; i++ ) {
+		FilterBlock_t *filter = set->engines[i]->filter;
+
+		index = set->engines[i]->StartNode;
+		evaluate = 0;
+		invert = 0;
+		while ( index ) {
+			FilterPredicate_t *predicate = &predicates[filter[index].predicate];
+			if ( predicate->epoch != epoch ) {
+				predicate->result = EvaluateBlock(predicate->block, nfrecord, predicate->IdentList);
+				predicate->epoch  = epoch;
+			}
+			invert   = filter[index].invert;
+			evaluate = predicate->result;
+			index    = evaluate ? filter[index].OnTrue : filter[index].OnFalse;
+		}
+		match[i] = invert ? !evaluate : evaluate;
+		matches += match[i];
+	}
+
+	return matches;
+
+} // End of RunFilterSet
+
 void AddLabel(uint32_t index, char *label) {
 
 	FilterTree[index].label = strdup(label);
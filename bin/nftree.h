@@ -67,6 +67,7 @@ typedef struct FilterBlock {
 	char		*fname;				/* ascii function name */
 	char		*label;				/* label, if any */
 	void		*data;				/* any additional data for this block */
+	uint32_t	predicate;			/* Index of shared predicate in a filter set */
 } FilterBlock_t;
 
 typedef struct FilterEngine_data_s {
@@ -79,6 +80,28 @@ typedef struct FilterEngine_data_s {
 	int (*FilterEngine)(struct FilterEngine_data_s *);
 } FilterEngine_data_t;
 
+/*
+ * Filter set: evaluate multiple filters against the same record
+ * Identical filter blocks of all filters in the set are mapped to one
+ * predicate, which is evaluated at most once per record.
+ */
+typedef struct FilterPredicate_s {
+	FilterBlock_t	*block;				/* representative filter block */
+	char			**IdentList;		/* IdentList of the engine owning block */
+	uint32_t		next;				/* hash chain */
+	uint32_t		epoch;				/* record epoch of cached result */
+	int				result;				/* cached result of last evaluation */
+} FilterPredicate_t;
+
+typedef struct FilterSet_s {
+	FilterEngine_data_t	**engines;
+	uint32_t			numEngines;
+	uint32_t			numBlocks;		/* total number of blocks of all engines */
+	FilterPredicate_t	*predicates;	/* index 0 reserved */
+	uint32_t			numPredicates;
+	uint32_t			epoch;
+} FilterSet_t;
+
 
 /* 
  * Definitions
@@ -126,6 +149,25 @@ struct ULongListNode {
  */
 int RunFilter(FilterEngine_data_t *args);
 int RunExtendedFilter(FilterEngine_data_t *args);
+
+/*
+ * Build a filter set of already compiled filters
+ */
+FilterSet_t *CompileFilterSet(FilterEngine_data_t **engines, uint32_t numEngines);
+
+/*
+ * Clone a filter set - each thread needs its own set
+ */
+FilterSet_t *CloneFilterSet(FilterSet_t *set);
+
+void DisposeFilterSet(FilterSet_t *set);
+
+/*
+ * Run all filters of a filter set against nfrecord.
+ * match[i] is set to the result of engine i. Returns number of matches
+ */
+uint32_t RunFilterSet(FilterSet_t *set, uint64_t *nfrecord, uint8_t *match);
+
 /*
  * For testing purpose only
  */
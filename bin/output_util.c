@@ -0,0 +1,366 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "output_util.h"
+
+/* 
+ * Formatting helpers for the flow record printers. They replace snprintf/inet_ntop/strftime
+ * in the per record path and produce the identical output.
+ */
+
+#define DATE_CACHE_SIZE 16
+#define DATE_CACHE_MASK (DATE_CACHE_SIZE - 1)
+
+/* strftime() formats cached by AppendDateTime(), indexed by DATE_TEXT/DATE_ISO */
+static const char *date_format[2] = {
+	"%Y-%m-%d %H:%M:%S",
+	"%Y-%m-%dT%H:%M:%S"
+};
+
+typedef struct date_cache_s {
+	time_t	when;
+	int		len;
+	char	string[32];
+} date_cache_t;
+
+// flows of a block are mostly within the same few seconds - localtime() is called once per second 
+static date_cache_t date_cache[2][DATE_CACHE_SIZE];
+static int	date_cache_valid[2] = { 0, 0 };
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static char output_buffer[OUTPUT_BUFFSIZE];
+static size_t output_len = 0;
+static uint64_t output_total = 0;
+static int	output_registered = 0;
+
+char *AppendString(char *s, const char *string) {
+
+	while ( *string )
+		*s++ = *string++;
+	*s = '\0';
+	return s;
+
+} // End of AppendString
+
+char *AppendPadded(char *s, const char *string, int width, int left) {
+int len = strlen(string);
+
+	if ( left ) {
+		s = AppendString(s, string);
+		while ( len++ < width )
+			*s++ = ' ';
+	} else {
+		while ( len < width-- )
+			*s++ = ' ';
+		s = AppendString(s, string);
+	}
+	*s = '\0';
+	return s;
+
+} // End of AppendPadded
+
+char *AppendUint(char *s, uint64_t num) {
+char tmp[24], *p;
+
+	p = tmp + sizeof(tmp);
+	do {
+		*--p = '0' + (num % 10);
+		num /= 10;
+	} while ( num );
+	while ( p < (tmp + sizeof(tmp)) )
+		*s++ = *p++;
+	*s = '\0';
+	return s;
+
+} // End of AppendUint
+
+char *AppendUintPadded(char *s, uint64_t num, int width, int left) {
+char tmp[24];
+
+	AppendUint(tmp, num);
+	return AppendPadded(s, tmp, width, left);
+
+} // End of AppendUintPadded
+
+char *AppendUintZero(char *s, uint64_t num, int width) {
+char tmp[24];
+int len;
+
+	len = AppendUint(tmp, num) - tmp;
+	while ( len < width-- )
+		*s++ = '0';
+	return AppendString(s, tmp);
+
+} // End of AppendUintZero
+
+char *AppendHex2(char *s, uint8_t num) {
+
+	*s++ = hex_digits[num >> 4];
+	*s++ = hex_digits[num & 0xF];
+	*s = '\0';
+	return s;
+
+} // End of AppendHex2
+
+char *AppendMac(char *s, uint64_t mac) {
+int i;
+
+	for ( i=5; i>=0; i-- ) {
+		s = AppendHex2(s, (mac >> ( i*8 )) & 0xFF);
+		if ( i ) 
+			*s++ = ':';
+	}
+	*s = '\0';
+	return s;
+
+} // End of AppendMac
+
+char *AppendIPv4(char *s, uint32_t ip) {
+
+	s = AppendUint(s, ip >> 24);
+	*s++ = '.';
+	s = AppendUint(s, (ip >> 16) & 0xFF);
+	*s++ = '.';
+	s = AppendUint(s, (ip >> 8) & 0xFF);
+	*s++ = '.';
+	return AppendUint(s, ip & 0xFF);
+
+} // End of AppendIPv4
+
+static char *AppendHex(char *s, uint16_t num) {
+int shift;
+
+	for ( shift = 12; shift > 0 && ((num >> shift) & 0xF) == 0; shift -= 4 )
+		;
+	for ( ; shift >= 0; shift -= 4 ) 
+		*s++ = hex_digits[(num >> shift) & 0xF];
+	*s = '\0';
+	return s;
+
+} // End of AppendHex
+
+/*
+ * Same rules as inet_ntop(AF_INET6, ...): the longest run of at least two zero words
+ * is compressed to '::', the first one wins on equal length; IPv4 compatible and
+ * IPv4 mapped addresses end in dotted quad notation.
+ */
+char *AppendIPv6(char *s, uint64_t ip[2]) {
+uint16_t words[8];
+int i, base, len, best_base, best_len;
+
+	for ( i=0; i<4; i++ ) {
+		words[i]   = (ip[0] >> (48 - 16*i)) & 0xFFFF;
+		words[i+4] = (ip[1] >> (48 - 16*i)) & 0xFFFF;
+	}
+
+	best_base = -1;
+	best_len  = 0;
+	base	  = -1;
+	len 	  = 0;
+	for ( i=0; i<8; i++ ) {
+		if ( words[i] == 0 ) {
+			if ( base == -1 ) {
+				base = i;
+				len  = 1;
+			} else
+				len++;
+		} else if ( base != -1 ) {
+			if ( best_base == -1 || len > best_len ) {
+				best_base = base;
+				best_len  = len;
+			}
+			base = -1;
+		}
+	}
+	if ( base != -1 && ( best_base == -1 || len > best_len )) {
+		best_base = base;
+		best_len  = len;
+	}
+	if ( best_base != -1 && best_len < 2 ) 
+		best_base = -1;
+
+	for ( i=0; i<8; i++ ) {
+		if ( best_base != -1 && i >= best_base && i < (best_base + best_len) ) {
+			if ( i == best_base )
+				*s++ = ':';
+			continue;
+		}
+		if ( i ) 
+			*s++ = ':';
+		if ( i == 6 && best_base == 0 && 
+			 (best_len == 6 || (best_len == 5 && words[5] == 0xffff)) ) {
+			return AppendIPv4(s, ip[1] & 0xFFFFFFFF);
+		}
+		s = AppendHex(s, words[i]);
+	}
+	if ( best_base != -1 && (best_base + best_len) == 8 )
+		*s++ = ':';
+	*s = '\0';
+	return s;
+
+} // End of AppendIPv6
+
+/*
+ * Append string as quoted JSON string. Quotes, backslashes and control characters are escaped
+ */
+char *AppendJSONString(char *s, const char *string) {
+const unsigned char *c = (const unsigned char *)string;
+
+	*s++ = '"';
+	while ( *c ) {
+		if ( *c == '"' || *c == '\\' ) {
+			*s++ = '\\';
+			*s++ = *c;
+		} else if ( *c < 0x20 ) {
+			s = AppendString(s, "\\u00");
+			s = AppendHex2(s, *c);
+		} else {
+			*s++ = *c;
+		}
+		c++;
+	}
+	*s++ = '"';
+	*s = '\0';
+	return s;
+
+} // End of AppendJSONString
+
+char *AppendDateTime(char *s, time_t when, int format) {
+date_cache_t *entry;
+struct tm *ts;
+
+	if ( !date_cache_valid[format] ) {
+		int i;
+		for ( i=0; i<DATE_CACHE_SIZE; i++ ) {
+			// make sure no entry matches, before it got filled
+			date_cache[format][i].when = (time_t)(i + 1);
+		}
+		date_cache_valid[format] = 1;
+	}
+
+	entry = &date_cache[format][when & DATE_CACHE_MASK];
+	if ( entry->when != when ) {
+		ts = localtime(&when);
+		entry->len = strftime(entry->string, sizeof(entry->string), date_format[format], ts);
+		entry->string[entry->len] = '\0';
+		entry->when = when;
+	}
+	memcpy(s, entry->string, entry->len + 1);
+	return s + entry->len;
+
+} // End of AppendDateTime
+
+static void RegisterOutput(void) {
+
+	if ( !output_registered ) {
+		atexit(FlushOutput);
+		output_registered = 1;
+	}
+
+} // End of RegisterOutput
+
+void FlushOutput(void) {
+
+	if ( output_len ) {
+		fwrite(output_buffer, 1, output_len, stdout);
+		output_len = 0;
+	}
+
+} // End of FlushOutput
+
+/*
+ * Print string followed by a newline to stdout. The lines are collected in a large buffer 
+ * and written at once. Call FlushOutput() before writing anything else to stdout.
+ */
+void PrintLine(char *string) {
+size_t len = strlen(string);
+
+	RegisterOutput();
+	output_total += len + 1;
+
+	if ( (output_len + len + 1) > OUTPUT_BUFFSIZE ) {
+		FlushOutput();
+		if ( (len + 1) > OUTPUT_BUFFSIZE ) {
+			fwrite(string, 1, len, stdout);
+			fputc('\n', stdout);
+			return;
+		}
+	}
+	memcpy(output_buffer + output_len, string, len);
+	output_len += len;
+	output_buffer[output_len++] = '\n';
+
+} // End of PrintLine
+
+/*
+ * Return a pointer into the output buffer with at least len bytes space for a record, 
+ * which is directly written into the buffer. OutputCommit() adds the written bytes 
+ * up to end to the output.
+ */
+char *OutputReserve(size_t len) {
+
+	RegisterOutput();
+
+	if ( (output_len + len) > OUTPUT_BUFFSIZE ) 
+		FlushOutput();
+
+	return output_buffer + output_len;
+
+} // End of OutputReserve
+
+void OutputCommit(char *end) {
+size_t len = end - output_buffer;
+
+	output_total += len - output_len;
+	output_len = len;
+
+} // End of OutputCommit
+
+/*
+ * Number of bytes printed by PrintLine() and OutputCommit() so far.
+ */
+uint64_t OutputBytes(void) {
+
+	return output_total;
+
+} // End of OutputBytes
@@ -0,0 +1,88 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _OUTPUT_UTIL_H
+#define _OUTPUT_UTIL_H 1
+
+#ifdef HAVE_CONFIG_H 
+#include "config.h"
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include <stddef.h>
+#include <time.h>
+
+/* size of the buffer, which collects the printed records before writing them to stdout */
+#define OUTPUT_BUFFSIZE	(1024 * 1024)
+
+/* date formats of AppendDateTime() */
+#define DATE_TEXT	0	// %Y-%m-%d %H:%M:%S
+#define DATE_ISO	1	// %Y-%m-%dT%H:%M:%S
+
+/* 
+ * All Append* functions write to s and return the pointer to the terminating '\0'
+ * The caller has to make sure the string buffer is large enough
+ */
+char *AppendString(char *s, const char *string);
+
+char *AppendPadded(char *s, const char *string, int width, int left);
+
+char *AppendUint(char *s, uint64_t num);
+
+char *AppendUintPadded(char *s, uint64_t num, int width, int left);
+
+char *AppendUintZero(char *s, uint64_t num, int width);
+
+char *AppendHex2(char *s, uint8_t num);
+
+char *AppendMac(char *s, uint64_t mac);
+
+char *AppendIPv4(char *s, uint32_t ip);
+
+char *AppendIPv6(char *s, uint64_t ip[2]);
+
+char *AppendJSONString(char *s, const char *string);
+
+char *AppendDateTime(char *s, time_t when, int format);
+
+void PrintLine(char *string);
+
+void FlushOutput(void);
+
+char *OutputReserve(size_t len);
+
+void OutputCommit(char *end);
+
+uint64_t OutputBytes(void);
+
+#endif //_OUTPUT_UTIL_H
@@ -84,6 +84,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -91,9 +93,136 @@
 
 #include "panonymizer.h"
 
+#if defined(__x86_64__) && defined(__GNUC__) && (defined(__clang__) || __GNUC__ >= 5)
+#define HAVE_AESNI 1
+#include <wmmintrin.h>
+#endif
+
 static	uint8_t m_key[16]; //128 bit secret key
 static	uint8_t m_pad[16]; //128 bit secret pad
 
+/*
+ * Per thread caches of the pseudorandom one-time-pads
+ * The pad bits 0..24 of an IPv4 address depend only on its /24 prefix,
+ * the pad bits 0..63 of an IPv6 address only on its first 8 bytes.
+ */
+#define V4CACHEBITS		16
+#define V6CACHEBITS		14
+#define V4CACHESIZE		(1 << V4CACHEBITS)
+#define V6CACHESIZE		(1 << V6CACHEBITS)
+
+#define V4PREFIXMASK	0xFFFFFF00
+#define V4PADMASK		0xFFFFFF80
+#define V4PREFIXBITS	25
+#define V6PREFIXBITS	64
+
+#define HASHMIX64		0x9E3779B97F4A7C15ULL
+#define HASH32(v, bits)	((uint32_t)((uint32_t)(v) * 2654435761U) >> (32 - (bits)))
+#define HASH64(v, bits)	((uint32_t)(((uint64_t)(v) * HASHMIX64) >> (64 - (bits))))
+
+typedef struct v4cache_s {
+	uint32_t	key;
+	uint32_t	pad;
+	uint32_t	generation;
+} v4cache_t;
+
+typedef struct v6cache_s {
+	uint64_t	key[2];
+	uint64_t	pad[2];
+	uint32_t	generation;
+} v6cache_t;
+
+typedef struct anon_cache_s {
+	v4cache_t	v4addr[V4CACHESIZE];
+	v4cache_t	v4prefix[V4CACHESIZE];
+	v6cache_t	v6addr[V6CACHESIZE];
+	v6cache_t	v6prefix[V6CACHESIZE];
+} anon_cache_t;
+
+// entries of other generations are invalid
+static uint32_t			m_generation = 0;
+static pthread_key_t	cache_key;
+static pthread_once_t	cache_once = PTHREAD_ONCE_INIT;
+
+#ifdef HAVE_AESNI
+/*
+ * AES-NI implementation of the 128 bit Rijndael encryption
+ * Only the encryption in ECB mode with the key of PAnonymizer_Init is required.
+ */
+static int		use_aesni = 0;
+static __m128i	aesni_key[11];
+
+#define AESNI_LANES	8
+
+#define AESNI_EXPAND(round, rcon) \
+	aesni_key[round] = AESNI_KeyExpand(aesni_key[round-1], _mm_aeskeygenassist_si128(aesni_key[round-1], rcon))
+
+__attribute__((target("aes,sse2")))
+static inline __m128i AESNI_KeyExpand(__m128i key, __m128i keygened) {
+
+	keygened = _mm_shuffle_epi32(keygened, _MM_SHUFFLE(3,3,3,3));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, keygened);
+
+} // End of AESNI_KeyExpand
+
+__attribute__((target("aes,sse2")))
+static void AESNI_Init(uint8_t *key) {
+
+	aesni_key[0] = _mm_loadu_si128((const __m128i *)key);
+	AESNI_EXPAND(1, 0x01);
+	AESNI_EXPAND(2, 0x02);
+	AESNI_EXPAND(3, 0x04);
+	AESNI_EXPAND(4, 0x08);
+	AESNI_EXPAND(5, 0x10);
+	AESNI_EXPAND(6, 0x20);
+	AESNI_EXPAND(7, 0x40);
+	AESNI_EXPAND(8, 0x80);
+	AESNI_EXPAND(9, 0x1b);
+	AESNI_EXPAND(10, 0x36);
+
+} // End of AESNI_Init
+
+// encrypt up to AESNI_LANES blocks interleaved, to keep the AES units busy
+__attribute__((target("aes,sse2")))
+static void AESNI_Bits(uint8_t input[][16], int num, uint8_t *bits) {
+__m128i	block[AESNI_LANES];
+int i, j, k, lanes;
+
+	for ( i=0; i<num; i+=AESNI_LANES ) {
+		lanes = (num - i) < AESNI_LANES ? (num - i) : AESNI_LANES;
+		for ( j=0; j<lanes; j++ ) 
+			block[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)input[i+j]), aesni_key[0]);
+		for ( k=1; k<10; k++ ) {
+			for ( j=0; j<lanes; j++ ) 
+				block[j] = _mm_aesenc_si128(block[j], aesni_key[k]);
+		}
+		for ( j=0; j<lanes; j++ ) {
+			block[j] = _mm_aesenclast_si128(block[j], aesni_key[10]);
+			// most significant bit of the first output byte
+			bits[i+j] = ((uint8_t)_mm_cvtsi128_si32(block[j])) >> 7;
+		}
+	}
+
+} // End of AESNI_Bits
+
+__attribute__((target("aes,sse2")))
+static void AESNI_blockEncrypt(uint8_t *input, uint8_t *output) {
+__m128i	block;
+int k;
+
+	block = _mm_xor_si128(_mm_loadu_si128((const __m128i *)input), aesni_key[0]);
+	for ( k=1; k<10; k++ ) 
+		block = _mm_aesenc_si128(block, aesni_key[k]);
+	block = _mm_aesenclast_si128(block, aesni_key[10]);
+	_mm_storeu_si128((__m128i *)output, block);
+
+} // End of AESNI_blockEncrypt
+
+#endif
+
 // Init
 void PAnonymizer_Init(uint8_t * key) {
   //initialize the 128-bit secret key.
@@ -102,7 +231,22 @@ void PAnonymizer_Init(uint8_t * key) {
   Rijndael_init(ECB, Encrypt, key, Key16Bytes, NULL);
   //initialize the 128-bit secret pad. The pad is encrypted before being used for padding.
   Rijndael_blockEncrypt(key + 16, 128, m_pad);  
-}
+
+#ifdef HAVE_AESNI
+	use_aesni = 0;
+	if ( __builtin_cpu_supports("aes") ) {
+		uint8_t pad[16];
+		AESNI_Init(key);
+		// paranoia check - AES-NI must produce the same pad
+		AESNI_blockEncrypt(key + 16, pad);
+		use_aesni = memcmp(pad, m_pad, 16) == 0;
+	}
+#endif
+
+	// invalidate all memoized addresses of a previous key
+	m_generation++;
+
+} // End of PAnonymizer_Init
 
 int ParseCryptoPAnKey ( char *s, char *key ) {
 int i, j;
@@ -142,23 +286,92 @@ uint32_t len = strlen(s);
 
 } // End of ParseCryptoPAnKey
 
+/*
+ * Each bit of the pseudorandom one-time-pad depends only on the address bits in front 
+ * of it. Addresses of the same network therefore share the leading bits of their pad.
+ * Every thread memoizes the pads of recently seen addresses and prefixes in direct
+ * mapped caches. On a prefix hit, only the remaining bits of the pad are computed.
+ */
+static void CacheKeyInit(void) {
+
+	pthread_key_create(&cache_key, free);
+
+} // End of CacheKeyInit
+
+static anon_cache_t *GetCache(void) {
+anon_cache_t *cache;
+
+	pthread_once(&cache_once, CacheKeyInit);
+	cache = (anon_cache_t *)pthread_getspecific(cache_key);
+	if ( cache == NULL ) {
+		cache = (anon_cache_t *)calloc(1, sizeof(anon_cache_t));
+		if ( !cache ) {
+			fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		pthread_setspecific(cache_key, (void *)cache);
+	}
+
+	return cache;
+
+} // End of GetCache
+
+/*
+ * Rijndael is used as pseudorandom function: encrypt num input blocks and 
+ * return the most significant bit of each output block. The inputs of an address
+ * do not depend on previous outputs, so all of them are encrypted in one batch.
+ */
+static void PRF_Bits(uint8_t input[][16], int num, uint8_t *bits) {
+uint8_t rin_output[16];
+int i;
+
+#ifdef HAVE_AESNI
+	if ( use_aesni ) {
+		AESNI_Bits(input, num, bits);
+		return;
+	}
+#endif
+
+	for ( i=0; i<num; i++ ) {
+		Rijndael_blockEncrypt(input[i], 128, rin_output);
+		bits[i] = rin_output[0] >> 7;
+	}
+
+} // End of PRF_Bits
+
 //Anonymization funtion
 uint32_t anonymize(const uint32_t orig_addr) {
-    uint8_t rin_output[16];
-    uint8_t rin_input[16];
+    uint8_t rin_input[32][16];
+    uint8_t bits[32];
+	anon_cache_t *cache;
+	v4cache_t *addr_entry, *prefix_entry;
 
     uint32_t result = 0;
     uint32_t first4bytes_pad, first4bytes_input;
-    int pos;
+    int pos, first, i, num;
+
+	cache = GetCache();
+	addr_entry = &cache->v4addr[HASH32(orig_addr, V4CACHEBITS)];
+	if ( addr_entry->generation == m_generation && addr_entry->key == orig_addr ) 
+		return addr_entry->pad ^ orig_addr;
+
+	// the leading pad bits are known for this prefix
+	prefix_entry = &cache->v4prefix[HASH32(orig_addr >> 8, V4CACHEBITS)];
+	if ( prefix_entry->generation == m_generation && prefix_entry->key == (orig_addr & V4PREFIXMASK) ) {
+		result = prefix_entry->pad;
+		first  = V4PREFIXBITS;
+	} else {
+		first  = 0;
+	}
 
-    memcpy(rin_input, m_pad, 16);
     first4bytes_pad = (((uint32_t) m_pad[0]) << 24) + (((uint32_t) m_pad[1]) << 16) +
 	(((uint32_t) m_pad[2]) << 8) + (uint32_t) m_pad[3]; 
 
     // For each prefixes with length from 0 to 31, generate a bit using the Rijndael cipher,
     // which is used as a pseudorandom function here. The bits generated in every rounds
     // are combineed into a pseudorandom one-time-pad.
-    for (pos = 0; pos <= 31 ; pos++) { 
+	num = 0;
+    for (pos = first; pos <= 31 ; pos++) { 
 
 	//Padding: The most significant pos bits are taken from orig_addr. The other 128-pos 
         //bits are taken from m_pad. The variables first4bytes_pad and first4bytes_input are used
@@ -169,18 +382,31 @@ uint32_t anonymize(const uint32_t orig_addr) {
 	else {
 	  first4bytes_input = ((orig_addr >> (32-pos)) << (32-pos)) | ((first4bytes_pad<<pos) >> pos);
 	}
-	rin_input[0] = (uint8_t) (first4bytes_input >> 24);
-	rin_input[1] = (uint8_t) ((first4bytes_input << 8) >> 24);
-	rin_input[2] = (uint8_t) ((first4bytes_input << 16) >> 24);
-	rin_input[3] = (uint8_t) ((first4bytes_input << 24) >> 24);
+	memcpy(rin_input[num], m_pad, 16);
+	rin_input[num][0] = (uint8_t) (first4bytes_input >> 24);
+	rin_input[num][1] = (uint8_t) ((first4bytes_input << 8) >> 24);
+	rin_input[num][2] = (uint8_t) ((first4bytes_input << 16) >> 24);
+	rin_input[num][3] = (uint8_t) ((first4bytes_input << 24) >> 24);
+	num++;
+    }
 
 	//Encryption: The Rijndael cipher is used as pseudorandom function. During each 
 	//round, only the first bit of rin_output is used.
-	Rijndael_blockEncrypt(rin_input, 128, rin_output);	
+	PRF_Bits(rin_input, num, bits);
 
 	//Combination: the bits are combined into a pseudorandom one-time-pad
-	result |=  (rin_output[0] >> 7) << (31-pos);
-    }
+	for ( i=0; i<num; i++ ) 
+		result |= ((uint32_t)bits[i]) << (31-(first + i));
+
+	if ( first == 0 ) {
+		prefix_entry->key		 = orig_addr & V4PREFIXMASK;
+		prefix_entry->pad		 = result & V4PADMASK;
+		prefix_entry->generation = m_generation;
+	}
+	addr_entry->key		   = orig_addr;
+	addr_entry->pad		   = result;
+	addr_entry->generation = m_generation;
+
     //XOR the orginal address with the pseudorandom one-time-pad
     return result ^ orig_addr;
 }
@@ -190,38 +416,75 @@ uint32_t anonymize(const uint32_t orig_addr) {
  * anon_addr return the result in the same order
  */
 void anonymize_v6(const uint64_t orig_addr[2], uint64_t *anon_addr) {
-    uint8_t rin_output[16], *orig_bytes, *result;
-    uint8_t rin_input[16];
+    uint8_t *orig_bytes, *result;
+    uint8_t rin_input[128][16];
+    uint8_t bits[128];
+	anon_cache_t *cache;
+	v6cache_t *addr_entry, *prefix_entry;
 
-    int pos, i, bit_num, left_byte;
+    int pos, i, bit_num, left_byte, first, num;
+
+	cache = GetCache();
+	addr_entry = &cache->v6addr[HASH64(orig_addr[0] ^ (orig_addr[1] * HASHMIX64), V6CACHEBITS)];
+	if ( addr_entry->generation == m_generation && 
+		 addr_entry->key[0] == orig_addr[0] && addr_entry->key[1] == orig_addr[1] ) {
+		anon_addr[0] = addr_entry->pad[0] ^ orig_addr[0];
+		anon_addr[1] = addr_entry->pad[1] ^ orig_addr[1];
+		return;
+	}
 
 	anon_addr[0] = anon_addr[1] = 0;
 	result 		 = (uint8_t *)anon_addr;
 	orig_bytes 	 = (uint8_t *)orig_addr;
 
+	// the first 8 pad bytes are known for this prefix
+	prefix_entry = &cache->v6prefix[HASH64(orig_addr[0], V6CACHEBITS)];
+	if ( prefix_entry->generation == m_generation && prefix_entry->key[0] == orig_addr[0] ) {
+		anon_addr[0] = prefix_entry->pad[0];
+		first = V6PREFIXBITS;
+	} else {
+		first = 0;
+	}
+
     // For each prefixes with length from 0 to 127, generate a bit using the Rijndael cipher,
     // which is used as a pseudorandom function here. The bits generated in every rounds
     // are combineed into a pseudorandom one-time-pad.
-    for (pos = 0; pos <= 127 ; pos++) { 
+	num = 0;
+    for (pos = first; pos <= 127 ; pos++) { 
 		bit_num = pos & 0x7;
 		left_byte = (pos >> 3);
 		
 		for ( i=0; i<left_byte; i++ ) {
-			rin_input[i] = orig_bytes[i];
+			rin_input[num][i] = orig_bytes[i];
 		}
-		rin_input[left_byte] = orig_bytes[left_byte] >> (7-bit_num) << (7-bit_num) | (m_pad[left_byte]<<bit_num) >> bit_num;
+		rin_input[num][left_byte] = orig_bytes[left_byte] >> (7-bit_num) << (7-bit_num) | (m_pad[left_byte]<<bit_num) >> bit_num;
 		for ( i=left_byte+1; i<16; i++ ) {
-			rin_input[i] = m_pad[i];
+			rin_input[num][i] = m_pad[i];
 		}
+		num++;
+    }
 
-		//Encryption: The Rijndael cipher is used as pseudorandom function. During each 
-		//round, only the first bit of rin_output is used.
-		Rijndael_blockEncrypt(rin_input, 128, rin_output);	
+	//Encryption: The Rijndael cipher is used as pseudorandom function. During each 
+	//round, only the first bit of rin_output is used.
+	PRF_Bits(rin_input, num, bits);
 
-		//Combination: the bits are combined into a pseudorandom one-time-pad
-		result[left_byte] |= (rin_output[0] >> 7) << bit_num;
+	//Combination: the bits are combined into a pseudorandom one-time-pad
+	for ( i=0; i<num; i++ ) {
+		pos = first + i;
+		result[pos >> 3] |= bits[i] << (pos & 0x7);
+	}
+
+	if ( first == 0 ) {
+		prefix_entry->key[0]	 = orig_addr[0];
+		prefix_entry->pad[0]	 = anon_addr[0];
+		prefix_entry->generation = m_generation;
+	}
+	addr_entry->key[0]	   = orig_addr[0];
+	addr_entry->key[1]	   = orig_addr[1];
+	addr_entry->pad[0]	   = anon_addr[0];
+	addr_entry->pad[1]	   = anon_addr[1];
+	addr_entry->generation = m_generation;
 
-    }
     //XOR the orginal address with the pseudorandom one-time-pad
 	anon_addr[0] ^= orig_addr[0];
 	anon_addr[1] ^= orig_addr[1];
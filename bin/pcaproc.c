@@ -105,6 +105,15 @@ typedef struct gre_hdr_s {
   uint16_t type;
 } gre_hdr_t;
 
+// ip6f_offlg in host byte order
+#define IP6FRAG_OFFMASK	0xfff8
+#define IP6FRAG_MF		0x0001
+
+// release the reassembly buffer of a defragmented packet
+#define ReleaseDefragmented(d) do { \
+	if ( (d) ) { IPFrag_Release(d); (d) = NULL; } \
+} while (0)
+
 int lock_sync = 0;
 
 pcapfile_t *OpenNewPcapFile(pcap_t *p, char *filename, pcapfile_t *pcapfile) {
@@ -490,12 +499,8 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 	// IP decoding
 	REDO_IPPROTO:
 	// IP decoding
-	if ( defragmented ) {
-		// data is sitting on a defragmented IPv4 packet memory region
-		// REDO loop could result in a memory leak, if again IP is fragmented
-		// XXX memory leak to be fixed
-		LogError("Fragmentation memory leak triggered!");
-	}
+	// data may sit on a defragmented packet memory region of an outer IP header. It is released
+	// after an inner fragment is copied into the fragment table, or at the end of the packet
 
 	ip  	= (struct ip *)(data + offset); // offset points to end of link layer
 	version = ip->ip_v;	 // ip version
@@ -510,11 +515,11 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 			LogError("Packet: %u Length error: data_len: %u < size IPV6: %u, captured: %u, hdr len: %u", 
 				pkg_cnt, data_len, size_ip, hdr->caplen, hdr->len);	
 			pcap_dev->proc_stat.short_snap++;
+			ReleaseDefragmented(defragmented);
 			Free_Node(Node);
 			return;
 		}
 
-		// XXX Extension headers not processed
 		proto		= ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt;
 		payload_len = bytes = ntohs(ip6->ip6_ctlun.ip6_un1.ip6_un1_plen);
 
@@ -538,6 +543,61 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 		Node->dst_addr.v6[1] = ntohll(addr[1]);
 		Node->version = AF_INET6;
 
+		// skip the extension headers, which may precede a fragment header
+		while ( proto == IPPROTO_HOPOPTS || proto == IPPROTO_ROUTING || proto == IPPROTO_DSTOPTS ) {
+			struct ip6_ext *ip6_ext = (struct ip6_ext *)payload;
+			uint32_t size_ext;
+
+			if ( payload_len < sizeof(struct ip6_ext) || 
+				 payload_len < (size_ext = (ip6_ext->ip6e_len + 1) << 3) ) {
+				LogError("Packet: %u IPv6 extension header length error: len: %u", pkg_cnt, payload_len);
+				pcap_dev->proc_stat.short_snap++;
+				ReleaseDefragmented(defragmented);
+				Free_Node(Node);
+				return;
+			}
+			proto	 	 = ip6_ext->ip6e_nxt;
+			payload		 = payload + size_ext;
+			payload_len -= size_ext;
+		}
+
+		// IPv6 defragmentation
+		if ( proto == IPPROTO_FRAGMENT ) {
+			struct ip6_frag *ip6_frag = (struct ip6_frag *)payload;
+			uint16_t offlg;
+			void *assembled;
+
+			if ( payload_len < sizeof(struct ip6_frag) ) {
+				LogError("Packet: %u IPv6 fragment header length error: len: %u", pkg_cnt, payload_len);
+				pcap_dev->proc_stat.short_snap++;
+				ReleaseDefragmented(defragmented);
+				Free_Node(Node);
+				return;
+			}
+			offlg		 = ntohs(ip6_frag->ip6f_offlg);
+			proto		 = ip6_frag->ip6f_nxt;
+			payload		 = payload + sizeof(struct ip6_frag);
+			payload_len -= sizeof(struct ip6_frag);
+			bytes		-= sizeof(struct ip6_frag);
+
+			// atomic fragments need no reassembly
+			if ( (offlg & IP6FRAG_OFFMASK) || (offlg & IP6FRAG_MF) ) {
+				assembled = IPFrag_Update(AF_INET6, &ip6->ip6_src, &ip6->ip6_dst, ntohl(ip6_frag->ip6f_ident), 
+					offlg & IP6FRAG_OFFMASK, offlg & IP6FRAG_MF, &payload_len, payload, hdr->ts.tv_sec);
+				// the fragment is copied - the outer defragmented packet is no longer needed
+				ReleaseDefragmented(defragmented);
+				if ( assembled == NULL ) {
+					// not yet complete
+					dbg_printf("Fragmentation not yet completed\n");
+					Free_Node(Node);
+					return;
+				}
+				dbg_printf("Fragmentation assembled\n");
+				payload = defragmented = assembled;
+				bytes	= payload_len;
+			}
+		}
+
 	} else if ( version == 4 ) {
 		uint16_t ip_off = ntohs(ip->ip_off);
 		uint32_t frag_offset = (ip_off & IP_OFFMASK) << 3;
@@ -548,6 +608,7 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 			LogError("Packet: %u Length error: data_len: %u < size IPV4: %u, captured: %u, hdr len: %u", 
 				pkg_cnt, data_len, size_ip, hdr->caplen, hdr->len);	
 			pcap_dev->proc_stat.short_snap++;
+			ReleaseDefragmented(defragmented);
 			Free_Node(Node);
 			return;
 		}
@@ -570,9 +631,19 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 			inet_ntop(AF_INET, &ip->ip_src, s1, sizeof(s1)),
 			inet_ntop(AF_INET, &ip->ip_dst, s2, sizeof(s2)));
 
+		Node->src_addr.v6[0] = 0;
+		Node->src_addr.v6[1] = 0;
+		Node->src_addr.v4 = ntohl(ip->ip_src.s_addr);
+
+		Node->dst_addr.v6[0] = 0;
+		Node->dst_addr.v6[1] = 0;
+		Node->dst_addr.v4 = ntohl(ip->ip_dst.s_addr);
+		Node->version = AF_INET;
+
 		// IPv4 defragmentation
 		if ( (ip_off & IP_MF) || frag_offset ) {
 			uint16_t ip_id = ntohs(ip->ip_id);
+			void *assembled;
 #ifdef DEVEL
 			if ( frag_offset == 0 )
 				printf("Fragmented packet: first segement: ip_off: %u, frag_offset: %u\n", ip_off, frag_offset);
@@ -582,28 +653,25 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 				printf("Fragmented packet: last segement: ip_off: %u, frag_offset: %u\n", ip_off, frag_offset);
 #endif
 			// fragmented packet
-			defragmented = IPFrag_tree_Update(ip->ip_src.s_addr, ip->ip_dst.s_addr, ip_id, &payload_len, ip_off, payload);
-			if ( defragmented == NULL ) {
+			assembled = IPFrag_Update(AF_INET, &ip->ip_src, &ip->ip_dst, ip_id, frag_offset, (ip_off & IP_MF) != 0, 
+				&payload_len, payload, hdr->ts.tv_sec);
+			// the fragment is copied - the outer defragmented packet is no longer needed
+			ReleaseDefragmented(defragmented);
+			if ( assembled == NULL ) {
 				// not yet complete
 				dbg_printf("Fragmentation not yet completed\n");
+				Free_Node(Node);
 				return;
 			}
 			dbg_printf("Fragmentation assembled\n");
 			// packet defragmented - set payload to defragmented data
-			payload = defragmented;
+			payload = defragmented = assembled;
+			bytes	= payload_len;
 		} 
-
-		Node->src_addr.v6[0] = 0;
-		Node->src_addr.v6[1] = 0;
-		Node->src_addr.v4 = ntohl(ip->ip_src.s_addr);
-
-		Node->dst_addr.v6[0] = 0;
-		Node->dst_addr.v6[1] = 0;
-		Node->dst_addr.v4 = ntohl(ip->ip_dst.s_addr);
-		Node->version = AF_INET;
 	} else {
 		LogError("ProcessPacket() Unsupprted protocol version: %i", version);
 		pcap_dev->proc_stat.unknown++;
+		ReleaseDefragmented(defragmented);
 		Free_Node(Node);
 		return;
 	}
@@ -686,14 +754,14 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 			struct icmp *icmp = (struct icmp *)payload;
 
 			Node->dst_port = (icmp->icmp_type << 8 ) + icmp->icmp_code;
-			dbg_printf("IPv%d ICMP proto: %u, type: %u, code: %u\n", version, ip->ip_p, icmp->icmp_type, icmp->icmp_code);
+			dbg_printf("IPv%d ICMP proto: %u, type: %u, code: %u\n", version, proto, icmp->icmp_type, icmp->icmp_code);
 			Push_Node(NodeList, Node);
 			} break;
 		case IPPROTO_ICMPV6: {
 			struct icmp6_hdr *icmp6 = (struct icmp6_hdr *)payload;
 
 			Node->dst_port = (icmp6->icmp6_type << 8 ) + icmp6->icmp6_code;
-			dbg_printf("IPv%d ICMP proto: %u, type: %u, code: %u\n", version, ip->ip_p, icmp6->icmp6_type, icmp6->icmp6_code);
+			dbg_printf("IPv%d ICMP proto: %u, type: %u, code: %u\n", version, proto, icmp6->icmp6_type, icmp6->icmp6_code);
 			Push_Node(NodeList, Node);
 			} break;
 		case IPPROTO_IPV6: {
@@ -702,10 +770,7 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 			if ( payload_len < size_inner_ip ) {
 				LogError("IPIPv6 tunnel header length error: len: %u < size inner IP: %u", payload_len, size_inner_ip);	
 				pcap_dev->proc_stat.short_snap++;
-				if ( defragmented ) {
-					free(defragmented);
-					defragmented = NULL;
-				}
+				ReleaseDefragmented(defragmented);
 				Free_Node(Node);
 				return;
 			}
@@ -782,8 +847,7 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 	}
 
 	if ( defragmented ) {
-		free(defragmented);
-		defragmented = NULL;
+		ReleaseDefragmented(defragmented);
 		dbg_printf("Defragmented buffer freed for proto %u", proto);	
 	}
 
@@ -55,6 +55,7 @@ typedef struct proc_stat_s {
 
 typedef struct pcap_dev_s {
     pcap_t  *handle;
+    struct tpacket_ring_s *ring;	// TPACKET_V3 ring, if not captured by libpcap
     uint32_t snaplen;
     uint32_t linkoffset;
     uint32_t linktype;
@@ -43,6 +43,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -73,6 +74,12 @@ extern char Ident[IDENTLEN];
 
 static profile_channel_info_t *profile_channels;
 static unsigned int num_channels;
+static FilterSet_t *channel_filters;
+
+typedef struct close_args_s {
+	time_t		tslot;
+	uint32_t	next_channel;
+} close_args_t;
 
 static inline int AppendString(char *stack, char *string, size_t	*buff_size);
 
@@ -83,6 +90,10 @@ profile_channel_info_t	*GetChannelInfoList(void) {
 	return profile_channels;
 } // End of GetProfiles
 
+FilterSet_t *GetChannelFilterSet(void) {
+	return channel_filters;
+} // End of GetChannelFilterSet
+
 static inline int AppendString(char *stack, char *string, size_t *buff_size) {
 size_t len = strlen(string);
 
@@ -113,6 +124,26 @@ profile_param_info_t	*profile_param;
 
 		profile_param = profile_param->next;
 	}
+
+	// merge all channel filters into one filter set, so common filter blocks are evaluated only once
+	channel_filters = NULL;
+	if ( !verify_only && num_channels ) {
+		FilterEngine_data_t **engines;
+		unsigned int num;
+
+		engines = (FilterEngine_data_t **)malloc(num_channels * sizeof(FilterEngine_data_t *));
+		if ( !engines ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		for ( num = 0; num < num_channels; num++ ) 
+			engines[num] = profile_channels[num].engine;
+
+		channel_filters = CompileFilterSet(engines, num_channels);
+		LogInfo("Filter set: %u channels, %u filter blocks, %u unique filter blocks\n", 
+			num_channels, channel_filters->numBlocks, channel_filters->numPredicates - 1);
+	}
+
 	return num_channels;
 
 } // End of InitChannels
@@ -351,56 +382,114 @@ nffile_t *nffile;
 
 } // End of SetupProfileChannels
 
-void CloseChannels (time_t tslot, int compress) {
+static pthread_mutex_t dirstat_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void CloseChannel(profile_channel_info_t *channel, time_t tslot) {
 dirstat_t	*dirstat;
 struct stat fstat;
-unsigned int num;
 
-	for ( num = 0; num < num_channels; num++ ) {
-		if ( profile_channels[num].ofile ) {
+	if ( channel->ofile ) {
 
-			if ( is_anonymized ) 
-				SetFlag(profile_channels[num].nffile->file_header->flags, FLAG_ANONYMIZED);
-			CloseUpdateFile(profile_channels[num].nffile, Ident);
-			profile_channels[num].nffile = DisposeFile(profile_channels[num].nffile);
+		if ( is_anonymized ) 
+			SetFlag(channel->nffile->file_header->flags, FLAG_ANONYMIZED);
+		CloseUpdateFile(channel->nffile, Ident);
+		channel->nffile = DisposeFile(channel->nffile);
 
-			stat(profile_channels[num].ofile, &fstat);
-			ReadStatInfo(profile_channels[num].dirstat_path, &dirstat, CREATE_AND_LOCK);
-	
-			if ( rename(profile_channels[num].ofile, profile_channels[num].wfile) < 0 ) {
-				LogError("Failed to rename file %s to %s: %s\n", 
-					profile_channels[num].ofile, profile_channels[num].wfile, strerror(errno) );
-			} else if ( dirstat && tslot > dirstat->last ) {
-				dirstat->filesize += 512 * fstat.st_blocks;
-				dirstat->numfiles++;
-				dirstat->last = tslot;
-			}
+		stat(channel->ofile, &fstat);
 
-			if ( dirstat ) {
-				WriteStatInfo(dirstat);
-			}
+		// dirstat handling uses a static stack in nfstatfile.c
+		pthread_mutex_lock(&dirstat_mutex);
+		ReadStatInfo(channel->dirstat_path, &dirstat, CREATE_AND_LOCK);
+
+		if ( rename(channel->ofile, channel->wfile) < 0 ) {
+			LogError("Failed to rename file %s to %s: %s\n", 
+				channel->ofile, channel->wfile, strerror(errno) );
+		} else if ( dirstat && tslot > dirstat->last ) {
+			dirstat->filesize += 512 * fstat.st_blocks;
+			dirstat->numfiles++;
+			dirstat->last = tslot;
+			AppendCatalog(channel->dirstat_path, channel->wfile, tslot, 512 * fstat.st_blocks);
 		}
-		if ( ((profile_channels[num].type & 0x8) == 0) && tslot > 0 ) {
-			UpdateRRD(tslot, &profile_channels[num]);
+
+		if ( dirstat ) {
+			WriteStatInfo(dirstat);
+		}
+		pthread_mutex_unlock(&dirstat_mutex);
+	}
+	if ( ((channel->type & 0x8) == 0) && tslot > 0 ) {
+		UpdateRRD(tslot, channel);
 #ifdef HAVE_INFLUXDB
-			if(strlen(influxdb_url) > 0)
-				UpdateInfluxDB(tslot, &profile_channels[num]);
+		if(strlen(influxdb_url) > 0)
+			UpdateInfluxDB(tslot, channel);
 #endif
+	}
+
+} // End of CloseChannel
+
+static void *CloseChannelThread(void *arg) {
+close_args_t *close_args = (close_args_t *)arg;
+unsigned int num;
+
+	// get next channel to close
+	while ( (num = __sync_fetch_and_add(&close_args->next_channel, 1)) < num_channels ) {
+		CloseChannel(&profile_channels[num], close_args->tslot);
+	}
+
+	return NULL;
+
+} // End of CloseChannelThread
+
+void CloseChannels (time_t tslot, int compress, int num_threads) {
+close_args_t close_args;
+pthread_t	*tid;
+int i, started;
+
+	close_args.tslot		= tslot;
+	close_args.next_channel = 0;
+
+	if ( num_threads > (int)num_channels ) 
+		num_threads = num_channels;
+
+	if ( num_threads <= 1 ) {
+		CloseChannelThread((void *)&close_args);
+		return;
+	}
+
+	tid = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+	if ( !tid ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	started = 0;
+	for ( i=0; i<num_threads; i++ ) {
+		int err = pthread_create(&tid[i], NULL, CloseChannelThread, (void *)&close_args);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err) );
+			break;
 		}
+		started++;
 	}
 
+	// if no thread could be started, close the channels ourself
+	if ( started == 0 )
+		CloseChannelThread((void *)&close_args);
+
+	for ( i=0; i<started; i++ ) {
+		pthread_join(tid[i], NULL);
+	}
+	free(tid);
+
 } // End of CloseChannels
 
 void UpdateRRD( time_t tslot, profile_channel_info_t *channel ) {
-char	*rrd_arg[10], buff[1024];
-char	*template, *s;
-int		i, len, argc, buffsize;
+const char	*rrd_arg[2];
+char	buff[1024], *template, *s;
+int		i, len, buffsize;
 stat_record_t stat_record = channel->stat_record;
 	
 	template = 	"flows:flows_tcp:flows_udp:flows_icmp:flows_other:packets:packets_tcp:packets_udp:packets_icmp:packets_other:traffic:traffic_tcp:traffic_udp:traffic_icmp:traffic_other";
 
-	argc = 0;
-
 	buffsize = 1024;
 	s = buff;
 	len = snprintf(s, buffsize , "%llu:", (long long unsigned)tslot);
@@ -439,18 +528,12 @@ stat_record_t stat_record = channel->stat_record;
 	buffsize -= len; s += len;
 
 	buff[1023] = '\0';
-	// Create arg vector
-	argc = 0;
-	rrd_arg[argc++] = "update";
-	rrd_arg[argc++] = channel->rrdfile;
-	rrd_arg[argc++] = "--template";
-	rrd_arg[argc++] = strdup(template);
-	rrd_arg[argc++] = buff;
-	rrd_arg[argc]   = NULL;
+	rrd_arg[0] = buff;
+	rrd_arg[1] = NULL;
 	
-	optind = 0; opterr = 0;
+	// use the reentrant version - channels may be updated in parallel
 	rrd_clear_error();
-	if ( ( i=rrd_update(argc, rrd_arg))) {
+	if ( ( i=rrd_update_r(channel->rrdfile, template, 1, rrd_arg))) {
 		LogError("RRD: %s Insert Error: %d %s\n", channel->rrdfile, i, rrd_get_error());
 	}
 
@@ -67,7 +67,9 @@ unsigned int InitChannels(char *profile_datadir, char *profile_statdir, profile_
 
 profile_channel_info_t	*GetChannelInfoList(void);
 
-void CloseChannels (time_t tslot, int compress);
+FilterSet_t *GetChannelFilterSet(void);
+
+void CloseChannels (time_t tslot, int compress, int num_threads);
 
 void UpdateRRD( time_t tslot, profile_channel_info_t *channel );
 
@@ -0,0 +1,170 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "util.h"
+#include "queue.h"
+
+queue_t *queue_init(uint32_t length) {
+queue_t *queue;
+
+	if ( length == 0 ) {
+		LogError("queue_init(): Invalid queue length: %u", length);
+		return NULL;
+	}
+
+	queue = calloc(1, sizeof(queue_t));
+	if ( !queue ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return NULL;
+	}
+
+	queue->element = calloc(length, sizeof(void *));
+	if ( !queue->element ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		free(queue);
+		return NULL;
+	}
+
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->cond_push, NULL);
+	pthread_cond_init(&queue->cond_pop, NULL);
+	queue->length		= length;
+	queue->head			= 0;
+	queue->tail			= 0;
+	queue->num_elements	= 0;
+	queue->closed		= 0;
+
+	return queue;
+
+} // End of queue_init
+
+void queue_free(queue_t *queue) {
+
+	if ( !queue ) 
+		return;
+
+	pthread_mutex_destroy(&queue->mutex);
+	pthread_cond_destroy(&queue->cond_push);
+	pthread_cond_destroy(&queue->cond_pop);
+	free(queue->element);
+	free(queue);
+
+} // End of queue_free
+
+/*
+ * push data into the queue. Blocks while the queue is full
+ * returns data or QUEUE_CLOSED, if the queue was closed
+ */
+void *queue_push(queue_t *queue, void *data) {
+
+	pthread_mutex_lock(&queue->mutex);
+	while ( queue->num_elements == queue->length && !queue->closed ) 
+		pthread_cond_wait(&queue->cond_pop, &queue->mutex);
+
+	if ( queue->closed ) {
+		pthread_mutex_unlock(&queue->mutex);
+		return QUEUE_CLOSED;
+	}
+
+	queue->element[queue->tail] = data;
+	queue->tail = (queue->tail + 1) % queue->length;
+	queue->num_elements++;
+
+	pthread_cond_signal(&queue->cond_push);
+	pthread_mutex_unlock(&queue->mutex);
+
+	return data;
+
+} // End of queue_push
+
+/*
+ * pop next element from the queue. Blocks while the queue is empty
+ * returns QUEUE_CLOSED, if the queue is closed and empty
+ */
+void *queue_pop(queue_t *queue) {
+void *data;
+
+	pthread_mutex_lock(&queue->mutex);
+	while ( queue->num_elements == 0 && !queue->closed ) 
+		pthread_cond_wait(&queue->cond_push, &queue->mutex);
+
+	if ( queue->num_elements == 0 ) {
+		// closed and empty
+		pthread_mutex_unlock(&queue->mutex);
+		return QUEUE_CLOSED;
+	}
+
+	data = queue->element[queue->head];
+	queue->head = (queue->head + 1) % queue->length;
+	queue->num_elements--;
+
+	pthread_cond_signal(&queue->cond_pop);
+	pthread_mutex_unlock(&queue->mutex);
+
+	return data;
+
+} // End of queue_pop
+
+/*
+ * close the queue - no more elements can be pushed
+ * wake up all waiting threads
+ */
+void queue_close(queue_t *queue) {
+
+	pthread_mutex_lock(&queue->mutex);
+	queue->closed = 1;
+	pthread_cond_broadcast(&queue->cond_push);
+	pthread_cond_broadcast(&queue->cond_pop);
+	pthread_mutex_unlock(&queue->mutex);
+
+} // End of queue_close
+
+uint32_t queue_length(queue_t *queue) {
+uint32_t num;
+
+	pthread_mutex_lock(&queue->mutex);
+	num = queue->num_elements;
+	pthread_mutex_unlock(&queue->mutex);
+
+	return num;
+
+} // End of queue_length
@@ -0,0 +1,75 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _QUEUE_H
+#define _QUEUE_H 1
+
+#include "config.h"
+
+#include <sys/types.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#include <pthread.h>
+
+/*
+ * Bounded, thread safe queue of pointers
+ * queue_push() blocks while the queue is full, queue_pop() blocks while the
+ * queue is empty. After queue_close(), waiting threads are woken up and 
+ * queue_pop() returns the remaining elements followed by QUEUE_CLOSED.
+ */
+
+#define QUEUE_CLOSED	((void *)-3)
+
+typedef struct queue_s {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond_push;	// signals new element in queue
+	pthread_cond_t	cond_pop;	// signals free slot in queue
+	uint32_t		length;		// max number of elements
+	uint32_t		head;		// next element to pop
+	uint32_t		tail;		// next free slot to push
+	uint32_t		num_elements;
+	int				closed;
+	void			**element;
+} queue_t;
+
+queue_t *queue_init(uint32_t length);
+
+void queue_free(queue_t *queue);
+
+void *queue_push(queue_t *queue, void *data);
+
+void *queue_pop(queue_t *queue);
+
+void queue_close(queue_t *queue);
+
+uint32_t queue_length(queue_t *queue);
+
+#endif //_QUEUE_H
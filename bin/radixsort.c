@@ -0,0 +1,330 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "util.h"
+#include "nfstat.h"
+#include "nfprof.h"
+#include "radixsort.h"
+
+/*
+ * Sorting of the stat and flow table elements by their 64bit count value
+ * Full orders use a LSD radix sort with 8bit digits. Digits, which are the same for
+ * all keys - typically the upper bytes of the counters - are skipped. Large arrays 
+ * are counted and scattered by several threads, each working on its own slice. 
+ * For a topN order, the topN largest elements are selected first and only these 
+ * are sorted.
+ */
+
+#define RADIX_BITS		8
+#define RADIX_SIZE		(1 << RADIX_BITS)
+#define RADIX_MASK		(RADIX_SIZE - 1)
+#define RADIX_PASSES	(64 / RADIX_BITS)
+
+// smaller arrays are sorted by heapSort
+#define MinRadixSize	256
+// min number of elements per thread
+#define MinThreadSize	(256*1024)
+#define MaxSortThreads	16
+
+enum { RADIX_COUNT_ALL = 0, RADIX_COUNT, RADIX_SCATTER };
+
+typedef struct radix_job_s {
+	SortElement_t	*src;
+	SortElement_t	*dst;
+	uint32_t		start;		// slice of this thread
+	uint32_t		end;
+	int				mode;
+	int				pass;		// current digit
+	uint32_t		hist[RADIX_PASSES][RADIX_SIZE];
+	uint32_t		offset[RADIX_SIZE];
+} radix_job_t;
+
+/* function prototypes */
+static void *RadixWorker(void *arg);
+
+static void RunJobs(radix_job_t *jobs, int num_jobs, int mode);
+
+static void RadixSort(SortElement_t *SortElement, SortElement_t *tmp, uint32_t array_size);
+
+static int SelectTopN(SortElement_t *SortElement, uint32_t array_size, uint32_t k);
+
+static void SortTopN(SortElement_t *SortElement, uint32_t array_size, int topN);
+
+#include "heapsort_inline.c"
+
+static void *RadixWorker(void *arg) {
+radix_job_t *job = (radix_job_t *)arg;
+SortElement_t *src = job->src;
+uint32_t i;
+int shift = job->pass * RADIX_BITS;
+
+	switch (job->mode) {
+		case RADIX_COUNT_ALL: 
+			memset((void *)job->hist, 0, sizeof(job->hist));
+			for ( i=job->start; i<job->end; i++ ) {
+				uint64_t key = src[i].count;
+				int d;
+				for ( d=0; d<RADIX_PASSES; d++ ) {
+					job->hist[d][key & RADIX_MASK]++;
+					key >>= RADIX_BITS;
+				}
+			}
+			break;
+		case RADIX_COUNT: {
+			uint32_t *hist = job->hist[job->pass];
+			memset((void *)hist, 0, RADIX_SIZE * sizeof(uint32_t));
+			for ( i=job->start; i<job->end; i++ ) 
+				hist[(src[i].count >> shift) & RADIX_MASK]++;
+			} break;
+		case RADIX_SCATTER: {
+			SortElement_t *dst = job->dst;
+			uint32_t *offset = job->offset;
+			for ( i=job->start; i<job->end; i++ ) 
+				dst[offset[(src[i].count >> shift) & RADIX_MASK]++] = src[i];
+			} break;
+	}
+
+	return NULL;
+
+} // End of RadixWorker
+
+static void RunJobs(radix_job_t *jobs, int num_jobs, int mode) {
+pthread_t tid[MaxSortThreads];
+int i, started[MaxSortThreads];
+
+	for ( i=0; i<num_jobs; i++ ) 
+		jobs[i].mode = mode;
+
+	// job 0 is run by the calling thread
+	for ( i=1; i<num_jobs; i++ ) {
+		started[i] = pthread_create(&tid[i], NULL, RadixWorker, (void *)&jobs[i]) == 0;
+		if ( !started[i] ) 
+			RadixWorker((void *)&jobs[i]);
+	}
+	RadixWorker((void *)&jobs[0]);
+
+	for ( i=1; i<num_jobs; i++ ) {
+		if ( started[i] )
+			pthread_join(tid[i], NULL);
+	}
+
+} // End of RunJobs
+
+static void RadixSort(SortElement_t *SortElement, SortElement_t *tmp, uint32_t array_size) {
+radix_job_t		*jobs;
+SortElement_t	*src, *dst;
+uint32_t		total[RADIX_PASSES][RADIX_SIZE];
+uint32_t		chunk, sum;
+int				num_jobs, pass, counted, i, b;
+
+	num_jobs = 1;
+	if ( array_size >= 2 * MinThreadSize ) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_jobs = array_size / MinThreadSize;
+		if ( cpus > 0 && num_jobs > cpus ) 
+			num_jobs = cpus;
+		if ( num_jobs > MaxSortThreads ) 
+			num_jobs = MaxSortThreads;
+	}
+
+	jobs = (radix_job_t *)calloc(num_jobs, sizeof(radix_job_t));
+	if ( !jobs ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	src = SortElement;
+	dst = tmp;
+	chunk = array_size / num_jobs;
+	for ( i=0; i<num_jobs; i++ ) {
+		jobs[i].src   = src;
+		jobs[i].start = i * chunk;
+		jobs[i].end	  = i == (num_jobs - 1) ? array_size : (i + 1) * chunk;
+	}
+
+	// count all digits in one go - the totals tell, which passes can be skipped
+	RunJobs(jobs, num_jobs, RADIX_COUNT_ALL);
+	memset((void *)total, 0, sizeof(total));
+	for ( i=0; i<num_jobs; i++ ) {
+		for ( pass=0; pass<RADIX_PASSES; pass++ ) 
+			for ( b=0; b<RADIX_SIZE; b++ ) 
+				total[pass][b] += jobs[i].hist[pass][b];
+	}
+
+	// the counts of the first pass are still valid for the unsorted array
+	counted = 1;
+	for ( pass=0; pass<RADIX_PASSES; pass++ ) {
+		// all keys have the same digit - nothing to do
+		if ( total[pass][(src[0].count >> (pass * RADIX_BITS)) & RADIX_MASK] == array_size )
+			continue;
+
+		for ( i=0; i<num_jobs; i++ ) {
+			jobs[i].src  = src;
+			jobs[i].dst  = dst;
+			jobs[i].pass = pass;
+		}
+		if ( !counted ) 
+			RunJobs(jobs, num_jobs, RADIX_COUNT);
+		counted = 0;
+
+		// each thread scatters its slice into its own range of each bucket - keeps the sort stable
+		sum = 0;
+		for ( b=0; b<RADIX_SIZE; b++ ) {
+			for ( i=0; i<num_jobs; i++ ) {
+				jobs[i].offset[b] = sum;
+				sum += jobs[i].hist[pass][b];
+			}
+		}
+		RunJobs(jobs, num_jobs, RADIX_SCATTER);
+
+		src = dst;
+		dst = src == SortElement ? tmp : SortElement;
+	}
+
+	if ( src != SortElement ) 
+		memcpy((void *)SortElement, (void *)src, array_size * sizeof(SortElement_t));
+
+	free(jobs);
+
+} // End of RadixSort
+
+static int SelectTopN(SortElement_t *SortElement, uint32_t array_size, uint32_t k) {
+int64_t left, right, i, j, mid;
+int		budget;
+uint64_t pivot;
+
+	// allow ~ 2 * log2(n) partitions - fall back to heapSort for bad pivot sequences
+	budget = 8;
+	for ( i = array_size; i > 0; i >>= 1 )
+		budget += 2;
+
+	left  = 0;
+	right = array_size - 1;
+	while ( right > left ) {
+		SortElement_t temp;
+
+		if ( budget-- == 0 )
+			return 0;
+
+		// median of three
+		mid = left + (right - left) / 2;
+		if ( SortElement[mid].count < SortElement[left].count ) {
+			temp = SortElement[mid]; SortElement[mid] = SortElement[left]; SortElement[left] = temp;
+		}
+		if ( SortElement[right].count < SortElement[left].count ) {
+			temp = SortElement[right]; SortElement[right] = SortElement[left]; SortElement[left] = temp;
+		}
+		if ( SortElement[right].count < SortElement[mid].count ) {
+			temp = SortElement[right]; SortElement[right] = SortElement[mid]; SortElement[mid] = temp;
+		}
+		pivot = SortElement[mid].count;
+
+		i = left;
+		j = right;
+		while ( i <= j ) {
+			while ( SortElement[i].count < pivot ) 
+				i++;
+			while ( SortElement[j].count > pivot ) 
+				j--;
+			if ( i <= j ) {
+				temp = SortElement[i]; SortElement[i] = SortElement[j]; SortElement[j] = temp;
+				i++;
+				j--;
+			}
+		}
+
+		// [left..j] <= pivot, [j+1..i-1] == pivot, [i..right] >= pivot
+		if ( k <= j ) 
+			right = j;
+		else if ( k >= i ) 
+			left = i;
+		else
+			break;
+	}
+
+	return 1;
+
+} // End of SelectTopN
+
+static void SortTopN(SortElement_t *SortElement, uint32_t array_size, int topN) {
+SortElement_t *tmp;
+
+	if ( array_size < 2 )
+		return;
+
+	if ( topN > 0 && (uint32_t)topN < (array_size - 1) ) {
+		uint32_t k = array_size - topN;
+		// move the topN largest elements to the end and sort only those
+		if ( !SelectTopN(SortElement, array_size, k) ) {
+			heapSort(SortElement, array_size, topN);
+			return;
+		}
+		SortElement += k;
+		array_size	 = topN;
+	}
+
+	if ( array_size < MinRadixSize ) {
+		heapSort(SortElement, array_size, 0);
+		return;
+	}
+
+	tmp = (SortElement_t *)malloc(array_size * sizeof(SortElement_t));
+	if ( !tmp ) {
+		// not enough memory for the radix buffer - sort in place
+		heapSort(SortElement, array_size, 0);
+		return;
+	}
+
+	RadixSort(SortElement, tmp, array_size);
+	free(tmp);
+
+} // End of SortTopN
+
+void SortElements(SortElement_t *SortElement, uint32_t array_size, int topN) {
+
+	PROF_START(PROF_SORT, PROF_ALL);
+	SortTopN(SortElement, array_size, topN);
+	PROF_END(PROF_SORT);
+
+} // End of SortElements
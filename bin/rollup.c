@@ -0,0 +1,461 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nffile.h"
+#include "util.h"
+#include "rollup.h"
+
+/* 
+ * -s element stats, which can be answered from a rollup file:
+ * the -A keys, the rollup must be aggregated with
+ */
+static struct rollup_stat_s {
+	char	*statname;
+	char	*keys;
+} rollup_stat[] = {
+	{ "srcip",		"srcip" },
+	{ "dstip",		"dstip" },
+	{ "ip",			"srcip,dstip" },
+	{ "nhip",		"next" },
+	{ "nhbip",		"bgpnext" },
+	{ "router",		"router" },
+	{ "srcport",	"srcport" },
+	{ "dstport",	"dstport" },
+	{ "port",		"srcport,dstport" },
+	{ "proto",		"proto" },
+	{ "tos",		"tos" },
+	{ "srctos",		"srctos" },
+	{ "dsttos",		"dsttos" },
+	{ "srcas",		"srcas" },
+	{ "dstas",		"dstas" },
+	{ "as",			"srcas,dstas" },
+	{ "prevas",		"prevas" },
+	{ "nextas",		"nextas" },
+	{ "inif",		"inif" },
+	{ "outif",		"outif" },
+	{ "if",			"inif,outif" },
+	{ "srcmask",	"srcmask" },
+	{ "dstmask",	"dstmask" },
+	{ "mask",		"srcmask,dstmask" },
+	{ "srcvlan",	"srcvlan" },
+	{ "dstvlan",	"dstvlan" },
+	{ "vlan",		"srcvlan,dstvlan" },
+	{ "insrcmac",	"insrcmac" },
+	{ "outdstmac",	"outdstmac" },
+	{ "indstmac",	"indstmac" },
+	{ "outsrcmac",	"outsrcmac" },
+	{ NULL,			NULL }
+};
+
+// max sub dir levels between a flow file and the rollup base directory: %Y/%m/%d/%H
+#define MAX_SUBDIR_LEVELS	4
+
+/* Function Prototypes */
+static int HasKey(stringlist_t *list, char *key);
+
+static void AddKey(stringlist_t *list, char *key);
+
+static char *FindRollupDir(char *filename, stringlist_t *keys);
+
+static uint32_t RunLength(stringlist_t *files, uint32_t start, stringlist_t *keys, char *rollupdir, int interval_len);
+
+static int UseRollup(stringlist_t *files, uint32_t start, uint32_t num, char *rollupdir, 
+	int interval_len, stringlist_t *selected);
+
+/* Functions */
+
+static int HasKey(stringlist_t *list, char *key) {
+uint32_t i;
+
+	for ( i=0; i<list->num_strings; i++ ) {
+		if ( strcasecmp(list->list[i], key) == 0 )
+			return 1;
+	}
+	return 0;
+
+} // End of HasKey
+
+static void AddKey(stringlist_t *list, char *key) {
+
+	if ( !HasKey(list, key) )
+		InsertString(list, key);
+
+} // End of AddKey
+
+/*
+ * returns the time slot YYYYMMDDhhmm of a flow file nfcapd.YYYYMMDDhhmm 
+ * or NULL, if the file is not named by its time slot
+ */
+char *RollupSlot(char *filename) {
+char *p;
+int	 i;
+
+	p = strrchr(filename, '/');
+	p = p ? p + 1 : filename;
+
+	if ( strlen(p) != (7 + SLOT_LEN) || strncmp(p, "nfcapd.", 7) != 0 )
+		return NULL;
+	p += 7;
+
+	for ( i=0; i<SLOT_LEN; i++ ) {
+		if ( !isdigit((int)p[i]) )
+			return NULL;
+	}
+
+	return p;
+
+} // End of RollupSlot
+
+/*
+ * split the comma separated -A keys into list
+ * returns 0, if the keys are empty or contain subnet bits, which are not
+ * supported for rollups, 1 otherwise
+ */
+int RollupKeyList(char *keys, stringlist_t *list) {
+char *s, *p, *q;
+
+	s = strdup(keys);
+	if ( !s ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	p = s;
+	while ( p ) {
+		q = strchr(p, ',');
+		if ( q ) 
+			*q++ = '\0';
+		if ( strlen(p) == 0 || strchr(p, '/') ) {
+			free(s);
+			return 0;
+		}
+		AddKey(list, p);
+		p = q;
+	}
+	free(s);
+
+	return list->num_strings > 0;
+
+} // End of RollupKeyList
+
+/*
+ * add the keys needed for the -s stat to keys
+ * returns 0, if the stat can not be answered from a rollup
+ */
+int RollupAddStatKeys(stringlist_t *keys, char *stat) {
+char *s, *p;
+int	 i, order_proto;
+
+	s = strdup(stat);
+	if ( !s ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	// strip the order options
+	p = strchr(s, '/');
+	if ( p )
+		*p = '\0';
+
+	// :p - stat per protocol
+	order_proto = 0;
+	p = strchr(s, ':');
+	if ( p ) {
+		if ( strcasecmp(p, ":p") != 0 ) {
+			free(s);
+			return 0;
+		}
+		*p = '\0';
+		order_proto = 1;
+	}
+
+	i = 0;
+	while ( rollup_stat[i].statname && strcasecmp(s, rollup_stat[i].statname) != 0 )
+		i++;
+	free(s);
+
+	if ( !rollup_stat[i].statname ) 
+		return 0;
+
+	RollupKeyList(rollup_stat[i].keys, keys);
+	if ( order_proto )
+		AddKey(keys, "proto");
+
+	return 1;
+
+} // End of RollupAddStatKeys
+
+/*
+ * add the keys of an -A aggregation to keys
+ * returns 0, if the aggregation can not be answered from a rollup
+ */
+int RollupAddAggregateKeys(stringlist_t *keys, char *aggr) {
+
+	return RollupKeyList(aggr, keys);
+
+} // End of RollupAddAggregateKeys
+
+/*
+ * path of the rollup file in rollupdir, which holds the hour or day of slot
+ */
+void RollupPath(char *path, size_t len, char *rollupdir, char *slot, int interval_len) {
+
+	snprintf(path, len, "%s/%s/%s%.*s", rollupdir, 
+		interval_len == DAY_LEN ? ROLLUP_DAY : ROLLUP_HOUR, ROLLUP_PREFIX, interval_len, slot);
+	path[len-1] = '\0';
+
+} // End of RollupPath
+
+/*
+ * read the merge info from the ident of a rollup file
+ * returns 0, if the file does not exist or is no rollup file
+ */
+int RollupReadInfo(char *filename, rollup_info_t *info) {
+struct stat stat_buf;
+nffile_t *nffile;
+int		 ret;
+
+	if ( stat(filename, &stat_buf) || !S_ISREG(stat_buf.st_mode) ) 
+		return 0;
+
+	nffile = OpenFile(filename, NULL);
+	if ( !nffile ) 
+		return 0;
+
+	ret = sscanf(nffile->file_header->ident, "nfrollup %12s %12s %u", 
+		info->first, info->last, &info->numfiles) == 3;
+
+	CloseFile(nffile);
+	DisposeFile(nffile);
+
+	return ret;
+
+} // End of RollupReadInfo
+
+void RollupSetIdent(char *ident, rollup_info_t *info) {
+
+	snprintf(ident, IDENTLEN, "nfrollup %s %s %u", info->first, info->last, info->numfiles);
+	ident[IDENTLEN-1] = '\0';
+
+} // End of RollupSetIdent
+
+/*
+ * find the rollup directory for a flow file, which covers all keys.
+ * The rollup base directory is the directory of the file or one of the
+ * sub dir hierarchy levels above. Of all rollups covering the keys, the one
+ * with the fewest keys is taken.
+ * returns NULL, if no rollup directory is found
+ */
+static char *FindRollupDir(char *filename, stringlist_t *keys) {
+static char dir[MAXPATHLEN], rollupdir[MAXPATHLEN];
+static char *found = NULL;
+char		path[MAXPATHLEN], basedir[MAXPATHLEN], *p;
+struct stat	stat_buf;
+int			level;
+
+	// files are listed in order - the previous directory is most likely the same
+	p = strrchr(filename, '/');
+	if ( p ) {
+		if ( (size_t)(p - filename) == strlen(dir) && strncmp(filename, dir, p - filename) == 0 )
+			return found;
+		snprintf(basedir, MAXPATHLEN, "%.*s", (int)(p - filename), filename);
+	} else {
+		if ( strcmp(dir, ".") == 0 ) 
+			return found;
+		strncpy(basedir, ".", MAXPATHLEN);
+	}
+	strncpy(dir, basedir, MAXPATHLEN);
+	dir[MAXPATHLEN-1] = '\0';
+	found = NULL;
+
+	for ( level=0; level <= MAX_SUBDIR_LEVELS; level++ ) {
+		if ( snprintf(path, MAXPATHLEN, "%s/%s", basedir, ROLLUP_DIR) >= MAXPATHLEN )
+			return NULL;
+		if ( stat(path, &stat_buf) == 0 && S_ISDIR(stat_buf.st_mode) ) 
+			break;
+		p = strrchr(basedir, '/');
+		if ( !p || p == basedir ) 
+			return NULL;
+		*p = '\0';
+	}
+	if ( level > MAX_SUBDIR_LEVELS ) 
+		return NULL;
+
+	{
+		DIR *rdir;
+		struct dirent *entry;
+		uint32_t numkeys = 0;
+
+		rdir = opendir(path);
+		if ( !rdir ) 
+			return NULL;
+
+		while ( (entry = readdir(rdir)) != NULL ) {
+			stringlist_t	rollup_keys;
+			uint32_t		i;
+
+			if ( entry->d_name[0] == '.' )
+				continue;
+
+			InitStringlist(&rollup_keys, 16);
+			if ( RollupKeyList(entry->d_name, &rollup_keys) ) {
+				for ( i=0; i<keys->num_strings; i++ ) {
+					if ( !HasKey(&rollup_keys, keys->list[i]) )
+						break;
+				}
+				if ( i == keys->num_strings && ( !found || rollup_keys.num_strings < numkeys ) &&
+					 snprintf(rollupdir, MAXPATHLEN, "%s/%s", path, entry->d_name) < MAXPATHLEN ) {
+					found	= rollupdir;
+					numkeys = rollup_keys.num_strings;
+				}
+			}
+			for ( i=0; i<rollup_keys.num_strings; i++ )
+				free(rollup_keys.list[i]);
+			free(rollup_keys.list);
+		}
+		closedir(rdir);
+	}
+
+	return found;
+
+} // End of FindRollupDir
+
+/*
+ * number of files from start on in the same hour or day and the same rollup dir
+ */
+static uint32_t RunLength(stringlist_t *files, uint32_t start, stringlist_t *keys, char *rollupdir, int interval_len) {
+char	 *slot = RollupSlot(files->list[start]);
+uint32_t i;
+
+	for ( i=start+1; i<files->num_strings; i++ ) {
+		char *s   = RollupSlot(files->list[i]);
+		char *dir = s ? FindRollupDir(files->list[i], keys) : NULL;
+		if ( !dir || strcmp(dir, rollupdir) != 0 || strncmp(s, slot, interval_len) != 0 )
+			break;
+	}
+
+	return i - start;
+
+} // End of RunLength
+
+/*
+ * use the rollup file of the hour or day, if it merged exactly the num files from start
+ */
+static int UseRollup(stringlist_t *files, uint32_t start, uint32_t num, char *rollupdir, 
+	int interval_len, stringlist_t *selected) {
+char			path[MAXPATHLEN];
+rollup_info_t	info;
+
+	RollupPath(path, MAXPATHLEN, rollupdir, RollupSlot(files->list[start]), interval_len);
+	if ( !RollupReadInfo(path, &info) ) 
+		return 0;
+
+	if ( info.numfiles != num || 
+		 strcmp(info.first, RollupSlot(files->list[start])) != 0 ||
+		 strcmp(info.last, RollupSlot(files->list[start+num-1])) != 0 ) 
+		return 0;
+
+	InsertString(selected, path);
+	return 1;
+
+} // End of UseRollup
+
+/*
+ * replace the flow files of all complete days or hours in files by their rollup 
+ * files, aggregated with all keys.
+ * returns the number of flow files replaced
+ */
+uint32_t RollupSelectFiles(stringlist_t *files, stringlist_t *keys) {
+stringlist_t	selected;
+char			rollupdir[MAXPATHLEN];
+uint32_t		i, j, num, end, replaced;
+
+	InitStringlist(&selected, 64);
+	replaced = 0;
+	i = 0;
+	while ( i < files->num_strings ) {
+		char *dir = files->list[i] && RollupSlot(files->list[i]) ? 
+			FindRollupDir(files->list[i], keys) : NULL;
+
+		if ( !dir ) {
+			InsertString(&selected, files->list[i]);
+			i++;
+			continue;
+		}
+		// FindRollupDir() returns a static buffer
+		strncpy(rollupdir, dir, MAXPATHLEN);
+		rollupdir[MAXPATHLEN-1] = '\0';
+
+		// all files of this day
+		num = RunLength(files, i, keys, rollupdir, DAY_LEN);
+		if ( UseRollup(files, i, num, rollupdir, DAY_LEN, &selected) ) {
+			replaced += num;
+			i += num;
+			continue;
+		}
+
+		// otherwise each hour of this day
+		end = i + num;
+		while ( i < end ) {
+			num = RunLength(files, i, keys, rollupdir, HOUR_LEN);
+			if ( UseRollup(files, i, num, rollupdir, HOUR_LEN, &selected) ) {
+				replaced += num;
+			} else {
+				for ( j=i; j<i+num; j++ ) 
+					InsertString(&selected, files->list[j]);
+			}
+			i += num;
+		}
+	}
+
+	for ( i=0; i<files->num_strings; i++ ) 
+		free(files->list[i]);
+	free(files->list);
+	*files = selected;
+
+	return replaced;
+
+} // End of RollupSelectFiles
@@ -0,0 +1,87 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _ROLLUP_H
+#define _ROLLUP_H 1
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <time.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "util.h"
+
+/*
+ * Rollup files
+ * A rollup file holds the aggregated flows of all flow files of an hour or a day. 
+ * The flows are aggregated by a fixed set of -A keys, which names the rollup 
+ * directory: <datadir>/.rollup/<keys>/1h/nfrollup.YYYYMMDDhh and
+ *            <datadir>/.rollup/<keys>/1d/nfrollup.YYYYMMDD
+ * The ident of a rollup file records the first and last time slot and the number 
+ * of flow files merged. nfrollup maintains the files, nfdump reads them in place of 
+ * the flow files of complete hours or days, if a query needs no other keys.
+ */
+
+#define ROLLUP_DIR		".rollup"
+#define ROLLUP_HOUR		"1h"
+#define ROLLUP_DAY		"1d"
+#define ROLLUP_PREFIX	"nfrollup."
+
+// length of a time slot string YYYYMMDDhhmm, an hour YYYYMMDDhh and a day YYYYMMDD
+#define SLOT_LEN	12
+#define HOUR_LEN	10
+#define DAY_LEN		8
+
+typedef struct rollup_info_s {
+	char		first[SLOT_LEN+1];	// first time slot merged
+	char		last[SLOT_LEN+1];	// last time slot merged
+	uint32_t	numfiles;			// number of flow files merged
+} rollup_info_t;
+
+char *RollupSlot(char *filename);
+
+int RollupKeyList(char *keys, stringlist_t *list);
+
+int RollupAddStatKeys(stringlist_t *keys, char *stat);
+
+int RollupAddAggregateKeys(stringlist_t *keys, char *aggr);
+
+void RollupPath(char *path, size_t len, char *rollupdir, char *slot, int interval_len);
+
+int RollupReadInfo(char *filename, rollup_info_t *info);
+
+void RollupSetIdent(char *ident, rollup_info_t *info);
+
+uint32_t RollupSelectFiles(stringlist_t *files, stringlist_t *keys);
+
+#endif //_ROLLUP_H
@@ -90,6 +90,7 @@
 #endif
 
 #include "expire.h"
+#include "nflive.h"
 
 #include "sflow_nfdump.h"
 
@@ -109,6 +110,9 @@ static FlowSource_t *FlowSource;
 
 static int done, launcher_alive, periodic_trigger, launcher_pid;
 
+// publish the written blocks of the current file in the live index - -L
+static int live_mode;
+
 static const char *nfdump_version = VERSION;
 
 /* Local function Prototypes */
@@ -116,6 +120,10 @@ static void usage(char *name);
 
 static void kill_launcher(int pid);
 
+static void OpenLive(FlowSource_t *fs);
+
+static void FlushLive(time_t now);
+
 static void IntHandler(int signal);
 
 static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss);
@@ -146,11 +154,14 @@ static void usage(char *name) {
 					"-P pidfile\tset the PID file\n"
 					"-R IP[/port]\tRepeat incoming packets to IP address/port\n"
 					"-x process\tlaunch process after a new file becomes available\n"
-					"-z\t\tLZO compress flows in output file.\n"
+					"-z[=method]\tLZO compress flows in output file.\n"
+					"\t\tmethod: lzo, lz4, bz2 or zstd[:level[:dictfile]]\n"
 					"-y\t\tLZ4 compress flows in output file.\n"
 					"-j\t\tBZ2 compress flows in output file.\n"
 					"-B bufflen\tSet socket buffer to bufflen bytes\n"
 					"-e\t\tExpire data at each cycle.\n"
+					"-L\t\tPublish the current file in a live index for nfdump --follow.\n"
+					"-A keys\tMaintain hourly and daily rollups aggregated by keys. Runs nfrollup\n"
 					"-D\t\tFork to background\n"
 					"-E\t\tPrint extended format of sflow data. for debugging purpose only.\n"
 					"-4\t\tListen on IPv4 (default).\n"
@@ -160,6 +171,35 @@ static void usage(char *name) {
 					, name);
 } // End of usage
 
+// attach the current file of the flow source to the live index of its data dir
+static void OpenLive(FlowSource_t *fs) {
+
+	if ( !live_mode ) 
+		return;
+
+	fs->nffile->live = OpenLiveIndex(fs->datadir, fs->current);
+	if ( fs->nffile->live ) 
+		LiveIndexUpdate(fs->nffile->live, fs->nffile->fd);
+	else
+		LogError("Ident: %s, live index disabled", fs->Ident);
+
+} // End of OpenLive
+
+// publish partially filled blocks of the current files in time
+static void FlushLive(time_t now) {
+FlowSource_t *fs = FlowSource;
+
+	while ( fs ) {
+		nffile_t *nffile = fs->nffile;
+		if ( nffile && nffile->live && nffile->block_header->NumRecords && LiveFlushDue(nffile->live, now) ) {
+			if ( WriteBlock(nffile) <= 0 )
+				LogError("Ident: %s, failed to write output buffer to disk: '%s'" , fs->Ident, strerror(errno));
+		}
+		fs = fs->next;
+	}
+
+} // End of FlushLive
+
 void kill_launcher(int pid) {
 int stat, i;
 pid_t ret;
@@ -367,6 +407,7 @@ srecord_t	*commbuff;
 		if ( !fs->nffile ) {
 			return;
 		}
+		OpenLive(fs);
 
 		// init stat vars
 		fs->bad_packets		= 0;
@@ -385,6 +426,12 @@ srecord_t	*commbuff;
 
 	// wake up at least at next time slot (twin) + some Overdue time
 	alarm(t_start + twin + OVERDUE_TIME - time(NULL));
+
+	if ( live_mode ) {
+		// wake up in time to publish the flows, if no packets arrive
+		struct timeval timeout = { LIVE_FLUSH, 0 };
+		setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (void *)&timeout, sizeof(timeout));
+	}
 	/*
 	 * Main processing loop:
 	 * this loop, continues until done = 1, set by the signal handler
@@ -394,6 +441,9 @@ srecord_t	*commbuff;
 	while ( 1 ) {
 		struct timeval tv;
 
+		if ( live_mode ) 
+			FlushLive(time(NULL));
+
 		/* read next bunch of data into beginn of input buffer */
 		if ( !done) {
 
@@ -411,7 +461,9 @@ srecord_t	*commbuff;
 				(struct sockaddr *)&sf_sender, &sf_sender_size);
 #endif
 			if ( cnt == -1 && errno != EINTR ) {
-				LogError("ERROR: recvfrom: %s", strerror(errno));
+				// a receive timeout in live mode is no error
+				if ( !live_mode || (errno != EAGAIN && errno != EWOULDBLOCK) ) 
+					LogError("ERROR: recvfrom: %s", strerror(errno));
 				continue;
 			}
 
@@ -515,8 +567,13 @@ srecord_t	*commbuff;
 					// Update books
 					stat(nfcapd_filename, &fstat);
 					UpdateBooks(fs->bookkeeper, t_start, 512*fstat.st_blocks);
+					AppendCatalog(fs->datadir, nfcapd_filename, t_start, 512*fstat.st_blocks);
 				}
 
+				// readers of the live index continue with the next file
+				if ( nffile->live ) 
+					LiveIndexRotate(nffile->live, err ? NULL : subfilename);
+
 				// log stats
 				LogInfo("Ident: '%s' Flows: %llu, Packets: %llu, Bytes: %llu, Sequence Errors: %u, Bad Packets: %u", 
 					fs->Ident, (unsigned long long)nffile->stat_record->numflows, (unsigned long long)nffile->stat_record->numpackets, 
@@ -653,7 +710,7 @@ srecord_t	*commbuff;
 
 int main(int argc, char **argv) {
  
-char	*bindhost, *datadir, pidstr[32], *launch_process;
+char	*bindhost, *datadir, pidstr[32], *launch_process, *rollup;
 char	*userid, *groupid, *checkptr, *listenport, *mcastgroup, *extension_tags;
 char	*Ident, *pcap_file, *time_extension, pidfile[MAXPATHLEN];
 struct stat fstat;
@@ -679,12 +736,14 @@ int	c;
 	mcastgroup		= NULL;
 	pidfile[0]		= 0;
 	launch_process	= NULL;
+	rollup			= NULL;
 	userid 			= groupid = NULL;
 	twin	 		= TIME_WINDOW;
 	datadir	 		= NULL;
 	subdir_index	= 0;
 	time_extension	= "%Y%m%d%H%M";
 	expire			= 0;
+	live_mode		= 0;
 	spec_time_extension = 0;
 	compress		= NOT_COMPRESSED;
 	memset((void *)&peer, 0, sizeof(send_peer_t));
@@ -694,7 +753,7 @@ int	c;
 	extension_tags	= DefaultExtensions;
 	pcap_file		= NULL;
 
-	while ((c = getopt(argc, argv, "46ewhEVI:DB:b:f:jl:n:p:J:P:R:S:T:t:x:ru:g:zZ")) != EOF) {
+	while ((c = getopt(argc, argv, "46A:eLwhEVI:DB:b:f:jl:n:p:J:P:R:S:T:t:x:ru:g:z::Z")) != EOF) {
 		switch (c) {
 			case 'h':
 				usage(argv[0]);
@@ -706,9 +765,15 @@ int	c;
 			case 'g':
 				groupid  = optarg;
 				break;
+			case 'A':
+				rollup = optarg;
+				break;
 			case 'e':
 				expire = 1;
 				break;
+			case 'L':
+				live_mode = 1;
+				break;
 			case 'E':
 				verbose = 1;
 				break;
@@ -761,7 +826,9 @@ int	c;
 					LogError("Use one compression: -z for LZO, -j for BZ2 or -y for LZ4 compression\n");
 					exit(255);
 				}
-				compress = LZO_COMPRESSED;
+				compress = ParseCompression(optarg);
+				if ( compress < 0 )
+					exit(255);
 				break;
 			case 'B':
 				bufflen = strtol(optarg, &checkptr, 10);
@@ -875,6 +942,11 @@ int	c;
 		exit(255);
 	}
 
+	if ( rollup && spec_time_extension ) {
+		fprintf(stderr, "ERROR, -Z timezone extension breaks rollups -A\n");
+		exit(255);
+	}
+
 	InitExtensionMaps(NO_EXTENSION_LIST);
 	SetupExtensionDescriptors(strdup(extension_tags));
 
@@ -998,7 +1070,7 @@ int	c;
 	}
 
 	done = 0;
-	if ( launch_process || expire ) {
+	if ( launch_process || rollup || expire ) {
 		// for efficiency reason, the process collecting the data
 		// and the process launching processes, when a new file becomes
 		// available are separated. Communication is done using signals
@@ -1016,7 +1088,7 @@ int	c;
 			case 0:
 				// child
 				close(sock);
-				launcher((char *)shmem, FlowSource, launch_process, expire);
+				launcher((char *)shmem, FlowSource, launch_process, rollup, expire);
 				exit(0);
 				break;
 			case -1:
@@ -212,10 +212,11 @@ void Process_sflow(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
 SFSample 	sample;
 int 		exceptionVal;
 
-	memset(&sample, 0, sizeof(sample));
+	// no memset of the whole sample - readSFlowDatagram() resets the decode state per sample
 	sample.rawSample = in_buff;
 	sample.rawSampleLen = in_buff_cnt;
-	sample.sourceIP.s_addr = fs->sa_family == PF_INET ? htonl(fs->ip.V4) : 0;;
+	sample.readTimestamp = fs->received.tv_sec;
+	sample.sourceIP.s_addr = fs->sa_family == PF_INET ? htonl(fs->ip.V4) : 0;
 
 	dbg_printf("startDatagram =================================\n");
 	// catch SFABORT in sflow code
@@ -670,6 +671,7 @@ uint64_t _bytes, _packets, _t;	// tmp buffers
 	if ( verbose ) {
 		master_record_t master_record;
 		char	*string;
+		memset((void *)&master_record, 0, sizeof(master_record_t));
 		ExpandRecord_v2((common_record_t *)common_record, &exporter->sflow_extension_info[ip_flags], &(exporter->info), &master_record);
 	 	format_file_block_record(&master_record, &string, 0);
 		printf("%s\n", string);
@@ -52,6 +52,7 @@
 #include <time.h>
 #include <ctype.h>
 #include <setjmp.h>
+#include <stddef.h>
 
 #include <unistd.h>
 #include <netdb.h>
@@ -472,7 +473,7 @@ uint16_t type_len;
 	}
 
 	/* now we're just looking for IP */
-	if((end - start) < sizeof(struct myiphdr)) return; /* not enough for an IPv4 header (or IPX, or SNAP) */
+	if((end - ptr) < sizeof(struct myiphdr)) return; /* not enough for an IPv4 header (or IPX, or SNAP) */
 
 	/* peek for IPX */
 	if(type_len == 0x0200 || type_len == 0x0201 || type_len == 0x0600) {
@@ -646,46 +647,46 @@ uint8_t *ptr = start;
 static void decodeIPLayer4(SFSample *sample, uint8_t *ptr) {
 uint8_t *end = sample->header + sample->headerLen;
 
-	if(ptr > (end - 8)) {
+	// all header fields are read in place - check the bytes left, before reading any of them
+	if((end - ptr) < 8) {
 		/* not enough header bytes left */
 		return;
 	}
 
 	switch(sample->dcd_ipProtocol) {
-		case 1: { /* ICMP */
-			struct myicmphdr icmp;
-			memcpy(&icmp, ptr, sizeof(icmp));
-			dbg_printf("ICMPType %u\n", icmp.type);
-			dbg_printf("ICMPCode %u\n", icmp.code);
-			sample->dcd_sport = icmp.type;
-			sample->dcd_dport = icmp.code;
-			sample->offsetToPayload = ptr + sizeof(icmp) - sample->header;
-		} break;
-  		case 6: {/* TCP */
-			struct mytcphdr tcp;
-			int headerBytes;
-			memcpy(&tcp, ptr, sizeof(tcp));
-			sample->dcd_sport = ntohs(tcp.th_sport);
-			sample->dcd_dport = ntohs(tcp.th_dport);
-			sample->dcd_tcpFlags = tcp.th_flags;
+		case 1: /* ICMP */
+			sample->dcd_sport = ptr[0];	// type
+			sample->dcd_dport = ptr[1];	// code
+			dbg_printf("ICMPType %u\n", sample->dcd_sport);
+			dbg_printf("ICMPCode %u\n", sample->dcd_dport);
+			sample->offsetToPayload = ptr + sizeof(struct myicmphdr) - sample->header;
+			break;
+  		case 6: { /* TCP */
+			uint32_t headerBytes;
+			sample->dcd_sport = (ptr[0] << 8) + ptr[1];
+			sample->dcd_dport = (ptr[2] << 8) + ptr[3];
 			dbg_printf("TCPSrcPort %u\n", sample->dcd_sport);
 			dbg_printf("TCPDstPort %u\n",sample->dcd_dport);
+			if((end - ptr) < offsetof(struct mytcphdr, th_win))
+				/* ports only - the header got truncated */
+				return;
+			sample->dcd_tcpFlags = ptr[offsetof(struct mytcphdr, th_flags)];
 			dbg_printf("TCPFlags %u\n", sample->dcd_tcpFlags);
-			headerBytes = (tcp.th_off_and_unused >> 4) * 4;
+			headerBytes = (ptr[offsetof(struct mytcphdr, th_off_and_unused)] >> 4) * 4;
+			if((end - ptr) < headerBytes)
+				return;
 			ptr += headerBytes;
 			sample->offsetToPayload = ptr - sample->header;
-		} break;
-  		case 17: { /* UDP */
-			struct myudphdr udp;
-			memcpy(&udp, ptr, sizeof(udp));
-			sample->dcd_sport = ntohs(udp.uh_sport);
-			sample->dcd_dport = ntohs(udp.uh_dport);
-			sample->udp_pduLen = ntohs(udp.uh_ulen);
+			} break;
+  		case 17: /* UDP */
+			sample->dcd_sport = (ptr[0] << 8) + ptr[1];
+			sample->dcd_dport = (ptr[2] << 8) + ptr[3];
+			sample->udp_pduLen = (ptr[4] << 8) + ptr[5];
 			dbg_printf("UDPSrcPort %u\n", sample->dcd_sport);
 			dbg_printf("UDPDstPort %u\n", sample->dcd_dport);
 			dbg_printf("UDPBytes %u\n", sample->udp_pduLen);
-			sample->offsetToPayload = ptr + sizeof(udp) - sample->header;
-			} break;
+			sample->offsetToPayload = ptr + sizeof(struct myudphdr) - sample->header;
+			break;
   		default: /* some other protcol */
 			sample->offsetToPayload = ptr - sample->header;
 			break;
@@ -699,52 +700,54 @@ uint8_t *end = sample->header + sample->headerLen;
 */
 
 static void decodeIPV4(SFSample *sample) {
-
-	if(sample->gotIPV4) {
+uint8_t *end, *ptr;
+uint32_t headerBytes;
 #ifdef DEVEL
-		char buf[51];
+char buf[51];
 #endif
-		uint8_t *end = sample->header + sample->headerLen;
-		uint8_t *start = sample->header + sample->offsetToIPV4;
-		uint8_t *ptr = start;
-		if((end - ptr) < sizeof(struct myiphdr))
-			return;
 
-		/* Create a local copy of the IP header (cannot overlay structure in case it is not quad-aligned...some
-			 platforms would core-dump if we tried that).  It's OK coz this probably performs just as well anyway. */
-		struct myiphdr ip;
-		memcpy(&ip, ptr, sizeof(ip));
-		/* Value copy all ip elements into sample */
-    	sample->ipsrc.type = SFLADDRESSTYPE_IP_V4;
-    	sample->ipsrc.address.ip_v4.addr = ip.saddr;
-    	sample->ipdst.type = SFLADDRESSTYPE_IP_V4;
-    	sample->ipdst.address.ip_v4.addr = ip.daddr;
-		sample->dcd_srcIP.s_addr = ip.saddr;
-		sample->dcd_dstIP.s_addr = ip.daddr;
-		sample->dcd_ipProtocol = ip.protocol;
-		sample->dcd_ipTos = ip.tos;
-		sample->dcd_ipTTL = ip.ttl;
-		dbg_printf("ip.tot_len %d\n", ntohs(ip.tot_len));
-		/* Log out the decoded IP fields */
-		dbg_printf("srcIP %s\n", IP_to_a(sample->dcd_srcIP.s_addr, buf, 51));
-		dbg_printf("dstIP %s\n", IP_to_a(sample->dcd_dstIP.s_addr, buf, 51));
-		dbg_printf("IPProtocol %u\n", sample->dcd_ipProtocol);
-		dbg_printf("IPTOS %u\n", sample->dcd_ipTos);
-		dbg_printf("IPTTL %u\n", sample->dcd_ipTTL);
-		/* check for fragments */
-		sample->ip_fragmentOffset = ntohs(ip.frag_off) & 0x1FFF;
-		if(sample->ip_fragmentOffset > 0) {
-			dbg_printf("IPFragmentOffset %u\n", sample->ip_fragmentOffset);
-		} else {
-			dbg_printf("Unfragmented\n");
-			/* advance the pointer to the next protocol layer */
-			/* ip headerLen is expressed as a number of quads */
-      		uint32_t headerBytes = (ip.version_and_headerLen & 0x0f) * 4;
-      		if((end - ptr) < headerBytes) return;
-      		ptr += headerBytes;
-      		decodeIPLayer4(sample, ptr);
-		}
+	if(!sample->gotIPV4)
+		return;
+
+	end = sample->header + sample->headerLen;
+	ptr = sample->header + sample->offsetToIPV4;
+	if(ptr > end || (end - ptr) < sizeof(struct myiphdr))
+		return;
+
+	/* Read the fields in place - the byte offsets are those of struct myiphdr. The addresses
+	   are copied, as the header may not be quad-aligned in the datagram */
+	sample->ipsrc.type = SFLADDRESSTYPE_IP_V4;
+	memcpy(&sample->ipsrc.address.ip_v4.addr, ptr + offsetof(struct myiphdr, saddr), 4);
+	sample->ipdst.type = SFLADDRESSTYPE_IP_V4;
+	memcpy(&sample->ipdst.address.ip_v4.addr, ptr + offsetof(struct myiphdr, daddr), 4);
+	sample->dcd_srcIP.s_addr = sample->ipsrc.address.ip_v4.addr;
+	sample->dcd_dstIP.s_addr = sample->ipdst.address.ip_v4.addr;
+	sample->dcd_ipProtocol = ptr[offsetof(struct myiphdr, protocol)];
+	sample->dcd_ipTos = ptr[offsetof(struct myiphdr, tos)];
+	sample->dcd_ipTTL = ptr[offsetof(struct myiphdr, ttl)];
+	dbg_printf("ip.tot_len %d\n", (ptr[2] << 8) + ptr[3]);
+	/* Log out the decoded IP fields */
+	dbg_printf("srcIP %s\n", IP_to_a(sample->dcd_srcIP.s_addr, buf, 51));
+	dbg_printf("dstIP %s\n", IP_to_a(sample->dcd_dstIP.s_addr, buf, 51));
+	dbg_printf("IPProtocol %u\n", sample->dcd_ipProtocol);
+	dbg_printf("IPTOS %u\n", sample->dcd_ipTos);
+	dbg_printf("IPTTL %u\n", sample->dcd_ipTTL);
+	/* check for fragments */
+	sample->ip_fragmentOffset = ((ptr[6] << 8) + ptr[7]) & 0x1FFF;
+	if(sample->ip_fragmentOffset > 0) {
+		dbg_printf("IPFragmentOffset %u\n", sample->ip_fragmentOffset);
+		return;
 	}
+
+	dbg_printf("Unfragmented\n");
+	/* advance the pointer to the next protocol layer */
+	/* ip headerLen is expressed as a number of quads */
+	headerBytes = (ptr[0] & 0x0f) * 4;
+	if(headerBytes < sizeof(struct myiphdr) || (end - ptr) < headerBytes)
+		return;
+	ptr += headerBytes;
+	decodeIPLayer4(sample, ptr);
+
 } // End of decodeIPV4
 
 /*_________________---------------------------__________________
@@ -756,88 +759,90 @@ static void decodeIPV6(SFSample *sample) {
 uint16_t payloadLen;
 uint32_t label;
 uint32_t nextHeader;
+uint8_t *end, *ptr;
 
-uint8_t *end = sample->header + sample->headerLen;
-uint8_t *start = sample->header + sample->offsetToIPV6;
-uint8_t *ptr = start;
+	if(!sample->gotIPV6)
+		return;
 
-	if((end - ptr) < sizeof(struct myip6hdr))
+	end = sample->header + sample->headerLen;
+	ptr = sample->header + sample->offsetToIPV6;
+	if(ptr > end || (end - ptr) < sizeof(struct myip6hdr))
 		return;
 
-	if(sample->gotIPV6) {
-		int ipVersion = (*ptr >> 4);
-		if(ipVersion != 6) {
-			LogError("SFLOW: decodeIPV6() header decode error: unexpected IP version: %d\n", ipVersion);
-			return;
-		}
+	int ipVersion = (*ptr >> 4);
+	if(ipVersion != 6) {
+		LogError("SFLOW: decodeIPV6() header decode error: unexpected IP version: %d\n", ipVersion);
+		return;
+	}
 
-		// get the tos (priority)
-		sample->dcd_ipTos = *ptr++ & 15;
-		dbg_printf("IPTOS %u\n", sample->dcd_ipTos);
+	// get the tos (priority)
+	sample->dcd_ipTos = *ptr++ & 15;
+	dbg_printf("IPTOS %u\n", sample->dcd_ipTos);
 
-		// 24-bit label
-		label = *ptr++;
-		label <<= 8;
-		label += *ptr++;
-		label <<= 8;
-		label += *ptr++;
-		dbg_printf("IP6_label 0x%x\n", label);
+	// 24-bit label
+	label = *ptr++;
+	label <<= 8;
+	label += *ptr++;
+	label <<= 8;
+	label += *ptr++;
+	dbg_printf("IP6_label 0x%x\n", label);
 
-		// payload
-		payloadLen = (ptr[0] << 8) + ptr[1];
-		ptr += 2;
+	// payload
+	payloadLen = (ptr[0] << 8) + ptr[1];
+	ptr += 2;
 
-		// if payload is zero, that implies a jumbo payload
-		if(payloadLen == 0)
-			dbg_printf("IPV6_payloadLen <jumbo>\n");
-		else
-			dbg_printf("IPV6_payloadLen %u\n", payloadLen);
+	// if payload is zero, that implies a jumbo payload
+	if(payloadLen == 0)
+		dbg_printf("IPV6_payloadLen <jumbo>\n");
+	else
+		dbg_printf("IPV6_payloadLen %u\n", payloadLen);
 
-		// next header
-		nextHeader = *ptr++;
+	// next header
+	nextHeader = *ptr++;
 
-		// TTL
-		sample->dcd_ipTTL = *ptr++;
-		dbg_printf("IPTTL %u\n", sample->dcd_ipTTL);
+	// TTL
+	sample->dcd_ipTTL = *ptr++;
+	dbg_printf("IPTTL %u\n", sample->dcd_ipTTL);
 
-		{// src and dst address
+	{// src and dst address
 #ifdef DEVEL
-			char buf[101];
+		char buf[101];
 #endif
-			sample->ipsrc.type = SFLADDRESSTYPE_IP_V6;
-			memcpy(&sample->ipsrc.address, ptr, 16);
-			ptr +=16;
-			dbg_printf("srcIP6 %s\n", printAddress(&sample->ipsrc, buf, 100));
-			sample->ipdst.type = SFLADDRESSTYPE_IP_V6;
-			memcpy(&sample->ipdst.address, ptr, 16);
-			ptr +=16;
-			dbg_printf("dstIP6 %s\n", printAddress(&sample->ipdst, buf, 100));
-		}
+		sample->ipsrc.type = SFLADDRESSTYPE_IP_V6;
+		memcpy(&sample->ipsrc.address, ptr, 16);
+		ptr +=16;
+		dbg_printf("srcIP6 %s\n", printAddress(&sample->ipsrc, buf, 100));
+		sample->ipdst.type = SFLADDRESSTYPE_IP_V6;
+		memcpy(&sample->ipdst.address, ptr, 16);
+		ptr +=16;
+		dbg_printf("dstIP6 %s\n", printAddress(&sample->ipdst, buf, 100));
+	}
 
-		// skip over some common header extensions...
-		// http://searchnetworking.techtarget.com/originalContent/0,289142,sid7_gci870277,00.html
-		while(nextHeader == 0 ||  // hop
-				nextHeader == 43 || // routing
-				nextHeader == 44 || // fragment
-				// nextHeader == 50 || // encryption - don't bother coz we'll not be able to read any further
-				nextHeader == 51 || // auth
-				nextHeader == 60) { // destination options
-			uint32_t optionLen, skip;
-			dbg_printf("IP6HeaderExtension: %d\n", nextHeader);
-			nextHeader = ptr[0];
-			optionLen = 8 * (ptr[1] + 1);  // second byte gives option len in 8-byte chunks, not counting first 8
-			skip = optionLen - 2;
-			ptr += skip;
-			if(ptr > end)
-				return; // ran off the end of the header
-		}
-		
-		// now that we have eliminated the extension headers, nextHeader should have what we want to
-		// remember as the ip protocol...
-		sample->dcd_ipProtocol = nextHeader;
-		dbg_printf("IPProtocol %u\n", sample->dcd_ipProtocol);
-		decodeIPLayer4(sample, ptr);
+	// skip over some common header extensions...
+	// http://searchnetworking.techtarget.com/originalContent/0,289142,sid7_gci870277,00.html
+	while(nextHeader == 0 ||  // hop
+			nextHeader == 43 || // routing
+			nextHeader == 44 || // fragment
+			// nextHeader == 50 || // encryption - don't bother coz we'll not be able to read any further
+			nextHeader == 51 || // auth
+			nextHeader == 60) { // destination options
+		uint32_t optionLen;
+		dbg_printf("IP6HeaderExtension: %d\n", nextHeader);
+		if((end - ptr) < 8)
+			return; // not enough bytes left for the extension header
+		nextHeader = ptr[0];
+		optionLen = 8 * (ptr[1] + 1);  // second byte gives option len in 8-byte chunks, not counting first 8
+		if((end - ptr) < optionLen)
+			return; // ran off the end of the header
+		ptr += optionLen;
 	}
+	
+	// now that we have eliminated the extension headers, nextHeader should have what we want to
+	// remember as the ip protocol...
+	sample->dcd_ipProtocol = nextHeader;
+	dbg_printf("IPProtocol %u\n", sample->dcd_ipProtocol);
+	decodeIPLayer4(sample, ptr);
+
 } // End of decodeIPV6
 
 
@@ -1503,11 +1508,13 @@ static void readFlowSample_header(SFSample *sample)
   
   sample->header = (uint8_t *)sample->datap; /* just point at the header */
   skipBytes(sample, sample->headerLen);
+#ifdef DEVEL
   {
     char scratch[2000];
     printHex(sample->header, sample->headerLen, scratch, 2000, 0, 2000);
     dbg_printf("headerBytes %s\n", scratch);
   }
+#endif
   
   switch(sample->headerProtocol) {
     /* the header protocol tells us where to jump into the decode */
@@ -3284,6 +3291,24 @@ static void readRTFlow(SFSample *sample, FlowSource_t *fs, int verbose)
 
 #endif
 
+/*_________________---------------------------__________________
+	_________________		resetSample				 __________________
+	-----------------___________________________------------------
+*/
+
+/*
+ * Reset the per sample decode state from sampledPacketSize up to the BGP info.
+ * This covers all fields StoreSflowRecord() and writeFlowLine() read, so no value
+ * of a previous sample leaks into the next one. The exception context, the datagram
+ * header and the large user/url buffers are not touched.
+ */
+static inline void resetSample(SFSample *sample) {
+
+	memset((void *)&sample->sampledPacketSize, 0, 
+		offsetof(SFSample, communities_len) - offsetof(SFSample, sampledPacketSize));
+
+} // End of resetSample
+
 /*_________________---------------------------__________________
   _________________    readFlowSample_v2v4    __________________
   -----------------___________________________------------------
@@ -3464,6 +3489,31 @@ uint8_t *sampleStart;
 			length = getData32(sample);
 			start = (uint8_t *)sample->datap;
 
+#ifndef DEVEL
+			if ( !verbose ) {
+				// fast path: decode the elements, which feed StoreSflowRecord() - skip all others
+				switch(tag) {
+				case SFLFLOW_HEADER:		 readFlowSample_header(sample); break;
+				case SFLFLOW_ETHERNET:	 readFlowSample_ethernet(sample, ""); break;
+				case SFLFLOW_IPV4:			 readFlowSample_IPv4(sample, ""); break;
+				case SFLFLOW_IPV6:			 readFlowSample_IPv6(sample, ""); break;
+				case SFLFLOW_EX_SWITCH:	readExtendedSwitch(sample); break;
+				case SFLFLOW_EX_ROUTER:	readExtendedRouter(sample); break;
+				case SFLFLOW_EX_GATEWAY: readExtendedGateway(sample); break;
+				case SFLFLOW_EX_SOCKET4: readExtendedSocket4(sample); break;
+				case SFLFLOW_EX_SOCKET6: readExtendedSocket6(sample); break;
+				case SFLFLOW_EX_L2_TUNNEL_OUT: readFlowSample_ethernet(sample, ""); break;
+				case SFLFLOW_EX_L2_TUNNEL_IN: readFlowSample_ethernet(sample, ""); break;
+				case SFLFLOW_EX_IPV4_TUNNEL_OUT: readFlowSample_IPv4(sample, ""); break;
+				case SFLFLOW_EX_IPV4_TUNNEL_IN: readFlowSample_IPv4(sample, ""); break;
+				case SFLFLOW_EX_IPV6_TUNNEL_OUT: readFlowSample_IPv6(sample, ""); break;
+				case SFLFLOW_EX_IPV6_TUNNEL_IN: readFlowSample_IPv6(sample, ""); break;
+				default: skipBytes(sample, length); break;
+				}
+				lengthCheck(sample, "flow_sample_element", start, length);
+				continue;
+			}
+#endif
 			switch(tag) {
 			case SFLFLOW_HEADER:		 readFlowSample_header(sample); break;
 			case SFLFLOW_ETHERNET:	 readFlowSample_ethernet(sample, ""); break;
@@ -3552,7 +3602,8 @@ uint32_t samplesInPacket, samp;
 	if(sample->datagramVersion >= 5) {
 		sample->agentSubId = getData32(sample);
 		dbg_printf("agentSubId %u\n", sample->agentSubId);
-	}
+	} else
+		sample->agentSubId = 0;
 
 	sample->sequenceNo = getData32(sample);	/* this is the packet sequence number */
 	sample->sysUpTime = getData32(sample);
@@ -3569,6 +3620,7 @@ uint32_t samplesInPacket, samp;
 			return;
 		}
 		/* just read the tag, then call the approriate decode fn */
+		resetSample(sample);
 		sample->elementType = 0;
 		sample->sampleType	= getData32(sample);
 		dbg_printf("startSample ----------------------\n");
@@ -65,10 +65,7 @@ diff -u test2.out nfdump.test.out
 rm -r test1.out test2.out
 
 # create tmp dir for flow replay
-if [ -d tmp ]; then
-	rm -f tmp/*
-	rmdir tmp
-fi
+rm -rf tmp
 mkdir tmp
 
 # Start nfcapd on localhost and replay flows
@@ -115,6 +112,172 @@ export MallocCorruptionAbort=1
 ./nfdump -r test.flows -w test-2.flows 'host  172.16.14.18'
 ./nfdump -r test.flows -O tstart -w test-2.flows 'host  172.16.14.18'
 ./nfanon -K abcdefghijklmnopqrstuvwxyz012345 -r test.flows -w anon.flows
+./nfanon -K abcdefghijklmnopqrstuvwxyz012345 -r test.flows -w test-anon.flows -W 2
+cmp anon.flows test-anon.flows
+./nfdump -r test.flows -q -o "jsonl:%ts %sa %da %byt" > test6.out
+test `wc -l < test6.out` -eq `./nfdump -r test.flows -q -o line | wc -l`
+# a key has the same JSON type in all records - ports are strings, counters numbers
+./nfdump -r test.flows -q -o "jsonl:%sa %da %sp %dp %pr %pkt %byt %td" > test6.out
+grep -qxF '{"sa":"172.16.1.66","da":"192.168.170.100","sp":"1024","dp":"25","pr":"6","pkt":202,"byt":303,"td":10.010}' test6.out
+grep -qxF '{"sa":"172.16.13.66","da":"192.168.170.112","sp":"0","dp":"0.8","pr":"1","pkt":50002,"byt":50000,"td":140.010}' test6.out
+# partial results of two sites merged must match the query over all flows
+mkdir -p tmp/site1 tmp/site2
+./nfdump -r test.flows -s ip/bytes -s dstport:p --partial tmp/site1/partial.flows 'proto tcp'
+./nfdump -r test.flows -s ip/bytes -s dstport:p --partial tmp/site2/partial.flows 'not proto tcp'
+./nfdump -M tmp/site1:site2 -r partial.flows --merge-partials -s ip/bytes -s dstport:p -q -n 0 | sort > test7.out
+./nfdump -r test.flows -s ip/bytes -s dstport:p -q -n 0 | sort > test8.out
+diff -u test7.out test8.out
+./nfdump -r test.flows -A srcip,proto --partial tmp/site1/partial.flows 'proto tcp'
+./nfdump -r test.flows -A srcip,proto --partial tmp/site2/partial.flows 'not proto tcp'
+./nfdump -M tmp/site1:site2 -r partial.flows --merge-partials -A srcip,proto -q | sort > test7.out
+./nfdump -r test.flows -A srcip,proto -q | sort > test8.out
+diff -u test7.out test8.out
+# partials aggregated by other keys or without flow table must be rejected
+if ./nfdump -M tmp/site1:site2 -r partial.flows --merge-partials -A dstport -q > /dev/null; then
+	echo Merged partials with different aggregation keys
+	exit 255
+fi
+./nfdump -r test.flows -s srcip --partial tmp/site1/partial.flows
+if ./nfdump -r tmp/site1/partial.flows --merge-partials -A srcip -q > /dev/null; then
+	echo Merged partial without flow table
+	exit 255
+fi
+rm -rf tmp/site1 tmp/site2
+# nfprofile filter threads must write the same channel files as the single threaded 
+# profiler. The nfdump 1.5.x block in front of the test records is skipped.
+if [ -x ./nfprofile ]; then
+	./nfgen -1 > test-v1.flows
+	for p in st mt; do
+		mkdir -p tmp/$p/grp/prof/any tmp/$p/grp/prof/tcp
+		echo 'any' > tmp/$p/grp/prof/any-filter.txt
+		echo 'proto tcp' > tmp/$p/grp/prof/tcp-filter.txt
+	done
+	printf 'grp#prof#0#any#*\ngrp#prof#0#tcp#*\n' | ./nfprofile -I -p `pwd`/tmp/st -r `pwd`/test-v1.flows -t 1089535800
+	printf 'grp#prof#0#any#*\ngrp#prof#0#tcp#*\n' | ./nfprofile -I -p `pwd`/tmp/mt -r `pwd`/test-v1.flows -t 1089535800 -W 2
+	./nfdump -r tmp/st/grp/prof/any/test-v1.flows -q -o raw > test7.out
+	./nfdump -r tmp/mt/grp/prof/any/test-v1.flows -q -o raw > test8.out
+	diff -u test7.out test8.out
+	test `./nfdump -r test-v1.flows -q -o line | wc -l` -eq `./nfdump -r test.flows -q -o line | wc -l`
+	test `grep -c 'Flow Record' test8.out` -eq `./nfdump -r test.flows -q -o line | wc -l`
+	./nfdump -r tmp/st/grp/prof/tcp/test-v1.flows -q -o raw > test7.out
+	./nfdump -r tmp/mt/grp/prof/tcp/test-v1.flows -q -o raw > test8.out
+	diff -u test7.out test8.out
+	rm -rf tmp/st tmp/mt
+fi
+# nfrepack recompresses and merges several files of a data dir at the same time.
+# No record may get lost and the books must match a rescan of the directory
+mkdir -p tmp/rp
+./nfgen -n 1000 -D 1500 -t 300 -l tmp/rp
+./nfexpire -r tmp/rp > /dev/null
+./nfdump -R tmp/rp -q -o "fmt:%ts %te %sa %da %sp %dp %pkt %byt" > test7.out
+test `wc -l < test7.out` -eq 1000
+./nfrepack -R tmp/rp -J lz4 -W 3
+./nfdump -R tmp/rp -q -o "fmt:%ts %te %sa %da %sp %dp %pkt %byt" > test8.out
+diff -u test7.out test8.out
+./nfrepack -R tmp/rp -m 2 -W 3
+./nfdump -R tmp/rp -q -o "fmt:%ts %te %sa %da %sp %dp %pkt %byt" > test8.out
+diff -u test7.out test8.out
+test `ls tmp/rp | wc -l` -eq 3
+./nfexpire -l tmp/rp > test7.out
+cp tmp/rp/.nfcatalog test7.catalog
+./nfexpire -r tmp/rp > /dev/null
+./nfexpire -l tmp/rp > test8.out
+diff -u test7.out test8.out
+cmp test7.catalog tmp/rp/.nfcatalog
+rm -rf tmp/rp test7.catalog
+# statistics answered from the rollups must match the statistics of the flow files. The
+# range 12:15 - 13:55 reads the flow files of hour 12 and the rollup of hour 13
+mkdir -p tmp/ru
+./nfgen -n 3000 -T 201907101130 -D 10800 -t 300 -l tmp/ru
+./nfrollup -A srcip,dstport,proto -l tmp/ru -R tmp/ru
+for r in tmp/ru tmp/ru/nfcapd.201907101215:nfcapd.201907101355; do
+	for q in "-s srcip" "-s dstport/bytes" "-A srcip,proto"; do
+		./nfdump -R $r $q -q -n 0 | sort > test7.out
+		./nfdump -R $r $q -q -n 0 --no-rollup | sort > test8.out
+		diff -u test7.out test8.out
+	done
+done
+./nfdump -R tmp/ru -s srcip | grep -q 'Rollup files replaced 36 flow files'
+./nfdump -R tmp/ru/nfcapd.201907101215:nfcapd.201907101355 -s srcip | grep -q 'Rollup files replaced 12 flow files'
+rm -rf tmp/ru
+# nfpcapd must not crash, if a flow expires before its reverse flow. No packet may get lost
+if [ -x ./nfpcapd ]; then
+	./nfgen -c test.pcap
+	for e in 10,10 10,5 60,30; do
+		mkdir -p tmp/pcap
+		./nfpcapd -r test.pcap -l tmp/pcap -e $e > /dev/null
+		test `./nfdump -R tmp/pcap -q -o "fmt:%pkt" | awk '{ s += $1 } END { print s }'` -eq 900
+		rm -rf tmp/pcap
+	done
+	rm -f test.pcap
+fi
+# sfcapd must decode the ports behind IPv6 extension headers and of truncated TCP headers.
+# Without -E only the elements needed for the records are decoded - the records must not change
+if [ -x ./sfcapd ]; then
+	port=`expr 30000 + $$ % 20000`
+	for e in "" -E; do
+		mkdir -p tmp/sflow
+		./sfcapd -p $port -l tmp/sflow -P tmp/sfcapd.pid $e > /dev/null &
+		sfcapd=$!
+		i=0
+		while [ ! -f tmp/sfcapd.pid ] && [ $i -lt 10 ]; do
+			sleep 1
+			i=`expr $i + 1`
+		done
+		./nfgen -F -H 127.0.0.1 -p $port
+		sleep 1
+		kill -TERM $sfcapd
+		wait $sfcapd
+		./nfdump -R tmp/sflow -q -o "fmt:%sa %da %sp %dp %pr" | awk '{ print $1, $2, $3, $4, $5 }' > test8.out
+		[ -z "$e" ] && mv test8.out test7.out
+		rm -rf tmp/sflow
+	done
+	diff -u test7.out test8.out
+	grep -qxF '2001:db8::1 2001:db8::2 1111 2222 TCP' test7.out
+	grep -qxF '10.47.0.1 10.47.0.2 3333 4444 TCP' test7.out
+	grep -qxF '2001:db8::3 2001:db8::4 5555 6666 TCP' test7.out
+	grep -qxF '2001:db8::5 2001:db8::6 0 0 0' test7.out
+	test `wc -l < test7.out` -eq 5
+fi
+# nfdump --follow must print the same flows as the files of the collector, also across
+# a file rotation. The collector rotates after 60s - the smallest interval of nfcapd file names
+mkdir -p tmp/live
+port=`expr 30000 + $$ % 20000 + 1`
+./nfcapd -p $port -T all -l tmp/live -t 60 -L -D -P tmp/nfcapd.pid
+i=0
+while [ ! -f tmp/live/.nflive ] && [ $i -lt 10 ]; do
+	sleep 1
+	i=`expr $i + 1`
+done
+./nfdump --follow tmp/live -q -o "fmt:%ts %te %sa %da %sp %dp %pkt %byt" > test7.out &
+follow=$!
+./nfgen -n 5000 -H 127.0.0.1 -p $port
+i=0
+while [ -z "`ls tmp/live | grep '^nfcapd\.[0-9]'`" ] && [ $i -lt 90 ]; do
+	sleep 1
+	i=`expr $i + 1`
+done
+./nfgen -n 5000 -s 2 -H 127.0.0.1 -p $port
+kill -TERM `cat tmp/nfcapd.pid`
+i=0
+while [ -f tmp/nfcapd.pid ] && [ $i -lt 10 ]; do
+	sleep 1
+	i=`expr $i + 1`
+done
+test `ls tmp/live | grep -c '^nfcapd\.[0-9]'` -eq 2
+# UDP packets may get lost - compare with the flows, the collector received
+./nfdump -R tmp/live -q -o "fmt:%ts %te %sa %da %sp %dp %pkt %byt" > test8.out
+test `wc -l < test8.out` -gt 0
+i=0
+while [ `wc -l < test7.out` -lt `wc -l < test8.out` ] && [ $i -lt 10 ]; do
+	sleep 1
+	i=`expr $i + 1`
+done
+kill -INT $follow
+wait $follow
+sort test7.out > test9.out
+sort test8.out | diff -u test9.out -
+rm -rf tmp/live
 ./nfdump -J 0 -r test.flows
 ./nfdump -J 1 -r test.flows
 ./nfdump -J 2 -r test.flows
@@ -124,6 +287,24 @@ export MallocCorruptionAbort=1
 ./nfdump -J 0 -r test.flows
 ./nfdump -q -r test.flows -o raw > test2.out
 diff -u test2.out nfdump.test.out
+# zstd levels and dictionaries - only if nfdump is built with zstd
+if grep -q '^#define HAVE_ZSTD 1' ../config.h; then
+	for l in 1 19; do
+		./nfdump -r test.flows -z=zstd:$l -w test-zstd.flows
+		./nfdump -q -r test-zstd.flows -o raw > test2.out
+		diff -u test2.out nfdump.test.out
+	done
+	# an uncompressed flow file is a valid raw content dictionary. The dictionary is
+	# stored in the file, so the file must be larger than the dictionary
+	./nfdump -r test.flows -z=none -w test-dict.flows
+	./nfdump -r test.flows -z=zstd:3:test-dict.flows -w test-zstd.flows
+	test `wc -c < test-zstd.flows` -gt `wc -c < test-dict.flows`
+	./nfdump -q -r test-zstd.flows -o raw > test2.out
+	diff -u test2.out nfdump.test.out
+	./nfdump -J lzo -r test-zstd.flows
+	./nfdump -q -r test-zstd.flows -o raw > test2.out
+	diff -u test2.out nfdump.test.out
+fi
 rm -f tmp/nfcapd.* test*.out test*.flows
 [ -d tmp ] && rmdir tmp
 [ -d memck.$$ ] && rm -rf  memck.$$
@@ -0,0 +1,274 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifdef HAVE_CONFIG_H 
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "util.h"
+#include "tpacket.h"
+
+#ifdef HAVE_TPACKET_V3
+
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <net/ethernet.h>
+#include <linux/filter.h>
+
+tpacket_ring_t *OpenTPacketRing(char *device, struct bpf_program *filter, int fanout_group) {
+tpacket_ring_t *ring;
+struct tpacket_req3 req;
+struct sockaddr_ll sll;
+struct packet_mreq mreq;
+struct ifreq ifr;
+int fd, version, ifindex;
+
+	ifindex = if_nametoindex(device);
+	if ( ifindex == 0 ) {
+		LogError("Unknown device %s: %s", device, strerror(errno));
+		return NULL;
+	}
+
+	fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if ( fd < 0 ) {
+		LogError("socket() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+		return NULL;
+	}
+
+	// only ethernet like devices are supported
+	memset((void *)&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, device, IFNAMSIZ-1);
+	if ( ioctl(fd, SIOCGIFHWADDR, &ifr) < 0 ) {
+		LogError("ioctl() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	if ( ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER && ifr.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK ) {
+		LogError("Unsupported hardware type %u of device %s", ifr.ifr_hwaddr.sa_family, device);
+		close(fd);
+		return NULL;
+	}
+
+	version = TPACKET_V3;
+	if ( setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ) {
+		LogError("setsockopt(PACKET_VERSION) error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	// the filter also cuts the packets to snaplen
+	if ( filter ) {
+		struct sock_fprog prog;
+		prog.len	= filter->bf_len;
+		prog.filter = (struct sock_filter *)filter->bf_insns;
+		if ( setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0 ) {
+			LogError("setsockopt(SO_ATTACH_FILTER) error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+			close(fd);
+			return NULL;
+		}
+	}
+
+	memset((void *)&req, 0, sizeof(req));
+	req.tp_block_size	  = RING_BLOCKSIZE;
+	req.tp_block_nr		  = RING_BLOCKNUM;
+	req.tp_frame_size	  = RING_FRAMESIZE;
+	req.tp_frame_nr		  = (RING_BLOCKSIZE * RING_BLOCKNUM) / RING_FRAMESIZE;
+	req.tp_retire_blk_tov = RING_BLOCKTIMEOUT;
+	if ( setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0 ) {
+		LogError("setsockopt(PACKET_RX_RING) error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	ring = (tpacket_ring_t *)calloc(1, sizeof(tpacket_ring_t));
+	if ( !ring ) {
+		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	ring->fd		 = fd;
+	ring->block_size = req.tp_block_size;
+	ring->block_num	 = req.tp_block_nr;
+	ring->block		 = 0;
+	ring->map_size	 = (size_t)req.tp_block_size * req.tp_block_nr;
+	ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+	if ( ring->map == MAP_FAILED ) 
+		// locked memory may be limited - try again without
+		ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if ( ring->map == MAP_FAILED ) {
+		LogError("mmap() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+		close(fd);
+		free(ring);
+		return NULL;
+	}
+
+	memset((void *)&sll, 0, sizeof(sll));
+	sll.sll_family	 = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex	 = ifindex;
+	if ( bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0 ) {
+		LogError("bind() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+		CloseTPacketRing(ring);
+		return NULL;
+	}
+
+	memset((void *)&mreq, 0, sizeof(mreq));
+	mreq.mr_ifindex = ifindex;
+	mreq.mr_type	= PACKET_MR_PROMISC;
+	if ( setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ) {
+		LogError("setsockopt(PACKET_ADD_MEMBERSHIP) error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+	}
+
+	if ( fanout_group >= 0 ) {
+		// both directions of a flow hash to the same ring. Fragments are reassembled
+		// by the kernel, so all fragments of a packet end up in the same ring
+		int fanout = (fanout_group & 0xffff) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+		if ( setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0 ) {
+			LogError("setsockopt(PACKET_FANOUT) error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+			CloseTPacketRing(ring);
+			return NULL;
+		}
+	}
+
+	return ring;
+
+} // End of OpenTPacketRing
+
+/*
+ * Process the next block of the ring. Wait at most timeout ms for a block.
+ * Returns the number of packets processed, 0 on timeout or -1 on error.
+ */
+int TPacketProcess(pcap_dev_t *pcap_dev, NodeList_t *NodeList, int timeout) {
+tpacket_ring_t *ring = pcap_dev->ring;
+struct tpacket_block_desc *block;
+struct tpacket3_hdr *ppd;
+struct pcap_pkthdr hdr;
+uint32_t i, num_pkts;
+
+	block = (struct tpacket_block_desc *)(ring->map + (size_t)ring->block * ring->block_size);
+	if ( (block->hdr.bh1.block_status & TP_STATUS_USER) == 0 ) {
+		struct pollfd pfd;
+		pfd.fd		= ring->fd;
+		pfd.events	= POLLIN | POLLERR;
+		pfd.revents = 0;
+		if ( poll(&pfd, 1, timeout) < 0 ) {
+			if ( errno == EINTR ) 
+				return 0;
+			LogError("poll() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+			return -1;
+		}
+		if ( (block->hdr.bh1.block_status & TP_STATUS_USER) == 0 ) 
+			return 0;
+	}
+
+	num_pkts = block->hdr.bh1.num_pkts;
+	ppd = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+	for ( i=0; i<num_pkts; i++ ) {
+		hdr.ts.tv_sec  = ppd->tp_sec;
+		hdr.ts.tv_usec = ppd->tp_nsec / 1000;
+		hdr.caplen	   = ppd->tp_snaplen;
+		hdr.len		   = ppd->tp_len;
+		ProcessPacket(NodeList, pcap_dev, &hdr, (u_char *)ppd + ppd->tp_mac);
+		ppd = (struct tpacket3_hdr *)((uint8_t *)ppd + ppd->tp_next_offset);
+	}
+
+	// hand the block back to the kernel
+	__sync_synchronize();
+	block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	ring->block = (ring->block + 1) % ring->block_num;
+
+	return num_pkts;
+
+} // End of TPacketProcess
+
+int TPacketStat(tpacket_ring_t *ring, uint32_t *packets, uint32_t *drops) {
+struct tpacket_stats_v3 stats;
+socklen_t len = sizeof(stats);
+
+	// the kernel resets the counters with each call
+	if ( getsockopt(ring->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) < 0 ) {
+		LogError("getsockopt(PACKET_STATISTICS) error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+		return 0;
+	}
+	*packets = stats.tp_packets;
+	*drops	 = stats.tp_drops;
+
+	return 1;
+
+} // End of TPacketStat
+
+void CloseTPacketRing(tpacket_ring_t *ring) {
+
+	if ( !ring )
+		return;
+
+	munmap(ring->map, ring->map_size);
+	close(ring->fd);
+	free(ring);
+
+} // End of CloseTPacketRing
+
+#else
+
+tpacket_ring_t *OpenTPacketRing(char *device, struct bpf_program *filter, int fanout_group) {
+
+	LogError("TPACKET_V3 capture not supported on this system");
+	return NULL;
+
+} // End of OpenTPacketRing
+
+int TPacketProcess(pcap_dev_t *pcap_dev, NodeList_t *NodeList, int timeout) {
+	return -1;
+} // End of TPacketProcess
+
+int TPacketStat(tpacket_ring_t *ring, uint32_t *packets, uint32_t *drops) {
+	return 0;
+} // End of TPacketStat
+
+void CloseTPacketRing(tpacket_ring_t *ring) {
+} // End of CloseTPacketRing
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2018, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _TPACKET_H
+#define _TPACKET_H 1
+
+#ifdef HAVE_CONFIG_H 
+#include "config.h"
+#endif
+
+#ifdef HAVE_LINUX_IF_PACKET_H
+#include <linux/if_packet.h>
+#ifdef TPACKET3_HDRLEN
+#define HAVE_TPACKET_V3 1
+#endif
+#endif
+
+#include <sys/types.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include <pcap.h>
+
+#include "flowtree.h"
+#include "pcaproc.h"
+
+/*
+ * AF_PACKET TPACKET_V3 mmap ring. Multiple rings joined into the same
+ * fanout group share the packets of a device, balanced by the flow hash.
+ */
+
+// ring geometry: 64 blocks of 1MB per ring
+#define RING_BLOCKSIZE		(1 << 20)
+#define RING_BLOCKNUM		64
+#define RING_FRAMESIZE		2048
+#define RING_BLOCKTIMEOUT	100		// ms to retire a partially filled block
+
+typedef struct tpacket_ring_s {
+	int			fd;
+	uint8_t		*map;
+	size_t		map_size;
+	uint32_t	block_size;
+	uint32_t	block_num;
+	uint32_t	block;			// next block to read
+} tpacket_ring_t;
+
+tpacket_ring_t *OpenTPacketRing(char *device, struct bpf_program *filter, int fanout_group);
+
+int TPacketProcess(pcap_dev_t *pcap_dev, NodeList_t *NodeList, int timeout);
+
+int TPacketStat(tpacket_ring_t *ring, uint32_t *packets, uint32_t *drops);
+
+void CloseTPacketRing(tpacket_ring_t *ring);
+
+#endif //_TPACKET_H
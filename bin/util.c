@@ -56,6 +56,7 @@
 #endif
 
 #include "util.h"
+#include "output_util.h"
 
 /* Global vars */
 
@@ -529,7 +530,7 @@ void format_number(uint64_t num, char *s, int scale, int fixed_width) {
 double f = num;
 
 	if ( !scale ) {
-		snprintf(s, 31, "%llu", (long long unsigned)num);
+		AppendUint(s, num);
 	} else {
 
 		if ( f >= _1TB ) {
@@ -548,10 +549,11 @@ double f = num;
 			else 
 				snprintf(s, NUMBER_STRING_SIZE-1, "%.1f M", f / _1MB );
 		} else  {
+			// f < 1M is an exact integer - same as "%4.0f" or "%.0f"
 			if ( fixed_width ) 
-				snprintf(s, NUMBER_STRING_SIZE-1, "%4.0f", f );
+				AppendUintPadded(s, num, 4, 0);
 			else 
-				snprintf(s, NUMBER_STRING_SIZE-1, "%.0f", f );
+				AppendUint(s, num);
 		} 
 		s[NUMBER_STRING_SIZE-1] = '\0';
 	}
@@ -114,6 +114,8 @@ void SetupInputFileSequence(char *multiple_dirs, char *single_file, char *multip
 
 char *GetCurrentFilename(void);
 
+stringlist_t *GetInputFileList(void);
+
 void Setv6Mode(int mode);
 
 #endif //_UTIL_H
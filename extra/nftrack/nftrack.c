@@ -67,6 +67,7 @@
 #include "nfx.h"
 #include "util.h"
 #include "grammar.h"
+#include "nfscan.h"
 
 #include "nftrack_stat.h"
 #include "nftrack_rrd.h"
@@ -92,12 +93,13 @@ static void usage(char *name);
 
 static int CheckRunningOnce(char *pidfile);
 
+static int track_flow(void *data, common_record_t *flow_record, master_record_t *master_record, 
+	extension_info_t *extension_info);
+
 static data_row *process(char *filter);
 
 /* Functions */
 
-#include "nffile_inline.c"
-
 static void usage(char *name) {
 		printf("usage %s [options] [\"filter\"]\n"
 					"-h\t\tthis text you see right here\n"
@@ -166,23 +168,28 @@ char pidstr[32];
 
 } // End of CheckRunningOnce
 
+static int track_flow(void *data, common_record_t *flow_record, master_record_t *master_record, 
+	extension_info_t *extension_info) {
+data_row *port_table = (data_row *)data;
+
+	// Add to stat record
+	if ( master_record->prot == 6 ) {
+		port_table[master_record->dstport].proto[tcp].type[flows]++;
+		port_table[master_record->dstport].proto[tcp].type[packets]	+= master_record->dPkts;
+		port_table[master_record->dstport].proto[tcp].type[bytes]	+= master_record->dOctets;
+	} else if ( master_record->prot == 17 ) {
+		port_table[master_record->dstport].proto[udp].type[flows]++;
+		port_table[master_record->dstport].proto[udp].type[packets]	+= master_record->dPkts;
+		port_table[master_record->dstport].proto[udp].type[bytes]	+= master_record->dOctets;
+	}
+
+	return SCAN_CONTINUE;
+
+} // End of track_flow
+
 static data_row *process(char *filter) {
-master_record_t		master_record;
-common_record_t		*flow_record;
-nffile_t	*nffile;
-int i, done, ret;
+scan_t		scan;
 data_row * 	port_table;
-uint64_t total_bytes; 
-
-	nffile = GetNextFile(NULL, 0, 0);
-	if ( !nffile ) {
-		LogError("GetNextFile() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-		return NULL;
-	}
-	if ( nffile == EMPTY_LIST ) {
-		LogError("Empty file list. No files to process\n");
-		return NULL;
-	}
 
 	port_table    = (data_row *)calloc(65536, sizeof(data_row));
     if ( !port_table) {
@@ -190,114 +197,16 @@ uint64_t total_bytes;
         return NULL;
     }
 
-    memset((void *)port_table, 0, 65536 * sizeof(data_row));
-
-	// setup Filter Engine to point to master_record, as any record read from file
-	// is expanded into this record
-	Engine->nfrecord = (uint64_t *)&master_record;
-
-	total_bytes = 0;
-	done	 	= 0;
-	while ( !done ) {
-
-		// get next data block from file
-		ret = ReadBlock(nffile);
-
-        switch (ret) {
-            case NF_CORRUPT:
-            case NF_ERROR:
-                if ( ret == NF_CORRUPT ) 
-                    LogError("Skip corrupt data file '%s'\n",GetCurrentFilename());
-                else 
-                    LogError("Read error in file '%s': %s\n",GetCurrentFilename(), strerror(errno) );
-                // fall through - get next file in chain
-            case NF_EOF: {
-				nffile_t *next = GetNextFile(nffile, 0, 0);
-				if ( next == EMPTY_LIST ) {
-					done = 1;
-				}
-				if ( next == NULL ) {
-					done = 1;
-					LogError("Unexpected end of file list\n");
-				}
-				// else continue with next file
-				continue;
-
-                } break; // not really needed
-            default:
-                // successfully read block
-                total_bytes += ret;
-        }
-
-		if ( nffile->block_header->id == Large_BLOCK_Type ) {
-			// skip
-			continue;
-		}
+	memset((void *)&scan, 0, sizeof(scan_t));
+	scan.engine				= Engine;
+	scan.extension_map_list	= extension_map_list;
+	scan.data				= (void *)port_table;
+	scan.flow				= track_flow;
 
-		if ( nffile->block_header->id != DATA_BLOCK_TYPE_2 ) {
-			LogError("Can't process block type %u\n", nffile->block_header->id);
-			continue;
-		}
-
-		flow_record = nffile->buff_ptr;
-
-		for ( i=0; i < nffile->block_header->NumRecords; i++ ) {
-			int			ret;
-
-			switch ( flow_record->type ) {
-				case CommonRecordV0Type:
-				case CommonRecordType: {
-                	if ( extension_map_list->slot[flow_record->ext_map] == NULL ) {
-                    	LogError("Corrupt data file! No such extension map id: %u. Skip record", flow_record->ext_map );
-                	} else {
-                    	ExpandRecord_v2( flow_record, extension_map_list->slot[flow_record->ext_map], NULL, &master_record);
-            
-   						ret = (*Engine->FilterEngine)(Engine);
-
-						if ( ret == 0 ) { // record failed to pass the filter
-							// increment pointer by number of bytes for netflow record
-							flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);	
-							// go to next record
-							continue;
-						}
-
-
-						// Add to stat record
-						if ( master_record.prot == 6 ) {
-							port_table[master_record.dstport].proto[tcp].type[flows]++;
-							port_table[master_record.dstport].proto[tcp].type[packets]	+= master_record.dPkts;
-							port_table[master_record.dstport].proto[tcp].type[bytes]	+= master_record.dOctets;
-						} else if ( master_record.prot == 17 ) {
-							port_table[master_record.dstport].proto[udp].type[flows]++;
-							port_table[master_record.dstport].proto[udp].type[packets]	+= master_record.dPkts;
-							port_table[master_record.dstport].proto[udp].type[bytes]	+= master_record.dOctets;
-						}
-             		}
-				} break;
-				case ExtensionMapType: {
-                	extension_map_t *map = (extension_map_t *)flow_record;
-
-                	if ( Insert_Extension_Map(extension_map_list, map) ) {
-                     		// flush new map
-                	} // else map already known and flushed
-				} break;
-				case ExporterInfoRecordType:
-				case ExporterStatRecordType:
-				case SamplerInfoRecordype:
-						// Silently skip exporter records
-					break;
-				default: {
-					LogError("Skip unknown record type %i\n", flow_record->type);
-				}
-            }
-
-			// Advance pointer by number of bytes for netflow record
-			flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);	
-		}
-	} // while
-
-	CloseFile(nffile);
-	DisposeFile(nffile);
+	if ( !ScanFiles(&scan) ) {
+		free(port_table);
+		return NULL;
+	}
 
 	PackExtensionMapList(extension_map_list);
 